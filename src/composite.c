@@ -0,0 +1,600 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Composite cwdevice forwarding changes of lines to several child
+/// cwdevices. See composite.h.
+///
+/// Each child has a bounded queue of commands and its own thread executing
+/// the commands. Producers (keying I/O thread) never wait for a child: if
+/// queue of a child is full, the command is dropped, and the child is
+/// brought to the latest state of its lines as soon as its queue has been
+/// drained.
+///
+/// Threads of children are started by first command posted to the
+/// composite device, not by composite_init(): cwdevice is initialized
+/// while command line options are parsed, before cwdaemon forks, and
+/// threads are not inherited by the child process.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "composite.h"
+#include "cwdaemon.h"
+#include "log.h"
+#include "rt.h"
+
+
+
+
+typedef enum {
+	COMPOSITE_CMD_CW,
+	COMPOSITE_CMD_PTT,
+	COMPOSITE_CMD_SSBWAY,
+	COMPOSITE_CMD_BAND,
+	COMPOSITE_CMD_RESET,
+} composite_cmd_t;
+
+
+
+
+typedef struct {
+	composite_cmd_t cmd;
+	int value;
+} composite_slot_t;
+
+
+
+
+typedef struct {
+	cwdevice * dev;
+
+	pthread_t thread;
+	bool thread_running;
+	bool thread_failed;  ///< Commands are executed by producers, because the thread couldn't be started.
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	composite_slot_t slots[COMPOSITE_QUEUE_SIZE];
+	unsigned int head;   ///< Position of next command to be executed.
+	unsigned int tail;   ///< Position of next free slot.
+	bool stopping;
+
+	/// Latest requested states of lines, applied after an overrun of the
+	/// queue. -1 for a line whose state is not known.
+	int latest[COMPOSITE_CMD_RESET];
+	bool resync;
+	uint64_t overruns;   ///< Count of commands dropped because the queue was full.
+} composite_child_t;
+
+
+
+
+struct composite_s {
+	composite_child_t children[COMPOSITE_CHILDREN_MAX];
+	unsigned int count;
+
+	/// Child from which input lines (footswitch, paddles) are read. NULL
+	/// if no child has input lines.
+	cwdevice * input_child;
+};
+
+
+
+
+/// Children probed by composite_probe_cwdevice(), waiting for
+/// composite_init().
+static cwdevice * g_composite_pending[COMPOSITE_CHILDREN_MAX];
+static unsigned int g_composite_pending_count = 0;
+
+
+
+
+static void composite_release_pending(void);
+static void composite_release_child(cwdevice * child);
+static void composite_post(cwdevice * dev, composite_cmd_t cmd, int value);
+static void composite_execute(cwdevice * child, composite_cmd_t cmd, int value);
+static void composite_start_thread(composite_child_t * c);
+static void * composite_thread_fn(void * arg);
+static void composite_update_inputs(cwdevice * dev);
+static int composite_footswitch(cwdevice * dev);
+static int composite_paddles(cwdevice * dev);
+static int composite_wait_input(cwdevice * dev);
+
+
+
+
+int composite_probe_cwdevice(const char * fname, composite_child_factory_t factory)
+{
+	if (NULL == strchr(fname, COMPOSITE_SEPARATOR)) {
+		return -1;
+	}
+
+	composite_release_pending();
+
+	char * names = strdup(fname);
+	if (NULL == names) {
+		log_error("Failed to allocate memory for name of composite cwdevice [%s]", fname);
+		return -1;
+	}
+
+	char * saveptr = NULL;
+	char const separators[] = { COMPOSITE_SEPARATOR, '\0' };
+	for (char * name = strtok_r(names, separators, &saveptr); name; name = strtok_r(NULL, separators, &saveptr)) {
+		if (g_composite_pending_count == COMPOSITE_CHILDREN_MAX) {
+			log_error("Too many children of composite cwdevice [%s], max is %d", fname, COMPOSITE_CHILDREN_MAX);
+			goto failure;
+		}
+		cwdevice * const child = factory(name);
+		if (NULL == child) {
+			log_error("Invalid child [%s] of composite cwdevice [%s]", name, fname);
+			goto failure;
+		}
+		g_composite_pending[g_composite_pending_count++] = child;
+	}
+	if (g_composite_pending_count < 2) {
+		log_error("Composite cwdevice [%s] needs at least two children", fname);
+		goto failure;
+	}
+
+	free(names);
+	return 0;
+
+ failure:
+	free(names);
+	composite_release_pending();
+	return -1;
+}
+
+
+
+
+int composite_init(cwdevice * dev, __attribute__((unused)) int fd)
+{
+	struct composite_s * const composite = calloc(1, sizeof (struct composite_s));
+	if (NULL == composite) {
+		log_error("Failed to allocate memory for composite cwdevice [%s]", dev->desc);
+		composite_release_pending();
+		return -1;
+	}
+	dev->fd = -1;
+	dev->latency_us = 0;
+
+	for (unsigned int i = 0; i < g_composite_pending_count; i++) {
+		composite_child_t * const c = &composite->children[composite->count++];
+		c->dev = g_composite_pending[i];
+		for (int line = 0; line < COMPOSITE_CMD_RESET; line++) {
+			c->latest[line] = -1;
+		}
+		if (c->dev->init && 0 != c->dev->init(c->dev, c->dev->fd)) {
+			log_error("Failed to initialize child [%s] of composite cwdevice", c->dev->desc);
+		}
+
+		// The device is as slow as its fastest child: latency is used to
+		// shorten PTT delay, and no child may get PTT delay shorter than
+		// requested.
+		if (0 == i || c->dev->latency_us < dev->latency_us) {
+			dev->latency_us = c->dev->latency_us;
+		}
+
+		// The thread is started by composite_post().
+		pthread_mutex_init(&c->mutex, NULL);
+		pthread_cond_init(&c->cond, NULL);
+	}
+	g_composite_pending_count = 0;
+
+	dev->composite = composite;
+	composite_update_inputs(dev);
+
+	return 0;
+}
+
+
+
+
+int composite_free(cwdevice * dev)
+{
+	struct composite_s * const composite = dev->composite;
+	if (NULL == composite) {
+		return 0;
+	}
+
+	for (unsigned int i = 0; i < composite->count; i++) {
+		composite_child_t * const c = &composite->children[i];
+		if (c->thread_running) {
+			// The thread executes all pending commands before exiting.
+			pthread_mutex_lock(&c->mutex);
+			c->stopping = true;
+			pthread_cond_signal(&c->cond);
+			pthread_mutex_unlock(&c->mutex);
+			pthread_join(c->thread, NULL);
+			c->thread_running = false;
+		}
+		pthread_mutex_destroy(&c->mutex);
+		pthread_cond_destroy(&c->cond);
+
+		if (c->overruns) {
+			log_warning("Child [%s] of composite cwdevice: %llu command(s) dropped because of slow I/O",
+			            c->dev->desc, (unsigned long long) c->overruns);
+		}
+		if (c->dev->free) {
+			c->dev->free(c->dev);
+		}
+		composite_release_child(c->dev);
+	}
+
+	free(composite);
+	dev->composite = NULL;
+	composite_update_inputs(dev);
+
+	return 0;
+}
+
+
+
+
+int composite_reset_pins_state(cwdevice * dev)
+{
+	composite_post(dev, COMPOSITE_CMD_RESET, 0);
+	return 0;
+}
+
+
+
+
+int composite_cw(cwdevice * dev, int onoff)
+{
+	composite_post(dev, COMPOSITE_CMD_CW, onoff);
+	return 0;
+}
+
+
+
+
+int composite_ptt(cwdevice * dev, int onoff)
+{
+	composite_post(dev, COMPOSITE_CMD_PTT, onoff);
+	return 0;
+}
+
+
+
+
+int composite_ssbway(cwdevice * dev, int onoff)
+{
+	composite_post(dev, COMPOSITE_CMD_SSBWAY, onoff);
+	return 0;
+}
+
+
+
+
+int composite_switchband(cwdevice * dev, unsigned char bitpattern)
+{
+	composite_post(dev, COMPOSITE_CMD_BAND, bitpattern);
+	return 0;
+}
+
+
+
+
+int composite_optparse(cwdevice * dev, const char * option)
+{
+	struct composite_s * const composite = dev->composite;
+	if (NULL == composite) {
+		return -1;
+	}
+
+	unsigned int accepted = 0;
+	for (unsigned int i = 0; i < composite->count; i++) {
+		cwdevice * const child = composite->children[i].dev;
+		if (NULL == child->options.optparse) {
+			continue;
+		}
+		if (0 != child->options.optparse(child, option)) {
+			return -1;
+		}
+		accepted++;
+	}
+	if (0 == accepted) {
+		log_error("None of children of composite cwdevice [%s] supports options", dev->desc);
+		return -1;
+	}
+
+	// Options may have assigned input lines of a child.
+	composite_update_inputs(dev);
+
+	return 0;
+}
+
+
+
+
+int composite_optvalidate(cwdevice * dev)
+{
+	struct composite_s * const composite = dev->composite;
+	if (NULL == composite) {
+		return 0;
+	}
+
+	for (unsigned int i = 0; i < composite->count; i++) {
+		cwdevice * const child = composite->children[i].dev;
+		if (child->options.optvalidate && 0 != child->options.optvalidate(child)) {
+			return -1;
+		}
+	}
+
+	// Some drivers configure input lines only during validation.
+	composite_update_inputs(dev);
+
+	return 0;
+}
+
+
+
+
+/// @brief Close and deallocate children that were probed but not initialized
+static void composite_release_pending(void)
+{
+	for (unsigned int i = 0; i < g_composite_pending_count; i++) {
+		cwdevice * const child = g_composite_pending[i];
+		if (child->fd >= 0) {
+			close(child->fd);
+		}
+		composite_release_child(child);
+	}
+	g_composite_pending_count = 0;
+
+	return;
+}
+
+
+
+
+static void composite_release_child(cwdevice * child)
+{
+	free(child->desc);
+	free(child);
+
+	return;
+}
+
+
+
+
+/// @brief Add a command to queue of each child
+///
+/// The function never waits for I/O of a child.
+static void composite_post(cwdevice * dev, composite_cmd_t cmd, int value)
+{
+	struct composite_s * const composite = dev->composite;
+	if (NULL == composite) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < composite->count; i++) {
+		composite_child_t * const c = &composite->children[i];
+
+		pthread_mutex_lock(&c->mutex);
+		if (!c->thread_running && !c->thread_failed) {
+			composite_start_thread(c);
+		}
+		if (c->thread_failed) {
+			pthread_mutex_unlock(&c->mutex);
+			composite_execute(c->dev, cmd, value);
+			continue;
+		}
+
+		if (COMPOSITE_CMD_RESET == cmd) {
+			c->latest[COMPOSITE_CMD_CW] = 0;
+			c->latest[COMPOSITE_CMD_PTT] = 0;
+		} else {
+			c->latest[cmd] = value;
+		}
+		if (c->tail - c->head == COMPOSITE_QUEUE_SIZE) {
+			c->overruns++;
+			c->resync = true;
+		} else {
+			composite_slot_t * const slot = &c->slots[c->tail & (COMPOSITE_QUEUE_SIZE - 1)];
+			slot->cmd = cmd;
+			slot->value = value;
+			c->tail++;
+		}
+		pthread_cond_signal(&c->cond);
+		pthread_mutex_unlock(&c->mutex);
+	}
+
+	return;
+}
+
+
+
+
+static void composite_execute(cwdevice * child, composite_cmd_t cmd, int value)
+{
+	switch (cmd) {
+	case COMPOSITE_CMD_CW:
+		child->cw(child, value);
+		break;
+	case COMPOSITE_CMD_PTT:
+		child->ptt(child, value);
+		break;
+	case COMPOSITE_CMD_SSBWAY:
+		if (child->ssbway) {
+			child->ssbway(child, value);
+		}
+		break;
+	case COMPOSITE_CMD_BAND:
+		if (child->switchband) {
+			child->switchband(child, (unsigned char) value);
+		}
+		break;
+	case COMPOSITE_CMD_RESET:
+	default:
+		child->reset_pins_state(child);
+		break;
+	}
+
+	return;
+}
+
+
+
+
+/// @brief Start thread executing commands of a child
+///
+/// Call with mutex of the child locked.
+static void composite_start_thread(composite_child_t * c)
+{
+	// Signals should be handled by main thread. The thread applies
+	// real-time profile by itself.
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int const retv = pthread_create(&c->thread, NULL, composite_thread_fn, c);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (0 != retv) {
+		// Commands for the child will be executed by producers.
+		log_error("Failed to start I/O thread of child [%s] of composite cwdevice: %s", c->dev->desc, strerror(retv));
+		c->thread_failed = true;
+	} else {
+		c->thread_running = true;
+	}
+
+	return;
+}
+
+
+
+
+/// @brief Thread executing commands of a single child
+static void * composite_thread_fn(void * arg)
+{
+	composite_child_t * const c = (composite_child_t *) arg;
+
+	rt_thread_apply("composite cwdevice I/O");
+	pthread_mutex_lock(&c->mutex);
+	for (;;) {
+		if (c->head != c->tail) {
+			composite_slot_t const slot = c->slots[c->head & (COMPOSITE_QUEUE_SIZE - 1)];
+			c->head++;
+			pthread_mutex_unlock(&c->mutex);
+			composite_execute(c->dev, slot.cmd, slot.value);
+			pthread_mutex_lock(&c->mutex);
+
+		} else if (c->resync) {
+			// Some commands were dropped. Bring lines of the child to
+			// latest requested states.
+			int latest[COMPOSITE_CMD_RESET];
+			memcpy(latest, c->latest, sizeof (latest));
+			c->resync = false;
+			pthread_mutex_unlock(&c->mutex);
+			for (int line = 0; line < COMPOSITE_CMD_RESET; line++) {
+				if (-1 != latest[line]) {
+					composite_execute(c->dev, (composite_cmd_t) line, latest[line]);
+				}
+			}
+			pthread_mutex_lock(&c->mutex);
+
+		} else if (c->stopping) {
+			break;
+
+		} else {
+			pthread_cond_wait(&c->cond, &c->mutex);
+		}
+	}
+	pthread_mutex_unlock(&c->mutex);
+
+	return NULL;
+}
+
+
+
+
+/// @brief Select child from which input lines are read
+static void composite_update_inputs(cwdevice * dev)
+{
+	struct composite_s * const composite = dev->composite;
+	cwdevice * input_child = NULL;
+	if (composite) {
+		for (unsigned int i = 0; i < composite->count; i++) {
+			cwdevice * const child = composite->children[i].dev;
+			if (child->footswitch || child->paddles) {
+				input_child = child;
+				break;
+			}
+		}
+		composite->input_child = input_child;
+	}
+
+	dev->footswitch = (input_child && input_child->footswitch) ? composite_footswitch : NULL;
+	dev->paddles = (input_child && input_child->paddles) ? composite_paddles : NULL;
+	dev->wait_input = (input_child && input_child->wait_input) ? composite_wait_input : NULL;
+
+	return;
+}
+
+
+
+
+static int composite_footswitch(cwdevice * dev)
+{
+	cwdevice * const child = dev->composite->input_child;
+	return child->footswitch(child);
+}
+
+
+
+
+static int composite_paddles(cwdevice * dev)
+{
+	cwdevice * const child = dev->composite->input_child;
+	return child->paddles(child);
+}
+
+
+
+
+static int composite_wait_input(cwdevice * dev)
+{
+	cwdevice * const child = dev->composite->input_child;
+	int const retv = child->wait_input(child);
+	__atomic_store_n(&dev->input_event_ns, __atomic_load_n(&child->input_event_ns, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	return retv;
+}
+
@@ -0,0 +1,103 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_COMPOSITE_H
+#define CWDAEMON_COMPOSITE_H
+
+
+
+
+/// @file
+///
+/// Composite cwdevice: forwards keying, PTT, SSB way, band switch and reset
+/// of pins to several child cwdevices at once.
+///
+/// The composite device is selected with names of children joined with
+/// '+', e.g. "-d ttyUSB0+record:/dev/shm/cwdaemon.rec". Each child has its
+/// own I/O thread and queue of commands, so a slow child (e.g. a
+/// USB-to-UART converter) doesn't delay changes of lines on other
+/// children. Input lines (footswitch, paddles) are read from first child
+/// that has them. Options passed with "-o" are forwarded to all children
+/// that accept options.
+
+
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+
+#define COMPOSITE_SEPARATOR     '+'
+#define COMPOSITE_CHILDREN_MAX  4
+#define COMPOSITE_QUEUE_SIZE    64u /**< Size of queue of commands of a child. Must be a power of two. */
+
+
+
+
+struct cwdev_s;
+
+
+
+
+/// @brief Create a child cwdevice from its name
+///
+/// The function is provided by owner of cwdevice types. It returns
+/// allocated and probed, but not initialized, cwdevice with its "fd" and
+/// "desc" set.
+///
+/// @return child cwdevice on success
+/// @return NULL if @p desc doesn't name a valid cwdevice
+typedef struct cwdev_s * (* composite_child_factory_t)(char const * desc);
+
+
+
+
+/// @brief Try opening children of a composite cwdevice with given device name
+///
+/// On success the children are kept aside until the composite device is
+/// initialized with composite_init().
+///
+/// @param[in] fname Names of children separated with COMPOSITE_SEPARATOR
+/// @param[in] factory Function creating a child from its name
+///
+/// @return 0 on success
+/// @return -1 if @p fname doesn't name a composite cwdevice, or on failure
+int composite_probe_cwdevice(const char * fname, composite_child_factory_t factory);
+
+int composite_init(struct cwdev_s * dev, int fd);
+int composite_free(struct cwdev_s * dev);
+/// Reset pins of cwdevice to initial states
+int composite_reset_pins_state(struct cwdev_s * dev);
+int composite_cw(struct cwdev_s * dev, int onoff);
+int composite_ptt(struct cwdev_s * dev, int onoff);
+int composite_ssbway(struct cwdev_s * dev, int onoff);
+int composite_switchband(struct cwdev_s * dev, unsigned char bitpattern);
+int composite_optparse(struct cwdev_s * dev, const char * option);
+int composite_optvalidate(struct cwdev_s * dev);
+
+
+
+
+#endif /* #ifndef CWDAEMON_COMPOSITE_H */
+
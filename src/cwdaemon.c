@@ -80,22 +80,42 @@
 #include <errno.h>
 #include <inttypes.h> /* PRI* format specifiers. */
 #include <limits.h>
+#include <pthread.h>
 #include <stdint.h> /* uint32_t */
 #include <stdio.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
+#if HAVE_LIBCW
 #include <libcw.h>
 #include <libcw_debug.h>
+#endif
 
+#include "composite.h"
 #include "cwdaemon.h"
+#include "engine.h"
+#include "engine_native.h"
+#include "gpio.h"
+#include "handoff.h"
 #include "help.h"
+#include "iambic.h"
+#include "input.h"
+#include "keying_io.h"
 #include "log.h"
+#include "notify.h"
 #include "options.h"
+#include "recorder.h"
+#include "rt.h"
+#include "sidetone.h"
 #include "sleep.h"
 #include "socket.h"
+#include "sound.h"
+#include "trace.h"
 #include "ttys.h"
 #include "utils.h"
+#include "vclock.h"
+#include "winkeyer.h"
 
 
 
@@ -132,6 +152,8 @@
    driver option         -o, --options             N/A
    network port          -p, --port                9 (obsolete)
    process priority      -P, --priority            N/A
+   real-time priority    --rt-priority             N/A
+   real-time CPUs        --rt-cpus                 N/A
    Morse speed (wpm)     -s, --wpm                 2
    PTT delay             -t, --pttdelay            d
    PTT keying on/off     N/A                       a
@@ -140,9 +162,20 @@
    Morse weighting       -w, --weighting           7
    sound tone            -T, --tone                3
    debug verbosity       -i                        N/A
-   debug verbosity       -y, --verbosity           N/A
+   debug verbosity       -y, --verbosity           i
    libcw debug flags     -I, --libcwflags          N/A
    debug output          -f, --debugfile           N/A
+   binary trace file     --tracefile               N/A
+   keying engine         --keyer                   N/A
+   paddles keyer mode    --paddles                 N/A
+   idle suspension       --idle-suspend            N/A
+   native sidetone sink  --sidetone                N/A
+   readiness notice      --ready-fd                N/A
+   lazy start            --lazy-start              N/A
+   extra keying channel  --channel                 N/A
+   Unix-domain socket    --unix-socket             N/A
+   UDP receive buffer    --udp-rcvbuf              N/A
+   Unix receive buffer   --unix-rcvbuf             N/A
 
    reset parameters      N/A                       0
    abort message         N/A                       4
@@ -167,11 +200,13 @@
 
 
 /* cwdaemon constants. */
+#if HAVE_LIBCW
 #define CWDAEMON_AUDIO_SYSTEM_DEFAULT      CW_AUDIO_CONSOLE /* Console buzzer, from libcw.h. */
+#else
+#define CWDAEMON_AUDIO_SYSTEM_DEFAULT      CW_AUDIO_NULL    /* Without libcw there is no sidetone. */
+#endif
 #define CWDAEMON_LOG_THRESHOLD_DEFAULT LOG_WARNING // Default threshold of priority of debug messages.
 
-#define CWDAEMON_REQUEST_QUEUE_SIZE_MAX 4000 /* Maximal size of common buffer/fifo where requests may be pushed to. */
-
 #define CWDAEMON_TUNE_SECONDS_MAX  10 /* Maximal time of tuning. TODO: why the limitation to 10 s? Is it enough? */
 
 
@@ -194,15 +229,8 @@ static options_t g_default_options = {
 };
 
 
-/* Actual values of parameters, used to control ongoing operation of
-   cwdaemon+libcw. These values can be modified through requests
-   received from socket in cwdaemon_receive(). */
-static int current_morse_speed  = CWDAEMON_MORSE_SPEED_DEFAULT;
-static int current_morse_tone   = CWDAEMON_MORSE_TONE_DEFAULT;
-static int current_morse_volume = CWDAEMON_MORSE_VOLUME_DEFAULT;
-static unsigned int g_current_ptt_delay_ms    = CWDAEMON_PTT_DELAY_DEFAULT; /* [milliseconds] */
-static int current_audio_system = CWDAEMON_AUDIO_SYSTEM_DEFAULT;
-static int current_weighting    = CWDAEMON_MORSE_WEIGHTING_DEFAULT;
+/* Actual values of parameters (other than log threshold) are members
+   of cwdaemon_t: each keying channel has its own. */
 options_t g_current_options = {
 	.log_threshold   = CWDAEMON_LOG_THRESHOLD_DEFAULT,
 };
@@ -210,7 +238,7 @@ options_t g_current_options = {
 /* Level of libcw's tone queue that triggers 'callback for low level
    in tone queue'.  The callback function is
    cwdaemon_tone_queue_low_callback(), it is registered with
-   cw_register_tone_queue_low_callback().
+   g_channel->engine->register_tone_queue_low_callback().
 
    I REALLY don't think that you would want to set it to any value
    other than '1'. */
@@ -221,28 +249,41 @@ static const int tq_low_watermark = 1;
    characters received from client, it crashes.  It doesn't know that
    it attempts to play to closed audio output.
 
-   This is a flag telling cwdaemon if audio output is available or not.
+   cwdaemon_t::has_audio_output is a flag telling cwdaemon if audio
+   output is available or not.
 
    TODO: the variable is almost unused. Start using it.
 
    TODO: decide on terminology: "audio system" or "sound system". */
-static bool has_audio_output = false;
 
 
-// Internally (but outside sendto() code) cwdaemon treats contents of reply
-// buffer as C string, therefore we need +1 for terminating NUL.
+// Main keying channel, configured with regular command line options.
 //
 // TODO (acerion) 2024.03.10: start treating the reply buffer always (in
 // entire code) as array of bytes with explicit count of bytes.
-static char reply_buffer[CWDAEMON_REPLY_SIZE_MAX + 1];
-
-
-// There is only one instance of cwdaemon object per process.
 static cwdaemon_t g_cwdaemon = {
+	.channel = 0,
 	.socket_descriptor = -1,
+	.unix_socket_descriptor = -1,
 	.network_port = CWDAEMON_NETWORK_PORT_DEFAULT,
+	.morse_speed  = CWDAEMON_MORSE_SPEED_DEFAULT,
+	.morse_tone   = CWDAEMON_MORSE_TONE_DEFAULT,
+	.morse_volume = CWDAEMON_MORSE_VOLUME_DEFAULT,
+	.ptt_delay_ms = CWDAEMON_PTT_DELAY_DEFAULT, /* [milliseconds] */
+	.audio_system = CWDAEMON_AUDIO_SYSTEM_DEFAULT,
+	.weighting    = CWDAEMON_MORSE_WEIGHTING_DEFAULT,
+	.stop_pipe    = { -1, -1 },
 };
 
+// Extra keying channels added with "--channel" command line option.
+static cwdaemon_t * g_channels[CWDAEMON_CHANNELS_MAX];
+static unsigned int g_channels_count = 1; // Including main channel.
+
+// Channel served by current thread. Main thread (and threads that don't
+// serve any channel) use main channel. Thread of a channel, and keying
+// engine's thread calling back cwdaemon, set this to their channel.
+static __thread cwdaemon_t * g_channel = &g_cwdaemon;
+
 
 
 
@@ -258,28 +299,64 @@ char *cwdaemon_debug_f_path = NULL;
 // symbols in libcw.h for numeric values of the flags.
 static uint32_t g_libcw_debug_flags;
 
+#if HAVE_LIBCW
 // For debugging of libcw used by cwdaemon.
 extern cw_debug_t cw_debug_object;
+#endif
+
+// Path to binary trace file (see trace.h). NULL if tracing is disabled.
+static char const * g_trace_file_path = NULL;
+
+// Descriptor on which readiness is notified (see notify.h), or -1.
+static int g_ready_fd = -1;
+
+// Command line, used to start new process on hand-over (see handoff.h).
+static int g_argc = 0;
+static char ** g_argv = NULL;
+
+// Mode of keyer driven by paddles connected to cwdevice (see input.h).
+static iambic_mode_t g_paddles_mode = IAMBIC_MODE_NONE;
+// Input thread has been stopped for the time of re-opening keying engine.
+static bool g_input_paused = false;
+
+// Switch of sound system requested with SOUND_SYSTEM Escape request, waiting
+// for result of probe of the sound system (see sound.h).
+typedef struct {
+	struct sockaddr_storage reply_addr; // Client that has requested the switch.
+	socklen_t reply_addrlen;
+	char value[16];                // Value of the request, echoed in reply.
+	int audio_system;              // Requested sound system.
+	bool pending;                  // Is the switch waiting for result of probe?
+} sound_switch_t;
+static sound_switch_t g_sound_switch;
+
+// Idle suspension of keying engine: after g_idle_suspend_s seconds with
+// empty tone queue and PTT off, the engine (libcw's generator with its
+// thread and sound device) is closed. It's opened again when next request
+// arrives, or when footswitch is pressed.
+static unsigned int g_idle_suspend_s = CWDAEMON_IDLE_SUSPEND_DEFAULT;
+// Keying engine is opened on first request instead of at start (in
+// suspended state, see above).
+static bool g_lazy_start = false;
+// Time of start of cwdaemon, for reports of time to first request.
+static int64_t g_start_ns = 0;
+// Set by first request received by any channel (atomic).
+static bool g_request_received = false;
+static bool g_footswitch_pressed = false;
 
 
 
 
 /* Various variables. */
-static int wordmode = 0;               /* Start in character mode. */
 bool g_forking = true;                 /* We fork by default. */
 static int process_priority = 0;       /* Scheduling priority of cwdaemon process. */
+static rt_profile_t g_rt_profile = { 0 }; /* Real-time scheduling profile of keying threads. */
 static int async_abort = 0;            /* Unused variable. It is used in patches/cwdaemon-mt.patch though. */
-static int inactivity_seconds = 9999;  /* Inactive since nnn seconds. */
-
+static int inactivity_seconds = 9999;  /* Inactive since nnn seconds. Reset by keying engines' threads, so accessed atomically. */
 
-/* Incoming requests without Escape code are stored in this pseudo-FIFO
-   before they are played. */
-static char request_queue[CWDAEMON_REQUEST_QUEUE_SIZE_MAX];
 
 
-
-/* Flag for PTT state/behaviour. */
-static unsigned char ptt_flag = 0;
+/* Flags for PTT state/behaviour (cwdaemon_t::ptt_flag). */
 
 /* Automatically turn PTT on and off.
    Turn PTT on when starting to play Morse characters, and turn PTT off when
@@ -337,6 +414,10 @@ int  cwdaemon_receive(void);
 void cwdaemon_handle_escaped_request(cwdevice ** device, char *request);
 
 static int cwdaemon_reset_almost_all(cwdevice * dev);
+static void cwdaemon_reset_basic_params(void);
+static int cwdaemon_default_audio_system(void);
+static int cwdaemon_current_wpm(void);
+static int cwdaemon_current_tone(void);
 
 /* Functions managing cwdevices. */
 bool cwdaemon_cwdevices_init(void);
@@ -345,9 +426,26 @@ void cwdaemon_cwdevice_init(void);
 void cwdaemon_cwdevice_free(void);
 
 /* Functions managing libcw output. */
-bool cwdaemon_open_libcw_output(int audio_system);
-void cwdaemon_close_libcw_output(void);
-static int cwdaemon_reset_libcw_output(void);
+bool cwdaemon_open_keying_engine(int audio_system);
+void cwdaemon_close_keying_engine(void);
+static int cwdaemon_reset_keying_engine(bool reopen);
+static bool cwdaemon_engine_supports_audio_system(int audio_system);
+static void cwdaemon_configure_keying_engine(cwdevice * dev);
+static void cwdaemon_finish_sound_system_switch(void);
+static void cwdaemon_reply_sound_system_switch(sound_switch_t const * sw, bool success);
+static void cwdaemon_suspend_idle_keying_engine(void);
+static void cwdaemon_resume_keying_engine(char const * reason);
+static void cwdaemon_report_resume_stats(void);
+static int64_t cwdaemon_now_ns(void);
+static void cwdaemon_hand_over(void);
+
+/* Functions managing keying channels other than main channel. */
+static bool cwdaemon_channel_add(in_port_t port, char const * desc);
+static void cwdaemon_channels_start(void);
+static void cwdaemon_channels_stop(void);
+static keying_io_t * cwdaemon_keying_io_of_cwdevice(cwdevice const * dev);
+static void * cwdaemon_channel_thread(void * arg);
+static cwdevice * cwdaemon_cwdevice_new(char const * desc);
 
 
 
@@ -381,17 +479,24 @@ static bool cwdaemon_params_options(cwdevice * dev, const char *optarg);
 
 
 /* Auto, manual, echo. */
-static char cwdaemon_debug_ptt_flag[3 + 1];
+static __thread char cwdaemon_debug_ptt_flag[3 + 1];
 static const char *cwdaemon_debug_ptt_flags(void);
 
 void cwdaemon_catch_sigint(int signal);
 
+#if HAVE_LIBCW
 static void set_libcw_debugging(cw_debug_t * debug_object, int log_threshold, uint32_t flags);
+#endif
 
 
 // Will be initialized by tty_init_cwdevice().
 static cwdevice cwdevice_ttys;
 
+#if HAVE_LINUX_GPIO_H
+// Will be initialized by gpio_init_cwdevice().
+static cwdevice cwdevice_gpio;
+#endif
+
 cwdevice cwdevice_null = {
 	.init       = null_init,
 	.free       = null_free,
@@ -405,6 +510,49 @@ cwdevice cwdevice_null = {
 	.desc       = NULL
 };
 
+cwdevice cwdevice_recorder = {
+	.init       = recorder_init,
+	.free       = recorder_free,
+	.reset_pins_state = recorder_reset_pins_state,
+	.cw         = recorder_cw,
+	.ptt        = recorder_ptt,
+	.ssbway     = recorder_ssbway,
+	.switchband = recorder_switchband,
+	.footswitch = NULL,
+	.fd         = -1,
+	.desc       = NULL
+};
+
+cwdevice cwdevice_winkeyer = {
+	.init       = winkeyer_init,
+	.free       = winkeyer_free,
+	.reset_pins_state = winkeyer_reset_pins_state,
+	.cw         = winkeyer_cw,
+	.ptt        = winkeyer_ptt,
+	.ssbway     = NULL,
+	.switchband = NULL,
+	.footswitch = NULL,
+	.fd         = -1,
+	.desc       = NULL
+};
+
+cwdevice cwdevice_composite = {
+	.init       = composite_init,
+	.free       = composite_free,
+	.reset_pins_state = composite_reset_pins_state,
+	.cw         = composite_cw,
+	.ptt        = composite_ptt,
+	.ssbway     = composite_ssbway,
+	.switchband = composite_switchband,
+	.footswitch = NULL, // Set by composite_init() if a child has input lines.
+	.options    = {
+		.optparse    = composite_optparse,
+		.optvalidate = composite_optvalidate,
+	},
+	.fd         = -1,
+	.desc       = NULL
+};
+
 #if defined (HAVE_LINUX_PPDEV_H) || defined (HAVE_DEV_PPBUS_PPI_H)
 cwdevice cwdevice_lp = {
 	.init       = lp_init,
@@ -415,20 +563,23 @@ cwdevice cwdevice_lp = {
 	.ssbway     = lp_ssbway,
 	.switchband = lp_switchband,
 	.footswitch = lp_footswitch,
+	.paddles    = lp_paddles,
 	.fd         = 0,
+	.io         = &cwdevice_io_system,
 	.desc       = NULL
 };
 #endif
 
 
 
-/* Selected keying device:
-   serial port (cwdevice_ttys) || parallel port (cwdevice_lp) || null (cwdevice_null).
+/* Keying device of main channel (g_cwdaemon.cwdevice):
+   serial port (cwdevice_ttys) || parallel port (cwdevice_lp) || null (cwdevice_null)
+   || GPIO chip (cwdevice_gpio) || recording device (cwdevice_recorder)
+   || several of them (cwdevice_composite).
    It should be configured with cwdaemon_cwdevice_set(). */
 /* FIXME: if no device is specified in command line, and no physical
-   device is available, the global_cwdevice is NULL, which causes the
-   program to break. */
-static cwdevice *global_cwdevice = NULL;
+   device is available, the main channel's cwdevice is NULL, which
+   causes the program to break. */
 
 
 
@@ -447,19 +598,19 @@ void cwdaemon_catch_sigint(__attribute__((unused)) int signal)
 const char *cwdaemon_debug_ptt_flags(void)
 {
 
-	if (ptt_flag & PTT_ACTIVE_AUTO) {
+	if (g_channel->ptt_flag & PTT_ACTIVE_AUTO) {
 		cwdaemon_debug_ptt_flag[0] = 'A';
 	} else {
 		cwdaemon_debug_ptt_flag[0] = 'a';
 	}
 
-	if (ptt_flag & PTT_ACTIVE_MANUAL) {
+	if (g_channel->ptt_flag & PTT_ACTIVE_MANUAL) {
 		cwdaemon_debug_ptt_flag[1] = 'M';
 	} else {
 		cwdaemon_debug_ptt_flag[1] = 'm';
 	}
 
-	if (ptt_flag & PTT_ACTIVE_ECHO) {
+	if (g_channel->ptt_flag & PTT_ACTIVE_ECHO) {
 		cwdaemon_debug_ptt_flag[2] = 'E';
 	} else {
 		cwdaemon_debug_ptt_flag[2] = 'e';
@@ -523,7 +674,8 @@ void cwdaemon_switch_band(cwdevice * dev, unsigned int band)
 {
 	unsigned int bit_pattern = (band & 0x01) | ((band & 0x0e) << 4);
 	if (dev->switchband) {
-		dev->switchband(dev, bit_pattern);
+		/* Pins are changed only by keying I/O thread. */
+		keying_io_post(keying_io_instance(g_channel->channel), dev, KEYING_IO_PIN_BAND, (int) bit_pattern);
 		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "set band switch to %x", band);
 	} else {
 		cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "band switch output not implemented");
@@ -548,25 +700,41 @@ void cwdaemon_set_ptt_on(cwdevice * dev, const char *info)
 	/* For backward compatibility it is assumed that ptt_delay=0
 	   means "cwdaemon shouldn't turn PTT on, at all". */
 
-	if (g_current_ptt_delay_ms && !(ptt_flag & PTT_ACTIVE_AUTO)) {
-		dev->ptt(dev, ON);
+	if (g_channel->ptt_delay_ms && !(g_channel->ptt_flag & PTT_ACTIVE_AUTO) && g_channel->engine->set_ptt_timing) {
+		/* Keyer turns PTT on before keyed text, and waits for PTT
+		   delay (lead-in time) by itself. */
+		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "%s (by keying engine)", info);
+		g_channel->ptt_flag |= PTT_ACTIVE_AUTO;
+		cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag +PTT_ACTIVE_AUTO (0x%02x/%s)", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
+
+	} else if (g_channel->ptt_delay_ms && !(g_channel->ptt_flag & PTT_ACTIVE_AUTO)) {
+		keying_io_t * const io = keying_io_instance(g_channel->channel);
+		keying_io_post(io, dev, KEYING_IO_PIN_PTT, ON);
+		/* PTT delay is counted from actual change of PTT pin. */
+		keying_io_sync(io);
+		trace_event(TRACE_EVENT_PTT, ON, g_channel->ptt_flag);
 		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "%s", info);
 
 
 #if 0
-		int rv = cw_queue_tone(g_current_ptt_delay_ms * CWDAEMON_MICROSECS_PER_MILLISEC, 0);	/* try to 'enqueue' delay */
+		int rv = cw_queue_tone(g_channel->ptt_delay_ms * CWDAEMON_MICROSECS_PER_MILLISEC, 0);	/* try to 'enqueue' delay */
 		if (rv == CW_FAILURE) {	/* Old libcw may reject freq=0. */
 			cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__,
 				       "cw_queue_tone() failed: rv=%d errno=\"%s\", using udelay() instead",
 				       rv, strerror(errno));
-			millisleep_nonintr(g_current_ptt_delay_ms);
+			millisleep_nonintr(g_channel->ptt_delay_ms);
 		}
 #else
-		millisleep_nonintr(g_current_ptt_delay_ms);
+		/* The first key edge will reach the pin after latency of
+		   cwdevice, so that part of PTT delay passes anyway. */
+		unsigned int const delay_us = g_channel->ptt_delay_ms * CWDAEMON_MICROSECS_PER_MILLISEC;
+		if (delay_us > dev->latency_us) {
+			microsleep_nonintr(delay_us - dev->latency_us);
+		}
 #endif
 
-		ptt_flag |= PTT_ACTIVE_AUTO;
-		cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag +PTT_ACTIVE_AUTO (0x%02x/%s)", ptt_flag, cwdaemon_debug_ptt_flags());
+		g_channel->ptt_flag |= PTT_ACTIVE_AUTO;
+		cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag +PTT_ACTIVE_AUTO (0x%02x/%s)", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 	}
 
 	return;
@@ -584,9 +752,10 @@ void cwdaemon_set_ptt_on(cwdevice * dev, const char *info)
 */
 void cwdaemon_set_ptt_off(cwdevice * dev, const char *info)
 {
-	dev->ptt(dev, OFF);
-	ptt_flag = 0;
-	cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag = 0 (0x%02x/%s)", ptt_flag, cwdaemon_debug_ptt_flags());
+	keying_io_post(keying_io_instance(g_channel->channel), dev, KEYING_IO_PIN_PTT, OFF);
+	g_channel->ptt_flag = 0;
+	trace_event(TRACE_EVENT_PTT, OFF, g_channel->ptt_flag);
+	cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag = 0 (0x%02x/%s)", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 
 	cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "%s", info);
 
@@ -612,15 +781,15 @@ void cwdaemon_set_ptt_off(cwdevice * dev, const char *info)
 void cwdaemon_tune(uint32_t seconds)
 {
 	if (seconds > 0) {
-		cw_flush_tone_queue();
-		cwdaemon_set_ptt_on(global_cwdevice, "PTT (TUNE) on");
+		g_channel->engine->flush_tone_queue();
+		cwdaemon_set_ptt_on(g_channel->cwdevice, "PTT (TUNE) on");
 
 		/* make it similar to normal CW, allowing interrupt */
 		for (uint32_t i = 0; i < seconds; i++) {
-			cw_queue_tone(CWDAEMON_MICROSECS_PER_SEC, current_morse_tone);
+			g_channel->engine->queue_tone(CWDAEMON_MICROSECS_PER_SEC, g_channel->morse_tone);
 		}
 
-		cw_send_character('e');	/* append minimal tone to return to normal flow */
+		g_channel->engine->send_character('e');	/* append minimal tone to return to normal flow */
 	}
 
 	return;
@@ -635,7 +804,7 @@ void cwdaemon_tune(uint32_t seconds)
 
    TODO: split this function into:
    cwdaemon_reset_basic_params()
-   cwdaemon_reset_libcw_output()
+   cwdaemon_reset_keying_engine()
    and call these two functions separately instead of this one.
    This function that combines these two doesn't make much sense.
 
@@ -646,145 +815,768 @@ void cwdaemon_tune(uint32_t seconds)
 */
 static int cwdaemon_reset_almost_all(cwdevice * dev)
 {
-	current_morse_speed  = default_morse_speed;
-	current_morse_tone   = default_morse_tone;
-	current_morse_volume = default_morse_volume;
-	current_audio_system = default_audio_system;
-	g_current_ptt_delay_ms    = g_default_ptt_delay_ms;
-	current_weighting    = default_weighting;
-
-	/* Right now there is no way to alter current log_threshold after
-	   start of daemon, but it's easy to imagine a new network
-	   request to modify verbosity. Maybe not very useful (to
-	   change verbosity of debug strings displayed on remote
-	   machine), but during development phase it may be useful.
-
-	   Anyway... Right now there is no such request, but for
-	   consistency I'm resetting the log_threshold as well. */
-	g_current_options.log_threshold = g_default_options.log_threshold;
-
-	if (0 != cwdaemon_reset_libcw_output()) {
-		has_audio_output = false;
+	/* Generator needs to be re-opened only if it's not open yet, or
+	   if it uses other sound system than the default one (changed
+	   with SOUND_SYSTEM Escape request). */
+	bool const reopen = !g_channel->has_audio_output || g_channel->audio_system != cwdaemon_default_audio_system();
+
+	cwdaemon_reset_basic_params();
+
+	if (0 != cwdaemon_reset_keying_engine(reopen)) {
+		g_channel->has_audio_output = false;
 		return -1;
 	}
-	has_audio_output = true;
-
-#ifdef CWDAEMON_GITHUB_ISSUE_6_FIXED
-	cw_register_keying_callback(cwdaemon_keyingevent, dev);
-#endif
+	g_channel->has_audio_output = true;
+
+#ifdef CWDAEMON_GITHUB_ISSUE_6_FIXED
+	g_channel->engine->register_keying_callback(cwdaemon_keyingevent, dev);
+#endif
+
+	return 0;
+}
+
+
+
+
+
+/**
+   \brief Reset parameters of cwdaemon to default values
+
+   Only cwdaemon's 'current_' variables are reset. Keying engine is
+   configured with them in cwdaemon_reset_keying_engine() or when the
+   engine is resumed.
+*/
+static void cwdaemon_reset_basic_params(void)
+{
+	g_channel->morse_speed  = default_morse_speed;
+	g_channel->morse_tone   = default_morse_tone;
+	g_channel->morse_volume = default_morse_volume;
+	g_channel->audio_system = cwdaemon_default_audio_system();
+	g_channel->ptt_delay_ms    = g_default_ptt_delay_ms;
+	g_channel->weighting    = default_weighting;
+
+	/* log_threshold may have been changed with LOG_THRESHOLD Escape
+	   request. Reset it together with other parameters. The threshold
+	   is shared by all channels, so only main channel can reset it. */
+	if (0 == g_channel->channel) {
+		log_set_threshold(g_default_options.log_threshold);
+	}
+
+	return;
+}
+
+
+
+
+
+/**
+   \brief Get sound system used by keying engine of current channel after reset
+
+   Only main channel can have a sidetone. Keying engines of other
+   channels use "null" sound system.
+*/
+static int cwdaemon_default_audio_system(void)
+{
+	return 0 == g_channel->channel ? default_audio_system : CW_AUDIO_NULL;
+}
+
+
+
+
+
+/**
+   \brief Open audio sink using keying engine
+
+   \param audio_system - audio system to be used by keying engine
+
+   \return false on failure
+   \return true otherwise
+*/
+bool cwdaemon_open_keying_engine(int audio_system)
+{
+	bool const success = g_channel->engine->open(audio_system);
+
+	/* Resume keyer of paddles paused by cwdaemon_close_keying_engine(). */
+	if (g_input_paused) {
+		g_input_paused = false;
+		input_start(g_channel->cwdevice);
+	}
+
+	return success;
+}
+
+
+
+
+
+/**
+   \brief Check if current keying engine can produce sound on given audio system
+
+   Sidetone of "native" engine depends on sink given with --sidetone
+   command line option.
+
+   \param audio_system - audio system to check
+
+   \return true if the engine can use the audio system
+   \return false otherwise
+*/
+static bool cwdaemon_engine_supports_audio_system(int audio_system)
+{
+	if (CW_AUDIO_NULL == audio_system) {
+		return true;
+	}
+	if (g_channel->engine == &engine_native) {
+		return sidetone_supports_audio_system(audio_system);
+	}
+	return g_channel->engine->has_sidetone;
+}
+
+
+
+
+
+/**
+   \brief Close audio output of keying engine
+*/
+void cwdaemon_close_keying_engine(void)
+{
+	/* Keyer of paddles in input thread must not use the engine
+	   while the engine is being closed and re-opened. */
+	if (0 == g_channel->channel && input_is_running()) {
+		input_stop();
+		g_input_paused = true;
+	}
+
+	/* Suspended engine has been closed already. Following open
+	   will simply create a new generator. */
+	if (g_channel->engine_suspended) {
+		g_channel->engine_suspended = false;
+	} else {
+		g_channel->engine->close();
+	}
+
+	return;
+}
+
+
+
+
+
+/**
+   \brief Reset parameters of keying engine to default values
+
+   Function uses values of cwdaemon's global 'default_' variables, and some
+   other values to reset state of keying engine.
+
+   Re-opening of generator is expensive and audible: opening of sound
+   device of ALSA or PulseAudio takes hundreds of milliseconds, and often
+   produces a click. Clients send RESET Escape request e.g. at the start
+   of each session, so without @p reopen the running generator is reused:
+   only its tone queue is flushed, and its parameters are restored.
+
+   @param reopen delete the generator and create a new one
+
+   @return 0 on success
+   @return -1 on failure
+*/
+static int cwdaemon_reset_keying_engine(bool reopen)
+{
+	/* This function is called when cwdaemon receives '0' escape code.
+	   README describes this code as "Reset to default values".
+	   Therefore we use default_* below.
+
+	   However, the function is called after "current_" values
+	   have been reset to "default_" values. So maybe we could use
+	   "current_" values and somehow encapsulate the calls to
+	   cw_set_*() functions? The calls are also made elsewhere.
+	*/
+
+	if (reopen) {
+		/* Delete old generator (if it exists). */
+		cwdaemon_close_keying_engine();
+
+		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "setting sound system \"%s\"", engine_get_audio_system_label(cwdaemon_default_audio_system()));
+
+		if (!cwdaemon_open_keying_engine(cwdaemon_default_audio_system())) {
+			return -1;
+		}
+
+		/* Remember that tone queue is bound to a generator.  When
+		   cwdaemon switches on request to other sound system, it will
+		   have to re-register the callback. */
+		g_channel->engine->register_tone_queue_low_callback(cwdaemon_tone_queue_low_callback, g_channel, tq_low_watermark);
+	} else {
+		/* Keep the generator, but drop tones of text that was
+		   being sent, and wait for the key to go up. The tone
+		   queue callback stays registered with the generator. */
+		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "reusing generator with sound system \"%s\"", engine_get_audio_system_label(cwdaemon_default_audio_system()));
+		g_channel->engine->flush_tone_queue();
+		g_channel->engine->wait_for_tone_queue();
+	}
+
+	g_channel->engine->set_frequency(default_morse_tone);
+	g_channel->engine->set_send_speed(default_morse_speed);
+	g_channel->engine->set_volume(default_morse_volume);
+	g_channel->engine->set_gap(0);
+	g_channel->engine->set_weighting((int) (default_weighting * 0.6 + CWDAEMON_MORSE_WEIGHTING_MAX));
+	if (g_channel->engine->set_ptt_timing) {
+		g_channel->engine->set_ptt_timing(g_default_ptt_delay_ms, 0);
+	}
+
+	return 0;
+}
+
+
+
+
+/**
+   \brief Configure re-opened keying engine with current parameters
+
+   @param dev current keying device
+*/
+static void cwdaemon_configure_keying_engine(cwdevice * dev)
+{
+	// TODO (acerion) 2024.05.13 code in this function should
+	// be shared with cwdaemon_reset_keying_engine(). libcw SHOULD
+	// be (re)set in the same way (with the same steps) in all
+	// situations: start of daemon, handling of RESET Escape
+	// request, handling of SOUND_SYSTEM Escape request. Call to
+	// g_channel->engine->register_keying_callback() should be a part of that
+	// shared code.
+
+	/* Tone queue is bound to a generator. Creating new generator
+	   requires re-registering the callback. */
+	g_channel->engine->register_tone_queue_low_callback(cwdaemon_tone_queue_low_callback, g_channel, tq_low_watermark);
+
+	/* This call recalibrates length of dot and dash. */
+	g_channel->engine->set_frequency(g_channel->morse_tone);
+
+	g_channel->engine->set_send_speed(g_channel->morse_speed);
+	g_channel->engine->set_volume(g_channel->morse_volume);
+
+	/* Regardless if we are using "default" or "current"
+	   parameters, the gap is always zero. */
+	g_channel->engine->set_gap(0);
+
+	g_channel->engine->set_weighting((int) (g_channel->weighting * 0.6 + CWDAEMON_MORSE_WEIGHTING_MAX));
+
+#if 1 // Enabling this fixes problem from ticket R0030
+	g_channel->engine->register_keying_callback(cwdaemon_keyingevent, dev);
+#endif
+
+	return;
+}
+
+
+
+
+/**
+   \brief Replace generator with generator using probed sound system
+
+   Called by main loop when results of probes of sound systems started
+   by SOUND_SYSTEM Escape request are available. The old generator is
+   closed only if the new sound system has been found to be available.
+   If the new generator can't be opened after all, generator with
+   previous sound system is opened again.
+*/
+static void cwdaemon_finish_sound_system_switch(void)
+{
+	int audio_system = CW_AUDIO_NONE;
+	bool available = false;
+	while (sound_read(&audio_system, &available)) {
+		/* Only one switch is pending at a time, see
+		   sound_probe_is_running(). */
+		if (!g_sound_switch.pending || audio_system != g_sound_switch.audio_system) {
+			log_warning("Unexpected result of probe of sound system \"%s\", ignoring it",
+			            engine_get_audio_system_label(audio_system));
+			continue;
+		}
+		g_sound_switch.pending = false;
+
+		bool success = false;
+		if (!available) {
+			log_warning("Sound system \"%s\" is not available, keeping sound system \"%s\"",
+			            engine_get_audio_system_label(audio_system), engine_get_audio_system_label(g_channel->audio_system));
+
+		} else if (audio_system == g_channel->audio_system && g_channel->has_audio_output) {
+			success = true;
+
+		} else {
+			int const previous = g_channel->audio_system;
+			cwdaemon_close_keying_engine();
+
+			if (cwdaemon_open_keying_engine(audio_system)) {
+				g_channel->audio_system = audio_system;
+				g_channel->has_audio_output = true;
+				success = true;
+			} else {
+				sound_set_available(audio_system, false);
+				cwdaemon_close_keying_engine();
+				if (cwdaemon_open_keying_engine(previous)) {
+					log_warning("Failed to open sound system \"%s\", back to sound system \"%s\"",
+					            engine_get_audio_system_label(audio_system), engine_get_audio_system_label(previous));
+					g_channel->has_audio_output = true;
+				} else {
+					/* Fall back to NULL audio system. */
+					cwdaemon_close_keying_engine();
+					if (cwdaemon_open_keying_engine(CW_AUDIO_NULL)) {
+						cwdaemon_debug(CWDAEMON_VERBOSITY_W, __func__, __LINE__,
+						               "fall back to \"Null\" sound system");
+						g_channel->audio_system = CW_AUDIO_NULL;
+						g_channel->has_audio_output = true;
+					} else {
+						cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__,
+						               "failed to fall back to \"Null\" sound system");
+						g_channel->has_audio_output = false;
+					}
+				}
+			}
+
+			if (g_channel->has_audio_output) {
+				cwdaemon_configure_keying_engine(g_channel->cwdevice);
+			}
+		}
+
+		cwdaemon_reply_sound_system_switch(&g_sound_switch, success);
+	}
+
+	return;
+}
+
+
+
+
+/**
+   \brief Tell client about result of SOUND_SYSTEM Escape request
+
+   Reply is "f<value> ok" or "f<value> error", where <value> is value of
+   the request.
+
+   @param sw switch requested by client
+   @param success result of the switch
+*/
+static void cwdaemon_reply_sound_system_switch(sound_switch_t const * sw, bool success)
+{
+	char reply[sizeof (sw->value) + 16] = { 0 };
+	snprintf(reply, sizeof (reply), "f%s %s\r\n", sw->value, success ? "ok" : "error");
+	cwdaemon_sendto_address(g_channel, reply, &sw->reply_addr, sw->reply_addrlen);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Close keying engine if it has been idle for long enough
+
+   Called by main loop on each iteration. Engine is idle when its tone
+   queue is empty and PTT is off. Keyer of paddles may use the engine at
+   any time, so the engine is never suspended when paddles are used.
+*/
+static void cwdaemon_suspend_idle_keying_engine(void)
+{
+	if (0 == g_idle_suspend_s || g_channel->engine_suspended || !g_channel->has_audio_output
+	    || IAMBIC_MODE_NONE != g_paddles_mode || sound_probe_is_running()) {
+		return;
+	}
+
+	int64_t const now = cwdaemon_now_ns();
+	if (g_channel->ptt_flag || g_footswitch_pressed || g_channel->engine->get_tone_queue_length() > 0) {
+		g_channel->last_activity_ns = now;
+		return;
+	}
+	if (now - g_channel->last_activity_ns < (int64_t) g_idle_suspend_s * 1000000000LL) {
+		return;
+	}
+
+	g_channel->engine->close();
+	g_channel->engine_suspended = true;
+	trace_event(TRACE_EVENT_SUSPEND, g_idle_suspend_s, 0);
+	log_info("Keying engine has been idle for %u seconds, suspending it", g_idle_suspend_s);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Open keying engine suspended by cwdaemon_suspend_idle_keying_engine()
+
+   Time of opening is logged, recorded in trace, and summarized when
+   cwdaemon exits.
+
+   \param reason event that requires the engine
+*/
+static void cwdaemon_resume_keying_engine(char const * reason)
+{
+	g_channel->last_activity_ns = cwdaemon_now_ns();
+	if (!g_channel->engine_suspended) {
+		return;
+	}
+	g_channel->engine_suspended = false;
+
+	int64_t const start = g_channel->last_activity_ns;
+	if (g_channel->engine->open(g_channel->audio_system)) {
+		cwdaemon_configure_keying_engine(g_channel->cwdevice);
+		if (g_channel->engine->set_ptt_timing) {
+			g_channel->engine->set_ptt_timing(g_channel->ptt_delay_ms, 0);
+		}
+	} else {
+		log_error("Failed to resume keying engine with sound system \"%s\"", engine_get_audio_system_label(g_channel->audio_system));
+		g_channel->has_audio_output = false;
+		return;
+	}
+	uint64_t const open_us = (uint64_t) (cwdaemon_now_ns() - start) / 1000;
+
+	g_channel->resume_stats.count++;
+	g_channel->resume_stats.open_us_total += open_us;
+	if (open_us > g_channel->resume_stats.open_us_max) {
+		g_channel->resume_stats.open_us_max = open_us;
+	}
+	trace_event(TRACE_EVENT_RESUME, (uint32_t) open_us, 0);
+	log_info("Keying engine resumed on %s in %llu us", reason, (unsigned long long) open_us);
+
+	return;
+}
+
+
+
+
+/**
+   \brief Log statistics of resumes of keying engines, summed over channels
+
+   Registered with atexit(), called after threads of channels have been
+   stopped (cwdaemon_channels_stop()).
+*/
+static void cwdaemon_report_resume_stats(void)
+{
+	uint64_t count = g_cwdaemon.resume_stats.count;
+	uint64_t open_us_total = g_cwdaemon.resume_stats.open_us_total;
+	uint64_t open_us_max = g_cwdaemon.resume_stats.open_us_max;
+	for (unsigned int i = 1; i < g_channels_count; i++) {
+		count += g_channels[i]->resume_stats.count;
+		open_us_total += g_channels[i]->resume_stats.open_us_total;
+		if (g_channels[i]->resume_stats.open_us_max > open_us_max) {
+			open_us_max = g_channels[i]->resume_stats.open_us_max;
+		}
+	}
+
+	if (count) {
+		log_info("Keying engine: %llu resumes from idle suspension, time of resume avg/max = %llu/%llu us",
+		         (unsigned long long) count,
+		         (unsigned long long) (open_us_total / count),
+		         (unsigned long long) open_us_max);
+	}
+}
+
+
+
+
+static int64_t cwdaemon_now_ns(void)
+{
+	return (int64_t) vclock_now_ns();
+}
+
+
+
+
+/**
+   \brief Hand network socket over to new process, and exit
+
+   Called when HANDOFF_SIGNAL has been received (see handoff.h). Text
+   that is being sent is finished (and reply to client is sent), then
+   cwdevice and keying engine are released, so that new process can
+   open them. Requests received in the meantime wait in the socket.
+
+   If the new process doesn't take over, cwdevice is opened again and
+   this process continues its work.
+*/
+static void cwdaemon_hand_over(void)
+{
+	if (g_channel->engine == &engine_winkeyer) {
+		log_warning("Hand-over to new process is not supported with WinKeyer %s", "");
+		return;
+	}
+	if (g_channels_count > 1) {
+		log_warning("Hand-over to new process is not supported with several keying channels %s", "");
+		return;
+	}
+	log_info("Hand-over to new process has been requested, finishing queued text %s", "");
+
+	if (!g_channel->engine_suspended && g_channel->has_audio_output) {
+		g_channel->engine->wait_for_tone_queue();
+	}
+	/* Reply and end of PTT are handled by callbacks of the engine after
+	   the tone queue becomes empty. Manual PTT is not waited for. */
+	for (int i = 0; i < 100 && (g_channel->ptt_flag & (PTT_ACTIVE_AUTO | PTT_ACTIVE_ECHO)); i++) {
+		millisleep_nonintr(10);
+	}
+
+	char * const desc = strdup(g_channel->cwdevice->desc ? g_channel->cwdevice->desc : "null");
+	if (NULL == desc) {
+		log_error("Failed to allocate memory for hand-over %s", "");
+		return;
+	}
+	bool const input_monitored = input_is_running();
+	input_stop();
+	g_channel->engine->register_keying_callback(NULL, NULL);
+	cwdaemon_option_cwdevice(&g_channel->cwdevice, "null");
+	if (!g_channel->engine_suspended) {
+		g_channel->engine->close();
+		g_channel->engine_suspended = true;
+	}
+
+	/* --ready-fd has been used by this process, new process uses
+	   the hand-over socket pair instead. */
+	char ** argv = calloc((size_t) g_argc + 1, sizeof (char *));
+	int argc = 0;
+	for (int i = 0; argv && i < g_argc; i++) {
+		if (!strcmp(g_argv[i], "--ready-fd")) {
+			i++;
+		} else if (strncmp(g_argv[i], "--ready-fd=", strlen("--ready-fd="))) {
+			argv[argc++] = g_argv[i];
+		}
+	}
+
+	if (argv && 0 == handoff_spawn(argv, g_cwdaemon.socket_descriptor, g_cwdaemon.unix_socket_descriptor)) {
+		notify_handed_over();
+		/* New process has taken over Unix-domain socket too, don't
+		   remove its socket file on exit. */
+		g_cwdaemon.unix_socket_path = NULL;
+		exit(EXIT_SUCCESS);
+	}
+	free(argv);
+
+	log_warning("Hand-over to new process has failed, resuming work with cwdevice [%s]", desc);
+	if (0 == cwdaemon_option_cwdevice(&g_channel->cwdevice, desc)) {
+		g_channel->engine->register_keying_callback(cwdaemon_keyingevent, g_channel->cwdevice);
+	}
+	free(desc);
+	if (input_monitored) {
+		input_start(g_channel->cwdevice);
+	}
+	if (IAMBIC_MODE_NONE != g_paddles_mode) {
+		/* Keyer of paddles needs the engine at any time. */
+		cwdaemon_resume_keying_engine("failed hand-over");
+	}
+	g_channel->last_activity_ns = cwdaemon_now_ns();
+
+	return;
+}
+
+
+
+
+/**
+   \brief Add keying channel requested with "--channel" command line option
+
+   The channel gets its own cwdevice and its own instance of "native"
+   keying engine. Socket and engine of the channel are opened later, in
+   cwdaemon_channels_start().
+
+   \param port network port of the channel
+   \param desc name or path of cwdevice of the channel
+
+   \return true on success
+   \return false on failure
+*/
+static bool cwdaemon_channel_add(in_port_t port, char const * desc)
+{
+	if (g_channels_count >= CWDAEMON_CHANNELS_MAX) {
+		log_error("Too many keying channels, max count of channels is %u", (unsigned int) CWDAEMON_CHANNELS_MAX);
+		return false;
+	}
+
+	cwdaemon_t * const channel = calloc(1, sizeof (cwdaemon_t));
+	if (NULL == channel) {
+		log_error("Failed to allocate memory for keying channel %s", "");
+		return false;
+	}
+	channel->channel = g_channels_count;
+	channel->socket_descriptor = -1;
+	channel->unix_socket_descriptor = -1;
+	channel->network_port = port;
+	channel->stop_pipe[0] = -1;
+	channel->stop_pipe[1] = -1;
+	channel->engine = engine_native_instance(channel->channel);
+
+	/* cwdevices of main channel are singletons, so each channel has
+	   its own copy of cwdevice. */
+	channel->cwdevice = cwdaemon_cwdevice_new(desc);
+	if (NULL == channel->cwdevice) {
+		log_error("Can't use cwdevice [%s] for keying channel %u", desc, channel->channel);
+		free(channel);
+		return false;
+	}
+	if (channel->cwdevice->init && 0 != channel->cwdevice->init(channel->cwdevice, channel->cwdevice->fd)) {
+		log_error("Failed to initialize cwdevice [%s] of keying channel %u", desc, channel->channel);
+		free(channel->cwdevice->desc);
+		free(channel->cwdevice);
+		free(channel);
+		return false;
+	}
+
+	g_channels[g_channels_count++] = channel;
+	return true;
+}
+
+
+
+
+/**
+   \brief Open sockets and keying engines of channels, start their threads
+
+   Main channel must be started before other channels: its keying engine
+   opens the sidetone shared by all channels. The function exits the
+   process on failure.
+*/
+static void cwdaemon_channels_start(void)
+{
+	for (unsigned int i = 1; i < g_channels_count; i++) {
+		cwdaemon_t * const channel = g_channels[i];
+
+		/* Engine of the channel is configured by main thread, on
+		   behalf of the channel. */
+		g_channel = channel;
+		channel->network_rcvbuf = g_cwdaemon.network_rcvbuf;
+		bool const success = 0 == keying_io_start(keying_io_instance(channel->channel))
+			&& cwdaemon_initialize_socket(channel)
+			&& 0 == cwdaemon_reset_almost_all(channel->cwdevice);
+		channel->last_activity_ns = cwdaemon_now_ns();
+		g_channel = &g_cwdaemon;
+		if (!success) {
+			log_error("Failed to start keying channel %u on port %u", i, (unsigned int) channel->network_port);
+			exit(EXIT_FAILURE);
+		}
+
+		if (0 != pipe(channel->stop_pipe)) {
+			cwdaemon_errmsg("Pipe for keying channel");
+			exit(EXIT_FAILURE);
+		}
+		fcntl(channel->stop_pipe[0], F_SETFD, FD_CLOEXEC);
+		fcntl(channel->stop_pipe[1], F_SETFD, FD_CLOEXEC);
+
+		/* The thread should not handle signals sent to cwdaemon. Like
+		   main thread, it keeps default scheduling: real-time profile is
+		   applied only by keying threads. */
+		sigset_t all;
+		sigset_t old;
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		int const rv = pthread_create(&channel->thread, NULL, cwdaemon_channel_thread, channel);
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		if (0 != rv) {
+			log_error("Failed to start thread of keying channel %u: %s", i, strerror(rv));
+			close(channel->stop_pipe[0]);
+			close(channel->stop_pipe[1]);
+			channel->stop_pipe[0] = -1;
+			channel->stop_pipe[1] = -1;
+			exit(EXIT_FAILURE);
+		}
+		log_info("Keying channel %u: port %u, cwdevice [%s]", i,
+		         (unsigned int) channel->network_port, channel->cwdevice->desc ? channel->cwdevice->desc : "");
+	}
 
-	return 0;
+	return;
 }
 
 
 
 
-
 /**
-   \brief Open audio sink using libcw
+   \brief Stop threads of channels, close their engines, sockets and cwdevices
 
-   \param audio_system - audio system to be used by libcw
-
-   \return false on failure
-   \return true otherwise
+   Registered with atexit(). When exit() is called from thread of a
+   channel, the thread is not joined.
 */
-bool cwdaemon_open_libcw_output(int audio_system)
+static void cwdaemon_channels_stop(void)
 {
-	int rv = cw_generator_new(audio_system, NULL);
-	if (audio_system == CW_AUDIO_OSS && rv == CW_FAILURE) {
-		/* When reopening libcw output, previous audio system may
-		   block audio device for a short period of time after the
-		   output has been closed. In such a situation OSS may fail
-		   to open audio device. Let's give it some time. */
-		for (int i = 0; i < 5; i++) {
-			cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "delaying switching to OSS, please wait few seconds.");
-			sleep(4);
-			rv = cw_generator_new(audio_system, NULL);
-			if (rv == CW_SUCCESS) {
-				break;
+	for (unsigned int i = 1; i < g_channels_count; i++) {
+		cwdaemon_t * const channel = g_channels[i];
+		if (-1 != channel->stop_pipe[1]) {
+			if (1 != write(channel->stop_pipe[1], "", 1)) {
+				log_warning("Failed to stop thread of keying channel %u: %s", i, strerror(errno));
+			} else if (!pthread_equal(channel->thread, pthread_self())) {
+				pthread_join(channel->thread, NULL);
 			}
+			close(channel->stop_pipe[0]);
+			close(channel->stop_pipe[1]);
+			channel->stop_pipe[0] = -1;
+			channel->stop_pipe[1] = -1;
 		}
-	}
-	if (rv != CW_FAILURE) {
-		rv = cw_generator_start();
-		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "starting generator with sound system \"%s\": %s", cw_get_audio_system_label(audio_system), rv ? "success" : "failure");
 
-	} else {
-		/* FIXME:
-		   When cwdaemon failed to create a generator, and user
-		   kills non-forked cwdaemon through Ctrl+C, there is
-		   a memory protection error.
-
-		   It seems that this error has been fixed with
-		   changes in libcw, committed on 31.12.2012.
-		   To be observed. */
-		cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "failed to create generator with sound system \"%s\"", cw_get_audio_system_label(audio_system));
+		channel->engine->register_keying_callback(NULL, NULL);
+		channel->engine->close();
+		keying_io_stop(keying_io_instance(channel->channel));
+		cwdaemon_close_socket(channel);
+		if (channel->cwdevice->free) {
+			channel->cwdevice->free(channel->cwdevice);
+		}
+		free(channel->cwdevice->desc);
+		free(channel->cwdevice);
+		channel->cwdevice = NULL;
 	}
-
-	return rv == CW_FAILURE ? false : true;
+	return;
 }
 
 
 
 
-
 /**
-   \brief Close libcw audio output
+   \brief Get keying I/O instance of channel that owns given cwdevice
+
+   \param dev cwdevice of one of channels
+
+   \return keying I/O instance of the channel, or of main channel if no
+   channel owns \p dev
 */
-void cwdaemon_close_libcw_output(void)
+static keying_io_t * cwdaemon_keying_io_of_cwdevice(cwdevice const * dev)
 {
-	cw_generator_stop();
-	cw_generator_delete();
-
-	return;
+	for (unsigned int i = 1; i < g_channels_count; i++) {
+		if (dev == g_channels[i]->cwdevice) {
+			return keying_io_instance(g_channels[i]->channel);
+		}
+	}
+	return keying_io_instance(g_cwdaemon.channel);
 }
 
 
 
 
-
 /**
-   \brief Reset parameters of libcw to default values
+   \brief Main function of thread of keying channel other than main channel
 
-   Function uses values of cwdaemon's global 'default_' variables, and some
-   other values to reset state of libcw.
+   The thread handles requests received on socket of the channel, the
+   same way as main thread handles requests of main channel.
 
-   @return 0 on success
-   @return -1 on failure
+   \param arg channel (cwdaemon_t) served by the thread
 */
-static int cwdaemon_reset_libcw_output(void)
+static void * cwdaemon_channel_thread(void * arg)
 {
-	/* This function is called when cwdaemon receives '0' escape code.
-	   README describes this code as "Reset to default values".
-	   Therefore we use default_* below.
-
-	   However, the function is called after "current_" values
-	   have been reset to "default_" values. So maybe we could use
-	   "current_" values and somehow encapsulate the calls to
-	   cw_set_*() functions? The calls are also made elsewhere.
-	*/
-
-	/* Delete old generator (if it exists). */
-	cwdaemon_close_libcw_output();
+	g_channel = (cwdaemon_t *) arg;
+	vclock_attach();
 
-	cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "setting sound system \"%s\"", cw_get_audio_system_label(default_audio_system));
+	g_channel->request_queue[0] = '\0';
+	while (true) {
+		fd_set readfd;
+		FD_ZERO(&readfd);
+		FD_SET(g_channel->socket_descriptor, &readfd);
+		FD_SET(g_channel->stop_pipe[0], &readfd);
+		int const max_fd = g_channel->socket_descriptor > g_channel->stop_pipe[0] ? g_channel->socket_descriptor : g_channel->stop_pipe[0];
 
-	if (!cwdaemon_open_libcw_output(default_audio_system)) {
-		return -1;
+		int const fd_count = vclock_select(max_fd + 1, &readfd, NULL, NULL, NULL);
+		if (fd_count == -1 && errno != EINTR) {
+			cwdaemon_errmsg("Select");
+		} else if (fd_count > 0 && FD_ISSET(g_channel->stop_pipe[0], &readfd)) {
+			break;
+		} else if (fd_count > 0) {
+			cwdaemon_receive();
+		}
 	}
 
-	/* Remember that tone queue is bound to a generator.  When
-	   cwdaemon switches on request to other sound system, it will
-	   have to re-register the callback. */
-	cw_register_tone_queue_low_callback(cwdaemon_tone_queue_low_callback, NULL, tq_low_watermark);
-
-	cw_set_frequency(default_morse_tone);
-	cw_set_send_speed(default_morse_speed);
-	cw_set_volume(default_morse_volume);
-	cw_set_gap(0);
-	cw_set_weighting((int) (default_weighting * 0.6 + CWDAEMON_MORSE_WEIGHTING_MAX));
-
-	return 0;
+	return NULL;
 }
 
 
@@ -831,8 +1623,8 @@ void cwdaemon_prepare_reply(cwdaemon_t * cwdaemon, char *reply, const char *requ
 	   when libcw's tone queue becomes empty.
 
 	   It is important to set this flag at the beginning of the function. */
-	ptt_flag |= PTT_ACTIVE_ECHO;
-	cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag +PTT_ACTIVE_ECHO (0x%02x/%s)", ptt_flag, cwdaemon_debug_ptt_flags());
+	g_channel->ptt_flag |= PTT_ACTIVE_ECHO;
+	cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag +PTT_ACTIVE_ECHO (0x%02x/%s)", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 
 	/* We are sending reply to the same host that sent a request. */
 	memcpy(&cwdaemon->reply_addr, &cwdaemon->request_addr, sizeof(cwdaemon->reply_addr));
@@ -871,7 +1663,7 @@ int cwdaemon_receive(void)
 	// (in entire code) as array of bytes with explicit count of bytes.
 	char request_buffer[CWDAEMON_REQUEST_SIZE_MAX + 1] = { 0 };
 
-	ssize_t recv_rc = cwdaemon_recvfrom(&g_cwdaemon, request_buffer, CWDAEMON_REQUEST_SIZE_MAX);
+	ssize_t recv_rc = cwdaemon_recvfrom(g_channel, request_buffer, CWDAEMON_REQUEST_SIZE_MAX);
 
 	if (recv_rc == -2) {
 		/* Sender has closed connection. */
@@ -888,6 +1680,18 @@ int cwdaemon_receive(void)
 	}
 
 	request_buffer[recv_rc] = '\0';
+	trace_event(TRACE_EVENT_RECEIVE, (uint32_t) recv_rc, 0);
+	if (!__atomic_exchange_n(&g_request_received, true, __ATOMIC_RELAXED)) {
+		log_info("First request received %llu ms after start",
+		         (unsigned long long) (cwdaemon_now_ns() - g_start_ns) / 1000000);
+	}
+
+	/* Clients usually send parameters (speed, tone) before text, so
+	   any request other than EXIT starts warming up suspended
+	   keying engine. */
+	if (!(request_buffer[0] == ASCII_ESC && request_buffer[1] == CWDAEMON_ESC_REQUEST_EXIT)) {
+		cwdaemon_resume_keying_engine("request");
+	}
 
 	cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "-------------------");
 	if (request_buffer[0] != ASCII_ESC) {
@@ -899,7 +1703,8 @@ int cwdaemon_receive(void)
 		   require sending a reply to client. Such request is
 		   correctly handled by cwdaemon_play_request(). */
 		log_info("received request: \"%s\"", request_buffer);
-		if ((strlen(request_buffer) + strlen(request_queue)) <= CWDAEMON_REQUEST_QUEUE_SIZE_MAX - 1) {
+		trace_event(TRACE_EVENT_DISPATCH, 0, 0);
+		if ((strlen(request_buffer) + strlen(g_channel->request_queue)) <= CWDAEMON_REQUEST_QUEUE_SIZE_MAX - 1) {
 			// TODO (acerion) 2024.02.11: initial tests with
 			// tests/functional_tests/supervised/feature_multiple_requests/ show
 			// that the 'request_queue' buffer never holds more than one
@@ -909,15 +1714,15 @@ int cwdaemon_receive(void)
 			// 'request_queue', the 'request_queue' is empty, so we can
 			// eliminate it and just pass 'request_buffer' to
 			// cwdaemon_play_request().
-			const size_t len = strlen(request_queue);
-			snprintf(request_queue + len, sizeof (request_queue) - len, "%s", request_buffer);
-			cwdaemon_play_request(request_queue);
+			const size_t len = strlen(g_channel->request_queue);
+			snprintf(g_channel->request_queue + len, sizeof (g_channel->request_queue) - len, "%s", request_buffer);
+			cwdaemon_play_request(g_channel->request_queue);
 		} else {
 			; /* TODO: how to handle this case? */
 		}
 		return 1;
 	} else {
-		cwdaemon_handle_escaped_request(&global_cwdevice, request_buffer);
+		cwdaemon_handle_escaped_request(&g_channel->cwdevice, request_buffer);
 		return 0;
 	}
 }
@@ -931,7 +1736,7 @@ int cwdaemon_receive(void)
 */
 void cwdaemon_handle_escaped_request(cwdevice ** device, char *request)
 {
-	cwdevice * dev = global_cwdevice;
+	cwdevice * dev = g_channel->cwdevice;
 	long lv = 0;
 
 	// Don't print literal escape character, use <ESC> symbol. First reason
@@ -942,6 +1747,7 @@ void cwdaemon_handle_escaped_request(cwdevice ** device, char *request)
 	char const escape_code = request[1];
 	log_info("received Escape request: \"<ESC>%c\" / \"<ESC>0x%02x\"", escape_code, (unsigned char) escape_code);
 	const char * const payload = request + 2; // The main part of the request.
+	trace_event(TRACE_EVENT_DISPATCH, (unsigned char) escape_code, 0);
 
 	/* Take action depending on Escape code. */
 	switch ((int) escape_code) { /* TODO acerion 2024.03.17: remove casting. */
@@ -949,74 +1755,81 @@ void cwdaemon_handle_escaped_request(cwdevice ** device, char *request)
 		/* Reset all values. */
 		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__,
 			       "requested resetting of parameters");
-		request_queue[0] = '\0';
+		g_channel->request_queue[0] = '\0';
 		cwdaemon_reset_almost_all(dev);
-		wordmode = 0;
+		g_channel->wordmode = 0;
 		async_abort = 0;
-		if (global_cwdevice->reset_pins_state) {
-			global_cwdevice->reset_pins_state(global_cwdevice);
+		if (g_channel->cwdevice->reset_pins_state) {
+			/* Pins are changed only by keying I/O thread. */
+			keying_io_post(keying_io_instance(g_channel->channel), g_channel->cwdevice, KEYING_IO_PINS_RESET, 0);
 		}
+		keying_io_sync(keying_io_instance(g_channel->channel));
 
-		ptt_flag = 0;
-		cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag = 0 (0x%02x/%s)", ptt_flag, cwdaemon_debug_ptt_flags());
+		g_channel->ptt_flag = 0;
+		cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag = 0 (0x%02x/%s)", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "resetting completed");
 
 		break;
 	case '2':
 		/* Set speed of Morse code, in words per minute. */
-		if (cwdaemon_params_wpm(&current_morse_speed, request + 2)) {
-			cw_set_send_speed(current_morse_speed);
+		if (cwdaemon_params_wpm(&g_channel->morse_speed, request + 2)) {
+			g_channel->engine->set_send_speed(g_channel->morse_speed);
 		}
 		break;
 	case '3':
 		/* Set tone (frequency) of morse code, in Hz.
 		   The code assumes that minimal valid frequency is zero. */
 		assert (CW_FREQUENCY_MIN == 0);
-		if (cwdaemon_params_tone(&current_morse_tone, request + 2)) {
-			if (current_morse_tone > 0) {
+		if (cwdaemon_params_tone(&g_channel->morse_tone, request + 2)) {
+			if (g_channel->morse_tone > 0) {
 
-				cw_set_frequency(current_morse_tone);
-				cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "tone: %d Hz", current_morse_tone);
+				g_channel->engine->set_frequency(g_channel->morse_tone);
+				cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "tone: %d Hz", g_channel->morse_tone);
 
 				/* TODO: Should we really be adjusting
 				   volume when the command is for
 				   frequency? It would be more
 				   "elegant" not to do so. */
-				cw_set_volume(current_morse_volume);
+				g_channel->engine->set_volume(g_channel->morse_volume);
 
-			} else { /* current_morse_tone==0, sidetone off */
-				cw_set_volume(0);
+			} else { /* g_channel->morse_tone==0, sidetone off */
+				g_channel->engine->set_volume(0);
 				cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "volume off");
 			}
 		}
 		break;
 	case '4':
 		/* Abort currently sent message. */
-		if (wordmode) {
+		if (g_channel->wordmode) {
 			cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "requested aborting of message - ignoring (word mode is active)");
 		} else {
 			cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "requested aborting of message - executing (character mode is active)");
-			if (ptt_flag & PTT_ACTIVE_ECHO) {
+			if (g_channel->ptt_flag & PTT_ACTIVE_ECHO) {
 				cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "echo \"break\"");
-				cwdaemon_sendto(&g_cwdaemon, "break\r\n");
+				cwdaemon_sendto(g_channel, "break\r\n");
 			}
-			request_queue[0] = '\0';
-			cw_flush_tone_queue();
-			cw_wait_for_tone_queue();
-			if (ptt_flag) {
-				cwdaemon_set_ptt_off(global_cwdevice, "PTT off");
+			g_channel->request_queue[0] = '\0';
+			g_channel->engine->flush_tone_queue();
+			g_channel->engine->wait_for_tone_queue();
+			if (g_channel->ptt_flag) {
+				cwdaemon_set_ptt_off(g_channel->cwdevice, "PTT off");
 			}
-			ptt_flag &= 0;
-			cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag = 0 (0x%02x/%s)", ptt_flag, cwdaemon_debug_ptt_flags());
+			g_channel->ptt_flag &= 0;
+			cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag = 0 (0x%02x/%s)", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 		}
 		break;
 
 	case CWDAEMON_ESC_REQUEST_EXIT:
 		/* Exit cwdaemon. */
+		if (0 != g_channel->channel) {
+			/* Other channels may be keying right now. */
+			log_warning("Exit may be requested only through main channel, ignoring request on channel %u", g_channel->channel);
+			break;
+		}
 		errno = 0;
 #if 0
 		char address[INET_ADDRSTRLEN] = { 0 };
-		inet_ntop(g_cwdaemon.request_addr.sin_family, (struct in_addr*) &(g_cwdaemon.request_addr.sin_addr.s_addr),
+		inet_ntop(AF_INET, &((struct sockaddr_in *) &g_channel->request_addr)->sin_addr,
 		          address, INET_ADDRSTRLEN);
 		log_info("requested exit of daemon (client address: %s)", address);
 #else
@@ -1027,8 +1840,8 @@ void cwdaemon_handle_escaped_request(cwdevice ** device, char *request)
 	case '6':
 		/* Set uninterruptable (word mode). */
 		request[0] = '\0';
-		request_queue[0] = '\0';
-		wordmode = 1;
+		g_channel->request_queue[0] = '\0';
+		g_channel->wordmode = 1;
 		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "wordmode set");
 		break;
 	case '7':
@@ -1036,17 +1849,28 @@ void cwdaemon_handle_escaped_request(cwdevice ** device, char *request)
 		   Remember that cwdaemon uses values in range
 		   -50/+50, but libcw accepts values in range
 		   20/80. This is why you have the calculation
-		   when calling cw_set_weighting(). */
-		if (cwdaemon_params_weighting(&current_weighting, request + 2)) {
-			cw_set_weighting((int) (current_weighting * 0.6 + CWDAEMON_MORSE_WEIGHTING_MAX));
+		   when calling g_channel->engine->set_weighting(). */
+		if (cwdaemon_params_weighting(&g_channel->weighting, request + 2)) {
+			g_channel->engine->set_weighting((int) (g_channel->weighting * 0.6 + CWDAEMON_MORSE_WEIGHTING_MAX));
 		}
 		break;
 
 	case CWDAEMON_ESC_REQUEST_CWDEVICE:
 		// Set new cwdevice.
-		cw_register_keying_callback(NULL, NULL); // First cancel old registration.
+		if (0 != g_channel->channel) {
+			// cwdevices of other channels are given only at start.
+			log_warning("Can't change cwdevice of channel %u while running, ignoring request for cwdevice [%s]", g_channel->channel, payload);
+			break;
+		}
+		if ((g_channel->engine == &engine_winkeyer) != winkeyer_is_device_name(payload)) {
+			// WinKeyer has its own keying engine, and engines are
+			// selected only at start.
+			log_warning("Can't switch between WinKeyer and other cwdevice while running, ignoring request for cwdevice [%s]", payload);
+			break;
+		}
+		g_channel->engine->register_keying_callback(NULL, NULL); // First cancel old registration.
 		if (0 == cwdaemon_option_cwdevice(device, payload)) {
-			cw_register_keying_callback(cwdaemon_keyingevent, *device);
+			g_channel->engine->register_keying_callback(cwdaemon_keyingevent, *device);
 		}
 		break;
 
@@ -1069,15 +1893,15 @@ void cwdaemon_handle_escaped_request(cwdevice ** device, char *request)
 		}
 
 		if (lv) {
-			if (global_cwdevice->ssbway) {
-				global_cwdevice->ssbway(global_cwdevice, SOUNDCARD);
+			if (g_channel->cwdevice->ssbway) {
+				keying_io_post(keying_io_instance(g_channel->channel), g_channel->cwdevice, KEYING_IO_PIN_SSBWAY, SOUNDCARD);
 				cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "\"SSB way\" set to SOUNDCARD");
 			} else {
 				cwdaemon_debug(CWDAEMON_VERBOSITY_W, __func__, __LINE__, "\"SSB way\" to SOUNDCARD unimplemented");
 			}
 		} else {
-			if (global_cwdevice->ssbway) {
-				global_cwdevice->ssbway(global_cwdevice, MICROPHONE);
+			if (g_channel->cwdevice->ssbway) {
+				keying_io_post(keying_io_instance(g_channel->channel), g_channel->cwdevice, KEYING_IO_PIN_SSBWAY, MICROPHONE);
 				cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "\"SSB way\" set to MICROPHONE");
 			} else {
 				cwdaemon_debug(CWDAEMON_VERBOSITY_W, __func__, __LINE__, "\"SSB way\" to MICROPHONE unimplemented");
@@ -1102,7 +1926,7 @@ void cwdaemon_handle_escaped_request(cwdevice ** device, char *request)
 			/* Set PTT delay (TOD, Turn On Delay, TX delay).
 			   The value is milliseconds. */
 
-			int rv = cwdaemon_params_pttdelay(&g_current_ptt_delay_ms, request + 2);
+			int rv = cwdaemon_params_pttdelay(&g_channel->ptt_delay_ms, request + 2);
 
 			if (rv == 0) {
 				/* Value totally invalid. */
@@ -1130,8 +1954,11 @@ void cwdaemon_handle_escaped_request(cwdevice ** device, char *request)
 					       CWDAEMON_PTT_DELAY_MIN, CWDAEMON_PTT_DELAY_MAX);
 			}
 
-			if (rv && g_current_ptt_delay_ms == 0) {
-				cwdaemon_set_ptt_off(global_cwdevice, "ensure PTT off");
+			if (rv && g_channel->engine->set_ptt_timing) {
+				g_channel->engine->set_ptt_timing(g_channel->ptt_delay_ms, 0);
+			}
+			if (rv && g_channel->ptt_delay_ms == 0) {
+				cwdaemon_set_ptt_off(g_channel->cwdevice, "ensure PTT off");
 			}
 		}
 
@@ -1146,89 +1973,56 @@ void cwdaemon_handle_escaped_request(cwdevice ** device, char *request)
 		/* We use four bits to select band, this gives 16
 		   bands: 0 - 15. */
 		if (lv >= 0 && lv <= 15) {
-			cwdaemon_switch_band(global_cwdevice, lv);
+			cwdaemon_switch_band(g_channel->cwdevice, lv);
 		}
 #else
 		cwdaemon_debug(CWDAEMON_VERBOSITY_W, __func__, __LINE__, "band switching through parallel port is unavailable (parallel port not configured)");
 #endif
 		break;
 	case 'f': {
-		/* Change sound system used by libcw. */
-		/* FIXME: if "request+2" describes unavailable sound system,
-		   cwdaemon fails to open the new sound system. Since
-		   the old one is closed with cwdaemon_close_libcw_output(),
-		   cwdaemon has no working sound system, and is unable to
-		   play sound.
-
-		   This can be fixed either by querying libcw if "request+2"
-		   sound system is available, or by first trying to
-		   open new sound system and then - on success -
-		   closing the old one. In either case cwdaemon would
-		   require some method to inform client about success
-		   or failure to open new sound system.	*/
-		if (cwdaemon_params_system(&current_audio_system, request + 2)) {
-			/* Handle valid request for changing sound system. */
-			cwdaemon_close_libcw_output();
-
-			if (cwdaemon_open_libcw_output(current_audio_system)) {
-				has_audio_output = true;
+		/* Change sound system used by keying engine. The sound
+		   system is probed in background, and the generator is
+		   replaced in cwdaemon_finish_sound_system_switch() only
+		   if the probe has succeeded, so cwdaemon doesn't end up
+		   without working sound system. Client gets a reply
+		   when the switch is finished. */
+		int audio_system = g_channel->audio_system;
+		bool started = false;
+		if (0 != g_channel->channel) {
+			/* Sidetone of other channels is heard through
+			   sidetone of main channel. */
+			log_warning("Channel %u has no sound system of its own, ignoring request for sound system", g_channel->channel);
+		} else if (cwdaemon_params_system(&audio_system, request + 2)) {
+			if (!cwdaemon_engine_supports_audio_system(audio_system)) {
+				/* Don't interrupt keying only to find out that
+				   the engine can't open the sound system. */
+				log_warning("Keying engine \"%s\" has no sidetone, ignoring request for sound system \"%s\"",
+				            g_channel->engine->name, engine_get_audio_system_label(audio_system));
+			} else if (0 == sound_probe_start(g_channel->engine, audio_system)) {
+				started = true;
 			} else {
-				/* Fall back to NULL audio system. */
-				cwdaemon_close_libcw_output();
-				if (cwdaemon_open_libcw_output(CW_AUDIO_NULL)) {
-
-					cwdaemon_debug(CWDAEMON_VERBOSITY_W, __func__, __LINE__,
-						       "fall back to \"Null\" sound system");
-					current_audio_system = CW_AUDIO_NULL;
-					has_audio_output = true;
-				} else {
-					cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__,
-						       "failed to fall back to \"Null\" sound system");
-					has_audio_output = false;
-				}
+				; /* Error has been logged by sound module. */
 			}
+		}
 
-			if (has_audio_output) {
-
-				// TODO (acerion) 2024.05.13 code in this code block should
-				// be shared with cwdaemon_reset_libcw_output(). libcw SHOULD
-				// be (re)set in the same way (with the same steps) in all
-				// situations: start of daemon, handling of RESET Escape
-				// request, handling of SOUND_SYSTEM Escape request. Call to
-				// cw_register_keying_callback() should be a part of that
-				// shared code.
-
-				/* Tone queue is bound to a
-				   generator. Creating new generator
-				   requires re-registering the
-				   callback. */
-				cw_register_tone_queue_low_callback(cwdaemon_tone_queue_low_callback, NULL, tq_low_watermark);
-
-				/* This call recalibrates length of
-				   dot and dash. */
-				cw_set_frequency(current_morse_tone);
-
-				cw_set_send_speed(current_morse_speed);
-				cw_set_volume(current_morse_volume);
-
-				/* Regardless if we are using
-				   "default" or "current" parameters,
-				   the gap is always zero. */
-				cw_set_gap(0);
-
-				cw_set_weighting((int) (current_weighting * 0.6 + CWDAEMON_MORSE_WEIGHTING_MAX));
-
-#if 1 // Enabling this fixes problem from ticket R0030
-				cw_register_keying_callback(cwdaemon_keyingevent, *device);
-#endif
-			}
+		/* We are sending reply to the host that sent the request. */
+		sound_switch_t sw = { 0 };
+		memcpy(&sw.reply_addr, &g_channel->request_addr, sizeof (sw.reply_addr));
+		sw.reply_addrlen = g_channel->request_addrlen;
+		snprintf(sw.value, sizeof (sw.value), "%s", request + 2);
+		if (started) {
+			sw.audio_system = audio_system;
+			sw.pending = true;
+			g_sound_switch = sw;
+		} else {
+			cwdaemon_reply_sound_system_switch(&sw, false);
 		}
 		break;
 	}
 	case 'g':
 		/* Set volume of sound, in percents. */
-		if (cwdaemon_params_volume(&current_morse_volume, request + 2)) {
-			cw_set_volume(current_morse_volume);
+		if (cwdaemon_params_volume(&g_channel->morse_volume, request + 2)) {
+			g_channel->engine->set_volume(g_channel->morse_volume);
 		}
 		break;
 
@@ -1246,11 +2040,27 @@ void cwdaemon_handle_escaped_request(cwdevice ** device, char *request)
 		   the client didn't specify reply text, the 'h' will
 		   be the only content of server's reply. */
 
-		cwdaemon_prepare_reply(&g_cwdaemon, reply_buffer, request + 1, strlen(request + 1));
-		log_info("reply is ready, waiting for message from client (reply: \"%s\")", reply_buffer);
+		cwdaemon_prepare_reply(g_channel, g_channel->reply_buffer, request + 1, strlen(request + 1));
+		log_info("reply is ready, waiting for message from client (reply: \"%s\")", g_channel->reply_buffer);
 		/* cwdaemon will wait for queue-empty callback before
 		   sending the reply. */
 		break;
+
+	case CWDAEMON_ESC_REQUEST_LOG_THRESHOLD: {
+		/* Change threshold of logs without restarting the daemon. */
+		int threshold = 0;
+		if (0 != cwdaemon_option_set_verbosity(&threshold, payload)) {
+			break;
+		}
+		log_set_threshold(threshold);
+#if HAVE_LIBCW
+		if (0 != g_libcw_debug_flags) {
+			set_libcw_debugging(&cw_debug_object, threshold, g_libcw_debug_flags);
+		}
+#endif
+		log_info("log threshold set to [%s]", log_get_priority_label(threshold));
+		break;
+	}
 	} /* switch (escape_code) */
 
 	return;
@@ -1274,6 +2084,11 @@ void cwdaemon_play_request(char *request)
 {
 	//cw_block_callback(true);
 
+	if (g_channels_count > 1) {
+		/* Operator hears the channel that has started sending. */
+		engine_native_set_sidetone_owner(g_channel->channel);
+	}
+
 	char *x = request;
 
 	while (*x) {
@@ -1285,23 +2100,23 @@ void cwdaemon_play_request(char *request)
 			   in such cases increase and decrease of speed is
 			   multiple of 2 wpm. */
 			do {
-				current_morse_speed += (*x == '+') ? 2 : -2;
+				g_channel->morse_speed += (*x == '+') ? 2 : -2;
 				x++;
 			} while (*x == '+' || *x == '-');
 
-			if (current_morse_speed < CW_SPEED_MIN) {
-				current_morse_speed = CW_SPEED_MIN;
-			} else if (current_morse_speed > CW_SPEED_MAX) {
-				current_morse_speed = CW_SPEED_MAX;
+			if (g_channel->morse_speed < CW_SPEED_MIN) {
+				g_channel->morse_speed = CW_SPEED_MIN;
+			} else if (g_channel->morse_speed > CW_SPEED_MAX) {
+				g_channel->morse_speed = CW_SPEED_MAX;
 			} else {
 				;
 			}
-			cw_set_send_speed(current_morse_speed);
+			g_channel->engine->set_send_speed(g_channel->morse_speed);
 			break;
 		case '~':
 			/* 2 dots time additional for the next char. The gap
 			   is always reset after playing the char. */
-			cw_set_gap(2);
+			g_channel->engine->set_gap(2);
 			x++;
 			break;
 		case '^':
@@ -1310,7 +2125,7 @@ void cwdaemon_play_request(char *request)
 			/* '^' can be found at the end of request, and
 			   it means "echo text of current request back
 			   to client once you finish playing it". */
-			cwdaemon_prepare_reply(&g_cwdaemon, reply_buffer, request, strlen(request));
+			cwdaemon_prepare_reply(g_channel, g_channel->reply_buffer, request, strlen(request));
 
 			/* cwdaemon will wait for queue-empty callback
 			   before sending the reply. */
@@ -1319,7 +2134,7 @@ void cwdaemon_play_request(char *request)
 			/* TODO: what's this? */
 			*x = '+';
 		default:
-			cwdaemon_set_ptt_on(global_cwdevice, "PTT (auto) on");
+			cwdaemon_set_ptt_on(g_channel->cwdevice, "PTT (auto) on");
 			/* PTT is now in AUTO. It will be turned off on low
 			   tone queue, in cwdaemon_tone_queue_low_callback(). */
 
@@ -1327,7 +2142,7 @@ void cwdaemon_play_request(char *request)
 			// fixed in commit c4fff9622c4e86c798703d637be7cf7e9ab84a06.
 			// Signed value -1 (unsigned value 255) triggers SIGSEGV in
 			// libcw. Therefore don't allow passing the value to
-			// cw_send_character().
+			// g_channel->engine->send_character().
 			//
 			// TODO (acerion) 2024.02.18: remove this (is_valid) condition
 			// after cwdaemon starts to have a hard dependency on a library
@@ -1335,12 +2150,13 @@ void cwdaemon_play_request(char *request)
 			const bool is_valid = 0xff != (unsigned char) *x;
 			if (is_valid) {
 				cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "Morse character \"%c\" to be queued in libcw", *x);
-				cw_send_character(*x);
+				trace_event(TRACE_EVENT_ENQUEUE, (unsigned char) *x, 0);
+				g_channel->engine->send_character(*x);
 				cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "Morse character \"%c\" has been queued in libcw", *x);
 			}
 
 			x++;
-			if (cw_get_gap() == 2) {
+			if (g_channel->engine->get_gap() == 2) {
 				if (*x == '^') {
 					/* '^' is supposed to be the
 					   last character in the
@@ -1351,7 +2167,7 @@ void cwdaemon_play_request(char *request)
 					   NUL. */
 					x++;
 				} else {
-					cw_set_gap(0);
+					g_channel->engine->set_gap(0);
 				}
 			}
 			break;
@@ -1396,14 +2212,25 @@ void cwdaemon_keyingevent(void * arg, int keystate)
 {
 	log_debug("keying event %d", keystate);
 
+	trace_event(TRACE_EVENT_KEY, (uint32_t) keystate, 0);
+
+	/* Don't wait for (possibly slow) I/O on cwdevice in keying
+	   engine's thread. */
 	cwdevice * dev = (cwdevice *) arg;
+	if (dev == g_cwdaemon.cwdevice) {
+		/* Paddles are read only from cwdevice of main channel. */
+		input_note_key_edge(keystate);
+	}
+	/* Keying engine's thread may not serve any channel, so find
+	   channel by its cwdevice. */
+	keying_io_t * const io = cwdaemon_keying_io_of_cwdevice(dev);
 	if (keystate == 1) {
-		dev->cw(dev, ON);
+		keying_io_post(io, dev, KEYING_IO_PIN_CW, ON);
 	} else {
-		dev->cw(dev, OFF);
+		keying_io_post(io, dev, KEYING_IO_PIN_CW, OFF);
 	}
 
-	inactivity_seconds = 0;
+	__atomic_store_n(&inactivity_seconds, 0, __ATOMIC_RELAXED);
 
 	return;
 }
@@ -1412,78 +2239,101 @@ void cwdaemon_keyingevent(void * arg, int keystate)
 
 
 
+/* Current parameters of keying of main channel, for keyer in input
+   thread. The values are changed by main thread. */
+static int cwdaemon_current_wpm(void)
+{
+	return __atomic_load_n(&g_cwdaemon.morse_speed, __ATOMIC_RELAXED);
+}
+
+
+
+
+static int cwdaemon_current_tone(void)
+{
+	return __atomic_load_n(&g_cwdaemon.morse_tone, __ATOMIC_RELAXED);
+}
+
+
+
+
+
 /**
    \brief Callback routine called when tone queue is empty
 
-   Callback routine registered with cw_register_tone_queue_low_callback(),
+   Callback routine registered with g_channel->engine->register_tone_queue_low_callback(),
    will be called by libcw every time number of tones drops in queue below
    specific level.
 
-   \param arg - unused argument
+   \param arg - keying channel (cwdaemon_t) of the engine
 */
-void cwdaemon_tone_queue_low_callback(__attribute__((unused)) void *arg)
+void cwdaemon_tone_queue_low_callback(void *arg)
 {
-	int len = cw_get_tone_queue_length();
+	/* We are in keying engine's thread. */
+	g_channel = (cwdaemon_t *) arg;
+
+	int len = g_channel->engine->get_tone_queue_length();
+	trace_event(TRACE_EVENT_TQ_LOW, (uint32_t) len, g_channel->ptt_flag);
 	cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: start, TQ len = %d, PTT flag = 0x%02x/%s",
-		       len, ptt_flag, cwdaemon_debug_ptt_flags());
+		       len, g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 
 	if (len > tq_low_watermark) {
 		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: TQ len larger than watermark, TQ len = %d", len);
 	}
 
-	if (ptt_flag == PTT_ACTIVE_AUTO
+	if (g_channel->ptt_flag == PTT_ACTIVE_AUTO
 	    /* PTT is (most probably?) on, in purely automatic mode.
 	       This means that as soon as there are no new chars to
 	       play, we should turn PTT off. */
 
-	    && request_queue[0] == '\0'
+	    && g_channel->request_queue[0] == '\0'
 	    /* No new text has been queued in the meantime. */
 
-	    && cw_get_tone_queue_length() <= tq_low_watermark) {
+	    && g_channel->engine->get_tone_queue_length() <= tq_low_watermark) {
 		/* TODO: check if this third condition is really necessary. */
-		/* Originally it was 'cw_get_tone_queue_length() <= 1',
+		/* Originally it was 'g_channel->engine->get_tone_queue_length() <= 1',
 		   I'm guessing that '1' here was the same '1' as the
-		   third argument to cw_register_tone_queue_low_callback().
+		   third argument to g_channel->engine->register_tone_queue_low_callback().
 		   Feel free to correct me ;) */
 
 
-		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: branch 1, PTT flag = 0x%02x/%s", ptt_flag, cwdaemon_debug_ptt_flags());
+		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: branch 1, PTT flag = 0x%02x/%s", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 
-		cwdaemon_set_ptt_off(global_cwdevice, "PTT (auto) off");
+		cwdaemon_set_ptt_off(g_channel->cwdevice, "PTT (auto) off");
 
-	} else if (ptt_flag & PTT_ACTIVE_ECHO) {
+	} else if (g_channel->ptt_flag & PTT_ACTIVE_ECHO) {
 		/* PTT_ACTIVE_ECHO: client has used special request to
 		   indicate that it is waiting for reply (echo) from
 		   the server (i.e. cwdaemon) after the server plays
 		   all characters. */
 
-		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: branch 2, PTT flag = 0x%02x/%s", ptt_flag, cwdaemon_debug_ptt_flags());
+		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: branch 2, PTT flag = 0x%02x/%s", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 
 		/* Since echo is being sent, we can turn the flag off.
 		   For some reason cwdaemon works better when we turn the
 		   flag off before sending the reply, rather than turning
 		   if after sending the reply. */
-		ptt_flag &= ~PTT_ACTIVE_ECHO;
-		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: PTT flag -PTT_ACTIVE_ECHO, PTT flag = 0x%02x/%s", ptt_flag, cwdaemon_debug_ptt_flags());
+		g_channel->ptt_flag &= ~PTT_ACTIVE_ECHO;
+		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: PTT flag -PTT_ACTIVE_ECHO, PTT flag = 0x%02x/%s", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 
 
-		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: echoing \"%s\" back to client             <----------", reply_buffer);
+		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: echoing \"%s\" back to client             <----------", g_channel->reply_buffer);
 		// TODO (acerion) 2024.02.11: appending "\r\n" could/should be moved
 		// to cwdaemon_prepare_reply().
-		const size_t rbl = strlen(reply_buffer);
-		snprintf(reply_buffer + rbl, sizeof (reply_buffer) - rbl, "\r\n"); /* Ensure exactly one CRLF */
+		const size_t rbl = strlen(g_channel->reply_buffer);
+		snprintf(g_channel->reply_buffer + rbl, sizeof (g_channel->reply_buffer) - rbl, "\r\n"); /* Ensure exactly one CRLF */
 
 		// TODO (acerion) 2024.02.11: evaluate if this is a good idea to do a
 		// (potentially costly) network write operation inside of libcw's
 		// "low tone queue" callback.
-		cwdaemon_sendto(&g_cwdaemon, reply_buffer);
+		cwdaemon_sendto(g_channel, g_channel->reply_buffer);
 		/* If this line is uncommented, the callback erases a valid
 		   reply that should be sent back to client. Commenting the
 		   line fixes the problem, and doesn't seem to introduce
 		   any new ones.
 		   TODO: investigate the original problem of erasing a valid
 		   reply. */
-		/* reply_buffer[0] = '\0'; */
+		/* g_channel->reply_buffer[0] = '\0'; */
 
 
 		/* wait a bit more since we expect to get more text to send
@@ -1503,19 +2353,19 @@ void cwdaemon_tone_queue_low_callback(__attribute__((unused)) void *arg)
 		   I wonder why we don't call the callback directly,
 		   maybe it has something to do with avoiding
 		   recursion? */
-		if (ptt_flag == PTT_ACTIVE_AUTO) {
+		if (g_channel->ptt_flag == PTT_ACTIVE_AUTO) {
 			cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: queueing two empty tones");
-			cw_queue_tone(1, 0); /* ensure Q-empty condition again */
-			cw_queue_tone(1, 0); /* when trailing gap also 'sent' */
+			g_channel->engine->queue_tone(1, 0); /* ensure Q-empty condition again */
+			g_channel->engine->queue_tone(1, 0); /* when trailing gap also 'sent' */
 		}
 	} else {
 		/* TODO: how to correctly handle this case?
 		   Should we do something? */
-		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: branch 3, PTT flag = 0x%02x/%s", ptt_flag, cwdaemon_debug_ptt_flags());
+		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: branch 3, PTT flag = 0x%02x/%s", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 	}
 
 	cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "low TQ callback: end, TQ len = %d, PTT flag = 0x%02x/%s",
-		       cw_get_tone_queue_length(), ptt_flag, cwdaemon_debug_ptt_flags());
+		       g_channel->engine->get_tone_queue_length(), g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 
 	return;
 
@@ -1532,6 +2382,8 @@ static struct option cwdaemon_args_long[] = {
 #if defined(HAVE_SETPRIORITY) && defined(PRIO_PROCESS)
 	{ "priority",    required_argument,       0, 0},  /* Process priority. */
 #endif
+	{ "rt-priority", required_argument,       0, 0},  /* Priority for SCHED_FIFO policy. */
+	{ "rt-cpus",     required_argument,       0, 0},  /* CPUs to pin keying threads to. */
 	{ "wpm",         required_argument,       0, 0},  /* Sending speed. */
 	{ "pttdelay",    required_argument,       0, 0},  /* PTT delay [milliseconds]. */
 	{ "volume",      required_argument,       0, 0},  /* Sound volume. */
@@ -1541,6 +2393,17 @@ static struct option cwdaemon_args_long[] = {
 	{ "verbosity",   required_argument,       0, 'y' },  /* Verbosity of cwdaemon's debug strings. */
 	{ "libcwflags",  required_argument,       0, 'I' },  /* libcw's debug flags. */
 	{ "debugfile",   required_argument,       0, 0},  /* Path to output debug file. */
+	{ "tracefile",   required_argument,       0, 0},  /* Path to binary trace file. */
+	{ "keyer",       required_argument,       0, 0},  /* Keying engine. */
+	{ "paddles",     required_argument,       0, 0},  /* Mode of keyer driven by paddles. */
+	{ "idle-suspend", required_argument,      0, 0},  /* Idle time after which keying engine is closed. */
+	{ "sidetone",    required_argument,       0, 0},  /* Sink of sidetone of native keying engine. */
+	{ "ready-fd",    required_argument,       0, 0},  /* Descriptor for notification of readiness. */
+	{ "lazy-start",  no_argument,             0, 0},  /* Open keying engine on first request. */
+	{ "channel",     required_argument,       0, 0},  /* Extra keying channel: port and cwdevice. */
+	{ "unix-socket", required_argument,       0, 0},  /* Path of Unix-domain datagram socket. */
+	{ "udp-rcvbuf",  required_argument,       0, 0},  /* Size of receive buffer of UDP socket. */
+	{ "unix-rcvbuf", required_argument,       0, 0},  /* Size of receive buffer of Unix-domain socket. */
 	{ "system",      required_argument,       0, 0},  /* Audio system. */
 	{ "options",     required_argument,       0, 'o' },  /* Driver-specific options. */
 	{ "help",        no_argument,             0, 'h' },  /* Print help text and exit. */
@@ -1568,7 +2431,7 @@ void cwdaemon_args_process_long(options_t * defaults, int argc, char *argv[])
 			const char *optname = cwdaemon_args_long[option_index].name;
 
 			if (!strcmp(optname, "cwdevice")) {
-				if (0 != cwdaemon_option_cwdevice(&global_cwdevice, optarg)) {
+				if (0 != cwdaemon_option_cwdevice(&g_cwdaemon.cwdevice, optarg)) {
 					exit(EXIT_FAILURE);
 				}
 
@@ -1580,6 +2443,16 @@ void cwdaemon_args_process_long(options_t * defaults, int argc, char *argv[])
 					exit(EXIT_FAILURE);
 				}
 
+			} else if (!strcmp(optname, "rt-priority")) {
+				if (0 != cwdaemon_option_rt_priority(&g_rt_profile.priority, optarg)) {
+					exit(EXIT_FAILURE);
+				}
+
+			} else if (!strcmp(optname, "rt-cpus")) {
+				if (0 != cwdaemon_option_rt_cpus(&g_rt_profile.cpus, optarg)) {
+					exit(EXIT_FAILURE);
+				}
+
 			} else if (!strcmp(optname, "wpm")) {
 				if (!cwdaemon_params_wpm(&default_morse_speed, optarg)) {
 					exit(EXIT_FAILURE);
@@ -1622,6 +2495,67 @@ void cwdaemon_args_process_long(options_t * defaults, int argc, char *argv[])
 					exit(EXIT_FAILURE);
 				}
 
+			} else if (!strcmp(optname, "tracefile")) {
+				g_trace_file_path = optarg;
+
+			} else if (!strcmp(optname, "keyer")) {
+				g_cwdaemon.engine = engine_get_by_name(optarg);
+				if (NULL == g_cwdaemon.engine) {
+					cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__,
+						       "invalid requested keying engine: \"%s\"", optarg);
+					exit(EXIT_FAILURE);
+				}
+
+			} else if (!strcmp(optname, "paddles")) {
+				if (!iambic_mode_from_name(optarg, &g_paddles_mode)) {
+					cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__,
+						       "invalid requested mode of paddles: \"%s\"", optarg);
+					exit(EXIT_FAILURE);
+				}
+
+			} else if (!strcmp(optname, "idle-suspend")) {
+				if (0 != cwdaemon_option_idle_suspend(&g_idle_suspend_s, optarg)) {
+					exit(EXIT_FAILURE);
+				}
+
+			} else if (!strcmp(optname, "sidetone")) {
+				sidetone_sink_t sink = { 0 };
+				if (0 != cwdaemon_option_sidetone(&sink, optarg)) {
+					exit(EXIT_FAILURE);
+				}
+				sidetone_set_sink(&sink);
+
+			} else if (!strcmp(optname, "ready-fd")) {
+				if (0 != cwdaemon_option_ready_fd(&g_ready_fd, optarg)) {
+					exit(EXIT_FAILURE);
+				}
+
+			} else if (!strcmp(optname, "lazy-start")) {
+				g_lazy_start = true;
+
+			} else if (!strcmp(optname, "channel")) {
+				in_port_t port = 0;
+				char device[PATH_MAX] = { 0 };
+				if (0 != cwdaemon_option_channel(&port, device, sizeof (device), optarg)
+				    || !cwdaemon_channel_add(port, device)) {
+					exit(EXIT_FAILURE);
+				}
+
+			} else if (!strcmp(optname, "unix-socket")) {
+				if (0 != cwdaemon_option_unix_socket(&g_cwdaemon.unix_socket_path, optarg)) {
+					exit(EXIT_FAILURE);
+				}
+
+			} else if (!strcmp(optname, "udp-rcvbuf")) {
+				if (0 != cwdaemon_option_rcvbuf(&g_cwdaemon.network_rcvbuf, optarg)) {
+					exit(EXIT_FAILURE);
+				}
+
+			} else if (!strcmp(optname, "unix-rcvbuf")) {
+				if (0 != cwdaemon_option_rcvbuf(&g_cwdaemon.unix_rcvbuf, optarg)) {
+					exit(EXIT_FAILURE);
+				}
+
 			} else if (!strcmp(optname, "system")) {
 				if (!cwdaemon_params_system(&default_audio_system, optarg)) {
 					exit(EXIT_FAILURE);
@@ -1653,7 +2587,7 @@ void cwdaemon_args_process_short(options_t * defaults, int c, const char *optarg
 		cwdaemon_args_help();
 		exit(EXIT_SUCCESS);
 	case 'd':
-		if (0 != cwdaemon_option_cwdevice(&global_cwdevice, optarg)) {
+		if (0 != cwdaemon_option_cwdevice(&g_cwdaemon.cwdevice, optarg)) {
 			exit(EXIT_FAILURE);
 		}
 		break;
@@ -1737,7 +2671,7 @@ void cwdaemon_args_process_short(options_t * defaults, int c, const char *optarg
 		}
 		break;
 	case 'o':
-		if (!cwdaemon_params_options(global_cwdevice, optarg)) {
+		if (!cwdaemon_params_options(g_cwdaemon.cwdevice, optarg)) {
 			exit(EXIT_FAILURE);
 		}
 		break;
@@ -1923,10 +2857,14 @@ void cwdaemon_params_version(void)
 {
 	printf("%s version %s\n", PACKAGE, VERSION);
 
+#if HAVE_LIBCW
 	const uint32_t v = (uint32_t) cw_version();
 	const uint32_t current = (v & 0xffff0000) >> 16U;
 	const uint32_t revision =  v & 0x0000ffff;
 	printf("Linked with libcw version: %"PRIu32".%"PRIu32"\n", current, revision);
+#else
+	printf("Built without libcw\n");
+#endif
 	return;
 }
 
@@ -2019,7 +2957,7 @@ bool cwdaemon_params_system(int *system, const char *optarg)
 	}
 
 	cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__,
-		       "requested sound system: \"%s\" (\"%s\")", optarg, cw_get_audio_system_label(*system));
+		       "requested sound system: \"%s\" (\"%s\")", optarg, engine_get_audio_system_label(*system));
 	return true;
 }
 
@@ -2039,31 +2977,37 @@ bool cwdaemon_params_ptt_on_off(const char *optarg)
 	}
 
 	if (lv) {
-		//global_cwdevice->ptt(global_cwdevice, ON);
-		if (g_current_ptt_delay_ms) {
-			cwdaemon_set_ptt_on(global_cwdevice, "PTT (manual, delay) on");
+		//g_channel->cwdevice->ptt(g_channel->cwdevice, ON);
+		if (g_channel->ptt_delay_ms && g_channel->engine->set_ptt_timing) {
+			/* Keyer controls PTT only around keyed text. Manual PTT
+			   is forced on cwdevice. */
+			keying_io_post(keying_io_instance(g_channel->channel), g_channel->cwdevice, KEYING_IO_PIN_PTT, ON);
+			trace_event(TRACE_EVENT_PTT, ON, g_channel->ptt_flag);
+			cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "PTT (manual) on");
+		} else if (g_channel->ptt_delay_ms) {
+			cwdaemon_set_ptt_on(g_channel->cwdevice, "PTT (manual, delay) on");
 		} else {
 			cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "PTT (manual, immediate) on");
 		}
 
-		ptt_flag |= PTT_ACTIVE_MANUAL;
-		cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag +PTT_ACTIVE_MANUAL (0x%02x/%s)", ptt_flag, cwdaemon_debug_ptt_flags());
+		g_channel->ptt_flag |= PTT_ACTIVE_MANUAL;
+		cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag +PTT_ACTIVE_MANUAL (0x%02x/%s)", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 
-	} else if (ptt_flag & PTT_ACTIVE_MANUAL) {	/* only if manually activated */
+	} else if (g_channel->ptt_flag & PTT_ACTIVE_MANUAL) {	/* only if manually activated */
 
-		ptt_flag &= ~PTT_ACTIVE_MANUAL;
-		cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag -PTT_ACTIVE_MANUAL (0x%02x/%s)", ptt_flag, cwdaemon_debug_ptt_flags());
+		g_channel->ptt_flag &= ~PTT_ACTIVE_MANUAL;
+		cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag -PTT_ACTIVE_MANUAL (0x%02x/%s)", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 
-		if (!(ptt_flag & !PTT_ACTIVE_AUTO)) {	/* no PTT modifiers; FIXME 2022.03.10: shouldn't this be "~PTT_ACTIVE_AUTO"? */
+		if (!(g_channel->ptt_flag & !PTT_ACTIVE_AUTO)) {	/* no PTT modifiers; FIXME 2022.03.10: shouldn't this be "~PTT_ACTIVE_AUTO"? */
 
-			if (request_queue[0] == '\0'/* no new text in the meantime */
-			    && cw_get_tone_queue_length() <= 1) {
+			if (g_channel->request_queue[0] == '\0'/* no new text in the meantime */
+			    && g_channel->engine->get_tone_queue_length() <= 1) {
 
-				cwdaemon_set_ptt_off(global_cwdevice, "PTT (manual, immediate) off");
+				cwdaemon_set_ptt_off(g_channel->cwdevice, "PTT (manual, immediate) off");
 			} else {
 				/* still sending, cannot yet switch PTT off */
-				ptt_flag |= PTT_ACTIVE_AUTO;	/* ensure auto-PTT active */
-				cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag +PTT_ACTIVE_AUTO (0x%02x/%s)", ptt_flag, cwdaemon_debug_ptt_flags());
+				g_channel->ptt_flag |= PTT_ACTIVE_AUTO;	/* ensure auto-PTT active */
+				cwdaemon_debug(CWDAEMON_VERBOSITY_D, __func__, __LINE__, "PTT flag +PTT_ACTIVE_AUTO (0x%02x/%s)", g_channel->ptt_flag, cwdaemon_debug_ptt_flags());
 
 				cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "reverting from PTT (manual) to PTT (auto) now");
 			}
@@ -2084,7 +3028,7 @@ bool cwdaemon_params_ptt_on_off(const char *optarg)
 */
 bool cwdaemon_params_options(cwdevice * dev, const char *optarg)
 {
-	/* FIXME: the program sets global_cwdevice to null device (in
+	/* FIXME: the program sets g_cwdaemon.cwdevice to null device (in
 	   cwdaemon_cwdevice_init()) before command line args are parsed, so
 	   this pointer should never be NULL. How to recognize if -o options
 	   were passed AFTER -d? */
@@ -2125,8 +3069,8 @@ void cwdaemon_args_parse(options_t * defaults, int argc, char *argv[])
 	// The call to this function makes sense only after all instances of "-o"
 	// option have been successfully parsed and there is a full and final set
 	// of cwdevice options to be validated as a whole.
-	if (global_cwdevice && global_cwdevice->options.optvalidate) {
-		if (0 != global_cwdevice->options.optvalidate(global_cwdevice)) {
+	if (g_cwdaemon.cwdevice && g_cwdaemon.cwdevice->options.optvalidate) {
+		if (0 != g_cwdaemon.cwdevice->options.optvalidate(g_cwdaemon.cwdevice)) {
 			cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "cw device options are not valid");
 			exit(EXIT_FAILURE);
 		}
@@ -2149,6 +3093,9 @@ int main(int argc, char *argv[])
 	   output is configured according to command line switches,
 	   use the default "stdout" file. */
 	cwdaemon_debug_f = stdout;
+	g_start_ns = cwdaemon_now_ns();
+	g_argc = argc;
+	g_argv = argv;
 
 	atexit(cwdaemon_cwdevices_free);
 	if (!cwdaemon_cwdevices_init()) {
@@ -2156,12 +3103,12 @@ int main(int argc, char *argv[])
 	}
 
 	atexit(cwdaemon_cwdevice_free);
-	/* Sets global_cwdevice to null device. This may be overridden
+	/* Sets g_cwdaemon.cwdevice to null device. This may be overridden
 	   with command line argument. */
 	cwdaemon_cwdevice_init();
 
 	cwdaemon_args_parse(&g_default_options, argc, argv);
-	cwdevice * dev = global_cwdevice;
+	cwdevice * dev = g_cwdaemon.cwdevice;
 
 	atexit(cwdaemon_debug_close);
 	/* Call cwdaemon_debug_open() after parsing command line
@@ -2174,6 +3121,59 @@ int main(int argc, char *argv[])
 	   later stage, so that as many debug strings as possible are
 	   being printed to stdout before main daemon loop? */
 	cwdaemon_debug_open(g_forking);
+	/* Messages from initialization of the daemon (e.g. the report of
+	   real-time profile) should be logged with threshold requested in
+	   command line. */
+	log_set_threshold(g_default_options.log_threshold);
+
+	if (g_cwdaemon.cwdevice == &cwdevice_winkeyer && g_cwdaemon.engine != &engine_winkeyer) {
+		if (g_cwdaemon.engine) {
+			log_warning("Keying engine \"%s\" can't key WinKeyer, using \"%s\" keying engine", g_cwdaemon.engine->name, engine_winkeyer.name);
+		}
+		g_cwdaemon.engine = &engine_winkeyer;
+	}
+	if (NULL == g_cwdaemon.engine) {
+		g_cwdaemon.engine = engine_get_default();
+	}
+	if (g_cwdaemon.engine == &engine_native && CW_AUDIO_NULL != default_audio_system
+	    && !cwdaemon_engine_supports_audio_system(default_audio_system)
+	    && cwdaemon_engine_supports_audio_system(CW_AUDIO_SOUNDCARD)) {
+		/* Sidetone sink has been configured, but the default
+		   sound system (console buzzer) can't be used with it. */
+		log_warning("Keying engine \"%s\" plays sidetone only on sound card, using \"%s\" sound system",
+		            g_cwdaemon.engine->name, engine_get_audio_system_label(CW_AUDIO_SOUNDCARD));
+		default_audio_system = CW_AUDIO_SOUNDCARD;
+	}
+	if (!cwdaemon_engine_supports_audio_system(default_audio_system)) {
+		log_warning("Keying engine \"%s\" has no sidetone, using \"%s\" sound system",
+		            g_cwdaemon.engine->name, engine_get_audio_system_label(CW_AUDIO_NULL));
+		default_audio_system = CW_AUDIO_NULL;
+	}
+	if (vclock_enabled() && g_cwdaemon.engine != &engine_native) {
+		log_warning("Virtual clock drives only \"%s\" keying engine, keying engine \"%s\" uses real time",
+		            engine_native.name, g_cwdaemon.engine->name);
+	}
+
+	/* Service manager (or previous cwdaemon process on hand-over)
+	   passes the socket to the process that it has started, so the
+	   socket must be taken over before fork(). */
+	in_port_t const requested_port = g_cwdaemon.network_port;
+	int passed = cwdaemon_socket_activation(&g_cwdaemon);
+	if (0 == passed) {
+		passed = handoff_receive(&g_cwdaemon);
+	}
+	if (passed < 0) {
+		exit(EXIT_FAILURE);
+	}
+	if (passed > 0 && CWDAEMON_NETWORK_PORT_DEFAULT != requested_port && requested_port != g_cwdaemon.network_port) {
+		log_warning("Ignoring requested network port %u, using port %u of passed socket",
+		            (unsigned int) requested_port, (unsigned int) g_cwdaemon.network_port);
+	}
+
+	/* Path to the program is resolved before chdir(). */
+	if (0 != handoff_listen(argv[0])) {
+		log_warning("Hand-over to new process won't be possible %s", "");
+	}
 
 	if (g_forking) {
 
@@ -2248,59 +3248,188 @@ int main(int argc, char *argv[])
 	}
 #endif
 
-	/* Initialize libcw (and other things) here, this late, to be
-	   sure that libcw has been initialized and is used only by
-	   child process, not by parent process. */
-	atexit(cwdaemon_close_libcw_output);
-	if (0 != cwdaemon_reset_almost_all(dev)) {
+	if (g_trace_file_path) {
+		atexit(trace_close);
+		if (0 != trace_open(g_trace_file_path, TRACE_RINGS_COUNT_DEFAULT, TRACE_RING_CAPACITY_DEFAULT)) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Start the logging thread after fork(): threads don't survive
+	   fork(). atexit() handlers are called in reverse order, so the
+	   thread will write pending messages before debug output is
+	   closed. */
+	atexit(log_async_stop);
+	if (0 != log_async_start()) {
+		exit(EXIT_FAILURE);
+	}
+
+	/* Set real-time profile before keying threads are started: each
+	   of them applies the profile to itself, main thread and helper
+	   threads keep default scheduling. */
+	rt_profile_set(&g_rt_profile);
+
+	/* Keying I/O thread applies real-time profile. It's stopped
+	   (atexit()) after keying engine has been closed and before
+	   cwdevice is freed. */
+	atexit(keying_io_stop_all);
+	if (0 != keying_io_start(keying_io_instance(g_cwdaemon.channel))) {
+		exit(EXIT_FAILURE);
+	}
+
+	/* Initialize keying engine (and other things) here, this late,
+	   to be sure that the engine has been initialized and is used
+	   only by child process, not by parent process. */
+	atexit(cwdaemon_report_resume_stats);
+	atexit(cwdaemon_close_keying_engine);
+	if (g_lazy_start && IAMBIC_MODE_NONE == g_paddles_mode) {
+		/* Opening of sound device may take seconds (OSS: up to 20
+		   seconds). Start in suspended state, and let the first
+		   request (or footswitch) resume the engine, while control
+		   requests are handled right away. Keyer of paddles needs
+		   the engine at any time, so the start is never lazy with
+		   paddles. */
+		cwdaemon_reset_basic_params();
+		g_cwdaemon.has_audio_output = true;
+		g_cwdaemon.engine_suspended = true;
+		log_info("Keying engine will be opened on first request %s", "");
+	} else if (0 != cwdaemon_reset_almost_all(dev)) {
 		/* Failed to open libcw output. */
 		exit(EXIT_FAILURE);
 	}
+	g_cwdaemon.last_activity_ns = cwdaemon_now_ns();
+
+	/* Input thread drives keying engine with paddles, so it's
+	   stopped (atexit()) before keying engine is closed and before
+	   cwdevice is freed. */
+	atexit(input_stop);
+	input_set_keyer(g_cwdaemon.engine, g_paddles_mode, cwdaemon_current_wpm, cwdaemon_current_tone);
+	if (0 != input_start(g_cwdaemon.cwdevice)) {
+		exit(EXIT_FAILURE);
+	}
 
+	/* Threads of other keying channels are stopped (atexit()) before
+	   keying engine of main channel is closed, and before keying I/O
+	   thread is stopped. */
+	atexit(cwdaemon_channels_stop);
+	cwdaemon_channels_start();
+
+#if HAVE_LIBCW
 	if (0 != g_libcw_debug_flags) {
 		// We are debugging libcw as well.
 		set_libcw_debugging(&cw_debug_object, g_current_options.log_threshold, g_libcw_debug_flags);
 	}
+#endif
 
 #ifndef CWDAEMON_GITHUB_ISSUE_6_FIXED
 	fprintf(stderr, "With re-registration not fixed\n");
-	cw_register_keying_callback(cwdaemon_keyingevent, dev);
+	g_cwdaemon.engine->register_keying_callback(cwdaemon_keyingevent, dev);
 #endif
 
+	/* Socket is bound, keying engine and threads are running: tell
+	   the parent (or service manager) that we are ready. */
+	/* On hand-over, previous process waits for our readiness, and
+	   then exits. */
+	if (0 != handoff_complete()) {
+		exit(EXIT_FAILURE);
+	}
+	atexit(notify_stopping);
+	notify_ready(g_ready_fd);
+	g_ready_fd = -1;
+	log_info("Startup has taken %llu us",
+	         (unsigned long long) (cwdaemon_now_ns() - g_start_ns) / 1000);
+
 
 	/* The main loop of cwdaemon. */
-	request_queue[0] = '\0';
+	g_cwdaemon.request_queue[0] = '\0';
 	do {
 		fd_set readfd;
 		struct timeval udptime;
 
 		FD_ZERO(&readfd);
 		FD_SET(g_cwdaemon.socket_descriptor, &readfd);
+		int max_fd = g_cwdaemon.socket_descriptor;
+		int const unix_fd = g_cwdaemon.unix_socket_descriptor;
+		if (unix_fd != -1) {
+			FD_SET(unix_fd, &readfd);
+			max_fd = unix_fd > max_fd ? unix_fd : max_fd;
+		}
+		int const input_fd = input_get_fd();
+		if (input_fd != -1) {
+			FD_SET(input_fd, &readfd);
+			max_fd = input_fd > max_fd ? input_fd : max_fd;
+		}
+		int const sound_fd = sound_get_fd();
+		if (sound_fd != -1) {
+			FD_SET(sound_fd, &readfd);
+			max_fd = sound_fd > max_fd ? sound_fd : max_fd;
+		}
+		int const handoff_fd = handoff_get_fd();
+		if (handoff_fd != -1) {
+			FD_SET(handoff_fd, &readfd);
+			max_fd = handoff_fd > max_fd ? handoff_fd : max_fd;
+		}
 
-		if (inactivity_seconds < 30) {
+		if (__atomic_load_n(&inactivity_seconds, __ATOMIC_RELAXED) < 30) {
 			udptime.tv_sec = 1;
-			inactivity_seconds++;
+			__atomic_add_fetch(&inactivity_seconds, 1, __ATOMIC_RELAXED);
 		} else {
 			udptime.tv_sec = 86400;
 		}
+		if (g_idle_suspend_s && !g_cwdaemon.engine_suspended) {
+			/* Check idleness of keying engine every second. */
+			udptime.tv_sec = 1;
+		}
 
 		udptime.tv_usec = 0;
 		/* udptime.tv_usec = 999000; */	/* 1s is more than enough */
-		int fd_count = select(g_cwdaemon.socket_descriptor + 1, &readfd, NULL, NULL, &udptime);
+		int fd_count = vclock_select(max_fd + 1, &readfd, NULL, NULL, &udptime);
 		/* int fd_count = select(g_cwdaemon.socket_descriptor + 1, &readfd, NULL, NULL, NULL); */
 		if (fd_count == -1 && errno != EINTR) {
 			cwdaemon_errmsg("Select");
+		} else if (fd_count > 0 && handoff_fd != -1 && FD_ISSET(handoff_fd, &readfd)) {
+			if (handoff_requested()) {
+				/* Requests that are already waiting in the
+				   socket are left for new process. */
+				cwdaemon_hand_over();
+			}
+		} else if (fd_count > 0
+		           && ((input_fd != -1 && FD_ISSET(input_fd, &readfd))
+		               || (sound_fd != -1 && FD_ISSET(sound_fd, &readfd)))) {
+
+			if (input_fd != -1 && FD_ISSET(input_fd, &readfd)) {
+				/* State of footswitch has changed. Input thread
+				   has debounced it, use the most recent state. */
+				int state = 0;
+				bool changed = false;
+				while (input_read(&state)) {
+					changed = true;
+					vclock_release(); /* Held by input thread. */
+				}
+				if (changed) {
+					cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "footswitch %s", state ? "up" : "down");
+					keying_io_post(keying_io_instance(g_cwdaemon.channel), g_cwdaemon.cwdevice, KEYING_IO_PIN_PTT, !state);
+					/* Operator is going to transmit. */
+					g_footswitch_pressed = !state;
+					if (g_footswitch_pressed) {
+						cwdaemon_resume_keying_engine("footswitch");
+					}
+				}
+			}
+			if (sound_fd != -1 && FD_ISSET(sound_fd, &readfd)) {
+				/* Probe of sound system requested by client has
+				   finished. */
+				cwdaemon_finish_sound_system_switch();
+			}
+			if (FD_ISSET(g_cwdaemon.socket_descriptor, &readfd)
+			    || (unix_fd != -1 && FD_ISSET(unix_fd, &readfd))) {
+				cwdaemon_receive();
+			}
 		} else {
 			cwdaemon_receive();
 		}
 
-#if defined (HAVE_LINUX_PPDEV_H) || defined (HAVE_DEV_PPBUS_PPI_H)
-		if (global_cwdevice->footswitch) {
-			int state = global_cwdevice->footswitch(global_cwdevice);
-			global_cwdevice->ptt(global_cwdevice, !state);
-		}
-#endif
-
+		cwdaemon_suspend_idle_keying_engine();
 	} while (1);
 
 	exit(EXIT_SUCCESS);
@@ -2339,6 +3468,13 @@ bool cwdaemon_cwdevices_init(void)
 		return false;
 	}
 
+#if HAVE_LINUX_GPIO_H
+	if (0 != gpio_init_cwdevice(&cwdevice_gpio)) {
+		log_error("Failed to initialize GPIO cwdevice %s", "");
+		return false;
+	}
+#endif
+
 
 	/* Default device description of null port. */
 	cwdevice_null.desc = strdup("null");
@@ -2371,6 +3507,28 @@ void cwdaemon_cwdevices_free(void)
 		cwdevice_null.desc = NULL;
 	}
 
+	if (cwdevice_recorder.desc) {
+		free(cwdevice_recorder.desc);
+		cwdevice_recorder.desc = NULL;
+	}
+
+#if HAVE_LINUX_GPIO_H
+	if (cwdevice_gpio.desc) {
+		free(cwdevice_gpio.desc);
+		cwdevice_gpio.desc = NULL;
+	}
+#endif
+
+	if (cwdevice_winkeyer.desc) {
+		free(cwdevice_winkeyer.desc);
+		cwdevice_winkeyer.desc = NULL;
+	}
+
+	if (cwdevice_composite.desc) {
+		free(cwdevice_composite.desc);
+		cwdevice_composite.desc = NULL;
+	}
+
 #if defined (HAVE_LINUX_PPDEV_H) || defined (HAVE_DEV_PPBUS_PPI_H)
 	if (cwdevice_lp.desc) {
 		free(cwdevice_lp.desc);
@@ -2385,11 +3543,126 @@ void cwdaemon_cwdevices_free(void)
 
 
 
+/**
+   \brief Find type of cwdevice named by given device name
+
+   \param[in] desc name of device, e.g. "ttyS0"
+   \param[out] fd file descriptor of opened device
+   \param[out] valid false if the device was found but can't be used
+
+   \return template of cwdevice of found type
+   \return NULL if \p desc doesn't name any known cwdevice
+*/
+static cwdevice * cwdaemon_cwdevice_probe(char const * desc, int * fd, bool * valid)
+{
+	*valid = true;
+
+	// Recording device, WinKeyer and GPIO chip are probed first: probing
+	// them as tty would create noise in logs.
+	if ((*fd = recorder_probe_cwdevice(desc)) != -1) {
+		return &cwdevice_recorder;
+	}
+	if ((*fd = winkeyer_probe_cwdevice(desc)) != -1) {
+		return &cwdevice_winkeyer;
+	}
+#if HAVE_LINUX_GPIO_H
+	if ((*fd = gpio_probe_cwdevice(desc)) != -1) {
+		return &cwdevice_gpio;
+	}
+#endif
+	if ((*fd = tty_probe_cwdevice(desc)) != -1) {
+		return &cwdevice_ttys;
+	}
+#if defined (HAVE_LINUX_PPDEV_H) || defined (HAVE_DEV_PPBUS_PPI_H)
+	if ((*fd = lp_probe_cwdevice(desc)) != -1) {
+		if (geteuid()) {
+			cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__,
+				       "you must run this program as root to use parallel port");
+			close(*fd);
+			*fd = -1;
+			*valid = false;
+			return NULL;
+		}
+		return &cwdevice_lp;
+	}
+#endif
+	if ((*fd = null_probe_cwdevice(desc)) != -1) {
+		return &cwdevice_null;
+	}
+
+	return NULL;
+}
+
+
+
+
+/**
+   \brief Create a child of composite cwdevice
+
+   The child is a copy of template of cwdevice of given type, with its own
+   options, state of lines and name.
+
+   \param[in] desc name of child device, e.g. "ttyUSB0"
+
+   \return allocated cwdevice, not initialized yet
+   \return NULL if \p desc doesn't name a valid cwdevice
+*/
+static cwdevice * cwdaemon_cwdevice_new(char const * desc)
+{
+	int fd = -1;
+	bool valid = false;
+	cwdevice const * const template = cwdaemon_cwdevice_probe(desc, &fd, &valid);
+	if (NULL == template) {
+		return NULL;
+	}
+	if (template == &cwdevice_winkeyer) {
+		// Text is keyed by the keyer itself, not by edges forwarded to
+		// children of composite device or to cwdevice of extra channel.
+		log_error("WinKeyer [%s] can't be a part of composite cwdevice or a cwdevice of extra keying channel", desc);
+		close(fd);
+		return NULL;
+	}
+
+	cwdevice * const child = malloc(sizeof (cwdevice));
+	if (NULL == child) {
+		close(fd);
+		return NULL;
+	}
+	if (template == &cwdevice_ttys) {
+		// Start from default options, not from options of cwdevice_ttys.
+		tty_init_cwdevice(child);
+		free(child->desc);
+	}
+#if HAVE_LINUX_GPIO_H
+	else if (template == &cwdevice_gpio) {
+		gpio_init_cwdevice(child);
+		free(child->desc);
+	}
+#endif
+	else {
+		*child = *template;
+	}
+	child->desc = strdup(desc);
+	child->fd = fd;
+	child->shadow.valid = false;
+	child->shadow.data_valid = false;
+	if (NULL == child->desc) {
+		close(fd);
+		free(child);
+		return NULL;
+	}
+
+	return child;
+}
+
+
+
+
 /**
    \brief Assign correct device type to given device variable
 
    A device setup function. The function takes device name (description)
-   \p desc, guesses device type (parport/tty/null), and assigns the guessed
+   \p desc, guesses device type (parport/tty/gpio/null/record), and assigns the guessed
    device to given \p device.
 
    Function assigns to \p device a pointer to global variable, there is
@@ -2414,28 +3687,24 @@ bool cwdaemon_cwdevice_set(cwdevice **device, const char *desc)
 {
 	cwdevice * const old_device = *device;
 
-	int fd = tty_probe_cwdevice(desc);
-	if (fd != -1) {
-		*device = &cwdevice_ttys;
-	}
-#if defined (HAVE_LINUX_PPDEV_H) || defined (HAVE_DEV_PPBUS_PPI_H)
-	else if ((fd = lp_probe_cwdevice(desc)) != -1) {
-		if (geteuid()) {
-			cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__,
-				       "you must run this program as root to use parallel port");
+	int fd = -1;
+	cwdevice * new_device = NULL;
+	if (0 == composite_probe_cwdevice(desc, cwdaemon_cwdevice_new)) {
+		new_device = &cwdevice_composite;
+	} else {
+		bool valid = false;
+		new_device = cwdaemon_cwdevice_probe(desc, &fd, &valid);
+		if (!valid) {
 			return false;
 		}
-		*device = &cwdevice_lp;
-	}
-#endif
-	else if ((fd = null_probe_cwdevice(desc)) != -1) {
-		*device = &cwdevice_null;
-	} else {
-		log_warning("no valid device found, setting cwdevice to null device %s", "");
-		/* It's better to have null device than NULL
-		   pointer. */
-		*device = &cwdevice_null;
+		if (NULL == new_device) {
+			log_warning("no valid device found, setting cwdevice to null device %s", "");
+			/* It's better to have null device than NULL
+			   pointer. */
+			new_device = &cwdevice_null;
+		}
 	}
+	*device = new_device;
 
 	if (!*device) {
 		cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__,
@@ -2443,7 +3712,12 @@ bool cwdaemon_cwdevice_set(cwdevice **device, const char *desc)
 		return false;
 	}
 
-	// Close old cwdevice and release its resources.
+	// Close old cwdevice and release its resources. Commands for
+	// the old cwdevice may be still waiting in keying I/O thread,
+	// and input thread may be reading its input lines.
+	bool const input_monitored = input_is_running();
+	input_stop();
+	keying_io_sync(keying_io_instance(g_channel->channel));
 	if (old_device) {
 		if (old_device->free) {
 			old_device->free(old_device);
@@ -2477,6 +3751,9 @@ bool cwdaemon_cwdevice_set(cwdevice **device, const char *desc)
 	if ((*device)->init) {
 		(*device)->init(*device, fd);
 	}
+	if (input_monitored) {
+		input_start(*device);
+	}
 
 	/*
 	  TODO (acerion) 2023.05.03: clang-tidy-11 complains that "Access to
@@ -2498,20 +3775,20 @@ bool cwdaemon_cwdevice_set(cwdevice **device, const char *desc)
 
 
 /**
-   \brief Assign initial value to global_cwdevice
+   \brief Assign initial value to g_cwdaemon.cwdevice
 
-   Assign some initial value (initial device) to global_cwdevice,
+   Assign some initial value (initial device) to g_cwdaemon.cwdevice,
    before the device will be configured through command line options.
 
    If cwdaemon will be started without any device specified in command
-   line, we could end up with global_cwdevice being NULL pointer.
+   line, we could end up with g_cwdaemon.cwdevice being NULL pointer.
 
 */
 void cwdaemon_cwdevice_init(void)
 {
-	global_cwdevice = &cwdevice_null;
+	g_cwdaemon.cwdevice = &cwdevice_null;
 
-	/* cwdevice_null->desc (and now global_cwdevice->desc) has
+	/* cwdevice_null->desc (and now g_cwdaemon.cwdevice->desc) has
 	   been set in cwdaemon_cwdevices_init(). */
 
 	return;
@@ -2532,10 +3809,10 @@ void cwdaemon_cwdevice_init(void)
 */
 void cwdaemon_cwdevice_free(void)
 {
-	if (global_cwdevice
-	    && global_cwdevice->free) {
+	if (g_cwdaemon.cwdevice
+	    && g_cwdaemon.cwdevice->free) {
 
-		global_cwdevice->free(global_cwdevice);
+		g_cwdaemon.cwdevice->free(g_cwdaemon.cwdevice);
 	}
 
 	return;
@@ -2552,6 +3829,7 @@ void cwdaemon_close_socket_wrapper(void)
 
 
 
+#if HAVE_LIBCW
 /// @brief Configure debugging of libcw
 ///
 /// @reviewed_on{2024.05.10}
@@ -2589,4 +3867,5 @@ static void set_libcw_debugging(cw_debug_t * debug_object, int log_threshold, ui
 
 	return;
 }
+#endif
 
@@ -41,8 +41,13 @@
 # include <sys/socket.h>
 #endif
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
+#include "cwdevice_io.h"
+#include "gpio.h"
 #include "ttys.h"
 
 
@@ -84,6 +89,15 @@
 #define CWDAEMON_PTT_DELAY_MIN                  0 /* [ms] */
 #define CWDAEMON_PTT_DELAY_MAX                 50 /* [ms] */
 
+/* Time of inactivity after which keying engine is closed. Zero: never. */
+#define CWDAEMON_IDLE_SUSPEND_DEFAULT           0 /* [s] */
+#define CWDAEMON_IDLE_SUSPEND_MAX           86400 /* [s] */
+
+/* Size of receive buffer of a socket (SO_RCVBUF). Zero: system's default. */
+#define CWDAEMON_RCVBUF_DEFAULT                 0 /* [bytes] */
+#define CWDAEMON_RCVBUF_MIN                  1024 /* [bytes] */
+#define CWDAEMON_RCVBUF_MAX      (16 * 1024 * 1024) /* [bytes] */
+
 
 
 
@@ -108,6 +122,12 @@
 #define CWDAEMON_REQUEST_SIZE_MAX                                256 /**< Size of cwdaemon's buffer for a request. */
 #define CWDAEMON_REPLY_SIZE_MAX      (CWDAEMON_REQUEST_SIZE_MAX + 1) /**< Size of cwdaemon's buffer for a reply. */
 
+#define CWDAEMON_REQUEST_QUEUE_SIZE_MAX 4000 /* Maximal size of common buffer/fifo where requests may be pushed to. */
+
+/// Max count of keying channels in one process: the main channel and
+/// channels added with "--channel" command line option.
+#define CWDAEMON_CHANNELS_MAX  4
+
 
 
 
@@ -131,6 +151,7 @@
 #define CWDAEMON_ESC_REQUEST_SOUND_SYSTEM 'f' /**< ``'f'`` character == 0x66; set sound system (Null/OSS/ALSA/PulseAudio). Formerly known as SDEVICE. */
 #define CWDAEMON_ESC_REQUEST_VOLUME       'g' /**< ``'g'`` character == 0x67; set volume of sound [%]. */
 #define CWDAEMON_ESC_REQUEST_REPLY        'h' /**< ``'h'`` character == 0x68; specify reply to be sent by cwdaemon after playing text. */
+#define CWDAEMON_ESC_REQUEST_LOG_THRESHOLD 'i' /**< ``'i'`` character == 0x69; set threshold of cwdaemon's logs (n/e/w/i/d). */
 
 
 
@@ -160,6 +181,22 @@ typedef struct cwdev_s {
 	int (*switchband) (struct cwdev_s *, unsigned char bandswitch);
 	int (*footswitch) (struct cwdev_s *);
 
+	/// Get state of paddle contacts: IAMBIC_PADDLE_DOT and
+	/// IAMBIC_PADDLE_DASH bits (iambic.h) of pressed paddles. NULL if
+	/// cwdevice has no inputs for paddles.
+	int (*paddles) (struct cwdev_s *);
+
+	/// Block until state of input lines (footswitch, paddles) may have changed.
+	/// Return -1 with errno set to EINTR when interrupted by a signal.
+	/// NULL if driver can't wait for changes of input lines. Then the
+	/// lines are polled with cwdevice::footswitch().
+	int (*wait_input) (struct cwdev_s *);
+
+	/// CLOCK_MONOTONIC time stamp [ns] of most recent change of input
+	/// lines, as reported by kernel to cwdevice::wait_input(). Zero if
+	/// driver doesn't get time stamps of changes.
+	int64_t input_event_ns;
+
 	/// Options of driver controlling a cwdevice. Not all cwdevice types
 	/// support changing options through command line.
 	struct {
@@ -176,11 +213,44 @@ typedef struct cwdev_s {
 
 		union {
 			tty_driver_options tty_options;
+			gpio_driver_options gpio_options;
 		} u;
 	} options;
 
 	int fd;
-	char *desc; /* "parport0", "ttyS0", "null" - name of device used for keying. */
+	char *desc; /* "parport0", "ttyS0", "null", "record:<path>", "ttyS0+record:<path>" - name of device used for keying. */
+
+	/// Backend performing I/O operations on fd. NULL for devices that
+	/// don't do any I/O.
+	cwdevice_io_t const * io;
+
+	/// Constant latency of changing a pin of cwdevice [microseconds], i.e.
+	/// time from a call to cwdevice::cw() or cwdevice::ptt() to actual
+	/// change of state of the pin. Configured or measured by driver, and
+	/// compensated by cwdaemon where an interval is counted from a pin
+	/// change (PTT delay).
+	unsigned int latency_us;
+
+	/// Last known state of output lines of cwdevice. Drivers use it to
+	/// skip operations that wouldn't change state of any line, and to
+	/// change several lines with a single operation.
+	struct {
+		bool valid;          ///< Is "lines" known?
+		unsigned int lines;  ///< tty: TIOCM_* bits. lp: control register.
+		bool data_valid;     ///< Is "data" known?
+		unsigned char data;  ///< lp: data register (band switch).
+	} shadow;
+
+	/// File of recording cwdevice (recorder.h). NULL header for other
+	/// cwdevices.
+	struct {
+		struct recorder_file_header_s * header;
+		size_t size;
+	} recorder;
+
+	/// Children of composite cwdevice (composite.h). NULL for other
+	/// cwdevices.
+	struct composite_s * composite;
 }
 cwdevice;
 
@@ -203,20 +273,92 @@ bool cwdaemon_cwdevice_set(cwdevice ** device, char const * desc)  __attribute__
 
 
 
-/// Instance of a cwdaemon server
+struct engine_t;
+
+
+
+
+/// Instance of a cwdaemon server: a keying channel
+///
+/// Each channel has its own socket, cwdevice, keying engine, parameters
+/// and queue of requests, so several radios can be keyed at the same time
+/// by one process. The main channel (index zero) is configured with
+/// regular command line options, and its requests are handled by main
+/// thread. Requests of other channels are handled by threads of the
+/// channels.
 typedef struct cwdaemon_t {
+	/// @brief Index of the channel, zero for main channel.
+	unsigned int channel;
+
 	int socket_descriptor;
 
 	/// @brief UDP port the server listens on.
 	in_port_t network_port;
 
+	/// @brief Size of receive buffer of UDP socket, zero for system's default.
+	int network_rcvbuf;
+
+	/// @brief Unix-domain datagram socket for clients on the same host, or -1.
+	int unix_socket_descriptor;
+
+	/// @brief Path of Unix-domain socket, NULL if there is no such listener.
+	char const * unix_socket_path;
+
+	/// @brief Size of receive buffer of Unix-domain socket, zero for system's default.
+	int unix_rcvbuf;
+
+	/// @brief Should next cwdaemon_recvfrom() try Unix-domain socket before UDP socket?
+	bool recv_unix_first;
+
 	/* cwdaemon usually receives requests from client, but on occasions
 	   it needs to send a reply back. This is why in addition to
-	   request_* we also have reply_* */
-	struct sockaddr_in request_addr;
-	socklen_t          request_addrlen;
-	struct sockaddr_in reply_addr;
-	socklen_t          reply_addrlen;
+	   request_* we also have reply_*. The address family tells which of
+	   the sockets (UDP or Unix-domain) a request came through. */
+	struct sockaddr_storage request_addr;
+	socklen_t               request_addrlen;
+	struct sockaddr_storage reply_addr;
+	socklen_t               reply_addrlen;
+
+	struct engine_t const * engine; ///< Keying engine (engine.h) of the channel.
+	cwdevice * cwdevice;            ///< Keying device of the channel.
+
+	/* Actual values of parameters, used to control ongoing operation
+	   of the channel. These values can be modified through requests
+	   received from socket. */
+	int morse_speed;
+	int morse_tone;
+	int morse_volume;
+	unsigned int ptt_delay_ms;
+	int audio_system;
+	int weighting;
+
+	bool has_audio_output;   ///< Has keying engine been opened successfully?
+	bool engine_suspended;   ///< Has idle keying engine been closed (suspended)?
+	int64_t last_activity_ns;
+
+	/// Resumes of keying engine from idle suspension. Written only by
+	/// thread handling requests of the channel, summed over channels by
+	/// cwdaemon_report_resume_stats().
+	struct {
+		uint64_t count;
+		uint64_t open_us_total;
+		uint64_t open_us_max;
+	} resume_stats;
+
+	unsigned char ptt_flag;  ///< Flag for PTT state/behaviour.
+	int wordmode;            ///< Is uninterruptible (word) mode active?
+
+	/// Incoming requests without Escape code are stored in this
+	/// pseudo-FIFO before they are played.
+	char request_queue[CWDAEMON_REQUEST_QUEUE_SIZE_MAX];
+
+	/// Internally (but outside sendto() code) cwdaemon treats contents
+	/// of reply buffer as C string, therefore we need +1 for
+	/// terminating NUL.
+	char reply_buffer[CWDAEMON_REPLY_SIZE_MAX + 1];
+
+	pthread_t thread;        ///< Thread handling requests of channel other than main channel.
+	int stop_pipe[2];        ///< Wakes up the thread when the channel is stopped.
 } cwdaemon_t;
 
 
@@ -0,0 +1,60 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Backend of cwdevice I/O that calls ioctl(2).
+
+
+
+
+#include "config.h"
+
+#if HAVE_SYS_IOCTL_H
+# include <sys/ioctl.h>
+#endif
+
+#include "cwdevice_io.h"
+
+
+
+
+static int cwdevice_io_system_ioctl(int fd, unsigned long request, void * arg);
+
+
+
+
+cwdevice_io_t const cwdevice_io_system = {
+	.ioctl = cwdevice_io_system_ioctl,
+};
+
+
+
+
+static int cwdevice_io_system_ioctl(int fd, unsigned long request, void * arg)
+{
+	return ioctl(fd, request, arg);
+}
+
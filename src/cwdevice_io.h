@@ -0,0 +1,60 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_CWDEVICE_IO_H
+#define CWDAEMON_CWDEVICE_IO_H
+
+
+
+
+/// @file
+///
+/// Backend performing I/O operations on file descriptor of cwdevice.
+///
+/// Drivers of cwdevices (ttys.c, lp.c) don't call ioctl() directly, but
+/// through this interface. cwdaemon uses the system backend. Unit tests
+/// use a mock backend that records the requests, so that they can verify
+/// which (and how many) operations a driver performs, without real
+/// hardware.
+
+
+
+
+/// Operations of cwdevice I/O backend.
+typedef struct cwdevice_io {
+	/// @brief Perform ioctl() on file descriptor of cwdevice
+	///
+	/// @return value returned by ioctl(2)
+	int (*ioctl)(int fd, unsigned long request, void * arg);
+} cwdevice_io_t;
+
+
+
+
+/// Backend calling ioctl(2).
+extern cwdevice_io_t const cwdevice_io_system;
+
+
+
+
+#endif /* #ifndef CWDAEMON_CWDEVICE_IO_H */
+
@@ -0,0 +1,98 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Selection of keying engine.
+
+
+
+
+#include "config.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "engine.h"
+
+
+
+
+engine_t const * engine_get_by_name(char const * name)
+{
+#if HAVE_LIBCW
+	if (0 == strcmp(name, engine_libcw.name)) {
+		return &engine_libcw;
+	}
+#endif
+	if (0 == strcmp(name, engine_native.name)) {
+		return &engine_native;
+	}
+	if (0 == strcmp(name, engine_winkeyer.name)) {
+		return &engine_winkeyer;
+	}
+	return NULL;
+}
+
+
+
+
+engine_t const * engine_get_default(void)
+{
+#if HAVE_LIBCW
+	return &engine_libcw;
+#else
+	return &engine_native;
+#endif
+}
+
+
+
+
+char const * engine_get_audio_system_label(int audio_system)
+{
+#if HAVE_LIBCW
+	return cw_get_audio_system_label(audio_system);
+#else
+	switch (audio_system) {
+	case CW_AUDIO_NULL:
+		return "Null";
+	case CW_AUDIO_CONSOLE:
+		return "Console";
+	case CW_AUDIO_OSS:
+		return "OSS";
+	case CW_AUDIO_ALSA:
+		return "ALSA";
+	case CW_AUDIO_PA:
+		return "PulseAudio";
+	case CW_AUDIO_SOUNDCARD:
+		return "Soundcard";
+	case CW_AUDIO_NONE:
+	default:
+		return "None";
+	}
+#endif
+}
+
@@ -0,0 +1,199 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_ENGINE_H
+#define CWDAEMON_ENGINE_H
+
+
+
+
+/// @file
+///
+/// Keying engines: code that converts characters into timed marks and
+/// spaces, and calls back cwdaemon on each change of state of the
+/// (software) key.
+///
+/// The interface follows the subset of libcw's API that cwdaemon has been
+/// using, so that cwdaemon's code can switch between engines without
+/// changes in the logic of handling requests:
+///  - "libcw" engine is a thin wrapper around libcw's generator. It can
+///    produce a sidetone on a sound system.
+///  - "native" engine (engine_native.c) drives the keying callback from
+///    its own thread, sleeping until absolute deadlines of edges. It is
+///    available also in builds without libcw. Its optional sidetone
+///    (sidetone.h) is rendered from the same schedule of edges.
+///  - "winkeyer" engine (engine_winkeyer.c) forwards text to WinKeyer
+///    hardware keyer (winkeyer.h), which does the timing by itself. The
+///    keying callback is never called.
+
+
+
+
+#include <stdbool.h>
+
+#if HAVE_LIBCW
+#include <libcw.h>
+#else
+/* Subset of symbols from libcw.h used by cwdaemon, for builds without
+   libcw. Values are the same as in libcw.h. */
+enum cw_audio_systems {
+	CW_AUDIO_NONE = 0,
+	CW_AUDIO_NULL,
+	CW_AUDIO_CONSOLE,
+	CW_AUDIO_OSS,
+	CW_AUDIO_ALSA,
+	CW_AUDIO_PA,
+	CW_AUDIO_SOUNDCARD
+};
+#define CW_SPEED_MIN          4
+#define CW_SPEED_MAX         60
+#define CW_FREQUENCY_MIN      0
+#define CW_FREQUENCY_MAX   4000
+#define CW_VOLUME_MIN         0
+#define CW_VOLUME_MAX       100
+#define CW_WEIGHTING_MIN     20
+#define CW_WEIGHTING_MAX     80
+#define CW_GAP_MIN            0
+#define CW_GAP_MAX           60
+#endif
+
+
+
+
+typedef struct engine_t {
+	char const * name;
+
+	/// Can the engine produce a sidetone on a sound system other than "Null"?
+	bool has_sidetone;
+
+	/// @brief Create and start generator using given sound system
+	///
+	/// @return true on success
+	/// @return false on failure
+	bool (*open)(int audio_system);
+
+	/// @brief Stop and delete generator
+	void (*close)(void);
+
+	/// @brief Check if given sound system can be opened, without opening a generator
+	///
+	/// The function may be called from other thread than the one using
+	/// the engine, and may block for a while. NULL if the engine has no
+	/// sidetone.
+	bool (*probe)(int audio_system);
+
+	/// @brief Register function to be called on each change of state of the key
+	///
+	/// The callback is called from engine's thread. Pass NULL to
+	/// unregister the callback.
+	void (*register_keying_callback)(void (*callback)(void * arg, int keystate), void * arg);
+
+	/// @brief Register function to be called when length of tone queue drops to @p level
+	///
+	/// The callback is called from engine's thread.
+	void (*register_tone_queue_low_callback)(void (*callback)(void * arg), void * arg, int level);
+
+	/// @brief Enqueue marks and spaces of given character
+	///
+	/// @return true on success
+	/// @return false if the character can't be sent, or the queue is full
+	bool (*send_character)(char character);
+
+	/// @brief Enqueue a single tone
+	///
+	/// Tone with zero @p frequency is a space (key is up).
+	bool (*queue_tone)(int duration_us, int frequency);
+
+	/// @brief Remove all tones from tone queue, put the key up
+	void (*flush_tone_queue)(void);
+
+	/// @brief Put the key down or up for as long as a straight key is held
+	///
+	/// Key down removes all tones from tone queue first, so that a
+	/// straight key breaks in on text being sent.
+	void (*straight_key)(int keystate);
+
+	/// @brief Wait until all tones from tone queue are played
+	void (*wait_for_tone_queue)(void);
+
+	int (*get_tone_queue_length)(void);
+
+	void (*set_send_speed)(int wpm);
+	void (*set_frequency)(int frequency);
+	void (*set_volume)(int volume);
+
+	/// @brief Set additional space after each character, in dots
+	void (*set_gap)(int gap);
+	int (*get_gap)(void);
+
+	/// @brief Set weighting, in libcw's range (CW_WEIGHTING_MIN - CW_WEIGHTING_MAX)
+	void (*set_weighting)(int weighting);
+
+	/// @brief Let the engine turn PTT on and off around keyed text
+	///
+	/// NULL if PTT is controlled by cwdaemon. Otherwise cwdaemon doesn't
+	/// turn PTT on (and doesn't wait for PTT delay) before keyed text.
+	///
+	/// @param[in] lead_ms Time from PTT on to first element, zero to disable PTT
+	/// @param[in] tail_ms Time from last element to PTT off, zero for engine's default
+	void (*set_ptt_timing)(unsigned int lead_ms, unsigned int tail_ms);
+} engine_t;
+
+
+
+
+#if HAVE_LIBCW
+extern engine_t const engine_libcw;
+#endif
+extern engine_t const engine_native;
+extern engine_t const engine_winkeyer;
+
+
+
+
+/// @brief Find keying engine by its name
+///
+/// @param[in] name Name of engine ("libcw", "native" or "winkeyer")
+///
+/// @return engine on success
+/// @return NULL if there is no such engine in this build
+engine_t const * engine_get_by_name(char const * name);
+
+
+
+
+/// @brief Get engine used when no engine has been selected explicitly
+engine_t const * engine_get_default(void);
+
+
+
+
+/// @brief Get label of sound system
+///
+/// @param[in] audio_system One of CW_AUDIO_* values
+char const * engine_get_audio_system_label(int audio_system);
+
+
+
+
+#endif /* #ifndef CWDAEMON_ENGINE_H */
+
@@ -0,0 +1,269 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Keying engine using libcw's generator.
+
+
+
+
+#include "config.h"
+
+#include <libcw.h>
+
+#include "engine.h"
+#include "log.h"
+#include "rt.h"
+
+
+
+
+static bool engine_libcw_open(int audio_system);
+static void engine_libcw_close(void);
+static bool engine_libcw_probe(int audio_system);
+static bool engine_libcw_probe(int audio_system)
+{
+	/* NULL: default device of given sound system. */
+	switch (audio_system) {
+	case CW_AUDIO_NULL:
+		return CW_SUCCESS == cw_is_null_possible(NULL);
+	case CW_AUDIO_CONSOLE:
+		return CW_SUCCESS == cw_is_console_possible(NULL);
+	case CW_AUDIO_OSS:
+		return CW_SUCCESS == cw_is_oss_possible(NULL);
+	case CW_AUDIO_ALSA:
+		return CW_SUCCESS == cw_is_alsa_possible(NULL);
+	case CW_AUDIO_PA:
+		return CW_SUCCESS == cw_is_pa_possible(NULL);
+	case CW_AUDIO_SOUNDCARD:
+		/* libcw selects first available of these. */
+		return CW_SUCCESS == cw_is_pa_possible(NULL)
+			|| CW_SUCCESS == cw_is_alsa_possible(NULL)
+			|| CW_SUCCESS == cw_is_oss_possible(NULL);
+	default:
+		return false;
+	}
+}
+
+
+
+
+static void engine_libcw_register_keying_callback(void (*callback)(void * arg, int keystate), void * arg);
+static void engine_libcw_register_tone_queue_low_callback(void (*callback)(void * arg), void * arg, int level);
+static bool engine_libcw_send_character(char character);
+static bool engine_libcw_queue_tone(int duration_us, int frequency);
+static void engine_libcw_flush_tone_queue(void);
+static void engine_libcw_straight_key(int keystate);
+static void engine_libcw_wait_for_tone_queue(void);
+static int engine_libcw_get_tone_queue_length(void);
+static void engine_libcw_set_send_speed(int wpm);
+static void engine_libcw_set_frequency(int frequency);
+static void engine_libcw_set_volume(int volume);
+static void engine_libcw_set_gap(int gap);
+static int engine_libcw_get_gap(void);
+static void engine_libcw_set_weighting(int weighting);
+
+
+
+
+engine_t const engine_libcw = {
+	.name                             = "libcw",
+	.has_sidetone                     = true,
+	.open                             = engine_libcw_open,
+	.close                            = engine_libcw_close,
+	.probe                            = engine_libcw_probe,
+	.register_keying_callback         = engine_libcw_register_keying_callback,
+	.register_tone_queue_low_callback = engine_libcw_register_tone_queue_low_callback,
+	.send_character                   = engine_libcw_send_character,
+	.queue_tone                       = engine_libcw_queue_tone,
+	.flush_tone_queue                 = engine_libcw_flush_tone_queue,
+	.straight_key                     = engine_libcw_straight_key,
+	.wait_for_tone_queue              = engine_libcw_wait_for_tone_queue,
+	.get_tone_queue_length            = engine_libcw_get_tone_queue_length,
+	.set_send_speed                   = engine_libcw_set_send_speed,
+	.set_frequency                    = engine_libcw_set_frequency,
+	.set_volume                       = engine_libcw_set_volume,
+	.set_gap                          = engine_libcw_set_gap,
+	.get_gap                          = engine_libcw_get_gap,
+	.set_weighting                    = engine_libcw_set_weighting,
+};
+
+
+
+
+static bool engine_libcw_open(int audio_system)
+{
+	/* Retries of OSS device that may be blocked by previous audio
+	   system are done in background, when the audio system is
+	   probed (sound.c). */
+	int rv = cw_generator_new(audio_system, NULL);
+	if (rv != CW_FAILURE) {
+		/* Generator's thread is created by libcw, it inherits the
+		   real-time profile from this thread. */
+		rt_thread_apply("libcw generator");
+		rv = cw_generator_start();
+		rt_thread_restore();
+		cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "starting generator with sound system \"%s\": %s", cw_get_audio_system_label(audio_system), rv ? "success" : "failure");
+
+	} else {
+		/* FIXME:
+		   When cwdaemon failed to create a generator, and user
+		   kills non-forked cwdaemon through Ctrl+C, there is
+		   a memory protection error.
+
+		   It seems that this error has been fixed with
+		   changes in libcw, committed on 31.12.2012.
+		   To be observed. */
+		cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "failed to create generator with sound system \"%s\"", cw_get_audio_system_label(audio_system));
+	}
+
+	return rv == CW_FAILURE ? false : true;
+}
+
+
+
+
+static void engine_libcw_close(void)
+{
+	cw_generator_stop();
+	cw_generator_delete();
+}
+
+
+
+
+static void engine_libcw_register_keying_callback(void (*callback)(void * arg, int keystate), void * arg)
+{
+	cw_register_keying_callback(callback, arg);
+}
+
+
+
+
+static void engine_libcw_register_tone_queue_low_callback(void (*callback)(void * arg), void * arg, int level)
+{
+	cw_register_tone_queue_low_callback(callback, arg, level);
+}
+
+
+
+
+static bool engine_libcw_send_character(char character)
+{
+	return CW_SUCCESS == cw_send_character(character);
+}
+
+
+
+
+static bool engine_libcw_queue_tone(int duration_us, int frequency)
+{
+	return CW_SUCCESS == cw_queue_tone(duration_us, frequency);
+}
+
+
+
+
+static void engine_libcw_flush_tone_queue(void)
+{
+	cw_flush_tone_queue();
+}
+
+
+
+
+static void engine_libcw_straight_key(int keystate)
+{
+	if (keystate) {
+		cw_flush_tone_queue();
+	}
+	cw_notify_straight_key_event(keystate);
+}
+
+
+
+
+static void engine_libcw_wait_for_tone_queue(void)
+{
+	cw_wait_for_tone_queue();
+}
+
+
+
+
+static int engine_libcw_get_tone_queue_length(void)
+{
+	return cw_get_tone_queue_length();
+}
+
+
+
+
+static void engine_libcw_set_send_speed(int wpm)
+{
+	cw_set_send_speed(wpm);
+}
+
+
+
+
+static void engine_libcw_set_frequency(int frequency)
+{
+	cw_set_frequency(frequency);
+}
+
+
+
+
+static void engine_libcw_set_volume(int volume)
+{
+	cw_set_volume(volume);
+}
+
+
+
+
+static void engine_libcw_set_gap(int gap)
+{
+	cw_set_gap(gap);
+}
+
+
+
+
+static int engine_libcw_get_gap(void)
+{
+	return cw_get_gap();
+}
+
+
+
+
+static void engine_libcw_set_weighting(int weighting)
+{
+	cw_set_weighting(weighting);
+}
+
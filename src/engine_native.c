@@ -0,0 +1,876 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Keying engine with its own keying thread and optional sidetone.
+///
+/// See engine_native.h for description of the engine, and sidetone.h for
+/// description of the sidetone.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#include "engine.h"
+#include "engine_native.h"
+#include "log.h"
+#include "rt.h"
+#include "sidetone.h"
+#include "vclock.h"
+
+
+
+
+#define CWDAEMON_NANOSECS_PER_SEC  1000000000L
+
+
+
+
+/// Representations of characters, indexed by character.
+static char const * const g_morse_table[128] = {
+	['A'] = ".-",     ['B'] = "-...",   ['C'] = "-.-.",   ['D'] = "-..",
+	['E'] = ".",      ['F'] = "..-.",   ['G'] = "--.",    ['H'] = "....",
+	['I'] = "..",     ['J'] = ".---",   ['K'] = "-.-",    ['L'] = ".-..",
+	['M'] = "--",     ['N'] = "-.",     ['O'] = "---",    ['P'] = ".--.",
+	['Q'] = "--.-",   ['R'] = ".-.",    ['S'] = "...",    ['T'] = "-",
+	['U'] = "..-",    ['V'] = "...-",   ['W'] = ".--",    ['X'] = "-..-",
+	['Y'] = "-.--",   ['Z'] = "--..",
+
+	['0'] = "-----",  ['1'] = ".----",  ['2'] = "..---",  ['3'] = "...--",
+	['4'] = "....-",  ['5'] = ".....",  ['6'] = "-....",  ['7'] = "--...",
+	['8'] = "---..",  ['9'] = "----.",
+
+	['"'] = ".-..-.", ['\''] = ".----.", ['$'] = "...-..-", ['('] = "-.--.",
+	[')'] = "-.--.-", ['+'] = ".-.-.",  [','] = "--..--", ['-'] = "-....-",
+	['.'] = ".-.-.-", ['/'] = "-..-.",  [':'] = "---...", [';'] = "-.-.-.",
+	['='] = "-...-",  ['?'] = "..--..", ['_'] = "..--.-", ['@'] = ".--.-.",
+
+	/* Procedural signals, the same as in libcw. */
+	['<'] = "...-.-", ['>'] = "-...-.-", ['!'] = "...-.", ['&'] = ".-...",
+	['^'] = "-.-.-",  ['~'] = ".-.-",
+};
+
+
+
+
+/// State of single instance of the engine. All members except of
+/// flush_generation are protected by the mutex.
+typedef struct {
+	unsigned int index; ///< Index of the instance in g_native[].
+
+	pthread_mutex_t mutex;
+	/// Signalled when new elements are enqueued, when the queue is
+	/// flushed, and when engine's thread becomes idle.
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running;
+	bool busy; ///< Is engine's thread playing an element?
+	bool with_sidetone; ///< Has this instance opened the sidetone?
+
+	/// Virtual clock (vclock.h) is held until idle engine's thread
+	/// notices new elements, or until a thread waiting for empty queue
+	/// notices that the queue is empty.
+	bool wake_held;
+	unsigned int waiters;      ///< Count of threads in engine_native_wait_for_tone_queue().
+	unsigned int waiters_held; ///< Count of holds to be released by the waiting threads.
+
+	engine_native_element_t queue[ENGINE_NATIVE_QUEUE_CAPACITY];
+	size_t head;
+	size_t len;
+
+	/// Incremented on each flush of queue. Read by engine's thread
+	/// without locking the mutex while it sleeps.
+	unsigned int flush_generation;
+
+	int wpm;
+	int weighting;
+	int gap;
+	engine_native_timing_t timing;
+
+	/// Frequency, volume and state of key as heard in the sidetone
+	/// when this instance owns it. Protected by g_sidetone_owner.mutex.
+	int frequency;
+	int volume;
+	bool key;
+
+	void (*keying_callback)(void * arg, int keystate);
+	void * keying_arg;
+	void (*tq_low_callback)(void * arg);
+	void * tq_low_arg;
+	int tq_low_level;
+} engine_native_state_t;
+
+
+
+
+#define ENGINE_NATIVE_STATE_INITIALIZER(n) {     \
+	.index = (n),                            \
+	.mutex = PTHREAD_MUTEX_INITIALIZER,      \
+	.cond = PTHREAD_COND_INITIALIZER,        \
+	.wpm = 12,                               \
+	.weighting = 50,                         \
+	.frequency = 800,                        \
+	.volume = 70,                            \
+}
+
+static engine_native_state_t g_native[ENGINE_NATIVE_INSTANCES_MAX] = {
+	ENGINE_NATIVE_STATE_INITIALIZER(0),
+	ENGINE_NATIVE_STATE_INITIALIZER(1),
+	ENGINE_NATIVE_STATE_INITIALIZER(2),
+	ENGINE_NATIVE_STATE_INITIALIZER(3),
+};
+
+
+
+
+/// The single sidetone (sidetone.h) is shared by all instances. Only the
+/// owner's edges, frequency and volume reach the sidetone.
+static struct {
+	pthread_mutex_t mutex;
+	unsigned int owner;
+} g_sidetone_owner = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.owner = 0,
+};
+
+
+
+
+static bool engine_native_open(engine_native_state_t * state, int audio_system);
+static void engine_native_close(engine_native_state_t * state);
+static bool engine_native_probe(int audio_system);
+static void engine_native_register_keying_callback(engine_native_state_t * state, void (*callback)(void * arg, int keystate), void * arg);
+static void engine_native_register_tone_queue_low_callback(engine_native_state_t * state, void (*callback)(void * arg), void * arg, int level);
+static bool engine_native_send_character(engine_native_state_t * state, char character);
+static bool engine_native_queue_tone(engine_native_state_t * state, int duration_us, int frequency);
+static void engine_native_flush_tone_queue(engine_native_state_t * state);
+static void engine_native_straight_key(engine_native_state_t * state, int keystate);
+static void engine_native_wait_for_tone_queue(engine_native_state_t * state);
+static int engine_native_get_tone_queue_length(engine_native_state_t * state);
+static void engine_native_set_send_speed(engine_native_state_t * state, int wpm);
+static void engine_native_set_frequency(engine_native_state_t * state, int frequency);
+static void engine_native_set_volume(engine_native_state_t * state, int volume);
+static void engine_native_set_gap(engine_native_state_t * state, int gap);
+static int engine_native_get_gap(engine_native_state_t * state);
+static void engine_native_set_weighting(engine_native_state_t * state, int weighting);
+
+static bool engine_native_enqueue(engine_native_state_t * state, engine_native_element_t const * elements, size_t count);
+static void * engine_native_thread(void * arg);
+static bool engine_native_sleep_until(engine_native_state_t * state, struct timespec const * deadline, unsigned int generation);
+static void engine_native_timespec_add_us(struct timespec * ts, int32_t us);
+static uint64_t engine_native_timespec_ns(struct timespec const * ts);
+static void engine_native_key(engine_native_state_t * state, bool key, uint64_t timestamp_ns, void (*keying_callback)(void *, int), void * keying_arg);
+static void engine_native_wake_waiters(engine_native_state_t * state);
+static void engine_native_sidetone_key(engine_native_state_t * state, bool key, uint64_t timestamp_ns);
+
+
+
+
+/// Functions of engine_t interface of instance @p n: thin wrappers that
+/// pass the instance's state to functions of the engine.
+#define ENGINE_NATIVE_INSTANCE(n)                                                                                             \
+	static bool engine_native_open_##n(int audio_system) { return engine_native_open(&g_native[n], audio_system); }        \
+	static void engine_native_close_##n(void) { engine_native_close(&g_native[n]); }                                       \
+	static void engine_native_register_keying_callback_##n(void (*callback)(void * arg, int keystate), void * arg)         \
+	{ engine_native_register_keying_callback(&g_native[n], callback, arg); }                                               \
+	static void engine_native_register_tone_queue_low_callback_##n(void (*callback)(void * arg), void * arg, int level)     \
+	{ engine_native_register_tone_queue_low_callback(&g_native[n], callback, arg, level); }                                \
+	static bool engine_native_send_character_##n(char character) { return engine_native_send_character(&g_native[n], character); } \
+	static bool engine_native_queue_tone_##n(int duration_us, int frequency)                                               \
+	{ return engine_native_queue_tone(&g_native[n], duration_us, frequency); }                                             \
+	static void engine_native_flush_tone_queue_##n(void) { engine_native_flush_tone_queue(&g_native[n]); }                 \
+	static void engine_native_straight_key_##n(int keystate) { engine_native_straight_key(&g_native[n], keystate); }       \
+	static void engine_native_wait_for_tone_queue_##n(void) { engine_native_wait_for_tone_queue(&g_native[n]); }           \
+	static int engine_native_get_tone_queue_length_##n(void) { return engine_native_get_tone_queue_length(&g_native[n]); } \
+	static void engine_native_set_send_speed_##n(int wpm) { engine_native_set_send_speed(&g_native[n], wpm); }             \
+	static void engine_native_set_frequency_##n(int frequency) { engine_native_set_frequency(&g_native[n], frequency); }   \
+	static void engine_native_set_volume_##n(int volume) { engine_native_set_volume(&g_native[n], volume); }               \
+	static void engine_native_set_gap_##n(int gap) { engine_native_set_gap(&g_native[n], gap); }                           \
+	static int engine_native_get_gap_##n(void) { return engine_native_get_gap(&g_native[n]); }                             \
+	static void engine_native_set_weighting_##n(int weighting) { engine_native_set_weighting(&g_native[n], weighting); }
+
+
+/// Interface of instance @p n of the engine.
+#define ENGINE_NATIVE_VTABLE(n) {                                                                       \
+	.name                             = "native",                                                    \
+	.has_sidetone                     = true,                                                        \
+	.open                             = engine_native_open_##n,                                      \
+	.close                            = engine_native_close_##n,                                     \
+	.probe                            = engine_native_probe,                                         \
+	.register_keying_callback         = engine_native_register_keying_callback_##n,                  \
+	.register_tone_queue_low_callback = engine_native_register_tone_queue_low_callback_##n,          \
+	.send_character                   = engine_native_send_character_##n,                            \
+	.queue_tone                       = engine_native_queue_tone_##n,                                \
+	.flush_tone_queue                 = engine_native_flush_tone_queue_##n,                          \
+	.straight_key                     = engine_native_straight_key_##n,                              \
+	.wait_for_tone_queue              = engine_native_wait_for_tone_queue_##n,                       \
+	.get_tone_queue_length            = engine_native_get_tone_queue_length_##n,                     \
+	.set_send_speed                   = engine_native_set_send_speed_##n,                            \
+	.set_frequency                    = engine_native_set_frequency_##n,                             \
+	.set_volume                       = engine_native_set_volume_##n,                                \
+	.set_gap                          = engine_native_set_gap_##n,                                   \
+	.get_gap                          = engine_native_get_gap_##n,                                   \
+	.set_weighting                    = engine_native_set_weighting_##n,                             \
+}
+
+ENGINE_NATIVE_INSTANCE(0)
+ENGINE_NATIVE_INSTANCE(1)
+ENGINE_NATIVE_INSTANCE(2)
+ENGINE_NATIVE_INSTANCE(3)
+
+/* Instance 0 is the engine selected with "--keyer native". */
+engine_t const engine_native = ENGINE_NATIVE_VTABLE(0);
+static engine_t const engine_native_1 = ENGINE_NATIVE_VTABLE(1);
+static engine_t const engine_native_2 = ENGINE_NATIVE_VTABLE(2);
+static engine_t const engine_native_3 = ENGINE_NATIVE_VTABLE(3);
+
+static engine_t const * const g_native_instances[ENGINE_NATIVE_INSTANCES_MAX] = {
+	&engine_native, &engine_native_1, &engine_native_2, &engine_native_3,
+};
+
+
+
+
+void engine_native_timing(engine_native_timing_t * timing, int wpm, int weighting, int gap)
+{
+	int32_t const unit_us = 1200000 / wpm;
+	int32_t const weighting_us = (2 * (weighting - 50) * unit_us) / 100;
+
+	timing->dot_us = unit_us + weighting_us;
+	timing->dash_us = 3 * timing->dot_us;
+	timing->ims_us = unit_us - (28 * weighting_us) / 22;
+	timing->eoc_us = 3 * unit_us - timing->ims_us + gap * unit_us;
+	timing->eow_us = 4 * unit_us + (7 * gap * unit_us) / 3;
+
+	return;
+}
+
+
+
+
+size_t engine_native_character_elements(engine_native_timing_t const * timing, char character, engine_native_element_t * elements, size_t size)
+{
+	if (' ' == character) {
+		if (size < 1) {
+			return 0;
+		}
+		elements[0] = (engine_native_element_t) { .duration_us = timing->eow_us, .key = false };
+		return 1;
+	}
+
+	unsigned char const c = (unsigned char) toupper((unsigned char) character);
+	if (c >= sizeof (g_morse_table) / sizeof (g_morse_table[0]) || NULL == g_morse_table[c]) {
+		return 0;
+	}
+	char const * const representation = g_morse_table[c];
+	if (2 * strlen(representation) + 1 > size) {
+		return 0;
+	}
+
+	size_t n = 0;
+	for (char const * symbol = representation; *symbol; symbol++) {
+		elements[n++] = (engine_native_element_t) { .duration_us = '.' == *symbol ? timing->dot_us : timing->dash_us, .key = true };
+		elements[n++] = (engine_native_element_t) { .duration_us = timing->ims_us, .key = false };
+	}
+	elements[n++] = (engine_native_element_t) { .duration_us = timing->eoc_us, .key = false };
+
+	return n;
+}
+
+
+
+
+engine_t const * engine_native_instance(unsigned int index)
+{
+	if (index >= ENGINE_NATIVE_INSTANCES_MAX) {
+		return NULL;
+	}
+	return g_native_instances[index];
+}
+
+
+
+
+void engine_native_set_sidetone_owner(unsigned int index)
+{
+	if (index >= ENGINE_NATIVE_INSTANCES_MAX) {
+		return;
+	}
+
+	pthread_mutex_lock(&g_sidetone_owner.mutex);
+	unsigned int const previous = g_sidetone_owner.owner;
+	if (previous != index) {
+		struct timespec now = { 0 };
+		vclock_gettime(&now);
+		if (g_native[previous].key) {
+			sidetone_key(false, engine_native_timespec_ns(&now));
+		}
+		g_sidetone_owner.owner = index;
+		sidetone_set_frequency(g_native[index].frequency);
+		sidetone_set_volume(g_native[index].volume);
+		if (g_native[index].key) {
+			sidetone_key(true, engine_native_timespec_ns(&now));
+		}
+	}
+	pthread_mutex_unlock(&g_sidetone_owner.mutex);
+
+	return;
+}
+
+
+
+
+static bool engine_native_open(engine_native_state_t * state, int audio_system)
+{
+	bool const with_sidetone = CW_AUDIO_NULL != audio_system && CW_AUDIO_NONE != audio_system;
+	if (with_sidetone && !sidetone_supports_audio_system(audio_system)) {
+		log_error("Keying engine \"%s\" has no sidetone sink for sound system \"%s\"",
+		          engine_native.name, engine_get_audio_system_label(audio_system));
+		return false;
+	}
+	if (with_sidetone && 0 != state->index) {
+		/* There is only one sidetone, opened by the first instance.
+		   Other instances reach it through ownership of sidetone. */
+		log_error("Instance %u of keying engine \"%s\" can't open its own sidetone", state->index, engine_native.name);
+		return false;
+	}
+
+	pthread_mutex_lock(&state->mutex);
+	if (state->running) {
+		pthread_mutex_unlock(&state->mutex);
+		return true;
+	}
+	if (with_sidetone) {
+		if (0 != sidetone_open(audio_system)) {
+			pthread_mutex_unlock(&state->mutex);
+			return false;
+		}
+		pthread_mutex_lock(&g_sidetone_owner.mutex);
+		sidetone_set_frequency(g_native[g_sidetone_owner.owner].frequency);
+		sidetone_set_volume(g_native[g_sidetone_owner.owner].volume);
+		pthread_mutex_unlock(&g_sidetone_owner.mutex);
+	}
+	state->with_sidetone = with_sidetone;
+	state->head = 0;
+	state->len = 0;
+	state->busy = false;
+	state->running = true;
+	engine_native_timing(&state->timing, state->wpm, state->weighting, state->gap);
+
+	/* The thread should not handle signals sent to cwdaemon. It applies
+	   real-time profile by itself (rt_thread_apply()). */
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int const rv = pthread_create(&state->thread, NULL, engine_native_thread, state);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (0 != rv) {
+		state->running = false;
+		pthread_mutex_unlock(&state->mutex);
+		if (state->with_sidetone) {
+			sidetone_close();
+		}
+		log_error("Failed to start thread of keying engine \"%s\": %s", engine_native.name, strerror(rv));
+		return false;
+	}
+	pthread_mutex_unlock(&state->mutex);
+
+	cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "starting keying engine \"%s\": success", engine_native.name);
+	return true;
+}
+
+
+
+
+static void engine_native_close(engine_native_state_t * state)
+{
+	pthread_mutex_lock(&state->mutex);
+	if (!state->running) {
+		pthread_mutex_unlock(&state->mutex);
+		return;
+	}
+	state->running = false;
+	state->len = 0;
+	__atomic_add_fetch(&state->flush_generation, 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&state->cond);
+	pthread_mutex_unlock(&state->mutex);
+
+	vclock_wait_begin(0);
+	pthread_join(state->thread, NULL);
+	vclock_wait_end();
+	if (state->with_sidetone) {
+		sidetone_close();
+	}
+
+	return;
+}
+
+
+
+
+static bool engine_native_probe(int audio_system)
+{
+	return sidetone_probe(audio_system);
+}
+
+
+
+
+static void engine_native_register_keying_callback(engine_native_state_t * state, void (*callback)(void * arg, int keystate), void * arg)
+{
+	pthread_mutex_lock(&state->mutex);
+	state->keying_callback = callback;
+	state->keying_arg = arg;
+	pthread_mutex_unlock(&state->mutex);
+}
+
+
+
+
+static void engine_native_register_tone_queue_low_callback(engine_native_state_t * state, void (*callback)(void * arg), void * arg, int level)
+{
+	pthread_mutex_lock(&state->mutex);
+	state->tq_low_callback = callback;
+	state->tq_low_arg = arg;
+	state->tq_low_level = level;
+	pthread_mutex_unlock(&state->mutex);
+}
+
+
+
+
+static bool engine_native_send_character(engine_native_state_t * state, char character)
+{
+	engine_native_element_t elements[ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX];
+
+	pthread_mutex_lock(&state->mutex);
+	size_t const count = engine_native_character_elements(&state->timing, character, elements, ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX);
+	pthread_mutex_unlock(&state->mutex);
+
+	if (0 == count) {
+		errno = ENOENT;
+		return false;
+	}
+	return engine_native_enqueue(state, elements, count);
+}
+
+
+
+
+static bool engine_native_queue_tone(engine_native_state_t * state, int duration_us, int frequency)
+{
+	if (duration_us < 0) {
+		errno = EINVAL;
+		return false;
+	}
+	engine_native_element_t const element = { .duration_us = duration_us, .key = 0 != frequency };
+	return engine_native_enqueue(state, &element, 1);
+}
+
+
+
+
+/// @brief Append elements to queue as a single unit
+///
+/// @return true on success
+/// @return false if the engine is not running or there is no space for all elements (errno is set)
+static bool engine_native_enqueue(engine_native_state_t * state, engine_native_element_t const * elements, size_t count)
+{
+	pthread_mutex_lock(&state->mutex);
+	if (!state->running) {
+		pthread_mutex_unlock(&state->mutex);
+		errno = ENODEV;
+		return false;
+	}
+	if (state->len + count > ENGINE_NATIVE_QUEUE_CAPACITY) {
+		pthread_mutex_unlock(&state->mutex);
+		errno = EAGAIN;
+		return false;
+	}
+	if (0 == state->len && !state->busy && !state->wake_held) {
+		state->wake_held = true;
+		vclock_hold();
+	}
+	for (size_t i = 0; i < count; i++) {
+		state->queue[(state->head + state->len) % ENGINE_NATIVE_QUEUE_CAPACITY] = elements[i];
+		state->len++;
+	}
+	pthread_cond_broadcast(&state->cond);
+	pthread_mutex_unlock(&state->mutex);
+
+	return true;
+}
+
+
+
+
+static void engine_native_flush_tone_queue(engine_native_state_t * state)
+{
+	pthread_mutex_lock(&state->mutex);
+	state->len = 0;
+	__atomic_add_fetch(&state->flush_generation, 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&state->cond);
+	pthread_mutex_unlock(&state->mutex);
+}
+
+
+
+
+/// Straight key down is a single long mark, ended by flush on key up.
+static void engine_native_straight_key(engine_native_state_t * state, int keystate)
+{
+	engine_native_flush_tone_queue(state);
+	if (keystate) {
+		engine_native_element_t const element = { .duration_us = ENGINE_NATIVE_STRAIGHT_KEY_MAX_US, .key = true };
+		engine_native_enqueue(state, &element, 1);
+	}
+}
+
+
+
+
+static void engine_native_wait_for_tone_queue(engine_native_state_t * state)
+{
+	pthread_mutex_lock(&state->mutex);
+	while (state->running && (state->len > 0 || state->busy)) {
+		state->waiters++;
+		vclock_wait_begin(0);
+		pthread_cond_wait(&state->cond, &state->mutex);
+		vclock_wait_end();
+		state->waiters--;
+		if (state->waiters_held) {
+			state->waiters_held--;
+			vclock_release();
+		}
+	}
+	pthread_mutex_unlock(&state->mutex);
+}
+
+
+
+
+static int engine_native_get_tone_queue_length(engine_native_state_t * state)
+{
+	pthread_mutex_lock(&state->mutex);
+	int const len = (int) state->len;
+	pthread_mutex_unlock(&state->mutex);
+	return len;
+}
+
+
+
+
+static void engine_native_set_send_speed(engine_native_state_t * state, int wpm)
+{
+	if (wpm < CW_SPEED_MIN || wpm > CW_SPEED_MAX) {
+		return;
+	}
+	pthread_mutex_lock(&state->mutex);
+	state->wpm = wpm;
+	engine_native_timing(&state->timing, state->wpm, state->weighting, state->gap);
+	pthread_mutex_unlock(&state->mutex);
+}
+
+
+
+
+static void engine_native_set_frequency(engine_native_state_t * state, int frequency)
+{
+	pthread_mutex_lock(&g_sidetone_owner.mutex);
+	state->frequency = frequency;
+	if (g_sidetone_owner.owner == state->index) {
+		sidetone_set_frequency(frequency);
+	}
+	pthread_mutex_unlock(&g_sidetone_owner.mutex);
+}
+
+
+
+
+static void engine_native_set_volume(engine_native_state_t * state, int volume)
+{
+	pthread_mutex_lock(&g_sidetone_owner.mutex);
+	state->volume = volume;
+	if (g_sidetone_owner.owner == state->index) {
+		sidetone_set_volume(volume);
+	}
+	pthread_mutex_unlock(&g_sidetone_owner.mutex);
+}
+
+
+
+
+static void engine_native_set_gap(engine_native_state_t * state, int gap)
+{
+	if (gap < CW_GAP_MIN || gap > CW_GAP_MAX) {
+		return;
+	}
+	pthread_mutex_lock(&state->mutex);
+	state->gap = gap;
+	engine_native_timing(&state->timing, state->wpm, state->weighting, state->gap);
+	pthread_mutex_unlock(&state->mutex);
+}
+
+
+
+
+static int engine_native_get_gap(engine_native_state_t * state)
+{
+	pthread_mutex_lock(&state->mutex);
+	int const gap = state->gap;
+	pthread_mutex_unlock(&state->mutex);
+	return gap;
+}
+
+
+
+
+static void engine_native_set_weighting(engine_native_state_t * state, int weighting)
+{
+	if (weighting < CW_WEIGHTING_MIN || weighting > CW_WEIGHTING_MAX) {
+		return;
+	}
+	pthread_mutex_lock(&state->mutex);
+	state->weighting = weighting;
+	engine_native_timing(&state->timing, state->wpm, state->weighting, state->gap);
+	pthread_mutex_unlock(&state->mutex);
+}
+
+
+
+
+/// @brief Main function of engine's thread: play elements from the queue
+///
+/// Callbacks are called with the mutex unlocked, so that they can call
+/// functions of the engine (e.g. enqueue more tones).
+static void * engine_native_thread(void * arg)
+{
+	engine_native_state_t * const state = (engine_native_state_t *) arg;
+	bool key = false;
+	bool idle = true;             // Is there no previous deadline to continue from?
+	struct timespec deadline = { 0 };
+
+	rt_thread_apply("keying engine");
+	vclock_attach();
+	pthread_mutex_lock(&state->mutex);
+	while (state->running) {
+		if (state->wake_held) {
+			state->wake_held = false;
+			vclock_release();
+		}
+		if (0 == state->len) {
+			state->busy = false;
+			idle = true;
+			engine_native_wake_waiters(state);
+			vclock_wait_begin(0);
+			pthread_cond_wait(&state->cond, &state->mutex);
+			vclock_wait_end();
+			continue;
+		}
+
+		engine_native_element_t const element = state->queue[state->head];
+		state->head = (state->head + 1) % ENGINE_NATIVE_QUEUE_CAPACITY;
+		size_t const len_before = state->len--;
+		state->busy = true;
+
+		unsigned int const generation = __atomic_load_n(&state->flush_generation, __ATOMIC_ACQUIRE);
+		void (* const keying_callback)(void *, int) = state->keying_callback;
+		void * const keying_arg = state->keying_arg;
+		void (* const tq_low_callback)(void *) = state->tq_low_callback;
+		void * const tq_low_arg = state->tq_low_arg;
+		bool const tq_low = NULL != tq_low_callback
+			&& len_before > (size_t) state->tq_low_level
+			&& state->len <= (size_t) state->tq_low_level;
+		pthread_mutex_unlock(&state->mutex);
+
+		if (idle) {
+			vclock_gettime(&deadline);
+			idle = false;
+		}
+		if (element.key != key) {
+			key = element.key;
+			engine_native_key(state, key, engine_native_timespec_ns(&deadline), keying_callback, keying_arg);
+		}
+		if (tq_low) {
+			tq_low_callback(tq_low_arg);
+		}
+
+		engine_native_timespec_add_us(&deadline, element.duration_us);
+		bool const flushed = !engine_native_sleep_until(state, &deadline, generation);
+		if (flushed) {
+			if (key) {
+				key = false;
+				struct timespec now = { 0 };
+				vclock_gettime(&now);
+				engine_native_key(state, key, engine_native_timespec_ns(&now), keying_callback, keying_arg);
+			}
+			idle = true;
+		}
+
+		pthread_mutex_lock(&state->mutex);
+	}
+	state->busy = false;
+	if (state->wake_held) {
+		state->wake_held = false;
+		vclock_release();
+	}
+	engine_native_wake_waiters(state);
+	void (* const keying_callback)(void *, int) = state->keying_callback;
+	void * const keying_arg = state->keying_arg;
+	pthread_mutex_unlock(&state->mutex);
+
+	if (key) {
+		struct timespec now = { 0 };
+		vclock_gettime(&now);
+		engine_native_key(state, false, engine_native_timespec_ns(&now), keying_callback, keying_arg);
+	}
+
+	return NULL;
+}
+
+
+
+
+/// @brief Change state of key: pass the edge to sidetone and to keying callback
+///
+/// @param[in] state Instance of engine
+/// @param[in] key New state of key
+/// @param[in] timestamp_ns Time at which the edge has been scheduled
+/// @param[in] keying_callback Keying callback, may be NULL
+/// @param[in] keying_arg Argument of keying callback
+static void engine_native_key(engine_native_state_t * state, bool key, uint64_t timestamp_ns, void (*keying_callback)(void *, int), void * keying_arg)
+{
+	engine_native_sidetone_key(state, key, timestamp_ns);
+	if (keying_callback) {
+		keying_callback(keying_arg, key);
+	}
+}
+
+
+
+
+/// @brief Pass edge to sidetone if the instance owns the sidetone
+///
+/// @param[in] state Instance of engine
+/// @param[in] key New state of key
+/// @param[in] timestamp_ns Time at which the edge has been scheduled
+static void engine_native_sidetone_key(engine_native_state_t * state, bool key, uint64_t timestamp_ns)
+{
+	pthread_mutex_lock(&g_sidetone_owner.mutex);
+	state->key = key;
+	if (g_sidetone_owner.owner == state->index) {
+		sidetone_key(key, timestamp_ns);
+	}
+	pthread_mutex_unlock(&g_sidetone_owner.mutex);
+}
+
+
+
+
+/// @brief Wake up threads waiting in engine_native_wait_for_tone_queue()
+///
+/// Call this with the mutex of @p state locked.
+static void engine_native_wake_waiters(engine_native_state_t * state)
+{
+	if (state->waiters > state->waiters_held) {
+		// The clock must not advance before the waiters notice that the
+		// queue is empty.
+		for (unsigned int i = state->waiters_held; i < state->waiters; i++) {
+			vclock_hold();
+		}
+		state->waiters_held = state->waiters;
+	}
+	pthread_cond_broadcast(&state->cond);
+}
+
+
+
+
+/// @brief Sleep until absolute CLOCK_MONOTONIC deadline
+///
+/// The sleep is interrupted when the queue is flushed. In virtual clock
+/// mode the deadline is in virtual time (vclock.h).
+///
+/// @param[in] state Instance of engine
+/// @param[in] deadline Time at which to wake up
+/// @param[in] generation Value of flush generation at the start of sleep
+///
+/// @return true if the deadline has been reached
+/// @return false if the queue has been flushed
+static bool engine_native_sleep_until(engine_native_state_t * state, struct timespec const * deadline, unsigned int generation)
+{
+	while (generation == __atomic_load_n(&state->flush_generation, __ATOMIC_ACQUIRE)) {
+		struct timespec slice = { 0 };
+		vclock_gettime(&slice);
+		if (slice.tv_sec > deadline->tv_sec
+		    || (slice.tv_sec == deadline->tv_sec && slice.tv_nsec >= deadline->tv_nsec)) {
+			return true;
+		}
+
+		engine_native_timespec_add_us(&slice, ENGINE_NATIVE_SLICE_US);
+		if (slice.tv_sec > deadline->tv_sec
+		    || (slice.tv_sec == deadline->tv_sec && slice.tv_nsec > deadline->tv_nsec)) {
+			slice = *deadline;
+		}
+		vclock_sleep_until_ns(engine_native_timespec_ns(&slice));
+	}
+	return false;
+}
+
+
+
+
+static void engine_native_timespec_add_us(struct timespec * ts, int32_t us)
+{
+	ts->tv_sec += us / 1000000;
+	ts->tv_nsec += (long) (us % 1000000) * 1000;
+	if (ts->tv_nsec >= CWDAEMON_NANOSECS_PER_SEC) {
+		ts->tv_sec++;
+		ts->tv_nsec -= CWDAEMON_NANOSECS_PER_SEC;
+	}
+	return;
+}
+
+
+
+
+static uint64_t engine_native_timespec_ns(struct timespec const * ts)
+{
+	return (uint64_t) ts->tv_sec * CWDAEMON_NANOSECS_PER_SEC + (uint64_t) ts->tv_nsec;
+}
+
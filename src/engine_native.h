@@ -0,0 +1,157 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_ENGINE_NATIVE_H
+#define CWDAEMON_ENGINE_NATIVE_H
+
+
+
+
+/// @file
+///
+/// Native keying engine: internals exposed for unit tests.
+///
+/// The engine converts characters into a schedule of elements (key down or
+/// key up for a given time). A dedicated thread plays the elements: for
+/// each element it calls the keying callback (if state of key changes), and
+/// then sleeps with clock_nanosleep(TIMER_ABSTIME) until absolute
+/// CLOCK_MONOTONIC deadline of end of the element. Deadline of an element
+/// is calculated from deadline of previous element, not from the moment
+/// the thread woke up, so latencies of wake-ups don't accumulate.
+///
+/// There are several independent instances of the engine, each with its
+/// own thread, queue and timing, so that separate keying channels can key
+/// at the same time. "engine_native" is the first instance. There is only
+/// one sidetone: it plays edges of the instance that owns it.
+
+
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "engine.h"
+
+
+
+
+/// Count of independent instances of the engine.
+#define ENGINE_NATIVE_INSTANCES_MAX     4
+
+/// Capacity of queue of elements, the same as capacity of libcw's tone queue.
+#define ENGINE_NATIVE_QUEUE_CAPACITY    3000
+
+/// Max count of elements produced for single character: seven marks, seven
+/// inter-mark spaces, and end-of-character space.
+#define ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX  15
+
+/// Max time of single sleep of engine's thread. Elements longer than this
+/// are played in slices, so that the thread notices flushing of the queue
+/// in a reasonable time. Flushing ends a straight key's mark and breaks in
+/// on text when a paddle is pressed, so the time is kept short.
+#define ENGINE_NATIVE_SLICE_US  2000
+
+/// Max length of mark of straight key.
+#define ENGINE_NATIVE_STRAIGHT_KEY_MAX_US  60000000
+
+
+
+
+/// Single element of keying schedule.
+typedef struct {
+	int32_t duration_us;
+	bool key; ///< Is the key down (mark) during the element?
+} engine_native_element_t;
+
+
+
+
+/// Durations of elements, calculated from speed, weighting and gap the same
+/// way as libcw does it.
+typedef struct {
+	int32_t dot_us;
+	int32_t dash_us;
+	int32_t ims_us; ///< Inter-mark space.
+	int32_t eoc_us; ///< Space appended after last inter-mark space of character.
+	int32_t eow_us; ///< Space sent for ' ' character.
+} engine_native_timing_t;
+
+
+
+
+/// @brief Calculate durations of elements
+///
+/// @param[out] timing Calculated durations
+/// @param[in] wpm Speed, words per minute
+/// @param[in] weighting Weighting in libcw's range (CW_WEIGHTING_MIN - CW_WEIGHTING_MAX)
+/// @param[in] gap Additional space after a character, in dots
+void engine_native_timing(engine_native_timing_t * timing, int wpm, int weighting, int gap);
+
+
+
+
+/// @brief Convert a character into elements of keying schedule
+///
+/// Lower-case letters are sent as upper-case letters. Space character is
+/// converted into a single word space.
+///
+/// @param[in] timing Durations of elements
+/// @param[in] character Character to convert
+/// @param[out] elements Output buffer
+/// @param[in] size Count of elements that fit into @p elements
+///
+/// @return count of elements written to @p elements
+/// @return zero if the character has no Morse representation, or @p elements is too small
+size_t engine_native_character_elements(engine_native_timing_t const * timing, char character, engine_native_element_t * elements, size_t size);
+
+
+
+
+/// @brief Get instance of the engine
+///
+/// Instances other than the first one can't open the sidetone: they must be
+/// opened with "null" sound system.
+///
+/// @param[in] index Index of instance, the first instance is "engine_native"
+///
+/// @return instance on success
+/// @return NULL if @p index is out of range
+engine_t const * engine_native_instance(unsigned int index);
+
+
+
+
+/// @brief Give the sidetone to given instance of the engine
+///
+/// Sidetone stops playing edges of previous owner, and starts playing edges
+/// of instance @p index with frequency and volume set for that instance.
+/// Current states of keys of both instances are applied immediately.
+///
+/// @param[in] index Index of instance
+void engine_native_set_sidetone_owner(unsigned int index);
+
+
+
+
+#endif /* #ifndef CWDAEMON_ENGINE_NATIVE_H */
+
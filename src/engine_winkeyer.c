@@ -0,0 +1,743 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Keying engine that offloads timing of elements to WinKeyer hardware
+/// keyer.
+///
+/// Characters, speed changes and tones are put into a queue. Engine's
+/// thread forwards them to the keyer, keeping no more than
+/// WINKEYER_INFLIGHT_MAX characters in keyer's buffer and stopping when the
+/// keyer signals XOFF. The keyer echoes each character when it starts
+/// keying it, so the thread knows how many characters are still in keyer's
+/// buffer; together with BUSY bit of keyer's status this gives the length
+/// of "tone queue" reported to cwdaemon.
+///
+/// The keyer doesn't report edges of keying to host, so keying callback
+/// is never called.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "log.h"
+#include "rt.h"
+#include "winkeyer.h"
+
+
+
+
+/// Capacity of queue of items, the same as capacity of libcw's tone queue.
+#define ENGINE_WINKEYER_QUEUE_CAPACITY  3000
+
+/// When characters are in keyer's buffer and the keyer has been silent
+/// for this long, the thread asks the keyer for its status. This recovers
+/// from a lost status byte or a missing echo.
+#define ENGINE_WINKEYER_STATUS_POLL_MS  250
+
+/// Bytes sent to the keyer need this long to reach the keyer at 1200 baud
+/// and to be parsed by it. Status "not busy" received earlier than this
+/// after last write doesn't describe the bytes written.
+#define ENGINE_WINKEYER_TRANSIT_NS  (50 * 1000000LL)
+
+
+
+
+typedef enum {
+	ENGINE_WINKEYER_ITEM_TEXT,   ///< Encoded character, goes into keyer's buffer.
+	ENGINE_WINKEYER_ITEM_SPEED,  ///< Change of speed between characters.
+	ENGINE_WINKEYER_ITEM_TONE,   ///< Key down for a time, with "key immediate" command.
+	ENGINE_WINKEYER_ITEM_SPACE,  ///< Key up for a time.
+} engine_winkeyer_item_kind_t;
+
+typedef struct {
+	uint8_t kind;     ///< One of engine_winkeyer_item_kind_t values.
+	uint8_t count;    ///< Count of bytes of encoded character.
+	uint8_t echoes;   ///< Count of characters echoed by the keyer for encoded character.
+	uint8_t bytes[WINKEYER_CHARACTER_BYTES_MAX];
+	int32_t value;    ///< Speed [wpm] of SPEED item, duration [us] of TONE and SPACE items.
+} engine_winkeyer_item_t;
+
+
+
+
+static bool engine_winkeyer_open(int audio_system);
+static void engine_winkeyer_close(void);
+static void engine_winkeyer_register_keying_callback(void (*callback)(void * arg, int keystate), void * arg);
+static void engine_winkeyer_register_tone_queue_low_callback(void (*callback)(void * arg), void * arg, int level);
+static bool engine_winkeyer_send_character(char character);
+static bool engine_winkeyer_queue_tone(int duration_us, int frequency);
+static void engine_winkeyer_flush_tone_queue(void);
+static void engine_winkeyer_straight_key(int keystate);
+static void engine_winkeyer_wait_for_tone_queue(void);
+static int engine_winkeyer_get_tone_queue_length(void);
+static void engine_winkeyer_set_send_speed(int wpm);
+static void engine_winkeyer_set_frequency(int frequency);
+static void engine_winkeyer_set_volume(int volume);
+static void engine_winkeyer_set_gap(int gap);
+static int engine_winkeyer_get_gap(void);
+static void engine_winkeyer_set_weighting(int weighting);
+static void engine_winkeyer_set_ptt_timing(unsigned int lead_ms, unsigned int tail_ms);
+
+static bool engine_winkeyer_enqueue(engine_winkeyer_item_t const * item);
+static void engine_winkeyer_wake(void);
+static void * engine_winkeyer_thread(void * arg);
+static int engine_winkeyer_pump(int64_t now);
+static void engine_winkeyer_receive(uint8_t byte, int64_t now);
+static int engine_winkeyer_length(void);
+static int64_t engine_winkeyer_now_ns(void);
+
+
+
+
+engine_t const engine_winkeyer = {
+	.name                             = "winkeyer",
+	.has_sidetone                     = false,
+	.open                             = engine_winkeyer_open,
+	.close                            = engine_winkeyer_close,
+	.register_keying_callback         = engine_winkeyer_register_keying_callback,
+	.register_tone_queue_low_callback = engine_winkeyer_register_tone_queue_low_callback,
+	.send_character                   = engine_winkeyer_send_character,
+	.queue_tone                       = engine_winkeyer_queue_tone,
+	.flush_tone_queue                 = engine_winkeyer_flush_tone_queue,
+	.straight_key                     = engine_winkeyer_straight_key,
+	.wait_for_tone_queue              = engine_winkeyer_wait_for_tone_queue,
+	.get_tone_queue_length            = engine_winkeyer_get_tone_queue_length,
+	.set_send_speed                   = engine_winkeyer_set_send_speed,
+	.set_frequency                    = engine_winkeyer_set_frequency,
+	.set_volume                       = engine_winkeyer_set_volume,
+	.set_gap                          = engine_winkeyer_set_gap,
+	.get_gap                          = engine_winkeyer_get_gap,
+	.set_weighting                    = engine_winkeyer_set_weighting,
+	.set_ptt_timing                   = engine_winkeyer_set_ptt_timing,
+};
+
+
+
+
+/// State of the engine, protected by the mutex.
+static struct {
+	pthread_mutex_t mutex;
+	/// Signalled when the queue becomes empty and the keyer becomes idle.
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running;
+	int wake_fds[2]; ///< Pipe used to wake up engine's thread waiting for the keyer.
+
+	engine_winkeyer_item_t queue[ENGINE_WINKEYER_QUEUE_CAPACITY];
+	size_t head;
+	size_t len;
+
+	unsigned int inflight; ///< Characters sent to the keyer and not yet echoed by it.
+	bool xoff;             ///< Keyer's buffer is 2/3 full.
+	bool busy;             ///< Keyer is keying.
+	bool tone;             ///< Item at head of queue (TONE or SPACE) is being played.
+	int64_t tone_end_ns;
+	int64_t last_write_ns; ///< Time of last write of a character to the keyer.
+	int64_t last_receive_ns;
+
+	int wpm;
+	int committed_wpm;     ///< Speed that the keyer returns to when its buffer is empty.
+	int gap;
+
+	void (*tq_low_callback)(void * arg);
+	void * tq_low_arg;
+	int tq_low_level;
+	int reported_len;      ///< Length of queue at last check for "tone queue low" condition.
+} g_wk = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.wake_fds = { -1, -1 },
+	.wpm = 12,
+	.committed_wpm = 12,
+};
+
+
+
+
+static bool engine_winkeyer_open(int audio_system)
+{
+	if (CW_AUDIO_NULL != audio_system && CW_AUDIO_NONE != audio_system) {
+		log_error("Keying engine \"%s\" has no sidetone, can't use sound system %d", engine_winkeyer.name, audio_system);
+		return false;
+	}
+	if (-1 == winkeyer_fd()) {
+		log_error("Keying engine \"%s\" needs WinKeyer cwdevice (\"-d %s<tty>\")", engine_winkeyer.name, WINKEYER_DEVICE_PREFIX);
+		return false;
+	}
+
+	pthread_mutex_lock(&g_wk.mutex);
+	if (g_wk.running) {
+		pthread_mutex_unlock(&g_wk.mutex);
+		return true;
+	}
+	if (0 != pipe(g_wk.wake_fds)) {
+		pthread_mutex_unlock(&g_wk.mutex);
+		log_error("Failed to create pipe of keying engine \"%s\": %s", engine_winkeyer.name, strerror(errno));
+		return false;
+	}
+	fcntl(g_wk.wake_fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(g_wk.wake_fds[1], F_SETFL, O_NONBLOCK);
+	g_wk.head = 0;
+	g_wk.len = 0;
+	g_wk.inflight = 0;
+	g_wk.xoff = false;
+	g_wk.busy = false;
+	g_wk.tone = false;
+	g_wk.reported_len = 0;
+	g_wk.running = true;
+
+	/* The thread should not handle signals sent to cwdaemon. It applies
+	   real-time profile by itself (rt_thread_apply()). */
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int const rv = pthread_create(&g_wk.thread, NULL, engine_winkeyer_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (0 != rv) {
+		g_wk.running = false;
+		close(g_wk.wake_fds[0]);
+		close(g_wk.wake_fds[1]);
+		g_wk.wake_fds[0] = g_wk.wake_fds[1] = -1;
+		pthread_mutex_unlock(&g_wk.mutex);
+		log_error("Failed to start thread of keying engine \"%s\": %s", engine_winkeyer.name, strerror(rv));
+		return false;
+	}
+	pthread_mutex_unlock(&g_wk.mutex);
+
+	cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "starting keying engine \"%s\": success", engine_winkeyer.name);
+	return true;
+}
+
+
+
+
+static void engine_winkeyer_close(void)
+{
+	pthread_mutex_lock(&g_wk.mutex);
+	if (!g_wk.running) {
+		pthread_mutex_unlock(&g_wk.mutex);
+		return;
+	}
+	g_wk.running = false;
+	g_wk.len = 0;
+	pthread_cond_broadcast(&g_wk.cond);
+	pthread_mutex_unlock(&g_wk.mutex);
+
+	engine_winkeyer_wake();
+	pthread_join(g_wk.thread, NULL);
+
+	uint8_t const clear[] = { WINKEYER_CMD_CLEAR_BUFFER, WINKEYER_CMD_KEY_IMMEDIATE, 0 };
+	winkeyer_write(clear, sizeof (clear));
+
+	pthread_mutex_lock(&g_wk.mutex);
+	close(g_wk.wake_fds[0]);
+	close(g_wk.wake_fds[1]);
+	g_wk.wake_fds[0] = g_wk.wake_fds[1] = -1;
+	g_wk.inflight = 0;
+	g_wk.tone = false;
+	pthread_mutex_unlock(&g_wk.mutex);
+
+	return;
+}
+
+
+
+
+/// The keyer doesn't report edges of keying, the callback is never called.
+static void engine_winkeyer_register_keying_callback(__attribute__((unused)) void (*callback)(void * arg, int keystate), __attribute__((unused)) void * arg)
+{
+}
+
+
+
+
+static void engine_winkeyer_register_tone_queue_low_callback(void (*callback)(void * arg), void * arg, int level)
+{
+	pthread_mutex_lock(&g_wk.mutex);
+	g_wk.tq_low_callback = callback;
+	g_wk.tq_low_arg = arg;
+	g_wk.tq_low_level = level;
+	pthread_mutex_unlock(&g_wk.mutex);
+}
+
+
+
+
+static bool engine_winkeyer_send_character(char character)
+{
+	engine_winkeyer_item_t item = { .kind = ENGINE_WINKEYER_ITEM_TEXT };
+	unsigned int echoes = 0;
+	size_t const count = winkeyer_character_bytes(character, item.bytes, &echoes);
+	if (0 == count) {
+		errno = ENOENT;
+		return false;
+	}
+	item.count = (uint8_t) count;
+	item.echoes = (uint8_t) echoes;
+	return engine_winkeyer_enqueue(&item);
+}
+
+
+
+
+static bool engine_winkeyer_queue_tone(int duration_us, int frequency)
+{
+	if (duration_us < 0) {
+		errno = EINVAL;
+		return false;
+	}
+	engine_winkeyer_item_t const item = {
+		.kind = 0 != frequency ? ENGINE_WINKEYER_ITEM_TONE : ENGINE_WINKEYER_ITEM_SPACE,
+		.value = duration_us,
+	};
+	return engine_winkeyer_enqueue(&item);
+}
+
+
+
+
+/// @brief Append item to queue
+///
+/// @return true on success
+/// @return false if the engine is not running or the queue is full (errno is set)
+static bool engine_winkeyer_enqueue(engine_winkeyer_item_t const * item)
+{
+	pthread_mutex_lock(&g_wk.mutex);
+	if (!g_wk.running) {
+		pthread_mutex_unlock(&g_wk.mutex);
+		errno = ENODEV;
+		return false;
+	}
+	if (g_wk.len >= ENGINE_WINKEYER_QUEUE_CAPACITY) {
+		pthread_mutex_unlock(&g_wk.mutex);
+		errno = EAGAIN;
+		return false;
+	}
+	g_wk.queue[(g_wk.head + g_wk.len) % ENGINE_WINKEYER_QUEUE_CAPACITY] = *item;
+	g_wk.len++;
+	pthread_mutex_unlock(&g_wk.mutex);
+
+	engine_winkeyer_wake();
+	return true;
+}
+
+
+
+
+/// Abort: remove items from the queue, and clear keyer's buffer.
+static void engine_winkeyer_flush_tone_queue(void)
+{
+	pthread_mutex_lock(&g_wk.mutex);
+	g_wk.len = 0;
+	g_wk.inflight = 0;
+	g_wk.xoff = false;
+	g_wk.tone = false;
+	uint8_t const clear[] = { WINKEYER_CMD_CLEAR_BUFFER, WINKEYER_CMD_KEY_IMMEDIATE, 0 };
+	winkeyer_write(clear, sizeof (clear));
+	pthread_mutex_unlock(&g_wk.mutex);
+
+	engine_winkeyer_wake();
+}
+
+
+
+
+static void engine_winkeyer_straight_key(int keystate)
+{
+	if (keystate) {
+		engine_winkeyer_flush_tone_queue();
+	}
+	uint8_t const key[] = { WINKEYER_CMD_KEY_IMMEDIATE, keystate ? 1 : 0 };
+	winkeyer_write(key, sizeof (key));
+}
+
+
+
+
+static void engine_winkeyer_wait_for_tone_queue(void)
+{
+	pthread_mutex_lock(&g_wk.mutex);
+	while (g_wk.running && engine_winkeyer_length() > 0) {
+		pthread_cond_wait(&g_wk.cond, &g_wk.mutex);
+	}
+	pthread_mutex_unlock(&g_wk.mutex);
+}
+
+
+
+
+static int engine_winkeyer_get_tone_queue_length(void)
+{
+	pthread_mutex_lock(&g_wk.mutex);
+	int const len = engine_winkeyer_length();
+	pthread_mutex_unlock(&g_wk.mutex);
+	return len;
+}
+
+
+
+
+/// @brief Set speed
+///
+/// Speed changes in the middle of text (e.g. '+' and '-' in a request)
+/// apply to characters that follow, so the change is queued together with
+/// the characters.
+static void engine_winkeyer_set_send_speed(int wpm)
+{
+	if (wpm < CW_SPEED_MIN || wpm > CW_SPEED_MAX) {
+		return;
+	}
+	wpm = wpm < WINKEYER_SPEED_MIN ? WINKEYER_SPEED_MIN : wpm;
+
+	pthread_mutex_lock(&g_wk.mutex);
+	g_wk.wpm = wpm;
+	bool const queued = g_wk.running && (g_wk.len > 0 || g_wk.inflight > 0);
+	if (!queued) {
+		g_wk.committed_wpm = wpm;
+		uint8_t const speed[] = { WINKEYER_CMD_SPEED, (uint8_t) wpm };
+		winkeyer_write(speed, sizeof (speed));
+	}
+	pthread_mutex_unlock(&g_wk.mutex);
+
+	if (queued) {
+		engine_winkeyer_item_t const item = { .kind = ENGINE_WINKEYER_ITEM_SPEED, .value = wpm };
+		engine_winkeyer_enqueue(&item);
+	}
+}
+
+
+
+
+/// Sidetone of the keyer has frequency of 4000 Hz divided by a number in range 1 - 10.
+static void engine_winkeyer_set_frequency(int frequency)
+{
+	if (frequency <= 0) {
+		return;
+	}
+	int divider = (4000 + frequency / 2) / frequency;
+	divider = divider < 1 ? 1 : (divider > 10 ? 10 : divider);
+	uint8_t const sidetone[] = { WINKEYER_CMD_SIDETONE, (uint8_t) divider };
+	winkeyer_write(sidetone, sizeof (sidetone));
+}
+
+
+
+
+static void engine_winkeyer_set_volume(__attribute__((unused)) int volume)
+{
+	/* Volume of keyer's sidetone can't be controlled by host. */
+}
+
+
+
+
+/// The keyer has no equivalent of additional inter-character gap. The gap
+/// is remembered only to keep cwdaemon's handling of '~' consistent.
+static void engine_winkeyer_set_gap(int gap)
+{
+	if (gap < CW_GAP_MIN || gap > CW_GAP_MAX) {
+		return;
+	}
+	pthread_mutex_lock(&g_wk.mutex);
+	g_wk.gap = gap;
+	pthread_mutex_unlock(&g_wk.mutex);
+}
+
+
+
+
+static int engine_winkeyer_get_gap(void)
+{
+	pthread_mutex_lock(&g_wk.mutex);
+	int const gap = g_wk.gap;
+	pthread_mutex_unlock(&g_wk.mutex);
+	return gap;
+}
+
+
+
+
+/// Weighting of the keyer uses the same scale as libcw: 50 is normal.
+static void engine_winkeyer_set_weighting(int weighting)
+{
+	if (weighting < CW_WEIGHTING_MIN || weighting > CW_WEIGHTING_MAX) {
+		return;
+	}
+	uint8_t const command[] = { WINKEYER_CMD_WEIGHTING, (uint8_t) weighting };
+	winkeyer_write(command, sizeof (command));
+}
+
+
+
+
+static void engine_winkeyer_set_ptt_timing(unsigned int lead_ms, unsigned int tail_ms)
+{
+	lead_ms = lead_ms > WINKEYER_PTT_TIME_MAX_MS ? WINKEYER_PTT_TIME_MAX_MS : lead_ms;
+	tail_ms = tail_ms > WINKEYER_PTT_TIME_MAX_MS ? WINKEYER_PTT_TIME_MAX_MS : tail_ms;
+
+	uint8_t pincfg = WINKEYER_PINCFG_KEY1 | WINKEYER_PINCFG_SIDETONE;
+	if (lead_ms) {
+		pincfg |= WINKEYER_PINCFG_PTT;
+	}
+	uint8_t const command[] = {
+		WINKEYER_CMD_PIN_CONFIG, pincfg,
+		WINKEYER_CMD_PTT_LEAD_TAIL, (uint8_t) ((lead_ms + 9) / 10), (uint8_t) ((tail_ms + 9) / 10),
+	};
+	winkeyer_write(command, sizeof (command));
+}
+
+
+
+
+static void engine_winkeyer_wake(void)
+{
+	uint8_t const byte = 0;
+	if (-1 != g_wk.wake_fds[1]) {
+		/* Pipe full means that the thread will be woken up anyway. */
+		(void) !write(g_wk.wake_fds[1], &byte, 1);
+	}
+}
+
+
+
+
+/// @brief Length of "tone queue": queued items, characters in keyer's buffer, and character being keyed
+///
+/// Call with the mutex locked.
+static int engine_winkeyer_length(void)
+{
+	return (int) (g_wk.len + g_wk.inflight) + (g_wk.busy ? 1 : 0);
+}
+
+
+
+
+/// @brief Main function of engine's thread: forward queued items to the keyer, read bytes from the keyer
+///
+/// Callbacks are called with the mutex unlocked, so that they can call
+/// functions of the engine (e.g. enqueue more tones).
+static void * engine_winkeyer_thread(__attribute__((unused)) void * arg)
+{
+	int const fd = winkeyer_fd();
+
+	rt_thread_apply("WinKeyer engine");
+	pthread_mutex_lock(&g_wk.mutex);
+	g_wk.last_receive_ns = engine_winkeyer_now_ns();
+	while (g_wk.running) {
+		int64_t now = engine_winkeyer_now_ns();
+		int const timeout_ms = engine_winkeyer_pump(now);
+
+		int const len = engine_winkeyer_length();
+		void (* const tq_low_callback)(void *) = g_wk.tq_low_callback;
+		void * const tq_low_arg = g_wk.tq_low_arg;
+		bool const tq_low = NULL != tq_low_callback
+			&& g_wk.reported_len > g_wk.tq_low_level
+			&& len <= g_wk.tq_low_level;
+		g_wk.reported_len = len;
+		if (0 == len) {
+			pthread_cond_broadcast(&g_wk.cond); // Wake up engine_winkeyer_wait_for_tone_queue().
+		}
+		int const wake_fd = g_wk.wake_fds[0];
+		pthread_mutex_unlock(&g_wk.mutex);
+
+		if (tq_low) {
+			tq_low_callback(tq_low_arg);
+			pthread_mutex_lock(&g_wk.mutex);
+			continue; // The callback may have enqueued items.
+		}
+
+		struct pollfd fds[2] = {
+			{ .fd = fd,      .events = POLLIN },
+			{ .fd = wake_fd, .events = POLLIN },
+		};
+		poll(fds, 2, timeout_ms);
+
+		uint8_t bytes[64];
+		ssize_t n = 0;
+		if (fds[1].revents & POLLIN) {
+			while (read(wake_fd, bytes, sizeof (bytes)) > 0) {
+				;
+			}
+		}
+		if (fds[0].revents & POLLIN) {
+			n = read(fd, bytes, sizeof (bytes));
+		}
+
+		pthread_mutex_lock(&g_wk.mutex);
+		now = engine_winkeyer_now_ns();
+		for (ssize_t i = 0; i < n; i++) {
+			engine_winkeyer_receive(bytes[i], now);
+		}
+	}
+	pthread_cond_broadcast(&g_wk.cond);
+	pthread_mutex_unlock(&g_wk.mutex);
+
+	return NULL;
+}
+
+
+
+
+/// @brief Forward items from head of queue to the keyer
+///
+/// Call with the mutex locked.
+///
+/// @return timeout of wait for next event, in milliseconds, or -1 for no timeout
+static int engine_winkeyer_pump(int64_t now)
+{
+	while (g_wk.len > 0) {
+		engine_winkeyer_item_t const * const item = &g_wk.queue[g_wk.head];
+
+		if (ENGINE_WINKEYER_ITEM_TEXT == item->kind) {
+			if (g_wk.xoff || g_wk.inflight >= WINKEYER_INFLIGHT_MAX) {
+				break; // Wait for echo of characters or for XON.
+			}
+			winkeyer_write(item->bytes, item->count);
+			g_wk.inflight += item->echoes;
+			g_wk.last_write_ns = now;
+
+		} else if (ENGINE_WINKEYER_ITEM_SPEED == item->kind) {
+			if (g_wk.inflight > 0) {
+				// Keyer returns to its non-buffered speed when its
+				// buffer becomes empty, the speed is committed then.
+				uint8_t const speed[] = { WINKEYER_CMD_BUFFERED_SPEED, (uint8_t) item->value };
+				winkeyer_write(speed, sizeof (speed));
+			} else {
+				uint8_t const speed[] = { WINKEYER_CMD_SPEED, (uint8_t) item->value };
+				winkeyer_write(speed, sizeof (speed));
+				g_wk.committed_wpm = item->value;
+			}
+
+		} else {
+			// Tones are keyed by host, after the keyer has keyed
+			// preceding text.
+			if (g_wk.inflight > 0) {
+				break;
+			}
+			bool const key = ENGINE_WINKEYER_ITEM_TONE == item->kind;
+			if (!g_wk.tone) {
+				if (key) {
+					uint8_t const down[] = { WINKEYER_CMD_KEY_IMMEDIATE, 1 };
+					winkeyer_write(down, sizeof (down));
+				}
+				g_wk.tone = true;
+				g_wk.tone_end_ns = now + (int64_t) item->value * 1000;
+			}
+			if (now < g_wk.tone_end_ns) {
+				return (int) ((g_wk.tone_end_ns - now + 999999) / 1000000);
+			}
+			if (key) {
+				uint8_t const up[] = { WINKEYER_CMD_KEY_IMMEDIATE, 0 };
+				winkeyer_write(up, sizeof (up));
+			}
+			g_wk.tone = false;
+		}
+
+		g_wk.head = (g_wk.head + 1) % ENGINE_WINKEYER_QUEUE_CAPACITY;
+		g_wk.len--;
+	}
+
+	if (0 == g_wk.inflight && g_wk.committed_wpm != g_wk.wpm && 0 == g_wk.len) {
+		uint8_t const speed[] = { WINKEYER_CMD_SPEED, (uint8_t) g_wk.wpm };
+		winkeyer_write(speed, sizeof (speed));
+		g_wk.committed_wpm = g_wk.wpm;
+	}
+
+	if (g_wk.inflight > 0 || g_wk.busy) {
+		int64_t const silent_ms = (now - g_wk.last_receive_ns) / 1000000;
+		if (silent_ms >= ENGINE_WINKEYER_STATUS_POLL_MS) {
+			uint8_t const status[] = { WINKEYER_CMD_STATUS };
+			winkeyer_write(status, sizeof (status));
+			g_wk.last_receive_ns = now;
+			return ENGINE_WINKEYER_STATUS_POLL_MS;
+		}
+		return (int) (ENGINE_WINKEYER_STATUS_POLL_MS - silent_ms);
+	}
+	return -1;
+}
+
+
+
+
+/// @brief Handle a byte received from the keyer
+///
+/// Call with the mutex locked.
+static void engine_winkeyer_receive(uint8_t byte, int64_t now)
+{
+	g_wk.last_receive_ns = now;
+
+	if (WINKEYER_STATUS_TAG == (byte & WINKEYER_STATUS_MASK)) {
+		g_wk.xoff = byte & WINKEYER_STATUS_XOFF;
+		g_wk.busy = byte & WINKEYER_STATUS_BUSY;
+		if (byte & WINKEYER_STATUS_BREAKIN) {
+			// Paddles of the keyer have interrupted the text, and the
+			// keyer has cleared its buffer.
+			cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "WinKeyer: break-in with paddles, dropping %zu queued items", g_wk.len);
+			g_wk.len = 0;
+			g_wk.inflight = 0;
+		}
+		if (!g_wk.busy && now - g_wk.last_write_ns > ENGINE_WINKEYER_TRANSIT_NS) {
+			// Idle keyer has nothing in its buffer, even if some echo
+			// has been lost.
+			g_wk.inflight = 0;
+		}
+	} else if (WINKEYER_SPEED_POT_TAG == (byte & WINKEYER_SPEED_POT_MASK)) {
+		; // Speed pot of the keyer is not used.
+	} else if (g_wk.inflight > 0) {
+		// The keyer is now keying the echoed character. Status byte
+		// with BUSY bit may arrive after the echo.
+		g_wk.inflight--;
+		g_wk.busy = true;
+	}
+
+	return;
+}
+
+
+
+
+static int64_t engine_winkeyer_now_ns(void)
+{
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
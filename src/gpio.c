@@ -0,0 +1,654 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// GPIO cwdevice, using version 2 of Linux GPIO character device
+/// interface. See gpio.h.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#if HAVE_LINUX_GPIO_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "cwdaemon.h"
+#include "gpio.h"
+#include "iambic.h"
+#include "log.h"
+#include "utils.h"
+
+
+
+
+/// Name of consumer of requested lines, visible e.g. in output of gpioinfo.
+#define GPIO_CONSUMER "cwdaemon"
+
+/// Prefix of names of GPIO chip devices.
+#define GPIO_CHIP_PREFIX "gpiochip"
+
+
+
+
+// Indices of lines in arrays passed to gpio_bit().
+enum { GPIO_OUTPUT_KEY, GPIO_OUTPUT_PTT, GPIO_OUTPUTS };
+enum { GPIO_INPUT_FOOTSWITCH, GPIO_INPUT_DOT, GPIO_INPUT_DASH, GPIO_INPUTS };
+
+
+
+
+static int gpio_init(cwdevice * dev, int fd);
+static int gpio_close(cwdevice * dev);
+static int gpio_reset_pins_state(cwdevice * dev);
+static int gpio_cw(cwdevice * dev, int onoff);
+static int gpio_ptt(cwdevice * dev, int onoff);
+static int gpio_footswitch(cwdevice * dev);
+static int gpio_paddles(cwdevice * dev);
+static int gpio_wait_input(cwdevice * dev);
+
+static void gpio_outputs(gpio_driver_options const * dropt, int offsets[GPIO_OUTPUTS]);
+static void gpio_inputs(gpio_driver_options const * dropt, int offsets[GPIO_INPUTS]);
+static uint64_t gpio_bit(int const * offsets, size_t which);
+static int gpio_request(cwdevice * dev, int const * offsets, size_t count, uint64_t flags, int * fd);
+static int gpio_request_lines(cwdevice * dev);
+static void gpio_release_lines(cwdevice * dev);
+static void gpio_set_lines(cwdevice * dev, uint64_t mask, uint64_t values);
+static uint64_t gpio_get_inputs(cwdevice * dev, uint64_t mask);
+static int gpio_parse_line(const char * value, int * offset);
+
+static int gpio_optparse(cwdevice * dev, const char * option);
+static int gpio_optvalidate(cwdevice * dev);
+
+
+
+
+int gpio_probe_cwdevice(const char * fname)
+{
+	char const * name = strrchr(fname, '/');
+	name = name ? name + 1 : fname;
+	if (0 != strncmp(name, GPIO_CHIP_PREFIX, strlen(GPIO_CHIP_PREFIX))) {
+		return -1;
+	}
+
+	char path[256] = { 0 };
+	int const retv = build_full_device_path(path, sizeof (path), fname);
+	if (0 != retv) {
+		log_error("Can't build path of GPIO chip from [%s]: %s", fname, strerror(-retv));
+		return -1;
+	}
+	int const fd = open(path, O_RDWR | O_CLOEXEC);
+	if (-1 == fd) {
+		log_error("open() failed for GPIO chip [%s]: %s", path, strerror(errno));
+		return -1;
+	}
+	struct gpiochip_info info;
+	memset(&info, 0, sizeof (info));
+	if (-1 == ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info)) {
+		log_error("ioctl(GPIO_GET_CHIPINFO_IOCTL) failed for GPIO chip [%s]: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	log_info("GPIO chip [%s]: name [%s], label [%s], %u lines", path, info.name, info.label, info.lines);
+
+	return fd;
+}
+
+
+
+
+int gpio_init_cwdevice(cwdevice * dev)
+{
+	memset(dev, 0, sizeof (cwdevice));
+	dev->fd = -1;
+	dev->io = &cwdevice_io_system;
+
+	dev->init                  = gpio_init;
+	dev->free                  = gpio_close;
+	dev->reset_pins_state      = gpio_reset_pins_state;
+	dev->cw                    = gpio_cw;
+	dev->ptt                   = gpio_ptt;
+
+	dev->options.optparse      = gpio_optparse;
+	dev->options.optvalidate   = gpio_optvalidate;
+
+	gpio_driver_options * const dropt = &dev->options.u.gpio_options;
+	dropt->key = GPIO_LINE_NONE;
+	dropt->ptt = GPIO_LINE_NONE;
+	dropt->footswitch = GPIO_LINE_NONE;
+	dropt->dot = GPIO_LINE_NONE;
+	dropt->dash = GPIO_LINE_NONE;
+	dropt->output_fd = -1;
+	dropt->input_fd = -1;
+
+	dev->desc = strdup(GPIO_CHIP_PREFIX "0");
+
+	return 0;
+}
+
+
+
+
+/// @brief Initialize GPIO cwdevice
+///
+/// Lines configured so far are requested. Lines configured later with "-o"
+/// are requested when the options are validated.
+static int gpio_init(cwdevice * dev, int fd)
+{
+	dev->fd = fd;
+	dev->latency_us = 0;
+	dev->options.u.gpio_options.output_fd = -1;
+	dev->options.u.gpio_options.input_fd = -1;
+
+	if (0 != gpio_request_lines(dev)) {
+		return -1;
+	}
+	dev->reset_pins_state(dev);
+
+	return 0;
+}
+
+
+
+
+/// @brief Close GPIO cwdevice
+///
+/// Released lines keep their last state, so the lines are reset first.
+static int gpio_close(cwdevice * dev)
+{
+	dev->reset_pins_state(dev);
+	gpio_release_lines(dev);
+
+	if (dev->fd >= 0) {
+		close(dev->fd);
+	}
+	dev->fd = -1;
+
+	return 0;
+}
+
+
+
+
+static int gpio_reset_pins_state(cwdevice * dev)
+{
+	int offsets[GPIO_OUTPUTS];
+	gpio_outputs(&dev->options.u.gpio_options, offsets);
+	uint64_t const mask = gpio_bit(offsets, GPIO_OUTPUT_KEY) | gpio_bit(offsets, GPIO_OUTPUT_PTT);
+	gpio_set_lines(dev, mask, 0);
+
+	return 0;
+}
+
+
+
+
+static int gpio_cw(cwdevice * dev, int onoff)
+{
+	int offsets[GPIO_OUTPUTS];
+	gpio_outputs(&dev->options.u.gpio_options, offsets);
+	uint64_t const bit = gpio_bit(offsets, GPIO_OUTPUT_KEY);
+	gpio_set_lines(dev, bit, onoff ? bit : 0);
+
+	return 0;
+}
+
+
+
+
+static int gpio_ptt(cwdevice * dev, int onoff)
+{
+	int offsets[GPIO_OUTPUTS];
+	gpio_outputs(&dev->options.u.gpio_options, offsets);
+	uint64_t const bit = gpio_bit(offsets, GPIO_OUTPUT_PTT);
+	gpio_set_lines(dev, bit, onoff ? bit : 0);
+
+	return 0;
+}
+
+
+
+
+/// @brief Get state of footswitch
+///
+/// @return 0 if footswitch is pressed
+/// @return 1 otherwise
+static int gpio_footswitch(cwdevice * dev)
+{
+	int offsets[GPIO_INPUTS];
+	gpio_inputs(&dev->options.u.gpio_options, offsets);
+	uint64_t const bit = gpio_bit(offsets, GPIO_INPUT_FOOTSWITCH);
+	return (gpio_get_inputs(dev, bit) & bit) ? 0 : 1;
+}
+
+
+
+
+/// @return IAMBIC_PADDLE_* bits of pressed paddles
+static int gpio_paddles(cwdevice * dev)
+{
+	int offsets[GPIO_INPUTS];
+	gpio_inputs(&dev->options.u.gpio_options, offsets);
+	uint64_t const dot = gpio_bit(offsets, GPIO_INPUT_DOT);
+	uint64_t const dash = gpio_bit(offsets, GPIO_INPUT_DASH);
+	uint64_t const lines = gpio_get_inputs(dev, dot | dash);
+
+	int paddles = 0;
+	if (lines & dot) {
+		paddles |= IAMBIC_PADDLE_DOT;
+	}
+	if (lines & dash) {
+		paddles |= IAMBIC_PADDLE_DASH;
+	}
+	return paddles;
+}
+
+
+
+
+/// @brief Wait for edge event on input lines
+///
+/// Events queued by kernel while nobody was waiting are consumed without
+/// waiting. Time stamp of most recent event is stored in
+/// cwdevice::input_event_ns.
+///
+/// @return 0 when input lines may have changed
+/// @return -1 on failure, or with errno set to EINTR when interrupted by signal
+static int gpio_wait_input(cwdevice * dev)
+{
+	int const fd = dev->options.u.gpio_options.input_fd;
+	struct gpio_v2_line_event events[16];
+
+	for (int round = 0; round < 2; round++) {
+		bool consumed = false;
+		for (;;) {
+			ssize_t const n = read(fd, events, sizeof (events));
+			if (n < (ssize_t) sizeof (events[0])) {
+				break;
+			}
+			size_t const count = (size_t) n / sizeof (events[0]);
+			__atomic_store_n(&dev->input_event_ns, (int64_t) events[count - 1].timestamp_ns, __ATOMIC_RELEASE);
+			consumed = true;
+		}
+		if (consumed) {
+			return 0;
+		}
+		if (EAGAIN != errno && EWOULDBLOCK != errno) {
+			return -1;
+		}
+		if (0 == round) {
+			struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+			if (-1 == poll(&pfd, 1, -1)) {
+				return -1; // EINTR when woken up by input_stop().
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+static void gpio_outputs(gpio_driver_options const * dropt, int offsets[GPIO_OUTPUTS])
+{
+	offsets[GPIO_OUTPUT_KEY] = dropt->key;
+	offsets[GPIO_OUTPUT_PTT] = dropt->ptt;
+}
+
+
+
+
+static void gpio_inputs(gpio_driver_options const * dropt, int offsets[GPIO_INPUTS])
+{
+	offsets[GPIO_INPUT_FOOTSWITCH] = dropt->footswitch;
+	offsets[GPIO_INPUT_DOT] = dropt->dot;
+	offsets[GPIO_INPUT_DASH] = dropt->dash;
+}
+
+
+
+
+/// @brief Get bit of a line in a line request
+///
+/// A line request contains used lines from @p offsets, in order, so the
+/// bit of a line depends on how many lines before it are used.
+///
+/// @return bit of the line, or zero if the line is not used
+static uint64_t gpio_bit(int const * offsets, size_t which)
+{
+	if (GPIO_LINE_NONE == offsets[which]) {
+		return 0;
+	}
+	unsigned int index = 0;
+	for (size_t i = 0; i < which; i++) {
+		if (GPIO_LINE_NONE != offsets[i]) {
+			index++;
+		}
+	}
+	return 1ull << index;
+}
+
+
+
+
+/// @brief Request used lines from @p offsets in a single line request
+///
+/// @param[out] fd file descriptor of the request, -1 if no line is used
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int gpio_request(cwdevice * dev, int const * offsets, size_t count, uint64_t flags, int * fd)
+{
+	*fd = -1;
+
+	struct gpio_v2_line_request request;
+	memset(&request, 0, sizeof (request));
+	for (size_t i = 0; i < count; i++) {
+		if (GPIO_LINE_NONE != offsets[i]) {
+			request.offsets[request.num_lines++] = (uint32_t) offsets[i];
+		}
+	}
+	if (0 == request.num_lines) {
+		return 0;
+	}
+
+	strncpy(request.consumer, GPIO_CONSUMER, sizeof (request.consumer) - 1);
+	request.config.flags = flags;
+	if (flags & GPIO_V2_LINE_FLAG_OUTPUT) {
+		// Outputs start inactive.
+		request.config.num_attrs = 1;
+		request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+		request.config.attrs[0].attr.values = 0;
+		request.config.attrs[0].mask = (1ull << request.num_lines) - 1;
+	}
+
+	if (0 != dev->io->ioctl(dev->fd, GPIO_V2_GET_LINE_IOCTL, &request)) {
+		log_error("ioctl(GPIO_V2_GET_LINE_IOCTL) failed for GPIO chip [%s]: %s", dev->desc, strerror(errno));
+		return -1;
+	}
+	*fd = request.fd;
+
+	return 0;
+}
+
+
+
+
+/// @brief Request lines configured in driver options
+///
+/// Previously requested lines are released first.
+static int gpio_request_lines(cwdevice * dev)
+{
+	gpio_driver_options * const dropt = &dev->options.u.gpio_options;
+	gpio_release_lines(dev);
+
+	int outputs[GPIO_OUTPUTS];
+	gpio_outputs(dropt, outputs);
+	uint64_t output_flags = GPIO_V2_LINE_FLAG_OUTPUT;
+	if (dropt->active_low) {
+		output_flags |= GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+	}
+	if (0 != gpio_request(dev, outputs, GPIO_OUTPUTS, output_flags, &dropt->output_fd)) {
+		return -1;
+	}
+	// Outputs were requested in inactive state.
+	dev->shadow.lines = 0;
+	dev->shadow.valid = true;
+
+	// Footswitch and paddles short the line to ground, so "active" means
+	// "low".
+	int inputs[GPIO_INPUTS];
+	gpio_inputs(dropt, inputs);
+	uint64_t const input_flags = GPIO_V2_LINE_FLAG_INPUT
+		| GPIO_V2_LINE_FLAG_ACTIVE_LOW
+		| GPIO_V2_LINE_FLAG_BIAS_PULL_UP
+		| GPIO_V2_LINE_FLAG_EDGE_RISING
+		| GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	if (0 != gpio_request(dev, inputs, GPIO_INPUTS, input_flags, &dropt->input_fd)) {
+		gpio_release_lines(dev);
+		return -1;
+	}
+	if (dropt->input_fd >= 0) {
+		int const flags = fcntl(dropt->input_fd, F_GETFL);
+		fcntl(dropt->input_fd, F_SETFL, flags | O_NONBLOCK);
+	}
+
+	dev->footswitch = GPIO_LINE_NONE != dropt->footswitch ? gpio_footswitch : NULL;
+	dev->paddles = (GPIO_LINE_NONE != dropt->dot || GPIO_LINE_NONE != dropt->dash) ? gpio_paddles : NULL;
+	dev->wait_input = dropt->input_fd >= 0 ? gpio_wait_input : NULL;
+
+	return 0;
+}
+
+
+
+
+static void gpio_release_lines(cwdevice * dev)
+{
+	gpio_driver_options * const dropt = &dev->options.u.gpio_options;
+	if (dropt->output_fd >= 0) {
+		close(dropt->output_fd);
+		dropt->output_fd = -1;
+	}
+	if (dropt->input_fd >= 0) {
+		close(dropt->input_fd);
+		dropt->input_fd = -1;
+	}
+	dev->shadow.valid = false;
+	dev->footswitch = NULL;
+	dev->paddles = NULL;
+	dev->wait_input = NULL;
+}
+
+
+
+
+/// @brief Change given output lines with a single ioctl()
+///
+/// Lines that already are in requested state are not changed.
+///
+/// @param dev cwdevice
+/// @param[in] mask bits of lines to change
+/// @param[in] values new values of lines in @p mask
+static void gpio_set_lines(cwdevice * dev, uint64_t mask, uint64_t values)
+{
+	int const fd = dev->options.u.gpio_options.output_fd;
+	if (fd < 0 || 0 == mask) {
+		return;
+	}
+
+	unsigned int const lines = (dev->shadow.lines & ~(unsigned int) mask) | (unsigned int) (values & mask);
+	uint64_t const changed = dev->shadow.valid ? (lines ^ dev->shadow.lines) : mask;
+	if (0 == changed) {
+		return;
+	}
+
+	struct gpio_v2_line_values line_values = { .bits = values & changed, .mask = changed };
+	if (0 != dev->io->ioctl(fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &line_values)) {
+		log_warning("ioctl(GPIO_V2_LINE_SET_VALUES_IOCTL) failed for GPIO chip [%s]: %s", dev->desc, strerror(errno));
+		dev->shadow.valid = false;
+		return;
+	}
+	dev->shadow.lines = lines;
+	dev->shadow.valid = true;
+}
+
+
+
+
+/// @return bits of active input lines from @p mask
+static uint64_t gpio_get_inputs(cwdevice * dev, uint64_t mask)
+{
+	int const fd = dev->options.u.gpio_options.input_fd;
+	if (fd < 0 || 0 == mask) {
+		return 0;
+	}
+	struct gpio_v2_line_values line_values = { .bits = 0, .mask = mask };
+	if (0 != dev->io->ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &line_values)) {
+		return 0;
+	}
+	return line_values.bits & mask;
+}
+
+
+
+
+/// @brief Parse offset of a line
+///
+/// @param[in] value offset of line on GPIO chip, or "none"
+/// @param[out] offset parsed offset, or GPIO_LINE_NONE for "none"
+///
+/// @return 0 on success
+/// @return -1 if @p value is not a valid offset
+static int gpio_parse_line(const char * value, int * offset)
+{
+	if (!strcasecmp(value, "none")) {
+		*offset = GPIO_LINE_NONE;
+		return 0;
+	}
+
+	char * end = NULL;
+	errno = 0;
+	long const parsed = strtol(value, &end, 10);
+	if (0 != errno || end == value || '\0' != *end || parsed < 0 || parsed > GPIO_LINE_MAX) {
+		return -1;
+	}
+	*offset = (int) parsed;
+	return 0;
+}
+
+
+
+
+/// @brief Parse value passed to "-o" command line option
+///
+/// Lines are requested only when all options have been parsed, in
+/// gpio_optvalidate().
+///
+/// @param dev cwdevice in which to store parsed configuration
+/// @param option string that is a value of "-o" command line option
+///
+/// @return 0 if option was parsed successfully
+/// @return -1 otherwise
+static int gpio_optparse(cwdevice * dev, const char * option)
+{
+	gpio_driver_options * const dropt = &dev->options.u.gpio_options;
+
+	struct {
+		char const * keyword;
+		int * offset;
+	} const lines[] = {
+		{ "key",        &dropt->key        },
+		{ "ptt",        &dropt->ptt        },
+		{ "footswitch", &dropt->footswitch },
+		{ "dot",        &dropt->dot        },
+		{ "dash",       &dropt->dash       },
+	};
+
+	const char * value = NULL;
+	for (size_t i = 0; i < sizeof (lines) / sizeof (lines[0]); i++) {
+		if (opt_success == find_opt_value(option, lines[i].keyword, &value)) {
+			/* <keyword>=<offset>|none */
+			if (0 != gpio_parse_line(value, lines[i].offset)) {
+				cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "Invalid value for '%s' option: %s", lines[i].keyword, value);
+				return -1;
+			}
+			return 0;
+		}
+	}
+
+	if (opt_success == find_opt_value(option, "active", &value)) {
+		/* active=high|low */
+		if (!strcasecmp(value, "high")) {
+			dropt->active_low = false;
+		} else if (!strcasecmp(value, "low")) {
+			dropt->active_low = true;
+		} else {
+			cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "Invalid value for 'active' option: %s", value);
+			return -1;
+		}
+		return 0;
+	}
+
+	cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "Invalid option for GPIO keying device (expected 'key|ptt|footswitch|dot|dash=<offset>|none' or 'active=high|low'): [%s]", option);
+	return -1;
+}
+
+
+
+
+/// @brief Validate parsed driver options, and request configured lines
+///
+/// @param dev cwdevice for which to validate configuration of cwdevice
+///
+/// @return 0 if validation found no errors in the configuration
+/// @return -1 if validation found some errors in the configuration
+static int gpio_optvalidate(cwdevice * dev)
+{
+	gpio_driver_options const * const dropt = &dev->options.u.gpio_options;
+
+	int const offsets[] = { dropt->key, dropt->ptt, dropt->footswitch, dropt->dot, dropt->dash };
+	size_t const count = sizeof (offsets) / sizeof (offsets[0]);
+	for (size_t i = 0; i < count; i++) {
+		for (size_t j = i + 1; j < count; j++) {
+			if (GPIO_LINE_NONE != offsets[i] && offsets[i] == offsets[j]) {
+				/* You can't use the same line for two purposes. */
+				log_error("two functions use the same GPIO line %d", offsets[i]);
+				return -1;
+			}
+		}
+	}
+	if (GPIO_LINE_NONE == dropt->key) {
+		log_warning("No GPIO line is used for keying, use \"-o key=<offset>\" %s", "");
+	}
+
+	if (dev->fd >= 0) {
+		if (0 != gpio_request_lines(dev)) {
+			return -1;
+		}
+		dev->reset_pins_state(dev);
+	}
+
+	return 0;
+}
+
+
+
+
+#endif /* #if HAVE_LINUX_GPIO_H */
+
@@ -0,0 +1,107 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_GPIO_H
+#define CWDAEMON_GPIO_H
+
+
+
+
+/// @file
+///
+/// GPIO cwdevice: keying through lines of a Linux GPIO chip
+/// (/dev/gpiochipN), using line requests of version 2 of GPIO character
+/// device interface.
+///
+/// Key and PTT outputs are requested together, in a single line request, so
+/// both of them are changed with a single ioctl(). Footswitch and paddle
+/// inputs are requested in another line request with edge detection, and
+/// their changes are reported by kernel as edge events with time stamps.
+///
+/// Lines are selected with "-o" options, by their offsets on the chip:
+/// "-o key=17 -o ptt=27 -o footswitch=22".
+
+
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+
+/// Value of offset of a line that is not used.
+#define GPIO_LINE_NONE  (-1)
+
+/// Max accepted offset of a line on a chip.
+#define GPIO_LINE_MAX   1023
+
+
+
+
+// Forward declaration.
+struct cwdev_s;
+
+
+
+
+typedef struct gpio_driver_options {
+	int key;         // Offset of output line used for keying, GPIO_LINE_NONE by default.
+	int ptt;         // Offset of output line used for PTT, GPIO_LINE_NONE by default.
+	int footswitch;  // Offset of input line used for footswitch, GPIO_LINE_NONE by default.
+	int dot;         // Offset of input line used for dot paddle (or straight key), GPIO_LINE_NONE by default.
+	int dash;        // Offset of input line used for dash paddle, GPIO_LINE_NONE by default.
+	bool active_low; // Outputs are active when low ("active=low"). Inputs are always active low, with pull-up bias.
+
+	int output_fd;   // Not an option: file descriptor of line request of outputs, -1 if not requested.
+	int input_fd;    // Not an option: file descriptor of line request of inputs, -1 if not requested.
+} gpio_driver_options;
+
+
+
+
+/// @brief Initialize "struct cwdev_s" variable for GPIO cwdevice
+///
+/// @param[in/out] dev GPIO cwdevice structure to initialize
+///
+/// @return 0 on success
+/// @return -1 on failure
+int gpio_init_cwdevice(struct cwdev_s * dev);
+
+
+
+
+/// @brief Try opening a GPIO chip cwdevice with given device name
+///
+/// Only names of GPIO chips ("gpiochip0" or "/dev/gpiochip0") are
+/// accepted, so that probing doesn't open (and change lines of) other
+/// devices.
+///
+/// @return -1 if the device isn't a GPIO chip
+/// @return a file descriptor if the device is a GPIO chip
+int gpio_probe_cwdevice(const char * fname);
+
+
+
+
+#endif /* #ifndef CWDAEMON_GPIO_H */
+
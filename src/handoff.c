@@ -0,0 +1,470 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+
+/// @file
+///
+/// Hot restart of cwdaemon: handing the bound network socket over to a new
+/// process with SCM_RIGHTS. See handoff.h.
+
+
+
+
+#define _XOPEN_SOURCE 700 /* realpath() */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "handoff.h"
+#include "log.h"
+#include "notify.h"
+#include "socket.h"
+#include "utils.h"
+
+
+
+
+/// Descriptor at which new process gets its end of socket pair.
+#define HANDOFF_CHANNEL_FD  3
+
+/// Max count of sockets passed to new process: UDP and Unix-domain.
+#define HANDOFF_SOCKETS_MAX 2
+
+/// Descriptors above this one are not closed in new process: they
+/// wouldn't be opened by cwdaemon anyway.
+#define HANDOFF_FD_MAX      1024
+
+
+
+
+extern char ** environ;
+
+/// Absolute path to the program, resolved at start.
+static char g_program_path[PATH_MAX];
+
+/// Self-pipe written by handler of HANDOFF_SIGNAL.
+static int g_signal_pipe[2] = { -1, -1 };
+
+/// Socket pair to old process, in new process.
+static int g_channel = -1;
+
+
+
+
+static void handoff_signal_handler(int signal);
+static int handoff_resolve_path(char const * argv0);
+static int handoff_read_until(int fd, char const * message, int timeout_ms);
+static int64_t handoff_now_ms(void);
+
+
+
+
+int handoff_listen(char const * argv0)
+{
+	if (0 != handoff_resolve_path(argv0)) {
+		log_warning("Can't find path to program [%s]", argv0);
+		return -1;
+	}
+
+	if (0 != pipe(g_signal_pipe)) {
+		log_warning("Failed to create pipe for hand-over requests: %s", strerror(errno));
+		return -1;
+	}
+	for (int i = 0; i < 2; i++) {
+		fcntl(g_signal_pipe[i], F_SETFD, FD_CLOEXEC);
+		fcntl(g_signal_pipe[i], F_SETFL, fcntl(g_signal_pipe[i], F_GETFL) | O_NONBLOCK);
+	}
+
+	struct sigaction action = { 0 };
+	action.sa_handler = handoff_signal_handler;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	if (0 != sigaction(HANDOFF_SIGNAL, &action, NULL)) {
+		log_warning("Failed to install handler of hand-over signal: %s", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+int handoff_get_fd(void)
+{
+	return g_signal_pipe[0];
+}
+
+
+
+
+bool handoff_requested(void)
+{
+	if (-1 == g_signal_pipe[0]) {
+		return false;
+	}
+	bool requested = false;
+	char buf[16];
+	while (read(g_signal_pipe[0], buf, sizeof (buf)) > 0) {
+		requested = true;
+	}
+	return requested;
+}
+
+
+
+
+int handoff_spawn(char * const argv[], int socket_fd, int unix_socket_fd)
+{
+	if ('\0' == g_program_path[0]) {
+		log_error("Path to program is unknown, can't start new process %s", "");
+		return -1;
+	}
+
+	int pair[2] = { -1, -1 };
+	if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, pair)) {
+		log_error("Failed to create socket pair for hand-over: %s", strerror(errno));
+		return -1;
+	}
+	fcntl(pair[0], F_SETFD, FD_CLOEXEC);
+	fcntl(pair[1], F_SETFD, FD_CLOEXEC);
+
+	/* Environment of new process is prepared before fork(): only
+	   async-signal-safe functions may be called in the child of
+	   multi-threaded process. */
+	static char env_fd[] = HANDOFF_ENV_FD "=3";
+	size_t count = 0;
+	while (environ[count]) {
+		count++;
+	}
+	char ** envp = calloc(count + 2, sizeof (char *));
+	if (NULL == envp) {
+		log_error("Failed to allocate environment of new process %s", "");
+		close(pair[0]);
+		close(pair[1]);
+		return -1;
+	}
+	size_t n = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (0 != strncmp(environ[i], HANDOFF_ENV_FD "=", strlen(HANDOFF_ENV_FD "="))) {
+			envp[n++] = environ[i];
+		}
+	}
+	envp[n] = env_fd;
+
+	pid_t const pid = fork();
+	if (0 == pid) {
+		/* dup2() clears FD_CLOEXEC of the new descriptor. */
+		if (HANDOFF_CHANNEL_FD == pair[1]) {
+			fcntl(pair[1], F_SETFD, 0);
+		} else if (-1 == dup2(pair[1], HANDOFF_CHANNEL_FD)) {
+			_exit(127);
+		}
+		/* The network socket is passed only through the pair. */
+		for (int fd = HANDOFF_CHANNEL_FD + 1; fd < HANDOFF_FD_MAX; fd++) {
+			close(fd);
+		}
+		execve(g_program_path, argv, envp);
+		_exit(127);
+	}
+	free(envp);
+	close(pair[1]);
+	if (pid < 0) {
+		log_error("Failed to start new process: %s", strerror(errno));
+		close(pair[0]);
+		return -1;
+	}
+	log_info("Started new process %ld, handing network socket%s over to it", (long) pid, -1 == unix_socket_fd ? "" : "s");
+
+	/* Both sockets are passed in one message, so the new process
+	   either gets all of them or none. */
+	int const fds[HANDOFF_SOCKETS_MAX] = { socket_fd, unix_socket_fd };
+	size_t const fds_count = -1 == unix_socket_fd ? 1 : 2;
+	char byte = 'S';
+	struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+	union {
+		struct cmsghdr header;
+		char buf[CMSG_SPACE(sizeof (fds))];
+	} control;
+	memset(&control, 0, sizeof (control));
+	struct msghdr msg = { 0 };
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = CMSG_SPACE(fds_count * sizeof (int));
+	struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(fds_count * sizeof (int));
+	memcpy(CMSG_DATA(cmsg), fds, fds_count * sizeof (int));
+
+	int rv = -1;
+	if (1 != sendmsg(pair[0], &msg, MSG_NOSIGNAL)) {
+		log_error("Failed to pass network socket to new process: %s", strerror(errno));
+	} else {
+		rv = handoff_read_until(pair[0], NOTIFY_READY_MESSAGE, HANDOFF_READY_TIMEOUT_MS);
+		if (0 != rv) {
+			log_error("New process %ld hasn't become ready: %s", (long) pid, 1 == rv ? "timeout" : "it has exited");
+		} else if (-1 == send(pair[0], HANDOFF_GO_MESSAGE, strlen(HANDOFF_GO_MESSAGE), MSG_NOSIGNAL)) {
+			log_error("Failed to let new process take over: %s", strerror(errno));
+			rv = -1;
+		}
+	}
+
+	if (0 != rv) {
+		/* Without HANDOFF_GO_MESSAGE, a daemonized descendant of
+		   the process will exit by itself. */
+		kill(pid, SIGTERM);
+		close(pair[0]);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+
+	/* The pair is closed when this process exits, and this is the
+	   signal for the new process to start reading requests. */
+	waitpid(pid, NULL, WNOHANG);
+	log_info("New process %ld has taken over", (long) pid);
+	return 0;
+}
+
+
+
+
+int handoff_receive(cwdaemon_t * cwdaemon)
+{
+	char const * value = getenv(HANDOFF_ENV_FD);
+	if (NULL == value) {
+		return 0;
+	}
+	long lv = 0;
+	bool const valid = cwdaemon_get_long(value, &lv) && lv >= 0 && lv <= INT_MAX;
+	unsetenv(HANDOFF_ENV_FD);
+	if (!valid) {
+		log_error("Invalid value of %s: [%s]", HANDOFF_ENV_FD, value);
+		return -1;
+	}
+	int const channel = (int) lv;
+	fcntl(channel, F_SETFD, FD_CLOEXEC);
+
+	char byte = 0;
+	struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+	union {
+		struct cmsghdr header;
+		char buf[CMSG_SPACE(HANDOFF_SOCKETS_MAX * sizeof (int))];
+	} control;
+	memset(&control, 0, sizeof (control));
+	struct msghdr msg = { 0 };
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof (control.buf);
+
+	ssize_t rv = 0;
+	do {
+		rv = recvmsg(channel, &msg, 0);
+	} while (-1 == rv && EINTR == errno);
+	struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+	if (1 != rv || NULL == cmsg || SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type
+	    || (CMSG_LEN(sizeof (int)) != cmsg->cmsg_len && CMSG_LEN(HANDOFF_SOCKETS_MAX * sizeof (int)) != cmsg->cmsg_len)) {
+		log_error("Failed to receive network socket from previous process: %s", -1 == rv ? strerror(errno) : "no socket");
+		close(channel);
+		return -1;
+	}
+	/* UDP socket, and optionally Unix-domain socket. */
+	int fds[HANDOFF_SOCKETS_MAX] = { -1, -1 };
+	size_t const fds_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof (int);
+	memcpy(fds, CMSG_DATA(cmsg), fds_count * sizeof (int));
+
+	if (0 != cwdaemon_socket_adopt(cwdaemon, fds[0], "previous process")) {
+		close(fds[0]);
+		if (-1 != fds[1]) {
+			close(fds[1]);
+		}
+		close(channel);
+		return -1;
+	}
+	if (-1 != fds[1]) {
+		/* Requests waiting in the socket are not lost, as they would
+		   be if the socket was bound again at the same path. */
+		if (NULL == cwdaemon->unix_socket_path) {
+			log_warning("Unix-domain socket passed by previous process is not configured, closing it %s", "");
+			close(fds[1]);
+		} else if (0 != cwdaemon_unix_socket_adopt(cwdaemon, fds[1], "previous process")) {
+			close(fds[1]);
+			close(channel);
+			return -1;
+		}
+	}
+
+	g_channel = channel;
+	return 1;
+}
+
+
+
+
+int handoff_complete(void)
+{
+	if (-1 == g_channel) {
+		return 0;
+	}
+
+	int rv = -1;
+	if (-1 == send(g_channel, NOTIFY_READY_MESSAGE, strlen(NOTIFY_READY_MESSAGE), MSG_NOSIGNAL)) {
+		log_error("Failed to notify previous process about readiness: %s", strerror(errno));
+	} else if (0 != handoff_read_until(g_channel, HANDOFF_GO_MESSAGE, HANDOFF_EXIT_TIMEOUT_MS)) {
+		log_error("Previous process has given up the hand-over %s", "");
+	} else if (-1 != handoff_read_until(g_channel, NULL, HANDOFF_EXIT_TIMEOUT_MS)) {
+		log_error("Previous process hasn't exited %s", "");
+	} else {
+		log_info("Previous process has exited, taking over network socket %s", "");
+		rv = 0;
+	}
+
+	close(g_channel);
+	g_channel = -1;
+	return rv;
+}
+
+
+
+
+static void handoff_signal_handler(__attribute__((unused)) int signal)
+{
+	int const saved_errno = errno;
+	ssize_t const rv = write(g_signal_pipe[1], "h", 1);
+	(void) rv;
+	errno = saved_errno;
+}
+
+
+
+
+/// @brief Find absolute path to the program, like execvp() would do
+///
+/// @param[in] argv0 argv[0] of the program
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int handoff_resolve_path(char const * argv0)
+{
+	if (strchr(argv0, '/')) {
+		return NULL == realpath(argv0, g_program_path) ? -1 : 0;
+	}
+
+	char const * path = getenv("PATH");
+	if (NULL == path) {
+		path = "/usr/bin:/bin";
+	}
+	while (*path) {
+		size_t const len = strcspn(path, ":");
+		char candidate[PATH_MAX] = { 0 };
+		int const n = snprintf(candidate, sizeof (candidate), "%.*s/%s", (int) len, len ? path : ".", argv0);
+		if (n > 0 && (size_t) n < sizeof (candidate) && 0 == access(candidate, X_OK)
+		    && NULL != realpath(candidate, g_program_path)) {
+			return 0;
+		}
+		path += len;
+		if (':' == *path) {
+			path++;
+		}
+	}
+	return -1;
+}
+
+
+
+
+/// @brief Read from socket pair until @p message or end-of-file
+///
+/// @param[in] fd socket pair
+/// @param[in] message message to wait for, NULL to wait only for end-of-file
+/// @param[in] timeout_ms time limit
+///
+/// @return 0 if @p message has been received
+/// @return 1 on timeout
+/// @return -1 on end-of-file or error
+static int handoff_read_until(int fd, char const * message, int timeout_ms)
+{
+	char buf[64] = { 0 };
+	size_t len = 0;
+	int64_t const deadline = handoff_now_ms() + timeout_ms;
+	while (1) {
+		int64_t const remaining = deadline - handoff_now_ms();
+		if (remaining <= 0) {
+			return 1;
+		}
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		int const n = poll(&pfd, 1, (int) remaining);
+		if (n < 0 && EINTR != errno) {
+			return -1;
+		}
+		if (n <= 0) {
+			continue;
+		}
+
+		ssize_t const rv = read(fd, buf + len, sizeof (buf) - 1 - len);
+		if (rv < 0 && EINTR == errno) {
+			continue;
+		}
+		if (rv <= 0) {
+			return -1;
+		}
+		len += (size_t) rv;
+		buf[len] = '\0';
+		if (message && strstr(buf, message)) {
+			return 0;
+		}
+		if (len == sizeof (buf) - 1) {
+			len = 0; // Garbage.
+		}
+	}
+}
+
+
+
+
+static int64_t handoff_now_ms(void)
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,153 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+#ifndef CWDAEMON_HANDOFF_H
+#define CWDAEMON_HANDOFF_H
+
+
+
+
+/// @file
+///
+/// Hot restart of cwdaemon: handing the bound network socket over to a new
+/// process.
+///
+/// On HANDOFF_SIGNAL the running cwdaemon finishes sending queued text,
+/// releases its cwdevice and keying engine, and starts a new instance of
+/// the program with the same command line. The bound UDP socket (and the
+/// Unix-domain socket, if there is one) is passed to the new process with
+/// SCM_RIGHTS over a Unix socket pair, whose descriptor is given to the
+/// new process in HANDOFF_ENV_FD environment variable. Requests that
+/// arrive in the meantime wait in the sockets' receive buffers, so no
+/// datagram is lost.
+///
+/// Protocol on the socket pair:
+///  - old process sends one byte with the UDP socket and optional
+///    Unix-domain socket attached;
+///  - new process sends NOTIFY_READY_MESSAGE when it's ready;
+///  - old process sends HANDOFF_GO_MESSAGE and exits;
+///  - new process starts reading requests when it sees that the old
+///    process has closed its end of the pair (i.e. has exited).
+///
+/// If the new process doesn't become ready within
+/// HANDOFF_READY_TIMEOUT_MS, it's terminated, and the old process resumes
+/// its work. A new process that doesn't get HANDOFF_GO_MESSAGE exits.
+
+
+
+
+#include <signal.h>
+#include <stdbool.h>
+
+#include "cwdaemon.h"
+
+
+
+
+#define HANDOFF_SIGNAL              SIGUSR2
+#define HANDOFF_ENV_FD              "CWDAEMON_HANDOFF_FD"
+#define HANDOFF_GO_MESSAGE          "GO\n"
+#define HANDOFF_READY_TIMEOUT_MS    30000
+#define HANDOFF_EXIT_TIMEOUT_MS     10000
+
+
+
+
+/// @brief Prepare for hand-over in running process
+///
+/// Resolve path to the program (call this before chdir()), and install
+/// handler of HANDOFF_SIGNAL.
+///
+/// @param[in] argv0 argv[0] of the program
+///
+/// @return 0 on success
+/// @return -1 on failure
+int handoff_listen(char const * argv0);
+
+
+
+
+/// @brief Get descriptor that becomes readable when hand-over is requested
+///
+/// @return descriptor to be watched with select()
+/// @return -1 if handoff_listen() hasn't been called
+int handoff_get_fd(void);
+
+
+
+
+/// @brief Check and clear pending request for hand-over
+///
+/// @return true if HANDOFF_SIGNAL has been received
+bool handoff_requested(void);
+
+
+
+
+/// @brief Start new process and hand the network sockets over to it
+///
+/// The function blocks until the new process is ready, or until
+/// HANDOFF_READY_TIMEOUT_MS. On success the caller must exit without
+/// touching the sockets again (and without removing socket file of
+/// Unix-domain socket).
+///
+/// @param[in] argv command line of the new process
+/// @param[in] socket_fd bound network socket
+/// @param[in] unix_socket_fd bound Unix-domain socket, or -1
+///
+/// @return 0 if the new process has taken over
+/// @return -1 on failure (the new process has been terminated)
+int handoff_spawn(char * const argv[], int socket_fd, int unix_socket_fd);
+
+
+
+
+/// @brief Receive network sockets in process started by handoff_spawn()
+///
+/// Does nothing if HANDOFF_ENV_FD is not set. Call this before fork().
+/// Unix-domain socket is received only if it has been configured in
+/// @p cwdaemon (unix_socket_path).
+///
+/// @param cwdaemon cwdaemon instance
+///
+/// @return 1 if a socket has been received
+/// @return 0 if the process hasn't been started by handoff_spawn()
+/// @return -1 on failure
+int handoff_receive(cwdaemon_t * cwdaemon);
+
+
+
+
+/// @brief Complete hand-over in process started by handoff_spawn()
+///
+/// Notify old process about readiness, and wait until it exits. Does
+/// nothing if the socket hasn't been received with handoff_receive().
+///
+/// @return 0 on success
+/// @return -1 if the old process has given up the hand-over
+int handoff_complete(void);
+
+
+
+
+#endif /* #ifndef CWDAEMON_HANDOFF_H */
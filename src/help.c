@@ -27,10 +27,10 @@
 
 #include <stdio.h>
 
-#include <libcw.h>
-
 #include "cwdaemon.h"
+#include "engine.h"
 #include "help.h"
+#include "rt.h"
 
 
 
@@ -64,6 +64,15 @@ void cwdaemon_args_help(void)
 #endif
 	printf("        You can also specify a full path to the device in /dev/ dir.\n");
 	printf("        Use \"null\" for dummy device (no rig keying, no ssb keying, etc.).\n");
+	printf("        Use \"record:<path>\" for device that records changes of keying,\n");
+	printf("        PTT, ssb way and band switch into memory-mapped file <path>.\n");
+	printf("        Use \"winkeyer:<tty>\" (e.g. winkeyer:ttyUSB0) for K1EL WinKeyer that\n");
+	printf("        does timing of keyed text by itself.\n");
+	printf("        Join names of devices with '+' (e.g. ttyUSB0+record:<path>) to key\n");
+	printf("        several devices at once.\n");
+#if HAVE_LINUX_GPIO_H
+	printf("        Use \"gpiochipN\" for lines of GPIO chip (GPIO character device).\n");
+#endif
 
 	printf("-o, --options <option>\n");
 	printf("        Specify <option> to configure device selected by -d / --cwdevice option.\n");
@@ -73,6 +82,16 @@ void cwdaemon_args_help(void)
 	printf("        Driver for serial line devices understands the following options:\n");
 	printf("        key=DTR|RTS|none (without spaces, default is DTR)\n");
 	printf("        ptt=RTS|DTR|none (without spaces, default is RTS)\n");
+	printf("        footswitch=CTS|DSR|DCD|RI|none (without spaces, default is none)\n");
+	printf("        dot=CTS|DSR|DCD|RI|none (without spaces, default is none)\n");
+	printf("        dash=CTS|DSR|DCD|RI|none (without spaces, default is none)\n");
+	printf("        latency=auto|none|<microseconds> (without spaces, default is none):\n");
+	printf("        latency of changing a line, compensated in PTT delay; \"auto\" measures it\n");
+#if HAVE_LINUX_GPIO_H
+	printf("        Driver for GPIO chips understands the following options:\n");
+	printf("        key|ptt|footswitch|dot|dash=<line offset>|none (default is none)\n");
+	printf("        active=high|low (active level of key and ptt lines, default is high)\n");
+#endif
 
 	printf("-n, --nofork\n");
 	printf("        Do not fork. Print messages to stdout.\n");
@@ -87,6 +106,14 @@ void cwdaemon_args_help(void)
 	printf("        Set program's priority (-20 - 20, default: 0).\n");
 #endif
 
+	printf("--rt-priority <priority>\n");
+	printf("        Use real-time profile: run keying threads with SCHED_FIFO policy\n");
+	printf("        and given priority (%d - %d), lock memory, set timer slack\n", CWDAEMON_RT_PRIORITY_MIN, CWDAEMON_RT_PRIORITY_MAX);
+	printf("        to 1 ns. Requires CAP_SYS_NICE and CAP_IPC_LOCK (or suitable\n");
+	printf("        rtprio and memlock limits).\n");
+	printf("--rt-cpus <cpus>\n");
+	printf("        Pin keying threads to given CPUs, e.g. \"2\" or \"0,2-3\".\n");
+
 	printf("-s, --wpm <speed>\n");
 	printf("        Set Morse speed [wpm].\n");
 	printf("        Valid values are in range <%d - %d>, inclusive.\n", CW_SPEED_MIN, CW_SPEED_MAX);
@@ -148,6 +175,64 @@ void cwdaemon_args_help(void)
 	printf("        future use. For now it will be rejected as invalid.\n");
 	printf("        Passing path to disc file as value of <output> works in both\n");
 	printf("        situations: when forking and when not forking.\n");
+
+	printf("--tracefile <path>\n");
+	printf("        Record binary trace of keying, PTT and network events to <path>\n");
+	printf("        (e.g. /dev/shm/cwdaemon.trace). Use tools/trace_dump to decode it.\n");
+	printf("--keyer <engine>\n");
+	printf("        Select keying engine that times marks and spaces on cwdevice.\n");
+#if HAVE_LIBCW
+	printf("        Available engines: libcw, native, winkeyer.\n");
+#else
+	printf("        Available engines: native, winkeyer.\n");
+#endif
+	printf("        \"native\" engine plays sidetone only with --sidetone option.\n");
+	printf("        \"winkeyer\" engine is used (and selected automatically) with\n");
+	printf("        WinKeyer cwdevice.\n");
+	printf("        Default engine: %s.\n", engine_get_default()->name);
+	printf("--paddles <mode>\n");
+	printf("        Key with paddles connected to cwdevice. <mode> is one of:\n");
+	printf("        iambic-a, iambic-b, straight, none. Default: none.\n");
+	printf("        Paddles are connected to lines selected with \"-o dot=\" and\n");
+	printf("        \"-o dash=\" (serial port), or to pins 13 (dot) and 12 (dash)\n");
+	printf("        of parallel port.\n");
+	printf("--idle-suspend <seconds>\n");
+	printf("        Close keying engine (and its sound device) after <seconds> of\n");
+	printf("        inactivity. The engine is opened again when next request\n");
+	printf("        arrives. Not used together with paddles. Default: 0 (never).\n");
+	printf("--sidetone <sink>\n");
+	printf("        Play sidetone of \"native\" keying engine on <sink>: \"alsa\",\n");
+	printf("        \"alsa:<device>\", or \"pcm:<path>\" (raw mono S16_LE PCM at\n");
+	printf("        48000 Hz written to named pipe or file). Used with \"soundcard\"\n");
+	printf("        and \"alsa\" sound systems.\n");
+	printf("--ready-fd <fd>\n");
+	printf("        When ready to handle requests, write \"READY=1\" to file\n");
+	printf("        descriptor <fd> inherited from parent process, and close it.\n");
+	printf("        The descriptor is closed without writing if cwdaemon exits\n");
+	printf("        before it's ready. Readiness is also sent to socket given\n");
+	printf("        in NOTIFY_SOCKET env variable (systemd's \"Type=notify\").\n");
+	printf("        UDP socket passed by systemd's socket activation (LISTEN_FDS)\n");
+	printf("        is used instead of binding a socket to port given with -p.\n");
+	printf("        On SIGUSR2 signal, cwdaemon hands its socket over to a new\n");
+	printf("        instance of the program started with the same options.\n");
+	printf("--lazy-start\n");
+	printf("        Don't open keying engine (sound device) at start, open it\n");
+	printf("        when first request is received. Ignored with --paddles.\n");
+	printf("\n");
+	printf("--channel <port>:<cwdevice>\n");
+	printf("        Add independent keying channel listening on <port> and keying\n");
+	printf("        <cwdevice> (e.g. second radio in SO2R). Can be given several\n");
+	printf("        times, up to %d channels in total. Extra channels use native\n", CWDAEMON_CHANNELS_MAX);
+	printf("        keyer without own sidetone.\n");
+	printf("\n");
+	printf("--unix-socket <path>\n");
+	printf("        Also receive requests through Unix-domain datagram socket\n");
+	printf("        created at absolute <path>, with read/write permissions for\n");
+	printf("        owner and group only. Replies go back to socket of client.\n");
+	printf("--udp-rcvbuf <bytes>\n");
+	printf("--unix-rcvbuf <bytes>\n");
+	printf("        Size of receive buffer of UDP socket or Unix-domain socket,\n");
+	printf("        %d - %d bytes. Default: 0 (system's default).\n", CWDAEMON_RCVBUF_MIN, CWDAEMON_RCVBUF_MAX);
 	printf("\n");
 
 	return;
@@ -0,0 +1,198 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Iambic keyer state machine.
+
+
+
+
+#include <string.h>
+
+#include "iambic.h"
+
+
+
+
+/// Duration of dot at 1 WPM (PARIS timing) [microseconds].
+#define IAMBIC_DOT_US_AT_1_WPM 1200000
+
+
+
+
+static iambic_element_t iambic_opposite(iambic_element_t element);
+static unsigned int iambic_paddle_of(iambic_element_t element);
+
+
+
+
+void iambic_init(iambic_t * keyer, iambic_mode_t mode)
+{
+	memset(keyer, 0, sizeof (iambic_t));
+	keyer->mode = mode;
+}
+
+
+
+
+void iambic_paddles(iambic_t * keyer, unsigned int paddles)
+{
+	unsigned int const pressed = paddles & ~keyer->paddles;
+	keyer->paddles = paddles;
+
+	if (IAMBIC_ELEMENT_NONE == keyer->element) {
+		return;
+	}
+
+	// Remember new presses of paddles. A paddle held since start of the
+	// element was already taken into account when the element was chosen.
+	keyer->memory |= pressed & ~keyer->held_at_start;
+
+	if (IAMBIC_MODE_B == keyer->mode
+	    && (IAMBIC_PADDLE_DOT | IAMBIC_PADDLE_DASH) == (paddles & (IAMBIC_PADDLE_DOT | IAMBIC_PADDLE_DASH))) {
+		// Squeeze during element: opposite element will be sent even if
+		// the squeeze is released before end of the element.
+		keyer->memory |= iambic_paddle_of(iambic_opposite(keyer->element));
+	}
+}
+
+
+
+
+iambic_element_t iambic_next(iambic_t * keyer)
+{
+	iambic_element_t next = IAMBIC_ELEMENT_NONE;
+	unsigned int const wanted = keyer->paddles | keyer->memory;
+
+	if (IAMBIC_ELEMENT_NONE == keyer->element) {
+		// Starting from idle. If both paddles are pressed, dot goes
+		// first.
+		if (wanted & IAMBIC_PADDLE_DOT) {
+			next = IAMBIC_ELEMENT_DOT;
+		} else if (wanted & IAMBIC_PADDLE_DASH) {
+			next = IAMBIC_ELEMENT_DASH;
+		}
+	} else {
+		iambic_element_t const opposite = iambic_opposite(keyer->element);
+		if (wanted & iambic_paddle_of(opposite)) {
+			next = opposite;
+		} else if (keyer->paddles & iambic_paddle_of(keyer->element)) {
+			next = keyer->element;
+		}
+	}
+
+	keyer->element = next;
+	keyer->held_at_start = keyer->paddles;
+	keyer->memory = 0;
+	if (IAMBIC_MODE_B == keyer->mode
+	    && IAMBIC_ELEMENT_NONE != next
+	    && (IAMBIC_PADDLE_DOT | IAMBIC_PADDLE_DASH) == (keyer->paddles & (IAMBIC_PADDLE_DOT | IAMBIC_PADDLE_DASH))) {
+		// Element starts during a squeeze.
+		keyer->memory = iambic_paddle_of(iambic_opposite(next));
+	}
+
+	return next;
+}
+
+
+
+
+int32_t iambic_element_duration_us(iambic_element_t element, int wpm)
+{
+	if (wpm <= 0) {
+		wpm = 1;
+	}
+	int32_t const dot_us = IAMBIC_DOT_US_AT_1_WPM / wpm;
+	switch (element) {
+	case IAMBIC_ELEMENT_DOT:
+		return dot_us;
+	case IAMBIC_ELEMENT_DASH:
+		return 3 * dot_us;
+	case IAMBIC_ELEMENT_NONE:
+	default:
+		return 0;
+	}
+}
+
+
+
+
+bool iambic_straight_key(unsigned int paddles)
+{
+	return 0 != (paddles & (IAMBIC_PADDLE_DOT | IAMBIC_PADDLE_DASH));
+}
+
+
+
+
+bool iambic_mode_from_name(char const * name, iambic_mode_t * mode)
+{
+	if (0 == strcmp(name, "iambic-a")) {
+		*mode = IAMBIC_MODE_A;
+	} else if (0 == strcmp(name, "iambic-b")) {
+		*mode = IAMBIC_MODE_B;
+	} else if (0 == strcmp(name, "straight")) {
+		*mode = IAMBIC_MODE_STRAIGHT;
+	} else if (0 == strcmp(name, "none")) {
+		*mode = IAMBIC_MODE_NONE;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+
+
+
+static iambic_element_t iambic_opposite(iambic_element_t element)
+{
+	switch (element) {
+	case IAMBIC_ELEMENT_DOT:
+		return IAMBIC_ELEMENT_DASH;
+	case IAMBIC_ELEMENT_DASH:
+		return IAMBIC_ELEMENT_DOT;
+	case IAMBIC_ELEMENT_NONE:
+	default:
+		return IAMBIC_ELEMENT_NONE;
+	}
+}
+
+
+
+
+static unsigned int iambic_paddle_of(iambic_element_t element)
+{
+	switch (element) {
+	case IAMBIC_ELEMENT_DOT:
+		return IAMBIC_PADDLE_DOT;
+	case IAMBIC_ELEMENT_DASH:
+		return IAMBIC_PADDLE_DASH;
+	case IAMBIC_ELEMENT_NONE:
+	default:
+		return 0;
+	}
+}
+
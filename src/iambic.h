@@ -0,0 +1,151 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_IAMBIC_H
+#define CWDAEMON_IAMBIC_H
+
+
+
+
+/// @file
+///
+/// Iambic keyer: converts states of dot and dash paddles into a sequence
+/// of Morse elements.
+///
+/// The keyer is a state machine without its own timing or I/O. Its owner
+/// reports each change of paddles with iambic_paddles(), and asks for next
+/// element with iambic_next() when the keyer is idle and a paddle is
+/// pressed, or when current element and the space after it have ended.
+///
+/// While an element is being sent, a new press of the opposite paddle is
+/// remembered, and the opposite element is sent next even if the paddle
+/// has been released in the meantime (dot/dash memory). A squeeze (both
+/// paddles pressed) sends alternating elements. The two modes differ in
+/// what happens when a squeeze is released during an element:
+///  - mode A: the keyer finishes current element and stops,
+///  - mode B: the keyer finishes current element and sends one more,
+///    opposite element.
+
+
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+
+#define IAMBIC_PADDLE_DOT   0x01u
+#define IAMBIC_PADDLE_DASH  0x02u
+
+
+
+
+typedef enum {
+	IAMBIC_MODE_NONE = 0,   ///< Paddles are not used.
+	IAMBIC_MODE_A,
+	IAMBIC_MODE_B,
+	IAMBIC_MODE_STRAIGHT,   ///< Dot contact (or either contact) is a straight key.
+} iambic_mode_t;
+
+
+
+
+typedef enum {
+	IAMBIC_ELEMENT_NONE = 0,
+	IAMBIC_ELEMENT_DOT,
+	IAMBIC_ELEMENT_DASH,
+} iambic_element_t;
+
+
+
+
+typedef struct {
+	iambic_mode_t mode;
+	unsigned int paddles;        ///< Current state of paddles (IAMBIC_PADDLE_*).
+	unsigned int held_at_start;  ///< Paddles that were pressed when current element started.
+	unsigned int memory;         ///< Paddles remembered during current element.
+	iambic_element_t element;    ///< Element being sent, IAMBIC_ELEMENT_NONE when idle.
+} iambic_t;
+
+
+
+
+/// @brief Initialize keyer in idle state
+void iambic_init(iambic_t * keyer, iambic_mode_t mode);
+
+
+
+
+/// @brief Report new state of paddles
+///
+/// @param keyer keyer to update
+/// @param[in] paddles Pressed paddles (IAMBIC_PADDLE_*)
+void iambic_paddles(iambic_t * keyer, unsigned int paddles);
+
+
+
+
+/// @brief Get next element to send
+///
+/// Call the function when the keyer is idle (to start sending after a
+/// paddle has been pressed), or when current element and the space after
+/// it have ended.
+///
+/// @return element to be sent now
+/// @return IAMBIC_ELEMENT_NONE if the keyer becomes idle
+iambic_element_t iambic_next(iambic_t * keyer);
+
+
+
+
+/// @brief Get duration of an element, without the space after it
+///
+/// @param[in] element Dot or dash
+/// @param[in] wpm Speed of keying
+///
+/// @return duration in microseconds
+int32_t iambic_element_duration_us(iambic_element_t element, int wpm);
+
+
+
+
+/// @brief Get state of straight key for given state of paddles
+bool iambic_straight_key(unsigned int paddles);
+
+
+
+
+/// @brief Get mode of keyer from its name
+///
+/// @param[in] name "iambic-a", "iambic-b", "straight" or "none"
+/// @param[out] mode mode of keyer
+///
+/// @return true if @p name is a valid name of mode
+/// @return false otherwise
+bool iambic_mode_from_name(char const * name, iambic_mode_t * mode);
+
+
+
+
+#endif /* #ifndef CWDAEMON_IAMBIC_H */
+
@@ -0,0 +1,499 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Thread monitoring input lines (footswitch, paddles) of cwdevice.
+///
+/// A thread blocked in cwdevice::wait_input() is woken up by stopping code
+/// with a signal (SIGRTMIN) that has an empty handler installed without
+/// SA_RESTART, so the blocking call returns with EINTR. The blocking call
+/// may be an ioctl() (TIOCMIWAIT), so a pipe can't be used to wake up the
+/// thread. The signal must not be used by other parts of cwdaemon: the
+/// handler installed here would replace their handlers (SIGUSR2 is used
+/// for hand-over, see handoff.h).
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "log.h"
+#include "sleep.h"
+#include "trace.h"
+#include "vclock.h"
+
+
+
+
+#define INPUT_WAKE_SIGNAL SIGRTMIN
+
+
+
+
+/// State of keyer, used only by input thread.
+typedef struct {
+	iambic_t iambic;
+	unsigned int paddles;         ///< Debounced state of paddles.
+	int64_t locked_until_ns[2];   ///< End of debounce time of dot and dash contacts.
+	bool straight;                ///< State of straight key.
+	int64_t element_end_ns;       ///< End of current element and space after it.
+} input_keyer_t;
+
+
+
+
+static pthread_t g_input_thread;
+static bool g_input_running = false;
+static bool g_input_stopping = false;
+static bool g_input_exited = false;
+static int g_input_pipe[2] = { -1, -1 };
+
+static struct {
+	engine_t const * engine;
+	iambic_mode_t mode;
+	int (*get_wpm)(void);
+	int (*get_tone)(void);
+} g_input_keyer_config;
+
+/// Time of paddle press that has started keying from idle, zero if there
+/// is no such press waiting for its key-down edge.
+static int64_t g_input_pending_ns = 0;
+static input_stats_t g_input_stats;
+
+
+
+
+static void * input_thread_fn(void * arg);
+static bool input_keyer_update(cwdevice * dev, input_keyer_t * keyer, int64_t now);
+static void input_keyer_start_element(input_keyer_t * keyer, int64_t now, int64_t pressed_ns);
+static int64_t input_edge_ns(cwdevice * dev, int64_t now);
+static void input_deliver_footswitch(int state);
+static void input_sleep_until(int64_t deadline_ns);
+static int64_t input_now_ns(void);
+static void input_wake_handler(int signal);
+
+
+
+
+void input_set_keyer(engine_t const * engine, iambic_mode_t mode, int (*get_wpm)(void), int (*get_tone)(void))
+{
+	g_input_keyer_config.engine = engine;
+	g_input_keyer_config.mode = mode;
+	g_input_keyer_config.get_wpm = get_wpm;
+	g_input_keyer_config.get_tone = get_tone;
+}
+
+
+
+
+int input_start(cwdevice * dev)
+{
+	if (g_input_running || NULL == dev) {
+		return 0;
+	}
+	bool const paddles = IAMBIC_MODE_NONE != g_input_keyer_config.mode && NULL != dev->paddles;
+	if (NULL == dev->footswitch && !paddles) {
+		return 0;
+	}
+
+	if (0 != pipe(g_input_pipe)) {
+		log_error("Failed to create pipe for input thread: %s", strerror(errno));
+		return -1;
+	}
+	fcntl(g_input_pipe[0], F_SETFL, O_NONBLOCK);
+
+	struct sigaction action;
+	memset(&action, 0, sizeof (action));
+	action.sa_handler = input_wake_handler;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = 0; // No SA_RESTART: interrupt the wait.
+	sigaction(INPUT_WAKE_SIGNAL, &action, NULL);
+
+	g_input_stopping = false;
+	g_input_exited = false;
+
+	// Signals should be handled by main thread. The thread unblocks only
+	// its wake-up signal. It keeps default scheduling of helper threads.
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int const retv = pthread_create(&g_input_thread, NULL, input_thread_fn, dev);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (0 != retv) {
+		log_error("Failed to start input thread: %s", strerror(retv));
+		close(g_input_pipe[0]);
+		close(g_input_pipe[1]);
+		g_input_pipe[0] = -1;
+		g_input_pipe[1] = -1;
+		return -1;
+	}
+
+	g_input_running = true;
+	log_info("Monitoring input lines of cwdevice [%s] (%s)", dev->desc ? dev->desc : "", dev->wait_input ? "waiting for changes" : "polling");
+
+	return 0;
+}
+
+
+
+
+void input_stop(void)
+{
+	if (!g_input_running) {
+		return;
+	}
+
+	__atomic_store_n(&g_input_stopping, true, __ATOMIC_RELEASE);
+	// The signal may arrive just before the thread enters a blocking
+	// wait, so repeat it until the thread is gone.
+	while (!__atomic_load_n(&g_input_exited, __ATOMIC_ACQUIRE)) {
+		pthread_kill(g_input_thread, INPUT_WAKE_SIGNAL);
+		microsleep_nonintr(INPUT_POLL_INTERVAL_US);
+	}
+	pthread_join(g_input_thread, NULL);
+
+	close(g_input_pipe[0]);
+	close(g_input_pipe[1]);
+	g_input_pipe[0] = -1;
+	g_input_pipe[1] = -1;
+	g_input_running = false;
+
+	input_stats_t stats = { 0 };
+	input_get_stats(&stats);
+	if (stats.count) {
+		log_info("Paddles: %llu key-downs, latency from press to key-down avg/max = %llu/%llu us",
+		         (unsigned long long) stats.count,
+		         (unsigned long long) (stats.latency_ns_total / stats.count / 1000),
+		         (unsigned long long) (stats.latency_ns_max / 1000));
+	}
+
+	return;
+}
+
+
+
+
+bool input_is_running(void)
+{
+	return g_input_running;
+}
+
+
+
+
+int input_get_fd(void)
+{
+	return g_input_pipe[0];
+}
+
+
+
+
+bool input_read(int * footswitch)
+{
+	if (g_input_pipe[0] < 0) {
+		return false;
+	}
+	unsigned char state = 0;
+	if (1 != read(g_input_pipe[0], &state, 1)) {
+		return false;
+	}
+	*footswitch = state;
+	return true;
+}
+
+
+
+
+void input_note_key_edge(int keystate)
+{
+	if (!keystate) {
+		return;
+	}
+	int64_t const pressed = __atomic_exchange_n(&g_input_pending_ns, 0, __ATOMIC_ACQ_REL);
+	if (0 == pressed) {
+		return;
+	}
+	uint64_t const latency = (uint64_t) (input_now_ns() - pressed);
+
+	// Key edges come from single thread of keying engine.
+	__atomic_add_fetch(&g_input_stats.count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&g_input_stats.latency_ns_total, latency, __ATOMIC_RELAXED);
+	if (latency > __atomic_load_n(&g_input_stats.latency_ns_max, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&g_input_stats.latency_ns_max, latency, __ATOMIC_RELAXED);
+	}
+}
+
+
+
+
+void input_get_stats(input_stats_t * stats)
+{
+	stats->count = __atomic_load_n(&g_input_stats.count, __ATOMIC_RELAXED);
+	stats->latency_ns_total = __atomic_load_n(&g_input_stats.latency_ns_total, __ATOMIC_RELAXED);
+	stats->latency_ns_max = __atomic_load_n(&g_input_stats.latency_ns_max, __ATOMIC_RELAXED);
+}
+
+
+
+
+static void * input_thread_fn(void * arg)
+{
+	cwdevice * dev = arg;
+
+	sigset_t wake;
+	sigemptyset(&wake);
+	sigaddset(&wake, INPUT_WAKE_SIGNAL);
+	pthread_sigmask(SIG_UNBLOCK, &wake, NULL);
+	vclock_attach();
+
+	bool const paddles = IAMBIC_MODE_NONE != g_input_keyer_config.mode && NULL != dev->paddles;
+	input_keyer_t keyer;
+	memset(&keyer, 0, sizeof (keyer));
+	iambic_init(&keyer.iambic, g_input_keyer_config.mode);
+
+	bool use_wait = NULL != dev->wait_input;
+	int reported = -1;
+	int64_t footswitch_locked_until = 0;
+	while (!__atomic_load_n(&g_input_stopping, __ATOMIC_ACQUIRE)) {
+		int64_t const now = input_now_ns();
+
+		if (dev->footswitch && now >= footswitch_locked_until) {
+			int const state = dev->footswitch(dev);
+			if (state != reported) {
+				input_deliver_footswitch(state);
+				reported = state;
+				// Contacts bounce for a few milliseconds after the edge.
+				footswitch_locked_until = now + INPUT_DEBOUNCE_MS * 1000000LL;
+			}
+		}
+
+		bool busy = now < footswitch_locked_until;
+		if (paddles && input_keyer_update(dev, &keyer, now)) {
+			busy = true;
+		}
+
+		if (busy) {
+			// Sleep until next poll, or until end of keyer's element.
+			int64_t deadline = now + INPUT_POLL_INTERVAL_US * 1000LL;
+			if (IAMBIC_ELEMENT_NONE != keyer.iambic.element && keyer.element_end_ns < deadline) {
+				deadline = keyer.element_end_ns;
+			}
+			input_sleep_until(deadline);
+		} else if (use_wait) {
+			vclock_wait_begin(0);
+			int const rv = dev->wait_input(dev);
+			int const err = errno;
+			vclock_wait_end();
+			errno = err;
+			if (0 != rv && EINTR != errno) {
+				log_warning("Failed to wait for change of input lines of cwdevice, polling the lines instead: %s", strerror(errno));
+				use_wait = false;
+			}
+		} else {
+			microsleep_nonintr(INPUT_POLL_INTERVAL_US);
+		}
+	}
+
+	if (keyer.straight) {
+		g_input_keyer_config.engine->straight_key(false);
+	}
+
+	__atomic_store_n(&g_input_exited, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+
+
+
+/// @brief Read paddles, and drive keyer or straight key
+///
+/// @return true if keyer is busy or paddles are in debounce time, so the
+/// paddles must be polled
+/// @return false if paddles are idle
+static bool input_keyer_update(cwdevice * dev, input_keyer_t * keyer, int64_t now)
+{
+	unsigned int const raw = (unsigned int) dev->paddles(dev);
+	unsigned int paddles = keyer->paddles;
+	bool locked = false;
+	unsigned int const contacts[2] = { IAMBIC_PADDLE_DOT, IAMBIC_PADDLE_DASH };
+	for (size_t i = 0; i < 2; i++) {
+		if (now < keyer->locked_until_ns[i]) {
+			locked = true;
+			continue;
+		}
+		if ((raw ^ paddles) & contacts[i]) {
+			paddles ^= contacts[i];
+			keyer->locked_until_ns[i] = now + INPUT_PADDLE_DEBOUNCE_US * 1000LL;
+			locked = true;
+		}
+	}
+
+	if (paddles != keyer->paddles) {
+		unsigned int const pressed = paddles & ~keyer->paddles;
+		keyer->paddles = paddles;
+		trace_event(TRACE_EVENT_PADDLE, paddles, 0);
+
+		if (IAMBIC_MODE_STRAIGHT == g_input_keyer_config.mode) {
+			bool const key = iambic_straight_key(paddles);
+			if (key != keyer->straight) {
+				keyer->straight = key;
+				if (key) {
+					__atomic_store_n(&g_input_pending_ns, input_edge_ns(dev, now), __ATOMIC_RELEASE);
+				}
+				g_input_keyer_config.engine->straight_key(key);
+			}
+		} else {
+			iambic_paddles(&keyer->iambic, paddles);
+			if (IAMBIC_ELEMENT_NONE == keyer->iambic.element && pressed) {
+				input_keyer_start_element(keyer, now, input_edge_ns(dev, now));
+			}
+		}
+	}
+
+	if (IAMBIC_ELEMENT_NONE != keyer->iambic.element && now >= keyer->element_end_ns) {
+		input_keyer_start_element(keyer, now, 0);
+	}
+
+	return locked || keyer->straight || IAMBIC_ELEMENT_NONE != keyer->iambic.element;
+}
+
+
+
+
+/// @brief Enqueue next element of iambic keyer in keying engine
+///
+/// @param keyer keyer
+/// @param[in] now current time
+/// @param[in] pressed_ns time of press of paddle if the keyer is starting from idle state, zero otherwise
+static void input_keyer_start_element(input_keyer_t * keyer, int64_t now, int64_t pressed_ns)
+{
+	iambic_element_t const element = iambic_next(&keyer->iambic);
+	if (IAMBIC_ELEMENT_NONE == element) {
+		return;
+	}
+
+	engine_t const * engine = g_input_keyer_config.engine;
+	int const wpm = g_input_keyer_config.get_wpm();
+	int tone = g_input_keyer_config.get_tone();
+	if (tone <= 0) {
+		tone = CW_FREQUENCY_MAX / 2; // Sidetone is muted with volume, but the mark needs non-zero frequency.
+	}
+	int32_t const mark_us = iambic_element_duration_us(element, wpm);
+	int32_t const space_us = iambic_element_duration_us(IAMBIC_ELEMENT_DOT, wpm);
+
+	if (pressed_ns) {
+		// Paddles break in on text being sent.
+		engine->flush_tone_queue();
+		__atomic_store_n(&g_input_pending_ns, pressed_ns, __ATOMIC_RELEASE);
+		keyer->element_end_ns = now;
+	}
+	engine->queue_tone(mark_us, tone);
+	engine->queue_tone(space_us, 0);
+	// Timing is continued from end of previous element, so that late
+	// wake-ups of this thread don't accumulate.
+	keyer->element_end_ns += (int64_t) (mark_us + space_us) * 1000;
+}
+
+
+
+
+/// @brief Get time of change of input lines that is being handled now
+///
+/// Time stamp of edge reported by kernel is more accurate than time of
+/// reading of the lines, but it is stale if the lines have been polled
+/// since the edge.
+static int64_t input_edge_ns(cwdevice * dev, int64_t now)
+{
+	int64_t const event_ns = __atomic_load_n(&dev->input_event_ns, __ATOMIC_ACQUIRE);
+	if (event_ns > 0 && event_ns <= now && now - event_ns < INPUT_PADDLE_DEBOUNCE_US * 1000LL) {
+		return event_ns;
+	}
+	return now;
+}
+
+
+
+
+static void input_deliver_footswitch(int state)
+{
+	unsigned char const byte = (unsigned char) state;
+	// Virtual clock is released by main loop when it reads the state.
+	vclock_hold();
+	if (1 != write(g_input_pipe[1], &byte, 1)) {
+		log_warning("Failed to deliver state of footswitch: %s", strerror(errno));
+		vclock_release();
+	}
+}
+
+
+
+
+static void input_sleep_until(int64_t deadline_ns)
+{
+	if (vclock_enabled()) {
+		// Not interrupted by input_stop(), but the sleep is short.
+		vclock_sleep_until_ns((uint64_t) deadline_ns);
+		return;
+	}
+	struct timespec const deadline = {
+		.tv_sec = (time_t) (deadline_ns / 1000000000),
+		.tv_nsec = (long) (deadline_ns % 1000000000),
+	};
+	// EINTR (wake-up by input_stop()) is handled by caller's loop.
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+}
+
+
+
+
+static int64_t input_now_ns(void)
+{
+	struct timespec now = { 0 };
+	vclock_gettime(&now);
+	return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+
+
+static void input_wake_handler(__attribute__((unused)) int signal)
+{
+	return;
+}
+
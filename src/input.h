@@ -0,0 +1,161 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_INPUT_H
+#define CWDAEMON_INPUT_H
+
+
+
+
+/// @file
+///
+/// Thread monitoring input lines (footswitch, paddles) of cwdevice.
+///
+/// The thread waits for changes of input lines with cwdevice::wait_input()
+/// (e.g. TIOCMIWAIT on serial port), or polls the lines every millisecond
+/// if the driver can't wait for changes (e.g. parallel port). A change of
+/// state of a contact is accepted at once, and then further changes of the
+/// contact are ignored for debounce time, during which contacts of a
+/// mechanical switch may bounce.
+///
+/// States of footswitch are delivered to main loop through a pipe: main
+/// loop adds input_get_fd() to its select(), and reads the states with
+/// input_read().
+///
+/// States of paddles are handled by the thread itself: they drive an
+/// iambic keyer (iambic.h) or a straight key, whose marks are sent through
+/// keying engine, so they share keying output and sidetone with text. Key
+/// down from idle breaks in on text being sent (tone queue is flushed).
+/// While the keyer is busy the thread polls the paddles, and sleeps until
+/// exact end of each element.
+
+
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cwdaemon.h"
+#include "engine.h"
+#include "iambic.h"
+
+
+
+
+#define INPUT_POLL_INTERVAL_US  1000 ///< Interval of polling input lines.
+#define INPUT_DEBOUNCE_MS          5 ///< Time after a change of footswitch during which further changes are ignored.
+#define INPUT_PADDLE_DEBOUNCE_US 2000 ///< Time after a change of paddle contact during which further changes are ignored.
+
+
+
+
+/// Statistics of paddle input.
+typedef struct {
+	uint64_t count;             ///< Count of key-down edges started from idle by paddles.
+	uint64_t latency_ns_total;  ///< Total time from paddle press to key-down edge.
+	uint64_t latency_ns_max;    ///< Longest time from paddle press to key-down edge.
+} input_stats_t;
+
+
+
+
+/// @brief Configure keyer driven by paddles
+///
+/// The configuration is used by threads started by following calls of
+/// input_start().
+///
+/// @param[in] engine Keying engine sending marks of the keyer
+/// @param[in] mode Mode of keyer, IAMBIC_MODE_NONE if paddles are not used
+/// @param[in] get_wpm Function returning current speed of keying
+/// @param[in] get_tone Function returning current frequency of sidetone
+void input_set_keyer(engine_t const * engine, iambic_mode_t mode, int (*get_wpm)(void), int (*get_tone)(void));
+
+
+
+
+/// @brief Start monitoring input lines of given cwdevice
+///
+/// If @p dev has no footswitch, and has no paddles or keyer is not
+/// configured, no thread is started.
+///
+/// @param dev cwdevice to monitor
+///
+/// @return 0 on success
+/// @return -1 on failure
+int input_start(cwdevice * dev);
+
+
+
+
+/// @brief Note change of state of key, for measurement of latency of paddles
+///
+/// Call the function from keying callback of keying engine.
+///
+/// @param[in] keystate New state of key
+void input_note_key_edge(int keystate);
+
+
+
+
+/// @brief Get statistics of paddle input
+void input_get_stats(input_stats_t * stats);
+
+
+
+
+/// @brief Stop monitoring input lines
+///
+/// The function must be called before cwdevice monitored by the thread is
+/// closed.
+void input_stop(void);
+
+
+
+
+/// @brief Check if a thread is monitoring input lines
+bool input_is_running(void);
+
+
+
+
+/// @brief Get file descriptor that becomes readable when state of input lines changes
+///
+/// @return file descriptor for select()
+/// @return -1 if input lines are not monitored
+int input_get_fd(void);
+
+
+
+
+/// @brief Read next state of footswitch, without blocking
+///
+/// @param[out] footswitch State of footswitch as returned by cwdevice::footswitch()
+///
+/// @return true if a state has been read
+/// @return false if there are no more states to read
+bool input_read(int * footswitch);
+
+
+
+
+#endif /* #ifndef CWDAEMON_INPUT_H */
+
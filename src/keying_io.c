@@ -0,0 +1,518 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Thread performing I/O operations on pins of cwdevice.
+///
+/// The queue of commands is a bounded multi-producer, single-consumer queue
+/// with per-slot sequence numbers, the same as queue of log messages in
+/// log.c. Producers are keying engine's thread (keying callback, "tone
+/// queue low" callback) and the thread handling requests of a channel
+/// (PTT). Each keying channel has its own instance: queue, I/O thread and
+/// statistics.
+///
+/// Producers never poll: a producer that finds the queue full, and a
+/// thread waiting in keying_io_sync(), block on a condition variable that
+/// the I/O thread signals after executing a command.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+#include "keying_io.h"
+#include "log.h"
+#include "rt.h"
+#include "trace.h"
+#include "vclock.h"
+
+
+
+
+/// A slot at position "pos" is free for producers when its seq == pos, and
+/// is ready for consumer when its seq == pos + 1.
+typedef struct {
+	unsigned int seq;
+	cwdevice * dev;
+	keying_io_pin_t pin;
+	int state;
+	uint64_t posted_ns; ///< CLOCK_MONOTONIC time of posting the command.
+} keying_io_slot_t;
+
+
+
+
+struct keying_io_s {
+	unsigned int index;           ///< Index of keying channel.
+	keying_io_slot_t slots[KEYING_IO_QUEUE_SIZE];
+	unsigned int tail;            ///< Position of next slot to be claimed by producers.
+	unsigned int head;            ///< Position of next slot to be read by consumer. Used only by consumer.
+	unsigned int done;            ///< Count of executed commands, for keying_io_sync().
+	bool async;                   ///< Is the I/O thread accepting commands?
+	unsigned int producers;       ///< Count of threads that may be posting a command or waiting in keying_io_sync().
+	unsigned int waiters;         ///< Count of threads that are about to wait on "done_cond".
+	bool stopping;
+	sem_t sem;
+	pthread_mutex_t done_mutex;
+	pthread_cond_t done_cond;     ///< Signalled by I/O thread after executing a command.
+	pthread_t thread;
+	keying_io_stats_t stats;
+};
+
+
+
+
+static keying_io_t g_keying_io[CWDAEMON_CHANNELS_MAX];
+
+
+
+
+static void keying_io_execute(keying_io_t * io, cwdevice * dev, keying_io_pin_t pin, int state, uint64_t posted_ns);
+static bool keying_io_execute_next(keying_io_t * io);
+static void * keying_io_thread_fn(void * arg);
+static uint64_t keying_io_now_ns(void);
+static void keying_io_update_max(uint64_t * max, uint64_t value);
+static bool keying_io_enter(keying_io_t * io);
+static void keying_io_leave(keying_io_t * io);
+static void keying_io_wait_done(keying_io_t * io, unsigned int pos);
+static void keying_io_wait_slot(keying_io_t * io, unsigned int pos);
+static void keying_io_notify(keying_io_t * io);
+
+
+
+
+keying_io_t * keying_io_instance(unsigned int index)
+{
+	if (index >= CWDAEMON_CHANNELS_MAX) {
+		return NULL;
+	}
+	g_keying_io[index].index = index;
+	return &g_keying_io[index];
+}
+
+
+
+
+int keying_io_start(keying_io_t * io)
+{
+	if (__atomic_load_n(&io->async, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+
+	for (unsigned int i = 0; i < KEYING_IO_QUEUE_SIZE; i++) {
+		io->slots[i].seq = i;
+	}
+	io->tail = 0;
+	io->head = 0;
+	io->done = 0;
+	io->waiters = 0;
+	io->stopping = false;
+
+	if (0 != sem_init(&io->sem, 0, 0)) {
+		log_error("Failed to initialize semaphore of keying I/O thread: %s", strerror(errno));
+		return -1;
+	}
+	pthread_mutex_init(&io->done_mutex, NULL);
+	pthread_cond_init(&io->done_cond, NULL);
+
+	// Signals should be handled by main thread. The thread applies
+	// real-time profile by itself (rt_thread_apply()).
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int const retv = pthread_create(&io->thread, NULL, keying_io_thread_fn, io);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (0 != retv) {
+		pthread_cond_destroy(&io->done_cond);
+		pthread_mutex_destroy(&io->done_mutex);
+		sem_destroy(&io->sem);
+		log_error("Failed to start keying I/O thread of channel %u: %s", io->index, strerror(retv));
+		return -1;
+	}
+
+	__atomic_store_n(&io->async, true, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+
+
+
+void keying_io_stop(keying_io_t * io)
+{
+	if (!__atomic_exchange_n(&io->async, false, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	// Producers that have seen the flag set may still be putting commands
+	// into the queue, or waiting for the I/O thread, which is still
+	// running. New producers execute their commands themselves.
+	while (0 != __atomic_load_n(&io->producers, __ATOMIC_SEQ_CST)) {
+		sched_yield();
+	}
+
+	__atomic_store_n(&io->stopping, true, __ATOMIC_RELEASE);
+	sem_post(&io->sem);
+	pthread_join(io->thread, NULL);
+
+	// Commands posted after last wake-up of the thread.
+	while (keying_io_execute_next(io)) {
+		;
+	}
+	pthread_cond_destroy(&io->done_cond);
+	pthread_mutex_destroy(&io->done_mutex);
+	sem_destroy(&io->sem);
+
+	keying_io_stats_t stats = { 0 };
+	keying_io_get_stats(io, &stats);
+	log_info("Keying I/O of channel %u: %llu operations, I/O time avg/max = %llu/%llu us, max queue delay = %llu us, %llu stalls",
+	         io->index,
+	         (unsigned long long) stats.count,
+	         (unsigned long long) (stats.count ? stats.io_ns_total / stats.count / 1000 : 0),
+	         (unsigned long long) (stats.io_ns_max / 1000),
+	         (unsigned long long) (stats.delay_ns_max / 1000),
+	         (unsigned long long) stats.stalls);
+
+	return;
+}
+
+
+
+
+void keying_io_stop_all(void)
+{
+	for (unsigned int i = 0; i < CWDAEMON_CHANNELS_MAX; i++) {
+		keying_io_stop(&g_keying_io[i]);
+	}
+	return;
+}
+
+
+
+
+void keying_io_post(keying_io_t * io, cwdevice * dev, keying_io_pin_t pin, int state)
+{
+	uint64_t const posted_ns = keying_io_now_ns();
+
+	if (!keying_io_enter(io)) {
+		keying_io_execute(io, dev, pin, state, posted_ns);
+		return;
+	}
+
+	unsigned int pos = __atomic_load_n(&io->tail, __ATOMIC_RELAXED);
+	keying_io_slot_t * slot = NULL;
+	bool stalled = false;
+	for (;;) {
+		slot = &io->slots[pos & (KEYING_IO_QUEUE_SIZE - 1)];
+		unsigned int const seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		int const diff = (int) (seq - pos);
+		if (0 == diff) {
+			if (__atomic_compare_exchange_n(&io->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+			// On failure "pos" has been updated to current tail.
+		} else if (diff < 0) {
+			// Queue is full. Unlike log messages, keying commands
+			// can't be dropped, so wait for the I/O thread.
+			if (!stalled) {
+				stalled = true;
+				__atomic_add_fetch(&io->stats.stalls, 1, __ATOMIC_RELAXED);
+			}
+			keying_io_wait_slot(io, pos);
+			pos = __atomic_load_n(&io->tail, __ATOMIC_RELAXED);
+		} else {
+			pos = __atomic_load_n(&io->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->dev = dev;
+	slot->pin = pin;
+	slot->state = state;
+	slot->posted_ns = posted_ns;
+	// In virtual clock mode the edge must be made at the time at which it
+	// has been posted. Released by I/O thread after the I/O.
+	vclock_hold();
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	sem_post(&io->sem);
+	keying_io_leave(io);
+
+	return;
+}
+
+
+
+
+void keying_io_sync(keying_io_t * io)
+{
+	if (!keying_io_enter(io)) {
+		return;
+	}
+
+	unsigned int const target = __atomic_load_n(&io->tail, __ATOMIC_ACQUIRE);
+	keying_io_wait_done(io, target);
+	keying_io_leave(io);
+
+	return;
+}
+
+
+
+
+void keying_io_get_stats(keying_io_t * io, keying_io_stats_t * stats)
+{
+	stats->count = __atomic_load_n(&io->stats.count, __ATOMIC_RELAXED);
+	stats->io_ns_total = __atomic_load_n(&io->stats.io_ns_total, __ATOMIC_RELAXED);
+	stats->io_ns_max = __atomic_load_n(&io->stats.io_ns_max, __ATOMIC_RELAXED);
+	stats->delay_ns_max = __atomic_load_n(&io->stats.delay_ns_max, __ATOMIC_RELAXED);
+	stats->stalls = __atomic_load_n(&io->stats.stalls, __ATOMIC_RELAXED);
+
+	return;
+}
+
+
+
+
+/// @brief Perform I/O operation of a command, record its timing
+static void keying_io_execute(keying_io_t * io, cwdevice * dev, keying_io_pin_t pin, int state, uint64_t posted_ns)
+{
+	uint64_t const start_ns = keying_io_now_ns();
+	switch (pin) {
+	case KEYING_IO_PIN_CW:
+		dev->cw(dev, state);
+		break;
+	case KEYING_IO_PIN_PTT:
+		dev->ptt(dev, state);
+		break;
+	case KEYING_IO_PIN_SSBWAY:
+		dev->ssbway(dev, state);
+		break;
+	case KEYING_IO_PIN_BAND:
+		dev->switchband(dev, (unsigned char) state);
+		break;
+	case KEYING_IO_PINS_RESET:
+	default:
+		dev->reset_pins_state(dev);
+		break;
+	}
+	uint64_t const end_ns = keying_io_now_ns();
+
+	uint64_t const delay_ns = start_ns - posted_ns;
+	uint64_t const io_ns = end_ns - start_ns;
+	__atomic_add_fetch(&io->stats.count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&io->stats.io_ns_total, io_ns, __ATOMIC_RELAXED);
+	keying_io_update_max(&io->stats.io_ns_max, io_ns);
+	keying_io_update_max(&io->stats.delay_ns_max, delay_ns);
+
+	if (KEYING_IO_PIN_CW == pin || KEYING_IO_PIN_PTT == pin) {
+		trace_event(KEYING_IO_PIN_CW == pin ? TRACE_EVENT_CW_IO : TRACE_EVENT_PTT_IO,
+		            (uint32_t) (delay_ns / 1000), (uint32_t) (io_ns / 1000));
+	}
+
+	return;
+}
+
+
+
+
+/// @brief Execute next command from the queue
+///
+/// @return true if a command has been executed
+/// @return false if there was no command ready
+static bool keying_io_execute_next(keying_io_t * io)
+{
+	keying_io_slot_t * const slot = &io->slots[io->head & (KEYING_IO_QUEUE_SIZE - 1)];
+	if (io->head + 1 != __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+
+	cwdevice * const dev = slot->dev;
+	keying_io_pin_t const pin = slot->pin;
+	int const state = slot->state;
+	uint64_t const posted_ns = slot->posted_ns;
+
+	// Release the slot before doing (slow) I/O. Sequentially consistent,
+	// see keying_io_notify().
+	__atomic_store_n(&slot->seq, io->head + KEYING_IO_QUEUE_SIZE, __ATOMIC_SEQ_CST);
+	io->head++;
+
+	keying_io_execute(io, dev, pin, state, posted_ns);
+	__atomic_add_fetch(&io->done, 1, __ATOMIC_SEQ_CST);
+	keying_io_notify(io);
+	vclock_release();
+
+	return true;
+}
+
+
+
+
+static void * keying_io_thread_fn(void * arg)
+{
+	keying_io_t * const io = (keying_io_t *) arg;
+	rt_thread_apply("keying I/O");
+	vclock_attach();
+	while (!__atomic_load_n(&io->stopping, __ATOMIC_ACQUIRE)) {
+		vclock_wait_begin(0);
+		int const rv = sem_wait(&io->sem);
+		int const err = errno;
+		vclock_wait_end();
+		if (0 != rv && EINTR == err) {
+			continue;
+		}
+		while (keying_io_execute_next(io)) {
+			;
+		}
+	}
+
+	return NULL;
+}
+
+
+
+
+static uint64_t keying_io_now_ns(void)
+{
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+
+
+
+static void keying_io_update_max(uint64_t * max, uint64_t value)
+{
+	uint64_t current = __atomic_load_n(max, __ATOMIC_RELAXED);
+	while (value > current
+	       && !__atomic_compare_exchange_n(max, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		;
+	}
+	return;
+}
+
+
+
+
+/// @brief Announce a producer, if the I/O thread is accepting commands
+///
+/// Announce the producer before checking the flag, so that
+/// keying_io_stop() can wait for producers that have seen the flag set.
+/// Both operations are sequentially consistent, paired with those in
+/// keying_io_stop().
+///
+/// @return true if the I/O thread accepts commands; call keying_io_leave() when done
+/// @return false otherwise
+static bool keying_io_enter(keying_io_t * io)
+{
+	__atomic_add_fetch(&io->producers, 1, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&io->async, __ATOMIC_SEQ_CST)) {
+		__atomic_sub_fetch(&io->producers, 1, __ATOMIC_SEQ_CST);
+		return false;
+	}
+	return true;
+}
+
+
+
+
+static void keying_io_leave(keying_io_t * io)
+{
+	__atomic_sub_fetch(&io->producers, 1, __ATOMIC_RELEASE);
+	return;
+}
+
+
+
+
+/// @brief Block until command at position @p pos has been executed
+///
+/// The wait is bounded by I/O time of queued commands. The commands hold
+/// the virtual clock, so the wait isn't announced with vclock_wait_begin().
+static void keying_io_wait_done(keying_io_t * io, unsigned int pos)
+{
+	pthread_mutex_lock(&io->done_mutex);
+	__atomic_add_fetch(&io->waiters, 1, __ATOMIC_SEQ_CST);
+	while ((int) (__atomic_load_n(&io->done, __ATOMIC_SEQ_CST) - pos) < 0) {
+		pthread_cond_wait(&io->done_cond, &io->done_mutex);
+	}
+	__atomic_sub_fetch(&io->waiters, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&io->done_mutex);
+
+	return;
+}
+
+
+
+
+/// @brief Block until slot at position @p pos of full queue is released by I/O thread
+static void keying_io_wait_slot(keying_io_t * io, unsigned int pos)
+{
+	keying_io_slot_t * const slot = &io->slots[pos & (KEYING_IO_QUEUE_SIZE - 1)];
+
+	pthread_mutex_lock(&io->done_mutex);
+	__atomic_add_fetch(&io->waiters, 1, __ATOMIC_SEQ_CST);
+	// The slot is released before its command is executed, and the I/O
+	// thread signals after the execution.
+	while ((int) (__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) - pos) < 0) {
+		pthread_cond_wait(&io->done_cond, &io->done_mutex);
+	}
+	__atomic_sub_fetch(&io->waiters, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&io->done_mutex);
+
+	return;
+}
+
+
+
+
+/// @brief Wake up threads waiting for the I/O thread
+///
+/// Called by I/O thread after it has updated "done". The mutex is taken
+/// only if there are waiters: the waiters announce themselves before
+/// checking "done", and all the operations are sequentially consistent, so
+/// either the waiter sees the update or the I/O thread sees the waiter.
+static void keying_io_notify(keying_io_t * io)
+{
+	if (0 == __atomic_load_n(&io->waiters, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+	pthread_mutex_lock(&io->done_mutex);
+	pthread_cond_broadcast(&io->done_cond);
+	pthread_mutex_unlock(&io->done_mutex);
+
+	return;
+}
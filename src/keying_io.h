@@ -0,0 +1,169 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_KEYING_IO_H
+#define CWDAEMON_KEYING_IO_H
+
+
+
+
+/// @file
+///
+/// Thread performing I/O operations on pins of cwdevice.
+///
+/// Changing state of a pin of cwdevice is an ioctl() on serial or parallel
+/// port. With USB-serial adapters a single ioctl() can take a millisecond
+/// or more. Keying callback of keying engine shouldn't wait for such
+/// operations, so it only posts a command to a queue, and the command is
+/// executed by a dedicated I/O thread. Commands for CW and PTT pins go
+/// through the same queue, so they are executed in the order in which they
+/// have been posted. Other changes of pins (SSB way, band switch, reset of
+/// pins) go through the queue too: drivers of cwdevices keep a shadow of
+/// state of pins, and the shadow is then modified only by the I/O thread.
+///
+/// Each keying channel has its own queue and its own I/O thread, so slow
+/// I/O on cwdevice of one channel doesn't delay keying of other channels.
+///
+/// For each command the thread measures delay between posting of the
+/// command and start of its execution, and time taken by the I/O
+/// operation. The measurements are recorded in binary trace (trace.h) and
+/// summarized in statistics.
+///
+/// When the thread is not running, commands are executed synchronously by
+/// the caller.
+
+
+
+
+#include <stdint.h>
+
+#include "cwdaemon.h"
+
+
+
+
+/// Count of slots in queue of commands. Must be a power of two.
+#define KEYING_IO_QUEUE_SIZE 256u
+
+
+
+
+typedef enum {
+	KEYING_IO_PIN_CW     = 0,
+	KEYING_IO_PIN_PTT    = 1,
+	KEYING_IO_PIN_SSBWAY = 2, ///< State is SOUNDCARD or MICROPHONE.
+	KEYING_IO_PIN_BAND   = 3, ///< State is bit pattern of band switch.
+	KEYING_IO_PINS_RESET = 4, ///< Reset of all pins, state is ignored.
+} keying_io_pin_t;
+
+
+
+
+/// Queue of commands and I/O thread of one keying channel.
+typedef struct keying_io_s keying_io_t;
+
+
+
+
+/// Statistics of executed commands.
+typedef struct {
+	uint64_t count;         ///< Count of executed commands.
+	uint64_t io_ns_total;   ///< Total time of I/O operations.
+	uint64_t io_ns_max;     ///< Longest I/O operation.
+	uint64_t delay_ns_max;  ///< Longest delay between posting a command and start of its execution.
+	uint64_t stalls;        ///< Count of commands that had to wait for free slot in the queue.
+} keying_io_stats_t;
+
+
+
+
+/// @brief Get keying I/O instance of given keying channel
+///
+/// @param[in] index Index of keying channel, less than CWDAEMON_CHANNELS_MAX
+///
+/// @return keying I/O instance
+/// @return NULL if @p index is out of range
+keying_io_t * keying_io_instance(unsigned int index);
+
+
+
+
+/// @brief Start the I/O thread of given instance
+///
+/// @return 0 on success
+/// @return -1 on failure
+int keying_io_start(keying_io_t * io);
+
+
+
+
+/// @brief Execute pending commands and stop the I/O thread of given instance
+///
+/// Summary of statistics is logged with "info" priority.
+void keying_io_stop(keying_io_t * io);
+
+
+
+
+/// @brief Stop I/O threads of all instances
+///
+/// Suitable for atexit().
+void keying_io_stop_all(void);
+
+
+
+
+/// @brief Post a command changing state of a pin of cwdevice
+///
+/// The function doesn't wait for the I/O operation, unless the queue is
+/// full.
+///
+/// The cwdevice must implement the operation (e.g. ssbway()) needed by
+/// @p pin.
+///
+/// @param[in] io Keying I/O instance of channel that owns @p dev
+/// @param[in] dev cwdevice
+/// @param[in] pin Pin to change
+/// @param[in] state New state of the pin (ON/OFF, or see keying_io_pin_t)
+void keying_io_post(keying_io_t * io, cwdevice * dev, keying_io_pin_t pin, int state);
+
+
+
+
+/// @brief Wait until all commands posted so far to given instance have been executed
+///
+/// Call this function before closing or reconfiguring a cwdevice, and when
+/// the caller needs the pin to be actually changed (e.g. before waiting
+/// for PTT delay). Commands posted to other instances are not waited for.
+void keying_io_sync(keying_io_t * io);
+
+
+
+
+/// @brief Get statistics of commands executed by given instance
+void keying_io_get_stats(keying_io_t * io, keying_io_stats_t * stats);
+
+
+
+
+#endif /* #ifndef CWDAEMON_KEYING_IO_H */
+
@@ -20,12 +20,20 @@
  * 02110-1301, USA.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "config.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,7 +45,13 @@
 
 
 
-#define LOG_BUF_SIZE (1024 + 1)
+/// Count of slots in queue of messages waiting for background thread. Must
+/// be a power of two.
+#define LOG_QUEUE_SIZE 128u
+
+/// Size of buffer for a single conversion specification rebuilt from format
+/// string, e.g. "%-08.3lld".
+#define LOG_SPEC_SIZE 32
 
 
 
@@ -50,6 +64,78 @@ extern options_t g_current_options;
 
 
 
+/// Length modifier of conversion specification.
+typedef enum {
+	LOG_LENGTH_NONE,
+	LOG_LENGTH_HH,
+	LOG_LENGTH_H,
+	LOG_LENGTH_L,
+	LOG_LENGTH_LL,
+	LOG_LENGTH_Z,
+	LOG_LENGTH_J,
+	LOG_LENGTH_T,
+	LOG_LENGTH_BIG_L,
+} log_length_t;
+
+
+
+
+/// Conversion specification parsed from format string.
+typedef struct {
+	char const * body;    ///< Flags, width and precision, as they appear in format string.
+	size_t body_len;
+	bool star_width;
+	bool star_precision;
+	bool positional;      ///< "%1$d" - not supported by deferred formatting.
+	int precision;        ///< Precision given with digits, or -1.
+	log_length_t length;
+	char conversion;
+} log_spec_t;
+
+
+
+
+/// Slot in queue of messages (bounded multi-producer queue with per-slot
+/// sequence numbers).
+///
+/// A slot at position "pos" is free for producers when its seq == pos, and
+/// is ready for consumer when its seq == pos + 1.
+typedef struct {
+	unsigned int seq;
+	log_record_t record;
+} log_slot_t;
+
+
+
+
+static log_slot_t g_log_slots[LOG_QUEUE_SIZE];
+static unsigned int g_log_tail = 0;        ///< Position of next slot to be claimed by producers.
+static unsigned int g_log_head = 0;        ///< Position of next slot to be read by consumer. Used only by consumer.
+static unsigned long g_log_dropped = 0;    ///< Count of messages dropped because the queue was full.
+static bool g_log_async = false;           ///< Is background thread accepting messages?
+static unsigned int g_log_producers = 0;   ///< Count of producers that may be putting a message into the queue.
+static bool g_log_stopping = false;
+static sem_t g_log_sem;
+static pthread_t g_log_thread;
+
+
+
+
+static char const * log_parse_spec(char const * p, log_spec_t * spec);
+static bool log_args_put(log_record_t * record, void const * data, size_t size);
+static void log_args_get(log_record_t const * record, size_t * offset, void * data, size_t size);
+static bool log_record_capture_args(log_record_t * record, char const * format, va_list * ap);
+static long long log_arg_signed(va_list * ap, log_length_t length);
+static unsigned long long log_arg_unsigned(va_list * ap, log_length_t length);
+static bool log_enqueue(int priority, bool file_only, char const * format, va_list ap);
+static bool log_write_next(void);
+static void log_drain(void);
+static void * log_thread_fn(void * arg);
+static void log_write(int priority, bool file_only, char const * text);
+
+
+
+
 /**
    @brief Get string label corresponding to given log priority
 
@@ -111,33 +197,60 @@ void cwdaemon_errmsg(const char *format, ...)
 
 
 
-// @reviewed_on{2024.07.28}
-void log_message(int priority, char const * format, ...)
+bool log_is_enabled(int priority)
+{
+	// LOG_EMERG == 0, ... LOG_DEBUG == 7.
+	return priority <= __atomic_load_n(&g_current_options.log_threshold, __ATOMIC_RELAXED);
+}
+
+
+
+
+void log_set_threshold(int threshold)
+{
+	__atomic_store_n(&g_current_options.log_threshold, threshold, __ATOMIC_RELAXED);
+}
+
+
+
+
+/// @brief Write formatted message to current log output
+///
+/// @param[in] priority syslog priority level enum
+/// @param[in] file_only Don't write the message to syslog
+/// @param[in] text Formatted message
+static void log_write(int priority, bool file_only, char const * text)
 {
 	// If output file (either disc file or stdout/stderr) is not specified,
 	// then the only remaining option is logging to syslog.
-	bool const to_syslog = NULL == cwdaemon_debug_f;
-
-	// LOG_EMERG == 0, ... LOG_DEBUG == 7.
-	if (priority > g_current_options.log_threshold) {
+	if (NULL == cwdaemon_debug_f) {
+		if (!file_only) {
+			// TODO (acerion) 2024.05.10: double-check if "\n" is allowed for
+			// syslog messages.
+			syslog(priority, "%s\n", text);
+		}
 		return;
 	}
 
+	char const * prio_str = log_get_priority_label(priority);
+	fprintf(cwdaemon_debug_f, "[%s] %s: %s\n", prio_str, PACKAGE, text);
+
+	return;
+}
+
+
+
+
+void log_message_internal(int priority, char const * format, ...)
+{
 	va_list ap;
-	char buf[LOG_BUF_SIZE] = { 0 };
 	va_start(ap, format);
-	vsnprintf(buf, sizeof (buf), format, ap);
-	va_end(ap);
-
-	if (to_syslog) {
-		// TODO (acerion) 2024.05.10: double-check if "\n" is allowed for
-		// syslog messages.
-		syslog(priority, "%s\n", buf);
-	} else {
-		// If not to syslog then the other option is to log to file.
-		char const * prio_str = log_get_priority_label(priority);
-		fprintf(cwdaemon_debug_f, "[%s] %s: %s\n", prio_str, PACKAGE, buf);
+	if (!log_enqueue(priority, false, format, ap)) {
+		char buf[LOG_BUF_SIZE] = { 0 };
+		vsnprintf(buf, sizeof (buf), format, ap);
+		log_write(priority, false, buf);
 	}
+	va_end(ap);
 
 	return;
 }
@@ -148,10 +261,9 @@ void log_message(int priority, char const * format, ...)
 /**
    \brief Print debug string to debug file
 
-   Function decides if given \p verbosity level is sufficient to print
-   given \p format debug string, and prints it to predefined file. If
-   current global verbosity level is "None", no information will be
-   printed.
+   Function prints given \p format debug string to predefined file. The
+   check of \p verbosity against current log threshold is done by
+   cwdaemon_debug() macro.
 
    Currently \p verbosity can have one of values defined in enum
    cwdaemon_verbosity.
@@ -160,32 +272,637 @@ void log_message(int priority, char const * format, ...)
    argument (\p format), and a set of optional arguments to be
    inserted into the formatting string.
 
-   @reviewed_on{2024.05.10}
-
    \param verbosity - verbosity level of given debug string
    \param format - formatting string of a debug string being printed
 */
-void cwdaemon_debug(int verbosity, __attribute__((unused)) const char *func, __attribute__((unused)) int line, const char *format, ...)
+void cwdaemon_debug_internal(int verbosity, __attribute__((unused)) const char *func, __attribute__((unused)) int line, const char *format, ...)
 {
 	if (!cwdaemon_debug_f) {
 		return;
 	}
 
-	/* LOG_EMERG == 0, ... LOG_DEBUG == 7. */
-	if (verbosity > g_current_options.log_threshold) {
-		return;
-	}
-
 	va_list ap;
-	char s[LOG_BUF_SIZE];
 	va_start(ap, format);
-	vsnprintf(s, sizeof (s), format, ap);
+	if (!log_enqueue(verbosity, true, format, ap)) {
+		char s[LOG_BUF_SIZE] = { 0 };
+		vsnprintf(s, sizeof (s), format, ap);
+		log_write(verbosity, true, s);
+		// fprintf(cwdaemon_debug_f, "cwdaemon:        %s(): %d\n", func, line);
+		fflush(cwdaemon_debug_f);
+	}
 	va_end(ap);
 
-	fprintf(cwdaemon_debug_f, "[%s] %s: %s\n", log_get_priority_label(verbosity), PACKAGE, s);
-	// fprintf(cwdaemon_debug_f, "cwdaemon:        %s(): %d\n", func, line);
-	fflush(cwdaemon_debug_f);
+	return;
+}
+
+
+
+
+/// @brief Parse conversion specification
+///
+/// @param[in] p Pointer to first character after '%'
+/// @param[out] spec Parsed specification
+///
+/// @return pointer to first character after the specification
+static char const * log_parse_spec(char const * p, log_spec_t * spec)
+{
+	memset(spec, 0, sizeof (log_spec_t));
+	spec->precision = -1;
+	spec->body = p;
+
+	while ('\0' != *p && NULL != strchr("-+ #0'", *p)) {
+		p++;
+	}
+	if ('*' == *p) {
+		spec->star_width = true;
+		p++;
+	} else {
+		while ('0' <= *p && *p <= '9') {
+			p++;
+		}
+	}
+	if ('$' == *p) {
+		spec->positional = true;
+		return p;
+	}
+	if ('.' == *p) {
+		p++;
+		if ('*' == *p) {
+			spec->star_precision = true;
+			p++;
+		} else {
+			spec->precision = 0;
+			while ('0' <= *p && *p <= '9') {
+				if (spec->precision < LOG_BUF_SIZE) {
+					spec->precision = spec->precision * 10 + (*p - '0');
+				}
+				p++;
+			}
+		}
+	}
+	spec->body_len = (size_t) (p - spec->body);
+
+	switch (*p) {
+	case 'h':
+		p++;
+		spec->length = LOG_LENGTH_H;
+		if ('h' == *p) {
+			p++;
+			spec->length = LOG_LENGTH_HH;
+		}
+		break;
+	case 'l':
+		p++;
+		spec->length = LOG_LENGTH_L;
+		if ('l' == *p) {
+			p++;
+			spec->length = LOG_LENGTH_LL;
+		}
+		break;
+	case 'q':
+		p++;
+		spec->length = LOG_LENGTH_LL;
+		break;
+	case 'z':
+		p++;
+		spec->length = LOG_LENGTH_Z;
+		break;
+	case 'j':
+		p++;
+		spec->length = LOG_LENGTH_J;
+		break;
+	case 't':
+		p++;
+		spec->length = LOG_LENGTH_T;
+		break;
+	case 'L':
+		p++;
+		spec->length = LOG_LENGTH_BIG_L;
+		break;
+	default:
+		break;
+	}
+
+	spec->conversion = *p;
+	if ('\0' != *p) {
+		p++;
+	}
+
+	return p;
+}
+
+
+
+
+static bool log_args_put(log_record_t * record, void const * data, size_t size)
+{
+	if (record->args_size + size > sizeof (record->args)) {
+		return false;
+	}
+	memcpy(record->args + record->args_size, data, size);
+	record->args_size += size;
+	return true;
+}
+
+
+
+
+static void log_args_get(log_record_t const * record, size_t * offset, void * data, size_t size)
+{
+	memcpy(data, record->args + *offset, size);
+	*offset += size;
+	return;
+}
+
+
+
+
+static long long log_arg_signed(va_list * ap, log_length_t length)
+{
+	switch (length) {
+	case LOG_LENGTH_HH:
+		return (signed char) va_arg(*ap, int);
+	case LOG_LENGTH_H:
+		return (short) va_arg(*ap, int);
+	case LOG_LENGTH_L:
+		return va_arg(*ap, long);
+	case LOG_LENGTH_LL:
+		return va_arg(*ap, long long);
+	case LOG_LENGTH_Z:
+		return (ptrdiff_t) va_arg(*ap, size_t);
+	case LOG_LENGTH_J:
+		return va_arg(*ap, intmax_t);
+	case LOG_LENGTH_T:
+		return va_arg(*ap, ptrdiff_t);
+	case LOG_LENGTH_NONE:
+	case LOG_LENGTH_BIG_L:
+	default:
+		return va_arg(*ap, int);
+	}
+}
+
+
+
+
+static unsigned long long log_arg_unsigned(va_list * ap, log_length_t length)
+{
+	switch (length) {
+	case LOG_LENGTH_HH:
+		return (unsigned char) va_arg(*ap, unsigned int);
+	case LOG_LENGTH_H:
+		return (unsigned short) va_arg(*ap, unsigned int);
+	case LOG_LENGTH_L:
+		return va_arg(*ap, unsigned long);
+	case LOG_LENGTH_LL:
+		return va_arg(*ap, unsigned long long);
+	case LOG_LENGTH_Z:
+		return va_arg(*ap, size_t);
+	case LOG_LENGTH_J:
+		return va_arg(*ap, uintmax_t);
+	case LOG_LENGTH_T:
+		return (size_t) va_arg(*ap, ptrdiff_t);
+	case LOG_LENGTH_NONE:
+	case LOG_LENGTH_BIG_L:
+	default:
+		return va_arg(*ap, unsigned int);
+	}
+}
+
+
+
+
+/// @brief Copy values of arguments into record
+///
+/// Integers are stored as 64-bit values, already converted to the type
+/// implied by length modifier. Strings are stored as zero-terminated copies.
+///
+/// @return true on success
+/// @return false if the format can't be deferred, or arguments don't fit into the record
+static bool log_record_capture_args(log_record_t * record, char const * format, va_list * ap)
+{
+	char const * p = format;
+	while ('\0' != *p) {
+		if ('%' != *p) {
+			p++;
+			continue;
+		}
+		if ('%' == p[1]) {
+			p += 2;
+			continue;
+		}
+
+		log_spec_t spec;
+		p = log_parse_spec(p + 1, &spec);
+		if (spec.positional || spec.body_len + 5 > LOG_SPEC_SIZE) {
+			return false;
+		}
+
+		if (spec.star_width) {
+			int const width = va_arg(*ap, int);
+			if (!log_args_put(record, &width, sizeof (width))) {
+				return false;
+			}
+		}
+		if (spec.star_precision) {
+			int const precision = va_arg(*ap, int);
+			if (!log_args_put(record, &precision, sizeof (precision))) {
+				return false;
+			}
+			spec.precision = precision < 0 ? -1 : precision;
+		}
+
+		bool ok = false;
+		switch (spec.conversion) {
+		case 'd':
+		case 'i':
+			if (LOG_LENGTH_BIG_L != spec.length) {
+				long long const value = log_arg_signed(ap, spec.length);
+				ok = log_args_put(record, &value, sizeof (value));
+			}
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			if (LOG_LENGTH_BIG_L != spec.length) {
+				unsigned long long const value = log_arg_unsigned(ap, spec.length);
+				ok = log_args_put(record, &value, sizeof (value));
+			}
+			break;
+		case 'c':
+			if (LOG_LENGTH_NONE == spec.length) {
+				int const value = va_arg(*ap, int);
+				ok = log_args_put(record, &value, sizeof (value));
+			}
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (LOG_LENGTH_NONE == spec.length || LOG_LENGTH_L == spec.length) {
+				double const value = va_arg(*ap, double);
+				ok = log_args_put(record, &value, sizeof (value));
+			}
+			break;
+		case 'p':
+			if (LOG_LENGTH_NONE == spec.length) {
+				void * const value = va_arg(*ap, void *);
+				ok = log_args_put(record, &value, sizeof (value));
+			}
+			break;
+		case 's':
+			if (LOG_LENGTH_NONE == spec.length) {
+				char const * value = va_arg(*ap, char const *);
+				if (NULL == value) {
+					value = "(null)";
+				}
+				size_t const len = spec.precision >= 0 ? strnlen(value, (size_t) spec.precision) : strlen(value);
+				ok = log_args_put(record, value, len) && log_args_put(record, "", 1);
+			}
+			break;
+		default:
+			// "%n", "%m", wide characters, or an invalid specification.
+			break;
+		}
+		if (!ok) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+
+
+void log_record_capture(log_record_t * record, char const * format, va_list ap)
+{
+	record->format = format;
+	record->formatted = false;
+	record->args_size = 0;
+
+	va_list args;
+	va_copy(args, ap);
+	bool const captured = log_record_capture_args(record, format, &args);
+	va_end(args);
+
+	if (!captured) {
+		// Fall back to formatting the message right away.
+		va_copy(args, ap);
+		int const n = vsnprintf((char *) record->args, sizeof (record->args), format, args);
+		va_end(args);
+
+		record->formatted = true;
+		if (n < 0) {
+			record->args_size = 0;
+		} else {
+			record->args_size = (size_t) n < sizeof (record->args) ? (size_t) n : sizeof (record->args) - 1;
+		}
+	}
+
+	return;
+}
+
+
+
+
+// Format a single conversion with zero, one or two '*' values preceding the value.
+#define LOG_SNPRINTF(out, avail, spec_buf, stars, stars_count, value)                 \
+	(0 == (stars_count) ? snprintf((out), (avail), (spec_buf), (value))             \
+	 : 1 == (stars_count) ? snprintf((out), (avail), (spec_buf), (stars)[0], (value)) \
+	 : snprintf((out), (avail), (spec_buf), (stars)[0], (stars)[1], (value)))
+
+
+
+
+size_t log_record_format(log_record_t const * record, char * buf, size_t size)
+{
+	if (0 == size) {
+		return 0;
+	}
+	if (record->formatted) {
+		size_t const len = record->args_size < size ? record->args_size : size - 1;
+		memcpy(buf, record->args, len);
+		buf[len] = '\0';
+		return len;
+	}
+
+	size_t len = 0;
+	size_t offset = 0;
+	char const * p = record->format;
+	while ('\0' != *p) {
+		if ('%' != *p || '%' == p[1]) {
+			if (len < size - 1) {
+				buf[len++] = *p;
+			}
+			p += '%' == *p ? 2 : 1;
+			continue;
+		}
+
+		log_spec_t spec;
+		p = log_parse_spec(p + 1, &spec);
+
+		int stars[2] = { 0 };
+		int stars_count = 0;
+		if (spec.star_width) {
+			log_args_get(record, &offset, &stars[stars_count++], sizeof (int));
+		}
+		if (spec.star_precision) {
+			log_args_get(record, &offset, &stars[stars_count++], sizeof (int));
+		}
+
+		// Rebuild the specification. Integers have been stored as 64-bit
+		// values, so their length modifier is always "ll".
+		char spec_buf[LOG_SPEC_SIZE] = { '%' };
+		memcpy(spec_buf + 1, spec.body, spec.body_len);
+		size_t i = 1 + spec.body_len;
+		if (NULL != strchr("diuoxX", spec.conversion)) {
+			spec_buf[i++] = 'l';
+			spec_buf[i++] = 'l';
+		}
+		spec_buf[i++] = spec.conversion;
+		spec_buf[i] = '\0';
+
+		char * const out = buf + len;
+		size_t const avail = size - len;
+		int n = 0;
+		switch (spec.conversion) {
+		case 'd':
+		case 'i': {
+			long long value = 0;
+			log_args_get(record, &offset, &value, sizeof (value));
+			n = LOG_SNPRINTF(out, avail, spec_buf, stars, stars_count, value);
+			break;
+		}
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X': {
+			unsigned long long value = 0;
+			log_args_get(record, &offset, &value, sizeof (value));
+			n = LOG_SNPRINTF(out, avail, spec_buf, stars, stars_count, value);
+			break;
+		}
+		case 'c': {
+			int value = 0;
+			log_args_get(record, &offset, &value, sizeof (value));
+			n = LOG_SNPRINTF(out, avail, spec_buf, stars, stars_count, value);
+			break;
+		}
+		case 'p': {
+			void * value = NULL;
+			log_args_get(record, &offset, &value, sizeof (value));
+			n = LOG_SNPRINTF(out, avail, spec_buf, stars, stars_count, value);
+			break;
+		}
+		case 's': {
+			char const * const value = (char const *) record->args + offset;
+			offset += strlen(value) + 1;
+			n = LOG_SNPRINTF(out, avail, spec_buf, stars, stars_count, value);
+			break;
+		}
+		default: { // Floating point conversions.
+			double value = 0.0;
+			log_args_get(record, &offset, &value, sizeof (value));
+			n = LOG_SNPRINTF(out, avail, spec_buf, stars, stars_count, value);
+			break;
+		}
+		}
+
+		if (n > 0) {
+			len += (size_t) n < avail ? (size_t) n : avail - 1;
+		}
+	}
+	buf[len] = '\0';
+
+	return len;
+}
+
+
+
+
+/// @brief Put message into queue of background thread
+///
+/// @return true if the message has been handled (queued or dropped)
+/// @return false if background thread is not running and caller should write the message itself
+static bool log_enqueue(int priority, bool file_only, char const * format, va_list ap)
+{
+	// Announce the producer before checking the flag, so that
+	// log_async_stop() can wait for producers that have seen the flag set.
+	// Both operations are sequentially consistent, paired with those in
+	// log_async_stop().
+	__atomic_add_fetch(&g_log_producers, 1, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&g_log_async, __ATOMIC_SEQ_CST)) {
+		__atomic_sub_fetch(&g_log_producers, 1, __ATOMIC_SEQ_CST);
+		return false;
+	}
+
+	unsigned int pos = __atomic_load_n(&g_log_tail, __ATOMIC_RELAXED);
+	log_slot_t * slot = NULL;
+	for (;;) {
+		slot = &g_log_slots[pos & (LOG_QUEUE_SIZE - 1)];
+		unsigned int const seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		int const diff = (int) (seq - pos);
+		if (0 == diff) {
+			if (__atomic_compare_exchange_n(&g_log_tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+			// On failure "pos" has been updated to current tail.
+		} else if (diff < 0) {
+			// Queue is full. Don't wait for the consumer: the caller may
+			// be a thread that does keying.
+			__atomic_add_fetch(&g_log_dropped, 1, __ATOMIC_RELAXED);
+			__atomic_sub_fetch(&g_log_producers, 1, __ATOMIC_RELEASE);
+			return true;
+		} else {
+			pos = __atomic_load_n(&g_log_tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->record.priority = priority;
+	slot->record.file_only = file_only;
+	log_record_capture(&slot->record, format, ap);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	sem_post(&g_log_sem);
+	__atomic_sub_fetch(&g_log_producers, 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+
+
+
+/// @brief Format and write next message from the queue
+///
+/// @return true if a message has been written
+/// @return false if there was no message ready
+static bool log_write_next(void)
+{
+	log_slot_t * const slot = &g_log_slots[g_log_head & (LOG_QUEUE_SIZE - 1)];
+	if (g_log_head + 1 != __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+
+	char buf[LOG_BUF_SIZE];
+	log_record_format(&slot->record, buf, sizeof (buf));
+	int const priority = slot->record.priority;
+	bool const file_only = slot->record.file_only;
+
+	// Release the slot before doing (slow) I/O.
+	__atomic_store_n(&slot->seq, g_log_head + LOG_QUEUE_SIZE, __ATOMIC_RELEASE);
+	g_log_head++;
+
+	log_write(priority, file_only, buf);
+
+	return true;
+}
+
+
+
+
+static void log_drain(void)
+{
+	bool written = false;
+	while (log_write_next()) {
+		written = true;
+	}
+
+	unsigned long const dropped = __atomic_exchange_n(&g_log_dropped, 0, __ATOMIC_RELAXED);
+	if (dropped) {
+		char buf[64];
+		snprintf(buf, sizeof (buf), "%lu log message(s) dropped", dropped);
+		log_write(LOG_WARNING, false, buf);
+		written = true;
+	}
+
+	if (written && cwdaemon_debug_f) {
+		fflush(cwdaemon_debug_f);
+	}
+
+	return;
+}
+
+
+
+
+static void * log_thread_fn(__attribute__((unused)) void * arg)
+{
+	while (!__atomic_load_n(&g_log_stopping, __ATOMIC_ACQUIRE)) {
+		if (0 != sem_wait(&g_log_sem) && EINTR == errno) {
+			continue;
+		}
+		log_drain();
+	}
+
+	return NULL;
+}
+
+
+
+
+int log_async_start(void)
+{
+	if (__atomic_load_n(&g_log_async, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+
+	for (unsigned int i = 0; i < LOG_QUEUE_SIZE; i++) {
+		g_log_slots[i].seq = i;
+	}
+	g_log_tail = 0;
+	g_log_head = 0;
+	g_log_stopping = false;
+
+	if (0 != sem_init(&g_log_sem, 0, 0)) {
+		log_error("Failed to initialize semaphore of logging thread: %s", strerror(errno));
+		return -1;
+	}
+
+	// Signals should be handled by main thread, not by logging thread.
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int const retv = pthread_create(&g_log_thread, NULL, log_thread_fn, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (0 != retv) {
+		sem_destroy(&g_log_sem);
+		log_error("Failed to start logging thread: %s", strerror(retv));
+		return -1;
+	}
+
+	__atomic_store_n(&g_log_async, true, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+
+
+
+void log_async_stop(void)
+{
+	if (!__atomic_exchange_n(&g_log_async, false, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	// Producers that have seen the flag set may still be putting messages
+	// into the queue, or posting the semaphore. New producers write their
+	// messages themselves.
+	while (0 != __atomic_load_n(&g_log_producers, __ATOMIC_SEQ_CST)) {
+		sched_yield();
+	}
+
+	__atomic_store_n(&g_log_stopping, true, __ATOMIC_RELEASE);
+	sem_post(&g_log_sem);
+	pthread_join(g_log_thread, NULL);
 
+	// Messages queued after last wake-up of the thread.
+	log_drain();
+	sem_destroy(&g_log_sem);
 
 	return;
 }
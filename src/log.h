@@ -4,7 +4,9 @@
 
 
 
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <syslog.h>
 
 
@@ -28,26 +30,152 @@ void cwdaemon_debug_close(void);
 
 
 
+#ifndef CWDAEMON_LOG_COMPILE_THRESHOLD
+/// Messages with priority above this threshold are removed at compile time,
+/// together with evaluation of their arguments. Configured with
+/// "--with-log-compile-threshold" option of configure script.
+#define CWDAEMON_LOG_COMPILE_THRESHOLD LOG_DEBUG
+#endif
+
+
+
+
+/// Size of buffer for a single formatted log message.
+#define LOG_BUF_SIZE (1024 + 1)
+
+
+
+
 /// @brief Log message to current log output (to syslog or to file)
 ///
 /// Function appends '\n' at the end of messages if the messages are sent to
 /// file (stdout, stderr or disc file).
 ///
+/// Arguments of filtered-out messages are not evaluated: the threshold is
+/// checked by the macro before the arguments are passed to a function.
+///
 /// @param[in] priority syslog priority level enum (LOG_ERR, LOG_INFO and friends)
 /// @param[in] format Format string for log message
-void log_message(int priority, const char * format, ...) __attribute__ ((format (printf, 2, 3)));
+#define log_message(priority, ...)                                          \
+	do {                                                                \
+		if ((priority) <= CWDAEMON_LOG_COMPILE_THRESHOLD            \
+		    && log_is_enabled(priority)) {                          \
+			log_message_internal((priority), __VA_ARGS__);      \
+		}                                                           \
+	} while (0)
 
 #define log_error(format, ...)      log_message(LOG_ERR, format, __VA_ARGS__)
 #define log_warning(format, ...)    log_message(LOG_WARNING, format, __VA_ARGS__)
 #define log_info(format, ...)       log_message(LOG_INFO, format, __VA_ARGS__)
 #define log_debug(format, ...)      log_message(LOG_DEBUG, format, __VA_ARGS__)
 
+void log_message_internal(int priority, const char * format, ...) __attribute__ ((format (printf, 2, 3)));
+
+
+
+
+/// @brief Check if messages with given priority pass current log threshold
+///
+/// The threshold may be changed at run time by another thread, so it is
+/// read atomically.
+///
+/// @param[in] priority syslog priority level enum (LOG_ERR, LOG_INFO and friends)
+///
+/// @return true if messages with given priority should be logged
+/// @return false otherwise
+bool log_is_enabled(int priority);
+
+
+
+
+/// @brief Set current log threshold
+///
+/// @param[in] threshold syslog priority level enum (LOG_ERR, LOG_INFO and friends), or LOG_CRIT for "none"
+void log_set_threshold(int threshold);
+
+
+
+
+/// @brief Start background thread that formats and writes log messages
+///
+/// Until this function is called (and after log_async_stop() is called),
+/// messages are formatted and written synchronously by the calling thread.
+///
+/// Call the function after forking: the thread wouldn't survive fork().
+///
+/// @return 0 on success
+/// @return -1 on failure
+int log_async_start(void);
+
+
+
+
+/// @brief Write pending log messages and stop the background thread
+///
+/// The function waits for other threads that are putting messages into the
+/// queue at the moment, so no queued message is lost.
+///
+/// Suitable for registering with atexit().
+void log_async_stop(void);
+
+
+
+
+/// Message waiting to be formatted by background thread.
+///
+/// Formatting is deferred: at the time of logging only the pointer to format
+/// string and raw values of arguments are copied into the record. Strings
+/// passed as arguments are copied too, because their buffers may be gone by
+/// the time the message is formatted. The format string itself must outlive
+/// the record, which is true for string literals.
+typedef struct {
+	char const * format;
+	int priority;
+	bool file_only;     ///< Write the message only to file, never to syslog (deprecated cwdaemon_debug()).
+	bool formatted;     ///< The message couldn't be captured and "args" holds already formatted text.
+	size_t args_size;   ///< Count of bytes used in "args".
+	unsigned char args[LOG_BUF_SIZE];
+} log_record_t;
+
+
+
+
+/// @brief Copy format pointer and values of arguments into a record
+///
+/// Conversions that can't be deferred (e.g. "%n" or positional arguments),
+/// or arguments that don't fit into the record, cause the message to be
+/// formatted right away.
+///
+/// @param[out] record Record to fill
+/// @param[in] format Format string, must outlive the record
+/// @param[in] ap Arguments matching @p format
+void log_record_capture(log_record_t * record, char const * format, va_list ap);
+
+
+
+
+/// @brief Format message from a record filled by log_record_capture()
+///
+/// @param[in] record Record with captured message
+/// @param[out] buf Output buffer
+/// @param[in] size Size of @p buf
+///
+/// @return length of formatted message, not greater than size - 1
+size_t log_record_format(log_record_t const * record, char * buf, size_t size);
+
 
 
 
 /* These functions are deprecated. Use log_message() function or log_X() macro instead. */
 void cwdaemon_errmsg(const char * format, ...) __attribute__ ((format (printf, 1, 2)));
-void cwdaemon_debug(int verbosity, const char *func, int line, const char *format, ...) __attribute__ ((format (printf, 4, 5)));
+#define cwdaemon_debug(verbosity, func, line, ...)                          \
+	do {                                                                \
+		if ((verbosity) <= CWDAEMON_LOG_COMPILE_THRESHOLD           \
+		    && log_is_enabled(verbosity)) {                         \
+			cwdaemon_debug_internal((verbosity), (func), (line), __VA_ARGS__); \
+		}                                                           \
+	} while (0)
+void cwdaemon_debug_internal(int verbosity, const char *func, int line, const char *format, ...) __attribute__ ((format (printf, 4, 5)));
 const char * log_get_priority_label(int priority);
 
 
@@ -67,6 +67,7 @@
 #include <unistd.h>
 
 #include "cwdaemon.h"
+#include "iambic.h"
 #include "log.h"
 #include "lp.h"
 #include "utils.h"
@@ -171,99 +172,104 @@ int lp_probe_cwdevice(const char *fname)
 
 
 
-/* Linux wrapper around PPFCONTROL */
-#ifdef HAVE_LINUX_PPDEV_H
-static void
-parport_control (int fd, unsigned char controlbits, int values)
-{
-	struct ppdev_frob_struct frob = { 0 };
-	frob.mask = controlbits;
-	frob.val = values;
+static void parport_control (cwdevice * dev, unsigned char controlbits, unsigned char values);
+static void parport_write_data (cwdevice * dev, unsigned char data);
+static unsigned char parport_read_data (cwdevice * dev);
+static void parport_ioctl (cwdevice * dev, unsigned long request, void * arg, char const * name);
 
-	if (ioctl (fd, PPFCONTROL, &frob) == -1)
-	{
-		cwdaemon_errmsg("Parallel port PPFCONTROL");
-		exit (1);
-	}
-}
-#endif
-
-/* FreeBSD wrapper around PPISCTRL */
-#ifdef HAVE_DEV_PPBUS_PPI_H
-static void
-parport_control (int fd, unsigned char controlbits, int values)
-{
-	unsigned char val = 0;
 
-	if (ioctl (fd, PPIGCTRL, &val) == -1)
-	{
-		cwdaemon_errmsg("Parallel port PPIGCTRL");
-		exit (1);
-	}
 
-	val &= ~controlbits;
-	val |= values;
 
-	if (ioctl (fd, PPISCTRL, &val) == -1)
+/* Wrapper around ioctl() on parallel port, exits on errors. */
+#if defined (HAVE_LINUX_PPDEV_H) || defined (HAVE_DEV_PPBUS_PPI_H)
+static void
+parport_ioctl (cwdevice * dev, unsigned long request, void * arg, char const * name)
+{
+	if (dev->io->ioctl (dev->fd, request, arg) == -1)
 	{
-		cwdaemon_errmsg("Parallel port PPISCTRL");
+		cwdaemon_errmsg("Parallel port %s", name);
 		exit (1);
 	}
 }
 #endif
 
-/* Linux wrapper around PPWDATA */
+/* Change bits of control register. Nothing is written if the bits are
+   already in requested state (according to shadow of the register).
+   The shadow isn't protected by a lock: after initialization of the
+   cwdevice all changes of pins are made by keying I/O thread
+   (keying_io.h). */
 #ifdef HAVE_LINUX_PPDEV_H
 static void
-parport_write_data (int fd, unsigned char data)
+parport_control (cwdevice * dev, unsigned char controlbits, unsigned char values)
 {
-	if (ioctl (fd, PPWDATA, &data) == -1)
-	{
-		cwdaemon_errmsg("Parallel port PPWDATA");
-		exit (1);
+	values &= controlbits;
+	unsigned char const control = (unsigned char) ((dev->shadow.lines & ~controlbits) | values);
+	if (dev->shadow.valid && control == dev->shadow.lines) {
+		return;
 	}
+
+	struct ppdev_frob_struct frob = { 0 };
+	frob.mask = controlbits;
+	frob.val = values;
+	parport_ioctl (dev, PPFCONTROL, &frob, "PPFCONTROL");
+
+	dev->shadow.lines = control;
 }
 #endif
 
-/* FreeBSD wrapper around PPISDATA */
+/* FreeBSD wrapper around PPISCTRL. Thanks to the shadow of control
+   register, a change is a single write instead of read-modify-write. */
 #ifdef HAVE_DEV_PPBUS_PPI_H
 static void
-parport_write_data (int fd, unsigned char data)
+parport_control (cwdevice * dev, unsigned char controlbits, unsigned char values)
 {
-	if (ioctl (fd, PPISDATA, &data) == -1)
+	if (!dev->shadow.valid)
 	{
-		cwdaemon_errmsg("Parallel port PPISDATA");
-		exit (1);
+		unsigned char val = 0;
+		parport_ioctl (dev, PPIGCTRL, &val, "PPIGCTRL");
+		dev->shadow.lines = val;
+		dev->shadow.valid = true;
+	}
+
+	unsigned char val = (unsigned char) ((dev->shadow.lines & ~controlbits) | (values & controlbits));
+	if (val == dev->shadow.lines) {
+		return;
 	}
+	parport_ioctl (dev, PPISCTRL, &val, "PPISCTRL");
+	dev->shadow.lines = val;
 }
 #endif
 
-/* Linux wrapper around PPRSTATUS, reading the status port */
-#ifdef HAVE_LINUX_PPDEV_H
-static unsigned char
-parport_read_data (int fd)
+/* Write data register (PPWDATA on Linux, PPISDATA on FreeBSD), unless it
+   already holds the value. */
+#if defined (HAVE_LINUX_PPDEV_H) || defined (HAVE_DEV_PPBUS_PPI_H)
+static void
+parport_write_data (cwdevice * dev, unsigned char data)
 {
-	unsigned char data = 0;
-	if (ioctl (fd, PPRSTATUS, &data) == -1)
-	{
-		cwdaemon_errmsg("Parallel port PPRSTATUS");
-		exit (1);
+	if (dev->shadow.data_valid && data == dev->shadow.data) {
+		return;
 	}
-	return data;
+#ifdef HAVE_LINUX_PPDEV_H
+	parport_ioctl (dev, PPWDATA, &data, "PPWDATA");
+#else
+	parport_ioctl (dev, PPISDATA, &data, "PPISDATA");
+#endif
+	dev->shadow.data = data;
+	dev->shadow.data_valid = true;
 }
 #endif
 
-/* FreeBSD wrapper around PPISSTATUS, reading the status port */
-#ifdef HAVE_DEV_PPBUS_PPI_H
+/* Read the status port (PPRSTATUS on Linux, PPISSTATUS on FreeBSD). */
+#if defined (HAVE_LINUX_PPDEV_H) || defined (HAVE_DEV_PPBUS_PPI_H)
 static unsigned char
-parport_read_data (int fd)
+parport_read_data (cwdevice * dev)
 {
 	unsigned char data = 0;
-	if (ioctl (fd, PPISSTATUS, &data) == -1)
-	{
-		cwdaemon_errmsg("Parallel port PPISSTATUS");
-		exit (1);
-	}
+#ifdef HAVE_LINUX_PPDEV_H
+	parport_ioctl (dev, PPRSTATUS, &data, "PPRSTATUS");
+#else
+	parport_ioctl (dev, PPISSTATUS, &data, "PPISSTATUS");
+#endif
 	return data;
 }
 #endif
@@ -272,23 +278,26 @@ parport_read_data (int fd)
 int
 lp_init (cwdevice * dev, int fd)
 {
+	dev->fd = fd;
+	dev->shadow.valid = false;
+	dev->shadow.data_valid = false;
 #ifdef HAVE_LINUX_PPDEV_H
 	int mode = PARPORT_MODE_PCSPP;
 
-	if (ioctl (fd, PPSETMODE, &mode) == -1)
+	if (dev->io->ioctl (fd, PPSETMODE, &mode) == -1)
 	{
 		cwdaemon_errmsg("Setting parallel port mode");
 		close (fd);
 		exit (1);
 	}
 
-	if (ioctl (fd, PPEXCL, NULL) == -1)
+	if (dev->io->ioctl (fd, PPEXCL, NULL) == -1)
 	{
 		cwdaemon_errmsg("Parallel port %s is already in use", dev->desc);
 		close (fd);
 		exit (1);
 	}
-	if (ioctl (fd, PPCLAIM, NULL) == -1)
+	if (dev->io->ioctl (fd, PPCLAIM, NULL) == -1)
 	{
 		cwdaemon_errmsg("Claiming parallel port %s", dev->desc);
 		cwdaemon_debug(CWDAEMON_VERBOSITY_W, __func__, __LINE__, "HINT: did you unload the lp kernel module?");
@@ -297,13 +306,20 @@ lp_init (cwdevice * dev, int fd)
 		exit (1);
 	}
 
+	/* Initial state of control register, for skipping redundant writes. */
+	unsigned char control = 0;
+	if (dev->io->ioctl (fd, PPRCONTROL, &control) == 0)
+	{
+		dev->shadow.lines = control;
+		dev->shadow.valid = true;
+	}
+
 	/* Enable CW & PTT - /STROBE bit (pin 1) */
-	parport_control (fd, PARPORT_CONTROL_STROBE, PARPORT_CONTROL_STROBE);
+	parport_control (dev, PARPORT_CONTROL_STROBE, PARPORT_CONTROL_STROBE);
 #endif
 #ifdef HAVE_DEV_PPBUS_PPI_H
-	parport_control (fd, STROBE, STROBE);
+	parport_control (dev, STROBE, STROBE);
 #endif
-	dev->fd = fd;
 	dev->reset_pins_state(dev);
 	return 0;
 }
@@ -316,24 +332,31 @@ lp_free (cwdevice * dev)
 	dev->reset_pins_state(dev);
 
 	/* Disable CW & PTT - /STROBE bit (pin 1) */
-	parport_control (dev->fd, PARPORT_CONTROL_STROBE, 0);
+	parport_control (dev, PARPORT_CONTROL_STROBE, 0);
 
-	ioctl (dev->fd, PPRELEASE);
+	dev->io->ioctl (dev->fd, PPRELEASE, NULL);
 #endif
 #ifdef HAVE_DEV_PPBUS_PPI_H
 	/* Disable CW & PTT - /STROBE bit (pin 1) */
-	parport_control (dev->fd, STROBE, 0);
+	parport_control (dev, STROBE, 0);
 #endif
 	close (dev->fd);
+	dev->shadow.valid = false;
+	dev->shadow.data_valid = false;
 	return 0;
 }
 
+/* CW, PTT and SSB way are reset with a single write of control register. */
 int lp_reset_pins_state(cwdevice * dev)
 {
+#ifdef HAVE_LINUX_PPDEV_H
+	parport_control (dev, PARPORT_CONTROL_SELECT | PARPORT_CONTROL_INIT | PARPORT_CONTROL_AUTOFD,
+			PARPORT_CONTROL_SELECT);
+#endif
+#ifdef HAVE_DEV_PPBUS_PPI_H
+	parport_control (dev, SELECTIN | nINIT | AUTOFEED, SELECTIN);
+#endif
 #if defined (HAVE_LINUX_PPDEV_H) || defined (HAVE_DEV_PPBUS_PPI_H)
-	lp_cw (dev, 0);
-	lp_ptt (dev, 0);
-	lp_ssbway (dev, 0);
 	lp_switchband (dev, 0);
 #endif
 	return 0;
@@ -345,17 +368,17 @@ lp_cw (cwdevice * dev, int onoff)
 {
 #ifdef HAVE_LINUX_PPDEV_H
 	if (onoff == 1) {
-		parport_control (dev->fd, PARPORT_CONTROL_SELECT, 0);
+		parport_control (dev, PARPORT_CONTROL_SELECT, 0);
 	} else {
-		parport_control (dev->fd, PARPORT_CONTROL_SELECT,
+		parport_control (dev, PARPORT_CONTROL_SELECT,
 				PARPORT_CONTROL_SELECT);
 	}
 #endif
 #ifdef HAVE_DEV_PPBUS_PPI_H
 	if (onoff == 1) {
-		parport_control (dev->fd, SELECTIN, 0);
+		parport_control (dev, SELECTIN, 0);
 	} else {
-		parport_control (dev->fd, SELECTIN, SELECTIN);
+		parport_control (dev, SELECTIN, SELECTIN);
 	}
 #endif
 	return 0;
@@ -367,18 +390,18 @@ lp_ptt (cwdevice * dev, int onoff)
 {
 #ifdef HAVE_LINUX_PPDEV_H
 	if (onoff == 1) {
-		parport_control (dev->fd, PARPORT_CONTROL_INIT,
+		parport_control (dev, PARPORT_CONTROL_INIT,
 				PARPORT_CONTROL_INIT);
 	} else {
-		parport_control (dev->fd, PARPORT_CONTROL_INIT, 0);
+		parport_control (dev, PARPORT_CONTROL_INIT, 0);
 	}
 #endif
 #ifdef HAVE_DEV_PPBUS_PPI_H
 	if (onoff == 1) {
-		parport_control (dev->fd, nINIT,
+		parport_control (dev, nINIT,
 				nINIT);
 	} else {
-		parport_control (dev->fd, nINIT, 0);
+		parport_control (dev, nINIT, 0);
 	}
 #endif
 	return 0;
@@ -391,30 +414,48 @@ lp_footswitch (cwdevice * dev)
 	unsigned char footswitch = 0xff;
 	/* we check for bit 3 low so FF is better then 0 */
 #if defined (HAVE_LINUX_PPDEV_H) || defined (HAVE_DEV_PPBUS_PPI_H)
-	footswitch = parport_read_data (dev->fd);
+	footswitch = parport_read_data (dev);
 	/* returns decimal 8 if pin 15 is high */
 #endif
 	return ((footswitch & 0x08) >> 3);
 	/* bit 0=1 footswitch up, bit 0=0 footswitch down*/
 }
 
+/* Paddles: dot on pin 13 (SELECT), dash on pin 12 (PAPEROUT). A pressed
+   paddle shorts the pin to ground. */
+int
+lp_paddles (cwdevice * dev)
+{
+	int paddles = 0;
+#if defined (HAVE_LINUX_PPDEV_H) || defined (HAVE_DEV_PPBUS_PPI_H)
+	unsigned char const status = parport_read_data (dev);
+	if (!(status & 0x10)) {
+		paddles |= IAMBIC_PADDLE_DOT;
+	}
+	if (!(status & 0x20)) {
+		paddles |= IAMBIC_PADDLE_DASH;
+	}
+#endif
+	return paddles;
+}
+
 /* SSB way from mic/soundcard - AUTOLF bit (pin 14) */
 int
 lp_ssbway (cwdevice * dev, int onoff)
 {
 #ifdef HAVE_LINUX_PPDEV_H
 	if (onoff == 1)	{   /* soundcard */
-		parport_control (dev->fd, PARPORT_CONTROL_AUTOFD,
+		parport_control (dev, PARPORT_CONTROL_AUTOFD,
 				PARPORT_CONTROL_AUTOFD);
 	} else {            /* microphone */
-		parport_control (dev->fd, PARPORT_CONTROL_AUTOFD, 0);
+		parport_control (dev, PARPORT_CONTROL_AUTOFD, 0);
 	}
 #endif
 #ifdef HAVE_DEV_PPBUS_PPI_H
 	if (onoff == 1)	{   /* soundcard */
-		parport_control (dev->fd, AUTOFEED, AUTOFEED);
+		parport_control (dev, AUTOFEED, AUTOFEED);
 	} else {            /* microphone */
-		parport_control (dev->fd, AUTOFEED, 0);
+		parport_control (dev, AUTOFEED, 0);
 	}
 #endif
 	return 0;
@@ -425,7 +466,7 @@ int
 lp_switchband (cwdevice * dev, unsigned char bitpattern)
 {
 #if defined (HAVE_LINUX_PPDEV_H) || defined (HAVE_DEV_PPBUS_PPI_H)
-	parport_write_data (dev->fd, bitpattern);
+	parport_write_data (dev, bitpattern);
 #endif
 	return 0 ;
 }
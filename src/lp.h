@@ -18,6 +18,7 @@ int lp_ptt(struct cwdev_s * dev, int onoff);
 int lp_ssbway(struct cwdev_s * dev, int onoff);
 int lp_switchband(struct cwdev_s * dev, unsigned char bitpattern);
 int lp_footswitch(struct cwdev_s * dev);
+int lp_paddles(struct cwdev_s * dev);
 
 
 
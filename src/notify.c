@@ -0,0 +1,154 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+
+/// @file
+///
+/// Notification of readiness of cwdaemon, through a file descriptor and
+/// through service manager's socket. See notify.h.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "notify.h"
+
+
+
+
+static bool g_notify_ready = false;
+
+
+
+
+static int notify_socket_send(char const * message);
+
+
+
+
+void notify_ready(int ready_fd)
+{
+	if (ready_fd >= 0) {
+		size_t const len = strlen(NOTIFY_READY_MESSAGE);
+		ssize_t rv = 0;
+		do {
+			rv = write(ready_fd, NOTIFY_READY_MESSAGE, len);
+		} while (-1 == rv && EINTR == errno);
+		if ((ssize_t) len != rv) {
+			log_warning("Failed to notify readiness on file descriptor %d: %s", ready_fd, -1 == rv ? strerror(errno) : "short write");
+		}
+		close(ready_fd);
+	}
+
+	char message[64] = { 0 };
+	snprintf(message, sizeof (message), "READY=1\nMAINPID=%ld\n", (long) getpid());
+	if (0 == notify_socket_send(message)) {
+		g_notify_ready = true;
+	}
+
+	log_info("Ready to handle requests, pid = %ld", (long) getpid());
+	return;
+}
+
+
+
+
+void notify_stopping(void)
+{
+	if (g_notify_ready) {
+		notify_socket_send("STOPPING=1\n");
+		g_notify_ready = false;
+	}
+	return;
+}
+
+
+
+
+void notify_handed_over(void)
+{
+	g_notify_ready = false;
+	return;
+}
+
+
+
+
+/// @brief Send a message to socket of service manager
+///
+/// @param[in] message Message in format of sd_notify()
+///
+/// @return 0 on success
+/// @return -1 if the socket is not set or on failure
+static int notify_socket_send(char const * message)
+{
+	char const * path = getenv(NOTIFY_ENV_SOCKET);
+	if (NULL == path || '\0' == path[0]) {
+		return -1;
+	}
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	size_t const path_len = strlen(path);
+	if (('@' != path[0] && '/' != path[0]) || path_len >= sizeof (addr.sun_path)) {
+		log_warning("Unsupported value of %s: [%s]", NOTIFY_ENV_SOCKET, path);
+		return -1;
+	}
+	memcpy(addr.sun_path, path, path_len);
+	if ('@' == path[0]) {
+		addr.sun_path[0] = '\0'; // Abstract namespace.
+	}
+	socklen_t const addr_len = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + path_len);
+
+	int const fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (-1 == fd) {
+		log_warning("Failed to create socket for notification of service manager: %s", strerror(errno));
+		return -1;
+	}
+	ssize_t const rv = sendto(fd, message, strlen(message), 0, (struct sockaddr const *) &addr, addr_len);
+	int const err = errno;
+	close(fd);
+	if (-1 == rv) {
+		log_warning("Failed to notify service manager at [%s]: %s", path, strerror(err));
+		return -1;
+	}
+
+	return 0;
+}
+
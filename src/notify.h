@@ -0,0 +1,91 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_NOTIFY_H
+#define CWDAEMON_NOTIFY_H
+
+
+
+
+/// @file
+///
+/// Notification of readiness of cwdaemon.
+///
+/// A process that starts cwdaemon (a service manager, a test program) needs
+/// to know when cwdaemon is ready to handle requests: its network socket is
+/// bound and its keying engine is running. With forking, exit of the
+/// started process says nothing about readiness of the daemon.
+///
+/// cwdaemon notifies readiness in two ways, both optional:
+///  - by writing NOTIFY_READY_MESSAGE to a file descriptor (e.g. write end
+///    of a pipe) given with --ready-fd option, and closing the descriptor.
+///    If cwdaemon exits before it's ready, the descriptor is closed
+///    without writing, so a reader of the pipe gets end-of-file;
+///  - by sending a datagram with "READY=1" to Unix socket given in
+///    NOTIFY_SOCKET environment variable, as expected by systemd's services
+///    of "Type=notify". "STOPPING=1" is sent when cwdaemon exits.
+
+
+
+
+#define NOTIFY_READY_MESSAGE  "READY=1\n"
+
+/// Name of environment variable with path to Unix socket of service
+/// manager. Path starting with '@' is in abstract namespace.
+#define NOTIFY_ENV_SOCKET     "NOTIFY_SOCKET"
+
+
+
+
+/// @brief Notify readiness of cwdaemon
+///
+/// Call this in the final (daemonized) process, after the socket has been
+/// bound and the keying engine has been opened. Failures are logged but
+/// are not fatal.
+///
+/// @param[in] ready_fd Descriptor given with --ready-fd, or -1
+void notify_ready(int ready_fd);
+
+
+
+
+/// @brief Notify service manager that cwdaemon is exiting
+///
+/// Does nothing if NOTIFY_ENV_SOCKET is not set, or if readiness has not
+/// been notified.
+void notify_stopping(void);
+
+
+
+
+/// @brief Forget about notified readiness after hand-over to new process
+///
+/// The service continues in new process (see handoff.h), which has sent
+/// its own MAINPID to service manager, so "STOPPING=1" must not be sent
+/// when this process exits.
+void notify_handed_over(void);
+
+
+
+
+#endif /* #ifndef CWDAEMON_NOTIFY_H */
+
@@ -30,12 +30,22 @@
 
 
 
+#include "config.h"
+
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/un.h>
 
 #include "cwdaemon.h"
 #include "log.h"
 #include "options.h"
+#include "rt.h"
+#include "sidetone.h"
 #include "utils.h"
 
 
@@ -155,3 +165,219 @@ int cwdaemon_option_cwdevice(cwdevice ** device, char const * opt_value)
 }
 
 
+
+
+int cwdaemon_option_rt_priority(int * priority, char const * opt_value)
+{
+	long lv = 0;
+	if (!cwdaemon_get_long(opt_value, &lv) || lv < CWDAEMON_RT_PRIORITY_MIN || lv > CWDAEMON_RT_PRIORITY_MAX) {
+		log_error("Invalid requested real-time priority: \"%s\", must be in range <%d - %d>, inclusive",
+		          opt_value, CWDAEMON_RT_PRIORITY_MIN, CWDAEMON_RT_PRIORITY_MAX);
+		return -1;
+	}
+
+	*priority = (int) lv;
+	log_info("Requested real-time priority: %d", *priority);
+	return 0;
+}
+
+
+
+
+int cwdaemon_option_idle_suspend(unsigned int * seconds, char const * opt_value)
+{
+	long lv = 0;
+	if (!cwdaemon_get_long(opt_value, &lv) || lv < 0 || lv > CWDAEMON_IDLE_SUSPEND_MAX) {
+		log_error("Invalid requested idle time: \"%s\", must be in range <0 - %d> seconds, inclusive",
+		          opt_value, CWDAEMON_IDLE_SUSPEND_MAX);
+		return -1;
+	}
+
+	*seconds = (unsigned int) lv;
+	log_info("Requested suspension of keying engine after %u seconds of inactivity", *seconds);
+	return 0;
+}
+
+
+
+
+int cwdaemon_option_ready_fd(int * fd, char const * opt_value)
+{
+	long lv = 0;
+	if (!cwdaemon_get_long(opt_value, &lv) || lv < 0 || lv > INT_MAX) {
+		log_error("Invalid requested readiness file descriptor: \"%s\"", opt_value);
+		return -1;
+	}
+	int const flags = fcntl((int) lv, F_GETFL);
+	if (-1 == flags || O_RDONLY == (flags & O_ACCMODE)) {
+		log_error("Requested readiness file descriptor %ld is not open for writing: %s",
+		          lv, -1 == flags ? strerror(errno) : "read-only");
+		return -1;
+	}
+	// Don't leak the descriptor to processes started by cwdaemon.
+	fcntl((int) lv, F_SETFD, FD_CLOEXEC);
+
+	*fd = (int) lv;
+	log_info("Readiness will be notified on file descriptor %d", *fd);
+	return 0;
+}
+
+
+
+
+int cwdaemon_option_sidetone(sidetone_sink_t * sink, char const * opt_value)
+{
+	sidetone_sink_t result = { .type = SIDETONE_SINK_NONE };
+	char const * path = NULL;
+
+	if (NULL == opt_value) {
+		;
+	} else if (0 == strcmp(opt_value, "alsa")) {
+		result.type = SIDETONE_SINK_ALSA;
+		path = SIDETONE_ALSA_DEVICE_DEFAULT;
+	} else if (0 == strncmp(opt_value, "alsa:", strlen("alsa:"))) {
+		result.type = SIDETONE_SINK_ALSA;
+		path = opt_value + strlen("alsa:");
+	} else if (0 == strncmp(opt_value, "pcm:", strlen("pcm:"))) {
+		result.type = SIDETONE_SINK_PCM;
+		path = opt_value + strlen("pcm:");
+	}
+
+	if (NULL == path || '\0' == path[0] || strlen(path) >= sizeof (result.path)) {
+		log_error("Invalid requested sidetone sink: \"%s\", expected \"alsa\", \"alsa:<device>\" or \"pcm:<path>\"",
+		          opt_value ? opt_value : "");
+		return -1;
+	}
+	snprintf(result.path, sizeof (result.path), "%s", path);
+
+	*sink = result;
+	log_info("Requested sidetone sink: %s [%s]", SIDETONE_SINK_ALSA == sink->type ? "ALSA device" : "raw PCM", sink->path);
+	return 0;
+}
+
+
+
+
+int cwdaemon_option_channel(in_port_t * port, char * device, size_t size, char const * opt_value)
+{
+	char const * const colon = opt_value ? strchr(opt_value, ':') : NULL;
+	if (NULL == colon || colon == opt_value || '\0' == colon[1]) {
+		log_error("Invalid requested keying channel: \"%s\", expected \"<port>:<cwdevice>\"", opt_value ? opt_value : "");
+		return -1;
+	}
+
+	char port_value[16] = { 0 };
+	size_t const port_len = (size_t) (colon - opt_value);
+	if (port_len >= sizeof (port_value)) {
+		log_error("Invalid port of requested keying channel: \"%s\"", opt_value);
+		return -1;
+	}
+	memcpy(port_value, opt_value, port_len);
+	in_port_t result = 0;
+	if (0 != cwdaemon_option_network_port(&result, port_value)) {
+		return -1;
+	}
+	if (strlen(colon + 1) >= size) {
+		log_error("Too long name of cwdevice of requested keying channel: \"%s\"", colon + 1);
+		return -1;
+	}
+
+	*port = result;
+	snprintf(device, size, "%s", colon + 1);
+	log_info("Requested keying channel on port %u with cwdevice [%s]", (unsigned int) *port, device);
+	return 0;
+}
+
+
+
+
+int cwdaemon_option_rt_cpus(uint64_t * cpus, char const * opt_value)
+{
+	if (NULL == opt_value || '\0' == opt_value[0]) {
+		log_error("Empty list of CPUs %s", "");
+		return -1;
+	}
+
+	uint64_t mask = 0;
+	char const * p = opt_value;
+	while ('\0' != *p) {
+		long first = 0;
+		long last = 0;
+		char * end = NULL;
+
+		if (!isdigit((unsigned char) *p)) {
+			break;
+		}
+		first = strtol(p, &end, 10);
+		last = first;
+		p = end;
+		if ('-' == *p) {
+			p++;
+			if (!isdigit((unsigned char) *p)) {
+				break;
+			}
+			last = strtol(p, &end, 10);
+			p = end;
+		}
+		if (first > last || last >= CWDAEMON_RT_CPUS_MAX) {
+			break;
+		}
+		for (long cpu = first; cpu <= last; cpu++) {
+			mask |= UINT64_C(1) << cpu;
+		}
+
+		if (',' == *p && '\0' != p[1]) {
+			p++;
+		} else if ('\0' != *p) {
+			break;
+		}
+	}
+
+	if ('\0' != *p || 0 == mask) {
+		log_error("Invalid requested list of CPUs: \"%s\", expected e.g. \"2\" or \"0,2-3\", CPU numbers lower than %d",
+		          opt_value, CWDAEMON_RT_CPUS_MAX);
+		return -1;
+	}
+
+	*cpus = mask;
+	log_info("Requested CPUs: \"%s\"", opt_value);
+	return 0;
+}
+
+
+
+
+int cwdaemon_option_unix_socket(char const ** path, char const * opt_value)
+{
+	struct sockaddr_un addr;
+	if (NULL == opt_value || '/' != opt_value[0]) {
+		log_error("Invalid requested path of Unix-domain socket: \"%s\", must be an absolute path", opt_value ? opt_value : "");
+		return -1;
+	}
+	if (strlen(opt_value) >= sizeof (addr.sun_path)) {
+		log_error("Too long path of Unix-domain socket: \"%s\", must be shorter than %zu characters", opt_value, sizeof (addr.sun_path));
+		return -1;
+	}
+
+	*path = opt_value;
+	log_info("Requested Unix-domain socket [%s]", *path);
+	return 0;
+}
+
+
+
+
+int cwdaemon_option_rcvbuf(int * size, char const * opt_value)
+{
+	long lv = 0;
+	if (!cwdaemon_get_long(opt_value, &lv)
+	    || (0 != lv && (lv < CWDAEMON_RCVBUF_MIN || lv > CWDAEMON_RCVBUF_MAX))) {
+		log_error("Invalid requested size of receive buffer: \"%s\", must be zero or in range <%d - %d> bytes, inclusive",
+		          opt_value, CWDAEMON_RCVBUF_MIN, CWDAEMON_RCVBUF_MAX);
+		return -1;
+	}
+
+	*size = (int) lv;
+	log_info("Requested receive buffer of %d bytes", *size);
+	return 0;
+}
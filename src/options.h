@@ -8,6 +8,7 @@
 #include <stdint.h>
 
 #include "cwdaemon.h"
+#include "sidetone.h"
 
 
 
@@ -65,5 +66,119 @@ int cwdaemon_option_cwdevice(cwdevice ** device, char const * opt_value);
 
 
 
+/// @brief Parse value of "--rt-priority" command line option
+///
+/// @param[out] priority Parsed priority for SCHED_FIFO scheduling policy
+/// @param[in] opt_value String with value of command line option
+///
+/// @return 0 on success
+/// @return -1 on failure
+int cwdaemon_option_rt_priority(int * priority, char const * opt_value);
+
+
+
+
+/// @brief Parse value of "--idle-suspend" command line option
+///
+/// @param[out] seconds Parsed time of inactivity, zero to disable suspension
+/// @param[in] opt_value String with value of command line option
+///
+/// @return 0 on success
+/// @return -1 on failure
+int cwdaemon_option_idle_suspend(unsigned int * seconds, char const * opt_value);
+
+
+
+
+/// @brief Parse value of "--sidetone" command line option
+///
+/// The value is "alsa" (default ALSA device), "alsa:<device>" (given ALSA
+/// device), or "pcm:<path>" (raw PCM written to named pipe or file).
+///
+/// @param[out] sink Parsed sink of sidetone
+/// @param[in] opt_value String with value of command line option
+///
+/// @return 0 on success
+/// @return -1 on failure
+int cwdaemon_option_sidetone(sidetone_sink_t * sink, char const * opt_value);
+
+
+
+
+/// @brief Parse value of "--ready-fd" command line option
+///
+/// The value is a number of file descriptor inherited from parent process,
+/// open for writing. The descriptor is marked as close-on-exec.
+///
+/// @param[out] fd Parsed file descriptor
+/// @param[in] opt_value String with value of command line option
+///
+/// @return 0 on success
+/// @return -1 on failure
+int cwdaemon_option_ready_fd(int * fd, char const * opt_value);
+
+
+
+
+/// @brief Parse value of "--rt-cpus" command line option
+///
+/// The value is a comma-separated list of CPU numbers or ranges of CPU
+/// numbers, e.g. "2" or "0,2-3".
+///
+/// @param[out] cpus Mask of CPUs, bit N set for CPU number N
+/// @param[in] opt_value String with value of command line option
+///
+/// @return 0 on success
+/// @return -1 on failure
+int cwdaemon_option_rt_cpus(uint64_t * cpus, char const * opt_value);
+
+
+
+
+/// @brief Parse value of "--channel" command line option
+///
+/// The value is "<port>:<cwdevice>": network port on which requests of the
+/// keying channel are received, and name or path of cwdevice keyed by the
+/// channel.
+///
+/// @param[out] port Parsed network port
+/// @param[out] device Buffer for parsed name of cwdevice
+/// @param[in] size Size of @p device buffer
+/// @param[in] opt_value String with value of command line option
+///
+/// @return 0 on success
+/// @return -1 on failure
+int cwdaemon_option_channel(in_port_t * port, char * device, size_t size, char const * opt_value);
+
+
+
+
+/// @brief Parse value of "--unix-socket" command line option
+///
+/// The value is an absolute path of Unix-domain datagram socket. Path is
+/// absolute because daemonized cwdaemon changes its working directory.
+///
+/// @param[out] path Parsed path, pointing to @p opt_value
+/// @param[in] opt_value String with value of command line option
+///
+/// @return 0 on success
+/// @return -1 on failure
+int cwdaemon_option_unix_socket(char const ** path, char const * opt_value);
+
+
+
+
+/// @brief Parse value of "--udp-rcvbuf" or "--unix-rcvbuf" command line option
+///
+/// @param[out] size Parsed size of receive buffer of socket [bytes], zero for system's default
+/// @param[in] opt_value String with value of command line option
+///
+/// @return 0 on success
+/// @return -1 on failure
+int cwdaemon_option_rcvbuf(int * size, char const * opt_value);
+
+
+
+
 #endif /* #ifndef CWDAEMON_OPTIONS_H */
 
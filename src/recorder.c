@@ -0,0 +1,376 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Recording cwdevice: records edges of output lines into a ring in a
+/// memory-mapped file. See recorder.h for layout of the file.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cwdaemon.h"
+#include "log.h"
+#include "recorder.h"
+
+
+
+
+/// Bits of cwdevice::shadow::lines used by recording cwdevice.
+#define RECORDER_SHADOW_KEY     0x01u
+#define RECORDER_SHADOW_PTT     0x02u
+#define RECORDER_SHADOW_SSBWAY  0x04u
+
+
+
+
+static size_t recorder_file_size(unsigned int capacity);
+static recorder_edge_t * recorder_records(recorder_file_header_t const * header);
+static void recorder_write(cwdevice * dev, recorder_line_t line, uint32_t value);
+static void recorder_set_line(cwdevice * dev, unsigned int bit, recorder_line_t line, int onoff);
+
+
+
+
+static size_t recorder_file_size(unsigned int capacity)
+{
+	return sizeof (recorder_file_header_t) + (size_t) capacity * sizeof (recorder_edge_t);
+}
+
+
+
+
+static recorder_edge_t * recorder_records(recorder_file_header_t const * header)
+{
+	return (recorder_edge_t *) ((uint8_t *) header + sizeof (recorder_file_header_t));
+}
+
+
+
+
+int recorder_probe_cwdevice(const char * fname)
+{
+	size_t const prefix_len = strlen(RECORDER_DEVICE_PREFIX);
+	if (0 != strncmp(fname, RECORDER_DEVICE_PREFIX, prefix_len)) {
+		return -1;
+	}
+	char const * path = fname + prefix_len;
+	if ('\0' == path[0]) {
+		log_error("Missing path of file in name of recording cwdevice [%s]", fname);
+		return -1;
+	}
+
+	int const fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (-1 == fd) {
+		log_error("Failed to open file of recording cwdevice [%s]: %s", path, strerror(errno));
+		return -1;
+	}
+	return fd;
+}
+
+
+
+
+int recorder_init(cwdevice * dev, int fd)
+{
+	dev->fd = fd;
+	dev->shadow.valid = false;
+	dev->shadow.data_valid = false;
+	dev->latency_us = 0;
+
+	size_t const size = recorder_file_size(RECORDER_CAPACITY_DEFAULT);
+	if (0 != ftruncate(fd, (off_t) size)) {
+		log_error("Failed to set size of file of recording cwdevice [%s]: %s", dev->desc, strerror(errno));
+		return -1;
+	}
+	void * const base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == base) {
+		log_error("Failed to map file of recording cwdevice [%s]: %s", dev->desc, strerror(errno));
+		return -1;
+	}
+
+	// The file has been truncated and extended, so it's filled with zeros.
+	recorder_file_header_t * const header = (recorder_file_header_t *) base;
+	header->version = RECORDER_VERSION;
+	header->capacity = RECORDER_CAPACITY_DEFAULT;
+	header->record_size = sizeof (recorder_edge_t);
+	header->writer_pid = (uint32_t) getpid();
+	__atomic_store_n(&header->magic, RECORDER_MAGIC, __ATOMIC_RELEASE);
+
+	dev->recorder.header = header;
+	dev->recorder.size = size;
+
+	// Record initial state of lines.
+	dev->reset_pins_state(dev);
+
+	return 0;
+}
+
+
+
+
+int recorder_free(cwdevice * dev)
+{
+	if (NULL == dev->recorder.header) {
+		return 0;
+	}
+
+	// Readers see final state of lines, like on a real device that is
+	// being closed.
+	dev->reset_pins_state(dev);
+
+	msync(dev->recorder.header, dev->recorder.size, MS_ASYNC);
+	munmap(dev->recorder.header, dev->recorder.size);
+	dev->recorder.header = NULL;
+	dev->recorder.size = 0;
+
+	close(dev->fd);
+	dev->fd = -1;
+	dev->shadow.valid = false;
+	dev->shadow.data_valid = false;
+
+	return 0;
+}
+
+
+
+
+int recorder_reset_pins_state(cwdevice * dev)
+{
+	recorder_set_line(dev, RECORDER_SHADOW_KEY, RECORDER_LINE_KEY, 0);
+	recorder_set_line(dev, RECORDER_SHADOW_PTT, RECORDER_LINE_PTT, 0);
+	dev->shadow.valid = true;
+
+	return 0;
+}
+
+
+
+
+int recorder_cw(cwdevice * dev, int onoff)
+{
+	recorder_set_line(dev, RECORDER_SHADOW_KEY, RECORDER_LINE_KEY, onoff);
+	return 0;
+}
+
+
+
+
+int recorder_ptt(cwdevice * dev, int onoff)
+{
+	recorder_set_line(dev, RECORDER_SHADOW_PTT, RECORDER_LINE_PTT, onoff);
+	return 0;
+}
+
+
+
+
+int recorder_ssbway(cwdevice * dev, int onoff)
+{
+	recorder_set_line(dev, RECORDER_SHADOW_SSBWAY, RECORDER_LINE_SSBWAY, onoff);
+	return 0;
+}
+
+
+
+
+int recorder_switchband(cwdevice * dev, unsigned char bitpattern)
+{
+	if (dev->shadow.data_valid && dev->shadow.data == bitpattern) {
+		return 0;
+	}
+	recorder_write(dev, RECORDER_LINE_BAND, bitpattern);
+	dev->shadow.data = bitpattern;
+	dev->shadow.data_valid = true;
+
+	return 0;
+}
+
+
+
+
+/// @brief Record new state of a line if the state differs from last recorded state
+///
+/// Until the first reset of pins the state of lines is unknown, so every
+/// change is recorded.
+static void recorder_set_line(cwdevice * dev, unsigned int bit, recorder_line_t line, int onoff)
+{
+	unsigned int const lines = onoff ? (dev->shadow.lines | bit) : (dev->shadow.lines & ~bit);
+	if (dev->shadow.valid && lines == dev->shadow.lines) {
+		return;
+	}
+	recorder_write(dev, line, onoff ? 1 : 0);
+	dev->shadow.lines = lines;
+
+	return;
+}
+
+
+
+
+/// @brief Write a single edge to the ring
+///
+/// Lines of cwdevice are changed from more than one thread (key and PTT
+/// from keying I/O thread, SSB way and band switch from main thread), so
+/// positions in the ring are claimed atomically.
+static void recorder_write(cwdevice * dev, recorder_line_t line, uint32_t value)
+{
+	recorder_file_header_t * const header = dev->recorder.header;
+	if (NULL == header) {
+		return;
+	}
+
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	uint64_t const pos = __atomic_fetch_add(&header->head, 1, __ATOMIC_RELAXED);
+	recorder_edge_t * const record = &recorder_records(header)[pos & (header->capacity - 1)];
+
+	__atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	record->timestamp_ns = (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+	record->line = (uint32_t) line;
+	record->value = value;
+
+	__atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return;
+}
+
+
+
+
+int recorder_map_open(recorder_map_t * map, char const * path)
+{
+	memset(map, 0, sizeof (recorder_map_t));
+
+	int const fd = open(path, O_RDONLY);
+	if (-1 == fd) {
+		log_error("Failed to open file of recording cwdevice [%s]: %s", path, strerror(errno));
+		return -1;
+	}
+	struct stat st = { 0 };
+	if (0 != fstat(fd, &st) || (size_t) st.st_size < sizeof (recorder_file_header_t)) {
+		log_error("File of recording cwdevice [%s] is too short", path);
+		close(fd);
+		return -1;
+	}
+
+	void * const base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == base) {
+		log_error("Failed to map file of recording cwdevice [%s]: %s", path, strerror(errno));
+		return -1;
+	}
+
+	recorder_file_header_t const * const header = (recorder_file_header_t const *) base;
+	if (RECORDER_MAGIC != __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE)
+	    || RECORDER_VERSION != header->version
+	    || sizeof (recorder_edge_t) != header->record_size
+	    || 0 == header->capacity
+	    || 0 != (header->capacity & (header->capacity - 1))
+	    || (size_t) st.st_size < recorder_file_size(header->capacity)) {
+
+		log_error("File [%s] is not a valid file of recording cwdevice", path);
+		munmap(base, (size_t) st.st_size);
+		return -1;
+	}
+
+	map->header = header;
+	map->size = (size_t) st.st_size;
+
+	uint64_t const head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	map->cursor = head > header->capacity ? head - header->capacity : 0;
+
+	return 0;
+}
+
+
+
+
+void recorder_map_close(recorder_map_t * map)
+{
+	if (map->header) {
+		munmap((void *) map->header, map->size);
+		map->header = NULL;
+		map->size = 0;
+	}
+	return;
+}
+
+
+
+
+size_t recorder_map_read(recorder_map_t * map, recorder_edge_t * edges, size_t size)
+{
+	recorder_file_header_t const * const header = map->header;
+	recorder_edge_t const * const records = recorder_records(header);
+
+	size_t n = 0;
+	while (n < size) {
+		uint64_t const head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+		if (map->cursor >= head) {
+			break;
+		}
+		if (head - map->cursor > header->capacity) {
+			// Reader has fallen behind, oldest records were overwritten.
+			map->lost += head - map->cursor - header->capacity;
+			map->cursor = head - header->capacity;
+		}
+
+		recorder_edge_t const * const record = &records[map->cursor & (header->capacity - 1)];
+		uint64_t const seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+		if (seq < map->cursor + 1) {
+			break; // Claimed by writer, but not published yet.
+		}
+		recorder_edge_t copy = *record;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq != map->cursor + 1 || seq != __atomic_load_n(&record->seq, __ATOMIC_RELAXED)) {
+			// Overwritten before or while we were copying it.
+			map->lost++;
+			map->cursor++;
+			continue;
+		}
+		copy.seq = seq;
+		edges[n++] = copy;
+		map->cursor++;
+	}
+
+	return n;
+}
+
@@ -0,0 +1,185 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_RECORDER_H
+#define CWDAEMON_RECORDER_H
+
+
+
+
+/// @file
+///
+/// Recording cwdevice: a virtual keying device that doesn't key anything,
+/// but writes each transition of its output lines (key, PTT, SSB way, band
+/// switch), with CLOCK_MONOTONIC time stamp, into a ring in a memory-mapped
+/// file.
+///
+/// The device is selected with "-d record:<path>", e.g.
+/// "-d record:/dev/shm/cwdaemon.rec". Test programs and external tools map
+/// the file with recorder_map_open() and read exact edges with
+/// recorder_map_read(), without hardware and without polling of pins.
+///
+/// Layout of the file:
+///
+/// <verbatim>
+///     recorder_file_header_t
+///     recorder_edge_t [capacity]
+/// </verbatim>
+///
+/// A writer claims a position by incrementing "head" of the file, fills
+/// the record at the position, and publishes it by writing the position to
+/// "seq" of the record. The ring is overwritten when a reader falls behind
+/// by more than "capacity" records.
+
+
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+
+#define RECORDER_MAGIC    0x52445743u /**< "CWDR" in a little-endian file. */
+#define RECORDER_VERSION  1u
+
+#define RECORDER_CAPACITY_DEFAULT  65536u /**< Records in the ring. Must be a power of two. */
+
+/// Prefix of cwdevice name that selects recording cwdevice.
+#define RECORDER_DEVICE_PREFIX "record:"
+
+
+
+
+/// Output lines of cwdevice whose changes are recorded.
+///
+/// Values of the enum are stored in the file, so don't change existing
+/// values. Add new values at the end.
+typedef enum {
+	RECORDER_LINE_NONE   = 0,
+	RECORDER_LINE_KEY    = 1, /**< value: 1 for key down, 0 for key up. */
+	RECORDER_LINE_PTT    = 2, /**< value: 1 for PTT on, 0 for PTT off. */
+	RECORDER_LINE_SSBWAY = 3, /**< value: SOUNDCARD or MICROPHONE. */
+	RECORDER_LINE_BAND   = 4, /**< value: bit pattern of band switch. */
+} recorder_line_t;
+
+
+
+
+/// A single edge in the ring. Size of the record is 32 bytes.
+typedef struct {
+	/// One-based position of the record in the ring. Zero when the
+	/// record is being written, or has never been written.
+	uint64_t seq;
+	uint64_t timestamp_ns; ///< CLOCK_MONOTONIC time stamp of the edge.
+	uint32_t line;         ///< One of recorder_line_t values.
+	uint32_t value;        ///< New state of the line.
+	uint32_t reserved[2];
+} recorder_edge_t;
+
+
+
+
+/// Header at the beginning of the file.
+typedef struct recorder_file_header_s {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;      ///< Count of records in the ring.
+	uint32_t record_size;
+	uint64_t head;          ///< Count of positions claimed by writers.
+	uint32_t writer_pid;
+	uint32_t reserved[9];
+} recorder_file_header_t;
+
+
+
+
+struct cwdev_s;
+
+
+
+
+/// @brief Try opening a recording cwdevice with given device name
+///
+/// @param[in] fname Device name in form "record:<path>"
+///
+/// @return file descriptor of created file on success
+/// @return -1 if @p fname doesn't select recording cwdevice, or on failure
+int recorder_probe_cwdevice(const char * fname);
+
+int recorder_init(struct cwdev_s * dev, int fd);
+int recorder_free(struct cwdev_s * dev);
+/// Reset pins of cwdevice to initial states
+int recorder_reset_pins_state(struct cwdev_s * dev);
+int recorder_cw(struct cwdev_s * dev, int onoff);
+int recorder_ptt(struct cwdev_s * dev, int onoff);
+int recorder_ssbway(struct cwdev_s * dev, int onoff);
+int recorder_switchband(struct cwdev_s * dev, unsigned char bitpattern);
+
+
+
+
+/// Read-only view of file of recording cwdevice, used by readers.
+typedef struct {
+	recorder_file_header_t const * header;
+	size_t size; ///< Size of mapped region.
+
+	uint64_t cursor; ///< Position of next record to be read.
+	uint64_t lost;   ///< Count of records overwritten before they were read.
+} recorder_map_t;
+
+
+
+
+/// @brief Map existing file of recording cwdevice for reading
+///
+/// Reading starts at oldest record present in the ring.
+///
+/// @return 0 on success
+/// @return -1 on failure
+int recorder_map_open(recorder_map_t * map, char const * path);
+
+
+
+
+void recorder_map_close(recorder_map_t * map);
+
+
+
+
+/// @brief Copy edges recorded since previous call
+///
+/// Edges are copied in order in which they were recorded. The function
+/// stops at a record that is still being written.
+///
+/// @param map File mapped with recorder_map_open()
+/// @param[out] edges Output buffer
+/// @param[in] size Count of edges that fit into @p edges
+///
+/// @return count of edges copied to @p edges
+size_t recorder_map_read(recorder_map_t * map, recorder_edge_t * edges, size_t size);
+
+
+
+
+#endif /* #ifndef CWDAEMON_RECORDER_H */
+
@@ -0,0 +1,239 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Real-time scheduling profile of cwdaemon: SCHED_FIFO policy, locked
+/// memory, CPU affinity and timer slack.
+
+
+
+
+#define _GNU_SOURCE /* CPU_SET() and sched_setaffinity(). */
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#if HAVE_SYS_PRCTL_H
+#include <sys/prctl.h>
+#endif
+
+#include "log.h"
+#include "rt.h"
+
+
+
+
+/// Profile of keying threads, and defaults to which rt_thread_restore()
+/// reverts. Written by main thread before keying threads are started.
+static struct {
+	rt_profile_t profile;
+	bool memory_locked;
+	bool have_default_cpus;
+#if HAVE_SCHED_SETAFFINITY
+	cpu_set_t default_cpus;
+#endif
+	long default_slack_ns;
+} g_rt;
+
+
+
+
+static void rt_profile_report(char const * name, bool granted);
+
+
+
+
+bool rt_profile_set(rt_profile_t const * profile)
+{
+	g_rt.profile = *profile;
+	g_rt.memory_locked = false;
+	g_rt.default_slack_ns = -1;
+#if HAVE_SCHED_SETAFFINITY
+	CPU_ZERO(&g_rt.default_cpus);
+	g_rt.have_default_cpus = 0 == sched_getaffinity(0, sizeof (g_rt.default_cpus), &g_rt.default_cpus);
+#endif
+#if HAVE_SYS_PRCTL_H && defined(PR_GET_TIMERSLACK)
+	g_rt.default_slack_ns = (long) prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL);
+#endif
+
+	if (0 == profile->priority) {
+		return true;
+	}
+
+	bool granted = true;
+#if HAVE_MLOCKALL
+	// Don't let page faults delay keying.
+	if (0 == mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		g_rt.memory_locked = true;
+	} else {
+		log_warning("Failed to lock memory: %s", strerror(errno));
+		granted = false;
+	}
+#else
+	log_warning("Locking memory is not supported on this platform %s", "");
+	granted = false;
+#endif
+
+	return granted;
+}
+
+
+
+
+bool rt_thread_apply(char const * name)
+{
+	rt_profile_t const * const profile = &g_rt.profile;
+	if (0 == profile->priority && 0 == profile->cpus) {
+		return true;
+	}
+
+	bool granted = true;
+
+	if (profile->priority > 0) {
+		struct sched_param param = { .sched_priority = profile->priority };
+		int const retv = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (0 != retv) {
+			log_warning("Failed to set SCHED_FIFO policy with priority %d for %s thread: %s", profile->priority, name, strerror(retv));
+			granted = false;
+		}
+
+#if HAVE_SYS_PRCTL_H && defined(PR_SET_TIMERSLACK)
+		// Wake up from sleeps on time, not up to 50 us later.
+		if (0 != prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL)) {
+			log_warning("Failed to set timer slack for %s thread: %s", name, strerror(errno));
+			granted = false;
+		}
+#endif
+	}
+
+	if (0 != profile->cpus) {
+#if HAVE_SCHED_SETAFFINITY
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (int cpu = 0; cpu < CWDAEMON_RT_CPUS_MAX; cpu++) {
+			if (profile->cpus & (UINT64_C(1) << cpu)) {
+				CPU_SET(cpu, &cpus);
+			}
+		}
+		// On Linux zero is the calling thread, not the whole process.
+		if (0 != sched_setaffinity(0, sizeof (cpus), &cpus)) {
+			log_warning("Failed to set CPU affinity of %s thread: %s", name, strerror(errno));
+			granted = false;
+		}
+#else
+		log_warning("Setting CPU affinity is not supported on this platform %s", "");
+		granted = false;
+#endif
+	}
+
+	rt_profile_report(name, granted);
+
+	return granted;
+}
+
+
+
+
+void rt_thread_restore(void)
+{
+	rt_profile_t const * const profile = &g_rt.profile;
+
+	if (profile->priority > 0) {
+		struct sched_param param = { .sched_priority = 0 };
+		pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+#if HAVE_SYS_PRCTL_H && defined(PR_SET_TIMERSLACK)
+		if (g_rt.default_slack_ns > 0) {
+			prctl(PR_SET_TIMERSLACK, (unsigned long) g_rt.default_slack_ns, 0UL, 0UL, 0UL);
+		}
+#endif
+	}
+
+#if HAVE_SCHED_SETAFFINITY
+	if (0 != profile->cpus && g_rt.have_default_cpus) {
+		sched_setaffinity(0, sizeof (g_rt.default_cpus), &g_rt.default_cpus);
+	}
+#endif
+
+	return;
+}
+
+
+
+
+/// @brief Log settings that are actually in effect for calling thread
+///
+/// The settings are read back from the kernel instead of being copied from
+/// requested profile.
+///
+/// @param[in] name Name of the thread
+/// @param[in] granted Whether all requested settings have been granted
+static void rt_profile_report(char const * name, bool granted)
+{
+	int policy = 0;
+	struct sched_param param = { 0 };
+	pthread_getschedparam(pthread_self(), &policy, &param);
+	char const * policy_name = SCHED_FIFO == policy ? "SCHED_FIFO" : (SCHED_RR == policy ? "SCHED_RR" : "SCHED_OTHER");
+
+	char cpus_str[3 * CWDAEMON_RT_CPUS_MAX + 1] = "unknown";
+#if HAVE_SCHED_SETAFFINITY
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	if (0 == sched_getaffinity(0, sizeof (cpus), &cpus)) {
+		size_t len = 0;
+		cpus_str[0] = '\0';
+		for (int cpu = 0; cpu < CWDAEMON_RT_CPUS_MAX; cpu++) {
+			if (CPU_ISSET(cpu, &cpus)) {
+				int const n = snprintf(cpus_str + len, sizeof (cpus_str) - len, "%s%d", len ? "," : "", cpu);
+				if (n < 0 || (size_t) n >= sizeof (cpus_str) - len) {
+					break;
+				}
+				len += (size_t) n;
+			}
+		}
+	}
+#endif
+
+	long slack_ns = -1;
+#if HAVE_SYS_PRCTL_H && defined(PR_GET_TIMERSLACK)
+	slack_ns = (long) prctl(PR_GET_TIMERSLACK, 0UL, 0UL, 0UL, 0UL);
+#endif
+
+	// Make the report visible with default log threshold if something was
+	// not granted.
+	log_message(granted ? LOG_INFO : LOG_WARNING,
+	            "Real-time profile of %s thread: policy %s, priority %d, CPUs %s, memory %s, timer slack %ld ns",
+	            name, policy_name, param.sched_priority, cpus_str, g_rt.memory_locked ? "locked" : "not locked", slack_ns);
+
+	return;
+}
+
@@ -0,0 +1,117 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_RT_H
+#define CWDAEMON_RT_H
+
+
+
+
+/// @file
+///
+/// Real-time scheduling profile of cwdaemon.
+///
+/// The profile is set once by main thread, and then each keying-critical
+/// thread (keying engine, keying I/O, sidetone) applies it to itself when
+/// it starts. Main thread and helper threads (network, input, sound probe,
+/// logging) keep the default scheduling. libcw's generator thread is
+/// created inside of libcw, so the thread that starts the generator
+/// applies the profile only for the time of the start, and the generator
+/// thread inherits it.
+
+
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+
+#define CWDAEMON_RT_PRIORITY_MIN     1
+#define CWDAEMON_RT_PRIORITY_MAX    99
+#define CWDAEMON_RT_CPUS_MAX        64 /**< CPUs are stored in a 64-bit mask. */
+
+
+
+
+typedef struct {
+	/// Priority for SCHED_FIFO policy. Zero: don't use real-time
+	/// scheduling, don't lock memory, don't change timer slack.
+	int priority;
+
+	/// Mask of CPUs to which to pin the threads. Zero: don't change CPU
+	/// affinity.
+	uint64_t cpus;
+} rt_profile_t;
+
+
+
+
+/// @brief Set real-time profile of keying threads
+///
+/// The profile is remembered for rt_thread_apply(). Memory of the process
+/// is locked right away, because locking can't be limited to some threads.
+///
+/// Call the function before any keying-critical thread is started.
+///
+/// Failures to get requested settings (e.g. due to missing privileges) are
+/// not fatal: they are logged.
+///
+/// @param[in] profile Profile of keying threads
+///
+/// @return true if all requested process-wide settings have been granted
+/// @return false otherwise
+bool rt_profile_set(rt_profile_t const * profile);
+
+
+
+
+/// @brief Apply real-time profile to calling thread
+///
+/// Scheduling policy, CPU affinity and timer slack of calling thread are
+/// changed according to profile set with rt_profile_set(). Without the
+/// profile the function does nothing.
+///
+/// Failures to get requested settings are not fatal: they are logged, and
+/// what was actually granted is reported.
+///
+/// @param[in] name Name of the thread, for logs
+///
+/// @return true if all requested settings have been granted
+/// @return false otherwise
+bool rt_thread_apply(char const * name);
+
+
+
+
+/// @brief Restore default scheduling of calling thread
+///
+/// Revert changes made by rt_thread_apply(): default policy, CPU affinity
+/// of the process and timer slack from the time of rt_profile_set().
+void rt_thread_restore(void);
+
+
+
+
+#endif /* #ifndef CWDAEMON_RT_H */
+
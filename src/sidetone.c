@@ -0,0 +1,432 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Real-time sidetone of native keying engine.
+///
+/// See sidetone.h for description of the sidetone.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#include "engine.h"
+#include "log.h"
+#include "rt.h"
+#include "sidetone.h"
+#include "synth.h"
+
+
+
+
+#define SIDETONE_NANOSECS_PER_SEC  1000000000ULL
+
+/// If sidetone thread falls behind by more than this count of blocks
+/// (e.g. the process was stopped), it skips the blocks instead of
+/// rendering all of them at once.
+#define SIDETONE_BLOCKS_BEHIND_MAX  8
+
+
+
+
+/// Edge of keying schedule.
+typedef struct {
+	uint64_t timestamp_ns;
+	bool key;
+} sidetone_edge_t;
+
+
+
+
+/// Sink opened by sidetone_open().
+typedef struct {
+	sidetone_sink_type_t type;
+	int fd;                 ///< File descriptor of raw PCM sink.
+#if HAVE_ALSA
+	snd_pcm_t * pcm;        ///< Handle of ALSA sink.
+#endif
+	unsigned long dropped;  ///< Count of blocks that couldn't be written.
+} sidetone_output_t;
+
+
+
+
+static sidetone_sink_t g_sidetone_sink = { .type = SIDETONE_SINK_NONE };
+
+static struct {
+	pthread_t thread;
+	bool running;  ///< Accessed atomically, written by thread calling sidetone_open()/sidetone_close().
+	synth_t synth;
+	sidetone_output_t output;
+
+	/// Single-producer (keying engine), single-consumer (sidetone
+	/// thread) queue of edges.
+	sidetone_edge_t edges[SIDETONE_EDGES_CAPACITY];
+	unsigned int edges_head; ///< Written by producer.
+	unsigned int edges_tail; ///< Written by consumer.
+	unsigned long edges_dropped;
+
+	int frequency; ///< Accessed atomically.
+	int volume;    ///< Accessed atomically.
+} g_sidetone = {
+	.frequency = 800,
+	.volume = 70,
+};
+
+
+
+
+static int sidetone_output_open(sidetone_output_t * output, sidetone_sink_t const * sink);
+static void sidetone_output_close(sidetone_output_t * output);
+static void sidetone_output_write(sidetone_output_t * output, int16_t const * frames, size_t count);
+static void * sidetone_thread(void * arg);
+static uint64_t sidetone_now_ns(void);
+
+
+
+
+void sidetone_set_sink(sidetone_sink_t const * sink)
+{
+	g_sidetone_sink = *sink;
+}
+
+
+
+
+bool sidetone_supports_audio_system(int audio_system)
+{
+	if (SIDETONE_SINK_NONE == g_sidetone_sink.type) {
+		return false;
+	}
+	return CW_AUDIO_ALSA == audio_system || CW_AUDIO_SOUNDCARD == audio_system;
+}
+
+
+
+
+bool sidetone_probe(int audio_system)
+{
+	if (CW_AUDIO_NULL == audio_system) {
+		return true;
+	}
+	if (!sidetone_supports_audio_system(audio_system)) {
+		return false;
+	}
+	if (__atomic_load_n(&g_sidetone.running, __ATOMIC_ACQUIRE)) {
+		/* The sink is already open, and it may be impossible to open
+		   it for the second time (e.g. ALSA's hw device). */
+		return true;
+	}
+
+	sidetone_output_t output = { 0 };
+	if (0 != sidetone_output_open(&output, &g_sidetone_sink)) {
+		return false;
+	}
+	sidetone_output_close(&output);
+	return true;
+}
+
+
+
+
+int sidetone_open(int audio_system)
+{
+	if (!sidetone_supports_audio_system(audio_system)) {
+		log_error("Sidetone can't be played on sound system \"%s\"", engine_get_audio_system_label(audio_system));
+		return -1;
+	}
+	if (__atomic_load_n(&g_sidetone.running, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+
+	synth_init(&g_sidetone.synth, SYNTH_SAMPLE_RATE_DEFAULT, SYNTH_RISE_US_DEFAULT);
+	if (0 != sidetone_output_open(&g_sidetone.output, &g_sidetone_sink)) {
+		return -1;
+	}
+	g_sidetone.edges_head = 0;
+	g_sidetone.edges_tail = 0;
+	g_sidetone.edges_dropped = 0;
+	__atomic_store_n(&g_sidetone.running, true, __ATOMIC_RELEASE);
+
+	/* The thread should not handle signals sent to cwdaemon. It applies
+	   real-time profile by itself (rt_thread_apply()). */
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int const rv = pthread_create(&g_sidetone.thread, NULL, sidetone_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (0 != rv) {
+		__atomic_store_n(&g_sidetone.running, false, __ATOMIC_RELEASE);
+		sidetone_output_close(&g_sidetone.output);
+		log_error("Failed to start sidetone thread: %s", strerror(rv));
+		return -1;
+	}
+
+	cwdaemon_debug(CWDAEMON_VERBOSITY_I, __func__, __LINE__, "sidetone started on sink [%s]", g_sidetone_sink.path);
+	return 0;
+}
+
+
+
+
+void sidetone_close(void)
+{
+	if (!__atomic_exchange_n(&g_sidetone.running, false, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+	pthread_join(g_sidetone.thread, NULL);
+
+	if (g_sidetone.output.dropped || g_sidetone.edges_dropped) {
+		log_warning("Sidetone has dropped %lu block(s) of samples and %lu edge(s)",
+		            g_sidetone.output.dropped, g_sidetone.edges_dropped);
+	}
+	sidetone_output_close(&g_sidetone.output);
+
+	return;
+}
+
+
+
+
+void sidetone_key(bool key, uint64_t timestamp_ns)
+{
+	if (!__atomic_load_n(&g_sidetone.running, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	unsigned int const head = g_sidetone.edges_head;
+	unsigned int const tail = __atomic_load_n(&g_sidetone.edges_tail, __ATOMIC_ACQUIRE);
+	if (head - tail >= SIDETONE_EDGES_CAPACITY) {
+		g_sidetone.edges_dropped++;
+		return;
+	}
+	g_sidetone.edges[head & (SIDETONE_EDGES_CAPACITY - 1)] = (sidetone_edge_t) { .timestamp_ns = timestamp_ns, .key = key };
+	__atomic_store_n(&g_sidetone.edges_head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+
+
+void sidetone_set_frequency(int frequency)
+{
+	__atomic_store_n(&g_sidetone.frequency, frequency, __ATOMIC_RELAXED);
+}
+
+
+
+
+void sidetone_set_volume(int volume)
+{
+	__atomic_store_n(&g_sidetone.volume, volume, __ATOMIC_RELAXED);
+}
+
+
+
+
+/// @brief Main function of sidetone thread: render and write blocks of samples
+///
+/// Block that spans time from @c start to @c end is rendered after @c end,
+/// so that all edges of the block are already known.
+static void * sidetone_thread(__attribute__((unused)) void * arg)
+{
+	int16_t block[SIDETONE_BLOCK_FRAMES];
+	uint64_t const rate = SYNTH_SAMPLE_RATE_DEFAULT;
+	uint64_t const block_ns = SIDETONE_BLOCK_FRAMES * SIDETONE_NANOSECS_PER_SEC / rate;
+	synth_t * const synth = &g_sidetone.synth;
+	bool key = false;
+
+	rt_thread_apply("sidetone");
+	uint64_t start = sidetone_now_ns();
+	while (__atomic_load_n(&g_sidetone.running, __ATOMIC_ACQUIRE)) {
+		uint64_t const end = start + block_ns;
+		struct timespec const deadline = {
+			.tv_sec = (time_t) (end / SIDETONE_NANOSECS_PER_SEC),
+			.tv_nsec = (long) (end % SIDETONE_NANOSECS_PER_SEC),
+		};
+		while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)) {
+			;
+		}
+
+		synth_set_frequency(synth, __atomic_load_n(&g_sidetone.frequency, __ATOMIC_RELAXED));
+		synth_set_volume(synth, __atomic_load_n(&g_sidetone.volume, __ATOMIC_RELAXED));
+
+		size_t done = 0;
+		unsigned int tail = g_sidetone.edges_tail;
+		unsigned int const head = __atomic_load_n(&g_sidetone.edges_head, __ATOMIC_ACQUIRE);
+		for (; tail != head; tail++) {
+			sidetone_edge_t const edge = g_sidetone.edges[tail & (SIDETONE_EDGES_CAPACITY - 1)];
+			if (edge.timestamp_ns >= end) {
+				break; // Belongs to one of next blocks.
+			}
+			/* Edges that arrived too late for their block are
+			   played at the start of current block. */
+			size_t const offset = edge.timestamp_ns <= start ? 0 : (size_t) ((edge.timestamp_ns - start) * rate / SIDETONE_NANOSECS_PER_SEC);
+			if (offset > done) {
+				synth_render(synth, key, block + done, offset - done);
+				done = offset;
+			}
+			key = edge.key;
+		}
+		__atomic_store_n(&g_sidetone.edges_tail, tail, __ATOMIC_RELEASE);
+		synth_render(synth, key, block + done, SIDETONE_BLOCK_FRAMES - done);
+
+		sidetone_output_write(&g_sidetone.output, block, SIDETONE_BLOCK_FRAMES);
+
+		start = end;
+		uint64_t const now = sidetone_now_ns();
+		if (now > start + SIDETONE_BLOCKS_BEHIND_MAX * block_ns) {
+			start = now;
+		}
+	}
+
+	return NULL;
+}
+
+
+
+
+static int sidetone_output_open(sidetone_output_t * output, sidetone_sink_t const * sink)
+{
+	memset(output, 0, sizeof (sidetone_output_t));
+	output->type = sink->type;
+	output->fd = -1;
+
+	switch (sink->type) {
+	case SIDETONE_SINK_PCM:
+		/* Opening a pipe without a reader fails with ENXIO instead of
+		   blocking. */
+		output->fd = open(sink->path, O_WRONLY | O_NONBLOCK | O_CREAT | O_TRUNC, 0644);
+		if (-1 == output->fd) {
+			log_error("Failed to open sidetone sink [%s]: %s", sink->path, strerror(errno));
+			return -1;
+		}
+		return 0;
+
+	case SIDETONE_SINK_ALSA:
+#if HAVE_ALSA
+	{
+		int rv = snd_pcm_open(&output->pcm, sink->path, SND_PCM_STREAM_PLAYBACK, 0);
+		if (rv < 0) {
+			log_error("Failed to open ALSA device [%s] for sidetone: %s", sink->path, snd_strerror(rv));
+			return -1;
+		}
+		rv = snd_pcm_set_params(output->pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED,
+		                        1, SYNTH_SAMPLE_RATE_DEFAULT, 1, SIDETONE_ALSA_LATENCY_US);
+		if (rv < 0) {
+			log_error("Failed to configure ALSA device [%s] for sidetone: %s", sink->path, snd_strerror(rv));
+			snd_pcm_close(output->pcm);
+			output->pcm = NULL;
+			return -1;
+		}
+		/* Start with buffer filled with silence, so that the device
+		   doesn't underrun while sidetone thread renders first block. */
+		int16_t silence[SIDETONE_BLOCK_FRAMES] = { 0 };
+		for (unsigned int us = 0; us < SIDETONE_ALSA_LATENCY_US / 2; us += SIDETONE_BLOCK_FRAMES * 1000000u / SYNTH_SAMPLE_RATE_DEFAULT) {
+			snd_pcm_writei(output->pcm, silence, SIDETONE_BLOCK_FRAMES);
+		}
+		return 0;
+	}
+#else
+		log_error("cwdaemon was built without ALSA, can't open sidetone sink [%s]", sink->path);
+		return -1;
+#endif
+
+	case SIDETONE_SINK_NONE:
+	default:
+		log_error("Sidetone sink is not configured %s", "");
+		return -1;
+	}
+}
+
+
+
+
+static void sidetone_output_close(sidetone_output_t * output)
+{
+	if (-1 != output->fd) {
+		close(output->fd);
+		output->fd = -1;
+	}
+#if HAVE_ALSA
+	if (NULL != output->pcm) {
+		snd_pcm_drop(output->pcm);
+		snd_pcm_close(output->pcm);
+		output->pcm = NULL;
+	}
+#endif
+}
+
+
+
+
+static void sidetone_output_write(sidetone_output_t * output, int16_t const * frames, size_t count)
+{
+	if (-1 != output->fd) {
+		/* Block is smaller than PIPE_BUF, so a write to a pipe is
+		   either complete, or fails with EAGAIN. */
+		ssize_t const n = write(output->fd, frames, count * sizeof (int16_t));
+		if (n != (ssize_t) (count * sizeof (int16_t))) {
+			output->dropped++;
+		}
+	}
+#if HAVE_ALSA
+	if (NULL != output->pcm) {
+		snd_pcm_sframes_t n = snd_pcm_writei(output->pcm, frames, count);
+		if (n < 0) {
+			/* Underrun or suspend. */
+			snd_pcm_recover(output->pcm, (int) n, 1);
+			output->dropped++;
+		}
+	}
+#endif
+}
+
+
+
+
+static uint64_t sidetone_now_ns(void)
+{
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * SIDETONE_NANOSECS_PER_SEC + (uint64_t) now.tv_nsec;
+}
+
@@ -0,0 +1,165 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_SIDETONE_H
+#define CWDAEMON_SIDETONE_H
+
+
+
+
+/// @file
+///
+/// Real-time sidetone of native keying engine.
+///
+/// Native keying engine reports each edge of its keying schedule together
+/// with CLOCK_MONOTONIC time at which the edge was scheduled. Sidetone
+/// thread wakes up at boundaries of blocks of SIDETONE_BLOCK_FRAMES
+/// frames, renders the block that has just ended with synthesizer
+/// (synth.h), placing the edges at frames corresponding to their time
+/// stamps, and writes the block to a sink. Timing of sidetone is
+/// therefore the same as timing of keying of cwdevice, delayed by one
+/// block and by latency of the sink.
+///
+/// Sinks:
+///  - ALSA PCM device (only if cwdaemon was built with ALSA),
+///  - raw PCM (mono, signed 16-bit little-endian samples at
+///    SYNTH_SAMPLE_RATE_DEFAULT) written to a named pipe or file. Writes
+///    don't block: if a reader of a pipe is too slow, blocks are dropped.
+
+
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+
+#define SIDETONE_BLOCK_FRAMES            240 ///< 5 ms at SYNTH_SAMPLE_RATE_DEFAULT.
+#define SIDETONE_EDGES_CAPACITY          256 ///< Capacity of queue of edges. Must be a power of two.
+#define SIDETONE_ALSA_LATENCY_US       20000
+#define SIDETONE_ALSA_DEVICE_DEFAULT  "default"
+#define SIDETONE_SINK_PATH_MAX           256
+
+
+
+
+typedef enum {
+	SIDETONE_SINK_NONE = 0, ///< Sidetone is not configured.
+	SIDETONE_SINK_ALSA,
+	SIDETONE_SINK_PCM,
+} sidetone_sink_type_t;
+
+
+
+
+/// Sink of sidetone, given in "--sidetone" command line option.
+typedef struct {
+	sidetone_sink_type_t type;
+	/// Name of ALSA PCM device, or path to pipe or file with raw PCM.
+	char path[SIDETONE_SINK_PATH_MAX];
+} sidetone_sink_t;
+
+
+
+
+/// @brief Set sink to be used by sidetone
+///
+/// The sink is used by subsequent calls to sidetone_open().
+void sidetone_set_sink(sidetone_sink_t const * sink);
+
+
+
+
+/// @brief Check if sidetone can be played on given sound system
+///
+/// Sidetone is played through configured sink when cwdaemon uses
+/// "soundcard" or "alsa" sound system.
+///
+/// @param[in] audio_system One of CW_AUDIO_* values
+///
+/// @return true if a sink is configured and can be used with @p audio_system
+/// @return false otherwise
+bool sidetone_supports_audio_system(int audio_system);
+
+
+
+
+/// @brief Check if sink can be opened for given sound system
+///
+/// The function may be called from any thread.
+///
+/// @param[in] audio_system One of CW_AUDIO_* values
+///
+/// @return true if sidetone can be opened with @p audio_system ("null" is always available)
+/// @return false otherwise
+bool sidetone_probe(int audio_system);
+
+
+
+
+/// @brief Open sink and start sidetone thread
+///
+/// @param[in] audio_system One of CW_AUDIO_* values, other than "null"
+///
+/// @return 0 on success
+/// @return -1 on failure
+int sidetone_open(int audio_system);
+
+
+
+
+/// @brief Stop sidetone thread and close sink
+///
+/// The function does nothing if sidetone is not open.
+void sidetone_close(void);
+
+
+
+
+/// @brief Pass edge of keying schedule to sidetone
+///
+/// The function must not be called from two threads at the same time
+/// (instances of native keying engine serialize their calls). It doesn't
+/// block. It does nothing if sidetone is not open.
+///
+/// @param[in] key New state of key
+/// @param[in] timestamp_ns CLOCK_MONOTONIC time of the edge
+void sidetone_key(bool key, uint64_t timestamp_ns);
+
+
+
+
+/// @brief Set frequency of sidetone, in Hz
+void sidetone_set_frequency(int frequency);
+
+
+
+
+/// @brief Set volume of sidetone, in percents
+void sidetone_set_volume(int volume);
+
+
+
+
+#endif /* #ifndef CWDAEMON_SIDETONE_H */
+
@@ -47,6 +47,9 @@
 
    TODO acerion 2024.01.07: be aware of the duplication and try to keep the
    files in the two locations in sync.
+
+   In virtual clock mode (vclock.h) the functions sleep on the virtual
+   clock.
 */
 
 
@@ -66,6 +69,7 @@
 #include <unistd.h>
 
 #include "sleep.h"
+#include "vclock.h"
 
 
 
@@ -73,6 +77,11 @@
 // @reviewed_on{2024.05.10}
 int microsleep_nonintr(unsigned int usecs)
 {
+	if (vclock_enabled()) {
+		vclock_sleep_ns((uint64_t) usecs * CWDAEMON_NANOSECS_PER_MICROSEC);
+		return 0;
+	}
+
 	const unsigned long seconds = usecs / CWDAEMON_MICROSECS_PER_SEC;
 	const unsigned long micros  = usecs % CWDAEMON_MICROSECS_PER_SEC;
 	struct timespec remaining = {
@@ -121,6 +130,11 @@ int sleep_nonintr(unsigned int secs)
 	  doing a multiplication of function argument by 10^6 and then dividing
 	  argument again back by 10^6.
 	*/
+	if (vclock_enabled()) {
+		vclock_sleep_ns((uint64_t) secs * CWDAEMON_NANOSECS_PER_SEC);
+		return 0;
+	}
+
 	struct timespec remaining = {
 		.tv_sec  = secs,
 		.tv_nsec = 0
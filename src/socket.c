@@ -23,6 +23,8 @@
 
 
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "config.h"
 
 #if HAVE_ARPA_INET_H
@@ -30,12 +32,24 @@
 #endif
 #include <assert.h>
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "log.h"
 #include "socket.h"
+#include "trace.h"
+#include "vclock.h"
+
+
+
+
+static bool cwdaemon_initialize_unix_socket(cwdaemon_t * cwdaemon);
+static bool cwdaemon_bind_unix_socket(cwdaemon_t * cwdaemon);
+static bool cwdaemon_socket_set_rcvbuf(int fd, int size, char const * name);
 
 
 
@@ -43,7 +57,9 @@
 /**
    \brief Initialize network variables in @p cwdaemon
 
-   Initialize network socket and other network variables.
+   Initialize network socket and other network variables. If path of
+   Unix-domain socket is set in @p cwdaemon, the Unix-domain socket is
+   initialized too.
 
    \param cwdaemon cwdaemon instance
 
@@ -52,24 +68,29 @@
 */
 bool cwdaemon_initialize_socket(cwdaemon_t * cwdaemon)
 {
+	struct sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(cwdaemon->network_port);
 	memset(&cwdaemon->request_addr, '\0', sizeof (cwdaemon->request_addr));
-	cwdaemon->request_addr.sin_family = AF_INET;
-	cwdaemon->request_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-	cwdaemon->request_addr.sin_port = htons(cwdaemon->network_port);
-	cwdaemon->request_addrlen = sizeof (cwdaemon->request_addr);
+	memcpy(&cwdaemon->request_addr, &addr, sizeof (addr));
+	cwdaemon->request_addrlen = sizeof (addr);
 
-	cwdaemon->socket_descriptor = socket(AF_INET, SOCK_DGRAM, 0);
+	/* Socket passed by service manager is already bound. */
 	if (cwdaemon->socket_descriptor == -1) {
-		cwdaemon_errmsg("Socket open");
-		return false;
-	}
+		cwdaemon->socket_descriptor = socket(AF_INET, SOCK_DGRAM, 0);
+		if (cwdaemon->socket_descriptor == -1) {
+			cwdaemon_errmsg("Socket open");
+			return false;
+		}
 
-	if (bind(cwdaemon->socket_descriptor,
-		 (struct sockaddr *) &cwdaemon->request_addr,
-		 cwdaemon->request_addrlen) == -1) {
+		if (bind(cwdaemon->socket_descriptor,
+			 (struct sockaddr *) &addr,
+			 sizeof (addr)) == -1) {
 
-		cwdaemon_errmsg("Bind");
-		return false;
+			cwdaemon_errmsg("Bind");
+			return false;
+		}
 	}
 
 	int save_flags = fcntl(cwdaemon->socket_descriptor, F_GETFL);
@@ -84,12 +105,258 @@ bool cwdaemon_initialize_socket(cwdaemon_t * cwdaemon)
 		return false;
 	}
 
+	if (!cwdaemon_socket_set_rcvbuf(cwdaemon->socket_descriptor, cwdaemon->network_rcvbuf, "UDP")) {
+		return false;
+	}
+
+	if (NULL != cwdaemon->unix_socket_path && !cwdaemon_initialize_unix_socket(cwdaemon)) {
+		return false;
+	}
+
+	return true;
+}
+
+
+
+
+/**
+   \brief Create and bind Unix-domain datagram socket
+
+   Socket file left by previous process (e.g. one that has crashed) is
+   replaced. Access to the socket is controlled with permissions of the
+   socket file: only owner and group of cwdaemon can send requests.
+
+   Socket passed by previous process on hand-over (see
+   cwdaemon_unix_socket_adopt()) is already bound and is only configured.
+
+   \param cwdaemon cwdaemon instance
+
+   \return false on failure
+   \return true on success
+*/
+static bool cwdaemon_initialize_unix_socket(cwdaemon_t * cwdaemon)
+{
+	char const * path = cwdaemon->unix_socket_path;
+	if (cwdaemon->unix_socket_descriptor == -1 && !cwdaemon_bind_unix_socket(cwdaemon)) {
+		return false;
+	}
+	int const fd = cwdaemon->unix_socket_descriptor;
+
+	int const flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		cwdaemon_errmsg("Trying non-blocking");
+		return false;
+	}
+	int const fd_flags = fcntl(fd, F_GETFD);
+	if (fd_flags == -1 || fcntl(fd, F_SETFD, fd_flags | FD_CLOEXEC) == -1) {
+		cwdaemon_errmsg("Trying close-on-exec");
+		return false;
+	}
+
+	if (!cwdaemon_socket_set_rcvbuf(fd, cwdaemon->unix_rcvbuf, "Unix-domain")) {
+		return false;
+	}
+
+	log_info("Listening on Unix-domain socket [%s]", path);
 	return true;
 }
 
 
 
 
+/**
+   \brief Create Unix-domain datagram socket and bind it at configured path
+
+   \param cwdaemon cwdaemon instance
+
+   \return false on failure
+   \return true on success
+*/
+static bool cwdaemon_bind_unix_socket(cwdaemon_t * cwdaemon)
+{
+	char const * path = cwdaemon->unix_socket_path;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof (addr.sun_path)) {
+		log_error("Path of Unix-domain socket is too long: [%s]", path);
+		return false;
+	}
+	snprintf(addr.sun_path, sizeof (addr.sun_path), "%s", path);
+
+	struct stat st = { 0 };
+	if (0 == lstat(path, &st)) {
+		if (!S_ISSOCK(st.st_mode)) {
+			log_error("Can't create Unix-domain socket: [%s] exists and is not a socket", path);
+			return false;
+		}
+		if (0 != unlink(path)) {
+			log_error("Can't remove stale Unix-domain socket [%s]: %s", path, strerror(errno));
+			return false;
+		}
+	}
+
+	int const fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd == -1) {
+		cwdaemon_errmsg("Unix socket open");
+		return false;
+	}
+	cwdaemon->unix_socket_descriptor = fd;
+
+	/* Daemonized process runs with umask(0). Socket file is created
+	   by bind(): without restrictive umask any local user could send
+	   requests between bind() and chmod(). */
+	mode_t const old_umask = umask(S_IXUSR | S_IXGRP | S_IRWXO);
+	int const bind_rv = bind(fd, (struct sockaddr *) &addr, sizeof (addr));
+	int const bind_errno = errno;
+	umask(old_umask);
+	if (bind_rv == -1) {
+		log_error("Can't bind Unix-domain socket [%s]: %s", path, strerror(bind_errno));
+		return false;
+	}
+	/* Mode doesn't depend on umask of non-daemonized process. */
+	if (chmod(path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) == -1) {
+		log_error("Can't set permissions of Unix-domain socket [%s]: %s", path, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+
+
+
+/**
+   \brief Set size of receive buffer of a socket
+
+   \param fd socket
+   \param size requested size of buffer, zero to keep system's default
+   \param name name of the socket, for logs
+
+   \return false on failure
+   \return true on success
+*/
+static bool cwdaemon_socket_set_rcvbuf(int fd, int size, char const * name)
+{
+	if (0 == size) {
+		return true;
+	}
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size)) == -1) {
+		log_error("Can't set receive buffer of %s socket to %d bytes: %s", name, size, strerror(errno));
+		return false;
+	}
+
+	/* The system may adjust the size (e.g. Linux doubles it, and caps it
+	   at net.core.rmem_max). */
+	int actual = 0;
+	socklen_t len = sizeof (actual);
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &actual, &len) == 0) {
+		log_info("Receive buffer of %s socket: requested %d bytes, got %d bytes", name, size, actual);
+	}
+
+	return true;
+}
+
+
+
+
+int cwdaemon_socket_activation(cwdaemon_t * cwdaemon)
+{
+	char const * listen_pid = getenv(SOCKET_ACTIVATION_ENV_PID);
+	char const * listen_fds = getenv(SOCKET_ACTIVATION_ENV_FDS);
+	if (NULL == listen_pid || NULL == listen_fds) {
+		return 0;
+	}
+
+	/* The variables are meant only for the process started by
+	   service manager, not for its children. */
+	char * end = NULL;
+	errno = 0;
+	long const pid = strtol(listen_pid, &end, 10);
+	bool const for_us = 0 == errno && '\0' == *end && end != listen_pid && pid == (long) getpid();
+	end = NULL;
+	errno = 0;
+	long const count = strtol(listen_fds, &end, 10);
+	bool const valid_count = 0 == errno && '\0' == *end && end != listen_fds;
+
+	unsetenv(SOCKET_ACTIVATION_ENV_PID);
+	unsetenv(SOCKET_ACTIVATION_ENV_FDS);
+	unsetenv(SOCKET_ACTIVATION_ENV_FDNAMES);
+
+	if (!for_us || !valid_count || count < 1) {
+		return 0;
+	}
+	if (count > 1) {
+		log_warning("Service manager has passed %ld sockets, using only the first one", count);
+	}
+
+	return 0 == cwdaemon_socket_adopt(cwdaemon, SOCKET_ACTIVATION_FD_START, "service manager") ? 1 : -1;
+}
+
+
+
+
+int cwdaemon_socket_adopt(cwdaemon_t * cwdaemon, int fd, char const * source)
+{
+	int type = 0;
+	socklen_t type_len = sizeof (type);
+	struct sockaddr_in addr = { 0 };
+	socklen_t addr_len = sizeof (addr);
+	if (0 != getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_len)
+	    || 0 != getsockname(fd, (struct sockaddr *) &addr, &addr_len)) {
+		log_error("Descriptor %d passed by %s is not a socket: %s", fd, source, strerror(errno));
+		return -1;
+	}
+	if (SOCK_DGRAM != type || AF_INET != addr.sin_family) {
+		log_error("Socket passed by %s is not an IPv4 UDP socket (type %d, family %d)", source, type, (int) addr.sin_family);
+		return -1;
+	}
+
+	int const flags = fcntl(fd, F_GETFD);
+	if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+		cwdaemon_errmsg("Trying close-on-exec");
+		return -1;
+	}
+
+	cwdaemon->socket_descriptor = fd;
+	cwdaemon->network_port = ntohs(addr.sin_port);
+	log_info("Using socket passed by %s, port %u", source, (unsigned int) cwdaemon->network_port);
+
+	return 0;
+}
+
+
+
+
+int cwdaemon_unix_socket_adopt(cwdaemon_t * cwdaemon, int fd, char const * source)
+{
+	int type = 0;
+	socklen_t type_len = sizeof (type);
+	struct sockaddr_un addr = { 0 };
+	socklen_t addr_len = sizeof (addr);
+	if (0 != getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_len)
+	    || 0 != getsockname(fd, (struct sockaddr *) &addr, &addr_len)) {
+		log_error("Descriptor %d passed by %s is not a socket: %s", fd, source, strerror(errno));
+		return -1;
+	}
+	if (SOCK_DGRAM != type || AF_UNIX != addr.sun_family) {
+		log_error("Socket passed by %s is not a Unix-domain datagram socket (type %d, family %d)", source, type, (int) addr.sun_family);
+		return -1;
+	}
+
+	int const flags = fcntl(fd, F_GETFD);
+	if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+		cwdaemon_errmsg("Trying close-on-exec");
+		return -1;
+	}
+
+	cwdaemon->unix_socket_descriptor = fd;
+	log_info("Using Unix-domain socket passed by %s", source);
+
+	return 0;
+}
+
+
+
+
 void cwdaemon_close_socket(cwdaemon_t * cwdaemon)
 {
 	if (-1 != cwdaemon->socket_descriptor) {
@@ -100,6 +367,17 @@ void cwdaemon_close_socket(cwdaemon_t * cwdaemon)
 		cwdaemon->socket_descriptor = -1;
 	}
 
+	if (-1 != cwdaemon->unix_socket_descriptor) {
+		if (close(cwdaemon->unix_socket_descriptor) == -1) {
+			cwdaemon_errmsg("Close Unix socket");
+			exit(EXIT_FAILURE);
+		}
+		cwdaemon->unix_socket_descriptor = -1;
+		if (NULL != cwdaemon->unix_socket_path) {
+			unlink(cwdaemon->unix_socket_path);
+		}
+	}
+
 	return;
 }
 
@@ -107,6 +385,14 @@ void cwdaemon_close_socket(cwdaemon_t * cwdaemon)
 
 
 ssize_t cwdaemon_sendto(cwdaemon_t * cwdaemon, const char *reply)
+{
+	return cwdaemon_sendto_address(cwdaemon, reply, &cwdaemon->reply_addr, cwdaemon->reply_addrlen);
+}
+
+
+
+
+ssize_t cwdaemon_sendto_address(cwdaemon_t * cwdaemon, const char * reply, struct sockaddr_storage const * addr, socklen_t addrlen)
 {
 	// TODO (acerion) 2025.05.10 count of bytes to be sent should be a part
 	// of "reply" struct.
@@ -126,13 +412,20 @@ ssize_t cwdaemon_sendto(cwdaemon_t * cwdaemon, const char *reply)
 
 	assert(reply[len - 2] == '\r' && reply[len - 1] == '\n');
 
-	ssize_t rv = sendto(cwdaemon->socket_descriptor, reply, len, 0,
-			    (struct sockaddr *) &cwdaemon->reply_addr, cwdaemon->reply_addrlen);
+	/* In virtual clock mode the clock is held until the client
+	   receives the reply. */
+	vclock_hold();
+	/* Reply goes back through the socket that received the request. */
+	int const fd = AF_UNIX == addr->ss_family ? cwdaemon->unix_socket_descriptor : cwdaemon->socket_descriptor;
+	ssize_t rv = sendto(fd, reply, len, 0,
+			    (struct sockaddr const *) addr, addrlen);
 
 	if (rv == -1) {
 		cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "sendto: \"%s\"", strerror(errno));
+		vclock_release();
 		return -1;
 	} else {
+		trace_event(TRACE_EVENT_REPLY, (uint32_t) rv, 0);
 		return rv;
 	}
 }
@@ -142,13 +435,34 @@ ssize_t cwdaemon_sendto(cwdaemon_t * cwdaemon, const char *reply)
 
 ssize_t cwdaemon_recvfrom(cwdaemon_t * cwdaemon, char *request, size_t size)
 {
-	ssize_t recv_rc = recvfrom(cwdaemon->socket_descriptor,
+	/* Both sockets are non-blocking: if there is no request in one
+	   socket, try the other one. The sockets are tried first in turns,
+	   so a busy client of one socket doesn't starve clients of the
+	   other one. */
+	int fds[] = { cwdaemon->socket_descriptor, cwdaemon->unix_socket_descriptor };
+	if (cwdaemon->recv_unix_first) {
+		fds[0] = cwdaemon->unix_socket_descriptor;
+		fds[1] = cwdaemon->socket_descriptor;
+	}
+	cwdaemon->recv_unix_first = !cwdaemon->recv_unix_first;
+	ssize_t recv_rc = -1;
+	errno = EAGAIN;
+	for (size_t i = 0; i < sizeof (fds) / sizeof (fds[0]); i++) {
+		if (-1 == fds[i]) {
+			continue;
+		}
+		/* recvfrom() modifies the length to actual length of address. */
+		cwdaemon->request_addrlen = sizeof (cwdaemon->request_addr);
+		recv_rc = recvfrom(fds[i],
 				   request,
 				   size,
 				   0, /* flags */
 				   (struct sockaddr *) &cwdaemon->request_addr,
-				   /* TODO: request_addrlen may be modified. Check it. */
 				   &cwdaemon->request_addrlen);
+		if (recv_rc != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			break;
+		}
+	}
 
 	if (recv_rc == -1) { /* No requests available? */
 
@@ -167,9 +481,10 @@ ssize_t cwdaemon_recvfrom(cwdaemon_t * cwdaemon, char *request, size_t size)
 		}
 	} else if (recv_rc == 0) {
 		/* "peer has performed an orderly shutdown" */
+		vclock_release(); /* Held by client in virtual clock mode. */
 		return -2;
 	} else {
-		; /* pass */
+		vclock_release(); /* Held by client in virtual clock mode. */
 	}
 
 #if 0 /* Just for debug. */
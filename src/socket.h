@@ -15,12 +15,78 @@
 
 
 
+/* Socket activation: service manager binds the socket and passes it to
+   cwdaemon as descriptor 3 (see sd_listen_fds(3)). */
+#define SOCKET_ACTIVATION_FD_START     3
+#define SOCKET_ACTIVATION_ENV_PID      "LISTEN_PID"
+#define SOCKET_ACTIVATION_ENV_FDS      "LISTEN_FDS"
+#define SOCKET_ACTIVATION_ENV_FDNAMES  "LISTEN_FDNAMES"
+
+
+
+
 bool    cwdaemon_initialize_socket(cwdaemon_t * cwdaemon);
 void    cwdaemon_close_socket(cwdaemon_t * cwdaemon);
 
 
 
 
+/// @brief Take over UDP socket passed by service manager
+///
+/// If LISTEN_PID and LISTEN_FDS environment variables are addressed to
+/// this process, the first passed descriptor is validated and stored in
+/// @p cwdaemon together with its port, and cwdaemon_initialize_socket()
+/// won't create and bind its own socket. The variables are removed from
+/// environment.
+///
+/// Call the function before fork(): LISTEN_PID is pid of the process
+/// started by service manager.
+///
+/// @param cwdaemon cwdaemon instance
+///
+/// @return 1 if a socket has been taken over
+/// @return 0 if no socket has been passed to this process
+/// @return -1 if the passed descriptor is not an IPv4 UDP socket
+int     cwdaemon_socket_activation(cwdaemon_t * cwdaemon);
+
+
+
+
+/// @brief Use already bound socket passed by other process
+///
+/// The socket is validated (it must be an IPv4 UDP socket), and stored in
+/// @p cwdaemon together with its port, so that
+/// cwdaemon_initialize_socket() won't create and bind its own socket.
+///
+/// @param cwdaemon cwdaemon instance
+/// @param[in] fd descriptor of the socket
+/// @param[in] source description of the passing process, for logs
+///
+/// @return 0 on success
+/// @return -1 if @p fd is not an IPv4 UDP socket
+int     cwdaemon_socket_adopt(cwdaemon_t * cwdaemon, int fd, char const * source);
+
+
+
+
+/// @brief Use already bound Unix-domain socket passed by other process
+///
+/// The socket is validated (it must be a Unix-domain datagram socket),
+/// and stored in @p cwdaemon, so that cwdaemon_initialize_socket() won't
+/// create and bind its own socket at path of the socket. Requests
+/// waiting in the socket's receive buffer are not lost.
+///
+/// @param cwdaemon cwdaemon instance
+/// @param[in] fd descriptor of the socket
+/// @param[in] source description of the passing process, for logs
+///
+/// @return 0 on success
+/// @return -1 if @p fd is not a Unix-domain datagram socket
+int     cwdaemon_unix_socket_adopt(cwdaemon_t * cwdaemon, int fd, char const * source);
+
+
+
+
 /**
    @brief Wrapper around sendto()
 
@@ -38,9 +104,30 @@ ssize_t cwdaemon_sendto(cwdaemon_t * cwdaemon, const char * reply);
 
 
 
+/// @brief Send a @p reply to given client
+///
+/// Like cwdaemon_sendto(), but for a reply that is not sent to client
+/// specified by reply_* members of @p cwdaemon, e.g. a delayed reply to
+/// request of other client. The reply is sent through Unix-domain socket
+/// if @p addr is a Unix-domain address, and through UDP socket otherwise.
+///
+/// @param cwdaemon cwdaemon instance
+/// @param[in] reply array of bytes to be sent over socket
+/// @param[in] addr address of client
+/// @param[in] addrlen size of @p addr
+///
+/// @return -1 on failure
+/// @return number of characters sent on success
+ssize_t cwdaemon_sendto_address(cwdaemon_t * cwdaemon, const char * reply, struct sockaddr_storage const * addr, socklen_t addrlen);
+
+
+
+
 //// @brief Receive request through socket
 ///
-/// Received request is returned through \p request.
+/// Received request is returned through \p request. Requests are received
+/// from UDP socket and from Unix-domain socket (if there is one), address of
+/// sender is stored in request_* members of @p cwdaemon.
 ///
 /// Possible trailing '\r' and '\n' characters are replaced with '\0'. Other
 /// than that, the function doesn't add terminating NUL to @p request. When
@@ -0,0 +1,300 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Probing of sound systems in background, with cache of results.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "sleep.h"
+#include "sound.h"
+
+
+
+
+#define SOUND_SYSTEMS_COUNT (CW_AUDIO_SOUNDCARD + 1)
+
+
+
+
+typedef enum {
+	SOUND_STATE_UNKNOWN = 0,
+	SOUND_STATE_AVAILABLE,
+	SOUND_STATE_UNAVAILABLE
+} sound_state_t;
+
+
+
+
+/// Result of probe, passed through the pipe.
+typedef struct {
+	int audio_system;
+	bool available;
+} sound_result_t;
+
+
+
+
+/// Arguments of probing thread.
+typedef struct {
+	engine_t const * engine;
+	int audio_system;
+} sound_probe_t;
+
+
+
+
+static int g_sound_pipe[2] = { -1, -1 };
+/// Probe is running, or its result hasn't been read by main loop yet.
+/// Cleared only by main loop, in sound_read().
+static bool g_sound_probe_running = false;
+static sound_probe_t g_sound_probe;
+
+/// Cache of availability of sound systems. Accessed only by main thread.
+static struct {
+	sound_state_t state;
+	int64_t updated_ns;
+} g_sound_cache[SOUND_SYSTEMS_COUNT];
+
+
+
+
+static void * sound_probe_thread_fn(void * arg);
+static bool sound_probe(engine_t const * engine, int audio_system);
+static void sound_deliver(int audio_system, bool available);
+static bool sound_cached(int audio_system, bool * available);
+static int64_t sound_now_ns(void);
+
+
+
+
+int sound_probe_start(engine_t const * engine, int audio_system)
+{
+	if (audio_system < 0 || audio_system >= SOUND_SYSTEMS_COUNT) {
+		return -1;
+	}
+	if (__atomic_load_n(&g_sound_probe_running, __ATOMIC_ACQUIRE)) {
+		log_warning("Probe of sound system is already running, ignoring request for sound system \"%s\"",
+		            engine_get_audio_system_label(audio_system));
+		return -1;
+	}
+
+	if (-1 == g_sound_pipe[0]) {
+		if (0 != pipe(g_sound_pipe)) {
+			log_error("Failed to create pipe for probes of sound systems: %s", strerror(errno));
+			return -1;
+		}
+		fcntl(g_sound_pipe[0], F_SETFL, O_NONBLOCK);
+	}
+
+	// Result delivered without probing is pending until it's read, just
+	// like result of a probe.
+	bool available = false;
+	if (CW_AUDIO_NULL == audio_system) {
+		__atomic_store_n(&g_sound_probe_running, true, __ATOMIC_RELEASE);
+		sound_deliver(audio_system, true); // Always available.
+		return 0;
+	}
+	if (sound_cached(audio_system, &available)) {
+		log_info("Sound system \"%s\" is %s (cached)", engine_get_audio_system_label(audio_system), available ? "available" : "unavailable");
+		__atomic_store_n(&g_sound_probe_running, true, __ATOMIC_RELEASE);
+		sound_deliver(audio_system, available);
+		return 0;
+	}
+
+	g_sound_probe.engine = engine;
+	g_sound_probe.audio_system = audio_system;
+	__atomic_store_n(&g_sound_probe_running, true, __ATOMIC_RELEASE);
+
+	// Signals should be handled by main thread. The thread is detached:
+	// nobody waits for a probe that hangs in a sound library, and
+	// exit of cwdaemon is not delayed by such probe.
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	sigset_t all;
+	sigset_t old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	pthread_t thread;
+	int const retv = pthread_create(&thread, &attr, sound_probe_thread_fn, &g_sound_probe);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+	if (0 != retv) {
+		log_error("Failed to start probe of sound system: %s", strerror(retv));
+		__atomic_store_n(&g_sound_probe_running, false, __ATOMIC_RELEASE);
+		return -1;
+	}
+
+	log_info("Probing sound system \"%s\"", engine_get_audio_system_label(audio_system));
+	return 0;
+}
+
+
+
+
+bool sound_probe_is_running(void)
+{
+	return __atomic_load_n(&g_sound_probe_running, __ATOMIC_ACQUIRE);
+}
+
+
+
+
+int sound_get_fd(void)
+{
+	return g_sound_pipe[0];
+}
+
+
+
+
+bool sound_read(int * audio_system, bool * available)
+{
+	if (g_sound_pipe[0] < 0) {
+		return false;
+	}
+	sound_result_t result = { 0 };
+	if ((ssize_t) sizeof (result) != read(g_sound_pipe[0], &result, sizeof (result))) {
+		return false;
+	}
+	*audio_system = result.audio_system;
+	*available = result.available;
+	sound_set_available(result.audio_system, result.available);
+	// Next probe may be started only now: a result that is still in the
+	// pipe belongs to the switch that is pending in main loop.
+	__atomic_store_n(&g_sound_probe_running, false, __ATOMIC_RELEASE);
+	return true;
+}
+
+
+
+
+void sound_set_available(int audio_system, bool available)
+{
+	if (audio_system < 0 || audio_system >= SOUND_SYSTEMS_COUNT) {
+		return;
+	}
+	g_sound_cache[audio_system].state = available ? SOUND_STATE_AVAILABLE : SOUND_STATE_UNAVAILABLE;
+	g_sound_cache[audio_system].updated_ns = sound_now_ns();
+}
+
+
+
+
+static void * sound_probe_thread_fn(void * arg)
+{
+	sound_probe_t const probe = *(sound_probe_t const *) arg;
+	bool const available = sound_probe(probe.engine, probe.audio_system);
+	log_info("Probe of sound system \"%s\": %s", engine_get_audio_system_label(probe.audio_system), available ? "available" : "unavailable");
+
+	// "Running" flag is cleared by main loop when it reads the result.
+	sound_deliver(probe.audio_system, available);
+
+	return NULL;
+}
+
+
+
+
+static bool sound_probe(engine_t const * engine, int audio_system)
+{
+	if (NULL == engine->probe) {
+		return false; // Engine without sidetone.
+	}
+
+	bool available = engine->probe(audio_system);
+	// OSS device may still be held by other sound system for a while
+	// after the other sound system has been closed. The retries happen
+	// here in background, so they don't block the daemon.
+	for (int i = 0; !available && CW_AUDIO_OSS == audio_system && i < SOUND_PROBE_OSS_RETRIES; i++) {
+		log_info("OSS device is not available, retrying in %d ms", SOUND_PROBE_OSS_DELAY_MS);
+		millisleep_nonintr(SOUND_PROBE_OSS_DELAY_MS);
+		available = engine->probe(audio_system);
+	}
+	return available;
+}
+
+
+
+
+static void sound_deliver(int audio_system, bool available)
+{
+	sound_result_t const result = { .audio_system = audio_system, .available = available };
+	// Writes of less than PIPE_BUF bytes are atomic.
+	if ((ssize_t) sizeof (result) != write(g_sound_pipe[1], &result, sizeof (result))) {
+		log_error("Failed to deliver result of probe of sound system: %s", strerror(errno));
+		// There will be no result to read.
+		__atomic_store_n(&g_sound_probe_running, false, __ATOMIC_RELEASE);
+	}
+}
+
+
+
+
+static bool sound_cached(int audio_system, bool * available)
+{
+	switch (g_sound_cache[audio_system].state) {
+	case SOUND_STATE_AVAILABLE:
+		*available = true;
+		return true;
+	case SOUND_STATE_UNAVAILABLE:
+		if (sound_now_ns() - g_sound_cache[audio_system].updated_ns < SOUND_UNAVAILABLE_TTL_S * 1000000000LL) {
+			*available = false;
+			return true;
+		}
+		return false;
+	case SOUND_STATE_UNKNOWN:
+	default:
+		return false;
+	}
+}
+
+
+
+
+static int64_t sound_now_ns(void)
+{
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
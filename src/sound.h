@@ -0,0 +1,124 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_SOUND_H
+#define CWDAEMON_SOUND_H
+
+
+
+
+/// @file
+///
+/// Probing of sound systems requested with SOUND_SYSTEM Escape request.
+///
+/// Opening a sound system that is not available on given machine may take
+/// seconds (e.g. connection to PulseAudio server, retries of busy OSS
+/// device), and fails only at the end. libcw can have only one generator,
+/// so the old generator must be closed before the new one is opened, and a
+/// failure leaves cwdaemon without sidetone.
+///
+/// Therefore a sound system is first probed by a short-lived thread, while
+/// main loop keeps serving requests with the old generator. Result of a
+/// probe is delivered to main loop through a pipe: main loop adds
+/// sound_get_fd() to its select(), and reads the results with
+/// sound_read(). Main loop replaces the generator only if the probe
+/// succeeded.
+///
+/// Results of probes and of opening the generator are cached, so that
+/// repeated requests for the same sound system don't probe it again.
+/// Unavailable sound systems are probed again after
+/// SOUND_UNAVAILABLE_TTL_S seconds, because e.g. a sound server may be
+/// started in the meantime.
+
+
+
+
+#include <stdbool.h>
+
+#include "engine.h"
+
+
+
+
+#define SOUND_UNAVAILABLE_TTL_S   30 ///< How long an unavailable sound system is remembered as unavailable.
+#define SOUND_PROBE_OSS_RETRIES    5 ///< Count of retries of probe of OSS device that may be held by other sound system.
+#define SOUND_PROBE_OSS_DELAY_MS 1000 ///< Time between retries of probe of OSS device.
+
+
+
+
+/// @brief Start probing sound system in background
+///
+/// If availability of @p audio_system is cached, the result is delivered
+/// to main loop without starting a thread.
+///
+/// @param[in] engine Keying engine that will open the sound system
+/// @param[in] audio_system One of CW_AUDIO_* values
+///
+/// @return 0 if the probe has been started, its result will be available through sound_read()
+/// @return -1 on failure, e.g. when a previous probe is still running or its result hasn't been read yet
+int sound_probe_start(engine_t const * engine, int audio_system);
+
+
+
+
+/// @brief Check if a probe is running, or if its result hasn't been read with sound_read() yet
+bool sound_probe_is_running(void);
+
+
+
+
+/// @brief Get file descriptor that becomes readable when a result of probe is available
+///
+/// @return file descriptor for select()
+/// @return -1 if no probe has been started yet
+int sound_get_fd(void);
+
+
+
+
+/// @brief Read next result of probe, without blocking
+///
+/// @param[out] audio_system Probed sound system
+/// @param[out] available Availability of the sound system
+///
+/// @return true if a result has been read
+/// @return false if there are no more results to read
+bool sound_read(int * audio_system, bool * available);
+
+
+
+
+/// @brief Remember availability of sound system
+///
+/// Call the function with result of opening a generator, so that the cache
+/// reflects the most recent knowledge.
+///
+/// @param[in] audio_system One of CW_AUDIO_* values
+/// @param[in] available Availability of the sound system
+void sound_set_available(int audio_system, bool available);
+
+
+
+
+#endif /* #ifndef CWDAEMON_SOUND_H */
+
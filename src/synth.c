@@ -0,0 +1,337 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Sidetone synthesizer: wavetable oscillator with raised-cosine envelope.
+///
+/// See synth.h for description of the synthesizer.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "synth.h"
+
+
+
+
+#define SYNTH_FRAC_BITS  (32 - SYNTH_TABLE_BITS)
+#define SYNTH_FRAC_MASK  ((1u << SYNTH_FRAC_BITS) - 1)
+
+/// Amplitude of tone at volume of 100%, leaving a bit of headroom.
+#define SYNTH_AMPLITUDE_MAX  32000.0f
+
+#define SYNTH_PI  3.14159265358979323846
+
+
+
+
+/// One period of sine. The extra entry at the end is equal to the first
+/// entry, so interpolation doesn't need to wrap the index.
+static float g_sine_table[SYNTH_TABLE_SIZE + 1];
+static pthread_once_t g_sine_table_once = PTHREAD_ONCE_INIT;
+
+
+
+
+static void synth_sine_table_init(void);
+static void synth_oscillator(synth_t * synth, float * restrict osc);
+static void synth_envelope(synth_t * synth, bool key, float * restrict env, size_t frames);
+static void synth_mix(int16_t * restrict out, float const * restrict osc, float const * restrict env, float gain);
+static void synth_put_le16(uint8_t * buf, uint16_t value);
+static void synth_put_le32(uint8_t * buf, uint32_t value);
+
+
+
+
+static void synth_sine_table_init(void)
+{
+	for (unsigned int i = 0; i <= SYNTH_TABLE_SIZE; i++) {
+		g_sine_table[i] = (float) sin(2.0 * SYNTH_PI * (double) i / (double) SYNTH_TABLE_SIZE);
+	}
+	g_sine_table[SYNTH_TABLE_SIZE] = g_sine_table[0];
+}
+
+
+
+
+int synth_init(synth_t * synth, unsigned int sample_rate, unsigned int rise_us)
+{
+	if (0 == sample_rate || sample_rate > SYNTH_SAMPLE_RATE_MAX || rise_us > SYNTH_RISE_US_MAX) {
+		return -1;
+	}
+	pthread_once(&g_sine_table_once, synth_sine_table_init);
+
+	memset(synth, 0, sizeof (synth_t));
+	synth->sample_rate = sample_rate;
+
+	/* Even with zero rise time there must be at least one step of the
+	   envelope, otherwise fall of the envelope would have nothing to
+	   play. */
+	unsigned int ramp_len = (unsigned int) synth_us_to_frames(synth, rise_us);
+	if (0 == ramp_len) {
+		ramp_len = 1;
+	}
+	if (ramp_len > SYNTH_RAMP_FRAMES_MAX) {
+		ramp_len = SYNTH_RAMP_FRAMES_MAX;
+	}
+	for (unsigned int i = 0; i < ramp_len; i++) {
+		/* Samples are taken in the middle of each step, so the ramp is
+		   symmetric and never reaches 0.0 or 1.0. */
+		synth->ramp[i] = (float) (0.5 - 0.5 * cos(SYNTH_PI * ((double) i + 0.5) / (double) ramp_len));
+	}
+	synth->ramp_len = ramp_len;
+
+	synth_set_frequency(synth, 800);
+	synth_set_volume(synth, 70);
+
+	return 0;
+}
+
+
+
+
+void synth_set_frequency(synth_t * synth, int frequency)
+{
+	if (frequency < 0) {
+		frequency = 0;
+	}
+	if ((unsigned int) frequency > synth->sample_rate / 2) {
+		frequency = (int) (synth->sample_rate / 2);
+	}
+	synth->phase_step = (uint32_t) (((uint64_t) frequency << 32) / synth->sample_rate);
+}
+
+
+
+
+void synth_set_volume(synth_t * synth, int volume)
+{
+	if (volume < 0) {
+		volume = 0;
+	}
+	if (volume > 100) {
+		volume = 100;
+	}
+	synth->gain = SYNTH_AMPLITUDE_MAX * (float) volume / 100.0f;
+}
+
+
+
+
+bool synth_is_silent(synth_t const * synth)
+{
+	return 0 == synth->ramp_pos;
+}
+
+
+
+
+uint64_t synth_us_to_frames(synth_t const * synth, uint64_t us)
+{
+	return (us * synth->sample_rate + 500000) / 1000000;
+}
+
+
+
+
+void synth_render(synth_t * synth, bool key, int16_t * out, size_t frames)
+{
+	/* Loops in helper functions always go over full block, so that
+	   compiler generates vector code without scalar prologues and
+	   epilogues. Only the requested frames are copied out. */
+	float osc[SYNTH_BLOCK_FRAMES] __attribute__((aligned(32)));
+	float env[SYNTH_BLOCK_FRAMES] __attribute__((aligned(32)));
+	int16_t pcm[SYNTH_BLOCK_FRAMES] __attribute__((aligned(32)));
+
+	while (frames > 0) {
+		size_t const n = frames < SYNTH_BLOCK_FRAMES ? frames : SYNTH_BLOCK_FRAMES;
+
+		if (!key && 0 == synth->ramp_pos) {
+			/* Silence. Keep the phase running anyway, so the
+			   oscillator doesn't depend on history of keying. */
+			memset(out, 0, n * sizeof (int16_t));
+			synth->phase += (uint32_t) n * synth->phase_step;
+		} else {
+			synth_oscillator(synth, osc);
+			synth_envelope(synth, key, env, n);
+			synth_mix(pcm, osc, env, synth->gain);
+			memcpy(out, pcm, n * sizeof (int16_t));
+			synth->phase += (uint32_t) n * synth->phase_step;
+		}
+
+		out += n;
+		frames -= n;
+	}
+}
+
+
+
+
+/// @brief Render one block of sine wave starting at current phase
+///
+/// Phase of each frame is calculated from phase at the start of block,
+/// without dependency between iterations. Phase of synthesizer is not
+/// modified.
+static void synth_oscillator(synth_t * synth, float * restrict osc)
+{
+	uint32_t const phase = synth->phase;
+	uint32_t const step = synth->phase_step;
+	float const frac_scale = 1.0f / (float) (1u << SYNTH_FRAC_BITS);
+
+	for (uint32_t i = 0; i < SYNTH_BLOCK_FRAMES; i++) {
+		uint32_t const p = phase + i * step;
+		uint32_t const idx = p >> SYNTH_FRAC_BITS;
+		float const frac = (float) (p & SYNTH_FRAC_MASK) * frac_scale;
+		float const a = g_sine_table[idx];
+		float const b = g_sine_table[idx + 1];
+		osc[i] = a + frac * (b - a);
+	}
+}
+
+
+
+
+/// @brief Calculate gain of envelope for frames of a block
+///
+/// Frames past @p frames get the gain of the last frame.
+static void synth_envelope(synth_t * synth, bool key, float * restrict env, size_t frames)
+{
+	size_t i = 0;
+	if (key) {
+		for (; i < frames && synth->ramp_pos < synth->ramp_len; i++) {
+			env[i] = synth->ramp[synth->ramp_pos++];
+		}
+	} else {
+		for (; i < frames && synth->ramp_pos > 0; i++) {
+			env[i] = synth->ramp[--synth->ramp_pos];
+		}
+	}
+
+	/* Steady state for the rest of the block. */
+	float const steady = synth->ramp_pos == synth->ramp_len ? 1.0f : 0.0f;
+	for (; i < SYNTH_BLOCK_FRAMES; i++) {
+		env[i] = steady;
+	}
+}
+
+
+
+
+static void synth_mix(int16_t * restrict out, float const * restrict osc, float const * restrict env, float gain)
+{
+	for (size_t i = 0; i < SYNTH_BLOCK_FRAMES; i++) {
+		out[i] = (int16_t) (int32_t) (osc[i] * env[i] * gain);
+	}
+}
+
+
+
+
+int64_t synth_render_elements(synth_t * synth, engine_native_element_t const * elements, size_t count,
+                              int (*write)(void * arg, int16_t const * frames, size_t count), void * arg)
+{
+	int16_t block[SYNTH_BLOCK_FRAMES];
+	uint64_t elapsed_us = 0;
+	uint64_t rendered = 0;
+
+	for (size_t e = 0; e < count; e++) {
+		elapsed_us += elements[e].duration_us > 0 ? (uint64_t) elements[e].duration_us : 0;
+		uint64_t const end = synth_us_to_frames(synth, elapsed_us);
+		while (rendered < end) {
+			size_t const n = end - rendered < SYNTH_BLOCK_FRAMES ? (size_t) (end - rendered) : SYNTH_BLOCK_FRAMES;
+			synth_render(synth, elements[e].key, block, n);
+			if (0 != write(arg, block, n)) {
+				return -1;
+			}
+			rendered += n;
+		}
+	}
+
+	/* Let the last mark fade out. */
+	while (!synth_is_silent(synth)) {
+		size_t const n = synth->ramp_pos < SYNTH_BLOCK_FRAMES ? synth->ramp_pos : SYNTH_BLOCK_FRAMES;
+		synth_render(synth, false, block, n);
+		if (0 != write(arg, block, n)) {
+			return -1;
+		}
+		rendered += n;
+	}
+
+	return (int64_t) rendered;
+}
+
+
+
+
+void synth_wav_header(uint8_t header[SYNTH_WAV_HEADER_SIZE], unsigned int sample_rate, uint32_t frames)
+{
+	uint32_t const data_size = frames * (uint32_t) sizeof (int16_t);
+
+	memcpy(header + 0, "RIFF", 4);
+	synth_put_le32(header + 4, 36 + data_size);
+	memcpy(header + 8, "WAVE", 4);
+
+	memcpy(header + 12, "fmt ", 4);
+	synth_put_le32(header + 16, 16);                 // Size of "fmt " chunk.
+	synth_put_le16(header + 20, 1);                  // PCM.
+	synth_put_le16(header + 22, 1);                  // Channels.
+	synth_put_le32(header + 24, sample_rate);
+	synth_put_le32(header + 28, sample_rate * 2);    // Bytes per second.
+	synth_put_le16(header + 32, 2);                  // Bytes per frame.
+	synth_put_le16(header + 34, 16);                 // Bits per sample.
+
+	memcpy(header + 36, "data", 4);
+	synth_put_le32(header + 40, data_size);
+}
+
+
+
+
+static void synth_put_le16(uint8_t * buf, uint16_t value)
+{
+	buf[0] = (uint8_t) (value & 0xff);
+	buf[1] = (uint8_t) (value >> 8);
+}
+
+
+
+
+static void synth_put_le32(uint8_t * buf, uint32_t value)
+{
+	buf[0] = (uint8_t) (value & 0xff);
+	buf[1] = (uint8_t) ((value >> 8) & 0xff);
+	buf[2] = (uint8_t) ((value >> 16) & 0xff);
+	buf[3] = (uint8_t) (value >> 24);
+}
+
@@ -0,0 +1,176 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_SYNTH_H
+#define CWDAEMON_SYNTH_H
+
+
+
+
+/// @file
+///
+/// Sidetone synthesizer.
+///
+/// Sine wave is read from a precomputed wavetable with a 32-bit phase
+/// accumulator and linear interpolation between entries of the table, so
+/// frequency can be changed at any moment without discontinuity of phase.
+/// Each mark starts and ends with a raised-cosine envelope (precomputed
+/// as well), so that edges of marks don't produce clicks.
+///
+/// Samples are rendered in blocks of up to SYNTH_BLOCK_FRAMES frames.
+/// Loops over a block work on separate arrays without aliasing, in a form
+/// that compilers vectorize with SIMD instructions of target CPU.
+///
+/// The synthesizer has no notion of time other than count of frames: it's
+/// driven either in real time by sidetone thread (sidetone.h), or faster
+/// than real time from a keying schedule (synth_render_elements()), e.g.
+/// to write a WAV file.
+
+
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "engine_native.h"
+
+
+
+
+#define SYNTH_SAMPLE_RATE_DEFAULT  48000 ///< [Hz]
+#define SYNTH_SAMPLE_RATE_MAX     192000 ///< [Hz]
+#define SYNTH_RISE_US_DEFAULT       5000 ///< Duration of rise and fall of envelope [us].
+#define SYNTH_RISE_US_MAX          10000 ///< [us]
+#define SYNTH_BLOCK_FRAMES           256 ///< Max count of frames rendered in one pass.
+
+#define SYNTH_TABLE_BITS              12
+#define SYNTH_TABLE_SIZE   (1u << SYNTH_TABLE_BITS)
+#define SYNTH_RAMP_FRAMES_MAX  (SYNTH_SAMPLE_RATE_MAX / 1000 * SYNTH_RISE_US_MAX / 1000)
+
+#define SYNTH_WAV_HEADER_SIZE         44 ///< Size of header of WAV file with 16-bit PCM.
+
+
+
+
+typedef struct {
+	unsigned int sample_rate;
+	uint32_t phase;       ///< Position in wavetable, full range of uint32_t is one period.
+	uint32_t phase_step;  ///< Increment of phase per frame, derived from frequency.
+	float gain;           ///< Amplitude, derived from volume.
+
+	/// Envelope of rise of a mark: ramp[0] is the first non-zero
+	/// gain, ramp[ramp_len - 1] is the last gain below 1.0. Fall is
+	/// the same ramp played backwards.
+	float ramp[SYNTH_RAMP_FRAMES_MAX];
+	unsigned int ramp_len;
+	/// Current position in envelope: 0 is silence, ramp_len is full
+	/// amplitude.
+	unsigned int ramp_pos;
+} synth_t;
+
+
+
+
+/// @brief Initialize synthesizer
+///
+/// @param[out] synth Synthesizer to initialize
+/// @param[in] sample_rate Sample rate of output [Hz], up to SYNTH_SAMPLE_RATE_MAX
+/// @param[in] rise_us Duration of rise and fall of envelope [us], up to SYNTH_RISE_US_MAX
+///
+/// @return 0 on success
+/// @return -1 on invalid arguments
+int synth_init(synth_t * synth, unsigned int sample_rate, unsigned int rise_us);
+
+
+
+
+/// @brief Set frequency of tone, in Hz
+void synth_set_frequency(synth_t * synth, int frequency);
+
+
+
+
+/// @brief Set volume of tone, in percents
+void synth_set_volume(synth_t * synth, int volume);
+
+
+
+
+/// @brief Render frames of mono, 16-bit signed PCM
+///
+/// If @p key differs from state of envelope, the envelope rises or falls
+/// during the frames.
+///
+/// @param synth Synthesizer
+/// @param[in] key State of key during the frames
+/// @param[out] out Output buffer
+/// @param[in] frames Count of frames to render
+void synth_render(synth_t * synth, bool key, int16_t * out, size_t frames);
+
+
+
+
+/// @brief Check if output is silent: key is up and the envelope has fallen
+bool synth_is_silent(synth_t const * synth);
+
+
+
+
+/// @brief Convert time to count of frames at sample rate of synthesizer
+uint64_t synth_us_to_frames(synth_t const * synth, uint64_t us);
+
+
+
+
+/// @brief Render keying schedule as fast as possible
+///
+/// Edges are placed at frames corresponding to exact sums of durations of
+/// elements, so rounding errors don't accumulate. After last element,
+/// frames are rendered until the envelope falls to silence.
+///
+/// @param synth Synthesizer
+/// @param[in] elements Elements of keying schedule
+/// @param[in] count Count of elements
+/// @param[in] write Function consuming rendered frames, returning 0 on success
+/// @param[in] arg Argument passed to @p write
+///
+/// @return count of rendered frames on success
+/// @return -1 if @p write has failed
+int64_t synth_render_elements(synth_t * synth, engine_native_element_t const * elements, size_t count,
+                              int (*write)(void * arg, int16_t const * frames, size_t count), void * arg);
+
+
+
+
+/// @brief Fill header of WAV file with mono, 16-bit PCM samples
+///
+/// @param[out] header Buffer for header
+/// @param[in] sample_rate Sample rate [Hz]
+/// @param[in] frames Count of frames in the file
+void synth_wav_header(uint8_t header[SYNTH_WAV_HEADER_SIZE], unsigned int sample_rate, uint32_t frames);
+
+
+
+
+#endif /* #ifndef CWDAEMON_SYNTH_H */
+
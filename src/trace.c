@@ -0,0 +1,436 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Binary trace of events happening on hot paths of cwdaemon.
+///
+/// Layout of trace file:
+///
+/// <verbatim>
+///     trace_file_header_t
+///     trace_ring_header_t [rings_count]
+///     trace_record_t      [rings_count][ring_capacity]
+/// </verbatim>
+///
+/// Each ring has exactly one writer: the thread that has claimed the ring.
+/// When the thread exits, the ring is released and can be claimed by next
+/// thread (e.g. next thread of keying engine after the engine has been
+/// reopened), so that the rings are not used up by short-lived threads.
+/// The writer first zeroes "seq" field of a record, then fills the record,
+/// then publishes the record by writing its position to "seq" and to ring's
+/// "head". A reader checks "seq" before and after copying a record, and
+/// discards the copy if the record was overwritten in the meantime.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "trace.h"
+
+
+
+
+/// Base of memory-mapped trace file. NULL when tracing is disabled.
+static uint8_t * g_trace_base = NULL;
+static size_t g_trace_size = 0;
+
+/// Incremented on each successful trace_open(), so that threads know that
+/// the ring claimed for previous trace file is no longer valid.
+static unsigned int g_trace_generation = 0;
+
+/// Index of ring claimed by current thread, or -1 if current thread didn't
+/// get a ring.
+static __thread int t_ring = -1;
+static __thread unsigned int t_generation = 0;
+
+/// Key with destructor releasing ring of exiting thread.
+static pthread_key_t g_trace_key;
+static bool g_trace_key_valid = false;
+static pthread_once_t g_trace_key_once = PTHREAD_ONCE_INIT;
+
+
+
+
+static size_t trace_file_size(unsigned int rings_count, unsigned int ring_capacity);
+static trace_ring_header_t * trace_ring_header(uint8_t * base, unsigned int ring);
+static trace_record_t * trace_ring_records(uint8_t * base, unsigned int rings_count, unsigned int ring_capacity, unsigned int ring);
+static int trace_claim_ring(uint8_t * base);
+static void trace_release_ring(void * arg);
+static void trace_key_create(void);
+
+
+
+
+static size_t trace_file_size(unsigned int rings_count, unsigned int ring_capacity)
+{
+	return sizeof (trace_file_header_t)
+		+ rings_count * sizeof (trace_ring_header_t)
+		+ (size_t) rings_count * ring_capacity * sizeof (trace_record_t);
+}
+
+
+
+
+static trace_ring_header_t * trace_ring_header(uint8_t * base, unsigned int ring)
+{
+	return (trace_ring_header_t *) (base + sizeof (trace_file_header_t) + ring * sizeof (trace_ring_header_t));
+}
+
+
+
+
+static trace_record_t * trace_ring_records(uint8_t * base, unsigned int rings_count, unsigned int ring_capacity, unsigned int ring)
+{
+	uint8_t * const records = base + sizeof (trace_file_header_t) + rings_count * sizeof (trace_ring_header_t);
+	return (trace_record_t *) (records + (size_t) ring * ring_capacity * sizeof (trace_record_t));
+}
+
+
+
+
+int trace_open(char const * path, unsigned int rings_count, unsigned int ring_capacity)
+{
+	if (0 == rings_count || 0 == ring_capacity || 0 != (ring_capacity & (ring_capacity - 1))) {
+		log_error("Invalid geometry of trace file: %u rings, %u records per ring", rings_count, ring_capacity);
+		return -1;
+	}
+	if (NULL != g_trace_base) {
+		log_error("Trace file is already open %s", "");
+		return -1;
+	}
+	pthread_once(&g_trace_key_once, trace_key_create);
+
+	int const fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (-1 == fd) {
+		log_error("Failed to open trace file [%s]: %s", path, strerror(errno));
+		return -1;
+	}
+
+	size_t const size = trace_file_size(rings_count, ring_capacity);
+	if (0 != ftruncate(fd, (off_t) size)) {
+		log_error("Failed to set size of trace file [%s]: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	void * const base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // The mapping stays valid after the file is closed.
+	if (MAP_FAILED == base) {
+		log_error("Failed to map trace file [%s]: %s", path, strerror(errno));
+		return -1;
+	}
+
+	// The file has been truncated and extended, so it's filled with zeros.
+	trace_file_header_t * const header = (trace_file_header_t *) base;
+	header->version = TRACE_VERSION;
+	header->rings_count = rings_count;
+	header->ring_capacity = ring_capacity;
+	header->record_size = sizeof (trace_record_t);
+	__atomic_store_n(&header->magic, TRACE_MAGIC, __ATOMIC_RELEASE);
+
+	g_trace_size = size;
+	__atomic_add_fetch(&g_trace_generation, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&g_trace_base, (uint8_t *) base, __ATOMIC_RELEASE);
+
+	log_info("Recording trace to [%s]: %u rings, %u records per ring", path, rings_count, ring_capacity);
+	return 0;
+}
+
+
+
+
+void trace_close(void)
+{
+	uint8_t * const base = __atomic_exchange_n(&g_trace_base, NULL, __ATOMIC_ACQ_REL);
+	if (NULL == base) {
+		return;
+	}
+	msync(base, g_trace_size, MS_ASYNC);
+	munmap(base, g_trace_size);
+	g_trace_size = 0;
+
+	return;
+}
+
+
+
+
+void trace_event(trace_event_t event, uint32_t arg0, uint32_t arg1)
+{
+	uint8_t * const base = __atomic_load_n(&g_trace_base, __ATOMIC_ACQUIRE);
+	if (NULL == base) {
+		return;
+	}
+	trace_file_header_t * const header = (trace_file_header_t *) base;
+
+	unsigned int const generation = __atomic_load_n(&g_trace_generation, __ATOMIC_RELAXED);
+	if (t_generation != generation) {
+		// First event recorded by this thread in this trace file.
+		t_generation = generation;
+		t_ring = trace_claim_ring(base);
+	}
+	if (t_ring < 0) {
+		__atomic_add_fetch(&header->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	trace_ring_header_t * const ring = trace_ring_header(base, (unsigned int) t_ring);
+	trace_record_t * const records = trace_ring_records(base, header->rings_count, header->ring_capacity, (unsigned int) t_ring);
+
+	uint64_t const pos = ring->head; // This thread is the only writer of the ring.
+	trace_record_t * const record = &records[pos & (header->ring_capacity - 1)];
+
+	__atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	record->timestamp_ns = (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+	record->event = (uint32_t) event;
+	record->arg0 = arg0;
+	record->arg1 = arg1;
+
+	__atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, pos + 1, __ATOMIC_RELEASE);
+
+	return;
+}
+
+
+
+
+/// @brief Claim a ring for calling thread
+///
+/// Rings released by threads that have exited are reused before new rings.
+///
+/// @return index of claimed ring
+/// @return -1 if all rings are used
+static int trace_claim_ring(uint8_t * base)
+{
+	trace_file_header_t * const header = (trace_file_header_t *) base;
+
+	unsigned int const used = __atomic_load_n(&header->rings_used, __ATOMIC_RELAXED);
+	int ring = -1;
+	for (unsigned int i = 0; i < used && i < header->rings_count; i++) {
+		uint32_t released = 1;
+		if (__atomic_compare_exchange_n(&trace_ring_header(base, i)->released, &released, 0, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			ring = (int) i;
+			break;
+		}
+	}
+	if (-1 == ring) {
+		unsigned int const next = __atomic_fetch_add(&header->rings_used, 1, __ATOMIC_RELAXED);
+		if (next >= header->rings_count) {
+			return -1;
+		}
+		ring = (int) next;
+	}
+
+	trace_ring_header(base, (unsigned int) ring)->owner_pid = (uint32_t) getpid();
+	if (g_trace_key_valid) {
+		// Any non-NULL value makes the destructor run on exit of the thread.
+		pthread_setspecific(g_trace_key, base);
+	}
+	return ring;
+}
+
+
+
+
+/// @brief Release ring of exiting thread (destructor of g_trace_key)
+///
+/// Thread-local variables are still valid when destructors of keys run.
+static void trace_release_ring(void * arg)
+{
+	uint8_t * const base = __atomic_load_n(&g_trace_base, __ATOMIC_ACQUIRE);
+	if (NULL == base || base != arg || t_ring < 0
+	    || t_generation != __atomic_load_n(&g_trace_generation, __ATOMIC_RELAXED)) {
+		// The ring belongs to trace file that has been closed.
+		return;
+	}
+	// Records written by this thread are published before the ring
+	// becomes available to other thread.
+	__atomic_store_n(&trace_ring_header(base, (unsigned int) t_ring)->released, 1, __ATOMIC_RELEASE);
+	t_ring = -1;
+
+	return;
+}
+
+
+
+
+static void trace_key_create(void)
+{
+	if (0 != pthread_key_create(&g_trace_key, trace_release_ring)) {
+		log_warning("Failed to create key for trace rings, rings of exited threads won't be reused %s", "");
+		return;
+	}
+	g_trace_key_valid = true;
+	return;
+}
+
+
+
+
+char const * trace_event_label(uint32_t event)
+{
+	switch (event) {
+	case TRACE_EVENT_RECEIVE:
+		return "RECEIVE";
+	case TRACE_EVENT_DISPATCH:
+		return "DISPATCH";
+	case TRACE_EVENT_ENQUEUE:
+		return "ENQUEUE";
+	case TRACE_EVENT_KEY:
+		return "KEY";
+	case TRACE_EVENT_PTT:
+		return "PTT";
+	case TRACE_EVENT_TQ_LOW:
+		return "TQ_LOW";
+	case TRACE_EVENT_REPLY:
+		return "REPLY";
+	case TRACE_EVENT_CW_IO:
+		return "CW_IO";
+	case TRACE_EVENT_PTT_IO:
+		return "PTT_IO";
+	case TRACE_EVENT_PADDLE:
+		return "PADDLE";
+	case TRACE_EVENT_SUSPEND:
+		return "SUSPEND";
+	case TRACE_EVENT_RESUME:
+		return "RESUME";
+	case TRACE_EVENT_NONE:
+	default:
+		return "??";
+	}
+}
+
+
+
+
+int trace_map_open(trace_map_t * map, char const * path)
+{
+	memset(map, 0, sizeof (trace_map_t));
+
+	int const fd = open(path, O_RDONLY);
+	if (-1 == fd) {
+		log_error("Failed to open trace file [%s]: %s", path, strerror(errno));
+		return -1;
+	}
+	struct stat st = { 0 };
+	if (0 != fstat(fd, &st) || (size_t) st.st_size < sizeof (trace_file_header_t)) {
+		log_error("Trace file [%s] is too short", path);
+		close(fd);
+		return -1;
+	}
+
+	void * const base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == base) {
+		log_error("Failed to map trace file [%s]: %s", path, strerror(errno));
+		return -1;
+	}
+
+	trace_file_header_t const * const header = (trace_file_header_t const *) base;
+	if (TRACE_MAGIC != __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE)
+	    || TRACE_VERSION != header->version
+	    || sizeof (trace_record_t) != header->record_size
+	    || (size_t) st.st_size < trace_file_size(header->rings_count, header->ring_capacity)) {
+
+		log_error("File [%s] is not a valid trace file", path);
+		munmap(base, (size_t) st.st_size);
+		return -1;
+	}
+
+	map->header = header;
+	map->size = (size_t) st.st_size;
+	return 0;
+}
+
+
+
+
+void trace_map_close(trace_map_t * map)
+{
+	if (map->header) {
+		munmap((void *) map->header, map->size);
+		map->header = NULL;
+		map->size = 0;
+	}
+	return;
+}
+
+
+
+
+size_t trace_map_read_ring(trace_map_t const * map, unsigned int ring, trace_record_t * records, size_t size)
+{
+	trace_file_header_t const * const header = map->header;
+	if (ring >= header->rings_count) {
+		return 0;
+	}
+	uint8_t * const base = (uint8_t *) header; // Only for computation of offsets, we will only read.
+	trace_ring_header_t const * const rh = trace_ring_header(base, ring);
+	trace_record_t const * const ring_records = trace_ring_records(base, header->rings_count, header->ring_capacity, ring);
+
+	uint64_t const head = __atomic_load_n(&rh->head, __ATOMIC_ACQUIRE);
+	uint64_t const first = head > header->ring_capacity ? head - header->ring_capacity : 0;
+
+	size_t n = 0;
+	for (uint64_t pos = first; pos < head && n < size; pos++) {
+		trace_record_t const * const record = &ring_records[pos & (header->ring_capacity - 1)];
+
+		uint64_t const seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+		if (seq != pos + 1) {
+			continue; // Being written, or already overwritten.
+		}
+		trace_record_t copy = *record;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq != __atomic_load_n(&record->seq, __ATOMIC_RELAXED)) {
+			continue; // Overwritten while we were copying it.
+		}
+		copy.seq = seq;
+		records[n++] = copy;
+	}
+
+	return n;
+}
+
@@ -0,0 +1,217 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_TRACE_H
+#define CWDAEMON_TRACE_H
+
+
+
+
+/// @file
+///
+/// Binary trace of events happening on hot paths of cwdaemon.
+///
+/// Regular logs (log.h) are formatted as text and written to file or syslog,
+/// which is too slow and too intrusive for timing-critical code like libcw's
+/// keying callback. Tracepoints defined here write fixed-size binary records
+/// into a file mapped into memory. Each thread that records events gets its
+/// own ring of records, so a writer never waits for a lock and never
+/// competes with other writers. The file can be read while cwdaemon is
+/// running, or after cwdaemon has exited, by tools/trace_dump.
+///
+/// When tracing is disabled (no trace file has been opened), a tracepoint
+/// costs a single comparison.
+
+
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+
+#define TRACE_MAGIC    0x54445743u /**< "CWDT" in a little-endian file. */
+#define TRACE_VERSION  1u
+
+#define TRACE_RINGS_COUNT_DEFAULT          8u /**< Max count of threads that can record events. */
+#define TRACE_RING_CAPACITY_DEFAULT     4096u /**< Records per ring. Must be a power of two. */
+
+
+
+
+/// Types of events recorded by tracepoints.
+///
+/// Values of the enum are stored in trace file, so don't change existing
+/// values. Add new values at the end.
+typedef enum {
+	TRACE_EVENT_NONE     = 0,
+	TRACE_EVENT_RECEIVE  = 1, /**< Request received from socket. arg0: size of request. */
+	TRACE_EVENT_DISPATCH = 2, /**< Request dispatched. arg0: Escape code, or zero for plain request. */
+	TRACE_EVENT_ENQUEUE  = 3, /**< Character enqueued for keying. arg0: character. */
+	TRACE_EVENT_KEY      = 4, /**< Keying edge on cwdevice. arg0: new state of key. */
+	TRACE_EVENT_PTT      = 5, /**< PTT change on cwdevice. arg0: new state of PTT, arg1: PTT flags. */
+	TRACE_EVENT_TQ_LOW   = 6, /**< "Tone queue low" callback. arg0: tone queue length, arg1: PTT flags. */
+	TRACE_EVENT_REPLY    = 7, /**< Reply sent to client. arg0: size of reply. */
+	TRACE_EVENT_CW_IO    = 8, /**< I/O on CW pin done. arg0: queue delay [us], arg1: time of I/O [us]. */
+	TRACE_EVENT_PTT_IO   = 9, /**< I/O on PTT pin done. arg0: queue delay [us], arg1: time of I/O [us]. */
+	TRACE_EVENT_PADDLE   = 10, /**< Change of paddles. arg0: pressed paddles (IAMBIC_PADDLE_*). */
+	TRACE_EVENT_SUSPEND  = 11, /**< Idle keying engine closed. arg0: idle time [s]. */
+	TRACE_EVENT_RESUME   = 12, /**< Suspended keying engine opened again. arg0: time of opening [us]. */
+
+	TRACE_EVENT_MAX /**< Keep this as the last item. */
+} trace_event_t;
+
+
+
+
+/// A single record in a ring. Size of the record is 32 bytes, so that two
+/// records fit into a single cache line.
+typedef struct {
+	/// One-based position of the record in its ring. Zero when the record
+	/// is being written, or has never been written.
+	uint64_t seq;
+	uint64_t timestamp_ns; ///< CLOCK_MONOTONIC time stamp.
+	uint32_t event;        ///< One of trace_event_t values.
+	uint32_t arg0;
+	uint32_t arg1;
+	uint32_t reserved;
+} trace_record_t;
+
+
+
+
+/// Header of a single ring.
+typedef struct {
+	/// Count of records written to the ring since the trace file has been
+	/// opened. Written only by the owner of the ring.
+	uint64_t head;
+	uint32_t owner_pid;
+	/// Non-zero when the owner of the ring has exited, and the ring can be
+	/// claimed by next thread. Records of the owners follow each other in
+	/// the ring.
+	uint32_t released;
+	uint32_t reserved[12];
+} trace_ring_header_t;
+
+
+
+
+/// Header at the beginning of trace file.
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t rings_count;
+	uint32_t ring_capacity;
+	uint32_t rings_used;     ///< Count of rings claimed by threads.
+	uint32_t record_size;
+	uint64_t dropped;        ///< Count of events from threads that didn't get a ring.
+	uint32_t reserved[8];
+} trace_file_header_t;
+
+
+
+
+/// @brief Create trace file and start recording events
+///
+/// Existing file at @p path is truncated.
+///
+/// @param[in] path Path to trace file, e.g. a file in /dev/shm
+/// @param[in] rings_count Max count of threads that can record events
+/// @param[in] ring_capacity Count of records in each ring, must be a power of two
+///
+/// @return 0 on success
+/// @return -1 on failure
+int trace_open(char const * path, unsigned int rings_count, unsigned int ring_capacity);
+
+
+
+
+/// @brief Stop recording events, unmap trace file
+///
+/// Contents of the file is preserved so that it can be decoded later. The
+/// function must not be called while other threads may be recording events.
+void trace_close(void);
+
+
+
+
+/// @brief Record an event in the ring of calling thread
+///
+/// The function does nothing if trace file has not been opened.
+///
+/// @param[in] event Type of event
+/// @param[in] arg0 First event-specific argument
+/// @param[in] arg1 Second event-specific argument
+void trace_event(trace_event_t event, uint32_t arg0, uint32_t arg1);
+
+
+
+
+/// @brief Get label of trace event
+char const * trace_event_label(uint32_t event);
+
+
+
+
+/// Read-only view of trace file, used by decoder.
+typedef struct {
+	trace_file_header_t const * header;
+	size_t size; ///< Size of mapped region.
+} trace_map_t;
+
+
+
+
+/// @brief Map existing trace file for reading
+///
+/// @return 0 on success
+/// @return -1 on failure
+int trace_map_open(trace_map_t * map, char const * path);
+
+
+
+
+void trace_map_close(trace_map_t * map);
+
+
+
+
+/// @brief Copy consistent records from given ring of trace file
+///
+/// Records are copied in order in which they were written. Records that are
+/// being overwritten by a writer at the time of reading are skipped.
+///
+/// @param[in] map Trace file mapped with trace_map_open()
+/// @param[in] ring Index of ring
+/// @param[out] records Output buffer
+/// @param[in] size Count of records that fit into @p records
+///
+/// @return count of records copied to @p records
+size_t trace_map_read_ring(trace_map_t const * map, unsigned int ring, trace_record_t * records, size_t size);
+
+
+
+
+#endif /* #ifndef CWDAEMON_TRACE_H */
+
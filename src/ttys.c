@@ -44,6 +44,9 @@
 #if HAVE_TERMIOS_H
 # include <termios.h>
 #endif
+#if HAVE_LINUX_SERIAL_H
+# include <linux/serial.h>
+#endif
 #if HAVE_SYS_STAT_H
 # include <sys/stat.h>
 #endif
@@ -52,10 +55,13 @@
 #endif
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "cwdaemon.h"
+#include "iambic.h"
 #include "log.h"
 #include "ttys.h"
 #include "utils.h"
@@ -72,11 +78,34 @@
 
 
 
+/// Count of rounds of measurement of latency of tty lines.
+#define TTYS_CALIBRATION_ROUNDS 16
+
+/// Max value of "latency=<microseconds>" option.
+#define TTYS_LATENCY_MAX_US 100000
+
+
+
+
 static int ttys_init(cwdevice * dev, int fd);
 static int ttys_close(cwdevice * dev);
 static int ttys_reset_pins_state(cwdevice * dev);
 static int ttys_cw(cwdevice * dev, int onoff);
 static int ttys_ptt(cwdevice * dev, int onoff);
+static int ttys_footswitch(cwdevice * dev);
+static int ttys_paddles(cwdevice * dev);
+static int ttys_input_line(const char * value, unsigned int * line);
+static void ttys_update_inputs(cwdevice * dev);
+#ifdef TIOCMIWAIT
+static int ttys_wait_input(cwdevice * dev);
+static int ttys_input_events(cwdevice * dev, unsigned int lines, unsigned long * count);
+#endif
+static void ttys_set_lines(cwdevice * dev, unsigned int mask, unsigned int values);
+static void ttys_ioctl(cwdevice * dev, unsigned long request, int arg);
+static void ttys_low_latency(cwdevice * dev, bool enable);
+static void ttys_calibrate(cwdevice * dev);
+static int compare_longs(void const * a, void const * b);
+static int64_t ttys_now_us(void);
 
 static int ttys_optparse(cwdevice * dev, const char * option);
 static int ttys_optvalidate(cwdevice * dev);
@@ -126,6 +155,8 @@ out:
 int tty_init_cwdevice(cwdevice * dev)
 {
 	memset(dev, 0, sizeof (cwdevice));
+	dev->fd = -1;
+	dev->io = &cwdevice_io_system;
 
 	dev->init                  = ttys_init;
 	dev->free                  = ttys_close; // The function name on the right is correct. The cwdevice::free method will be renamed to cwdevice::close in the future.
@@ -169,8 +200,27 @@ int tty_init_cwdevice(cwdevice * dev)
 static int ttys_init(cwdevice * dev, int fd)
 {
 	dev->fd = fd;
+
+	ttys_low_latency(dev, true);
+
+	// Initial state of lines is needed to skip redundant changes of lines
+	// and to change several lines with TIOCMSET.
+	int lines = 0;
+	if (0 == dev->io->ioctl(dev->fd, TIOCMGET, &lines)) {
+		dev->shadow.lines = (unsigned int) lines;
+		dev->shadow.valid = true;
+	} else {
+		log_warning("ioctl(TIOCMGET) failed for tty device [%s]: %s", dev->desc, strerror(errno));
+		dev->shadow.valid = false;
+	}
+	dev->options.u.tty_options.input_events_valid = false;
+
 	dev->reset_pins_state(dev);
 
+	if (dev->options.u.tty_options.latency_auto) {
+		ttys_calibrate(dev);
+	}
+
 	return 0;
 }
 
@@ -188,9 +238,11 @@ static int ttys_close(cwdevice * dev)
 	// We will no longer use this device, so let's make sure that its pins
 	// are in the same state as they were initially.
 	dev->reset_pins_state(dev);
+	ttys_low_latency(dev, false);
 
 	close(dev->fd);
 	dev->fd = -1;
+	dev->shadow.valid = false;
 
 	return 0;
 }
@@ -207,8 +259,10 @@ static int ttys_close(cwdevice * dev)
 /// @return 0
 static int ttys_reset_pins_state(cwdevice * dev)
 {
-	ttys_cw (dev, OFF);
-	ttys_ptt (dev, OFF);
+	tty_driver_options const * const dropt = &dev->options.u.tty_options;
+
+	// Both lines are changed with a single ioctl().
+	ttys_set_lines(dev, dropt->key | dropt->ptt, 0);
 	return 0;
 }
 
@@ -230,11 +284,7 @@ static int ttys_cw(cwdevice * dev, int onoff)
 		return 0;
 	}
 
-	int result = ioctl (dev->fd, onoff ? TIOCMBIS : TIOCMBIC, &dropt->key);
-	if (result < 0) {
-		cwdaemon_errmsg("Ioctl serial port %s", dev->desc);
-		exit (1); // TODO (acerion) 2024.05.09: we shouldn't exit here. Maybe in cwdaemon.c, but not here.
-	}
+	ttys_set_lines(dev, dropt->key, onoff ? dropt->key : 0);
 	return 0;
 }
 
@@ -258,12 +308,311 @@ static int ttys_ptt(cwdevice * dev, int onoff)
 		return 0;
 	}
 
-	int result = ioctl (dev->fd, onoff ? TIOCMBIS : TIOCMBIC, &dropt->ptt);
-	if (result < 0) {
+	ttys_set_lines(dev, dropt->ptt, onoff ? dropt->ptt : 0);
+	return 0;
+}
+
+
+
+
+/// @brief Get state of footswitch connected to tty cwdevice
+///
+/// @param dev cwdevice from which to read the footswitch
+///
+/// @return 0 if footswitch is pressed (its line is asserted)
+/// @return 1 otherwise
+static int ttys_footswitch(cwdevice * dev)
+{
+	int lines = 0;
+	if (0 != dev->io->ioctl(dev->fd, TIOCMGET, &lines)) {
+		return 1;
+	}
+	return (lines & (int) dev->options.u.tty_options.footswitch) ? 0 : 1;
+}
+
+
+
+
+/// @brief Get state of paddles connected to tty cwdevice
+///
+/// @param dev cwdevice from which to read the paddles
+///
+/// @return IAMBIC_PADDLE_* bits of pressed paddles (asserted lines)
+static int ttys_paddles(cwdevice * dev)
+{
+	tty_driver_options const * const dropt = &dev->options.u.tty_options;
+	int lines = 0;
+	if (0 != dev->io->ioctl(dev->fd, TIOCMGET, &lines)) {
+		return 0;
+	}
+	int paddles = 0;
+	if (lines & (int) dropt->dot) {
+		paddles |= IAMBIC_PADDLE_DOT;
+	}
+	if (lines & (int) dropt->dash) {
+		paddles |= IAMBIC_PADDLE_DASH;
+	}
+	return paddles;
+}
+
+
+
+
+#ifdef TIOCMIWAIT
+/// @brief Wait for change of input lines of tty cwdevice
+///
+/// TIOCMIWAIT waits for a change that happens after the ioctl() has been
+/// called, but the caller reads the lines before calling this function. A
+/// change between the reading and the ioctl() would be noticed only on the
+/// next change. So the function compares driver's count of changes with
+/// the count taken when the function has returned previously (i.e. before
+/// the caller has read the lines), and returns immediately if they differ.
+/// The first call returns immediately, to take the first count.
+///
+/// Drivers that don't count changes (e.g. pty) are just waited on.
+///
+/// @param dev cwdevice on which to wait
+///
+/// @return 0 when the line may have changed
+/// @return -1 on errors, including interruption by signal (EINTR)
+static int ttys_wait_input(cwdevice * dev)
+{
+	tty_driver_options * const dropt = &dev->options.u.tty_options;
+	unsigned int const lines = dropt->footswitch | dropt->dot | dropt->dash;
+
+	unsigned long count = 0;
+	if (0 == ttys_input_events(dev, lines, &count)) {
+		bool const changed = !dropt->input_events_valid || count != dropt->input_events;
+		dropt->input_events = count;
+		dropt->input_events_valid = true;
+		if (changed) {
+			return 0;
+		}
+	} else {
+		dropt->input_events_valid = false;
+	}
+
+	// Argument of TIOCMIWAIT is the mask itself, not a pointer.
+	int const retv = dev->io->ioctl(dev->fd, TIOCMIWAIT, (void *) (uintptr_t) lines);
+	if (0 == retv && dropt->input_events_valid) {
+		int const err = errno;
+		if (0 != ttys_input_events(dev, lines, &dropt->input_events)) {
+			dropt->input_events_valid = false;
+		}
+		errno = err;
+	}
+	return retv;
+}
+
+
+
+
+/// @brief Get count of changes of given input lines of tty cwdevice, as counted by driver
+///
+/// @param dev cwdevice from which to get the count
+/// @param[in] lines TIOCM_* bits of input lines
+/// @param[out] count Sum of counts of changes of @p lines
+///
+/// @return 0 on success
+/// @return -1 if the driver doesn't count changes of lines
+static int ttys_input_events(cwdevice * dev, unsigned int lines, unsigned long * count)
+{
+#if HAVE_LINUX_SERIAL_H && defined(TIOCGICOUNT)
+	struct serial_icounter_struct icount;
+	memset(&icount, 0, sizeof (icount));
+	if (0 != dev->io->ioctl(dev->fd, TIOCGICOUNT, &icount)) {
+		return -1;
+	}
+	*count = 0;
+	if (lines & TIOCM_CTS) {
+		*count += (unsigned long) icount.cts;
+	}
+	if (lines & TIOCM_DSR) {
+		*count += (unsigned long) icount.dsr;
+	}
+	if (lines & TIOCM_CD) {
+		*count += (unsigned long) icount.dcd;
+	}
+	if (lines & TIOCM_RI) {
+		*count += (unsigned long) icount.rng;
+	}
+	return 0;
+#else
+	(void) dev;
+	(void) lines;
+	(void) count;
+	return -1;
+#endif
+}
+#endif
+
+
+
+
+/// @brief Change state of given output lines of tty cwdevice
+///
+/// When the shadow of lines is valid, lines that are already in requested
+/// state are not touched, and the function does nothing if all lines are
+/// in requested state. Lines that are set and lines that are cleared are
+/// changed with one TIOCMBIS and one TIOCMBIC, so a change of several
+/// lines in the same direction (e.g. reset of key and PTT) is a single
+/// ioctl().
+///
+/// The shadow isn't protected by a lock: after initialization of the
+/// cwdevice all changes of lines are made by keying I/O thread
+/// (keying_io.h).
+///
+/// @param dev cwdevice on which to change the lines
+/// @param[in] mask TIOCM_* bits of lines to change
+/// @param[in] values New states of lines selected by @p mask
+static void ttys_set_lines(cwdevice * dev, unsigned int mask, unsigned int values)
+{
+	if (0 == mask || dev->fd < 0) {
+		return;
+	}
+	values &= mask;
+
+	unsigned int changed = mask;
+	if (dev->shadow.valid) {
+		changed = ((dev->shadow.lines & ~mask) | values) ^ dev->shadow.lines;
+	}
+
+	if (changed & values) {
+		ttys_ioctl(dev, TIOCMBIS, (int) (changed & values));
+	}
+	if (changed & ~values) {
+		ttys_ioctl(dev, TIOCMBIC, (int) (changed & ~values));
+	}
+	dev->shadow.lines = (dev->shadow.lines & ~mask) | values;
+
+	return;
+}
+
+
+
+
+static void ttys_ioctl(cwdevice * dev, unsigned long request, int arg)
+{
+	if (dev->io->ioctl(dev->fd, request, &arg) < 0) {
 		cwdaemon_errmsg("Ioctl serial port %s", dev->desc);
 		exit (1); // TODO (acerion) 2024.05.09: we shouldn't exit here. Maybe in cwdaemon.c, but not here.
 	}
-	return 0;
+	return;
+}
+
+
+
+
+/// @brief Enable or disable low-latency mode of serial driver
+///
+/// In low-latency mode a serial driver (e.g. ftdi_sio) doesn't delay
+/// transfers to/from the device. The mode is disabled when the device is
+/// closed only if it was enabled by this function.
+///
+/// @param dev cwdevice on which to change the mode
+/// @param[in] enable whether to enable or disable the mode
+static void ttys_low_latency(cwdevice * dev, bool enable)
+{
+#if HAVE_LINUX_SERIAL_H && defined(ASYNC_LOW_LATENCY)
+	tty_driver_options * const dropt = &dev->options.u.tty_options;
+	if (!enable && !dropt->low_latency_set) {
+		return;
+	}
+
+	struct serial_struct serial = { 0 };
+	if (0 != dev->io->ioctl(dev->fd, TIOCGSERIAL, &serial)) {
+		log_info("Low-latency mode is not supported by tty device [%s]", dev->desc);
+		return;
+	}
+	if (enable) {
+		if (serial.flags & ASYNC_LOW_LATENCY) {
+			return; // Already enabled by someone else, leave it as it is.
+		}
+		serial.flags |= ASYNC_LOW_LATENCY;
+	} else {
+		serial.flags &= ~ASYNC_LOW_LATENCY;
+	}
+	if (0 != dev->io->ioctl(dev->fd, TIOCSSERIAL, &serial)) {
+		log_info("Failed to %s low-latency mode of tty device [%s]: %s", enable ? "enable" : "disable", dev->desc, strerror(errno));
+		return;
+	}
+	dropt->low_latency_set = enable;
+	log_info("Low-latency mode of tty device [%s] has been %s", dev->desc, enable ? "enabled" : "disabled");
+#else
+	(void) dev;
+	(void) enable;
+#endif
+	return;
+}
+
+
+
+
+/// @brief Measure latency of changing lines of tty cwdevice
+///
+/// USB-serial adapters execute modem-control requests in a round-trip to
+/// the adapter, which takes from tens of microseconds to several
+/// milliseconds, depending on chip and driver. The function measures a
+/// change of lines (TIOCMBIC of lines used for keying and PTT, which are
+/// already cleared, so nothing goes on air) and a read of lines (TIOCMGET),
+/// and stores median time of the change in cwdevice::latency_us.
+///
+/// @param dev cwdevice to calibrate, with keying and PTT lines cleared
+static void ttys_calibrate(cwdevice * dev)
+{
+	tty_driver_options const * const dropt = &dev->options.u.tty_options;
+	unsigned int const lines = dropt->key | dropt->ptt;
+	if (dev->fd < 0 || 0 == lines) {
+		return;
+	}
+
+	long change_us[TTYS_CALIBRATION_ROUNDS] = { 0 };
+	long read_us[TTYS_CALIBRATION_ROUNDS] = { 0 };
+	for (size_t i = 0; i < TTYS_CALIBRATION_ROUNDS; i++) {
+		int arg = (int) lines;
+		int64_t const start = ttys_now_us();
+		if (0 != dev->io->ioctl(dev->fd, TIOCMBIC, &arg)) {
+			log_warning("Failed to measure latency of tty device [%s]: %s", dev->desc, strerror(errno));
+			return;
+		}
+		int64_t const changed = ttys_now_us();
+		if (0 != dev->io->ioctl(dev->fd, TIOCMGET, &arg)) {
+			log_warning("Failed to measure latency of tty device [%s]: %s", dev->desc, strerror(errno));
+			return;
+		}
+		change_us[i] = (long) (changed - start);
+		read_us[i] = (long) (ttys_now_us() - changed);
+	}
+	qsort(change_us, TTYS_CALIBRATION_ROUNDS, sizeof (long), compare_longs);
+	qsort(read_us, TTYS_CALIBRATION_ROUNDS, sizeof (long), compare_longs);
+
+	dev->latency_us = (unsigned int) change_us[TTYS_CALIBRATION_ROUNDS / 2];
+	log_info("Latency of tty device [%s]: change of lines (min/median/max): %ld/%ld/%ld us, read of lines: %ld/%ld/%ld us",
+	         dev->desc,
+	         change_us[0], change_us[TTYS_CALIBRATION_ROUNDS / 2], change_us[TTYS_CALIBRATION_ROUNDS - 1],
+	         read_us[0], read_us[TTYS_CALIBRATION_ROUNDS / 2], read_us[TTYS_CALIBRATION_ROUNDS - 1]);
+
+	return;
+}
+
+
+
+
+static int compare_longs(void const * a, void const * b)
+{
+	long const la = *(long const *) a;
+	long const lb = *(long const *) b;
+	return (la > lb) - (la < lb);
+}
+
+
+
+
+static int64_t ttys_now_us(void)
+{
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
 
@@ -313,8 +662,76 @@ static int ttys_optparse(cwdevice * dev, const char * option)
 			return -1;
 		}
 		ttys_ptt(dev, 0);
+	} else if (opt_success == find_opt_value(option, "footswitch", &value)) {
+		/* footswitch=CTS|DSR|DCD|RI|none */
+		if (0 != ttys_input_line(value, &dropt->footswitch)) {
+			cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "Invalid value for 'footswitch' option: %s", value);
+			return -1;
+		}
+		ttys_update_inputs(dev);
+	} else if (opt_success == find_opt_value(option, "dot", &value)) {
+		/* dot=CTS|DSR|DCD|RI|none */
+		if (0 != ttys_input_line(value, &dropt->dot)) {
+			cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "Invalid value for 'dot' option: %s", value);
+			return -1;
+		}
+		ttys_update_inputs(dev);
+	} else if (opt_success == find_opt_value(option, "dash", &value)) {
+		/* dash=CTS|DSR|DCD|RI|none */
+		if (0 != ttys_input_line(value, &dropt->dash)) {
+			cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "Invalid value for 'dash' option: %s", value);
+			return -1;
+		}
+		ttys_update_inputs(dev);
+	} else if (opt_success == find_opt_value(option, "latency", &value)) {
+		/* latency=auto|none|<microseconds> */
+		if (!strcasecmp(value, "auto")) {
+			dropt->latency_auto = true;
+			ttys_calibrate(dev);
+		} else if (!strcasecmp(value, "none")) {
+			dropt->latency_auto = false;
+			dev->latency_us = 0;
+		} else {
+			char * end = NULL;
+			errno = 0;
+			long const us = strtol(value, &end, 10);
+			if (0 != errno || end == value || '\0' != *end || us < 0 || us > TTYS_LATENCY_MAX_US) {
+				cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "Invalid value for 'latency' option: %s", value);
+				return -1;
+			}
+			dropt->latency_auto = false;
+			dev->latency_us = (unsigned int) us;
+		}
+	} else {
+		cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "Invalid option for keying device (expected 'key|ptt=RTS|DTR|none', 'footswitch|dot|dash=CTS|DSR|DCD|RI|none' or 'latency=auto|none|<us>'): [%s]", option);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+
+/// @brief Parse name of input line of tty
+///
+/// @param[in] value name of line: CTS, DSR, DCD, RI or none
+/// @param[out] line TIOCM_* bit of the line, or zero for "none"
+///
+/// @return 0 on success
+/// @return -1 if @p value is not a valid name
+static int ttys_input_line(const char * value, unsigned int * line)
+{
+	if (!strcasecmp(value, "cts")) {
+		*line = TIOCM_CTS;
+	} else if (!strcasecmp(value, "dsr")) {
+		*line = TIOCM_DSR;
+	} else if (!strcasecmp(value, "dcd")) {
+		*line = TIOCM_CD;
+	} else if (!strcasecmp(value, "ri")) {
+		*line = TIOCM_RI;
+	} else if (!strcasecmp(value, "none")) {
+		*line = 0;
 	} else {
-		cwdaemon_debug(CWDAEMON_VERBOSITY_E, __func__, __LINE__, "Invalid option for keying device (expected 'key|ptt=RTS|DTR|none'): [%s]", option);
 		return -1;
 	}
 	return 0;
@@ -323,6 +740,20 @@ static int ttys_optparse(cwdevice * dev, const char * option)
 
 
 
+/// @brief Set methods reading input lines according to configured lines
+static void ttys_update_inputs(cwdevice * dev)
+{
+	tty_driver_options const * const dropt = &dev->options.u.tty_options;
+	dev->footswitch = dropt->footswitch ? ttys_footswitch : NULL;
+	dev->paddles = (dropt->dot || dropt->dash) ? ttys_paddles : NULL;
+#ifdef TIOCMIWAIT
+	dev->wait_input = (dev->footswitch || dev->paddles) ? ttys_wait_input : NULL;
+#endif
+}
+
+
+
+
 /// @brief Validate parsed driver options
 ///
 /// @reviewed_on{2024.05.09}
@@ -343,6 +774,17 @@ static int ttys_optvalidate(cwdevice * dev)
 		return -1;
 	}
 
+	unsigned int const inputs[3] = { dropt->footswitch, dropt->dot, dropt->dash };
+	for (size_t i = 0; i < 3; i++) {
+		for (size_t j = i + 1; j < 3; j++) {
+			if (0 != inputs[i] && inputs[i] == inputs[j]) {
+				/* You can't use the same tty pin for two purposes. */
+				log_error("two input functions use the same pin 0x%02x", inputs[i]);
+				return -1;
+			}
+		}
+	}
+
 	return 0;
 }
 
@@ -4,6 +4,11 @@
 
 
 
+#include <stdbool.h>
+
+
+
+
 // Forward declaration.
 struct cwdev_s;
 
@@ -13,6 +18,14 @@ struct cwdev_s;
 typedef struct tty_driver_options {
 	unsigned int key; // Pin/line used for keying. TIOCM_DTR by default. "unsigned" because TIOCM_* is defined as hex value.
 	unsigned int ptt; // Pin/line used for PTT.    TIOCM_RTS by default. "unsigned" because TIOCM_* is defined as hex value.
+	unsigned int footswitch; // Input line used for footswitch (TIOCM_CTS/DSR/CD/RI), 0 (none) by default.
+	unsigned int dot;        // Input line used for dot paddle (or straight key), 0 (none) by default.
+	unsigned int dash;       // Input line used for dash paddle, 0 (none) by default.
+	bool latency_auto; // Measure latency of changing a line each time the device is opened ("latency=auto").
+
+	bool low_latency_set; // Not an option: ASYNC_LOW_LATENCY has been set by driver and must be cleared when the device is closed.
+	bool input_events_valid; // Not an option: is input_events known?
+	unsigned long input_events; // Not an option: count of changes of input lines (TIOCGICOUNT), taken when cwdevice::wait_input() has returned.
 } tty_driver_options;
 
 
@@ -23,6 +23,8 @@
 
 
 
+#include "config.h"
+
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
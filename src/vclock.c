@@ -0,0 +1,772 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Virtual clock. See vclock.h for description of the clock.
+///
+/// Layout of state file:
+///
+/// <verbatim>
+///     vclock_file_header_t
+///     vclock_slot_t [VCLOCK_SLOTS_COUNT]
+/// </verbatim>
+///
+/// Each participant (a thread) owns one slot with its state and deadline.
+/// All changes of states, and advances of the clock, are made under a
+/// spinlock in the header: critical sections are short, and participants
+/// are in different processes that don't share any other synchronization
+/// primitive. Sleeping participants wait on a futex word in the header,
+/// incremented on each advance of the clock. The futex waits have a short
+/// timeout of real time, after which a waiter frees slots of processes that
+/// have exited, and checks whether the clock has stalled.
+
+
+
+
+#define _GNU_SOURCE /* syscall() */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "vclock.h"
+#ifndef VCLOCK_LOG_STDERR
+#include "log.h"
+#endif
+
+
+
+
+#ifdef VCLOCK_LOG_STDERR
+// Test programs and tools that aren't linked with cwdaemon's log.c.
+#define vclock_log_error(format, ...)   fprintf(stderr, "[EE] Virtual clock: " format "\n", __VA_ARGS__)
+#define vclock_log_warning(format, ...) fprintf(stderr, "[WW] Virtual clock: " format "\n", __VA_ARGS__)
+#else
+#define vclock_log_error(format, ...)   log_error("Virtual clock: " format, __VA_ARGS__)
+#define vclock_log_warning(format, ...) log_warning("Virtual clock: " format, __VA_ARGS__)
+#endif
+
+
+
+
+#define VCLOCK_MAGIC    0x43565743u /**< "CWVC" in a little-endian file. */
+#define VCLOCK_VERSION  1u
+
+#define VCLOCK_NANOSECS_PER_SEC  1000000000u
+
+/// Real time between checks made by a waiting participant: for processes
+/// that have exited, and for stall of the clock.
+#define VCLOCK_CHECK_INTERVAL_NS  10000000u
+
+/// Interval of real time in which vclock_select() polls descriptors.
+#define VCLOCK_SELECT_POLL_US  1000
+
+
+
+
+/// States of participant.
+typedef enum {
+	VCLOCK_STATE_RUNNING  = 0, /**< Clock must not advance. */
+	VCLOCK_STATE_SLEEPING = 1, /**< Sleeping until deadline. */
+	VCLOCK_STATE_WAITING  = 2, /**< Blocked in external wait, optionally with deadline. */
+} vclock_state_t;
+
+
+
+
+typedef struct {
+	uint32_t pid;          ///< Process of the participant. Zero for unused slot.
+	uint32_t state;        ///< One of vclock_state_t values.
+	uint64_t deadline_ns;  ///< Virtual time at which sleeping or waiting participant wants to run. Zero for none.
+} vclock_slot_t;
+
+
+
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots_count;
+	uint32_t lock;         ///< Spinlock guarding slots and advances of the clock.
+
+	/// Futex word, incremented on every advance of the clock. Sleeping
+	/// participants sleep on it.
+	uint32_t ticks;
+
+	uint32_t holds;        ///< Count of holds (vclock_hold()) not released yet.
+	uint32_t stalls;       ///< Count of advances forced after VCLOCK_STALL_MS of no progress.
+	uint32_t reserved[9];
+	uint64_t now_ns;       ///< Current virtual time.
+	uint64_t progress_ns;  ///< CLOCK_MONOTONIC time of last activity of any participant.
+} vclock_file_header_t;
+
+
+
+
+static struct {
+	vclock_file_header_t * header; ///< NULL when virtual clock is disabled.
+	vclock_slot_t * slots;
+	pthread_key_t key;             ///< Key with destructor freeing slot of exiting thread.
+} g_vclock;
+
+static pthread_once_t g_vclock_once = PTHREAD_ONCE_INIT;
+
+/// Index of slot owned by current thread, or -1.
+static __thread int t_vclock_slot = -1;
+
+
+
+
+static void vclock_init(void);
+static void vclock_atfork_child(void);
+static void vclock_thread_exit(void * arg);
+static vclock_slot_t * vclock_self(void);
+static void vclock_lock(void);
+static void vclock_unlock(void);
+static bool vclock_advance_locked(bool force);
+static void vclock_check(void);
+static bool vclock_pid_is_gone(pid_t pid);
+static void vclock_futex_wait(uint32_t * word, uint32_t value, uint64_t timeout_ns);
+static void vclock_futex_wake(uint32_t * word);
+static uint64_t vclock_real_now_ns(void);
+
+
+
+
+bool vclock_enabled(void)
+{
+	pthread_once(&g_vclock_once, vclock_init);
+	return NULL != g_vclock.header;
+}
+
+
+
+
+uint64_t vclock_now_ns(void)
+{
+	if (!vclock_enabled()) {
+		return vclock_real_now_ns();
+	}
+	return __atomic_load_n(&g_vclock.header->now_ns, __ATOMIC_ACQUIRE);
+}
+
+
+
+
+void vclock_gettime(struct timespec * ts)
+{
+	uint64_t const now = vclock_now_ns();
+	ts->tv_sec = (time_t) (now / VCLOCK_NANOSECS_PER_SEC);
+	ts->tv_nsec = (long) (now % VCLOCK_NANOSECS_PER_SEC);
+	return;
+}
+
+
+
+
+void vclock_sleep_until_ns(uint64_t deadline_ns)
+{
+	if (!vclock_enabled()) {
+		struct timespec const deadline = {
+			.tv_sec = (time_t) (deadline_ns / VCLOCK_NANOSECS_PER_SEC),
+			.tv_nsec = (long) (deadline_ns % VCLOCK_NANOSECS_PER_SEC),
+		};
+		while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)) {
+			;
+		}
+		return;
+	}
+
+	vclock_file_header_t * const header = g_vclock.header;
+	vclock_slot_t * const self = vclock_self();
+	if (NULL == self) {
+		// No free slot. Sleep without taking part in advancing the clock.
+		while (__atomic_load_n(&header->now_ns, __ATOMIC_ACQUIRE) < deadline_ns) {
+			uint32_t const ticks = __atomic_load_n(&header->ticks, __ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&header->now_ns, __ATOMIC_ACQUIRE) >= deadline_ns) {
+				break;
+			}
+			vclock_futex_wait(&header->ticks, ticks, VCLOCK_CHECK_INTERVAL_NS);
+			vclock_check();
+		}
+		return;
+	}
+
+	vclock_lock();
+	if (header->now_ns >= deadline_ns) {
+		vclock_unlock();
+		return;
+	}
+	self->deadline_ns = deadline_ns;
+	__atomic_store_n(&self->state, VCLOCK_STATE_SLEEPING, __ATOMIC_RELEASE);
+	bool const advanced = vclock_advance_locked(false);
+	vclock_unlock();
+	if (advanced) {
+		vclock_futex_wake(&header->ticks);
+	}
+
+	// Advance of the clock to our deadline changes our state to "running".
+	while (true) {
+		uint32_t const ticks = __atomic_load_n(&header->ticks, __ATOMIC_ACQUIRE);
+		if (VCLOCK_STATE_RUNNING == __atomic_load_n(&self->state, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		vclock_futex_wait(&header->ticks, ticks, VCLOCK_CHECK_INTERVAL_NS);
+		vclock_check();
+	}
+
+	return;
+}
+
+
+
+
+void vclock_sleep_ns(uint64_t duration_ns)
+{
+	vclock_sleep_until_ns(vclock_now_ns() + duration_ns);
+	return;
+}
+
+
+
+
+void vclock_attach(void)
+{
+	if (vclock_enabled()) {
+		vclock_self();
+	}
+	return;
+}
+
+
+
+
+void vclock_wait_begin(uint64_t deadline_ns)
+{
+	if (!vclock_enabled()) {
+		return;
+	}
+	vclock_slot_t * const self = vclock_self();
+	if (NULL == self) {
+		return;
+	}
+
+	vclock_lock();
+	self->deadline_ns = deadline_ns;
+	__atomic_store_n(&self->state, VCLOCK_STATE_WAITING, __ATOMIC_RELEASE);
+	bool const advanced = vclock_advance_locked(false);
+	vclock_unlock();
+	if (advanced) {
+		vclock_futex_wake(&g_vclock.header->ticks);
+	}
+	return;
+}
+
+
+
+
+bool vclock_wait_expired(void)
+{
+	if (!vclock_enabled() || t_vclock_slot < 0) {
+		return false;
+	}
+	vclock_slot_t * const self = &g_vclock.slots[t_vclock_slot];
+	vclock_check();
+	return 0 != self->deadline_ns
+		&& VCLOCK_STATE_RUNNING == __atomic_load_n(&self->state, __ATOMIC_ACQUIRE);
+}
+
+
+
+
+void vclock_wait_end(void)
+{
+	if (!vclock_enabled() || t_vclock_slot < 0) {
+		return;
+	}
+	vclock_slot_t * const self = &g_vclock.slots[t_vclock_slot];
+
+	vclock_lock();
+	__atomic_store_n(&self->state, VCLOCK_STATE_RUNNING, __ATOMIC_RELEASE);
+	self->deadline_ns = 0;
+	__atomic_store_n(&g_vclock.header->progress_ns, vclock_real_now_ns(), __ATOMIC_RELAXED);
+	vclock_unlock();
+	return;
+}
+
+
+
+
+void vclock_hold(void)
+{
+	if (!vclock_enabled()) {
+		return;
+	}
+	__atomic_add_fetch(&g_vclock.header->holds, 1, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&g_vclock.header->progress_ns, vclock_real_now_ns(), __ATOMIC_RELAXED);
+	return;
+}
+
+
+
+
+void vclock_release(void)
+{
+	if (!vclock_enabled()) {
+		return;
+	}
+	vclock_file_header_t * const header = g_vclock.header;
+
+	vclock_lock();
+	// Holds are reset when a stalled clock is forced to advance, so the
+	// count may already be zero.
+	if (header->holds > 0) {
+		__atomic_sub_fetch(&header->holds, 1, __ATOMIC_ACQ_REL);
+	}
+	__atomic_store_n(&header->progress_ns, vclock_real_now_ns(), __ATOMIC_RELAXED);
+	bool const advanced = vclock_advance_locked(false);
+	vclock_unlock();
+	if (advanced) {
+		vclock_futex_wake(&header->ticks);
+	}
+	return;
+}
+
+
+
+
+int vclock_select(int nfds, fd_set * readfds, fd_set * writefds, fd_set * exceptfds, struct timeval * timeout)
+{
+	if (!vclock_enabled()) {
+		return select(nfds, readfds, writefds, exceptfds, timeout);
+	}
+
+	fd_set sets[3];
+	fd_set * const user[3] = { readfds, writefds, exceptfds };
+	for (int i = 0; i < 3; i++) {
+		if (user[i]) {
+			sets[i] = *user[i];
+		}
+	}
+
+	uint64_t deadline_ns = 0;
+	if (timeout) {
+		deadline_ns = vclock_now_ns()
+			+ (uint64_t) timeout->tv_sec * VCLOCK_NANOSECS_PER_SEC
+			+ (uint64_t) timeout->tv_usec * 1000u;
+	}
+
+	vclock_wait_begin(deadline_ns);
+	int rv = 0;
+	while (true) {
+		for (int i = 0; i < 3; i++) {
+			if (user[i]) {
+				*user[i] = sets[i];
+			}
+		}
+		struct timeval poll = { .tv_sec = 0, .tv_usec = VCLOCK_SELECT_POLL_US };
+		rv = select(nfds, readfds, writefds, exceptfds, &poll);
+		if (0 != rv || vclock_wait_expired()) {
+			break;
+		}
+	}
+	vclock_wait_end();
+
+	return rv;
+}
+
+
+
+
+unsigned int vclock_stalls(void)
+{
+	if (!vclock_enabled()) {
+		return 0;
+	}
+	return __atomic_load_n(&g_vclock.header->stalls, __ATOMIC_ACQUIRE);
+}
+
+
+
+
+/// @brief Map state file of virtual clock, if it's selected with VCLOCK_ENV_PATH
+static void vclock_init(void)
+{
+	char const * const path = getenv(VCLOCK_ENV_PATH);
+	if (NULL == path || '\0' == path[0]) {
+		return;
+	}
+
+	int const fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if (-1 == fd) {
+		vclock_log_error("failed to open state file [%s], using real clock: %s", path, strerror(errno));
+		return;
+	}
+	size_t const size = sizeof (vclock_file_header_t) + VCLOCK_SLOTS_COUNT * sizeof (vclock_slot_t);
+	struct stat st = { 0 };
+	if (0 != fstat(fd, &st)
+	    || ((size_t) st.st_size < size && 0 != ftruncate(fd, (off_t) size))) {
+		vclock_log_error("failed to prepare state file [%s], using real clock: %s", path, strerror(errno));
+		close(fd);
+		return;
+	}
+	if (0 == st.st_size) {
+		// New file. Let processes of other users use it too, regardless of umask.
+		(void) fchmod(fd, 0666);
+	}
+	void * const base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // The mapping stays valid after the file is closed.
+	if (MAP_FAILED == base) {
+		vclock_log_error("failed to map state file [%s], using real clock: %s", path, strerror(errno));
+		return;
+	}
+
+	vclock_file_header_t * const header = (vclock_file_header_t *) base;
+	if (0 == __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE)) {
+		// New file, filled with zeros. The stores are the same in all
+		// processes that may be initializing the file at the same time.
+		// The clock starts at current real time, so that time stamps
+		// look familiar in logs.
+		header->version = VCLOCK_VERSION;
+		header->slots_count = VCLOCK_SLOTS_COUNT;
+		uint64_t zero = 0;
+		__atomic_compare_exchange_n(&header->now_ns, &zero, vclock_real_now_ns(), false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+		__atomic_store_n(&header->magic, VCLOCK_MAGIC, __ATOMIC_RELEASE);
+	}
+	if (VCLOCK_MAGIC != header->magic
+	    || VCLOCK_VERSION != header->version
+	    || VCLOCK_SLOTS_COUNT != header->slots_count) {
+
+		vclock_log_error("[%s] is not a valid state file, using real clock", path);
+		munmap(base, size);
+		return;
+	}
+
+	if (0 != pthread_key_create(&g_vclock.key, vclock_thread_exit)) {
+		munmap(base, size);
+		return;
+	}
+	pthread_atfork(NULL, NULL, vclock_atfork_child);
+
+	g_vclock.slots = (vclock_slot_t *) ((uint8_t *) base + sizeof (vclock_file_header_t));
+	g_vclock.header = header;
+	return;
+}
+
+
+
+
+/// Only the thread that has called fork() exists in child process, and
+/// the slot of the thread belongs to parent process.
+static void vclock_atfork_child(void)
+{
+	t_vclock_slot = -1;
+	if (g_vclock.header) {
+		pthread_setspecific(g_vclock.key, NULL);
+	}
+	return;
+}
+
+
+
+
+/// Destructor of thread-specific value: free slot of exiting thread.
+static void vclock_thread_exit(void * arg)
+{
+	vclock_slot_t * const slot = &g_vclock.slots[(intptr_t) arg - 1];
+
+	vclock_lock();
+	__atomic_store_n(&slot->pid, 0, __ATOMIC_RELEASE);
+	slot->state = VCLOCK_STATE_RUNNING;
+	slot->deadline_ns = 0;
+	bool const advanced = vclock_advance_locked(false);
+	vclock_unlock();
+	if (advanced) {
+		vclock_futex_wake(&g_vclock.header->ticks);
+	}
+	t_vclock_slot = -1;
+	return;
+}
+
+
+
+
+/// @brief Get slot of calling thread, claim a slot if the thread doesn't have one
+///
+/// @return slot of the thread
+/// @return NULL if all slots are used
+static vclock_slot_t * vclock_self(void)
+{
+	if (t_vclock_slot >= 0) {
+		return &g_vclock.slots[t_vclock_slot];
+	}
+
+	int index = -1;
+	vclock_lock();
+	for (unsigned int i = 0; i < VCLOCK_SLOTS_COUNT; i++) {
+		if (0 == g_vclock.slots[i].pid) {
+			index = (int) i;
+			g_vclock.slots[i].state = VCLOCK_STATE_RUNNING;
+			g_vclock.slots[i].deadline_ns = 0;
+			__atomic_store_n(&g_vclock.slots[i].pid, (uint32_t) getpid(), __ATOMIC_RELEASE);
+			break;
+		}
+	}
+	vclock_unlock();
+
+	if (index < 0) {
+		static bool reported = false;
+		if (!__atomic_exchange_n(&reported, true, __ATOMIC_RELAXED)) {
+			vclock_log_warning("all %u slots of participants are used", VCLOCK_SLOTS_COUNT);
+		}
+		return NULL;
+	}
+	t_vclock_slot = index;
+	pthread_setspecific(g_vclock.key, (void *) (intptr_t) (index + 1));
+	return &g_vclock.slots[index];
+}
+
+
+
+
+static void vclock_lock(void)
+{
+	while (__atomic_exchange_n(&g_vclock.header->lock, 1, __ATOMIC_ACQUIRE)) {
+		sched_yield();
+	}
+	return;
+}
+
+
+
+
+static void vclock_unlock(void)
+{
+	__atomic_store_n(&g_vclock.header->lock, 0, __ATOMIC_RELEASE);
+	return;
+}
+
+
+
+
+/// @brief Advance the clock to earliest deadline, if no participant is running
+///
+/// Participants whose deadlines have been reached are marked as running.
+/// Call this with the lock taken, and wake up sleepers if the function
+/// returns true.
+///
+/// @param[in] force Advance even if some participant is running or the clock is held
+///
+/// @return true if the clock has been advanced (or deadlines have been reached)
+/// @return false otherwise
+static bool vclock_advance_locked(bool force)
+{
+	vclock_file_header_t * const header = g_vclock.header;
+	if (!force && 0 != header->holds) {
+		return false;
+	}
+
+	uint64_t next = UINT64_MAX;
+	for (unsigned int i = 0; i < VCLOCK_SLOTS_COUNT; i++) {
+		vclock_slot_t const * const slot = &g_vclock.slots[i];
+		if (0 == slot->pid) {
+			continue;
+		}
+		if (VCLOCK_STATE_RUNNING == slot->state) {
+			if (!force) {
+				return false;
+			}
+			continue;
+		}
+		if (0 != slot->deadline_ns && slot->deadline_ns < next) {
+			next = slot->deadline_ns;
+		}
+	}
+	if (UINT64_MAX == next) {
+		return false; // Nobody to wake up.
+	}
+
+	if (next > header->now_ns) {
+		__atomic_store_n(&header->now_ns, next, __ATOMIC_RELEASE);
+	}
+	for (unsigned int i = 0; i < VCLOCK_SLOTS_COUNT; i++) {
+		vclock_slot_t * const slot = &g_vclock.slots[i];
+		if (0 != slot->pid
+		    && VCLOCK_STATE_RUNNING != slot->state
+		    && 0 != slot->deadline_ns
+		    && slot->deadline_ns <= header->now_ns) {
+
+			__atomic_store_n(&slot->state, VCLOCK_STATE_RUNNING, __ATOMIC_RELEASE);
+		}
+	}
+	__atomic_add_fetch(&header->ticks, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&header->progress_ns, vclock_real_now_ns(), __ATOMIC_RELAXED);
+	return true;
+}
+
+
+
+
+/// @brief Periodic check made by waiting participants
+///
+/// Free slots of processes that have exited (their threads can't free the
+/// slots), and advance the clock if it has stalled.
+static void vclock_check(void)
+{
+	vclock_file_header_t * const header = g_vclock.header;
+	uint64_t const real = vclock_real_now_ns();
+	uint64_t const idle = real - __atomic_load_n(&header->progress_ns, __ATOMIC_RELAXED);
+	if (idle < VCLOCK_CHECK_INTERVAL_NS) {
+		return;
+	}
+
+	pid_t const own = getpid();
+	bool freed = false;
+	for (unsigned int i = 0; i < VCLOCK_SLOTS_COUNT; i++) {
+		uint32_t const pid = __atomic_load_n(&g_vclock.slots[i].pid, __ATOMIC_ACQUIRE);
+		if (0 == pid || own == (pid_t) pid || !vclock_pid_is_gone((pid_t) pid)) {
+			continue;
+		}
+		vclock_lock();
+		if (pid == g_vclock.slots[i].pid) {
+			g_vclock.slots[i].pid = 0;
+			g_vclock.slots[i].state = VCLOCK_STATE_RUNNING;
+			g_vclock.slots[i].deadline_ns = 0;
+			freed = true;
+		}
+		vclock_unlock();
+	}
+
+	vclock_lock();
+	bool advanced = freed && vclock_advance_locked(false);
+	bool const stalled = !advanced && idle >= (uint64_t) VCLOCK_STALL_MS * 1000000u;
+	if (stalled) {
+		__atomic_store_n(&header->holds, 0, __ATOMIC_RELEASE);
+		advanced = vclock_advance_locked(true);
+		if (advanced) {
+			__atomic_add_fetch(&header->stalls, 1, __ATOMIC_RELAXED);
+		}
+	}
+	vclock_unlock();
+
+	if (advanced) {
+		if (stalled) {
+			vclock_log_warning("no progress for %u ms of real time, advancing the clock anyway", VCLOCK_STALL_MS);
+		}
+		vclock_futex_wake(&header->ticks);
+	}
+	return;
+}
+
+
+
+
+/// @brief Check if a process doesn't run anymore
+///
+/// A zombie process is treated as gone: it has done all its work, and it
+/// may stay a zombie until its parent is woken up by the clock.
+static bool vclock_pid_is_gone(pid_t pid)
+{
+	if (0 != kill(pid, 0) && ESRCH == errno) {
+		return true;
+	}
+#if defined(__linux__)
+	char path[32];
+	snprintf(path, sizeof (path), "/proc/%d/stat", (int) pid);
+	int const fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (-1 == fd) {
+		return false;
+	}
+	char buf[128] = { 0 };
+	ssize_t const n = read(fd, buf, sizeof (buf) - 1);
+	close(fd);
+	// Format: "pid (comm) state ...", comm may contain spaces and parens.
+	char const * const paren = n > 0 ? strrchr(buf, ')') : NULL;
+	return NULL != paren && ' ' == paren[1] && 'Z' == paren[2];
+#else
+	return false;
+#endif
+}
+
+
+
+
+static void vclock_futex_wait(uint32_t * word, uint32_t value, uint64_t timeout_ns)
+{
+#if defined(__linux__)
+	struct timespec const timeout = {
+		.tv_sec = (time_t) (timeout_ns / VCLOCK_NANOSECS_PER_SEC),
+		.tv_nsec = (long) (timeout_ns % VCLOCK_NANOSECS_PER_SEC),
+	};
+	syscall(SYS_futex, word, FUTEX_WAIT, value, &timeout, NULL, 0);
+#else
+	// No futex: poll the word.
+	uint64_t const end = vclock_real_now_ns() + timeout_ns;
+	while (value == __atomic_load_n(word, __ATOMIC_ACQUIRE) && vclock_real_now_ns() < end) {
+		struct timespec const poll = { .tv_sec = 0, .tv_nsec = 100000 };
+		nanosleep(&poll, NULL);
+	}
+#endif
+	return;
+}
+
+
+
+
+static void vclock_futex_wake(uint32_t * word)
+{
+#if defined(__linux__)
+	syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+	(void) word;
+#endif
+	return;
+}
+
+
+
+
+static uint64_t vclock_real_now_ns(void)
+{
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * VCLOCK_NANOSECS_PER_SEC + (uint64_t) now.tv_nsec;
+}
@@ -0,0 +1,199 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_VCLOCK_H
+#define CWDAEMON_VCLOCK_H
+
+
+
+
+/// @file
+///
+/// Virtual clock, for running functional tests faster than real time.
+///
+/// Functional tests key Morse code at 4-60 WPM and wait for a receiver to
+/// decode it, so most of their time is spent sleeping. When environment
+/// variable VCLOCK_ENV_PATH is set, cwdaemon and the test programs read
+/// time and sleep through this module, and the time is virtual: a clock
+/// shared by all the processes through a file mapped into memory.
+///
+/// The virtual clock doesn't advance while any participant is running.
+/// A participant is a thread that has slept on the virtual clock at least
+/// once. When all participants sleep (or wait for an external event, see
+/// vclock_wait_begin()), the clock jumps straight to the earliest deadline
+/// of sleeping participants, and the participants with that deadline are
+/// woken up. Keying edges are therefore made and observed at exactly the
+/// virtual times at which they have been scheduled, however long the real
+/// processing takes.
+///
+/// A thread that hands work over to a participant (e.g. sends a request to
+/// cwdaemon, or posts a command to keying I/O thread) holds the clock with
+/// vclock_hold() until the receiver picks the work up and calls
+/// vclock_release(). Otherwise the clock could jump over the time at which
+/// the work should be done.
+///
+/// If the clock can't advance for VCLOCK_STALL_MS of real time (e.g. a
+/// hold has never been released because the receiver has exited), it is
+/// advanced anyway, and a warning is logged. Slots of processes
+/// that have exited are freed, so exit of a process doesn't stop the clock.
+///
+/// Only "native" keying engine is driven by the virtual clock. Timing of
+/// libcw's generator can't be controlled from outside of libcw.
+///
+/// When VCLOCK_ENV_PATH is not set, the functions use CLOCK_MONOTONIC and
+/// real sleeps, and holds are no-ops.
+///
+/// Errors are logged with log.h. Test programs and tools that aren't linked
+/// with cwdaemon's log.c compile vclock.c with VCLOCK_LOG_STDERR defined,
+/// and the errors are printed to stderr.
+
+
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/select.h>
+#include <time.h>
+
+
+
+
+/// Name of environment variable with path to state file of virtual clock.
+/// Virtual clock is disabled when the variable is not set.
+#define VCLOCK_ENV_PATH  "CWDAEMON_VCLOCK"
+
+
+#define VCLOCK_SLOTS_COUNT  64u   /**< Max count of participants in all processes. */
+#define VCLOCK_STALL_MS     2000u /**< Real time after which a stalled clock is advanced anyway. */
+
+
+
+
+/// @brief Check if virtual clock is enabled in this process
+bool vclock_enabled(void);
+
+
+
+
+/// @brief Get current time in nanoseconds
+///
+/// @return virtual time if virtual clock is enabled
+/// @return CLOCK_MONOTONIC time otherwise
+uint64_t vclock_now_ns(void);
+
+
+
+
+/// @brief Get current time, like clock_gettime(CLOCK_MONOTONIC)
+void vclock_gettime(struct timespec * ts);
+
+
+
+
+/// @brief Sleep until given time
+///
+/// Interruptions by signals are not reported, the sleep is continued.
+///
+/// @param[in] deadline_ns Time (as returned by vclock_now_ns()) at which to wake up
+void vclock_sleep_until_ns(uint64_t deadline_ns);
+
+
+
+
+/// @brief Sleep for given duration
+void vclock_sleep_ns(uint64_t duration_ns);
+
+
+
+
+/// @brief Make calling thread a participant
+///
+/// The clock doesn't advance while a participant runs. A thread becomes a
+/// participant also on its first sleep or wait, but a thread that may
+/// receive work before it sleeps (e.g. a thread started to serve a queue)
+/// should call this function as the first thing it does.
+void vclock_attach(void);
+
+
+
+
+/// @brief Mark calling thread as blocked in a wait that the clock doesn't know about
+///
+/// Call this before blocking in pthread_cond_wait(), sem_wait(), poll()
+/// and the like, and call vclock_wait_end() after the wait, so that the
+/// clock can advance while the thread is blocked. The thread that wakes
+/// the waiting thread up must hold the clock (vclock_hold()).
+///
+/// @param[in] deadline_ns Timeout of the wait (virtual time), or zero for no timeout
+void vclock_wait_begin(uint64_t deadline_ns);
+
+
+
+
+/// @brief Check if the clock has reached deadline given to vclock_wait_begin()
+///
+/// @return true if deadline of current wait has been reached
+/// @return false otherwise, or if the wait has no deadline
+bool vclock_wait_expired(void);
+
+
+
+
+void vclock_wait_end(void);
+
+
+
+
+/// @brief Prevent the clock from advancing until vclock_release() is called
+///
+/// Holds are counted. A hold may be released by other thread, or by other
+/// process.
+void vclock_hold(void);
+
+
+
+
+void vclock_release(void);
+
+
+
+
+/// @brief select() that waits on virtual clock
+///
+/// In virtual clock mode the timeout is measured in virtual time, and the
+/// descriptors are polled in short intervals of real time while the clock
+/// doesn't reach the timeout.
+int vclock_select(int nfds, fd_set * readfds, fd_set * writefds, fd_set * exceptfds, struct timeval * timeout);
+
+
+
+
+/// @brief Get count of forced advances of stalled clock
+///
+/// @return count of advances made after VCLOCK_STALL_MS of no progress
+/// @return 0 if virtual clock is disabled
+unsigned int vclock_stalls(void);
+
+
+
+
+#endif /* #ifndef CWDAEMON_VCLOCK_H */
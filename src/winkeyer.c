@@ -0,0 +1,371 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// WinKeyer cwdevice: host side of K1EL WinKeyer protocol. See winkeyer.h
+/// for description of the device.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "cwdaemon.h"
+#include "log.h"
+#include "utils.h"
+#include "winkeyer.h"
+
+
+
+
+/// Time to wait for reply to "host open" command.
+#define WINKEYER_HOST_OPEN_TIMEOUT_MS  1000
+
+/// Time to wait for space in output buffer of serial port.
+#define WINKEYER_WRITE_TIMEOUT_MS  1000
+
+
+
+
+/// State of the (single) opened WinKeyer.
+static struct {
+	/// Serializes writes from cwdevice's methods and from keying engine.
+	pthread_mutex_t write_mutex;
+	int fd;
+	struct termios saved_termios;
+	bool saved_termios_valid;
+} g_winkeyer = {
+	.write_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.fd = -1,
+};
+
+
+
+
+/// Prosigns of cwdaemon, sent as two merged letters.
+static char const * const g_winkeyer_prosigns[128] = {
+	['<'] = "SK", ['>'] = "BK", ['!'] = "SN", ['&'] = "AS", ['^'] = "KA", ['~'] = "AL",
+};
+
+/// Characters other than letters and digits that are sent as they are.
+static char const g_winkeyer_punctuation[] = " \"$'()+,-./:;=?@";
+
+
+
+
+static int winkeyer_configure_tty(int fd);
+static int winkeyer_host_open(int fd);
+static int winkeyer_write_fd(int fd, uint8_t const * bytes, size_t count);
+
+
+
+
+bool winkeyer_is_device_name(char const * fname)
+{
+	return 0 == strncmp(fname, WINKEYER_DEVICE_PREFIX, strlen(WINKEYER_DEVICE_PREFIX));
+}
+
+
+
+
+int winkeyer_probe_cwdevice(char const * fname)
+{
+	if (!winkeyer_is_device_name(fname)) {
+		return -1;
+	}
+	char const * const tty = fname + strlen(WINKEYER_DEVICE_PREFIX);
+
+	char path[MAXPATHLEN];
+	int const retv = build_full_device_path(path, sizeof (path), tty);
+	if (0 != retv) {
+		log_error("Can't build path of tty of WinKeyer from [%s]: %s", tty, strerror(-retv));
+		return -1;
+	}
+	int const fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (-1 == fd) {
+		log_error("Failed to open tty of WinKeyer [%s]: %s", path, strerror(errno));
+		return -1;
+	}
+	if (!isatty(fd)) {
+		log_error("Device of WinKeyer [%s] is not a tty", path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+
+
+int winkeyer_init(cwdevice * dev, int fd)
+{
+	dev->fd = fd;
+	dev->latency_us = 0;
+	dev->shadow.valid = false;
+	dev->shadow.data_valid = false;
+
+	if (-1 != g_winkeyer.fd) {
+		log_error("WinKeyer is already open, can't open another one [%s]", dev->desc);
+		return -1;
+	}
+	if (0 != winkeyer_configure_tty(fd)) {
+		return -1;
+	}
+	int const version = winkeyer_host_open(fd);
+	if (version < 0) {
+		log_error("WinKeyer [%s] didn't reply to \"host open\" command", dev->desc);
+		return -1;
+	}
+	log_info("Opened WinKeyer [%s], firmware version %d", dev->desc, version);
+
+	// Characters are echoed when they are keyed. This is how the host
+	// knows how many characters are still in keyer's buffer.
+	uint8_t const setup[] = {
+		WINKEYER_CMD_MODE, WINKEYER_MODE_SERIAL_ECHO,
+		WINKEYER_CMD_PIN_CONFIG, WINKEYER_PINCFG_KEY1 | WINKEYER_PINCFG_SIDETONE | WINKEYER_PINCFG_PTT,
+	};
+	if (0 != winkeyer_write_fd(fd, setup, sizeof (setup))) {
+		return -1;
+	}
+
+	__atomic_store_n(&g_winkeyer.fd, fd, __ATOMIC_RELEASE);
+	return 0;
+}
+
+
+
+
+int winkeyer_free(cwdevice * dev)
+{
+	if (-1 == dev->fd) {
+		return 0;
+	}
+	if (dev->fd == g_winkeyer.fd) {
+		uint8_t const close_host[] = {
+			WINKEYER_CMD_CLEAR_BUFFER,
+			WINKEYER_CMD_ADMIN, WINKEYER_ADMIN_HOST_CLOSE,
+		};
+		winkeyer_write(close_host, sizeof (close_host));
+		tcdrain(dev->fd);
+		if (g_winkeyer.saved_termios_valid) {
+			tcsetattr(dev->fd, TCSANOW, &g_winkeyer.saved_termios);
+			g_winkeyer.saved_termios_valid = false;
+		}
+		__atomic_store_n(&g_winkeyer.fd, -1, __ATOMIC_RELEASE);
+	}
+	close(dev->fd);
+	dev->fd = -1;
+
+	return 0;
+}
+
+
+
+
+int winkeyer_reset_pins_state(cwdevice * dev)
+{
+	(void) dev;
+	uint8_t const reset[] = {
+		WINKEYER_CMD_CLEAR_BUFFER,
+		WINKEYER_CMD_KEY_IMMEDIATE, 0,
+		WINKEYER_CMD_PTT, 0,
+	};
+	return winkeyer_write(reset, sizeof (reset));
+}
+
+
+
+
+int winkeyer_cw(cwdevice * dev, int onoff)
+{
+	(void) dev;
+	uint8_t const key[] = { WINKEYER_CMD_KEY_IMMEDIATE, onoff ? 1 : 0 };
+	return winkeyer_write(key, sizeof (key));
+}
+
+
+
+
+int winkeyer_ptt(cwdevice * dev, int onoff)
+{
+	(void) dev;
+	uint8_t const ptt[] = { WINKEYER_CMD_PTT, onoff ? 1 : 0 };
+	return winkeyer_write(ptt, sizeof (ptt));
+}
+
+
+
+
+int winkeyer_fd(void)
+{
+	return __atomic_load_n(&g_winkeyer.fd, __ATOMIC_ACQUIRE);
+}
+
+
+
+
+int winkeyer_write(uint8_t const * bytes, size_t count)
+{
+	int const fd = winkeyer_fd();
+	if (-1 == fd) {
+		return -1;
+	}
+	pthread_mutex_lock(&g_winkeyer.write_mutex);
+	int const retv = winkeyer_write_fd(fd, bytes, count);
+	pthread_mutex_unlock(&g_winkeyer.write_mutex);
+	return retv;
+}
+
+
+
+
+size_t winkeyer_character_bytes(char character, uint8_t * bytes, unsigned int * echoes)
+{
+	unsigned char const c = (unsigned char) toupper((unsigned char) character);
+	if (c >= 128 || '\0' == c) {
+		return 0;
+	}
+
+	if (g_winkeyer_prosigns[c]) {
+		bytes[0] = WINKEYER_CMD_MERGE;
+		bytes[1] = (uint8_t) g_winkeyer_prosigns[c][0];
+		bytes[2] = (uint8_t) g_winkeyer_prosigns[c][1];
+		*echoes = 2;
+		return 3;
+	}
+	if (isupper(c) || isdigit(c) || NULL != strchr(g_winkeyer_punctuation, c)) {
+		bytes[0] = c;
+		*echoes = 1;
+		return 1;
+	}
+	return 0;
+}
+
+
+
+
+/// @brief Put serial port into raw mode, 1200 baud, 8N2
+///
+/// Current settings of the port are saved, and are restored by winkeyer_free().
+static int winkeyer_configure_tty(int fd)
+{
+	struct termios tio;
+	if (0 != tcgetattr(fd, &tio)) {
+		log_error("Failed to get attributes of tty of WinKeyer: %s", strerror(errno));
+		return -1;
+	}
+	g_winkeyer.saved_termios = tio;
+	g_winkeyer.saved_termios_valid = true;
+
+	tio.c_iflag &= ~(tcflag_t) (IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF);
+	tio.c_oflag &= ~(tcflag_t) OPOST;
+	tio.c_lflag &= ~(tcflag_t) (ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	tio.c_cflag &= ~(tcflag_t) (CSIZE | PARENB);
+	tio.c_cflag |= CS8 | CSTOPB | CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	cfsetispeed(&tio, B1200);
+	cfsetospeed(&tio, B1200);
+	if (0 != tcsetattr(fd, TCSANOW, &tio)) {
+		log_error("Failed to set attributes of tty of WinKeyer: %s", strerror(errno));
+		return -1;
+	}
+	tcflush(fd, TCIOFLUSH);
+	return 0;
+}
+
+
+
+
+/// @brief Open host mode of the keyer
+///
+/// @return firmware version reported by the keyer
+/// @return -1 on failure
+static int winkeyer_host_open(int fd)
+{
+	uint8_t const open_host[] = { WINKEYER_CMD_ADMIN, WINKEYER_ADMIN_HOST_OPEN };
+	if (0 != winkeyer_write_fd(fd, open_host, sizeof (open_host))) {
+		return -1;
+	}
+
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	while (poll(&pfd, 1, WINKEYER_HOST_OPEN_TIMEOUT_MS) > 0) {
+		uint8_t byte = 0;
+		ssize_t const n = read(fd, &byte, 1);
+		if (1 != n) {
+			if (-1 == n && (EAGAIN == errno || EINTR == errno)) {
+				continue;
+			}
+			return -1;
+		}
+		// Keyer may report its status before the version.
+		if (WINKEYER_STATUS_TAG == (byte & WINKEYER_STATUS_MASK)) {
+			continue;
+		}
+		return byte;
+	}
+	return -1;
+}
+
+
+
+
+static int winkeyer_write_fd(int fd, uint8_t const * bytes, size_t count)
+{
+	size_t done = 0;
+	while (done < count) {
+		ssize_t const n = write(fd, bytes + done, count - done);
+		if (n > 0) {
+			done += (size_t) n;
+			continue;
+		}
+		if (-1 == n && EINTR == errno) {
+			continue;
+		}
+		if (-1 == n && EAGAIN == errno) {
+			struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+			if (poll(&pfd, 1, WINKEYER_WRITE_TIMEOUT_MS) > 0) {
+				continue;
+			}
+		}
+		log_error("Failed to write to WinKeyer: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+#ifndef CWDAEMON_WINKEYER_H
+#define CWDAEMON_WINKEYER_H
+
+
+
+
+/// @file
+///
+/// WinKeyer cwdevice: a K1EL WinKeyer (WK2/WK3) hardware keyer connected
+/// to a serial port.
+///
+/// The device is selected with "-d winkeyer:<tty>", e.g.
+/// "-d winkeyer:ttyUSB0". Unlike other cwdevices, WinKeyer is not keyed
+/// edge by edge by cwdaemon: text, speed, weighting, PTT lead-in/tail and
+/// aborts are forwarded to the keyer by "winkeyer" keying engine
+/// (engine_winkeyer.c), and the keyer does the timing of elements by
+/// itself. cwdaemon selects the engine automatically when the device is
+/// used.
+///
+/// This file implements host side of the protocol that is shared by the
+/// cwdevice and by the engine: opening of host mode, encoding of
+/// characters and serialized writes to the keyer.
+
+
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+
+/// Prefix of cwdevice name that selects WinKeyer cwdevice.
+#define WINKEYER_DEVICE_PREFIX "winkeyer:"
+
+/// Baud rate of WinKeyer's host interface.
+#define WINKEYER_BAUD_RATE  1200
+
+/// Size of keyer's input buffer, in bytes.
+#define WINKEYER_BUFFER_SIZE  128
+
+/// Max count of characters sent to the keyer and not yet keyed by it. The
+/// keyer signals XOFF only when its buffer is 2/3 full; abort (clearing of
+/// the buffer) is quicker and speed changes apply sooner when the host
+/// keeps fewer characters in the keyer.
+#define WINKEYER_INFLIGHT_MAX  16
+
+/// Range of speeds accepted by the keyer, in WPM.
+#define WINKEYER_SPEED_MIN   5
+#define WINKEYER_SPEED_MAX  99
+
+/// Max PTT lead-in or tail time, in milliseconds (the keyer uses 10 ms units).
+#define WINKEYER_PTT_TIME_MAX_MS  2550
+
+/// Max count of bytes of a single encoded character.
+#define WINKEYER_CHARACTER_BYTES_MAX  3
+
+
+
+
+/// Commands of WinKeyer host protocol.
+enum {
+	WINKEYER_CMD_ADMIN           = 0x00, /**< Followed by one of WINKEYER_ADMIN_* codes. */
+	WINKEYER_CMD_SIDETONE        = 0x01,
+	WINKEYER_CMD_SPEED           = 0x02, /**< nn: speed in WPM, immediate. */
+	WINKEYER_CMD_WEIGHTING       = 0x03, /**< nn: 10-90, 50 is normal. */
+	WINKEYER_CMD_PTT_LEAD_TAIL   = 0x04, /**< nn1 nn2: lead-in and tail, in 10 ms units. */
+	WINKEYER_CMD_PIN_CONFIG      = 0x09, /**< nn: WINKEYER_PINCFG_* bits. */
+	WINKEYER_CMD_CLEAR_BUFFER    = 0x0A, /**< Abort: clear buffer, stop keying. */
+	WINKEYER_CMD_KEY_IMMEDIATE   = 0x0B, /**< nn: 1 for key down, 0 for key up. */
+	WINKEYER_CMD_MODE            = 0x0E, /**< nn: WINKEYER_MODE_* bits. */
+	WINKEYER_CMD_STATUS          = 0x15, /**< Request status byte. */
+	WINKEYER_CMD_PTT             = 0x18, /**< nn: buffered PTT on/off. */
+	WINKEYER_CMD_MERGE           = 0x1B, /**< c1 c2: buffered merge of two letters into a prosign. */
+	WINKEYER_CMD_BUFFERED_SPEED  = 0x1C, /**< nn: buffered speed change. */
+};
+
+enum {
+	WINKEYER_ADMIN_HOST_OPEN  = 0x02, /**< Keyer replies with its version. */
+	WINKEYER_ADMIN_HOST_CLOSE = 0x03,
+};
+
+/// Bits of mode register.
+enum {
+	WINKEYER_MODE_SERIAL_ECHO = 0x04, /**< Echo characters to host as they are keyed. */
+};
+
+/// Bits of pin configuration register.
+enum {
+	WINKEYER_PINCFG_PTT       = 0x01, /**< Keyer drives PTT output. */
+	WINKEYER_PINCFG_SIDETONE  = 0x02,
+	WINKEYER_PINCFG_KEY1      = 0x08,
+};
+
+/// Bytes sent by the keyer to host. Status bytes have 110xxxxx bit
+/// pattern, speed pot bytes have 10xxxxxx bit pattern, other bytes are
+/// echoed characters.
+enum {
+	WINKEYER_STATUS_MASK      = 0xE0,
+	WINKEYER_STATUS_TAG       = 0xC0,
+	WINKEYER_SPEED_POT_MASK   = 0xC0,
+	WINKEYER_SPEED_POT_TAG    = 0x80,
+
+	WINKEYER_STATUS_XOFF      = 0x01, /**< Buffer is more than 2/3 full. */
+	WINKEYER_STATUS_BREAKIN   = 0x02, /**< Paddles have interrupted sending of buffer. */
+	WINKEYER_STATUS_BUSY      = 0x04, /**< Keyer is keying. */
+};
+
+
+
+
+struct cwdev_s;
+
+
+
+
+/// @brief Check if given cwdevice name selects WinKeyer cwdevice
+bool winkeyer_is_device_name(char const * fname);
+
+
+
+
+/// @brief Try opening a WinKeyer cwdevice with given device name
+///
+/// @param[in] fname Device name in form "winkeyer:<tty>"
+///
+/// @return file descriptor of opened tty on success
+/// @return -1 if @p fname doesn't select WinKeyer cwdevice, or on failure
+int winkeyer_probe_cwdevice(char const * fname);
+
+/// @brief Configure serial port and open host mode of WinKeyer
+///
+/// @return 0 on success
+/// @return -1 on failure
+int winkeyer_init(struct cwdev_s * dev, int fd);
+
+/// @brief Close host mode of WinKeyer and the serial port
+int winkeyer_free(struct cwdev_s * dev);
+
+/// @brief Clear keyer's buffer, put key up, turn PTT off
+int winkeyer_reset_pins_state(struct cwdev_s * dev);
+
+/// @brief Key the transmitter immediately, bypassing keyer's buffer
+int winkeyer_cw(struct cwdev_s * dev, int onoff);
+
+/// @brief Force PTT on or off (buffered command of the keyer)
+int winkeyer_ptt(struct cwdev_s * dev, int onoff);
+
+
+
+
+/// @brief Get file descriptor of serial port of opened WinKeyer
+///
+/// There is at most one WinKeyer cwdevice opened at a time.
+///
+/// @return file descriptor on success
+/// @return -1 if no WinKeyer cwdevice is open
+int winkeyer_fd(void);
+
+
+
+
+/// @brief Write a command to the keyer
+///
+/// Writes from cwdevice and from keying engine are serialized, so that
+/// multi-byte commands are never interleaved.
+///
+/// @return 0 on success
+/// @return -1 on failure
+int winkeyer_write(uint8_t const * bytes, size_t count);
+
+
+
+
+/// @brief Encode a character as bytes of WinKeyer protocol
+///
+/// Lower-case letters are sent as upper-case letters. Procedural signals
+/// of cwdaemon ('<', '>', '!', '&', '^', '~') are sent with buffered merge
+/// command.
+///
+/// @param[in] character Character to encode
+/// @param[out] bytes Output buffer, at least WINKEYER_CHARACTER_BYTES_MAX bytes
+/// @param[out] echoes Count of characters that the keyer will echo for the encoded character
+///
+/// @return count of bytes written to @p bytes
+/// @return zero if the keyer can't send the character
+size_t winkeyer_character_bytes(char character, uint8_t * bytes, unsigned int * echoes);
+
+
+
+
+#endif /* #ifndef CWDAEMON_WINKEYER_H */
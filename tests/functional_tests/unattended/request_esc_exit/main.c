@@ -65,6 +65,7 @@
 
 #include <errno.h>
 
+#include "src/vclock.h"
 #include "tests/library/client.h"
 //#include "tests/library/cwdevice_observer.h"
 //#include "tests/library/cwdevice_observer_serial.h"
@@ -153,7 +154,7 @@ static void sighandler(int sig)
 {
 	if (SIGCHLD == sig) {
 		g_child_exit_info.waitpid_retv = waitpid(g_child_exit_info.pid, &g_child_exit_info.wstatus, 0);
-		clock_gettime(CLOCK_MONOTONIC, &g_child_exit_info.sigchld_timestamp);
+		vclock_gettime(&g_child_exit_info.sigchld_timestamp);
 
 		// Re-enable signal handling.
 		//
@@ -189,6 +190,10 @@ int main(int argc, char * const * argv)
 	const uint32_t seed = cwdaemon_srandom(test_opts.random_seed);
 	test_log_info("Test: random seed: 0x%08x (%u)\n", seed, seed);
 
+	// The handler reads time with vclock_gettime(). Initialization of
+	// virtual clock on its first use isn't async-signal-safe, so do it
+	// before the handler is installed.
+	(void) vclock_enabled();
 	signal(SIGCHLD, sighandler);
 
 
@@ -58,6 +58,7 @@
 #include "string_utils.h"
 #include "thread.h"
 
+#include "src/vclock.h"
 #include "tests/library/sleep.h"
 
 
@@ -134,9 +135,13 @@ int client_send_esc_request(client_t * client, int code, const char * bytes, siz
 int client_send_request(client_t * client, const test_request_t * request)
 {
 	errno = 0;
+	// In virtual clock mode the clock is held until the server receives
+	// the request, so that the request is handled at its "real" time.
+	vclock_hold();
 	const ssize_t send_rc = send(client->sock, request->bytes, request->n_bytes, 0);
 	if (send_rc == -1) { /* TODO acerion 2024.02.28: shouldn't we compare the value with n_bytes? */
 		test_log_err("cwdaemon client: failed to send data to server: %s\n", strerror(errno));
+		vclock_release();
 		return -1;
 	}
 
@@ -203,6 +208,7 @@ static void * client_socket_receiver_thread_poll_fn(void * client_arg)
 				test_log_info("cwdaemon client: received %zu/[%s] from cwdaemon server\n",
 				              client->received_data.n_bytes, printable);
 				events_insert_reply_received_event(client->events, &client->received_data);
+				vclock_release(); // Held by server when it was sending the reply.
 			}
 		} else {
 			test_log_err("cwdaemon client: poll() error %s\n", "");
@@ -260,7 +266,9 @@ int client_socket_receive_stop(client_t * client)
 	test_log_info("cwdaemon client: stopping %s\n", client->socket_receiver_thread.name);
 	client->socket_receiver_thread.thread_loop_continue = false;
 	test_millisleep_nonintr(RECEIVE_THREAD_STOP_WAIT_MS);
+	vclock_wait_begin(0);
 	pthread_join(client->socket_receiver_thread.thread_id, NULL);
+	vclock_wait_end();
 	test_log_info("cwdaemon client: stopped %s, status = %u\n", client->socket_receiver_thread.name, client->socket_receiver_thread.status);
 
 	if (client->socket_receiver_thread.status != thread_stopped_ok) {
@@ -37,6 +37,7 @@
 #include <libcw.h>
 
 #include "cw_easy_receiver.h"
+#include "src/vclock.h"
 
 
 
@@ -66,6 +67,18 @@ void cw_easy_receiver_delete(cw_easy_rec_t ** easy_rec)
 
 
 void cw_easy_receiver_sk_event(cw_easy_rec_t * easy_rec, bool is_down)
+{
+	struct timespec ts = { 0 };
+	vclock_gettime(&ts);
+	cw_easy_receiver_sk_event_at(easy_rec, is_down, &ts);
+
+	return;
+}
+
+
+
+
+void cw_easy_receiver_sk_event_at(cw_easy_rec_t * easy_rec, bool is_down, struct timespec const * ts)
 {
 	/* Inform xcwcp receiver (which will inform libcw receiver)
 	   about new state of straight key ("sk").
@@ -82,12 +95,10 @@ void cw_easy_receiver_sk_event(cw_easy_rec_t * easy_rec, bool is_down)
 	   how straight key does not. Apparently the timer is used to
 	   recognize and distinguish dots from dashes. Maybe straight
 	   key could have such timer as well? */
-	struct timespec ts = { 0 };
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	easy_rec->main_timer.tv_sec  = ts.tv_sec;
-	easy_rec->main_timer.tv_usec = ts.tv_nsec / NANOSECS_PER_MICROSEC;
+	easy_rec->main_timer.tv_sec  = ts->tv_sec;
+	easy_rec->main_timer.tv_usec = ts->tv_nsec / NANOSECS_PER_MICROSEC;
 
-	// fprintf(stdout, "[II] Easy receiver: time on S-key [%s] event: %10ld.%09ld\n", is_down ? "down" : " up ", ts.tv_sec, ts.tv_nsec);
+	// fprintf(stdout, "[II] Easy receiver: time on S-key [%s] event: %10ld.%09ld\n", is_down ? "down" : " up ", ts->tv_sec, ts->tv_nsec);
 
 	cw_notify_straight_key_event(is_down);
 
@@ -113,7 +124,7 @@ void cw_easy_receiver_ik_left_event(cw_easy_rec_t * easy_rec, bool is_down, bool
 		   TODO: why libcw can't create such timestamp for
 		   first event for us? */
 		struct timespec ts = { 0 };
-		clock_gettime(CLOCK_MONOTONIC, &ts);
+		vclock_gettime(&ts);
 		easy_rec->main_timer.tv_sec  = ts.tv_sec;
 		easy_rec->main_timer.tv_usec = ts.tv_nsec / NANOSECS_PER_MICROSEC;
 
@@ -145,7 +156,7 @@ void cw_easy_receiver_ik_right_event(cw_easy_rec_t * easy_rec, bool is_down, boo
 		   next (non-initial) "paddle up" or "paddle down"
 		   event in a character will be created by libcw. */
 		struct timespec ts = { 0 };
-		clock_gettime(CLOCK_MONOTONIC, &ts);
+		vclock_gettime(&ts);
 		easy_rec->main_timer.tv_sec  = ts.tv_sec;
 		easy_rec->main_timer.tv_usec = ts.tv_nsec / NANOSECS_PER_MICROSEC;
 
@@ -284,7 +295,7 @@ void cw_easy_receiver_start(cw_easy_rec_t * easy_rec)
 	cw_iambic_keyer_register_timer(&easy_rec->main_timer);
 
 	struct timespec ts = { 0 };
-	clock_gettime(CLOCK_MONOTONIC, &ts);
+	vclock_gettime(&ts);
 	easy_rec->main_timer.tv_sec  = ts.tv_sec;
 	easy_rec->main_timer.tv_usec = ts.tv_nsec / NANOSECS_PER_MICROSEC;
 
@@ -384,7 +395,7 @@ bool cw_easy_receiver_poll_character(cw_easy_rec_t * easy_rec, cw_rec_data_t * e
 	   intervals measured by receiver.easy_rec->main_timer, and that would
 	   interfere with recognizing dots and dashes. */
 	struct timespec ts = { 0 };
-	clock_gettime(CLOCK_MONOTONIC, &ts);
+	vclock_gettime(&ts);
 	const struct timeval timer = { .tv_sec = ts.tv_sec, .tv_usec = ts.tv_nsec / NANOSECS_PER_MICROSEC };
 
 	// fprintf(stdout, "[II] Easy receiver: poll char:                  %10ld.%09ld\n", ts.tv_sec, ts.tv_nsec);
@@ -467,7 +478,7 @@ bool cw_easy_receiver_poll_space(cw_easy_rec_t * easy_rec, cw_rec_data_t * erd)
 	   marking initial "key down" events. Use local throw-away
 	   timer. */
 	struct timespec ts = { 0 };
-	clock_gettime(CLOCK_MONOTONIC, &ts);
+	vclock_gettime(&ts);
 	const struct timeval timer = { .tv_sec = ts.tv_sec, .tv_usec = ts.tv_nsec / NANOSECS_PER_MICROSEC };
 
 	// fprintf(stdout, "[II] Easy receiver: poll space:                 %10ld.%09ld\n", ts.tv_sec, ts.tv_nsec);
@@ -541,10 +552,10 @@ void cw_easy_receiver_clear(cw_easy_rec_t * easy_rec)
 
 
 
-int cw_easy_receiver_on_key_state_change(void * arg_easy_rec, bool key_is_down)
+int cw_easy_receiver_on_key_state_change(void * arg_easy_rec, bool key_is_down, struct timespec const * timestamp)
 {
 	cw_easy_rec_t * easy_rec = (cw_easy_rec_t *) arg_easy_rec;
-	cw_easy_receiver_sk_event(easy_rec, key_is_down);
+	cw_easy_receiver_sk_event_at(easy_rec, key_is_down, timestamp);
 
 	// fprintf(stdout, "[INFO ] easy receiver: key is %s\n", key_is_down ? "down" : "up");
 
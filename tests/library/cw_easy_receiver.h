@@ -6,6 +6,7 @@
 
 #include <stdbool.h>
 #include <sys/time.h>
+#include <time.h>
 
 
 
@@ -107,6 +108,14 @@ void cw_easy_receiver_clear(cw_easy_rec_t * easy_rec);
 */
 void cw_easy_receiver_sk_event(cw_easy_rec_t * easy_rec, bool is_down);
 
+/**
+   \brief Handle straight key event that happened at given time
+
+   \param is_down
+   \param ts CLOCK_MONOTONIC time of the event
+*/
+void cw_easy_receiver_sk_event_at(cw_easy_rec_t * easy_rec, bool is_down, struct timespec const * ts);
+
 /**
    \brief Handle event on left paddle of iambic keyer
 
@@ -172,9 +181,10 @@ int cw_easy_receiver_handle_libcw_keying_event(void * easy_receiver, bool key_is
 ///
 /// @param[in] arg_easy_rec cw_easy_rec_t variable
 /// @param[in] key_is_down current state of keying pin
+/// @param[in] timestamp CLOCK_MONOTONIC time of change of keying pin
 ///
 /// @return 0
-int cw_easy_receiver_on_key_state_change(void * arg_easy_rec, bool key_is_down);
+int cw_easy_receiver_on_key_state_change(void * arg_easy_rec, bool key_is_down, struct timespec const * timestamp);
 
 
 
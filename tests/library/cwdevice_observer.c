@@ -31,11 +31,17 @@
 
 
 
+#ifndef __FreeBSD__
+#define _POSIX_C_SOURCE 200809L /* sigaction(), pthread_kill() */
+#endif
+
 #include <errno.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 
 
@@ -44,6 +50,7 @@
 #include "cwdevice_observer.h"
 #include "log.h"
 #include "misc.h"
+#include "src/vclock.h"
 #include "tests/library/sleep.h"
 
 
@@ -59,10 +66,18 @@
 /// CPU usage is justified.
 #define KEY_SOURCE_DEFAULT_INTERVAL_US 100
 
+/// Signal that interrupts observer's thread blocked in waiting for edges.
+#define CWDEVICE_OBSERVER_WAKEUP_SIGNAL SIGUSR2
+
+/// Count of edges taken from cwdevice in one call to wait_edges_fn.
+#define CWDEVICE_OBSERVER_EDGES_MAX 16
+
 
 
 
 static void * cwdevice_observer_poll_thread(void * arg_observer);
+static void cwdevice_observer_report(cwdevice_observer_t * observer, cwdevice_observer_edge_t const * edge);
+static void cwdevice_observer_wakeup_handler(int sig);
 
 
 
@@ -95,7 +110,17 @@ int cwdevice_observer_start_observing(cwdevice_observer_t * observer)
 	observer->previous_key_is_down = key_is_down;
 #endif
 
+	if (observer->wait_edges_fn) {
+		// Handler without SA_RESTART: the signal must interrupt waiting in
+		// ioctl() or in futex, so that the thread notices end of observation.
+		struct sigaction sa = { 0 };
+		sa.sa_handler = cwdevice_observer_wakeup_handler;
+		sigemptyset(&sa.sa_mask);
+		sigaction(CWDEVICE_OBSERVER_WAKEUP_SIGNAL, &sa, NULL);
+	}
+
 	observer->do_polling = true;
+	observer->thread_done = false;
 	const int retv = pthread_create(&observer->thread_id, NULL, cwdevice_observer_poll_thread, observer);
 	if (0 != retv) {
 		test_log_err("cwdevice observer: failed to create an observer thread: %d\n", retv);
@@ -116,8 +141,18 @@ int cwdevice_observer_start_observing(cwdevice_observer_t * observer)
 void cwdevice_observer_stop_observing(cwdevice_observer_t * observer)
 {
 	if (observer->thread_created) {
-		observer->do_polling = false;
-		pthread_cancel(observer->thread_id);
+		__atomic_store_n(&observer->do_polling, false, __ATOMIC_RELEASE);
+		// The thread may be blocked in waiting for an edge that never
+		// comes. Interrupt the waiting until the thread notices that it
+		// should stop. The signal is repeated because the first one may
+		// arrive just before the thread starts waiting.
+		while (!__atomic_load_n(&observer->thread_done, __ATOMIC_ACQUIRE)) {
+			if (observer->wait_edges_fn) {
+				pthread_kill(observer->thread_id, CWDEVICE_OBSERVER_WAKEUP_SIGNAL);
+			}
+			test_millisleep_nonintr(1);
+		}
+		pthread_join(observer->thread_id, NULL);
 		observer->thread_created = false;
 	}
 
@@ -129,37 +164,36 @@ void cwdevice_observer_stop_observing(cwdevice_observer_t * observer)
 
 
 
-/// @brief Thread function polling state of cwdevice's pins
+/// @brief Thread function waiting for edges on cwdevice's pins, or polling state of the pins
 ///
 /// @reviewed_on{2024.04.16}
 static void * cwdevice_observer_poll_thread(void * arg_observer)
 {
 	cwdevice_observer_t * observer = (cwdevice_observer_t *) arg_observer;
-	while (observer->do_polling) {
-		bool key_is_down = false;
-		bool ptt_is_on = false;
-
-		if (0 != observer->poll_once_fn(observer, &key_is_down, &ptt_is_on)) {
-			test_log_err("cwdevice observer: failed to poll once %s\n", "");
-			return NULL;
-		}
-
-		/* Recognize new state, save it and react to it. */
-		if (key_is_down != observer->previous_key_is_down) {
-			observer->previous_key_is_down = key_is_down;
-			if (observer->new_key_state_cb) {
-				/* We may forward state of key to libcw's Morse
-				   receiver/decoder, and the receiver will try to decode
-				   characters and spaces. */
-				observer->new_key_state_cb(observer->new_key_state_cb_arg, key_is_down);
+	bool waiting = NULL != observer->wait_edges_fn;
+
+	while (__atomic_load_n(&observer->do_polling, __ATOMIC_ACQUIRE)) {
+		if (waiting) {
+			cwdevice_observer_edge_t edges[CWDEVICE_OBSERVER_EDGES_MAX];
+			const int n = observer->wait_edges_fn(observer, edges, CWDEVICE_OBSERVER_EDGES_MAX);
+			if (n < 0) {
+				test_log_warn("cwdevice observer: can't wait for edges on cwdevice, falling back to polling %s\n", "");
+				waiting = false;
+				continue;
 			}
-		}
-		if (ptt_is_on != observer->previous_ptt_is_on) {
-			observer->previous_ptt_is_on = ptt_is_on;
-			if (observer->new_ptt_state_cb) {
-				observer->new_ptt_state_cb(observer->new_ptt_state_cb_arg, ptt_is_on);
+			for (int i = 0; i < n; i++) {
+				cwdevice_observer_report(observer, &edges[i]);
 			}
+			continue;
+		}
+
+		cwdevice_observer_edge_t edge = { 0 };
+		vclock_gettime(&edge.timestamp);
+		if (0 != observer->poll_once_fn(observer, &edge.key_is_down, &edge.ptt_is_on)) {
+			test_log_err("cwdevice observer: failed to poll once %s\n", "");
+			break;
 		}
+		cwdevice_observer_report(observer, &edge);
 
 		const int sleep_retv = test_microsleep_nonintr(observer->poll_interval_us);
 		if (sleep_retv) {
@@ -167,12 +201,44 @@ static void * cwdevice_observer_poll_thread(void * arg_observer)
 		}
 	}
 
+	__atomic_store_n(&observer->thread_done, true, __ATOMIC_RELEASE);
 	return NULL;
 }
 
 
 
 
+/// @brief Recognize new state of pins, save it and react to it
+static void cwdevice_observer_report(cwdevice_observer_t * observer, cwdevice_observer_edge_t const * edge)
+{
+	if (edge->key_is_down != observer->previous_key_is_down) {
+		observer->previous_key_is_down = edge->key_is_down;
+		if (observer->new_key_state_cb) {
+			/* We may forward state of key to libcw's Morse
+			   receiver/decoder, and the receiver will try to decode
+			   characters and spaces. */
+			observer->new_key_state_cb(observer->new_key_state_cb_arg, edge->key_is_down, &edge->timestamp);
+		}
+	}
+	if (edge->ptt_is_on != observer->previous_ptt_is_on) {
+		observer->previous_ptt_is_on = edge->ptt_is_on;
+		if (observer->new_ptt_state_cb) {
+			observer->new_ptt_state_cb(observer->new_ptt_state_cb_arg, edge->ptt_is_on);
+		}
+	}
+}
+
+
+
+
+static void cwdevice_observer_wakeup_handler(int sig)
+{
+	(void) sig; // Only interrupts blocking call in observer's thread.
+}
+
+
+
+
 void cwdevice_observer_configure_polling(cwdevice_observer_t * observer, unsigned int interval_us, poll_once_fn_t poll_once_fn)
 {
 	if (0 == interval_us) {
@@ -187,7 +253,15 @@ void cwdevice_observer_configure_polling(cwdevice_observer_t * observer, unsigne
 
 
 
-int cwdevice_observer_set_key_change_handler(cwdevice_observer_t * observer, int (* cb)(void * obj, bool key_is_down), void * obj)
+void cwdevice_observer_configure_waiting(cwdevice_observer_t * observer, wait_edges_fn_t wait_edges_fn)
+{
+	observer->wait_edges_fn = wait_edges_fn;
+}
+
+
+
+
+int cwdevice_observer_set_key_change_handler(cwdevice_observer_t * observer, int (* cb)(void * obj, bool key_is_down, struct timespec const * timestamp), void * obj)
 {
 	observer->new_key_state_cb     = cb;
 	observer->new_key_state_cb_arg = obj;
@@ -6,7 +6,9 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
 
@@ -25,8 +27,8 @@
 
    Structure holding the state of key.
 
-   Structure holding functions that poll the cwdevice, waiting for state of the
-   key to change.
+   Structure holding functions that poll the cwdevice, or wait for edges on
+   pins of the cwdevice, to learn about changes of state of the key.
 
    Structure holding a callback that will be called when change of state of
    key has been detected.
@@ -44,6 +46,32 @@ typedef int (* poll_once_fn_t)(struct cwdevice_observer_t * observer, bool * key
 
 
 
+/// State of observed pins after a change of state of any of the pins.
+typedef struct {
+	struct timespec timestamp; ///< CLOCK_MONOTONIC time of the change.
+	bool key_is_down;
+	bool ptt_is_on;
+} cwdevice_observer_edge_t;
+
+
+
+
+/// @brief Wait for changes of pins of cwdevice
+///
+/// The function blocks until at least one of observed pins changes its
+/// state, or until the waiting thread is interrupted by a signal.
+///
+/// @param observer Observer of cwdevice
+/// @param[out] edges States of pins after changes, in chronological order
+/// @param[in] size Count of items that fit into @p edges
+///
+/// @return count of items put into @p edges (zero when interrupted by a signal)
+/// @return -1 if waiting is not possible; the observer then falls back to polling
+typedef int (* wait_edges_fn_t)(struct cwdevice_observer_t * observer, cwdevice_observer_edge_t * edges, size_t size);
+
+
+
+
 /*
   Structure describing pins of tty cwdevice.
 
@@ -83,7 +111,8 @@ typedef struct cwdevice_observer_t {
 
 	/// User-provided callback function that is called by observer each time
 	/// the state of key pin of cwdevice changes between up and down.
-	int (* new_key_state_cb)(void * new_key_state_cb_arg, bool key_is_down);
+	/// @p timestamp is CLOCK_MONOTONIC time of the change.
+	int (* new_key_state_cb)(void * new_key_state_cb_arg, bool key_is_down, struct timespec const * timestamp);
 
 	/// Pointer that will be passed as first argument of new_key_state_cb on
 	/// each call to the function.
@@ -116,6 +145,17 @@ typedef struct cwdevice_observer_t {
 	   key_is_down. State of ptt pin is returned through @p ptt_is_on */
 	poll_once_fn_t poll_once_fn;
 
+	/* User-provided function that blocks until pins of cwdevice change,
+	   and returns time-stamped states of pins. If the function is set,
+	   observer waits for edges instead of polling, and polls only if the
+	   function reports that waiting is not possible. */
+	wait_edges_fn_t wait_edges_fn;
+
+	/* Reference to resource used by wait_edges_fn to learn about edges,
+	   other than source_reference. To be used by cwdevice-type-specific
+	   open/close/wait_edges functions. */
+	void * edges_reference;
+
 	/* Reference to low-level resource related to cwdevice. It may be
 	   e.g. a polled file descriptor. To be used by cwdevice-type-specific
 	   open/close/poll_once functions. */
@@ -157,6 +197,7 @@ typedef struct cwdevice_observer_t {
 	pthread_t thread_id;
 
 	bool thread_created; /**< Whether a thread was created correctly. */
+	bool thread_done;    /**< Whether the thread has exited its loop. */
 } cwdevice_observer_t;
 
 
@@ -176,7 +217,7 @@ typedef struct cwdevice_observer_t {
 /// @param[in] obj First argument to the @cb callback
 ///
 /// @return 0
-int cwdevice_observer_set_key_change_handler(cwdevice_observer_t * observer, int (* cb)(void * obj, bool key_is_down), void * obj);
+int cwdevice_observer_set_key_change_handler(cwdevice_observer_t * observer, int (* cb)(void * obj, bool key_is_down, struct timespec const * timestamp), void * obj);
 
 
 
@@ -234,9 +275,8 @@ void cwdevice_observer_stop_observing(cwdevice_observer_t * observer);
 
    @reviewed_on{2024.04.16}
 
-   In theory we can have an observer that learns about key/ptt state changes
-   by means other than polling, but for now polling is the only supported
-   method.
+   Polling is used when the observer can't wait for edges on pins (see
+   cwdevice_observer_configure_waiting()).
 
    @param observer cwdevice observer for which to configure polling
    @param poll_interval_us interval of polling [microseconds]; use 0 to tell function to use default value
@@ -247,5 +287,24 @@ void cwdevice_observer_configure_polling(cwdevice_observer_t * observer, unsigne
 
 
 
+/**
+   @brief Configure waiting for edges on pins of cwdevice
+
+   Instead of polling pins at fixed interval, the observer will block in
+   @p wait_edges_fn and will forward each change of pins to change handlers
+   with time stamp of the change. This doesn't quantize time of changes
+   to the interval of polling, and doesn't use CPU while pins don't change.
+
+   Polling configured with cwdevice_observer_configure_polling() is still
+   needed as a fallback for cwdevices on which waiting is not possible.
+
+   @param observer cwdevice observer for which to configure waiting
+   @param wait_edges_fn function that waits for changes of pins
+*/
+void cwdevice_observer_configure_waiting(cwdevice_observer_t * observer, wait_edges_fn_t wait_edges_fn);
+
+
+
+
 #endif /* #ifndef CWDEVICE_OBSERVER_H */
 
@@ -55,19 +55,54 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <sys/sysmacros.h>
+#include "tools/modem_lines.h"
+#endif
 
 #include "cw_easy_receiver.h"
 #include "cwdevice_observer_serial.h"
 #include "log.h"
+#include "src/vclock.h"
 #include "test_defines.h"
 
 
 
 
+/// Lines that serial drivers can wait for with TIOCMIWAIT.
+#define SERIAL_INPUT_LINES (TIOCM_CTS | TIOCM_DSR | TIOCM_CD | TIOCM_RI)
+
+/// Majors of slave sides of ptys on Linux.
+#define PTY_SLAVE_MAJOR_FIRST  136u
+#define PTY_SLAVE_MAJOR_LAST   143u
+
+
+
+
+#if defined(__linux__)
+/// Ring of edges of a pty with emulated modem lines.
+typedef struct {
+	modem_lines_t modem_lines;
+	modem_lines_slot_t * slot;
+	uint64_t cursor; ///< Position of next record to be read from the ring.
+} serial_edges_t;
+
+static void serial_edges_open(cwdevice_observer_t * observer, int fd);
+static int serial_edges_wait(cwdevice_observer_t * observer, serial_edges_t * source, cwdevice_observer_edge_t * edges, size_t size);
+#endif
+
+static void serial_pins(cwdevice_observer_t const * observer, unsigned int * keying_pin, unsigned int * ptt_pin);
+
+
+
+
 int cwdevice_observer_serial_open(cwdevice_observer_t * observer)
 {
 	/* Open serial port. */
@@ -82,6 +117,9 @@ int cwdevice_observer_serial_open(cwdevice_observer_t * observer)
 	}
 
 	observer->source_reference = (uintptr_t) fd;
+#if defined(__linux__)
+	serial_edges_open(observer, fd);
+#endif
 	return 0;
 }
 
@@ -95,6 +133,14 @@ void cwdevice_observer_serial_close(cwdevice_observer_t * observer)
 		close(fd);
 		observer->source_reference = (uintptr_t) -1;
 	}
+#if defined(__linux__)
+	serial_edges_t * source = observer->edges_reference;
+	if (source) {
+		modem_lines_close(&source->modem_lines);
+		free(source);
+		observer->edges_reference = NULL;
+	}
+#endif
 }
 
 
@@ -113,14 +159,9 @@ int cwdevice_observer_serial_poll_once(cwdevice_observer_t * observer, bool * ke
 		return -1;
 	}
 
-	unsigned int keying_pin = TIOCM_DTR; /* Default ID of keying pin. */
-	unsigned int ptt_pin = TIOCM_RTS;    /* Default ID of ptt pin. */
-	if (observer->tty_pins_config.explicit) {
-		/* Configuration of observer includes explicitly specified IDs for
-		   tty pins. Use them here. */
-		keying_pin = observer->tty_pins_config.pin_keying;
-		ptt_pin    = observer->tty_pins_config.pin_ptt;
-	}
+	unsigned int keying_pin = 0;
+	unsigned int ptt_pin = 0;
+	serial_pins(observer, &keying_pin, &ptt_pin);
 
 	*key_is_down = !!(value & keying_pin);
 	*ptt_is_on   = !!(value & ptt_pin);
@@ -146,6 +187,7 @@ int cwdevice_observer_tty_setup(cwdevice_observer_t * observer, const tty_pins_t
 	cwdevice_get_full_path(TESTS_TTY_CWDEVICE_NAME, observer->source_path, sizeof (observer->source_path));
 
 	cwdevice_observer_configure_polling(observer, 0, cwdevice_observer_serial_poll_once);
+	cwdevice_observer_configure_waiting(observer, cwdevice_observer_serial_wait_edges);
 
 	return 0;
 }
@@ -153,3 +195,135 @@ int cwdevice_observer_tty_setup(cwdevice_observer_t * observer, const tty_pins_t
 
 
 
+int cwdevice_observer_serial_wait_edges(cwdevice_observer_t * observer, cwdevice_observer_edge_t * edges, size_t size)
+{
+#if defined(__linux__)
+	if (observer->edges_reference) {
+		return serial_edges_wait(observer, observer->edges_reference, edges, size);
+	}
+#endif
+
+#ifdef TIOCMIWAIT
+	unsigned int keying_pin = 0;
+	unsigned int ptt_pin = 0;
+	serial_pins(observer, &keying_pin, &ptt_pin);
+	unsigned int const lines = keying_pin | ptt_pin;
+	if (0 == lines || 0 != (lines & ~SERIAL_INPUT_LINES) || 0 == size) {
+		// Output lines of a tty can't be waited for.
+		return -1;
+	}
+
+	int const fd = (int) observer->source_reference;
+	// Argument of TIOCMIWAIT is the mask itself, not a pointer.
+	if (0 != ioctl(fd, TIOCMIWAIT, (void *) (uintptr_t) lines)) {
+		if (EINTR == errno) {
+			return 0;
+		}
+		char buf[ERRNO_BUF_SIZE] = { 0 };
+		strerror_r(errno, buf, sizeof (buf));
+		test_log_warn("cwdevice observer: ioctl(TIOCMIWAIT): %s / %d\n", buf, errno);
+		return -1;
+	}
+	// Time stamp of wake-up is the best approximation of time of the edge.
+	vclock_gettime(&edges[0].timestamp);
+	if (0 != cwdevice_observer_serial_poll_once(observer, &edges[0].key_is_down, &edges[0].ptt_is_on)) {
+		return -1;
+	}
+	return 1;
+#else
+	(void) observer;
+	(void) edges;
+	(void) size;
+	return -1;
+#endif
+}
+
+
+
+
+/// @brief Get tty lines used by cwdaemon for keying and PTT
+static void serial_pins(cwdevice_observer_t const * observer, unsigned int * keying_pin, unsigned int * ptt_pin)
+{
+	*keying_pin = TIOCM_DTR; /* Default ID of keying pin. */
+	*ptt_pin = TIOCM_RTS;    /* Default ID of ptt pin. */
+	if (observer->tty_pins_config.explicit) {
+		/* Configuration of observer includes explicitly specified IDs for
+		   tty pins. Use them here. */
+		*keying_pin = observer->tty_pins_config.pin_keying;
+		*ptt_pin    = observer->tty_pins_config.pin_ptt;
+	}
+}
+
+
+
+
+#if defined(__linux__)
+/// @brief Use ring of edges if observed tty is a pty with emulated modem lines
+///
+/// Modem lines of a pty are emulated if TIOCMGET on the pty succeeds,
+/// i.e. if the test program was started with LD_PRELOAD of
+/// libcwdaemon_modem_lines.so.
+static void serial_edges_open(cwdevice_observer_t * observer, int fd)
+{
+	struct stat st;
+	if (0 != fstat(fd, &st) || !S_ISCHR(st.st_mode)) {
+		return;
+	}
+	unsigned int const maj = major(st.st_rdev);
+	if (maj < PTY_SLAVE_MAJOR_FIRST || maj > PTY_SLAVE_MAJOR_LAST) {
+		return;
+	}
+	int lines = 0;
+	if (0 != ioctl(fd, TIOCMGET, &lines)) {
+		return;
+	}
+
+	serial_edges_t * source = calloc(1, sizeof (serial_edges_t));
+	if (NULL == source) {
+		return;
+	}
+	unsigned int const pty = (maj - PTY_SLAVE_MAJOR_FIRST) * 256u + minor(st.st_rdev);
+	if (0 != modem_lines_open(&source->modem_lines, NULL)
+	    || NULL == (source->slot = modem_lines_slot(&source->modem_lines, pty, true))) {
+		test_log_warn("cwdevice observer: can't open state of modem lines of [%s]\n", observer->source_path);
+		if (source->modem_lines.header) {
+			modem_lines_close(&source->modem_lines);
+		}
+		free(source);
+		return;
+	}
+	// Only edges made after start of observation are interesting.
+	source->cursor = __atomic_load_n(&source->slot->head, __ATOMIC_ACQUIRE);
+	observer->edges_reference = source;
+	test_log_info("cwdevice observer: observing edges of pty [%s] with emulated modem lines\n", observer->source_path);
+}
+
+
+
+
+static int serial_edges_wait(cwdevice_observer_t * observer, serial_edges_t * source, cwdevice_observer_edge_t * edges, size_t size)
+{
+	if (0 != modem_lines_wait_record(source->slot, source->cursor)) {
+		return EINTR == errno ? 0 : -1;
+	}
+
+	unsigned int keying_pin = 0;
+	unsigned int ptt_pin = 0;
+	serial_pins(observer, &keying_pin, &ptt_pin);
+
+	modem_lines_record_t records[32];
+	size_t const n = modem_lines_read(source->slot, &source->cursor, records,
+	                                  size < sizeof (records) / sizeof (records[0]) ? size : sizeof (records) / sizeof (records[0]));
+	for (size_t i = 0; i < n; i++) {
+		edges[i].timestamp.tv_sec = (time_t) (records[i].timestamp_ns / 1000000000u);
+		edges[i].timestamp.tv_nsec = (long) (records[i].timestamp_ns % 1000000000u);
+		edges[i].key_is_down = !!(records[i].lines & keying_pin);
+		edges[i].ptt_is_on = !!(records[i].lines & ptt_pin);
+	}
+	return (int) n;
+}
+#endif
+
+
+
+
@@ -56,6 +56,25 @@ int cwdevice_observer_serial_poll_once(cwdevice_observer_t * observer, bool * ke
 
 
 
+/// @brief Implementation of cwdevice_observer_t::wait_edges_fn function specific to serial line file
+///
+/// On a pty with emulated modem lines (tools/modem_lines.h) the function
+/// takes edges, with time stamps of the changes made by cwdaemon, from ring
+/// of the pty. On other ttys it waits in TIOCMIWAIT, which serial drivers
+/// support only for input lines (CTS, DSR, CD, RI), i.e. when pins of
+/// cwdaemon's cwdevice are connected to input lines of observed tty.
+///
+/// @param observer cwdevice observer observing a tty device
+/// @param[out] edges States of pins after changes
+/// @param[in] size Count of items that fit into @p edges
+///
+/// @return count of items put into @p edges
+/// @return -1 if waiting is not possible on the tty
+int cwdevice_observer_serial_wait_edges(cwdevice_observer_t * observer, cwdevice_observer_edge_t * edges, size_t size);
+
+
+
+
 /// @brief Configure given observer to be used with tty device
 ///
 /// If @p observer_pins_config is NULL, the observer will use default
@@ -58,6 +58,7 @@
 #include <string.h>
 #include <time.h>
 
+#include "src/vclock.h"
 #include "tests/library/events.h"
 #include "tests/library/log.h"
 #include "tests/library/misc.h"
@@ -182,7 +183,7 @@ int events_insert_reply_received_event(events_t * events, const test_reply_data_
 			assert(0);
 		} else {
 			struct timespec timestamp = { 0 };
-			clock_gettime(CLOCK_MONOTONIC, &timestamp);
+			vclock_gettime(&timestamp);
 
 			event_t * event = &events->events[events->events_cnt];
 			event->etype = etype_reply;
@@ -235,7 +236,7 @@ int events_insert_exit_escape_request_event(events_t * events)
 			test_log_err("Test: trying to record too many events (EXIT Escape request): current count of stored events = %d, limit = %d\n", events->events_cnt, EVENTS_MAX);
 			assert(0);
 		} else {
-			clock_gettime(CLOCK_MONOTONIC, &events->events[events->events_cnt].tstamp);
+			vclock_gettime(&events->events[events->events_cnt].tstamp);
 			events->events[events->events_cnt].etype = etype_req_exit;
 			events->events_cnt++;
 		}
@@ -69,6 +69,7 @@
 
 #include <libcw.h>
 
+#include "src/vclock.h"
 #include "tests/library/cwdevice_observer_serial.h"
 #include "tests/library/log.h"
 #include "tests/library/morse_receiver.h"
@@ -178,7 +179,9 @@ int morse_receiver_wait_for_stop(morse_receiver_t * receiver)
 {
 	bool success = true;
 
+	vclock_wait_begin(0);
 	pthread_join(receiver->thread.thread_id, NULL);
+	vclock_wait_end();
 	if (receiver->thread.status != thread_stopped_ok) {
 		test_log_err("Morse receiver: thread's status is not OK: %u\n", receiver->thread.status);
 		success = false;
@@ -398,7 +401,7 @@ static void * morse_receiver_thread_fn(void * receiver_arg)
 				buffer[buffer_i++] = erd.character;
 				test_log_debug("Morse receiver thread: received char %3d: '%c', remaining wait dropped to %d\n", buffer_i, erd.character, remaining_wait_ms); /* Log shows 1-based char counter. */
 				remaining_wait_ms = total_wait_ms; /* Reset remaining time. */
-				clock_gettime(CLOCK_MONOTONIC, &last_character_receive_tstamp);
+				vclock_gettime(&last_character_receive_tstamp);
 			} else {
 				; /* NOOP */
 			}
@@ -51,12 +51,15 @@
 #include <sys/types.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h> /* getenv() */
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "log.h"
@@ -65,6 +68,8 @@
 #include "server.h"
 #include "socket.h"
 #include "src/cwdaemon.h"
+#include "src/notify.h"
+#include "src/vclock.h"
 #include "supervisor.h"
 #include "tests/library/sleep.h"
 
@@ -72,7 +77,7 @@
 
 
 /* Count of non-NULL items to be put in env[] passed to execve(). */
-#define ENV_MAX_COUNT   2
+#define ENV_MAX_COUNT   5
 
 
 
@@ -83,12 +88,14 @@ static int append_option_verbosity(server_options_t const * server_opts, const c
 static int append_option_tty_pins(server_options_t const * server_opts, const char ** argv, int * argc);
 static int start_process(const char * path, const server_options_t * server_opts, server_t * server);
 static int prepare_env(char * env[ENV_MAX_COUNT + 1]);
+static int wait_for_ready(int fd, unsigned int timeout_ms);
 
 static int append_option_short_long(char const * opt_short, char const * opt_long, char const * value, const char ** argv, int * argc);
 
 
 static char g_arg_tone[TONE_BUF_SIZE] = { 0 };
 static char g_arg_wpm[WPM_BUF_SIZE] = { 0 };
+static char g_arg_ready_fd[16] = { 0 };
 
 
 
@@ -455,8 +462,22 @@ static int start_process(const char * cwdaemon_path, const server_options_t * se
 		return -1;
 	}
 
+	/// cwdaemon notifies its readiness by writing to the pipe (--ready-fd),
+	/// or exits without writing, which closes the pipe.
+	int ready_pipe[2] = { -1, -1 };
+	if (0 != pipe(ready_pipe)) {
+		test_log_err("Test: failed to create readiness pipe: %s\n", strerror(errno));
+		return -1;
+	}
+	fcntl(ready_pipe[0], F_SETFD, FD_CLOEXEC);
+
 	pid_t pid = fork();
 	if (0 == pid) {
+		close(ready_pipe[0]);
+		snprintf(g_arg_ready_fd, sizeof (g_arg_ready_fd), "%d", ready_pipe[1]);
+		argv[argc++] = "--ready-fd";
+		argv[argc++] = g_arg_ready_fd;
+
 		if (0 != server_opts->tone) {
 			argv[argc++] = "-T";
 			snprintf(g_arg_tone, sizeof (g_arg_tone), "%d", server_opts->tone);
@@ -488,6 +509,12 @@ static int start_process(const char * cwdaemon_path, const server_options_t * se
 		}
 		append_option_tty_pins(server_opts, argv, &argc);
 
+		if (vclock_enabled()) {
+			// Only the native keying engine is driven by virtual clock.
+			argv[argc++] = "--keyer";
+			argv[argc++] = "native";
+		}
+
 		// Debug print-out of the options array.
 		if (1) {
 			int i = 0;
@@ -509,48 +536,54 @@ static int start_process(const char * cwdaemon_path, const server_options_t * se
 		exit(EXIT_FAILURE); /* Calling "return -1" doesn't result in proper behaviour of waitpid. */
 	} else {
 		server->supervisor_id = server_opts->supervisor_id;
+		close(ready_pipe[1]);
 
 		/*
-		  Wait for start of cwdaemon for two reasons:
-
-		  1. if execve() fails, waitpid() will be able to detect this only
-		     after some small delay (~30 ms). Calling waitpid(WNOHANG) too
-		     early will result in detecting a running child process.
-		  2. Give the cwdaemon some time to properly start.
-
-		  More info on the second reason: I noticed that a Morse-receiver
-		  test that was started immediately after start of cwdaemon was
-		  always receiving first letter incorrectly. With 60 milliseconds the
-		  behaviour was correct, but I'm setting it to 300 ms to be sure.
-
-		  Usually the tests are written in a way to expect and discard errors
-		  at the beginning of received text, but why add another factor that
-		  decreases quality of receiving?
-
-		  I haven't observed this in practice, but I think that when program
-		  is ran under supervisor, it may take longer for it to start and be
-		  responsive to test suite, compared to no supervisor. TODO acerion
-		  2024.02.19: check this somehow.
+		  Wait until cwdaemon notifies that it's ready to handle
+		  requests: its socket is bound and its keying engine is
+		  running. Readiness is notified through the pipe, so there is
+		  no need to guess how long the start takes.
+
+		  If cwdaemon fails to start (e.g. execve() fails, or values of
+		  options are out of range), the pipe is closed without
+		  notification, and the waitpid() below detects the exit.
+
+		  A program started under supervisor (e.g. valgrind or gdb)
+		  may need much more time to become ready.
 		*/
-		unsigned int milli_sleep_duration = 300;
+		unsigned int ready_timeout_ms = 5000;
 		switch (server->supervisor_id) {
 		case supervisor_id_none:
-			milli_sleep_duration = 300;
+			ready_timeout_ms = 5000;
 			break;
 		case supervisor_id_valgrind:
-			milli_sleep_duration = 3000;
+			ready_timeout_ms = 30000;
 			break;
 		case supervisor_id_gdb:
-			milli_sleep_duration = 1000;
+			ready_timeout_ms = 60000;
 			break;
 		default:
-			test_log_err("Test: can't get start delay value, unhandled supervisor id %u\n", server_opts->supervisor_id);
+			test_log_err("Test: can't get start timeout value, unhandled supervisor id %u\n", server_opts->supervisor_id);
+			close(ready_pipe[0]);
 			return -1;
 		}
-		const int sleep_retv = test_millisleep_nonintr(milli_sleep_duration);
-		if (sleep_retv) {
-			test_log_err("Test: error during sleep in parent: %s\n", strerror(errno));
+		const int ready = wait_for_ready(ready_pipe[0], ready_timeout_ms);
+		close(ready_pipe[0]);
+		if (ready < 0) {
+			// The pipe has been closed without notification: the child
+			// has exited or is exiting. Collect its exit status.
+			waitpid(pid, &server->wstatus, 0);
+			test_log_err("Test: child process exited before it was ready %s\n", "");
+			if (WIFEXITED(server->wstatus)) {
+				test_log_err("Test: child process exited too early, exit status = %d\n", WEXITSTATUS(server->wstatus));
+			} else if (WIFSIGNALED(server->wstatus)) {
+				test_log_err("Test: child process was terminated by signal %d\n", WTERMSIG(server->wstatus));
+			}
 			return -1;
+		} else if (ready > 0) {
+			test_log_warn("Test: cwdaemon didn't notify readiness in %u ms\n", ready_timeout_ms);
+		} else {
+			; // Ready.
 		}
 
 		pid_t waited_pid = waitpid(pid, &server->wstatus, WNOHANG);
@@ -584,6 +617,59 @@ static int start_process(const char * cwdaemon_path, const server_options_t * se
 
 
 
+/// @brief Wait for notification of readiness on read end of a pipe
+///
+/// @param[in] fd Read end of the pipe
+/// @param[in] timeout_ms Timeout of the wait, in real time
+///
+/// @return 0 if cwdaemon has notified its readiness
+/// @return 1 on timeout
+/// @return -1 if the pipe has been closed without notification, or on error
+static int wait_for_ready(int fd, unsigned int timeout_ms)
+{
+	char buf[sizeof (NOTIFY_READY_MESSAGE)] = { 0 };
+	size_t len = 0;
+
+	struct timespec start = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (true) {
+		struct timespec now = { 0 };
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		const long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000L + (now.tv_nsec - start.tv_nsec) / 1000000L;
+		if (elapsed_ms >= (long) timeout_ms) {
+			return 1;
+		}
+
+		struct pollfd descriptor = { .fd = fd, .events = POLLIN };
+		const int n = poll(&descriptor, 1, (int) (timeout_ms - (unsigned int) elapsed_ms));
+		if (n < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+			test_log_err("Test: poll() on readiness pipe failed: %s\n", strerror(errno));
+			return -1;
+		}
+		if (0 == n) {
+			return 1;
+		}
+
+		const ssize_t r = read(fd, buf + len, sizeof (buf) - 1 - len);
+		if (r < 0 && EINTR == errno) {
+			continue;
+		}
+		if (r <= 0) {
+			return -1; // End of file: cwdaemon has exited without notification.
+		}
+		len += (size_t) r;
+		if (len == strlen(NOTIFY_READY_MESSAGE)) {
+			return 0 == strcmp(buf, NOTIFY_READY_MESSAGE) ? 0 : -1;
+		}
+	}
+}
+
+
+
+
 int server_start(server_options_t const * server_opts, server_t * server)
 {
 	const char * path = TESTS_CWDAEMON_PATH;
@@ -671,6 +757,39 @@ static int prepare_env(char * env[ENV_MAX_COUNT + 1])
 		}
 	}
 
+	if (1) {
+		/*
+		  Tests of tty cwdevice can be run on a pty instead of a real
+		  serial port. Modem lines of the pty are then emulated by a
+		  library loaded with LD_PRELOAD into the test program and
+		  into cwdaemon, with state file shared by both processes (see
+		  tools/modem_lines.h). Tests can be also run on virtual clock
+		  shared by the test program and cwdaemon (see src/vclock.h).
+		*/
+		static char ld_preload[BUF_SIZE] = { 0 };
+		static char modem_lines[BUF_SIZE] = { 0 };
+		static char vclock[BUF_SIZE] = { 0 };
+		struct {
+			const char * name;
+			char * buf;
+		} const forwarded[] = {
+			{ "LD_PRELOAD",           ld_preload  },
+			{ "CWDAEMON_MODEM_LINES", modem_lines },
+			{ VCLOCK_ENV_PATH,        vclock      },
+		};
+		for (size_t i = 0; i < sizeof (forwarded) / sizeof (forwarded[0]); i++) {
+			const char * value = getenv(forwarded[i].name);
+			if (value) {
+				int n = snprintf(forwarded[i].buf, BUF_SIZE, "%s=%s", forwarded[i].name, value);
+				if (n >= BUF_SIZE) {
+					test_log_err("Test: overflow when writing %s to env table\n", forwarded[i].name);
+					return -1;
+				}
+				env[env_i++] = forwarded[i].buf;
+			}
+		}
+	}
+
 	if (env_i > ENV_MAX_COUNT) {
 		/* TODO: it may be too late for this check: writing past the array size may have already happened. */
 		test_log_err("Test: count of env items in env table is exceeded: %d > %d\n", env_i, ENV_MAX_COUNT);
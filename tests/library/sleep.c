@@ -47,6 +47,9 @@
 
    TODO acerion 2024.01.07: be aware of the duplication and try to keep the
    files in the two locations in sync.
+
+   In virtual clock mode (src/vclock.h) the functions sleep on the virtual
+   clock, except for test_millisleep_real_nonintr().
 */
 
 
@@ -66,14 +69,40 @@
 #include <unistd.h>
 
 #include "log.h"
+#include "src/vclock.h"
 #include "tests/library/sleep.h"
 #include "time_utils.h"
 
 
 
 
+static int test_microsleep_real_nonintr(unsigned int usecs);
+
+
+
+
 // @reviewed_on{2024.05.10}
 int test_microsleep_nonintr(unsigned int usecs)
+{
+	if (vclock_enabled()) {
+		vclock_sleep_ns((uint64_t) usecs * TESTS_NANOSECS_PER_MICROSEC);
+		return 0;
+	}
+	return test_microsleep_real_nonintr(usecs);
+}
+
+
+
+
+int test_millisleep_real_nonintr(unsigned int millisecs)
+{
+	return test_microsleep_real_nonintr(millisecs * TESTS_MICROSECS_PER_MILLISEC);
+}
+
+
+
+
+static int test_microsleep_real_nonintr(unsigned int usecs)
 {
 	const unsigned long seconds = usecs / TESTS_MICROSECS_PER_SEC;
 	const unsigned long micros  = usecs % TESTS_MICROSECS_PER_SEC;
@@ -123,6 +152,11 @@ int test_sleep_nonintr(unsigned int secs)
 	  doing a multiplication of function argument by 10^6 and then dividing
 	  argument again back by 10^6.
 	*/
+	if (vclock_enabled()) {
+		vclock_sleep_ns((uint64_t) secs * TESTS_NANOSECS_PER_SEC);
+		return 0;
+	}
+
 	struct timespec remaining = {
 		.tv_sec  = secs,
 		.tv_nsec = 0
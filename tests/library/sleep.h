@@ -57,6 +57,24 @@ int test_millisleep_nonintr(unsigned int millisecs);
 
 
 
+/**
+   @brief Non-interruptible milli-seconds-sleep in real time
+
+   Unlike test_millisleep_nonintr(), the function always sleeps in real
+   time, also in virtual clock mode (src/vclock.h). Use it to give time to
+   things that don't follow the virtual clock, like start of a thread or
+   exit of a process.
+
+   @param[in] millisecs Milliseconds to sleep
+
+   @return 0 if sleep was completed without errors (interrupts by signal may or may not have happened)
+   @return -1 on errors
+*/
+int test_millisleep_real_nonintr(unsigned int millisecs);
+
+
+
+
 /**
    @brief Non-interruptible seconds-sleep
 
@@ -34,6 +34,7 @@
 #include <string.h>
 
 #include "log.h"
+#include "src/vclock.h"
 #include "tests/library/sleep.h"
 #include "thread.h"
 
@@ -49,8 +50,19 @@ int thread_start(thread_t * thread)
 	}
 
 	/* Very naive method of checking if a thread has started correctly: wait
-	   a bit and check thread's flag. */
-	test_millisleep_nonintr(100);
+	   a bit and check thread's flag. On virtual clock (src/vclock.h) the
+	   wait is in real time, because start of a thread doesn't depend on
+	   the virtual clock. */
+	if (vclock_enabled()) {
+		for (int i = 0; i < 100; i++) {
+			if (thread_running == __atomic_load_n(&thread->status, __ATOMIC_ACQUIRE)) {
+				break;
+			}
+			test_millisleep_real_nonintr(1);
+		}
+	} else {
+		test_millisleep_nonintr(100);
+	}
 	if (thread->status != thread_running) {
 		test_log_err("Test: %s: thread has not started correctly\n", thread->name);
 		return -1;
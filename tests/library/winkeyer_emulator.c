@@ -0,0 +1,402 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/**
+   @file
+
+   Emulator of K1EL WinKeyer hardware keyer on a pseudo-terminal pair.
+*/
+
+
+
+
+#define _XOPEN_SOURCE 600 /* posix_openpt(), grantpt(), unlockpt(), ptsname(). */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/winkeyer.h"
+#include "winkeyer_emulator.h"
+
+
+
+
+/// Length of every keyed character, in dot units.
+#define WINKEYER_EMULATOR_CHARACTER_UNITS  8
+
+
+
+
+/// Count of arguments of commands of the protocol (0x00 - 0x1F).
+static uint8_t const g_arguments_count[0x20] = {
+	[0x00] = 1, [0x01] = 1, [0x02] = 1, [0x03] = 1, [0x04] = 2, [0x05] = 3, [0x06] = 1,
+	[0x09] = 1, [0x0B] = 1, [0x0C] = 1, [0x0D] = 1, [0x0E] = 1, [0x0F] = 15,
+	[0x10] = 1, [0x11] = 1, [0x12] = 1, [0x14] = 1, [0x16] = 1, [0x17] = 1,
+	[0x18] = 1, [0x19] = 1, [0x1A] = 1, [0x1B] = 2, [0x1C] = 1, [0x1D] = 1,
+};
+
+
+
+
+static void * winkeyer_emulator_thread(void * arg);
+static void winkeyer_emulator_receive(winkeyer_emulator_t * emu, uint8_t byte);
+static void winkeyer_emulator_command(winkeyer_emulator_t * emu);
+static void winkeyer_emulator_buffer(winkeyer_emulator_t * emu, uint8_t const * bytes, size_t count);
+static void winkeyer_emulator_play(winkeyer_emulator_t * emu, int64_t now);
+static void winkeyer_emulator_report_status(winkeyer_emulator_t * emu, bool always);
+static void winkeyer_emulator_send(winkeyer_emulator_t * emu, uint8_t byte);
+static void winkeyer_emulator_keyed(winkeyer_emulator_t * emu, char c);
+static int64_t winkeyer_emulator_now_ns(void);
+
+
+
+
+int winkeyer_emulator_start(winkeyer_emulator_t * emu)
+{
+	size_t const xoff_threshold = emu->xoff_threshold;
+	unsigned int const unit_us = emu->unit_us;
+	memset(emu, 0, sizeof (winkeyer_emulator_t));
+	emu->xoff_threshold = xoff_threshold ? xoff_threshold : (2 * WINKEYER_EMULATOR_BUFFER_SIZE) / 3;
+	emu->unit_us = unit_us;
+	emu->state.wpm = 12;
+	emu->state.weighting = 50;
+	emu->status = -1;
+	emu->slave_fd = -1;
+
+	emu->master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (-1 == emu->master_fd) {
+		fprintf(stderr, "[EE] posix_openpt() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	char const * path = NULL;
+	if (0 != grantpt(emu->master_fd) || 0 != unlockpt(emu->master_fd) || NULL == (path = ptsname(emu->master_fd))) {
+		fprintf(stderr, "[EE] Failed to prepare slave side of pseudo-terminal: %s\n", strerror(errno));
+		close(emu->master_fd);
+		return -1;
+	}
+	snprintf(emu->slave_path, sizeof (emu->slave_path), "%s", path);
+	emu->slave_fd = open(emu->slave_path, O_RDWR | O_NOCTTY);
+	if (-1 == emu->slave_fd) {
+		fprintf(stderr, "[EE] Failed to open slave side of pseudo-terminal [%s]: %s\n", emu->slave_path, strerror(errno));
+		close(emu->master_fd);
+		return -1;
+	}
+	fcntl(emu->master_fd, F_SETFL, O_NONBLOCK);
+
+	pthread_mutex_init(&emu->mutex, NULL);
+	emu->running = true;
+	if (0 != pthread_create(&emu->thread, NULL, winkeyer_emulator_thread, emu)) {
+		fprintf(stderr, "[EE] Failed to start thread of WinKeyer emulator\n");
+		emu->running = false;
+		close(emu->slave_fd);
+		close(emu->master_fd);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+
+void winkeyer_emulator_stop(winkeyer_emulator_t * emu)
+{
+	pthread_mutex_lock(&emu->mutex);
+	emu->running = false;
+	pthread_mutex_unlock(&emu->mutex);
+	pthread_join(emu->thread, NULL);
+
+	close(emu->slave_fd);
+	close(emu->master_fd);
+	pthread_mutex_destroy(&emu->mutex);
+}
+
+
+
+
+void winkeyer_emulator_get_state(winkeyer_emulator_t * emu, winkeyer_emulator_state_t * state)
+{
+	pthread_mutex_lock(&emu->mutex);
+	*state = emu->state;
+	pthread_mutex_unlock(&emu->mutex);
+}
+
+
+
+
+static void * winkeyer_emulator_thread(void * arg)
+{
+	winkeyer_emulator_t * const emu = arg;
+
+	pthread_mutex_lock(&emu->mutex);
+	while (emu->running) {
+		int64_t const now = winkeyer_emulator_now_ns();
+		winkeyer_emulator_play(emu, now);
+		winkeyer_emulator_report_status(emu, false);
+
+		int timeout_ms = 10; // Notice stop of the emulator in reasonable time.
+		if (emu->keying_end_ns && (emu->keying_end_ns - now) / 1000000 < timeout_ms) {
+			timeout_ms = (int) ((emu->keying_end_ns - now) / 1000000) + 1;
+		}
+		pthread_mutex_unlock(&emu->mutex);
+
+		struct pollfd pfd = { .fd = emu->master_fd, .events = POLLIN };
+		poll(&pfd, 1, timeout_ms);
+		uint8_t bytes[64];
+		ssize_t n = 0;
+		if (pfd.revents & POLLIN) {
+			n = read(emu->master_fd, bytes, sizeof (bytes));
+		}
+
+		pthread_mutex_lock(&emu->mutex);
+		for (ssize_t i = 0; i < n; i++) {
+			winkeyer_emulator_receive(emu, bytes[i]);
+		}
+	}
+	pthread_mutex_unlock(&emu->mutex);
+
+	return NULL;
+}
+
+
+
+
+/// Collect bytes of a command, execute the command when it's complete.
+static void winkeyer_emulator_receive(winkeyer_emulator_t * emu, uint8_t byte)
+{
+	emu->command[emu->command_len++] = byte;
+	uint8_t const code = emu->command[0];
+	size_t const needed = code < 0x20 ? 1u + g_arguments_count[code] : 1u;
+	if (needed > sizeof (emu->command)) {
+		// Long commands (e.g. loading of defaults) are not supported, skip their arguments.
+		if (emu->command_len == sizeof (emu->command)) {
+			emu->command_len = 0;
+		}
+		return;
+	}
+	if (emu->command_len == needed) {
+		winkeyer_emulator_command(emu);
+		emu->command_len = 0;
+	}
+}
+
+
+
+
+static void winkeyer_emulator_command(winkeyer_emulator_t * emu)
+{
+	uint8_t const * const c = emu->command;
+	winkeyer_emulator_state_t * const state = &emu->state;
+
+	switch (c[0]) {
+	case WINKEYER_CMD_ADMIN:
+		if (WINKEYER_ADMIN_HOST_OPEN == c[1]) {
+			state->host_open = true;
+			winkeyer_emulator_send(emu, WINKEYER_EMULATOR_VERSION);
+		} else if (WINKEYER_ADMIN_HOST_CLOSE == c[1]) {
+			state->host_open = false;
+		}
+		break;
+	case WINKEYER_CMD_SIDETONE:
+		state->sidetone = c[1];
+		break;
+	case WINKEYER_CMD_SPEED:
+		state->wpm = c[1];
+		break;
+	case WINKEYER_CMD_WEIGHTING:
+		state->weighting = c[1];
+		break;
+	case WINKEYER_CMD_PTT_LEAD_TAIL:
+		state->ptt_lead_ms = 10u * c[1];
+		state->ptt_tail_ms = 10u * c[2];
+		break;
+	case WINKEYER_CMD_PIN_CONFIG:
+		state->pin_config = c[1];
+		break;
+	case WINKEYER_CMD_CLEAR_BUFFER:
+		emu->len = 0;
+		emu->keying_end_ns = 0;
+		emu->buffered_wpm = 0;
+		state->busy = false;
+		state->clears++;
+		break;
+	case WINKEYER_CMD_KEY_IMMEDIATE:
+		state->key = 0 != c[1];
+		break;
+	case WINKEYER_CMD_MODE:
+		state->mode = c[1];
+		break;
+	case WINKEYER_CMD_STATUS:
+		winkeyer_emulator_report_status(emu, true);
+		break;
+	case WINKEYER_CMD_PTT:
+	case WINKEYER_CMD_MERGE:
+	case WINKEYER_CMD_BUFFERED_SPEED:
+		winkeyer_emulator_buffer(emu, c, 1u + g_arguments_count[c[0]]);
+		break;
+	default:
+		if (c[0] >= 0x20) {
+			winkeyer_emulator_buffer(emu, c, 1);
+		}
+		// Other commands are accepted and ignored.
+		break;
+	}
+}
+
+
+
+
+/// Put buffered command into the buffer. The command is dropped if it doesn't fit.
+static void winkeyer_emulator_buffer(winkeyer_emulator_t * emu, uint8_t const * bytes, size_t count)
+{
+	if (emu->len + count > WINKEYER_EMULATOR_BUFFER_SIZE) {
+		emu->state.overflows += count;
+		return;
+	}
+	memcpy(emu->buffer + emu->len, bytes, count);
+	emu->len += count;
+	if (emu->len > emu->state.max_fill) {
+		emu->state.max_fill = emu->len;
+	}
+}
+
+
+
+
+/// Take next commands from the buffer when current character has been keyed.
+static void winkeyer_emulator_play(winkeyer_emulator_t * emu, int64_t now)
+{
+	winkeyer_emulator_state_t * const state = &emu->state;
+
+	if (emu->keying_end_ns && now < emu->keying_end_ns) {
+		return;
+	}
+	emu->keying_end_ns = 0;
+
+	while (emu->len > 0) {
+		uint8_t const code = emu->buffer[0];
+		size_t const count = code < 0x20 ? 1u + g_arguments_count[code] : 1u;
+		int units = 0;
+
+		if (WINKEYER_CMD_PTT == code) {
+			state->ptt = 0 != emu->buffer[1];
+		} else if (WINKEYER_CMD_BUFFERED_SPEED == code) {
+			emu->buffered_wpm = emu->buffer[1];
+			state->buffered_speeds++;
+		} else if (WINKEYER_CMD_MERGE == code) {
+			winkeyer_emulator_keyed(emu, '[');
+			winkeyer_emulator_keyed(emu, (char) emu->buffer[1]);
+			winkeyer_emulator_keyed(emu, (char) emu->buffer[2]);
+			winkeyer_emulator_keyed(emu, ']');
+			if (state->mode & WINKEYER_MODE_SERIAL_ECHO) {
+				winkeyer_emulator_send(emu, emu->buffer[1]);
+				winkeyer_emulator_send(emu, emu->buffer[2]);
+			}
+			units = 2 * WINKEYER_EMULATOR_CHARACTER_UNITS;
+		} else {
+			winkeyer_emulator_keyed(emu, (char) code);
+			if (state->mode & WINKEYER_MODE_SERIAL_ECHO) {
+				winkeyer_emulator_send(emu, code);
+			}
+			units = WINKEYER_EMULATOR_CHARACTER_UNITS;
+		}
+
+		memmove(emu->buffer, emu->buffer + count, emu->len - count);
+		emu->len -= count;
+
+		if (units) {
+			int const wpm = emu->buffered_wpm ? emu->buffered_wpm : state->wpm;
+			int64_t const unit_ns = emu->unit_us ? 1000LL * emu->unit_us : 1200000000LL / (wpm ? wpm : 1);
+			emu->keying_end_ns = now + units * unit_ns;
+			state->busy = true;
+			return;
+		}
+	}
+
+	// Buffer is empty. Buffered speed is cancelled when the buffer empties.
+	emu->buffered_wpm = 0;
+	state->busy = false;
+}
+
+
+
+
+/// Send status byte to host if XOFF or BUSY bits have changed, or if @p always is true.
+static void winkeyer_emulator_report_status(winkeyer_emulator_t * emu, bool always)
+{
+	int status = WINKEYER_STATUS_TAG;
+	if (emu->len >= emu->xoff_threshold) {
+		status |= WINKEYER_STATUS_XOFF;
+	}
+	if (emu->state.busy) {
+		status |= WINKEYER_STATUS_BUSY;
+	}
+	if (always || status != emu->status) {
+		emu->status = status;
+		winkeyer_emulator_send(emu, (uint8_t) status);
+	}
+}
+
+
+
+
+static void winkeyer_emulator_send(winkeyer_emulator_t * emu, uint8_t byte)
+{
+	if (!emu->state.host_open) {
+		return;
+	}
+	if (1 != write(emu->master_fd, &byte, 1)) {
+		fprintf(stderr, "[EE] WinKeyer emulator failed to send byte 0x%02x: %s\n", byte, strerror(errno));
+	}
+}
+
+
+
+
+static void winkeyer_emulator_keyed(winkeyer_emulator_t * emu, char c)
+{
+	if (emu->state.keyed_len + 1 < sizeof (emu->state.keyed)) {
+		emu->state.keyed[emu->state.keyed_len++] = c;
+		emu->state.keyed[emu->state.keyed_len] = '\0';
+	}
+}
+
+
+
+
+static int64_t winkeyer_emulator_now_ns(void)
+{
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
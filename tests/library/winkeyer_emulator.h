@@ -0,0 +1,131 @@
+#ifndef CWDAEMON_TESTS_LIB_WINKEYER_EMULATOR_H
+#define CWDAEMON_TESTS_LIB_WINKEYER_EMULATOR_H
+
+
+
+
+/**
+   @file
+
+   Emulator of K1EL WinKeyer hardware keyer, for tests of WinKeyer cwdevice
+   and "winkeyer" keying engine.
+
+   The emulator opens a pseudo-terminal pair and serves WinKeyer host
+   protocol on master side of the pair, in its own thread. Path to slave
+   side (e.g. /dev/pts/5) is used as tty of WinKeyer cwdevice:
+   "winkeyer:/dev/pts/5".
+
+   The emulator keeps an input buffer like the real keyer: it echoes
+   buffered characters as it starts keying them, reports BUSY and XOFF bits
+   in status bytes sent on each change of the bits, and clears the buffer
+   on abort. Each character is "keyed" for a fixed number of dot units at
+   current speed; the emulator doesn't reproduce exact lengths of
+   characters.
+*/
+
+
+
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+
+#define WINKEYER_EMULATOR_VERSION      23 /**< Firmware version reported on "host open". */
+#define WINKEYER_EMULATOR_BUFFER_SIZE 128
+#define WINKEYER_EMULATOR_KEYED_SIZE  256
+
+
+
+
+/// State of the keyer as seen by host, for checks in tests.
+typedef struct {
+	bool host_open;
+	int wpm;
+	int weighting;
+	unsigned int ptt_lead_ms;
+	unsigned int ptt_tail_ms;
+	uint8_t pin_config;
+	uint8_t mode;
+	int sidetone;
+	bool key;                ///< State of key set with "key immediate" command.
+	bool ptt;                ///< State of PTT set with buffered PTT command.
+	bool busy;
+
+	/// Characters keyed from the buffer. Merged letters are recorded in
+	/// square brackets, e.g. "[SK]".
+	char keyed[WINKEYER_EMULATOR_KEYED_SIZE];
+	size_t keyed_len;
+
+	unsigned int clears;     ///< Count of "clear buffer" commands.
+	unsigned int buffered_speeds; ///< Count of buffered speed changes.
+	size_t max_fill;         ///< Max count of bytes in the buffer.
+	size_t overflows;        ///< Bytes dropped because the buffer was full.
+} winkeyer_emulator_state_t;
+
+
+
+
+typedef struct {
+	/// Fill of buffer at which XOFF is reported. Set before
+	/// winkeyer_emulator_start(). Zero selects 2/3 of buffer size, like
+	/// in the real keyer.
+	size_t xoff_threshold;
+
+	/// Duration of dot unit, in microseconds. Set before
+	/// winkeyer_emulator_start(). Zero selects duration calculated from
+	/// current speed; tests use short units to run quickly.
+	unsigned int unit_us;
+
+	char slave_path[64];     ///< Path to tty to be used by host.
+
+	int master_fd;
+	int slave_fd;            ///< Kept open, so that master doesn't see hangups when host closes the tty.
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	bool running;
+
+	winkeyer_emulator_state_t state;
+	uint8_t buffer[WINKEYER_EMULATOR_BUFFER_SIZE];
+	size_t len;
+	uint8_t command[4];      ///< Command being received.
+	size_t command_len;
+	int buffered_wpm;        ///< Speed set by buffered speed change, zero if none.
+	int64_t keying_end_ns;   ///< End of character being keyed, zero if not keying.
+	int status;              ///< Last status byte sent to host, -1 if none.
+} winkeyer_emulator_t;
+
+
+
+
+/**
+   @brief Create pseudo-terminal pair and start emulator's thread
+
+   @return 0 on success
+   @return -1 on failure
+*/
+int winkeyer_emulator_start(winkeyer_emulator_t * emu);
+
+
+
+
+/**
+   @brief Stop emulator's thread and close pseudo-terminal pair
+*/
+void winkeyer_emulator_stop(winkeyer_emulator_t * emu);
+
+
+
+
+/**
+   @brief Get copy of state of the keyer
+*/
+void winkeyer_emulator_get_state(winkeyer_emulator_t * emu, winkeyer_emulator_state_t * state);
+
+
+
+
+#endif /* #ifndef CWDAEMON_TESTS_LIB_WINKEYER_EMULATOR_H */
@@ -0,0 +1,529 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for composite cwdevice (cwdaemon/src/composite.c). Children
+/// of the composite device are fake devices that record calls of their
+/// methods; one of them is slow.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/composite.h"
+#include "src/cwdaemon.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+/// Duration of a single write to the slow child [us].
+#define TEST_SLOW_IO_US 5000
+
+
+
+
+/// State of a fake child, found by name of the child.
+typedef struct {
+	char const * name;
+	bool slow;
+	unsigned int latency_us;
+	bool has_inputs;
+
+	int cw_calls;
+	int cw;
+	int ptt;
+	int resets;
+	int options;
+	bool freed;
+} fake_child_t;
+
+static fake_child_t g_children[] = {
+	{ .name = "fast", .slow = false, .latency_us = 300, .has_inputs = false },
+	{ .name = "slow", .slow = true,  .latency_us = 200, .has_inputs = true  },
+	{ .name = "other", .slow = false, .latency_us = 100, .has_inputs = false },
+};
+
+
+
+
+static int test_composite_probe(void);
+static int test_composite_forwarding(void);
+static int test_composite_isolation(void);
+static int test_composite_overrun(void);
+static int test_composite_forking(void);
+
+static cwdevice * fake_factory(char const * desc);
+static fake_child_t * fake_child(cwdevice * dev);
+static int fake_init(cwdevice * dev, int fd);
+static int fake_free(cwdevice * dev);
+static int fake_reset_pins_state(cwdevice * dev);
+static int fake_cw(cwdevice * dev, int onoff);
+static int fake_ptt(cwdevice * dev, int onoff);
+static int fake_footswitch(cwdevice * dev);
+static int fake_optparse(cwdevice * dev, const char * option);
+static void fake_reset_all(void);
+static int open_composite(cwdevice * dev, char const * desc);
+static int64_t now_us(void);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_composite_probe,
+	test_composite_forwarding,
+	test_composite_isolation,
+	test_composite_overrun,
+	test_composite_forking,
+	NULL
+};
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			return -1;
+		}
+		i++;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+static cwdevice * fake_factory(char const * desc)
+{
+	fake_child_t * found = NULL;
+	for (size_t i = 0; i < sizeof (g_children) / sizeof (g_children[0]); i++) {
+		if (0 == strcmp(desc, g_children[i].name)) {
+			found = &g_children[i];
+		}
+	}
+	if (NULL == found) {
+		return NULL;
+	}
+
+	cwdevice * const dev = calloc(1, sizeof (cwdevice));
+	dev->init = fake_init;
+	dev->free = fake_free;
+	dev->reset_pins_state = fake_reset_pins_state;
+	dev->cw = fake_cw;
+	dev->ptt = fake_ptt;
+	dev->options.optparse = fake_optparse;
+	dev->fd = -1;
+	dev->desc = strdup(desc);
+
+	return dev;
+}
+
+
+
+
+static fake_child_t * fake_child(cwdevice * dev)
+{
+	for (size_t i = 0; i < sizeof (g_children) / sizeof (g_children[0]); i++) {
+		if (0 == strcmp(dev->desc, g_children[i].name)) {
+			return &g_children[i];
+		}
+	}
+	return NULL;
+}
+
+
+
+
+static int fake_init(cwdevice * dev, __attribute__((unused)) int fd)
+{
+	fake_child_t * const child = fake_child(dev);
+	dev->latency_us = child->latency_us;
+	if (child->has_inputs) {
+		dev->footswitch = fake_footswitch;
+	}
+	return 0;
+}
+
+
+
+
+static int fake_free(cwdevice * dev)
+{
+	fake_child(dev)->freed = true;
+	return 0;
+}
+
+
+
+
+static int fake_reset_pins_state(cwdevice * dev)
+{
+	fake_child_t * const child = fake_child(dev);
+	__atomic_add_fetch(&child->resets, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&child->cw, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&child->ptt, 0, __ATOMIC_RELAXED);
+	return 0;
+}
+
+
+
+
+static int fake_cw(cwdevice * dev, int onoff)
+{
+	fake_child_t * const child = fake_child(dev);
+	if (child->slow) {
+		nanosleep(&(struct timespec) { .tv_sec = 0, .tv_nsec = TEST_SLOW_IO_US * 1000L }, NULL);
+	}
+	__atomic_store_n(&child->cw, onoff, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&child->cw_calls, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+
+
+
+static int fake_ptt(cwdevice * dev, int onoff)
+{
+	__atomic_store_n(&fake_child(dev)->ptt, onoff, __ATOMIC_RELAXED);
+	return 0;
+}
+
+
+
+
+static int fake_footswitch(__attribute__((unused)) cwdevice * dev)
+{
+	return 42;
+}
+
+
+
+
+static int fake_optparse(cwdevice * dev, const char * option)
+{
+	if (0 == strcmp(option, "bad")) {
+		return -1;
+	}
+	fake_child(dev)->options++;
+	return 0;
+}
+
+
+
+
+static void fake_reset_all(void)
+{
+	for (size_t i = 0; i < sizeof (g_children) / sizeof (g_children[0]); i++) {
+		g_children[i].cw_calls = 0;
+		g_children[i].cw = 0;
+		g_children[i].ptt = 0;
+		g_children[i].resets = 0;
+		g_children[i].options = 0;
+		g_children[i].freed = false;
+	}
+}
+
+
+
+
+static int open_composite(cwdevice * dev, char const * desc)
+{
+	fake_reset_all();
+	memset(dev, 0, sizeof (cwdevice));
+	dev->init = composite_init;
+	dev->free = composite_free;
+	dev->reset_pins_state = composite_reset_pins_state;
+	dev->cw = composite_cw;
+	dev->ptt = composite_ptt;
+	dev->options.optparse = composite_optparse;
+	dev->options.optvalidate = composite_optvalidate;
+	dev->desc = (char *) desc;
+
+	if (0 != composite_probe_cwdevice(desc, fake_factory)) {
+		test_log_err("Test: failed to probe composite device [%s]\n", desc);
+		return -1;
+	}
+	if (0 != dev->init(dev, -1)) {
+		test_log_err("Test: failed to init composite device [%s]\n", desc);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+
+static int test_composite_probe(void)
+{
+	char const * names[] = { "fast", "fast+", "+slow", "fast+unknown", "fast+slow+other+fast+slow" };
+	for (size_t i = 0; i < sizeof (names) / sizeof (names[0]); i++) {
+		if (0 == composite_probe_cwdevice(names[i], fake_factory)) {
+			test_log_err("Test: name [%s] was accepted as composite device\n", names[i]);
+			return -1;
+		}
+	}
+
+	test_log_info("Test: probe %s\n", "OK");
+	return 0;
+}
+
+
+
+
+/// Lines, options and input lines are forwarded to children.
+static int test_composite_forwarding(void)
+{
+	cwdevice dev;
+	if (0 != open_composite(&dev, "fast+slow+other")) {
+		return -1;
+	}
+
+	int result = 0;
+	if (100 != dev.latency_us) {
+		test_log_err("Test: latency of composite device is %u, expected 100\n", dev.latency_us);
+		result = -1;
+	}
+	if (NULL == dev.footswitch || 42 != dev.footswitch(&dev) || NULL != dev.paddles || NULL != dev.wait_input) {
+		test_log_err("Test: input lines of composite device are not taken from slow child %s\n", "");
+		result = -1;
+	}
+	if (0 != dev.options.optparse(&dev, "key=RTS") || 0 == dev.options.optparse(&dev, "bad")) {
+		test_log_err("Test: unexpected results of parsing of options %s\n", "");
+		result = -1;
+	}
+
+	dev.ptt(&dev, 1);
+	dev.cw(&dev, 1);
+	dev.free(&dev);
+
+	for (size_t i = 0; i < sizeof (g_children) / sizeof (g_children[0]); i++) {
+		fake_child_t const * const child = &g_children[i];
+		if (!child->freed || 1 != child->cw || 1 != child->ptt || 1 != child->cw_calls || child->options < 1) {
+			test_log_err("Test: unexpected state of child [%s]: freed=%d cw=%d ptt=%d cw_calls=%d options=%d\n",
+			             child->name, child->freed, child->cw, child->ptt, child->cw_calls, child->options);
+			result = -1;
+		}
+	}
+	if (NULL != dev.footswitch) {
+		test_log_err("Test: closed composite device still has input lines %s\n", "");
+		result = -1;
+	}
+
+	if (0 == result) {
+		test_log_info("Test: forwarding %s\n", "OK");
+	}
+	return result;
+}
+
+
+
+
+/// Slow child doesn't delay the fast one, and doesn't delay the caller.
+static int test_composite_isolation(void)
+{
+	cwdevice dev;
+	if (0 != open_composite(&dev, "slow+fast")) {
+		return -1;
+	}
+
+	int const n = 10;
+	int64_t const start_us = now_us();
+	for (int i = 0; i < n; i++) {
+		dev.cw(&dev, (i + 1) % 2);
+	}
+	int64_t const post_us = now_us() - start_us;
+
+	// Wait for the fast child.
+	while (n != __atomic_load_n(&g_children[0].cw_calls, __ATOMIC_ACQUIRE) && now_us() - start_us < 1000000) {
+		nanosleep(&(struct timespec) { .tv_sec = 0, .tv_nsec = 100000 }, NULL);
+	}
+	int const fast_calls = __atomic_load_n(&g_children[0].cw_calls, __ATOMIC_ACQUIRE);
+	int const slow_calls = __atomic_load_n(&g_children[1].cw_calls, __ATOMIC_ACQUIRE);
+	int64_t const fast_us = now_us() - start_us;
+
+	dev.free(&dev); // Waits for the slow child.
+
+	int result = 0;
+	if (post_us > TEST_SLOW_IO_US) {
+		test_log_err("Test: posting of %d commands took %ld us\n", n, (long) post_us);
+		result = -1;
+	}
+	if (n != fast_calls || slow_calls >= n || fast_us > n * TEST_SLOW_IO_US / 2) {
+		test_log_err("Test: fast child got %d commands, slow child got %d commands after %ld us\n", fast_calls, slow_calls, (long) fast_us);
+		result = -1;
+	}
+	if (n != g_children[1].cw_calls || 0 != g_children[1].cw) {
+		test_log_err("Test: slow child didn't get all commands: %d\n", g_children[1].cw_calls);
+		result = -1;
+	}
+
+	if (0 == result) {
+		test_log_info("Test: isolation %s\n", "OK");
+	}
+	return result;
+}
+
+
+
+
+/// When queue of slow child overflows, the caller isn't blocked, and the
+/// slow child ends in the latest requested state.
+static int test_composite_overrun(void)
+{
+	cwdevice dev;
+	if (0 != open_composite(&dev, "slow+fast")) {
+		return -1;
+	}
+
+	// Commands are posted at a rate that the fast child can keep up with,
+	// but the slow child can't.
+	int const n = (int) COMPOSITE_QUEUE_SIZE * 2 + 1;
+	int64_t post_max_us = 0;
+	for (int i = 0; i < n; i++) {
+		int64_t const start_us = now_us();
+		dev.cw(&dev, (i + 1) % 2);
+		int64_t const post_us = now_us() - start_us;
+		post_max_us = post_us > post_max_us ? post_us : post_max_us;
+		nanosleep(&(struct timespec) { .tv_sec = 0, .tv_nsec = TEST_SLOW_IO_US * 1000L / 10 }, NULL);
+	}
+
+	dev.free(&dev);
+
+	int result = 0;
+	if (post_max_us > TEST_SLOW_IO_US) {
+		test_log_err("Test: posting of a command took %ld us\n", (long) post_max_us);
+		result = -1;
+	}
+	if (1 != g_children[1].cw || g_children[1].cw_calls >= n) {
+		test_log_err("Test: slow child: cw=%d after %d calls, expected 1 after less than %d calls\n", g_children[1].cw, g_children[1].cw_calls, n);
+		result = -1;
+	}
+	if (n != g_children[0].cw_calls || 1 != g_children[0].cw) {
+		test_log_err("Test: fast child: cw=%d after %d calls\n", g_children[0].cw, g_children[0].cw_calls);
+		result = -1;
+	}
+
+	if (0 == result) {
+		test_log_info("Test: overrun %s\n", "OK");
+	}
+	return result;
+}
+
+
+
+
+/// Composite device initialized before fork() (as cwdaemon does when it
+/// parses command line options) keys its children in child process.
+static int test_composite_forking(void)
+{
+	cwdevice dev;
+	if (0 != open_composite(&dev, "fast+slow")) {
+		return -1;
+	}
+
+	pid_t const pid = fork();
+	if (pid < 0) {
+		test_log_err("Test: fork() failed %s\n", "");
+		dev.free(&dev);
+		return -1;
+	}
+	if (0 == pid) {
+		dev.ptt(&dev, 1);
+		dev.cw(&dev, 1);
+		int64_t const start_us = now_us();
+		while ((1 != __atomic_load_n(&g_children[0].cw_calls, __ATOMIC_ACQUIRE)
+		        || 1 != __atomic_load_n(&g_children[1].cw_calls, __ATOMIC_ACQUIRE))
+		       && now_us() - start_us < 1000000) {
+			nanosleep(&(struct timespec) { .tv_sec = 0, .tv_nsec = 100000 }, NULL);
+		}
+		for (int i = 0; i < 2; i++) {
+			fake_child_t const * const child = &g_children[i];
+			if (1 != __atomic_load_n(&child->cw_calls, __ATOMIC_ACQUIRE) || 1 != child->cw || 1 != child->ptt) {
+				test_log_err("Test: child [%s] hasn't been keyed in forked process: cw=%d ptt=%d cw_calls=%d\n",
+				             child->name, child->cw, child->ptt, child->cw_calls);
+				_exit(1);
+			}
+		}
+		dev.free(&dev);
+		_exit(0);
+	}
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+	dev.free(&dev); // Threads of children have never been started in this process.
+
+	if (!WIFEXITED(status) || 0 != WEXITSTATUS(status)) {
+		test_log_err("Test: composite device failed in forked process, status 0x%x\n", (unsigned int) status);
+		return -1;
+	}
+
+	test_log_info("Test: forking %s\n", "OK");
+	return 0;
+}
+
+
+
+
+static int64_t now_us(void)
+{
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
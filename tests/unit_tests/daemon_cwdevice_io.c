@@ -0,0 +1,815 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for shadowing of pin states and coalescing of writes in
+/// cwdaemon/src/ttys.c, cwdaemon/src/lp.c and cwdaemon/src/gpio.c. The
+/// drivers do their I/O
+/// through a mock backend that emulates the lines of a device and counts
+/// ioctl() calls.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#if HAVE_LINUX_SERIAL_H
+# include <linux/serial.h>
+#endif
+#ifdef HAVE_LINUX_PPDEV_H
+# include <linux/parport.h>
+# include <linux/ppdev.h>
+#endif
+#if HAVE_LINUX_GPIO_H
+# include <linux/gpio.h>
+#endif
+
+#include "src/cwdaemon.h"
+#include "src/cwdevice_io.h"
+#include "src/gpio.h"
+#include "src/iambic.h"
+#include "src/lp.h"
+#include "src/ttys.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+#define MOCK_CALLS_MAX 32
+
+
+
+
+static int test_ttys_init(void);
+static int test_ttys_redundant(void);
+static int test_ttys_coalesced(void);
+static int test_ttys_latency(void);
+#if HAVE_LINUX_SERIAL_H && defined(TIOCGICOUNT) && defined(TIOCMIWAIT)
+static int test_ttys_wait_input(void);
+#endif
+#ifdef HAVE_LINUX_PPDEV_H
+static int test_lp(void);
+#endif
+#if HAVE_LINUX_GPIO_H
+static int test_gpio(void);
+static int test_gpio_options(void);
+#endif
+
+static int mock_ioctl(int fd, unsigned long request, void * arg);
+static void mock_reset(void);
+static size_t mock_count(unsigned long request);
+#if HAVE_LINUX_SERIAL_H && defined(TIOCGICOUNT)
+static void mock_toggle_input(int line);
+#endif
+static int open_fake_fd(void);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_ttys_init,
+	test_ttys_redundant,
+	test_ttys_coalesced,
+	test_ttys_latency,
+#if HAVE_LINUX_SERIAL_H && defined(TIOCGICOUNT) && defined(TIOCMIWAIT)
+	test_ttys_wait_input,
+#endif
+#ifdef HAVE_LINUX_PPDEV_H
+	test_lp,
+#endif
+#if HAVE_LINUX_GPIO_H
+	test_gpio,
+	test_gpio_options,
+#endif
+	NULL
+};
+
+
+
+
+/// State of emulated device and log of ioctl() calls.
+static struct {
+	int lines;             ///< Modem lines of tty.
+	int serial_flags;      ///< Flags of serial driver (ASYNC_*).
+	long change_delay_ns;  ///< Time of change of modem lines.
+	unsigned char control; ///< Control register of parallel port.
+	unsigned char data;    ///< Data register of parallel port.
+#if HAVE_LINUX_SERIAL_H && defined(TIOCGICOUNT)
+	struct serial_icounter_struct icount; ///< Counts of changes of input lines of tty.
+	bool icount_unsupported; ///< Emulate driver that doesn't count changes (e.g. pty).
+#endif
+#if HAVE_LINUX_GPIO_H
+	struct gpio_v2_line_request gpio_requests[2]; ///< Line requests: outputs, inputs.
+	size_t gpio_requests_count;
+	uint64_t gpio_outputs;   ///< Values of requested output lines.
+	uint64_t gpio_inputs;    ///< Values of requested input lines.
+	int gpio_events_fd;      ///< Write end of pipe with edge events of input lines.
+#endif
+
+	unsigned long requests[MOCK_CALLS_MAX];
+	size_t count;
+} g_mock;
+
+static cwdevice_io_t const g_mock_io = {
+	.ioctl = mock_ioctl,
+};
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			return -1;
+		}
+		i++;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Initialization of tty reads lines once and resets both pins with one call
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_ttys_init(void)
+{
+	cwdevice dev;
+	tty_init_cwdevice(&dev);
+	dev.io = &g_mock_io;
+
+	mock_reset();
+	g_mock.lines = TIOCM_DTR | TIOCM_RTS | TIOCM_CTS;
+	dev.init(&dev, open_fake_fd());
+
+	if (1 != mock_count(TIOCMGET) || 1 != mock_count(TIOCMBIC) || 0 != mock_count(TIOCMBIS)) {
+		test_log_err("Unexpected ioctl() calls during init: %zu\n", g_mock.count);
+		return -1;
+	}
+	if (TIOCM_CTS != g_mock.lines) {
+		test_log_err("Unexpected lines after init: 0x%x\n", (unsigned int) g_mock.lines);
+		return -1;
+	}
+#if HAVE_LINUX_SERIAL_H && defined(ASYNC_LOW_LATENCY)
+	if (!(g_mock.serial_flags & ASYNC_LOW_LATENCY)) {
+		test_log_err("Low-latency mode has not been enabled %s\n", "");
+		return -1;
+	}
+#endif
+
+	/* Pins are already in reset state: closing the device doesn't touch them. */
+	mock_reset();
+	dev.free(&dev);
+	if (0 != mock_count(TIOCMBIS) || 0 != mock_count(TIOCMBIC)) {
+		test_log_err("Unexpected ioctl() calls during close: %zu\n", g_mock.count);
+		return -1;
+	}
+#if HAVE_LINUX_SERIAL_H && defined(ASYNC_LOW_LATENCY)
+	if (g_mock.serial_flags & ASYNC_LOW_LATENCY) {
+		test_log_err("Low-latency mode has not been restored %s\n", "");
+		return -1;
+	}
+#endif
+	free(dev.desc);
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Repeated requests for the same state of a pin don't reach the device
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_ttys_redundant(void)
+{
+	cwdevice dev;
+	tty_init_cwdevice(&dev);
+	dev.io = &g_mock_io;
+	g_mock.lines = 0;
+	dev.init(&dev, open_fake_fd());
+
+	mock_reset();
+	dev.cw(&dev, 1);
+	if (1 != g_mock.count || TIOCMBIS != g_mock.requests[0] || TIOCM_DTR != g_mock.lines) {
+		test_log_err("Unexpected ioctl() calls for key down: %zu\n", g_mock.count);
+		return -1;
+	}
+	dev.cw(&dev, 1);
+	dev.ptt(&dev, 0);
+	if (1 != g_mock.count) {
+		test_log_err("Redundant changes of lines reached the device: %zu calls\n", g_mock.count);
+		return -1;
+	}
+	dev.cw(&dev, 0);
+	if (2 != g_mock.count || TIOCMBIC != g_mock.requests[1] || 0 != g_mock.lines) {
+		test_log_err("Unexpected ioctl() calls for key up: %zu\n", g_mock.count);
+		return -1;
+	}
+
+	dev.free(&dev);
+	free(dev.desc);
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Changes of several lines are done with a single call
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_ttys_coalesced(void)
+{
+	cwdevice dev;
+	tty_init_cwdevice(&dev);
+	dev.io = &g_mock_io;
+	g_mock.lines = 0;
+	dev.init(&dev, open_fake_fd());
+
+	dev.cw(&dev, 1);
+	dev.ptt(&dev, 1);
+
+	/* Both lines are on: reset clears them with one call. */
+	mock_reset();
+	dev.reset_pins_state(&dev);
+	if (1 != g_mock.count || TIOCMBIC != g_mock.requests[0] || 0 != g_mock.lines) {
+		test_log_err("Unexpected ioctl() calls for reset with two lines on: %zu\n", g_mock.count);
+		return -1;
+	}
+
+	/* Only PTT is on: reset clears only the line that is on. */
+	dev.ptt(&dev, 1);
+	mock_reset();
+	dev.reset_pins_state(&dev);
+	if (1 != g_mock.count || TIOCMBIC != g_mock.requests[0] || 0 != g_mock.lines) {
+		test_log_err("Unexpected ioctl() calls for reset with one line on: %zu\n", g_mock.count);
+		return -1;
+	}
+
+	dev.free(&dev);
+	free(dev.desc);
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Latency of changing lines is measured without keying, or configured
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_ttys_latency(void)
+{
+	cwdevice dev;
+	tty_init_cwdevice(&dev);
+	dev.io = &g_mock_io;
+	g_mock.lines = 0;
+	dev.init(&dev, open_fake_fd());
+
+	if (0 != dev.latency_us) {
+		test_log_err("Latency is set without being requested: %u us\n", dev.latency_us);
+		return -1;
+	}
+
+	mock_reset();
+	g_mock.change_delay_ns = 2000000;
+	if (0 != dev.options.optparse(&dev, "latency=auto")) {
+		test_log_err("Failed to parse 'latency=auto' %s\n", "");
+		return -1;
+	}
+	g_mock.change_delay_ns = 0;
+	if (dev.latency_us < 2000 || dev.latency_us > 20000) {
+		test_log_err("Unexpected measured latency: %u us\n", dev.latency_us);
+		return -1;
+	}
+	if (0 != mock_count(TIOCMBIS) || 0 != g_mock.lines) {
+		test_log_err("Lines have been set during measurement %s\n", "");
+		return -1;
+	}
+
+	if (0 != dev.options.optparse(&dev, "latency=1500") || 1500 != dev.latency_us) {
+		test_log_err("Failed to set explicit latency: %u us\n", dev.latency_us);
+		return -1;
+	}
+	if (0 == dev.options.optparse(&dev, "latency=fast") || 0 == dev.options.optparse(&dev, "latency=-5")) {
+		test_log_err("Invalid values of 'latency' have been accepted %s\n", "");
+		return -1;
+	}
+	if (0 != dev.options.optparse(&dev, "latency=none") || 0 != dev.latency_us) {
+		test_log_err("Failed to disable latency: %u us\n", dev.latency_us);
+		return -1;
+	}
+
+	dev.free(&dev);
+	free(dev.desc);
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+#if HAVE_LINUX_SERIAL_H && defined(TIOCGICOUNT) && defined(TIOCMIWAIT)
+/// @brief Change of input line between reading the line and TIOCMIWAIT is not missed
+///
+/// The mock's TIOCMIWAIT returns immediately, so the test checks whether
+/// wait_input() would have blocked (i.e. called TIOCMIWAIT).
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_ttys_wait_input(void)
+{
+	cwdevice dev;
+	tty_init_cwdevice(&dev);
+	dev.io = &g_mock_io;
+	g_mock.lines = 0;
+	memset(&g_mock.icount, 0, sizeof (g_mock.icount));
+	g_mock.icount_unsupported = false;
+	if (0 != dev.options.optparse(&dev, "footswitch=cts") || NULL == dev.wait_input) {
+		test_log_err("Failed to configure footswitch %s\n", "");
+		return -1;
+	}
+	dev.init(&dev, open_fake_fd());
+
+	/* First wait returns at once: lines read before it can't be compared with anything. */
+	mock_reset();
+	if (0 != dev.wait_input(&dev) || 0 != mock_count(TIOCMIWAIT)) {
+		test_log_err("First wait has blocked %s\n", "");
+		return -1;
+	}
+
+	/* Input thread reads the line, and the line changes before the thread waits again. */
+	int const released = dev.footswitch(&dev);
+	mock_toggle_input(TIOCM_CTS);
+	mock_reset();
+	if (0 != dev.wait_input(&dev) || 0 != mock_count(TIOCMIWAIT)) {
+		test_log_err("Change of line before the wait has been missed %s\n", "");
+		return -1;
+	}
+	if (released == dev.footswitch(&dev)) {
+		test_log_err("Change of line is not visible %s\n", "");
+		return -1;
+	}
+
+	/* No change since the last wait: block. */
+	mock_reset();
+	if (0 != dev.wait_input(&dev) || 1 != mock_count(TIOCMIWAIT)) {
+		test_log_err("Wait without a change hasn't blocked %s\n", "");
+		return -1;
+	}
+	/* Change of a line that isn't monitored doesn't matter. */
+	mock_toggle_input(TIOCM_DSR);
+	mock_reset();
+	if (0 != dev.wait_input(&dev) || 1 != mock_count(TIOCMIWAIT)) {
+		test_log_err("Change of other line has woken up the wait %s\n", "");
+		return -1;
+	}
+
+	/* Driver without counts of changes: wait in TIOCMIWAIT only. */
+	g_mock.icount_unsupported = true;
+	mock_toggle_input(TIOCM_CTS);
+	mock_reset();
+	if (0 != dev.wait_input(&dev) || 1 != mock_count(TIOCMIWAIT)) {
+		test_log_err("Driver without counts of changes hasn't been waited on %s\n", "");
+		return -1;
+	}
+	g_mock.icount_unsupported = false;
+
+	dev.free(&dev);
+	free(dev.desc);
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+#endif
+
+
+
+
+#ifdef HAVE_LINUX_PPDEV_H
+/// @brief Parallel port: control lines are written once per change, data
+/// register is written only when band changes
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_lp(void)
+{
+	cwdevice dev = {
+		.init       = lp_init,
+		.free       = lp_free,
+		.reset_pins_state = lp_reset_pins_state,
+		.cw         = lp_cw,
+		.ptt        = lp_ptt,
+		.ssbway     = lp_ssbway,
+		.switchband = lp_switchband,
+		.io         = &g_mock_io,
+		.desc       = "parport0",
+	};
+
+	mock_reset();
+	g_mock.control = PARPORT_CONTROL_INIT | PARPORT_CONTROL_AUTOFD;
+	dev.init(&dev, open_fake_fd());
+	/* PPSETMODE, PPEXCL, PPCLAIM, PPRCONTROL, /STROBE, reset of control lines, data. */
+	if (7 != g_mock.count || 1 != mock_count(PPRCONTROL) || 2 != mock_count(PPFCONTROL) || 1 != mock_count(PPWDATA)) {
+		test_log_err("Unexpected ioctl() calls during init: %zu\n", g_mock.count);
+		return -1;
+	}
+	unsigned char const reset = PARPORT_CONTROL_STROBE | PARPORT_CONTROL_SELECT;
+	if (reset != g_mock.control || 0 != g_mock.data) {
+		test_log_err("Unexpected registers after init: 0x%02x 0x%02x\n", g_mock.control, g_mock.data);
+		return -1;
+	}
+
+	mock_reset();
+	dev.cw(&dev, 1);
+	dev.cw(&dev, 1);
+	dev.ptt(&dev, 0);
+	dev.switchband(&dev, 0);
+	if (1 != g_mock.count || PPFCONTROL != g_mock.requests[0]) {
+		test_log_err("Redundant changes of lines reached the device: %zu calls\n", g_mock.count);
+		return -1;
+	}
+
+	/* CW, PTT and SSB way are reset together. */
+	dev.ptt(&dev, 1);
+	dev.ssbway(&dev, 1);
+	dev.switchband(&dev, 5);
+	dev.switchband(&dev, 5);
+	mock_reset();
+	dev.reset_pins_state(&dev);
+	if (2 != g_mock.count || 1 != mock_count(PPFCONTROL) || 1 != mock_count(PPWDATA)) {
+		test_log_err("Unexpected ioctl() calls for reset: %zu\n", g_mock.count);
+		return -1;
+	}
+	if (reset != g_mock.control || 0 != g_mock.data) {
+		test_log_err("Unexpected registers after reset: 0x%02x 0x%02x\n", g_mock.control, g_mock.data);
+		return -1;
+	}
+
+	dev.free(&dev);
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+#endif /* #ifdef HAVE_LINUX_PPDEV_H */
+
+
+
+
+#if HAVE_LINUX_GPIO_H
+/// @brief Key and PTT of GPIO chip are requested together and changed with single calls
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_gpio(void)
+{
+	cwdevice dev;
+	gpio_init_cwdevice(&dev);
+	dev.io = &g_mock_io;
+	memset(&g_mock.gpio_requests, 0, sizeof (g_mock.gpio_requests));
+	g_mock.gpio_requests_count = 0;
+	g_mock.gpio_outputs = 0;
+
+	/* Device is opened before "-o" options are parsed. No lines are requested yet. */
+	mock_reset();
+	dev.init(&dev, open_fake_fd());
+	if (0 != g_mock.count || NULL != dev.footswitch) {
+		test_log_err("Unexpected ioctl() calls during init of GPIO chip: %zu\n", g_mock.count);
+		return -1;
+	}
+
+	char const * options[] = { "key=17", "ptt=27", "footswitch=22", "dot=5", "dash=6" };
+	for (size_t i = 0; i < sizeof (options) / sizeof (options[0]); i++) {
+		if (0 != dev.options.optparse(&dev, options[i])) {
+			test_log_err("Failed to parse option [%s]\n", options[i]);
+			return -1;
+		}
+	}
+	if (0 != dev.options.optvalidate(&dev)) {
+		test_log_err("Failed to validate options of GPIO chip %s\n", "");
+		return -1;
+	}
+
+	struct gpio_v2_line_request const * const out = &g_mock.gpio_requests[0];
+	struct gpio_v2_line_request const * const in = &g_mock.gpio_requests[1];
+	if (2 != g_mock.gpio_requests_count
+	    || 2 != out->num_lines || 17 != out->offsets[0] || 27 != out->offsets[1]
+	    || !(out->config.flags & GPIO_V2_LINE_FLAG_OUTPUT)
+	    || 3 != in->num_lines || 22 != in->offsets[0] || 5 != in->offsets[1] || 6 != in->offsets[2]
+	    || !(in->config.flags & GPIO_V2_LINE_FLAG_EDGE_FALLING) || !(in->config.flags & GPIO_V2_LINE_FLAG_EDGE_RISING)) {
+		test_log_err("Unexpected line requests: %zu\n", g_mock.gpio_requests_count);
+		return -1;
+	}
+
+	mock_reset();
+	dev.cw(&dev, 1);
+	dev.cw(&dev, 1);
+	dev.ptt(&dev, 1);
+	dev.ptt(&dev, 1);
+	if (2 != mock_count(GPIO_V2_LINE_SET_VALUES_IOCTL) || 0x3 != g_mock.gpio_outputs) {
+		test_log_err("Unexpected writes of key and PTT: %zu, lines 0x%llx\n", mock_count(GPIO_V2_LINE_SET_VALUES_IOCTL), (unsigned long long) g_mock.gpio_outputs);
+		return -1;
+	}
+
+	mock_reset();
+	dev.reset_pins_state(&dev);
+	if (1 != mock_count(GPIO_V2_LINE_SET_VALUES_IOCTL) || 0 != g_mock.gpio_outputs) {
+		test_log_err("Reset of key and PTT wasn't done with one call: %zu\n", mock_count(GPIO_V2_LINE_SET_VALUES_IOCTL));
+		return -1;
+	}
+
+	g_mock.gpio_inputs = 0x1; /* Footswitch. */
+	if (NULL == dev.footswitch || 0 != dev.footswitch(&dev) || 0 != dev.paddles(&dev)) {
+		test_log_err("Pressed footswitch not recognized %s\n", "");
+		return -1;
+	}
+	g_mock.gpio_inputs = 0x6; /* Dot and dash. */
+	if (1 != dev.footswitch(&dev) || (IAMBIC_PADDLE_DOT | IAMBIC_PADDLE_DASH) != dev.paddles(&dev)) {
+		test_log_err("Pressed paddles not recognized %s\n", "");
+		return -1;
+	}
+
+	/* Edge event carries time stamp from kernel. */
+	struct gpio_v2_line_event event;
+	memset(&event, 0, sizeof (event));
+	event.timestamp_ns = 123456789;
+	event.offset = 5;
+	event.id = GPIO_V2_LINE_EVENT_FALLING_EDGE;
+	if (sizeof (event) != write(g_mock.gpio_events_fd, &event, sizeof (event))
+	    || NULL == dev.wait_input || 0 != dev.wait_input(&dev) || 123456789 != dev.input_event_ns) {
+		test_log_err("Edge event not received %s\n", "");
+		return -1;
+	}
+
+	/* Pins are already in reset state: closing the device doesn't touch them. */
+	mock_reset();
+	dev.free(&dev);
+	if (0 != mock_count(GPIO_V2_LINE_SET_VALUES_IOCTL)) {
+		test_log_err("Unexpected ioctl() calls during close: %zu\n", g_mock.count);
+		return -1;
+	}
+	close(g_mock.gpio_events_fd);
+	free(dev.desc);
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Invalid options of GPIO chip are rejected
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_gpio_options(void)
+{
+	cwdevice dev;
+	gpio_init_cwdevice(&dev);
+	dev.io = &g_mock_io;
+
+	char const * invalid[] = { "key=", "key=abc", "key=-2", "key=100000", "ptt=DTR", "active=middle", "foo=1" };
+	for (size_t i = 0; i < sizeof (invalid) / sizeof (invalid[0]); i++) {
+		if (0 == dev.options.optparse(&dev, invalid[i])) {
+			test_log_err("Invalid option [%s] was accepted\n", invalid[i]);
+			return -1;
+		}
+	}
+
+	if (0 != dev.options.optparse(&dev, "key=4") || 0 != dev.options.optparse(&dev, "dash=4")) {
+		test_log_err("Valid options were rejected %s\n", "");
+		return -1;
+	}
+	if (0 == dev.options.optvalidate(&dev)) {
+		test_log_err("The same line used for two functions was accepted %s\n", "");
+		return -1;
+	}
+	if (0 != dev.options.optparse(&dev, "dash=none") || 0 != dev.options.optvalidate(&dev)) {
+		test_log_err("Valid configuration was rejected %s\n", "");
+		return -1;
+	}
+	free(dev.desc);
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+#endif
+
+
+
+
+static int mock_ioctl(__attribute__((unused)) int fd, unsigned long request, void * arg)
+{
+	if (g_mock.count < MOCK_CALLS_MAX) {
+		g_mock.requests[g_mock.count] = request;
+	}
+	g_mock.count++;
+
+	switch (request) {
+	case TIOCMGET:
+		*(int *) arg = g_mock.lines;
+		break;
+	case TIOCMBIS:
+		g_mock.lines |= *(int *) arg;
+		break;
+	case TIOCMBIC:
+		if (g_mock.change_delay_ns) {
+			struct timespec const delay = { .tv_sec = 0, .tv_nsec = g_mock.change_delay_ns };
+			nanosleep(&delay, NULL);
+		}
+		g_mock.lines &= ~*(int *) arg;
+		break;
+	case TIOCMSET:
+		g_mock.lines = *(int *) arg;
+		break;
+#if HAVE_LINUX_SERIAL_H
+	case TIOCGSERIAL:
+		((struct serial_struct *) arg)->flags = g_mock.serial_flags;
+		break;
+	case TIOCSSERIAL:
+		g_mock.serial_flags = ((struct serial_struct *) arg)->flags;
+		break;
+#endif
+#if HAVE_LINUX_SERIAL_H && defined(TIOCGICOUNT)
+	case TIOCGICOUNT:
+		if (g_mock.icount_unsupported) {
+			errno = EINVAL;
+			return -1;
+		}
+		*(struct serial_icounter_struct *) arg = g_mock.icount;
+		break;
+#endif
+#ifdef HAVE_LINUX_PPDEV_H
+	case PPRCONTROL:
+		*(unsigned char *) arg = g_mock.control;
+		break;
+	case PPFCONTROL:
+		{
+			struct ppdev_frob_struct const * frob = arg;
+			g_mock.control = (unsigned char) ((g_mock.control & ~frob->mask) | (frob->val & frob->mask));
+		}
+		break;
+	case PPWDATA:
+		g_mock.data = *(unsigned char *) arg;
+		break;
+#endif
+#if HAVE_LINUX_GPIO_H
+	case GPIO_V2_GET_LINE_IOCTL:
+		{
+			struct gpio_v2_line_request * const request = arg;
+			if (request->config.flags & GPIO_V2_LINE_FLAG_INPUT) {
+				int fds[2] = { -1, -1 };
+				if (0 != pipe(fds)) {
+					return -1;
+				}
+				request->fd = fds[0];
+				g_mock.gpio_events_fd = fds[1];
+			} else {
+				request->fd = open_fake_fd();
+			}
+			if (g_mock.gpio_requests_count < 2) {
+				g_mock.gpio_requests[g_mock.gpio_requests_count++] = *request;
+			}
+		}
+		break;
+	case GPIO_V2_LINE_SET_VALUES_IOCTL:
+		{
+			struct gpio_v2_line_values const * const values = arg;
+			g_mock.gpio_outputs = (g_mock.gpio_outputs & ~values->mask) | (values->bits & values->mask);
+		}
+		break;
+	case GPIO_V2_LINE_GET_VALUES_IOCTL:
+		{
+			struct gpio_v2_line_values * const values = arg;
+			values->bits = g_mock.gpio_inputs & values->mask;
+		}
+		break;
+#endif
+	default:
+		break;
+	}
+	return 0;
+}
+
+
+
+
+static void mock_reset(void)
+{
+	memset(g_mock.requests, 0, sizeof (g_mock.requests));
+	g_mock.count = 0;
+}
+
+
+
+
+static size_t mock_count(unsigned long request)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < g_mock.count && i < MOCK_CALLS_MAX; i++) {
+		if (request == g_mock.requests[i]) {
+			n++;
+		}
+	}
+	return n;
+}
+
+
+
+
+#if HAVE_LINUX_SERIAL_H && defined(TIOCGICOUNT)
+/// @brief Change state of input line of emulated tty, and count the change like serial driver does
+static void mock_toggle_input(int line)
+{
+	g_mock.lines ^= line;
+	switch (line) {
+	case TIOCM_CTS:
+		g_mock.icount.cts++;
+		break;
+	case TIOCM_DSR:
+		g_mock.icount.dsr++;
+		break;
+	case TIOCM_CD:
+		g_mock.icount.dcd++;
+		break;
+	case TIOCM_RI:
+	default:
+		g_mock.icount.rng++;
+		break;
+	}
+}
+#endif
+
+
+
+
+/// @brief Get a file descriptor that drivers can close()
+static int open_fake_fd(void)
+{
+	return open("/dev/null", O_RDWR);
+}
@@ -0,0 +1,487 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for cwdaemon/src/engine_native.c.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "src/cwdaemon.h"
+#include "src/engine.h"
+#include "src/engine_native.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+/// Tolerance of timing of keying edges. Generous, because the test may be
+/// run on a loaded machine without real-time priority.
+#define TEST_TOLERANCE_US  15000
+
+#define TEST_EDGES_MAX  32
+
+
+
+
+static int test_engine_native_timing(void);
+static int test_engine_native_character_elements(void);
+static int test_engine_native_open_sound_system(void);
+static int test_engine_native_keying(void);
+static int test_engine_native_flush(void);
+static int test_engine_native_instances(void);
+
+static void keying_callback(void * arg, int keystate);
+static void instance_keying_callback(void * arg, int keystate);
+static void tq_low_callback(void * arg);
+static int64_t now_us(void);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_engine_native_timing,
+	test_engine_native_character_elements,
+	test_engine_native_open_sound_system,
+	test_engine_native_keying,
+	test_engine_native_flush,
+	test_engine_native_instances,
+	NULL
+};
+
+
+
+
+/// Keying edges recorded by keying callback.
+static struct {
+	int64_t timestamp_us[TEST_EDGES_MAX];
+	int keystate[TEST_EDGES_MAX];
+	size_t count;
+	unsigned int tq_low_count;
+} g_edges;
+
+
+
+
+/// Keying edges of one instance of the engine, recorded by
+/// instance_keying_callback().
+typedef struct {
+	int64_t timestamp_us[TEST_EDGES_MAX];
+	int keystate[TEST_EDGES_MAX];
+	size_t count;
+} instance_edges_t;
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			return -1;
+		}
+		i++;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Durations of elements match libcw's formulas
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_engine_native_timing(void)
+{
+	struct {
+		int wpm;
+		int weighting;
+		int gap;
+		engine_native_timing_t expected;
+	} const data[] = {
+		/* Unit = 100 ms. */
+		{ 12, 50, 0, { .dot_us = 100000, .dash_us = 300000, .ims_us = 100000, .eoc_us = 200000, .eow_us = 400000 } },
+		{ 12, 50, 2, { .dot_us = 100000, .dash_us = 300000, .ims_us = 100000, .eoc_us = 400000, .eow_us = 866666 } },
+		/* Weighting length = 2 * 30 * 100000 / 100 = 60000. */
+		{ 12, 80, 0, { .dot_us = 160000, .dash_us = 480000, .ims_us =  23637, .eoc_us = 276363, .eow_us = 400000 } },
+		/* Unit = 20 ms. */
+		{ 60, 50, 0, { .dot_us =  20000, .dash_us =  60000, .ims_us =  20000, .eoc_us =  40000, .eow_us =  80000 } },
+	};
+
+	for (size_t i = 0; i < sizeof (data) / sizeof (data[0]); i++) {
+		engine_native_timing_t timing = { 0 };
+		engine_native_timing(&timing, data[i].wpm, data[i].weighting, data[i].gap);
+		engine_native_timing_t const * e = &data[i].expected;
+		if (timing.dot_us != e->dot_us || timing.dash_us != e->dash_us || timing.ims_us != e->ims_us
+		    || timing.eoc_us != e->eoc_us || timing.eow_us != e->eow_us) {
+			test_log_err("Unexpected timing #%zu: dot %d, dash %d, ims %d, eoc %d, eow %d\n",
+			             i, timing.dot_us, timing.dash_us, timing.ims_us, timing.eoc_us, timing.eow_us);
+			return -1;
+		}
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Characters are converted into expected schedules
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_engine_native_character_elements(void)
+{
+	engine_native_timing_t timing = { 0 };
+	engine_native_timing(&timing, 12, 50, 0);
+	engine_native_element_t elements[ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX] = { 0 };
+
+	/* Lower-case letter is sent as upper-case letter: dot, ims, dash, ims, eoc. */
+	engine_native_element_t const expected_a[] = {
+		{ 100000, true }, { 100000, false }, { 300000, true }, { 100000, false }, { 200000, false }
+	};
+	size_t const n_lower = engine_native_character_elements(&timing, 'a', elements, ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX);
+	if (5 != n_lower) {
+		test_log_err("Unexpected count of elements of 'a': %zu\n", n_lower);
+		return -1;
+	}
+	for (size_t i = 0; i < n_lower; i++) {
+		if (elements[i].duration_us != expected_a[i].duration_us || elements[i].key != expected_a[i].key) {
+			test_log_err("Unexpected element #%zu of 'a': %d/%d\n", i, elements[i].duration_us, elements[i].key);
+			return -1;
+		}
+	}
+	size_t const n_upper = engine_native_character_elements(&timing, 'A', elements, ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX);
+	if (n_upper != n_lower) {
+		test_log_err("Unexpected count of elements of 'A': %zu\n", n_upper);
+		return -1;
+	}
+
+	/* Word space. */
+	size_t const n_space = engine_native_character_elements(&timing, ' ', elements, ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX);
+	if (1 != n_space || elements[0].key || elements[0].duration_us != timing.eow_us) {
+		test_log_err("Unexpected elements of space: %zu\n", n_space);
+		return -1;
+	}
+
+	/* Longest character fits exactly into the buffer, but not into smaller one. */
+	if (ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX != engine_native_character_elements(&timing, '$', elements, ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX)) {
+		test_log_err("Unexpected count of elements of '$' %s\n", "");
+		return -1;
+	}
+	if (0 != engine_native_character_elements(&timing, '$', elements, ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX - 1)) {
+		test_log_err("Elements of '$' have been written to too small buffer %s\n", "");
+		return -1;
+	}
+
+	/* Characters without Morse representation. */
+	char const invalid[] = { '#', '%', '\t', (char) 0xff };
+	for (size_t i = 0; i < sizeof (invalid); i++) {
+		if (0 != engine_native_character_elements(&timing, invalid[i], elements, ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX)) {
+			test_log_err("Invalid character 0x%02x has been converted\n", (unsigned char) invalid[i]);
+			return -1;
+		}
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Engine without sidetone refuses sound systems other than Null
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_engine_native_open_sound_system(void)
+{
+	if (engine_native.open(CW_AUDIO_ALSA)) {
+		test_log_err("Engine has accepted ALSA sound system %s\n", "");
+		engine_native.close();
+		return -1;
+	}
+	if (!engine_native.open(CW_AUDIO_NULL)) {
+		test_log_err("Engine has rejected Null sound system %s\n", "");
+		return -1;
+	}
+	engine_native.close();
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Keying edges of "ee" are reported in order and on time
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_engine_native_keying(void)
+{
+	g_edges.count = 0;
+	g_edges.tq_low_count = 0;
+
+	if (!engine_native.open(CW_AUDIO_NULL)) {
+		test_log_err("Failed to open engine %s\n", "");
+		return -1;
+	}
+	engine_native.register_keying_callback(keying_callback, NULL);
+	engine_native.register_tone_queue_low_callback(tq_low_callback, NULL, 1);
+	engine_native.set_send_speed(60); /* Unit = 20 ms. */
+	engine_native.set_weighting(50);
+	engine_native.set_gap(0);
+
+	int64_t const start_us = now_us();
+	engine_native.send_character('e');
+	engine_native.send_character('e');
+	engine_native.wait_for_tone_queue();
+	int64_t const end_us = now_us();
+	engine_native.close();
+	engine_native.register_keying_callback(NULL, NULL);
+	engine_native.register_tone_queue_low_callback(NULL, NULL, 0);
+
+	/* Each 'e': dot 20 ms, ims 20 ms, eoc 40 ms. */
+	int const expected_keystate[] = { 1, 0, 1, 0 };
+	int64_t const expected_offset_us[] = { 0, 20000, 80000, 100000 };
+	if (4 != g_edges.count) {
+		test_log_err("Unexpected count of keying edges: %zu\n", g_edges.count);
+		return -1;
+	}
+	for (size_t i = 0; i < g_edges.count; i++) {
+		int64_t const offset_us = g_edges.timestamp_us[i] - g_edges.timestamp_us[0];
+		if (g_edges.keystate[i] != expected_keystate[i]
+		    || llabs(offset_us - expected_offset_us[i]) > TEST_TOLERANCE_US) {
+			test_log_err("Unexpected keying edge #%zu: key %d at %lld us\n", i, g_edges.keystate[i], (long long) offset_us);
+			return -1;
+		}
+	}
+	if (end_us - start_us < 160000 - TEST_TOLERANCE_US) {
+		test_log_err("Waiting for tone queue has ended too early: %lld us\n", (long long) (end_us - start_us));
+		return -1;
+	}
+	/* Six elements in queue: the length drops to watermark only once. */
+	if (1 != g_edges.tq_low_count) {
+		test_log_err("Unexpected count of calls of 'tone queue low' callback: %u\n", g_edges.tq_low_count);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Flushing the queue interrupts a long tone and puts the key up
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_engine_native_flush(void)
+{
+	g_edges.count = 0;
+
+	if (!engine_native.open(CW_AUDIO_NULL)) {
+		test_log_err("Failed to open engine %s\n", "");
+		return -1;
+	}
+	engine_native.register_keying_callback(keying_callback, NULL);
+
+	int64_t const start_us = now_us();
+	engine_native.queue_tone(2000000, 800);
+	engine_native.queue_tone(2000000, 800);
+	struct timespec const delay = { .tv_sec = 0, .tv_nsec = 50000000 };
+	nanosleep(&delay, NULL);
+	engine_native.flush_tone_queue();
+	engine_native.wait_for_tone_queue();
+	int64_t const end_us = now_us();
+
+	int const len = engine_native.get_tone_queue_length();
+	engine_native.close();
+	engine_native.register_keying_callback(NULL, NULL);
+
+	if (end_us - start_us > 50000 + ENGINE_NATIVE_SLICE_US + TEST_TOLERANCE_US) {
+		test_log_err("Flush of queue has taken too long: %lld us\n", (long long) (end_us - start_us));
+		return -1;
+	}
+	if (0 != len || 2 != g_edges.count || 1 != g_edges.keystate[0] || 0 != g_edges.keystate[1]) {
+		test_log_err("Unexpected state after flush: queue length %d, %zu keying edges\n", len, g_edges.count);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Two instances of the engine key at the same time with their own speeds
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_engine_native_instances(void)
+{
+	engine_t const * const first = engine_native_instance(0);
+	engine_t const * const second = engine_native_instance(1);
+	if (first != &engine_native || NULL == second || second == first
+	    || NULL != engine_native_instance(ENGINE_NATIVE_INSTANCES_MAX)) {
+		test_log_err("Unexpected instances of engine %s\n", "");
+		return -1;
+	}
+	if (second->open(CW_AUDIO_SOUNDCARD)) {
+		test_log_err("Second instance has opened its own sidetone %s\n", "");
+		second->close();
+		return -1;
+	}
+
+	instance_edges_t edges[2] = { 0 };
+	engine_t const * const instances[2] = { first, second };
+	int const wpm[2] = { 60, 30 }; /* Unit = 20 ms and 40 ms. */
+	for (size_t i = 0; i < 2; i++) {
+		if (!instances[i]->open(CW_AUDIO_NULL)) {
+			test_log_err("Failed to open instance %zu of engine\n", i);
+			return -1;
+		}
+		instances[i]->register_keying_callback(instance_keying_callback, &edges[i]);
+		instances[i]->set_send_speed(wpm[i]);
+		instances[i]->set_weighting(50);
+		instances[i]->set_gap(0);
+	}
+
+	/* Sidetone is not open, but ownership may be switched anyway. */
+	engine_native_set_sidetone_owner(1);
+	first->send_character('e');
+	second->send_character('t');
+	engine_native_set_sidetone_owner(0);
+	first->wait_for_tone_queue();
+	second->wait_for_tone_queue();
+
+	for (size_t i = 0; i < 2; i++) {
+		instances[i]->close();
+		instances[i]->register_keying_callback(NULL, NULL);
+	}
+
+	/* 'e' of first instance: dot 20 ms. 't' of second instance: dash 120 ms. */
+	int64_t const expected_mark_us[2] = { 20000, 120000 };
+	for (size_t i = 0; i < 2; i++) {
+		if (2 != edges[i].count || 1 != edges[i].keystate[0] || 0 != edges[i].keystate[1]) {
+			test_log_err("Unexpected keying edges of instance %zu: %zu edges\n", i, edges[i].count);
+			return -1;
+		}
+		int64_t const mark_us = edges[i].timestamp_us[1] - edges[i].timestamp_us[0];
+		if (llabs(mark_us - expected_mark_us[i]) > TEST_TOLERANCE_US) {
+			test_log_err("Unexpected length of mark of instance %zu: %lld us\n", i, (long long) mark_us);
+			return -1;
+		}
+	}
+	/* The second instance doesn't wait for the first one. */
+	if (llabs(edges[1].timestamp_us[0] - edges[0].timestamp_us[0]) > TEST_TOLERANCE_US) {
+		test_log_err("Instances haven't started keying at the same time: %lld us apart\n",
+		             (long long) (edges[1].timestamp_us[0] - edges[0].timestamp_us[0]));
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+static void keying_callback(__attribute__((unused)) void * arg, int keystate)
+{
+	if (g_edges.count < TEST_EDGES_MAX) {
+		g_edges.timestamp_us[g_edges.count] = now_us();
+		g_edges.keystate[g_edges.count] = keystate;
+		g_edges.count++;
+	}
+}
+
+
+
+
+static void instance_keying_callback(void * arg, int keystate)
+{
+	instance_edges_t * const edges = (instance_edges_t *) arg;
+	if (edges->count < TEST_EDGES_MAX) {
+		edges->timestamp_us[edges->count] = now_us();
+		edges->keystate[edges->count] = keystate;
+		edges->count++;
+	}
+}
+
+
+
+
+static void tq_low_callback(__attribute__((unused)) void * arg)
+{
+	g_edges.tq_low_count++;
+}
+
+
+
+
+static int64_t now_us(void)
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
@@ -0,0 +1,422 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for cwdaemon/src/handoff.c.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "src/cwdaemon.h"
+#include "src/handoff.h"
+#include "src/input.h"
+#include "src/notify.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+static int test_handoff_none(void);
+static int test_handoff_take_over(void);
+static int test_handoff_given_up(void);
+static int test_handoff_unix_socket(void);
+static int test_handoff_signal_with_input(void);
+
+static int start_handoff(int * old_end, int * udp_fd, in_port_t * port, int unix_fd);
+static bool read_message(int fd, char const * message);
+static int fake_footswitch(cwdevice * dev);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_handoff_none,
+	test_handoff_take_over,
+	test_handoff_given_up,
+	test_handoff_unix_socket,
+	test_handoff_signal_with_input,
+	NULL
+};
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+
+	int rv = 0;
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			rv = -1;
+			break;
+		}
+		i++;
+	}
+
+	if (0 == rv) {
+		test_log_info("Test result: PASS %s\n", "");
+	}
+	return rv;
+}
+
+
+
+
+/// @brief Process not started on hand-over doesn't receive a socket
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_handoff_none(void)
+{
+	cwdaemon_t cwdaemon = { .socket_descriptor = -1, .unix_socket_descriptor = -1, .network_port = CWDAEMON_NETWORK_PORT_DEFAULT };
+
+	unsetenv(HANDOFF_ENV_FD);
+	if (0 != handoff_receive(&cwdaemon) || -1 != cwdaemon.socket_descriptor) {
+		test_log_err("Unexpected socket received without hand-over %s\n", "");
+		return -1;
+	}
+	if (0 != handoff_complete()) {
+		test_log_err("Unexpected failure of completion without hand-over %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief New process receives the socket, notifies readiness, and takes over after GO and exit of old process
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_handoff_take_over(void)
+{
+	cwdaemon_t cwdaemon = { .socket_descriptor = -1, .unix_socket_descriptor = -1, .network_port = CWDAEMON_NETWORK_PORT_DEFAULT };
+	int old_end = -1;
+	int udp_fd = -1;
+	in_port_t port = 0;
+	if (0 != start_handoff(&old_end, &udp_fd, &port, -1)) {
+		return -1;
+	}
+
+	int const received = handoff_receive(&cwdaemon);
+	if (1 != received || -1 == cwdaemon.socket_descriptor || port != cwdaemon.network_port) {
+		test_log_err("Socket has not been received: rv = %d, port = %u, expected %u\n",
+		             received, (unsigned int) cwdaemon.network_port, (unsigned int) port);
+		close(old_end);
+		close(udp_fd);
+		return -1;
+	}
+	if (NULL != getenv(HANDOFF_ENV_FD)) {
+		test_log_err("Hand-over variable has not been removed from environment %s\n", "");
+		return -1;
+	}
+
+	/* Old process lets the new one take over, and exits: its end of
+	   the pair is not writable anymore, but READY message from new
+	   process can be still read from it. */
+	send(old_end, HANDOFF_GO_MESSAGE, strlen(HANDOFF_GO_MESSAGE), 0);
+	shutdown(old_end, SHUT_WR);
+	int const completed = handoff_complete();
+	bool const ready = read_message(old_end, NOTIFY_READY_MESSAGE);
+	close(old_end);
+	close(cwdaemon.socket_descriptor);
+	close(udp_fd);
+
+	if (0 != completed) {
+		test_log_err("New process hasn't taken over %s\n", "");
+		return -1;
+	}
+	if (!ready) {
+		test_log_err("New process hasn't notified readiness %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief New process doesn't take over if old one exits without GO
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_handoff_given_up(void)
+{
+	cwdaemon_t cwdaemon = { .socket_descriptor = -1, .unix_socket_descriptor = -1, .network_port = CWDAEMON_NETWORK_PORT_DEFAULT };
+	int old_end = -1;
+	int udp_fd = -1;
+	in_port_t port = 0;
+	if (0 != start_handoff(&old_end, &udp_fd, &port, -1)) {
+		return -1;
+	}
+
+	int const received = handoff_receive(&cwdaemon);
+	close(old_end);
+	int const completed = handoff_complete();
+	close(cwdaemon.socket_descriptor);
+	close(udp_fd);
+
+	if (1 != received || -1 != completed) {
+		test_log_err("Unexpected result of given up hand-over: received = %d, completed = %d\n", received, completed);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Unix-domain socket is passed together with UDP socket, without losing waiting requests
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_handoff_unix_socket(void)
+{
+	char path[64] = { 0 };
+	snprintf(path, sizeof (path), "/tmp/cwdaemon_test_handoff_%ld.sock", (long) getpid());
+	unlink(path);
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof (addr.sun_path), "%s", path);
+	int const unix_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (-1 == unix_fd || 0 != bind(unix_fd, (struct sockaddr *) &addr, sizeof (addr))) {
+		test_log_err("Failed to bind Unix-domain socket %s\n", "");
+		return -1;
+	}
+
+	/* Request sent to old process, not read by it before hand-over. */
+	int const client_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	char const request[] = "unix request";
+	if (-1 == client_fd || (ssize_t) sizeof (request) != sendto(client_fd, request, sizeof (request), 0, (struct sockaddr *) &addr, sizeof (addr))) {
+		test_log_err("Failed to send request to Unix-domain socket %s\n", "");
+		return -1;
+	}
+	close(client_fd);
+
+	cwdaemon_t cwdaemon = { .socket_descriptor = -1, .unix_socket_descriptor = -1, .network_port = CWDAEMON_NETWORK_PORT_DEFAULT, .unix_socket_path = path };
+	int old_end = -1;
+	int udp_fd = -1;
+	in_port_t port = 0;
+	if (0 != start_handoff(&old_end, &udp_fd, &port, unix_fd)) {
+		return -1;
+	}
+	/* Old process exits. */
+	close(unix_fd);
+	close(udp_fd);
+
+	int const received = handoff_receive(&cwdaemon);
+	close(old_end);
+	handoff_complete();
+
+	char buf[32] = { 0 };
+	ssize_t const n = -1 == cwdaemon.unix_socket_descriptor ? -1 : recv(cwdaemon.unix_socket_descriptor, buf, sizeof (buf), MSG_DONTWAIT);
+	if (-1 != cwdaemon.socket_descriptor) {
+		close(cwdaemon.socket_descriptor);
+	}
+	if (-1 != cwdaemon.unix_socket_descriptor) {
+		close(cwdaemon.unix_socket_descriptor);
+	}
+	unlink(path);
+
+	if (1 != received || port != cwdaemon.network_port) {
+		test_log_err("Sockets have not been received: rv = %d\n", received);
+		return -1;
+	}
+	if ((ssize_t) sizeof (request) != n || 0 != strcmp(buf, request)) {
+		test_log_err("Request waiting in Unix-domain socket has been lost: %zd bytes\n", n);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Hand-over signal is not taken over by input thread
+///
+/// Input thread installs handler of its own wake-up signal after
+/// handoff_listen() has installed handler of HANDOFF_SIGNAL.
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_handoff_signal_with_input(void)
+{
+	if (0 != handoff_listen("/bin/sh")) {
+		test_log_err("Failed to listen for hand-over signal %s\n", "");
+		return -1;
+	}
+	cwdevice dev = { .footswitch = fake_footswitch, .desc = "parport0" };
+	if (0 != input_start(&dev) || !input_is_running()) {
+		test_log_err("Failed to start input thread %s\n", "");
+		return -1;
+	}
+
+	int rv = 0;
+	raise(HANDOFF_SIGNAL);
+	if (!handoff_requested()) {
+		test_log_err("Hand-over signal has not been received while input thread is running %s\n", "");
+		rv = -1;
+	}
+	/* Input thread is still woken up by its own signal. */
+	input_stop();
+	if (input_is_running()) {
+		test_log_err("Input thread has not been stopped %s\n", "");
+		rv = -1;
+	}
+
+	/* Signal received after stop is received too. */
+	if (0 == rv) {
+		raise(HANDOFF_SIGNAL);
+		if (!handoff_requested()) {
+			test_log_err("Hand-over signal has not been received after input thread has stopped %s\n", "");
+			rv = -1;
+		}
+	}
+
+	if (0 == rv) {
+		test_log_info("Test result: PASS %s\n", "");
+	}
+	return rv;
+}
+
+
+
+
+/// @brief Do the first step of hand-over in old process
+///
+/// Bind UDP socket, pass it (and optional Unix-domain socket) through
+/// socket pair, and put the new process's end of the pair in environment.
+///
+/// @param[out] old_end old process's end of socket pair
+/// @param[out] udp_fd old process's copy of UDP socket
+/// @param[out] port port of UDP socket
+/// @param[in] unix_fd Unix-domain socket to be passed, or -1
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int start_handoff(int * old_end, int * udp_fd, in_port_t * port, int unix_fd)
+{
+	int pair[2] = { -1, -1 };
+	if (0 != socketpair(AF_UNIX, SOCK_STREAM, 0, pair)) {
+		test_log_err("Failed to create socket pair %s\n", "");
+		return -1;
+	}
+
+	int const fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = 0, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t addr_len = sizeof (addr);
+	if (-1 == fd || 0 != bind(fd, (struct sockaddr *) &addr, addr_len)
+	    || 0 != getsockname(fd, (struct sockaddr *) &addr, &addr_len)) {
+		test_log_err("Failed to bind UDP socket %s\n", "");
+		return -1;
+	}
+
+	int const fds[2] = { fd, unix_fd };
+	size_t const fds_count = -1 == unix_fd ? 1 : 2;
+	char byte = 'S';
+	struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+	union {
+		struct cmsghdr header;
+		char buf[CMSG_SPACE(sizeof (fds))];
+	} control;
+	memset(&control, 0, sizeof (control));
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = CMSG_SPACE(fds_count * sizeof (int)) };
+	struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(fds_count * sizeof (int));
+	memcpy(CMSG_DATA(cmsg), fds, fds_count * sizeof (int));
+	if (1 != sendmsg(pair[0], &msg, 0)) {
+		test_log_err("Failed to pass UDP socket %s\n", "");
+		return -1;
+	}
+
+	char value[16] = { 0 };
+	snprintf(value, sizeof (value), "%d", pair[1]);
+	setenv(HANDOFF_ENV_FD, value, 1);
+
+	*old_end = pair[0];
+	*udp_fd = fd;
+	*port = ntohs(addr.sin_port);
+	return 0;
+}
+
+
+
+
+static bool read_message(int fd, char const * message)
+{
+	char buf[32] = { 0 };
+	ssize_t const n = recv(fd, buf, sizeof (buf) - 1, MSG_DONTWAIT);
+	return n > 0 && NULL != strstr(buf, message);
+}
+
+
+
+
+static int fake_footswitch(__attribute__((unused)) cwdevice * dev)
+{
+	return 1;
+}
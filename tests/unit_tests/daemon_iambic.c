@@ -0,0 +1,299 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for cwdaemon/src/iambic.c.
+
+
+
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "src/iambic.h"
+#include "tests/library/log.h"
+
+
+
+
+#define DOT   IAMBIC_ELEMENT_DOT
+#define DASH  IAMBIC_ELEMENT_DASH
+#define NONE  IAMBIC_ELEMENT_NONE
+#define BOTH  (IAMBIC_PADDLE_DOT | IAMBIC_PADDLE_DASH)
+
+
+
+
+static int test_iambic_single_paddle(void);
+static int test_iambic_squeeze(void);
+static int test_iambic_squeeze_release(void);
+static int test_iambic_memory(void);
+static int test_iambic_helpers(void);
+
+static int expect_elements(iambic_t * keyer, iambic_element_t const * expected, size_t count, char const * label);
+
+/// Check that keyer returns given elements (and nothing more).
+#define EXPECT_ELEMENTS(keyer, label, ...)                              \
+	expect_elements((keyer), (iambic_element_t const[]) { __VA_ARGS__ }, \
+	                sizeof ((iambic_element_t const[]) { __VA_ARGS__ }) / sizeof (iambic_element_t), (label))
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_iambic_single_paddle,
+	test_iambic_squeeze,
+	test_iambic_squeeze_release,
+	test_iambic_memory,
+	test_iambic_helpers,
+	NULL
+};
+
+
+
+
+int main(void)
+{
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			return -1;
+		}
+		i++;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// Get @p count elements from keyer and compare them with @p expected.
+static int expect_elements(iambic_t * keyer, iambic_element_t const * expected, size_t count, char const * label)
+{
+	for (size_t i = 0; i < count; i++) {
+		iambic_element_t const element = iambic_next(keyer);
+		if (element != expected[i]) {
+			test_log_err("Test: %s: element #%zu is %d, expected %d\n", label, i, element, expected[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+
+
+/// Holding a single paddle repeats its element, releasing the paddle stops
+/// the keyer after current element.
+static int test_iambic_single_paddle(void)
+{
+	iambic_mode_t const modes[] = { IAMBIC_MODE_A, IAMBIC_MODE_B };
+	for (size_t m = 0; m < sizeof (modes) / sizeof (modes[0]); m++) {
+		iambic_t keyer;
+		iambic_init(&keyer, modes[m]);
+		if (NONE != iambic_next(&keyer)) {
+			test_log_err("Test: idle keyer with released paddles returns element in mode %d\n", modes[m]);
+			return -1;
+		}
+
+		iambic_paddles(&keyer, IAMBIC_PADDLE_DOT);
+		if (0 != EXPECT_ELEMENTS(&keyer, "dot paddle held", DOT, DOT, DOT, DOT)) {
+			return -1;
+		}
+		iambic_paddles(&keyer, 0);
+		if (0 != EXPECT_ELEMENTS(&keyer, "dot paddle released", NONE)) {
+			return -1;
+		}
+
+		iambic_paddles(&keyer, IAMBIC_PADDLE_DASH);
+		if (0 != EXPECT_ELEMENTS(&keyer, "dash paddle held", DASH, DASH, DASH)) {
+			return -1;
+		}
+		iambic_paddles(&keyer, 0);
+		if (0 != EXPECT_ELEMENTS(&keyer, "dash paddle released", NONE)) {
+			return -1;
+		}
+	}
+
+	test_log_info("Test: single paddle %s\n", "OK");
+	return 0;
+}
+
+
+
+
+/// Squeeze sends alternating elements, starting with dot.
+static int test_iambic_squeeze(void)
+{
+	iambic_mode_t const modes[] = { IAMBIC_MODE_A, IAMBIC_MODE_B };
+	for (size_t m = 0; m < sizeof (modes) / sizeof (modes[0]); m++) {
+		iambic_t keyer;
+		iambic_init(&keyer, modes[m]);
+		iambic_paddles(&keyer, BOTH);
+		if (0 != EXPECT_ELEMENTS(&keyer, "squeeze", DOT, DASH, DOT, DASH, DOT, DASH, DOT)) {
+			return -1;
+		}
+	}
+
+	test_log_info("Test: squeeze %s\n", "OK");
+	return 0;
+}
+
+
+
+
+/// Release of squeeze during an element: mode A stops after the element,
+/// mode B sends one more, opposite element.
+static int test_iambic_squeeze_release(void)
+{
+	iambic_t keyer;
+
+	iambic_init(&keyer, IAMBIC_MODE_A);
+	iambic_paddles(&keyer, BOTH);
+	if (0 != EXPECT_ELEMENTS(&keyer, "mode A, squeeze", DOT, DASH)) {
+		return -1;
+	}
+	iambic_paddles(&keyer, 0); // Released during dash.
+	if (0 != EXPECT_ELEMENTS(&keyer, "mode A, squeeze released", NONE)) {
+		return -1;
+	}
+
+	iambic_init(&keyer, IAMBIC_MODE_B);
+	iambic_paddles(&keyer, BOTH);
+	if (0 != EXPECT_ELEMENTS(&keyer, "mode B, squeeze", DOT, DASH)) {
+		return -1;
+	}
+	iambic_paddles(&keyer, 0); // Released during dash.
+	if (0 != EXPECT_ELEMENTS(&keyer, "mode B, squeeze released", DOT, NONE)) {
+		return -1;
+	}
+
+	// Mode B: squeeze made during an element, released before end of the element.
+	iambic_init(&keyer, IAMBIC_MODE_B);
+	iambic_paddles(&keyer, IAMBIC_PADDLE_DASH);
+	if (0 != EXPECT_ELEMENTS(&keyer, "mode B, dash", DASH)) {
+		return -1;
+	}
+	iambic_paddles(&keyer, BOTH);
+	iambic_paddles(&keyer, 0);
+	if (0 != EXPECT_ELEMENTS(&keyer, "mode B, short squeeze", DOT, NONE)) {
+		return -1;
+	}
+
+	test_log_info("Test: release of squeeze %s\n", "OK");
+	return 0;
+}
+
+
+
+
+/// A short tap of opposite paddle during an element is remembered.
+static int test_iambic_memory(void)
+{
+	iambic_t keyer;
+
+	// Dot memory: tap of dot paddle during a dash.
+	iambic_init(&keyer, IAMBIC_MODE_A);
+	iambic_paddles(&keyer, IAMBIC_PADDLE_DASH);
+	if (0 != EXPECT_ELEMENTS(&keyer, "dash", DASH)) {
+		return -1;
+	}
+	iambic_paddles(&keyer, BOTH);
+	iambic_paddles(&keyer, IAMBIC_PADDLE_DASH);
+	if (0 != EXPECT_ELEMENTS(&keyer, "dot memory, dash held", DOT, DASH, DASH)) {
+		return -1;
+	}
+	iambic_paddles(&keyer, 0);
+	if (0 != EXPECT_ELEMENTS(&keyer, "dot memory, dash released", NONE)) {
+		return -1;
+	}
+
+	// Dash memory: tap of dash paddle during a dot, with dot paddle released.
+	iambic_init(&keyer, IAMBIC_MODE_A);
+	iambic_paddles(&keyer, IAMBIC_PADDLE_DOT);
+	if (0 != EXPECT_ELEMENTS(&keyer, "dot", DOT)) {
+		return -1;
+	}
+	iambic_paddles(&keyer, 0);
+	iambic_paddles(&keyer, IAMBIC_PADDLE_DASH);
+	iambic_paddles(&keyer, 0);
+	if (0 != EXPECT_ELEMENTS(&keyer, "dash memory", DASH, NONE)) {
+		return -1;
+	}
+
+	test_log_info("Test: element memory %s\n", "OK");
+	return 0;
+}
+
+
+
+
+static int test_iambic_helpers(void)
+{
+	if (60000 != iambic_element_duration_us(DOT, 20)
+	    || 180000 != iambic_element_duration_us(DASH, 20)
+	    || 0 != iambic_element_duration_us(NONE, 20)) {
+		test_log_err("Test: unexpected durations of elements at 20 WPM: %d/%d\n",
+		             (int) iambic_element_duration_us(DOT, 20), (int) iambic_element_duration_us(DASH, 20));
+		return -1;
+	}
+
+	if (iambic_straight_key(0) || !iambic_straight_key(IAMBIC_PADDLE_DOT) || !iambic_straight_key(IAMBIC_PADDLE_DASH)) {
+		test_log_err("Test: unexpected state of straight key %s\n", "");
+		return -1;
+	}
+
+	struct {
+		char const * name;
+		bool valid;
+		iambic_mode_t mode;
+	} const names[] = {
+		{ "iambic-a", true,  IAMBIC_MODE_A        },
+		{ "iambic-b", true,  IAMBIC_MODE_B        },
+		{ "straight", true,  IAMBIC_MODE_STRAIGHT },
+		{ "none",     true,  IAMBIC_MODE_NONE     },
+		{ "iambic",   false, IAMBIC_MODE_NONE     },
+		{ "",         false, IAMBIC_MODE_NONE     },
+	};
+	for (size_t i = 0; i < sizeof (names) / sizeof (names[0]); i++) {
+		iambic_mode_t mode = IAMBIC_MODE_NONE;
+		if (names[i].valid != iambic_mode_from_name(names[i].name, &mode)
+		    || (names[i].valid && names[i].mode != mode)) {
+			test_log_err("Test: unexpected result for name of mode [%s]\n", names[i].name);
+			return -1;
+		}
+	}
+
+	test_log_info("Test: helpers %s\n", "OK");
+	return 0;
+}
+
@@ -0,0 +1,278 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for cwdaemon/src/input.c.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/select.h>
+#include <time.h>
+
+#include "src/cwdaemon.h"
+#include "src/input.h"
+#include "src/sleep.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+/// Max time from change of line to delivery of the change [us]. The
+/// requirement is 1 ms, the rest is a margin for loaded test machine.
+#define TEST_DELIVERY_MAX_US 5000
+
+
+
+
+static int test_input_no_lines(void);
+static int test_input_polling(void);
+static int test_input_waiting(void);
+
+static int run_test(cwdevice * dev);
+static bool wait_for_state(int * state, int timeout_ms);
+static int fake_footswitch(cwdevice * dev);
+static int fake_wait_input(cwdevice * dev);
+static int64_t now_us(void);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_input_no_lines,
+	test_input_polling,
+	test_input_waiting,
+	NULL
+};
+
+
+
+
+/// State of emulated footswitch line.
+static int g_line = 1;
+static sem_t g_line_changed;
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+	sem_init(&g_line_changed, 0, 0);
+
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			input_stop();
+			return -1;
+		}
+		i++;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief No thread is started for device without input lines
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_input_no_lines(void)
+{
+	cwdevice dev = { .desc = "null" };
+	if (0 != input_start(&dev) || input_is_running() || -1 != input_get_fd()) {
+		test_log_err("Input thread has been started for device without input lines %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Lines of device without cwdevice::wait_input() are polled
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_input_polling(void)
+{
+	cwdevice dev = { .footswitch = fake_footswitch, .desc = "parport0" };
+	return run_test(&dev);
+}
+
+
+
+
+/// @brief Device with cwdevice::wait_input() is woken up by changes, and by input_stop()
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_input_waiting(void)
+{
+	cwdevice dev = { .footswitch = fake_footswitch, .wait_input = fake_wait_input, .desc = "ttyS0" };
+	return run_test(&dev);
+}
+
+
+
+
+static int run_test(cwdevice * dev)
+{
+	__atomic_store_n(&g_line, 1, __ATOMIC_RELEASE);
+	if (0 != input_start(dev) || !input_is_running()) {
+		test_log_err("Failed to start input thread %s\n", "");
+		return -1;
+	}
+
+	/* Initial state is delivered at start. */
+	int state = -1;
+	if (!wait_for_state(&state, 100) || 1 != state) {
+		test_log_err("Initial state has not been delivered: %d\n", state);
+		return -1;
+	}
+	millisleep_nonintr(2 * INPUT_DEBOUNCE_MS);
+
+	/* Press: delivered at once. */
+	int64_t const pressed = now_us();
+	__atomic_store_n(&g_line, 0, __ATOMIC_RELEASE);
+	sem_post(&g_line_changed);
+	if (!wait_for_state(&state, 100) || 0 != state) {
+		test_log_err("Press has not been delivered: %d\n", state);
+		return -1;
+	}
+	int64_t const delivery_us = now_us() - pressed;
+	if (delivery_us > TEST_DELIVERY_MAX_US) {
+		test_log_err("Press has been delivered too late: %lld us\n", (long long) delivery_us);
+		return -1;
+	}
+
+	/* Bouncing contacts: changes during debounce time are ignored, and
+	   the final state is delivered after debounce time. */
+	__atomic_store_n(&g_line, 1, __ATOMIC_RELEASE);
+	sem_post(&g_line_changed);
+	__atomic_store_n(&g_line, 0, __ATOMIC_RELEASE);
+	sem_post(&g_line_changed);
+	if (wait_for_state(&state, 3 * INPUT_DEBOUNCE_MS)) {
+		test_log_err("Bounce has been delivered: %d\n", state);
+		return -1;
+	}
+
+	/* Release. */
+	__atomic_store_n(&g_line, 1, __ATOMIC_RELEASE);
+	sem_post(&g_line_changed);
+	if (!wait_for_state(&state, 100) || 1 != state) {
+		test_log_err("Release has not been delivered: %d\n", state);
+		return -1;
+	}
+
+	input_stop();
+	if (input_is_running() || -1 != input_get_fd()) {
+		test_log_err("Input thread has not been stopped %s\n", "");
+		return -1;
+	}
+	test_log_info("Test result: PASS (delivery of press: %lld us)\n", (long long) delivery_us);
+	return 0;
+}
+
+
+
+
+/// @brief Wait for next state delivered by input thread
+///
+/// @return true if a state has been delivered before timeout
+/// @return false otherwise
+static bool wait_for_state(int * state, int timeout_ms)
+{
+	int const fd = input_get_fd();
+	fd_set readfd;
+	FD_ZERO(&readfd);
+	FD_SET(fd, &readfd);
+	struct timeval timeout = { .tv_sec = 0, .tv_usec = timeout_ms * 1000 };
+	if (select(fd + 1, &readfd, NULL, NULL, &timeout) <= 0) {
+		return false;
+	}
+	return input_read(state);
+}
+
+
+
+
+static int fake_footswitch(__attribute__((unused)) cwdevice * dev)
+{
+	return __atomic_load_n(&g_line, __ATOMIC_ACQUIRE);
+}
+
+
+
+
+/// @brief Wait for a change of emulated line, like TIOCMIWAIT
+static int fake_wait_input(__attribute__((unused)) cwdevice * dev)
+{
+	/* Don't use changes that have been made during debounce time. */
+	while (0 == sem_trywait(&g_line_changed)) {
+		;
+	}
+	return sem_wait(&g_line_changed);
+}
+
+
+
+
+static int64_t now_us(void)
+{
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
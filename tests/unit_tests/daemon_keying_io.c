@@ -0,0 +1,531 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for cwdaemon/src/keying_io.c.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "src/cwdaemon.h"
+#include "src/keying_io.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+#define TEST_OPS_MAX     1024
+#define TEST_SLOW_IO_NS  1000000 /* Time of I/O of emulated USB-serial adapter. */
+
+
+
+
+static int test_keying_io_sync_fallback(void);
+static int test_keying_io_slow_device(void);
+static int test_keying_io_order(void);
+static int test_keying_io_other_pins(void);
+static int test_keying_io_channels(void);
+static int test_keying_io_stop_race(void);
+
+static int fake_cw(cwdevice * dev, int onoff);
+static int fake_ptt(cwdevice * dev, int onoff);
+static int fake_ssbway(cwdevice * dev, int onoff);
+static int fake_switchband(cwdevice * dev, unsigned char bandswitch);
+static int fake_reset_pins_state(cwdevice * dev);
+static int fake_cw_fast(cwdevice * dev, int onoff);
+static void fake_record(int pin, int onoff);
+static void * poster_fn(void * arg);
+static void * fast_poster_fn(void * arg);
+static int64_t now_ns(void);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_keying_io_sync_fallback,
+	test_keying_io_slow_device,
+	test_keying_io_order,
+	test_keying_io_other_pins,
+	test_keying_io_channels,
+	test_keying_io_stop_race,
+	NULL
+};
+
+
+
+
+/// Operations recorded by fake cwdevice. Written only by thread doing I/O.
+static struct {
+	int pin[TEST_OPS_MAX];
+	int onoff[TEST_OPS_MAX];
+	size_t count;
+	bool slow;
+} g_ops;
+
+/// Count of operations on cwdevice of second channel.
+static size_t g_fast_ops_count;
+
+/// Keying I/O instance of main channel.
+static keying_io_t * g_io;
+
+static cwdevice g_fake_device = {
+	.cw = fake_cw,
+	.ptt = fake_ptt,
+	.ssbway = fake_ssbway,
+	.switchband = fake_switchband,
+	.reset_pins_state = fake_reset_pins_state,
+};
+
+/// cwdevice of second channel.
+static cwdevice g_fast_device = {
+	.cw = fake_cw_fast,
+};
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+	g_io = keying_io_instance(0);
+
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			keying_io_stop_all();
+			return -1;
+		}
+		i++;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Without I/O thread commands are executed by caller
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_keying_io_sync_fallback(void)
+{
+	g_ops.count = 0;
+	g_ops.slow = false;
+
+	keying_io_post(g_io, &g_fake_device, KEYING_IO_PIN_PTT, ON);
+	if (1 != g_ops.count || KEYING_IO_PIN_PTT != g_ops.pin[0] || ON != g_ops.onoff[0]) {
+		test_log_err("Command hasn't been executed synchronously: %zu operations\n", g_ops.count);
+		return -1;
+	}
+	keying_io_post(g_io, &g_fake_device, KEYING_IO_PIN_PTT, OFF);
+	keying_io_sync(g_io); // No-op without I/O thread.
+
+	keying_io_stats_t stats = { 0 };
+	keying_io_get_stats(g_io, &stats);
+	if (2 != stats.count) {
+		test_log_err("Unexpected count of operations in stats: %llu\n", (unsigned long long) stats.count);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Posting doesn't wait for slow I/O, latency of I/O is measured
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_keying_io_slow_device(void)
+{
+	g_ops.count = 0;
+	g_ops.slow = true;
+	if (0 != keying_io_start(g_io)) {
+		test_log_err("Failed to start I/O thread %s\n", "");
+		return -1;
+	}
+
+	keying_io_stats_t before = { 0 };
+	keying_io_get_stats(g_io, &before);
+
+	size_t const n = 50;
+	int64_t const start_ns = now_ns();
+	for (size_t i = 0; i < n; i++) {
+		keying_io_post(g_io, &g_fake_device, KEYING_IO_PIN_CW, (int) (i % 2));
+	}
+	int64_t const post_ns = now_ns() - start_ns;
+	keying_io_sync(g_io);
+	int64_t const sync_ns = now_ns() - start_ns;
+
+	keying_io_stats_t after = { 0 };
+	keying_io_get_stats(g_io, &after);
+	keying_io_stop(g_io);
+
+	/* Posting must take much less than performing the I/O. */
+	if (post_ns > (int64_t) n * TEST_SLOW_IO_NS / 2) {
+		test_log_err("Posting of commands has taken too long: %lld ns\n", (long long) post_ns);
+		return -1;
+	}
+	if (n != g_ops.count || sync_ns < (int64_t) n * TEST_SLOW_IO_NS) {
+		test_log_err("Sync has ended before all commands have been executed: %zu operations after %lld ns\n", g_ops.count, (long long) sync_ns);
+		return -1;
+	}
+	if (n != after.count - before.count || after.io_ns_max < TEST_SLOW_IO_NS || after.delay_ns_max < TEST_SLOW_IO_NS) {
+		test_log_err("Unexpected stats: %llu operations, max I/O %llu ns, max delay %llu ns\n",
+		             (unsigned long long) (after.count - before.count),
+		             (unsigned long long) after.io_ns_max, (unsigned long long) after.delay_ns_max);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Commands from two threads are executed in order of posting of each thread
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_keying_io_order(void)
+{
+	g_ops.count = 0;
+	g_ops.slow = false;
+	if (0 != keying_io_start(g_io)) {
+		test_log_err("Failed to start I/O thread %s\n", "");
+		return -1;
+	}
+
+	/* The other thread posts CW commands, this thread posts PTT
+	   commands. Together they post more commands than there are slots
+	   in the queue. */
+	size_t const n = KEYING_IO_QUEUE_SIZE;
+	pthread_t thread;
+	pthread_create(&thread, NULL, poster_fn, (void *) &n);
+	for (size_t i = 0; i < n; i++) {
+		keying_io_post(g_io, &g_fake_device, KEYING_IO_PIN_PTT, (int) (i % 2));
+	}
+	pthread_join(thread, NULL);
+	keying_io_stop(g_io); // Executes remaining commands.
+
+	if (2 * n != g_ops.count) {
+		test_log_err("Unexpected count of operations: %zu\n", g_ops.count);
+		return -1;
+	}
+	size_t next[2] = { 0, 0 };
+	for (size_t i = 0; i < g_ops.count; i++) {
+		int const pin = g_ops.pin[i];
+		if (g_ops.onoff[i] != (int) (next[pin] % 2)) {
+			test_log_err("Operation #%zu on pin %d is out of order\n", i, pin);
+			return -1;
+		}
+		next[pin]++;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief SSB way, band switch and reset of pins are executed by I/O thread, in order with keying
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_keying_io_other_pins(void)
+{
+	g_ops.count = 0;
+	g_ops.slow = true;
+	if (0 != keying_io_start(g_io)) {
+		test_log_err("Failed to start I/O thread %s\n", "");
+		return -1;
+	}
+
+	keying_io_post(g_io, &g_fake_device, KEYING_IO_PIN_CW, ON);
+	keying_io_post(g_io, &g_fake_device, KEYING_IO_PIN_SSBWAY, ON);
+	keying_io_post(g_io, &g_fake_device, KEYING_IO_PIN_BAND, 0x21);
+	keying_io_post(g_io, &g_fake_device, KEYING_IO_PINS_RESET, 0);
+	/* Slow I/O: the commands can't have been executed yet. */
+	size_t const count_before_sync = __atomic_load_n(&g_ops.count, __ATOMIC_ACQUIRE);
+	keying_io_sync(g_io);
+	keying_io_stop(g_io);
+
+	int const expected_pin[] = { KEYING_IO_PIN_CW, KEYING_IO_PIN_SSBWAY, KEYING_IO_PIN_BAND, KEYING_IO_PINS_RESET };
+	int const expected_onoff[] = { ON, ON, 0x21, 0 };
+	size_t const n = sizeof (expected_pin) / sizeof (expected_pin[0]);
+	if (count_before_sync >= n || n != g_ops.count) {
+		test_log_err("Unexpected count of operations: %zu before sync, %zu after sync\n", count_before_sync, g_ops.count);
+		return -1;
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (expected_pin[i] != g_ops.pin[i] || expected_onoff[i] != g_ops.onoff[i]) {
+			test_log_err("Unexpected operation #%zu: pin %d, state %d\n", i, g_ops.pin[i], g_ops.onoff[i]);
+			return -1;
+		}
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Slow I/O on cwdevice of one channel doesn't delay keying of other channel
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_keying_io_channels(void)
+{
+	keying_io_t * const io2 = keying_io_instance(1);
+	if (NULL != keying_io_instance(CWDAEMON_CHANNELS_MAX)) {
+		test_log_err("Got instance for out-of-range channel %s\n", "");
+		return -1;
+	}
+
+	g_ops.count = 0;
+	g_ops.slow = true;
+	__atomic_store_n(&g_fast_ops_count, 0, __ATOMIC_RELEASE);
+	if (0 != keying_io_start(g_io) || 0 != keying_io_start(io2)) {
+		test_log_err("Failed to start I/O threads %s\n", "");
+		keying_io_stop_all();
+		return -1;
+	}
+
+	/* Backlog of slow I/O in first channel. */
+	size_t const n = 50;
+	for (size_t i = 0; i < n; i++) {
+		keying_io_post(g_io, &g_fake_device, KEYING_IO_PIN_CW, (int) (i % 2));
+	}
+
+	int64_t const start_ns = now_ns();
+	keying_io_post(io2, &g_fast_device, KEYING_IO_PIN_CW, ON);
+	keying_io_post(io2, &g_fast_device, KEYING_IO_PIN_CW, OFF);
+	keying_io_sync(io2);
+	int64_t const sync_ns = now_ns() - start_ns;
+	size_t const slow_count = __atomic_load_n(&g_ops.count, __ATOMIC_ACQUIRE);
+
+	keying_io_stats_t stats2 = { 0 };
+	keying_io_get_stats(io2, &stats2);
+	keying_io_stop_all();
+
+	if (2 != __atomic_load_n(&g_fast_ops_count, __ATOMIC_ACQUIRE) || 2 != stats2.count) {
+		test_log_err("Unexpected count of operations in second channel: %zu\n", g_fast_ops_count);
+		return -1;
+	}
+	/* Second channel must not wait for the backlog of first channel. */
+	if (slow_count >= n || sync_ns > (int64_t) n * TEST_SLOW_IO_NS / 2) {
+		test_log_err("Second channel has waited for first channel: %zu operations of first channel after %lld ns\n",
+		             slow_count, (long long) sync_ns);
+		return -1;
+	}
+	if (n != g_ops.count) {
+		test_log_err("Unexpected count of operations in first channel: %zu\n", g_ops.count);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Commands posted while I/O thread is being stopped are not lost
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_keying_io_stop_race(void)
+{
+	size_t const n = 20000;
+	size_t const threads_count = 2;
+	size_t const rounds = 10;
+
+	for (size_t round = 0; round < rounds; round++) {
+		__atomic_store_n(&g_fast_ops_count, 0, __ATOMIC_RELEASE);
+		if (0 != keying_io_start(g_io)) {
+			test_log_err("Failed to start I/O thread %s\n", "");
+			return -1;
+		}
+
+		pthread_t threads[2];
+		for (size_t i = 0; i < threads_count; i++) {
+			pthread_create(&threads[i], NULL, fast_poster_fn, (void *) &n);
+		}
+		/* Stop the thread while the posters are busy. Commands posted
+		   after this are executed by the posters themselves. */
+		struct timespec const ts = { .tv_sec = 0, .tv_nsec = 1000000 * (long) (round + 1) };
+		nanosleep(&ts, NULL);
+		keying_io_stop(g_io);
+		for (size_t i = 0; i < threads_count; i++) {
+			pthread_join(threads[i], NULL);
+		}
+
+		size_t const count = __atomic_load_n(&g_fast_ops_count, __ATOMIC_ACQUIRE);
+		if (threads_count * n != count) {
+			test_log_err("Commands have been lost in round %zu: %zu of %zu executed\n", round, count, threads_count * n);
+			return -1;
+		}
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+static void * poster_fn(void * arg)
+{
+	size_t const n = *(size_t const *) arg;
+	for (size_t i = 0; i < n; i++) {
+		keying_io_post(g_io, &g_fake_device, KEYING_IO_PIN_CW, (int) (i % 2));
+	}
+	return NULL;
+}
+
+
+
+
+static void * fast_poster_fn(void * arg)
+{
+	size_t const n = *(size_t const *) arg;
+	for (size_t i = 0; i < n; i++) {
+		keying_io_post(g_io, &g_fast_device, KEYING_IO_PIN_CW, (int) (i % 2));
+	}
+	return NULL;
+}
+
+
+
+
+static int fake_cw(__attribute__((unused)) cwdevice * dev, int onoff)
+{
+	fake_record(KEYING_IO_PIN_CW, onoff);
+	return 0;
+}
+
+
+
+
+static int fake_ptt(__attribute__((unused)) cwdevice * dev, int onoff)
+{
+	fake_record(KEYING_IO_PIN_PTT, onoff);
+	return 0;
+}
+
+
+
+
+static int fake_ssbway(__attribute__((unused)) cwdevice * dev, int onoff)
+{
+	fake_record(KEYING_IO_PIN_SSBWAY, onoff);
+	return 0;
+}
+
+
+
+
+static int fake_switchband(__attribute__((unused)) cwdevice * dev, unsigned char bandswitch)
+{
+	fake_record(KEYING_IO_PIN_BAND, bandswitch);
+	return 0;
+}
+
+
+
+
+static int fake_reset_pins_state(__attribute__((unused)) cwdevice * dev)
+{
+	fake_record(KEYING_IO_PINS_RESET, 0);
+	return 0;
+}
+
+
+
+
+static int fake_cw_fast(__attribute__((unused)) cwdevice * dev, __attribute__((unused)) int onoff)
+{
+	__atomic_add_fetch(&g_fast_ops_count, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+
+
+
+static void fake_record(int pin, int onoff)
+{
+	if (g_ops.slow) {
+		struct timespec const io = { .tv_sec = 0, .tv_nsec = TEST_SLOW_IO_NS };
+		nanosleep(&io, NULL);
+	}
+	if (g_ops.count < TEST_OPS_MAX) {
+		g_ops.pin[g_ops.count] = pin;
+		g_ops.onoff[g_ops.count] = onoff;
+		g_ops.count++;
+	}
+}
+
+
+
+
+static int64_t now_ns(void)
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
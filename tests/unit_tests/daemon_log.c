@@ -0,0 +1,359 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for deferred formatting of log messages (cwdaemon/src/log.c).
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "src/cwdaemon.h"
+#include "src/log.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+static int test_log_record_conversions(void);
+static int test_log_record_volatile_string(void);
+static int test_log_record_fallback(void);
+static int test_log_threshold(void);
+static int test_log_async_stop(void);
+
+static void * producer_thread_fn(void * arg);
+
+static int compare_with_vsnprintf(char const * format, ...) __attribute__ ((format (printf, 1, 2)));
+static void capture(log_record_t * record, char const * format, ...) __attribute__ ((format (printf, 2, 3)));
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_log_record_conversions,
+	test_log_record_volatile_string,
+	test_log_record_fallback,
+	test_log_threshold,
+	test_log_async_stop,
+	NULL
+};
+
+
+
+
+int main(void)
+{
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			return -1;
+		}
+		i++;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+static void capture(log_record_t * record, char const * format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	log_record_capture(record, format, ap);
+	va_end(ap);
+}
+
+
+
+
+/// @brief Capture and format a message, compare the result with vsnprintf()
+///
+/// @return 0 if results are the same
+/// @return -1 otherwise
+static int compare_with_vsnprintf(char const * format, ...)
+{
+	char expected[LOG_BUF_SIZE] = { 0 };
+	char result[LOG_BUF_SIZE] = { 0 };
+	static log_record_t record;
+
+	va_list ap;
+	va_start(ap, format);
+	vsnprintf(expected, sizeof (expected), format, ap);
+	va_end(ap);
+
+	va_start(ap, format);
+	log_record_capture(&record, format, ap);
+	va_end(ap);
+
+	size_t const len = log_record_format(&record, result, sizeof (result));
+	if (0 != strcmp(expected, result) || len != strlen(expected)) {
+		test_log_err("Unexpected result for format [%s]: [%s] (%zu) != [%s]\n", format, result, len, expected);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+
+/// @brief Deferred formatting gives the same results as vsnprintf()
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_log_record_conversions(void)
+{
+	int failures = 0;
+
+	failures += compare_with_vsnprintf("plain text, no conversions");
+	failures += compare_with_vsnprintf("percent: 100%%");
+	failures += compare_with_vsnprintf("int: %d %i %5d %-5d| %+d %05d", -17, 42, 3, 4, 5, -6);
+	failures += compare_with_vsnprintf("unsigned: %u %x %X %o %#x", 4000000000u, 0xbeefu, 0xcafeu, 8u, 255u);
+	failures += compare_with_vsnprintf("short/char: %hd %hhd %hu %hhx", (short) -300, (signed char) -5, (unsigned short) 65535, (unsigned char) 0xab);
+	failures += compare_with_vsnprintf("long: %ld %lu %lld %llu", -123456789L, 123456789UL, -1234567890123LL, 12345678901234ULL);
+	failures += compare_with_vsnprintf("sizes: %zu %zd %jd %td", (size_t) 12345, (size_t) 77, (intmax_t) -9, (ptrdiff_t) -10);
+	failures += compare_with_vsnprintf("char: [%c] [%3c] [%-3c]", 'a', 'b', 'c');
+	failures += compare_with_vsnprintf("double: %f %.2f %e %g %10.3f %lf", 3.14159, 2.71828, 12345.678, 0.0001, -1.5, 1.0);
+	failures += compare_with_vsnprintf("string: [%s] [%10s] [%-10s] [%.3s] [%s]", "hello", "right", "left", "truncated", "");
+	failures += compare_with_vsnprintf("star: [%*d] [%-*d] [%.*s] [%*.*f]", 6, 1, 6, 2, 2, "abcdef", 8, 3, 1.23456);
+	failures += compare_with_vsnprintf("pointer: %p", (void *) &failures);
+	failures += compare_with_vsnprintf("PTT flag = %d (0x%02x/%s)", 3, 3u, "PTT_ACTIVE_AUTO|PTT_ACTIVE_MANUAL");
+
+	if (0 != failures) {
+		return -1;
+	}
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Strings are copied at the time of capture, not referenced
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_log_record_volatile_string(void)
+{
+	static log_record_t record;
+	char text[16] = "before";
+
+	capture(&record, "text: [%s] %d", text, 5);
+	// Buffer passed as argument is modified before the message is formatted.
+	strcpy(text, "after");
+
+	char result[LOG_BUF_SIZE] = { 0 };
+	log_record_format(&record, result, sizeof (result));
+	if (0 != strcmp("text: [before] 5", result)) {
+		test_log_err("Unexpected result: [%s]\n", result);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Messages that can't be deferred are formatted at the time of capture
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_log_record_fallback(void)
+{
+	static log_record_t record;
+
+	// Wide string.
+	capture(&record, "%s %ls", "hello", L"world");
+	char result[LOG_BUF_SIZE] = { 0 };
+	log_record_format(&record, result, sizeof (result));
+	if (!record.formatted || 0 != strcmp("hello world", result)) {
+		test_log_err("Unexpected result for wide string: [%s]\n", result);
+		return -1;
+	}
+
+	// Arguments that don't fit into the record.
+	char long_text[LOG_BUF_SIZE] = { 0 };
+	memset(long_text, 'x', sizeof (long_text) - 1);
+	capture(&record, "%d %s", 1, long_text);
+	size_t const len = log_record_format(&record, result, sizeof (result));
+	if (!record.formatted || LOG_BUF_SIZE - 1 != len || 0 != strncmp("1 xxx", result, 5)) {
+		test_log_err("Unexpected result for long argument: %zu\n", len);
+		return -1;
+	}
+
+	// Output buffer smaller than the message.
+	capture(&record, "%s %d", "abcdef", 12345);
+	char small[8] = { 0 };
+	if (7 != log_record_format(&record, small, sizeof (small)) || 0 != strcmp("abcdef ", small)) {
+		test_log_err("Unexpected result for small buffer: [%s]\n", small);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Runtime threshold decides which messages are enabled
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_log_threshold(void)
+{
+	log_set_threshold(LOG_WARNING);
+	if (!log_is_enabled(LOG_ERR) || !log_is_enabled(LOG_WARNING) || log_is_enabled(LOG_INFO)) {
+		test_log_err("Unexpected results for threshold WARNING %s\n", "");
+		return -1;
+	}
+
+	// Arguments of filtered-out message are not evaluated.
+	int evaluated = 0;
+	log_info("%d", ++evaluated);
+	if (0 != evaluated) {
+		test_log_err("Arguments of filtered-out message have been evaluated %s\n", "");
+		return -1;
+	}
+
+	log_set_threshold(LOG_CRIT); // "None".
+	if (log_is_enabled(LOG_ERR)) {
+		test_log_err("Unexpected results for threshold NONE %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+#define TEST_PRODUCERS_COUNT           4
+#define TEST_MESSAGES_PER_PRODUCER  5000
+
+
+
+
+/// @brief No message is lost when background thread is stopped while other threads are logging
+///
+/// Each message is either written by background thread, written by the
+/// producer itself, or counted as dropped.
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_log_async_stop(void)
+{
+	FILE * const file = tmpfile();
+	if (NULL == file) {
+		test_log_err("Failed to create temporary file %s\n", "");
+		return -1;
+	}
+	cwdaemon_debug_f = file;
+	log_set_threshold(LOG_INFO);
+
+	unsigned int finished = 0;
+	pthread_t threads[TEST_PRODUCERS_COUNT];
+	for (size_t i = 0; i < TEST_PRODUCERS_COUNT; i++) {
+		pthread_create(&threads[i], NULL, producer_thread_fn, &finished);
+	}
+	// Start and stop the thread while producers are putting messages into its queue.
+	while (__atomic_load_n(&finished, __ATOMIC_ACQUIRE) < TEST_PRODUCERS_COUNT) {
+		log_async_start();
+		log_async_stop();
+	}
+	for (size_t i = 0; i < TEST_PRODUCERS_COUNT; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	log_async_stop();
+	log_set_threshold(LOG_CRIT);
+	cwdaemon_debug_f = NULL;
+
+	unsigned long written = 0;
+	unsigned long dropped = 0;
+	char line[LOG_BUF_SIZE] = { 0 };
+	rewind(file);
+	while (fgets(line, sizeof (line), file)) {
+		unsigned long n = 0;
+		if (strstr(line, "producer message")) {
+			written++;
+		} else if (1 == sscanf(line, "[WW] " PACKAGE ": %lu log message(s) dropped", &n)) {
+			dropped += n;
+		}
+	}
+	fclose(file);
+
+	unsigned long const expected = TEST_PRODUCERS_COUNT * TEST_MESSAGES_PER_PRODUCER;
+	if (written + dropped != expected) {
+		test_log_err("Messages have been lost: written %lu, dropped %lu, expected %lu in total\n", written, dropped, expected);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+static void * producer_thread_fn(void * arg)
+{
+	for (int i = 0; i < TEST_MESSAGES_PER_PRODUCER; i++) {
+		log_info("producer message %d", i);
+	}
+	__atomic_add_fetch((unsigned int *) arg, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
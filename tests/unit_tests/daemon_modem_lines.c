@@ -0,0 +1,488 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for emulation of modem-control lines of ptys
+/// (cwdaemon/tools/modem_lines.c and cwdaemon/tools/modem_lines_preload.c).
+///
+/// The interposer of ioctl() is linked into the test program, so it
+/// replaces ioctl() of C library for the test program in the same way as
+/// it does for programs started with LD_PRELOAD. This allows running the
+/// real tty cwdevice (cwdaemon/src/ttys.c) on a pty.
+
+
+
+
+#define _XOPEN_SOURCE 700 /* posix_openpt(), grantpt(), unlockpt(), ptsname(). */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/cwdaemon.h"
+#include "src/ttys.h"
+#include "tests/library/log.h"
+#include "tools/modem_lines.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+/// A pty with emulated lines.
+typedef struct {
+	int master;
+	char slave_path[64];
+	unsigned int index;
+} pty_t;
+
+
+
+
+/// Arguments and results of a thread waiting in TIOCMIWAIT.
+typedef struct {
+	int fd;
+	unsigned int mask;
+	int retv;
+	int err;
+	bool done;
+} waiter_t;
+
+
+
+
+static int test_modem_lines_passthrough(void);
+static int test_modem_lines_tty_cwdevice(void);
+static int test_modem_lines_null_modem(void);
+static int test_modem_lines_wait(void);
+static int test_modem_lines_wait_interrupted(void);
+
+static int pty_open(pty_t * pty);
+static int get_lines(int fd);
+static void * waiter_thread(void * arg);
+static void handle_signal(int sig);
+static void sleep_ms(unsigned int ms);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_modem_lines_passthrough,
+	test_modem_lines_tty_cwdevice,
+	test_modem_lines_null_modem,
+	test_modem_lines_wait,
+	test_modem_lines_wait_interrupted,
+	NULL
+};
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+
+	// Private state file, so that the test doesn't interfere with ptys
+	// used by other programs. The path must be set before first ioctl().
+	char path[] = "/tmp/cwdaemon_modem_lines_XXXXXX";
+	int const fd = mkstemp(path);
+	if (-1 == fd) {
+		test_log_err("Test: can't create state file: %s\n", strerror(errno));
+		return -1;
+	}
+	close(fd);
+	setenv(MODEM_LINES_ENV_PATH, path, 1);
+
+	int retv = 0;
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			retv = -1;
+			break;
+		}
+		i++;
+	}
+	unlink(path);
+
+	if (0 == retv) {
+		test_log_info("Test result: PASS %s\n", "");
+	}
+	return retv;
+}
+
+
+
+
+/// @brief Requests other than modem-line requests, and fds other than ptys, are not emulated
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_modem_lines_passthrough(void)
+{
+	int fds[2] = { -1, -1 };
+	if (0 != pipe(fds)) {
+		test_log_err("Test: can't create pipe: %s\n", strerror(errno));
+		return -1;
+	}
+	int lines = 0;
+	int const retv = ioctl(fds[0], TIOCMGET, &lines);
+	close(fds[0]);
+	close(fds[1]);
+	if (-1 != retv) {
+		test_log_err("Test: TIOCMGET succeeded on a pipe %s\n", "");
+		return -1;
+	}
+
+	pty_t pty = { 0 };
+	if (0 != pty_open(&pty)) {
+		return -1;
+	}
+	struct winsize ws = { .ws_row = 25, .ws_col = 80 };
+	struct winsize ws_read = { 0 };
+	bool const success = 0 == ioctl(pty.master, TIOCSWINSZ, &ws)
+		&& 0 == ioctl(pty.master, TIOCGWINSZ, &ws_read)
+		&& 80 == ws_read.ws_col;
+	close(pty.master);
+	if (!success) {
+		test_log_err("Test: TIOCSWINSZ/TIOCGWINSZ not passed to pty %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Real tty cwdevice can be probed and used on a pty, and changes are traced
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_modem_lines_tty_cwdevice(void)
+{
+	pty_t pty = { 0 };
+	if (0 != pty_open(&pty)) {
+		return -1;
+	}
+
+	int const fd = tty_probe_cwdevice(pty.slave_path);
+	if (-1 == fd) {
+		test_log_err("Test: failed to probe pty [%s] as tty cwdevice\n", pty.slave_path);
+		close(pty.master);
+		return -1;
+	}
+	cwdevice dev = { 0 };
+	tty_init_cwdevice(&dev);
+	dev.init(&dev, fd);
+
+	// Observer opens the same slave side.
+	int const observer = open(pty.slave_path, O_RDONLY | O_NOCTTY);
+
+	struct {
+		int (* fn)(cwdevice * dev, int onoff);
+		int onoff;
+		int observer_lines;
+		int master_lines;
+	} const steps[] = {
+		{ dev.cw,  1, TIOCM_DTR,             TIOCM_DSR | TIOCM_CD },
+		{ dev.ptt, 1, TIOCM_DTR | TIOCM_RTS, TIOCM_DSR | TIOCM_CD | TIOCM_CTS },
+		{ dev.cw,  0, TIOCM_RTS,             TIOCM_CTS },
+		{ dev.ptt, 0, 0,                     0 },
+	};
+	bool success = -1 != observer;
+	for (size_t i = 0; success && i < sizeof (steps) / sizeof (steps[0]); i++) {
+		steps[i].fn(&dev, steps[i].onoff);
+		int const observed = get_lines(observer);
+		int const master = get_lines(pty.master);
+		if (observed != steps[i].observer_lines || master != steps[i].master_lines) {
+			test_log_err("Test: unexpected lines in step %zu: observer 0x%x, master 0x%x\n", i, observed, master);
+			success = false;
+		}
+	}
+	dev.free(&dev);
+	free(dev.desc);
+	if (-1 != observer) {
+		close(observer);
+	}
+
+	// Each of the four steps has been traced.
+	modem_lines_t ml = { 0 };
+	modem_lines_slot_t * slot = NULL;
+	if (success && (0 != modem_lines_open(&ml, NULL) || NULL == (slot = modem_lines_slot(&ml, pty.index, false)))) {
+		test_log_err("Test: can't find state of pty %u\n", pty.index);
+		success = false;
+	}
+	if (success) {
+		uint64_t cursor = 0;
+		modem_lines_record_t records[8];
+		size_t const n = modem_lines_read(slot, &cursor, records, sizeof (records) / sizeof (records[0]));
+		unsigned int const expected[] = { TIOCM_DTR, TIOCM_DTR | TIOCM_RTS, TIOCM_RTS, 0 };
+		if (4 != n) {
+			test_log_err("Test: unexpected count of traced changes: %zu\n", n);
+			success = false;
+		}
+		for (size_t i = 0; success && i < n; i++) {
+			if (records[i].lines != expected[i]
+			    || MODEM_LINES_SIDE_SLAVE != records[i].side
+			    || (uint32_t) getpid() != records[i].pid
+			    || (i > 0 && records[i].timestamp_ns < records[i - 1].timestamp_ns)) {
+				test_log_err("Test: unexpected traced change #%zu: lines 0x%x, side %u\n", i, records[i].lines, records[i].side);
+				success = false;
+			}
+		}
+	}
+	if (ml.header) {
+		modem_lines_close(&ml);
+	}
+	close(pty.master);
+
+	if (!success) {
+		return -1;
+	}
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Outputs of master side are inputs of slave side
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_modem_lines_null_modem(void)
+{
+	pty_t pty = { 0 };
+	if (0 != pty_open(&pty)) {
+		return -1;
+	}
+	int const slave = open(pty.slave_path, O_RDWR | O_NOCTTY);
+
+	int lines = TIOCM_DTR | TIOCM_RTS;
+	ioctl(pty.master, TIOCMSET, &lines);
+	int const both = get_lines(slave);
+	lines = TIOCM_RTS;
+	ioctl(pty.master, TIOCMBIC, &lines);
+	int const dtr = get_lines(slave);
+	// Input lines can't be set by a side, only by the other side.
+	lines = TIOCM_CTS | TIOCM_RI;
+	ioctl(slave, TIOCMBIS, &lines);
+	int const master = get_lines(pty.master);
+
+	close(slave);
+	close(pty.master);
+
+	if (both != (TIOCM_DSR | TIOCM_CD | TIOCM_CTS) || dtr != (TIOCM_DSR | TIOCM_CD) || master != TIOCM_DTR) {
+		test_log_err("Test: unexpected lines: 0x%x, 0x%x, 0x%x\n", both, dtr, master);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief TIOCMIWAIT returns on change of selected lines only
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_modem_lines_wait(void)
+{
+	pty_t pty = { 0 };
+	if (0 != pty_open(&pty)) {
+		return -1;
+	}
+	int const slave = open(pty.slave_path, O_RDWR | O_NOCTTY);
+	int const observer = open(pty.slave_path, O_RDONLY | O_NOCTTY);
+
+	// Observer waits for DTR of slave side, master side waits for CTS
+	// (RTS of slave side).
+	waiter_t waiters[] = {
+		{ .fd = observer,   .mask = TIOCM_DTR },
+		{ .fd = pty.master, .mask = TIOCM_CTS },
+	};
+	pthread_t threads[2];
+	for (size_t i = 0; i < 2; i++) {
+		pthread_create(&threads[i], NULL, waiter_thread, &waiters[i]);
+	}
+	sleep_ms(50);
+
+	int lines = TIOCM_RTS;
+	ioctl(slave, TIOCMBIS, &lines);
+	sleep_ms(50);
+	bool const early = __atomic_load_n(&waiters[0].done, __ATOMIC_ACQUIRE);
+	// A pulse shorter than anyone can poll for is noticed too.
+	lines = TIOCM_DTR;
+	ioctl(slave, TIOCMBIS, &lines);
+	ioctl(slave, TIOCMBIC, &lines);
+
+	for (size_t i = 0; i < 2; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	close(observer);
+	close(slave);
+	close(pty.master);
+
+	if (early || 0 != waiters[0].retv || 0 != waiters[1].retv) {
+		test_log_err("Test: unexpected results of waiting: early = %d, %d, %d\n", early, waiters[0].retv, waiters[1].retv);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief TIOCMIWAIT is interrupted by a signal, like in serial drivers
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_modem_lines_wait_interrupted(void)
+{
+	pty_t pty = { 0 };
+	if (0 != pty_open(&pty)) {
+		return -1;
+	}
+	struct sigaction sa = { 0 };
+	sa.sa_handler = handle_signal; // No SA_RESTART.
+	sigaction(SIGUSR1, &sa, NULL);
+
+	waiter_t waiter = { .fd = pty.master, .mask = TIOCM_DSR };
+	pthread_t thread;
+	pthread_create(&thread, NULL, waiter_thread, &waiter);
+	sleep_ms(50);
+	pthread_kill(thread, SIGUSR1);
+	pthread_join(thread, NULL);
+	close(pty.master);
+
+	if (-1 != waiter.retv || EINTR != waiter.err) {
+		test_log_err("Test: unexpected result of interrupted waiting: %d, errno %d\n", waiter.retv, waiter.err);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+static int pty_open(pty_t * pty)
+{
+	pty->master = posix_openpt(O_RDWR | O_NOCTTY);
+	char const * path = NULL;
+	if (-1 == pty->master || 0 != grantpt(pty->master) || 0 != unlockpt(pty->master) || NULL == (path = ptsname(pty->master))) {
+		test_log_err("Test: can't create pseudo-terminal: %s\n", strerror(errno));
+		return -1;
+	}
+	snprintf(pty->slave_path, sizeof (pty->slave_path), "%s", path);
+	if (1 != sscanf(pty->slave_path, "/dev/pts/%u", &pty->index)) {
+		test_log_err("Test: unexpected path of pseudo-terminal [%s]\n", pty->slave_path);
+		close(pty->master);
+		return -1;
+	}
+
+	// Clear state left by earlier pty with the same index.
+	modem_lines_t ml = { 0 };
+	modem_lines_slot_t * slot = NULL;
+	if (0 != modem_lines_open(&ml, NULL) || NULL == (slot = modem_lines_slot(&ml, pty->index, true))) {
+		test_log_err("Test: can't open state file: %s\n", strerror(errno));
+		close(pty->master);
+		return -1;
+	}
+	modem_lines_reset(slot);
+	modem_lines_close(&ml);
+	return 0;
+}
+
+
+
+
+static int get_lines(int fd)
+{
+	int lines = 0;
+	if (0 != ioctl(fd, TIOCMGET, &lines)) {
+		return -1;
+	}
+	return lines;
+}
+
+
+
+
+static void * waiter_thread(void * arg)
+{
+	waiter_t * const waiter = arg;
+	waiter->retv = ioctl(waiter->fd, TIOCMIWAIT, (void *) (uintptr_t) waiter->mask);
+	waiter->err = errno;
+	__atomic_store_n(&waiter->done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+
+
+
+static void handle_signal(int sig)
+{
+	(void) sig;
+}
+
+
+
+
+static void sleep_ms(unsigned int ms)
+{
+	struct timespec const ts = { .tv_sec = ms / 1000, .tv_nsec = (long) (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
@@ -36,6 +36,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "src/cwdaemon.h"
 #include "src/options.h"
@@ -58,12 +59,28 @@ options_t g_current_options;
 
 
 static int test_option_network_port(void);
+static int test_option_rt_priority(void);
+static int test_option_rt_cpus(void);
+static int test_option_idle_suspend(void);
+static int test_option_sidetone(void);
+static int test_option_ready_fd(void);
+static int test_option_channel(void);
+static int test_option_unix_socket(void);
+static int test_option_rcvbuf(void);
 
 
 
 
 static int (*tests[])(void) = {
 	test_option_network_port,
+	test_option_rt_priority,
+	test_option_rt_cpus,
+	test_option_idle_suspend,
+	test_option_sidetone,
+	test_option_ready_fd,
+	test_option_channel,
+	test_option_unix_socket,
+	test_option_rcvbuf,
 	NULL
 };
 
@@ -165,3 +182,417 @@ static int test_option_network_port(void)
 
 
 
+/// @return 0 on success
+/// @return -1 on failure
+static int test_option_rt_priority(void)
+{
+	const struct {
+		char const * opt_value;
+		bool expected_success;
+		int expected_priority;
+	} test_data[] = {
+		{ .opt_value =    "0", .expected_success = false, .expected_priority =  0 },
+		{ .opt_value =    "1", .expected_success = true,  .expected_priority =  1 },  /* CWDAEMON_RT_PRIORITY_MIN */
+		{ .opt_value =   "50", .expected_success = true,  .expected_priority = 50 },
+		{ .opt_value =   "99", .expected_success = true,  .expected_priority = 99 },  /* CWDAEMON_RT_PRIORITY_MAX */
+		{ .opt_value =  "100", .expected_success = false, .expected_priority =  0 },
+		{ .opt_value =   "-1", .expected_success = false, .expected_priority =  0 },
+		{ .opt_value =     "", .expected_success = false, .expected_priority =  0 },
+		{ .opt_value = "high", .expected_success = false, .expected_priority =  0 },
+		{ .opt_value =  "10x", .expected_success = false, .expected_priority =  0 },
+	};
+
+	const size_t n = sizeof (test_data) / sizeof (test_data[0]);
+	for (size_t i = 0; i < n; i++) {
+		int priority = 0;
+		const int retv = cwdaemon_option_rt_priority(&priority, test_data[i].opt_value);
+		const bool success = 0 == retv;
+		if (success != test_data[i].expected_success) {
+			test_log_err("Tested function returns unexpected result %d in test %zu / %zu, opt_value = [%s]\n",
+			             retv, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+		if (success && priority != test_data[i].expected_priority) {
+			test_log_err("Tested function returns unexpected priority %d where %d was expected in test %zu / %zu, opt_value = [%s]\n",
+			             priority, test_data[i].expected_priority, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+	}
+
+	test_log_info("Tests of cwdaemon_option_rt_priority() have succeeded %s\n", "");
+
+	return 0;
+}
+
+
+
+
+/// @return 0 on success
+/// @return -1 on failure
+static int test_option_rt_cpus(void)
+{
+	const struct {
+		char const * opt_value;
+		bool expected_success;
+		uint64_t expected_cpus;
+	} test_data[] = {
+		{ .opt_value =       "0", .expected_success = true,  .expected_cpus = 0x1 },
+		{ .opt_value =       "2", .expected_success = true,  .expected_cpus = 0x4 },
+		{ .opt_value =   "0,2-3", .expected_success = true,  .expected_cpus = 0xd },
+		{ .opt_value =   "1-1,5", .expected_success = true,  .expected_cpus = 0x22 },
+		{ .opt_value =      "63", .expected_success = true,  .expected_cpus = UINT64_C(1) << 63 },
+		{ .opt_value =    "0-63", .expected_success = true,  .expected_cpus = UINT64_MAX },
+
+		{ .opt_value =      "64", .expected_success = false, .expected_cpus = 0 },  /* Above CWDAEMON_RT_CPUS_MAX. */
+		{ .opt_value =     "3-1", .expected_success = false, .expected_cpus = 0 },  /* Reversed range. */
+		{ .opt_value =        "", .expected_success = false, .expected_cpus = 0 },
+		{ .opt_value =      "1,", .expected_success = false, .expected_cpus = 0 },
+		{ .opt_value =     "1,,2", .expected_success = false, .expected_cpus = 0 },
+		{ .opt_value =      "-1", .expected_success = false, .expected_cpus = 0 },
+		{ .opt_value =      "2-", .expected_success = false, .expected_cpus = 0 },
+		{ .opt_value =     "cpu", .expected_success = false, .expected_cpus = 0 },
+		{ .opt_value =     "1 2", .expected_success = false, .expected_cpus = 0 },
+	};
+
+	const size_t n = sizeof (test_data) / sizeof (test_data[0]);
+	for (size_t i = 0; i < n; i++) {
+		uint64_t cpus = 0;
+		const int retv = cwdaemon_option_rt_cpus(&cpus, test_data[i].opt_value);
+		const bool success = 0 == retv;
+		if (success != test_data[i].expected_success) {
+			test_log_err("Tested function returns unexpected result %d in test %zu / %zu, opt_value = [%s]\n",
+			             retv, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+		if (success && cpus != test_data[i].expected_cpus) {
+			test_log_err("Tested function returns unexpected mask 0x%llx where 0x%llx was expected in test %zu / %zu, opt_value = [%s]\n",
+			             (unsigned long long) cpus, (unsigned long long) test_data[i].expected_cpus, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+	}
+
+	test_log_info("Tests of cwdaemon_option_rt_cpus() have succeeded %s\n", "");
+
+	return 0;
+}
+
+
+
+
+/// @brief Test parsing of value of "--idle-suspend" command line option
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_option_idle_suspend(void)
+{
+	const struct {
+		char const * opt_value;
+		bool expected_success;
+		unsigned int expected_seconds;
+	} test_data[] = {
+		{ .opt_value =     "0", .expected_success = true,  .expected_seconds =     0 },  /* Disabled. */
+		{ .opt_value =     "1", .expected_success = true,  .expected_seconds =     1 },
+		{ .opt_value =   "300", .expected_success = true,  .expected_seconds =   300 },
+		{ .opt_value = "86400", .expected_success = true,  .expected_seconds = 86400 },  /* CWDAEMON_IDLE_SUSPEND_MAX */
+		{ .opt_value = "86401", .expected_success = false, .expected_seconds =     0 },
+		{ .opt_value =    "-1", .expected_success = false, .expected_seconds =     0 },
+		{ .opt_value =      "", .expected_success = false, .expected_seconds =     0 },
+		{ .opt_value =  "long", .expected_success = false, .expected_seconds =     0 },
+		{ .opt_value =   "10s", .expected_success = false, .expected_seconds =     0 },
+	};
+
+	const size_t n = sizeof (test_data) / sizeof (test_data[0]);
+	for (size_t i = 0; i < n; i++) {
+		unsigned int seconds = 0;
+		const int retv = cwdaemon_option_idle_suspend(&seconds, test_data[i].opt_value);
+		const bool success = 0 == retv;
+		if (success != test_data[i].expected_success) {
+			test_log_err("Tested function returns unexpected result %d in test %zu / %zu, opt_value = [%s]\n",
+			             retv, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+		if (success && seconds != test_data[i].expected_seconds) {
+			test_log_err("Tested function returns unexpected time %u where %u was expected in test %zu / %zu, opt_value = [%s]\n",
+			             seconds, test_data[i].expected_seconds, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+	}
+
+	test_log_info("Tests of cwdaemon_option_idle_suspend() have succeeded %s\n", "");
+
+	return 0;
+}
+
+
+
+
+/// @brief Test parsing of value of "--sidetone" command line option
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_option_sidetone(void)
+{
+	const struct {
+		char const * opt_value;
+		bool expected_success;
+		sidetone_sink_type_t expected_type;
+		char const * expected_path;
+	} test_data[] = {
+		{ .opt_value = "alsa",                .expected_success = true,  .expected_type = SIDETONE_SINK_ALSA, .expected_path = "default" },
+		{ .opt_value = "alsa:hw:1,0",         .expected_success = true,  .expected_type = SIDETONE_SINK_ALSA, .expected_path = "hw:1,0" },
+		{ .opt_value = "pcm:/tmp/sidetone",   .expected_success = true,  .expected_type = SIDETONE_SINK_PCM,  .expected_path = "/tmp/sidetone" },
+		{ .opt_value = "pcm:relative/path",   .expected_success = true,  .expected_type = SIDETONE_SINK_PCM,  .expected_path = "relative/path" },
+		{ .opt_value = "alsa:",               .expected_success = false, .expected_type = SIDETONE_SINK_NONE, .expected_path = "" },
+		{ .opt_value = "pcm:",                .expected_success = false, .expected_type = SIDETONE_SINK_NONE, .expected_path = "" },
+		{ .opt_value = "pcm",                 .expected_success = false, .expected_type = SIDETONE_SINK_NONE, .expected_path = "" },
+		{ .opt_value = "oss",                 .expected_success = false, .expected_type = SIDETONE_SINK_NONE, .expected_path = "" },
+		{ .opt_value = "",                    .expected_success = false, .expected_type = SIDETONE_SINK_NONE, .expected_path = "" },
+		{ .opt_value = "ALSA",                .expected_success = false, .expected_type = SIDETONE_SINK_NONE, .expected_path = "" },
+	};
+
+	const size_t n = sizeof (test_data) / sizeof (test_data[0]);
+	for (size_t i = 0; i < n; i++) {
+		sidetone_sink_t sink = { 0 };
+		const int retv = cwdaemon_option_sidetone(&sink, test_data[i].opt_value);
+		const bool success = 0 == retv;
+		if (success != test_data[i].expected_success) {
+			test_log_err("Tested function returns unexpected result %d in test %zu / %zu, opt_value = [%s]\n",
+			             retv, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+		if (success && (sink.type != test_data[i].expected_type || 0 != strcmp(sink.path, test_data[i].expected_path))) {
+			test_log_err("Tested function returns unexpected sink %d [%s] where %d [%s] was expected in test %zu / %zu, opt_value = [%s]\n",
+			             sink.type, sink.path, test_data[i].expected_type, test_data[i].expected_path, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+	}
+
+	/* Path that doesn't fit into the sink. */
+	char long_value[SIDETONE_SINK_PATH_MAX + 8] = "pcm:";
+	memset(long_value + 4, 'a', sizeof (long_value) - 5);
+	long_value[sizeof (long_value) - 1] = '\0';
+	sidetone_sink_t sink = { 0 };
+	if (0 == cwdaemon_option_sidetone(&sink, long_value)) {
+		test_log_err("Tested function accepts too long path %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Tests of cwdaemon_option_sidetone() have succeeded %s\n", "");
+
+	return 0;
+}
+
+
+
+
+/// @brief Test parsing of value of "--ready-fd" command line option
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_option_ready_fd(void)
+{
+	int pipe_fds[2] = { -1, -1 };
+	if (0 != pipe(pipe_fds)) {
+		test_log_err("Failed to create pipe for test %s\n", "");
+		return -1;
+	}
+	char read_end[16] = { 0 };
+	char write_end[16] = { 0 };
+	char closed_fd[16] = { 0 };
+	snprintf(read_end, sizeof (read_end), "%d", pipe_fds[0]);
+	snprintf(write_end, sizeof (write_end), "%d", pipe_fds[1]);
+	snprintf(closed_fd, sizeof (closed_fd), "%d", pipe_fds[1] + 10);
+
+	const struct {
+		char const * opt_value;
+		bool expected_success;
+		int expected_fd;
+	} test_data[] = {
+		{ .opt_value = write_end, .expected_success = true,  .expected_fd = pipe_fds[1] },
+		{ .opt_value = read_end,  .expected_success = false, .expected_fd = -1 },  /* Not open for writing. */
+		{ .opt_value = closed_fd, .expected_success = false, .expected_fd = -1 },  /* Not open at all. */
+		{ .opt_value = "-1",      .expected_success = false, .expected_fd = -1 },
+		{ .opt_value = "",        .expected_success = false, .expected_fd = -1 },
+		{ .opt_value = "fd",      .expected_success = false, .expected_fd = -1 },
+	};
+
+	int result = 0;
+	const size_t n = sizeof (test_data) / sizeof (test_data[0]);
+	for (size_t i = 0; i < n; i++) {
+		int fd = -1;
+		const int retv = cwdaemon_option_ready_fd(&fd, test_data[i].opt_value);
+		const bool success = 0 == retv;
+		if (success != test_data[i].expected_success) {
+			test_log_err("Tested function returns unexpected result %d in test %zu / %zu, opt_value = [%s]\n",
+			             retv, i + 1, n, test_data[i].opt_value);
+			result = -1;
+			break;
+		}
+		if (success && fd != test_data[i].expected_fd) {
+			test_log_err("Tested function returns unexpected fd %d where %d was expected in test %zu / %zu, opt_value = [%s]\n",
+			             fd, test_data[i].expected_fd, i + 1, n, test_data[i].opt_value);
+			result = -1;
+			break;
+		}
+	}
+
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+	if (0 == result) {
+		test_log_info("Tests of cwdaemon_option_ready_fd() have succeeded %s\n", "");
+	}
+
+	return result;
+}
+
+
+
+
+/// @brief Test parsing of value of "--channel" command line option
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_option_channel(void)
+{
+	const struct {
+		char const * opt_value;
+		bool expected_success;
+		in_port_t expected_port;
+		char const * expected_device;
+	} test_data[] = {
+		{ .opt_value = "6790:ttyS1",          .expected_success = true,  .expected_port = 6790, .expected_device = "ttyS1" },
+		{ .opt_value = "1024:null",           .expected_success = true,  .expected_port = 1024, .expected_device = "null" },
+		{ .opt_value = "6790:/dev/ttyUSB0",   .expected_success = true,  .expected_port = 6790, .expected_device = "/dev/ttyUSB0" },
+		{ .opt_value = "6790:record:/tmp/a",  .expected_success = true,  .expected_port = 6790, .expected_device = "record:/tmp/a" }, /* Only first ':' separates port. */
+		{ .opt_value = "6790:",               .expected_success = false, .expected_port = 0,    .expected_device = "" },
+		{ .opt_value = ":ttyS1",              .expected_success = false, .expected_port = 0,    .expected_device = "" },
+		{ .opt_value = "6790",                .expected_success = false, .expected_port = 0,    .expected_device = "" },
+		{ .opt_value = "1023:ttyS1",          .expected_success = false, .expected_port = 0,    .expected_device = "" }, /* Below CWDAEMON_NETWORK_PORT_MIN. */
+		{ .opt_value = "65536:ttyS1",         .expected_success = false, .expected_port = 0,    .expected_device = "" },
+		{ .opt_value = "port:ttyS1",          .expected_success = false, .expected_port = 0,    .expected_device = "" },
+		{ .opt_value = "",                    .expected_success = false, .expected_port = 0,    .expected_device = "" },
+	};
+
+	const size_t n = sizeof (test_data) / sizeof (test_data[0]);
+	for (size_t i = 0; i < n; i++) {
+		in_port_t port = 0;
+		char device[32] = { 0 };
+		const int retv = cwdaemon_option_channel(&port, device, sizeof (device), test_data[i].opt_value);
+		const bool success = 0 == retv;
+		if (success != test_data[i].expected_success) {
+			test_log_err("Tested function returns unexpected result %d in test %zu / %zu, opt_value = [%s]\n",
+			             retv, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+		if (success && (port != test_data[i].expected_port || 0 != strcmp(device, test_data[i].expected_device))) {
+			test_log_err("Tested function returns unexpected channel %u [%s] where %u [%s] was expected in test %zu / %zu, opt_value = [%s]\n",
+			             (unsigned int) port, device, (unsigned int) test_data[i].expected_port, test_data[i].expected_device, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+	}
+
+	/* Name of cwdevice that doesn't fit into the buffer. */
+	in_port_t port = 0;
+	char device[8] = { 0 };
+	if (0 == cwdaemon_option_channel(&port, device, sizeof (device), "6790:/dev/ttyUSB0")) {
+		test_log_err("Tested function accepts too long name of cwdevice %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Tests of cwdaemon_option_channel() have succeeded %s\n", "");
+
+	return 0;
+}
+
+
+
+
+/// @return 0 on success
+/// @return -1 on failure
+static int test_option_unix_socket(void)
+{
+	char too_long[200] = { 0 };
+	too_long[0] = '/';
+	memset(too_long + 1, 'a', sizeof (too_long) - 2);
+
+	const struct {
+		char const * opt_value;
+		bool expected_success;
+	} test_data[] = {
+		{ .opt_value = "/run/cwdaemon/cwdaemon.sock", .expected_success = true  },
+		{ .opt_value = "/tmp/a",                      .expected_success = true  },
+		{ .opt_value = "cwdaemon.sock",               .expected_success = false }, /* Relative path. */
+		{ .opt_value = "./cwdaemon.sock",             .expected_success = false },
+		{ .opt_value = "",                            .expected_success = false },
+		{ .opt_value = too_long,                      .expected_success = false }, /* Doesn't fit into sun_path. */
+	};
+
+	const size_t n = sizeof (test_data) / sizeof (test_data[0]);
+	for (size_t i = 0; i < n; i++) {
+		char const * path = NULL;
+		const int retv = cwdaemon_option_unix_socket(&path, test_data[i].opt_value);
+		const bool success = 0 == retv;
+		if (success != test_data[i].expected_success) {
+			test_log_err("Tested function returns unexpected result %d in test %zu / %zu, opt_value = [%s]\n",
+			             retv, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+		if (success && path != test_data[i].opt_value) {
+			test_log_err("Tested function returns unexpected path [%s] in test %zu / %zu, opt_value = [%s]\n",
+			             path, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+	}
+
+	test_log_info("Tests of cwdaemon_option_unix_socket() have succeeded %s\n", "");
+
+	return 0;
+}
+
+
+
+
+/// @return 0 on success
+/// @return -1 on failure
+static int test_option_rcvbuf(void)
+{
+	const int doesnt_matter = 4096;
+
+	const struct {
+		char const * opt_value;
+		bool expected_success;
+		int expected_size;
+	} test_data[] = {
+		{ .opt_value =        "0", .expected_success = true,  .expected_size =        0 }, /* System's default. */
+		{ .opt_value =     "1023", .expected_success = false, .expected_size = doesnt_matter },
+		{ .opt_value =     "1024", .expected_success = true,  .expected_size =     1024 }, /* CWDAEMON_RCVBUF_MIN */
+		{ .opt_value =   "262144", .expected_success = true,  .expected_size =   262144 },
+		{ .opt_value = "16777216", .expected_success = true,  .expected_size = 16777216 }, /* CWDAEMON_RCVBUF_MAX */
+		{ .opt_value = "16777217", .expected_success = false, .expected_size = doesnt_matter },
+		{ .opt_value =       "-1", .expected_success = false, .expected_size = doesnt_matter },
+		{ .opt_value =         "", .expected_success = false, .expected_size = doesnt_matter },
+		{ .opt_value =      "64k", .expected_success = false, .expected_size = doesnt_matter },
+	};
+
+	const size_t n = sizeof (test_data) / sizeof (test_data[0]);
+	for (size_t i = 0; i < n; i++) {
+		int size = doesnt_matter;
+		const int retv = cwdaemon_option_rcvbuf(&size, test_data[i].opt_value);
+		const bool success = 0 == retv;
+		if (success != test_data[i].expected_success) {
+			test_log_err("Tested function returns unexpected result %d in test %zu / %zu, opt_value = [%s]\n",
+			             retv, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+		if (size != test_data[i].expected_size) {
+			test_log_err("Tested function returns unexpected size %d where %d was expected in test %zu / %zu, opt_value = [%s]\n",
+			             size, test_data[i].expected_size, i + 1, n, test_data[i].opt_value);
+			return -1;
+		}
+	}
+
+	test_log_info("Tests of cwdaemon_option_rcvbuf() have succeeded %s\n", "");
+
+	return 0;
+}
+
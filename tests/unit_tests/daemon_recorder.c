@@ -0,0 +1,313 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for recording cwdevice (cwdaemon/src/recorder.c).
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/cwdaemon.h"
+#include "src/recorder.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+static int test_recorder_probe(void);
+static int test_recorder_edges(void);
+static int test_recorder_overrun(void);
+
+static int open_device(cwdevice * dev);
+static void close_device(cwdevice * dev);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_recorder_probe,
+	test_recorder_edges,
+	test_recorder_overrun,
+	NULL
+};
+
+
+
+
+static char g_path[] = "/tmp/cwdaemon_recorder_XXXXXX";
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+
+	int const fd = mkstemp(g_path);
+	if (-1 == fd) {
+		test_log_err("Test: failed to create temporary file %s\n", "");
+		return -1;
+	}
+	close(fd);
+
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			unlink(g_path);
+			return -1;
+		}
+		i++;
+	}
+
+	unlink(g_path);
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+static int open_device(cwdevice * dev)
+{
+	memset(dev, 0, sizeof (cwdevice));
+	dev->init = recorder_init;
+	dev->free = recorder_free;
+	dev->reset_pins_state = recorder_reset_pins_state;
+	dev->cw = recorder_cw;
+	dev->ptt = recorder_ptt;
+	dev->ssbway = recorder_ssbway;
+	dev->switchband = recorder_switchband;
+
+	char desc[64] = { 0 };
+	snprintf(desc, sizeof (desc), "%s%s", RECORDER_DEVICE_PREFIX, g_path);
+	dev->desc = desc;
+
+	int const fd = recorder_probe_cwdevice(desc);
+	if (-1 == fd) {
+		test_log_err("Test: failed to probe recording device [%s]\n", desc);
+		return -1;
+	}
+	int const retv = dev->init(dev, fd);
+	dev->desc = NULL;
+	if (0 != retv) {
+		test_log_err("Test: failed to init recording device [%s]\n", desc);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+
+static void close_device(cwdevice * dev)
+{
+	dev->free(dev);
+}
+
+
+
+
+static int test_recorder_probe(void)
+{
+	char const * names[] = { "null", "ttyS0", "/dev/ttyS0", "record", "record:", "rec:/tmp/x" };
+	for (size_t i = 0; i < sizeof (names) / sizeof (names[0]); i++) {
+		if (-1 != recorder_probe_cwdevice(names[i])) {
+			test_log_err("Test: name [%s] was accepted as recording device\n", names[i]);
+			return -1;
+		}
+	}
+
+	test_log_info("Test: probe %s\n", "OK");
+	return 0;
+}
+
+
+
+
+/// Each change of a line is recorded once, in order, with non-decreasing
+/// time stamps. Repeated writes of the same state are not recorded.
+static int test_recorder_edges(void)
+{
+	cwdevice dev;
+	if (0 != open_device(&dev)) {
+		return -1;
+	}
+	recorder_map_t map = { 0 };
+	if (0 != recorder_map_open(&map, g_path)) {
+		test_log_err("Test: failed to map file %s\n", g_path);
+		close_device(&dev);
+		return -1;
+	}
+
+	dev.ptt(&dev, 1);
+	dev.cw(&dev, 1);
+	dev.cw(&dev, 1);
+	nanosleep(&(struct timespec) { .tv_sec = 0, .tv_nsec = 2000000 }, NULL);
+	dev.cw(&dev, 0);
+	dev.cw(&dev, 0);
+	dev.switchband(&dev, 3);
+	dev.switchband(&dev, 3);
+	dev.ssbway(&dev, 1);
+	dev.ptt(&dev, 0);
+	close_device(&dev); // Lines are already in reset state, nothing is recorded.
+
+	struct {
+		uint32_t line;
+		uint32_t value;
+	} const expected[] = {
+		{ RECORDER_LINE_KEY,    0 }, // Initial state, recorded by init.
+		{ RECORDER_LINE_PTT,    0 },
+		{ RECORDER_LINE_PTT,    1 },
+		{ RECORDER_LINE_KEY,    1 },
+		{ RECORDER_LINE_KEY,    0 },
+		{ RECORDER_LINE_BAND,   3 },
+		{ RECORDER_LINE_SSBWAY, 1 },
+		{ RECORDER_LINE_PTT,    0 },
+	};
+	size_t const n_expected = sizeof (expected) / sizeof (expected[0]);
+
+	recorder_edge_t edges[16];
+	size_t const n = recorder_map_read(&map, edges, 16);
+	int result = 0;
+	if (n != n_expected) {
+		test_log_err("Test: got %zu edges, expected %zu\n", n, n_expected);
+		result = -1;
+	}
+	for (size_t i = 0; 0 == result && i < n; i++) {
+		if (edges[i].line != expected[i].line || edges[i].value != expected[i].value) {
+			test_log_err("Test: edge #%zu: line %u value %u, expected line %u value %u\n",
+			             i, edges[i].line, edges[i].value, expected[i].line, expected[i].value);
+			result = -1;
+		}
+		if (i > 0 && edges[i].timestamp_ns < edges[i - 1].timestamp_ns) {
+			test_log_err("Test: time stamp of edge #%zu goes back\n", i);
+			result = -1;
+		}
+	}
+	if (0 == result) {
+		// Key was down for 2 ms.
+		uint64_t const mark_us = (edges[4].timestamp_ns - edges[3].timestamp_ns) / 1000;
+		if (mark_us < 2000 || mark_us > 100000) {
+			test_log_err("Test: unexpected duration of mark: %lu us\n", (unsigned long) mark_us);
+			result = -1;
+		}
+	}
+	if (0 == result && 0 != recorder_map_read(&map, edges, 16)) {
+		test_log_err("Test: edges read twice %s\n", "");
+		result = -1;
+	}
+
+	recorder_map_close(&map);
+	if (0 == result) {
+		test_log_info("Test: edges %s\n", "OK");
+	}
+	return result;
+}
+
+
+
+
+/// A reader that falls behind by more than capacity of the ring loses
+/// oldest edges, and is told how many were lost.
+static int test_recorder_overrun(void)
+{
+	cwdevice dev;
+	if (0 != open_device(&dev)) {
+		return -1;
+	}
+	recorder_map_t map = { 0 };
+	if (0 != recorder_map_open(&map, g_path)) {
+		test_log_err("Test: failed to map file %s\n", g_path);
+		close_device(&dev);
+		return -1;
+	}
+
+	// Two edges were recorded by init. Add more than fits in the ring.
+	unsigned int const extra = 10;
+	for (unsigned int i = 0; i < RECORDER_CAPACITY_DEFAULT + extra; i++) {
+		dev.cw(&dev, (int) ((i + 1) % 2));
+	}
+
+	recorder_edge_t edges[1000];
+	size_t total = 0;
+	size_t n = 0;
+	uint32_t expected_value = 1;
+	int result = 0;
+	while (0 != (n = recorder_map_read(&map, edges, sizeof (edges) / sizeof (edges[0])))) {
+		for (size_t i = 0; 0 == result && i < n; i++) {
+			if (RECORDER_LINE_KEY != edges[i].line) {
+				test_log_err("Test: unexpected line %u of edge #%zu\n", edges[i].line, total + i);
+				result = -1;
+			}
+			if (0 == total + i) {
+				expected_value = edges[i].value;
+			} else if (edges[i].value != expected_value) {
+				test_log_err("Test: unexpected value of edge #%zu\n", total + i);
+				result = -1;
+			}
+			expected_value = !expected_value;
+		}
+		total += n;
+	}
+	if (total != RECORDER_CAPACITY_DEFAULT || map.lost != 2 + extra) {
+		test_log_err("Test: read %zu edges, lost %lu, expected %u and %u\n",
+		             total, (unsigned long) map.lost, RECORDER_CAPACITY_DEFAULT, 2 + extra);
+		result = -1;
+	}
+
+	recorder_map_close(&map);
+	close_device(&dev);
+	if (0 == result) {
+		test_log_info("Test: overrun %s\n", "OK");
+	}
+	return result;
+}
+
@@ -0,0 +1,183 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for cwdaemon/src/rt.c.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "src/cwdaemon.h"
+#include "src/rt.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+#define TEST_RT_PRIORITY  10
+
+
+
+
+/// Scheduling policy of a thread, observed by the thread itself.
+typedef struct {
+	bool apply;          ///< Should the thread apply real-time profile?
+	bool granted;        ///< Result of rt_thread_apply().
+	int policy;          ///< Policy after (optional) rt_thread_apply().
+	int priority;
+	int restored_policy; ///< Policy after rt_thread_restore().
+} observed_t;
+
+
+
+
+static int test_rt_thread_apply(void);
+
+static void * observer_thread_fn(void * arg);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_rt_thread_apply,
+	NULL
+};
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+
+	int rv = 0;
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			rv = -1;
+			break;
+		}
+		i++;
+	}
+
+	if (0 == rv) {
+		test_log_info("Test result: PASS %s\n", "");
+	}
+	return rv;
+}
+
+
+
+
+/// @brief Real-time profile is applied only to threads that ask for it
+///
+/// Main thread and threads that it creates afterwards keep the default
+/// scheduling policy.
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_rt_thread_apply(void)
+{
+	rt_profile_t const profile = { .priority = TEST_RT_PRIORITY, .cpus = 0 };
+	rt_profile_set(&profile);
+
+	observed_t keying = { .apply = true };
+	observed_t helper = { .apply = false };
+	pthread_t thread;
+	pthread_create(&thread, NULL, observer_thread_fn, &keying);
+	pthread_join(thread, NULL);
+	pthread_create(&thread, NULL, observer_thread_fn, &helper);
+	pthread_join(thread, NULL);
+
+	int policy = 0;
+	struct sched_param param = { 0 };
+	pthread_getschedparam(pthread_self(), &policy, &param);
+	if (SCHED_OTHER != policy) {
+		test_log_err("Main thread has changed its policy to %d\n", policy);
+		return -1;
+	}
+	if (SCHED_OTHER != helper.policy) {
+		test_log_err("Helper thread has inherited policy %d\n", helper.policy);
+		return -1;
+	}
+	if (!keying.granted) {
+		/* No privileges for real-time scheduling, the rest can't be tested. */
+		test_log_info("Real-time scheduling has not been granted, skipping checks of keying thread %s\n", "");
+	} else if (SCHED_FIFO != keying.policy || TEST_RT_PRIORITY != keying.priority) {
+		test_log_err("Unexpected policy %d with priority %d of keying thread\n", keying.policy, keying.priority);
+		return -1;
+	} else if (SCHED_OTHER != keying.restored_policy) {
+		test_log_err("Policy of keying thread has not been restored: %d\n", keying.restored_policy);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+static void * observer_thread_fn(void * arg)
+{
+	observed_t * const observed = (observed_t *) arg;
+	if (observed->apply) {
+		observed->granted = rt_thread_apply("test");
+	}
+
+	struct sched_param param = { 0 };
+	pthread_getschedparam(pthread_self(), &observed->policy, &param);
+	observed->priority = param.sched_priority;
+
+	rt_thread_restore();
+	pthread_getschedparam(pthread_self(), &observed->restored_policy, &param);
+
+	return NULL;
+}
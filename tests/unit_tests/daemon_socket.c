@@ -0,0 +1,503 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for cwdaemon/src/socket.c.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "src/cwdaemon.h"
+#include "src/socket.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+static int test_socket_activation_none(void);
+static int test_socket_activation_other_pid(void);
+static int test_socket_activation_udp(void);
+static int test_socket_activation_tcp(void);
+static int test_unix_socket(void);
+static int test_unix_socket_not_a_socket(void);
+static int test_recvfrom_fairness(void);
+
+static int pass_socket(int type, in_port_t * port);
+static void set_env(long pid, char const * fds);
+static bool env_is_cleared(void);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_socket_activation_none,
+	test_socket_activation_other_pid,
+	test_socket_activation_udp,
+	test_socket_activation_tcp,
+	test_unix_socket,
+	test_unix_socket_not_a_socket,
+	test_recvfrom_fairness,
+	NULL
+};
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+
+	int rv = 0;
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			rv = -1;
+			break;
+		}
+		i++;
+	}
+
+	if (0 == rv) {
+		test_log_info("Test result: PASS %s\n", "");
+	}
+	return rv;
+}
+
+
+
+
+/// @brief Without socket activation variables no socket is taken over
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_socket_activation_none(void)
+{
+	cwdaemon_t cwdaemon = { .socket_descriptor = -1, .unix_socket_descriptor = -1, .network_port = CWDAEMON_NETWORK_PORT_DEFAULT };
+
+	unsetenv(SOCKET_ACTIVATION_ENV_PID);
+	unsetenv(SOCKET_ACTIVATION_ENV_FDS);
+	if (0 != cwdaemon_socket_activation(&cwdaemon)
+	    || -1 != cwdaemon.socket_descriptor || CWDAEMON_NETWORK_PORT_DEFAULT != cwdaemon.network_port) {
+		test_log_err("Unexpected socket taken over without socket activation %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Socket passed to other process (e.g. parent) is not taken over
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_socket_activation_other_pid(void)
+{
+	cwdaemon_t cwdaemon = { .socket_descriptor = -1, .unix_socket_descriptor = -1, .network_port = CWDAEMON_NETWORK_PORT_DEFAULT };
+	in_port_t port = 0;
+	if (0 != pass_socket(SOCK_DGRAM, &port)) {
+		return -1;
+	}
+
+	set_env((long) getppid(), "1");
+	int const rv = cwdaemon_socket_activation(&cwdaemon);
+	close(SOCKET_ACTIVATION_FD_START);
+
+	if (0 != rv || -1 != cwdaemon.socket_descriptor) {
+		test_log_err("Socket of other process has been taken over %s\n", "");
+		return -1;
+	}
+	if (!env_is_cleared()) {
+		test_log_err("Socket activation variables have not been removed from environment %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief UDP socket passed to this process is taken over together with its port
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_socket_activation_udp(void)
+{
+	cwdaemon_t cwdaemon = { .socket_descriptor = -1, .unix_socket_descriptor = -1, .network_port = CWDAEMON_NETWORK_PORT_DEFAULT };
+	in_port_t port = 0;
+	if (0 != pass_socket(SOCK_DGRAM, &port)) {
+		return -1;
+	}
+
+	set_env((long) getpid(), "1");
+	int const rv = cwdaemon_socket_activation(&cwdaemon);
+	bool const initialized = 1 == rv && cwdaemon_initialize_socket(&cwdaemon);
+	int const fd = cwdaemon.socket_descriptor;
+	cwdaemon_close_socket(&cwdaemon);
+
+	if (1 != rv || !initialized || SOCKET_ACTIVATION_FD_START != fd) {
+		test_log_err("Passed UDP socket has not been taken over: rv = %d, fd = %d\n", rv, fd);
+		return -1;
+	}
+	if (port != cwdaemon.network_port) {
+		test_log_err("Unexpected port of passed socket: %u, expected %u\n", (unsigned int) cwdaemon.network_port, (unsigned int) port);
+		return -1;
+	}
+	if (!env_is_cleared()) {
+		test_log_err("Socket activation variables have not been removed from environment %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Passed socket of other type than UDP is rejected
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_socket_activation_tcp(void)
+{
+	cwdaemon_t cwdaemon = { .socket_descriptor = -1, .unix_socket_descriptor = -1, .network_port = CWDAEMON_NETWORK_PORT_DEFAULT };
+	in_port_t port = 0;
+	if (0 != pass_socket(SOCK_STREAM, &port)) {
+		return -1;
+	}
+
+	set_env((long) getpid(), "1");
+	int const rv = cwdaemon_socket_activation(&cwdaemon);
+	close(SOCKET_ACTIVATION_FD_START);
+
+	if (-1 != rv || -1 != cwdaemon.socket_descriptor) {
+		test_log_err("Passed TCP socket has not been rejected: rv = %d\n", rv);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Request received through Unix-domain socket is replied to through the same socket
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_unix_socket(void)
+{
+	char path[64] = { 0 };
+	snprintf(path, sizeof (path), "/tmp/cwdaemon_socket_test_%ld", (long) getpid());
+	struct sockaddr_un client_addr = { .sun_family = AF_UNIX };
+	snprintf(client_addr.sun_path, sizeof (client_addr.sun_path), "/tmp/cwdaemon_socket_client_%ld", (long) getpid());
+	unlink(client_addr.sun_path);
+
+	/* Socket file left by crashed process is replaced. */
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof (addr.sun_path), "%s", path);
+	int const stale = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (-1 == stale || 0 != bind(stale, (struct sockaddr *) &addr, sizeof (addr))) {
+		test_log_err("Failed to create stale socket file [%s]\n", path);
+		return -1;
+	}
+	close(stale);
+
+	int const rcvbuf = 65536;
+	cwdaemon_t cwdaemon = { .socket_descriptor = -1, .unix_socket_descriptor = -1, .network_port = 0,
+	                        .unix_socket_path = path, .unix_rcvbuf = rcvbuf };
+	/* Like in daemonized process. */
+	mode_t const test_umask = umask(0);
+	bool const initialized = cwdaemon_initialize_socket(&cwdaemon);
+	if (0 != umask(test_umask)) {
+		test_log_err("Umask of process has not been restored %s\n", "");
+		cwdaemon_close_socket(&cwdaemon);
+		return -1;
+	}
+	if (!initialized) {
+		test_log_err("Failed to initialize sockets %s\n", "");
+		cwdaemon_close_socket(&cwdaemon);
+		return -1;
+	}
+
+	int rv = 0;
+	struct stat st = { 0 };
+	int actual_rcvbuf = 0;
+	socklen_t len = sizeof (actual_rcvbuf);
+	if (0 != stat(path, &st) || !S_ISSOCK(st.st_mode) || (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) != (st.st_mode & 0777)) {
+		test_log_err("Unexpected socket file [%s], mode 0%o\n", path, (unsigned int) (st.st_mode & 0777));
+		rv = -1;
+	} else if (0 != getsockopt(cwdaemon.unix_socket_descriptor, SOL_SOCKET, SO_RCVBUF, &actual_rcvbuf, &len)
+	           || actual_rcvbuf < rcvbuf) {
+		test_log_err("Unexpected receive buffer of Unix-domain socket: %d bytes\n", actual_rcvbuf);
+		rv = -1;
+	}
+
+	int const client = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (0 == rv && (-1 == client || 0 != bind(client, (struct sockaddr *) &client_addr, sizeof (client_addr))
+	                || 7 != sendto(client, "paris\r\n", 7, 0, (struct sockaddr *) &addr, sizeof (addr)))) {
+		test_log_err("Failed to send request through Unix-domain socket %s\n", "");
+		rv = -1;
+	}
+
+	char request[CWDAEMON_REQUEST_SIZE_MAX + 1] = { 0 };
+	if (0 == rv) {
+		ssize_t const n = cwdaemon_recvfrom(&cwdaemon, request, CWDAEMON_REQUEST_SIZE_MAX);
+		if (5 != n || 0 != strcmp(request, "paris") || AF_UNIX != cwdaemon.request_addr.ss_family) {
+			test_log_err("Unexpected request received through Unix-domain socket: %zd bytes [%s]\n", n, request);
+			rv = -1;
+		}
+	}
+
+	char reply[16] = { 0 };
+	if (0 == rv) {
+		memcpy(&cwdaemon.reply_addr, &cwdaemon.request_addr, sizeof (cwdaemon.reply_addr));
+		cwdaemon.reply_addrlen = cwdaemon.request_addrlen;
+		if (7 != cwdaemon_sendto(&cwdaemon, "paris\r\n")
+		    || 7 != recv(client, reply, sizeof (reply), MSG_DONTWAIT)
+		    || 0 != strcmp(reply, "paris\r\n")) {
+			test_log_err("Client hasn't received reply through Unix-domain socket: [%s]\n", reply);
+			rv = -1;
+		}
+	}
+
+	if (-1 != client) {
+		close(client);
+	}
+	unlink(client_addr.sun_path);
+	cwdaemon_close_socket(&cwdaemon);
+	if (0 == rv && 0 == lstat(path, &st)) {
+		test_log_err("Socket file [%s] has not been removed\n", path);
+		rv = -1;
+	}
+	unlink(path);
+
+	if (0 == rv) {
+		test_log_info("Test result: PASS %s\n", "");
+	}
+	return rv;
+}
+
+
+
+
+/// @brief Busy client of UDP socket doesn't starve client of Unix-domain socket
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_recvfrom_fairness(void)
+{
+	char path[64] = { 0 };
+	snprintf(path, sizeof (path), "/tmp/cwdaemon_socket_fair_%ld", (long) getpid());
+	cwdaemon_t cwdaemon = { .socket_descriptor = -1, .unix_socket_descriptor = -1, .network_port = 0,
+	                        .unix_socket_path = path };
+	if (!cwdaemon_initialize_socket(&cwdaemon)) {
+		test_log_err("Failed to initialize sockets %s\n", "");
+		cwdaemon_close_socket(&cwdaemon);
+		return -1;
+	}
+
+	struct sockaddr_in udp_addr = { 0 };
+	socklen_t udp_addr_len = sizeof (udp_addr);
+	getsockname(cwdaemon.socket_descriptor, (struct sockaddr *) &udp_addr, &udp_addr_len);
+	udp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	struct sockaddr_un unix_addr = { .sun_family = AF_UNIX };
+	snprintf(unix_addr.sun_path, sizeof (unix_addr.sun_path), "%s", path);
+
+	/* UDP socket has more requests waiting than can be read in the
+	   test, Unix-domain socket has one. */
+	int rv = 0;
+	int const udp_client = socket(AF_INET, SOCK_DGRAM, 0);
+	int const unix_client = socket(AF_UNIX, SOCK_DGRAM, 0);
+	for (int i = 0; 0 == rv && i < 4; i++) {
+		if (3 != sendto(udp_client, "udp", 3, 0, (struct sockaddr *) &udp_addr, udp_addr_len)) {
+			test_log_err("Failed to send request through UDP socket %s\n", "");
+			rv = -1;
+		}
+	}
+	if (0 == rv && 4 != sendto(unix_client, "unix", 4, 0, (struct sockaddr *) &unix_addr, sizeof (unix_addr))) {
+		test_log_err("Failed to send request through Unix-domain socket %s\n", "");
+		rv = -1;
+	}
+
+	bool unix_received = false;
+	for (int i = 0; 0 == rv && i < 2; i++) {
+		char request[CWDAEMON_REQUEST_SIZE_MAX + 1] = { 0 };
+		ssize_t const n = cwdaemon_recvfrom(&cwdaemon, request, CWDAEMON_REQUEST_SIZE_MAX);
+		if (n <= 0) {
+			test_log_err("Failed to receive request #%d: %zd\n", i, n);
+			rv = -1;
+		} else if (0 == strcmp(request, "unix")) {
+			unix_received = true;
+		}
+	}
+	if (0 == rv && !unix_received) {
+		test_log_err("Request in Unix-domain socket has waited for requests in UDP socket %s\n", "");
+		rv = -1;
+	}
+
+	close(udp_client);
+	close(unix_client);
+	cwdaemon_close_socket(&cwdaemon);
+	unlink(path);
+
+	if (0 == rv) {
+		test_log_info("Test result: PASS %s\n", "");
+	}
+	return rv;
+}
+
+
+
+
+/// @brief File at path of Unix-domain socket that is not a socket is not replaced
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_unix_socket_not_a_socket(void)
+{
+	char path[64] = { 0 };
+	snprintf(path, sizeof (path), "/tmp/cwdaemon_socket_test_%ld", (long) getpid());
+	int const fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (-1 == fd) {
+		test_log_err("Failed to create regular file [%s]\n", path);
+		return -1;
+	}
+	close(fd);
+
+	cwdaemon_t cwdaemon = { .socket_descriptor = -1, .unix_socket_descriptor = -1, .network_port = 0,
+	                        .unix_socket_path = path };
+	bool const initialized = cwdaemon_initialize_socket(&cwdaemon);
+	cwdaemon_close_socket(&cwdaemon);
+	struct stat st = { 0 };
+	bool const kept = 0 == lstat(path, &st) && S_ISREG(st.st_mode);
+	unlink(path);
+
+	if (initialized || !kept) {
+		test_log_err("Regular file has been replaced with socket: initialized = %d, kept = %d\n", initialized, kept);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Bind socket to ephemeral port on loopback, put it at descriptor 3
+///
+/// @param[in] type type of socket
+/// @param[out] port port to which the socket has been bound
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int pass_socket(int type, in_port_t * port)
+{
+	int const fd = socket(AF_INET, type, 0);
+	if (-1 == fd) {
+		test_log_err("Failed to create socket %s\n", "");
+		return -1;
+	}
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = 0, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t addr_len = sizeof (addr);
+	if (0 != bind(fd, (struct sockaddr *) &addr, addr_len)
+	    || 0 != getsockname(fd, (struct sockaddr *) &addr, &addr_len)) {
+		test_log_err("Failed to bind socket %s\n", "");
+		close(fd);
+		return -1;
+	}
+	if (SOCKET_ACTIVATION_FD_START != fd) {
+		if (-1 == dup2(fd, SOCKET_ACTIVATION_FD_START)) {
+			test_log_err("Failed to move socket to descriptor %d\n", SOCKET_ACTIVATION_FD_START);
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+
+	*port = ntohs(addr.sin_port);
+	return 0;
+}
+
+
+
+
+static void set_env(long pid, char const * fds)
+{
+	char value[32] = { 0 };
+	snprintf(value, sizeof (value), "%ld", pid);
+	setenv(SOCKET_ACTIVATION_ENV_PID, value, 1);
+	setenv(SOCKET_ACTIVATION_ENV_FDS, fds, 1);
+	setenv(SOCKET_ACTIVATION_ENV_FDNAMES, "cwdaemon.socket", 1);
+}
+
+
+
+
+static bool env_is_cleared(void)
+{
+	return NULL == getenv(SOCKET_ACTIVATION_ENV_PID)
+		&& NULL == getenv(SOCKET_ACTIVATION_ENV_FDS)
+		&& NULL == getenv(SOCKET_ACTIVATION_ENV_FDNAMES);
+}
+
@@ -0,0 +1,312 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for cwdaemon/src/sound.c.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/select.h>
+#include <time.h>
+
+#include "src/cwdaemon.h"
+#include "src/engine.h"
+#include "src/sound.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+static int test_sound_probe(void);
+static int test_sound_busy(void);
+static int test_sound_cache(void);
+static int test_sound_no_sidetone(void);
+
+static bool wait_for_result(int * audio_system, bool * available, int timeout_ms);
+static bool wait_for_fd(int timeout_ms);
+static bool fake_probe(int audio_system);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_sound_probe,
+	test_sound_busy,
+	test_sound_cache,
+	test_sound_no_sidetone,
+	NULL
+};
+
+
+
+
+/// Count of calls of fake_probe().
+static int g_probes = 0;
+/// fake_probe() waits for the semaphore when this is true.
+static bool g_probe_blocks = false;
+static sem_t g_probe_release;
+
+static engine_t const g_engine = { .name = "fake", .has_sidetone = true, .probe = fake_probe };
+static engine_t const g_engine_silent = { .name = "silent", .has_sidetone = false };
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+	sem_init(&g_probe_release, 0, 0);
+
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			return -1;
+		}
+		i++;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Results of probes done by engine are delivered through file descriptor
+static int test_sound_probe(void)
+{
+	int const expected[] = { CW_AUDIO_ALSA, CW_AUDIO_PA };
+	bool const expected_available[] = { true, false };
+
+	for (size_t i = 0; i < sizeof (expected) / sizeof (expected[0]); i++) {
+		int const probes = g_probes;
+		if (0 != sound_probe_start(&g_engine, expected[i])) {
+			test_log_err("Test: failed to start probe of %d\n", expected[i]);
+			return -1;
+		}
+		int audio_system = CW_AUDIO_NONE;
+		bool available = false;
+		if (!wait_for_result(&audio_system, &available, 1000)) {
+			test_log_err("Test: no result of probe of %d\n", expected[i]);
+			return -1;
+		}
+		if (audio_system != expected[i] || available != expected_available[i] || g_probes != probes + 1) {
+			test_log_err("Test: unexpected result of probe: %d/%d, probes = %d\n", audio_system, available, g_probes - probes);
+			return -1;
+		}
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Second probe can't be started while first one is running
+static int test_sound_busy(void)
+{
+	g_probe_blocks = true;
+	if (0 != sound_probe_start(&g_engine, CW_AUDIO_CONSOLE)) {
+		test_log_err("Test: failed to start first probe %s\n", "");
+		return -1;
+	}
+	bool const running = sound_probe_is_running();
+	int const second = sound_probe_start(&g_engine, CW_AUDIO_OSS);
+
+	// Main loop keeps working while the probe is blocked.
+	int audio_system = CW_AUDIO_NONE;
+	bool available = false;
+	bool const early = wait_for_result(&audio_system, &available, 50);
+
+	g_probe_blocks = false;
+	sem_post(&g_probe_release);
+	if (!running || -1 != second || early) {
+		test_log_err("Test: running = %d, second = %d, early result = %d\n", running, second, early);
+		return -1;
+	}
+	// Result has been delivered, but main loop hasn't read it yet: next
+	// probe can't be started, the result belongs to the first request.
+	if (!wait_for_fd(1000) || !sound_probe_is_running() || -1 != sound_probe_start(&g_engine, CW_AUDIO_OSS)) {
+		test_log_err("Test: second probe has been started before result of first probe has been read %s\n", "");
+		return -1;
+	}
+	if (!sound_read(&audio_system, &available) || CW_AUDIO_CONSOLE != audio_system) {
+		test_log_err("Test: no result of first probe %s\n", "");
+		return -1;
+	}
+	// "Running" flag is cleared when the result is read.
+	if (sound_probe_is_running()) {
+		test_log_err("Test: probe is still running %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Known results are delivered from cache, without calling engine
+static int test_sound_cache(void)
+{
+	// ALSA and PulseAudio have been probed in first test, Null needs no
+	// probe, and OSS is known to be unavailable after failed open.
+	sound_set_available(CW_AUDIO_OSS, false);
+	int const systems[] = { CW_AUDIO_ALSA, CW_AUDIO_PA, CW_AUDIO_NULL, CW_AUDIO_OSS };
+	bool const expected_available[] = { true, false, true, false };
+
+	int const probes = g_probes;
+	for (size_t i = 0; i < sizeof (systems) / sizeof (systems[0]); i++) {
+		if (0 != sound_probe_start(&g_engine, systems[i])) {
+			test_log_err("Test: failed to start probe of %d\n", systems[i]);
+			return -1;
+		}
+		// Cached result is pending until it's read, too.
+		if (!sound_probe_is_running() || -1 != sound_probe_start(&g_engine, CW_AUDIO_CONSOLE)) {
+			test_log_err("Test: probe has been started while cached result of %d is pending\n", systems[i]);
+			return -1;
+		}
+		int audio_system = CW_AUDIO_NONE;
+		bool available = false;
+		if (!wait_for_result(&audio_system, &available, 1000)
+		    || audio_system != systems[i]
+		    || available != expected_available[i]) {
+			test_log_err("Test: unexpected result for %d: %d/%d\n", systems[i], audio_system, available);
+			return -1;
+		}
+		if (wait_for_result(&audio_system, &available, 0)) {
+			test_log_err("Test: unexpected extra result %d\n", audio_system);
+			return -1;
+		}
+	}
+	if (g_probes != probes) {
+		test_log_err("Test: engine has been called %d times\n", g_probes - probes);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Engine without sidetone can use only Null sound system
+static int test_sound_no_sidetone(void)
+{
+	int const systems[] = { CW_AUDIO_SOUNDCARD, CW_AUDIO_NULL };
+	bool const expected_available[] = { false, true };
+
+	for (size_t i = 0; i < sizeof (systems) / sizeof (systems[0]); i++) {
+		if (0 != sound_probe_start(&g_engine_silent, systems[i])) {
+			test_log_err("Test: failed to start probe of %d\n", systems[i]);
+			return -1;
+		}
+		int audio_system = CW_AUDIO_NONE;
+		bool available = false;
+		if (!wait_for_result(&audio_system, &available, 1000) || available != expected_available[i]) {
+			test_log_err("Test: unexpected result for %d: %d\n", systems[i], available);
+			return -1;
+		}
+	}
+	if (-1 != sound_probe_start(&g_engine_silent, CW_AUDIO_SOUNDCARD + 1)) {
+		test_log_err("Test: probe of invalid sound system has been started %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// Wait for result like main loop of cwdaemon does.
+static bool wait_for_result(int * audio_system, bool * available, int timeout_ms)
+{
+	if (!wait_for_fd(timeout_ms)) {
+		return false;
+	}
+	return sound_read(audio_system, available);
+}
+
+
+
+
+/// Wait until a result can be read, without reading it.
+static bool wait_for_fd(int timeout_ms)
+{
+	int const fd = sound_get_fd();
+	if (-1 == fd) {
+		return false;
+	}
+	fd_set readfd;
+	FD_ZERO(&readfd);
+	FD_SET(fd, &readfd);
+	struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+	return select(fd + 1, &readfd, NULL, NULL, &tv) > 0;
+}
+
+
+
+
+/// ALSA and Console are available, other sound systems are not.
+static bool fake_probe(int audio_system)
+{
+	__atomic_add_fetch(&g_probes, 1, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&g_probe_blocks, __ATOMIC_ACQUIRE)) {
+		while (0 != sem_wait(&g_probe_release) && EINTR == errno) {
+			;
+		}
+	}
+	return CW_AUDIO_ALSA == audio_system || CW_AUDIO_CONSOLE == audio_system;
+}
+
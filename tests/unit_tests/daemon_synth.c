@@ -0,0 +1,412 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+/// @file
+///
+/// Unit tests for cwdaemon/src/synth.c.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/cwdaemon.h"
+#include "src/synth.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+#define TEST_RATE  48000
+
+/// Amplitude of tone at volume used in tests (see SYNTH_AMPLITUDE_MAX in synth.c).
+#define TEST_AMPLITUDE  (32000 * 70 / 100)
+
+
+
+
+typedef struct {
+	int16_t * frames;
+	size_t count;
+	size_t capacity;
+} test_buffer_t;
+
+
+
+
+static int test_synth_init(void);
+static int test_synth_envelope(void);
+static int test_synth_frequency(void);
+static int test_synth_elements(void);
+static int test_synth_wav_header(void);
+
+static int buffer_write(void * arg, int16_t const * frames, size_t count);
+static int max_delta(int16_t const * frames, size_t count);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_synth_init,
+	test_synth_envelope,
+	test_synth_frequency,
+	test_synth_elements,
+	test_synth_wav_header,
+	NULL
+};
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			return -1;
+		}
+		i++;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Invalid parameters are rejected, length of envelope follows rise time
+static int test_synth_init(void)
+{
+	static synth_t synth;
+
+	if (0 == synth_init(&synth, 0, SYNTH_RISE_US_DEFAULT)
+	    || 0 == synth_init(&synth, SYNTH_SAMPLE_RATE_MAX + 1, SYNTH_RISE_US_DEFAULT)
+	    || 0 == synth_init(&synth, TEST_RATE, SYNTH_RISE_US_MAX + 1)) {
+		test_log_err("Test: invalid parameters have been accepted %s\n", "");
+		return -1;
+	}
+
+	struct {
+		unsigned int rate;
+		unsigned int rise_us;
+		unsigned int expected_len;
+	} const cases[] = {
+		{ TEST_RATE,             5000,  240 },
+		{ TEST_RATE,                0,    1 },
+		{ 8000,                  2000,   16 },
+		{ SYNTH_SAMPLE_RATE_MAX, SYNTH_RISE_US_MAX, SYNTH_RAMP_FRAMES_MAX },
+	};
+	for (size_t i = 0; i < sizeof (cases) / sizeof (cases[0]); i++) {
+		if (0 != synth_init(&synth, cases[i].rate, cases[i].rise_us)) {
+			test_log_err("Test: failed to initialize synthesizer #%zu\n", i);
+			return -1;
+		}
+		if (synth.ramp_len != cases[i].expected_len || !synth_is_silent(&synth)) {
+			test_log_err("Test: unexpected length of envelope in case #%zu: %u\n", i, synth.ramp_len);
+			return -1;
+		}
+		/* Envelope must rise monotonically, symmetrically around 0.5. */
+		for (unsigned int k = 0; k < synth.ramp_len; k++) {
+			float const sum = synth.ramp[k] + synth.ramp[synth.ramp_len - 1 - k];
+			if (synth.ramp[k] <= 0.0f || synth.ramp[k] >= 1.0f
+			    || (k > 0 && synth.ramp[k] <= synth.ramp[k - 1])
+			    || sum < 0.999f || sum > 1.001f) {
+				test_log_err("Test: invalid envelope in case #%zu at %u: %f\n", i, k, (double) synth.ramp[k]);
+				return -1;
+			}
+		}
+	}
+
+	test_log_info("Test: initialization of synthesizer %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Marks start and end without clicks
+///
+/// A click is a step between two consecutive samples larger than the
+/// steepest step of sine wave of full amplitude. The test also splits
+/// rendering into pieces of different sizes, like sidetone thread does
+/// at edges, which must not change the output.
+static int test_synth_envelope(void)
+{
+	static synth_t synth;
+	static synth_t synth_split;
+	int const frequencies[] = { 300, 800, 1500 };
+	size_t const silence = 480;
+	size_t const mark = 2400;
+	size_t const total = silence + mark + silence;
+
+	for (size_t f = 0; f < sizeof (frequencies) / sizeof (frequencies[0]); f++) {
+		synth_init(&synth, TEST_RATE, SYNTH_RISE_US_DEFAULT);
+		synth_init(&synth_split, TEST_RATE, SYNTH_RISE_US_DEFAULT);
+		synth_set_frequency(&synth, frequencies[f]);
+		synth_set_frequency(&synth_split, frequencies[f]);
+
+		int16_t out[3360] = { 0 };
+		synth_render(&synth, false, out, silence);
+		synth_render(&synth, true, out + silence, mark);
+		synth_render(&synth, false, out + silence + mark, silence);
+
+		int16_t split[3360] = { 0 };
+		size_t done = 0;
+		size_t const pieces[] = { 1, 7, 472, 100, 3, 2297, 13, 467 };
+		bool const keys[] = { false, false, false, true, true, true, false, false };
+		for (size_t p = 0; p < sizeof (pieces) / sizeof (pieces[0]); p++) {
+			synth_render(&synth_split, keys[p], split + done, pieces[p]);
+			done += pieces[p];
+		}
+		if (done != total || 0 != memcmp(out, split, sizeof (out))) {
+			test_log_err("Test: output depends on sizes of rendered pieces at %d Hz\n", frequencies[f]);
+			return -1;
+		}
+
+		/* Trailing silence starts after fall of envelope. */
+		for (size_t i = 0; i < silence; i++) {
+			if (0 != out[i] || (i < silence - synth.ramp_len && 0 != out[total - 1 - i])) {
+				test_log_err("Test: non-zero sample in silence at %d Hz\n", frequencies[f]);
+				return -1;
+			}
+		}
+		if (!synth_is_silent(&synth)) {
+			test_log_err("Test: envelope has not fallen at %d Hz\n", frequencies[f]);
+			return -1;
+		}
+
+		/* Steepest step of sine, plus margin for interpolation and
+		   rounding. */
+		int const limit = (int) (TEST_AMPLITUDE * 2 * 3.1416 * frequencies[f] / TEST_RATE) + 4;
+		int const delta = max_delta(out, total);
+		if (delta > limit) {
+			test_log_err("Test: click at %d Hz: step %d, limit %d\n", frequencies[f], delta, limit);
+			return -1;
+		}
+
+		/* The steps of envelope alone must be small too: first and
+		   last samples of mark are close to zero. */
+		int const edge_limit = limit / 10;
+		if (abs(out[silence]) > edge_limit || abs(out[silence + mark + synth.ramp_len - 1]) > edge_limit) {
+			test_log_err("Test: mark doesn't start or end at zero at %d Hz: %d, %d\n",
+			             frequencies[f], out[silence], out[silence + mark + synth.ramp_len - 1]);
+			return -1;
+		}
+	}
+
+	test_log_info("Test: envelope without clicks %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Frequency of tone, measured with count of zero crossings
+static int test_synth_frequency(void)
+{
+	static synth_t synth;
+	int const frequencies[] = { 100, 700, 1234, 4000 };
+
+	for (size_t f = 0; f < sizeof (frequencies) / sizeof (frequencies[0]); f++) {
+		synth_init(&synth, TEST_RATE, SYNTH_RISE_US_DEFAULT);
+		synth_set_frequency(&synth, frequencies[f]);
+
+		/* Skip rise of envelope, then measure during one second. */
+		static int16_t out[TEST_RATE];
+		synth_render(&synth, true, out, synth.ramp_len);
+		synth_render(&synth, true, out, TEST_RATE);
+
+		int crossings = 0;
+		int peak = 0;
+		for (size_t i = 1; i < TEST_RATE; i++) {
+			if (out[i - 1] < 0 && out[i] >= 0) {
+				crossings++;
+			}
+			peak = abs(out[i]) > peak ? abs(out[i]) : peak;
+		}
+		if (crossings < frequencies[f] - 1 || crossings > frequencies[f] + 1) {
+			test_log_err("Test: expected %d Hz, measured %d Hz\n", frequencies[f], crossings);
+			return -1;
+		}
+		if (peak < TEST_AMPLITUDE - 2 * TEST_AMPLITUDE / 100 || peak > TEST_AMPLITUDE) {
+			test_log_err("Test: unexpected amplitude at %d Hz: %d\n", frequencies[f], peak);
+			return -1;
+		}
+	}
+
+	test_log_info("Test: frequency of tone %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Rendering of keying schedule: placement of marks, length of output
+///
+/// Midpoints of rise and fall of envelope are at half of length of
+/// envelope after edges, so distance between the midpoints is equal to
+/// duration of a mark.
+static int test_synth_elements(void)
+{
+	static synth_t synth;
+	synth_init(&synth, TEST_RATE, SYNTH_RISE_US_DEFAULT);
+	synth_set_frequency(&synth, 1000);
+
+	/* "ET" at 20 wpm with durations that don't map to whole frames. */
+	engine_native_element_t const elements[] = {
+		{ .duration_us =  60013, .key = true },
+		{ .duration_us =  60013, .key = false },
+		{ .duration_us = 120041, .key = false },
+		{ .duration_us = 180039, .key = true },
+		{ .duration_us =  60013, .key = false },
+	};
+	size_t const count = sizeof (elements) / sizeof (elements[0]);
+
+	test_buffer_t buffer = { .capacity = TEST_RATE };
+	buffer.frames = calloc(buffer.capacity, sizeof (int16_t));
+	int64_t const frames = synth_render_elements(&synth, elements, count, buffer_write, &buffer);
+
+	uint64_t total_us = 0;
+	for (size_t i = 0; i < count; i++) {
+		total_us += (uint64_t) elements[i].duration_us;
+	}
+	if (frames < 0 || (uint64_t) frames != synth_us_to_frames(&synth, total_us) || (size_t) frames != buffer.count) {
+		test_log_err("Test: unexpected count of frames: %lld\n", (long long) frames);
+		free(buffer.frames);
+		return -1;
+	}
+
+	/* Find marks as ranges of samples with absolute value above half of
+	   amplitude. Tolerance is one period of the tone. */
+	uint64_t const expected_start[] = { 0, synth_us_to_frames(&synth, 60013 + 60013 + 120041) };
+	uint64_t const expected_len[] = { synth_us_to_frames(&synth, 60013), synth_us_to_frames(&synth, 180039) };
+	int64_t const tolerance = TEST_RATE / 1000;
+	size_t mark = 0;
+	size_t i = 0;
+	while (i < buffer.count && mark < 2) {
+		if (abs(buffer.frames[i]) < TEST_AMPLITUDE / 2) {
+			i++;
+			continue;
+		}
+		size_t const start = i;
+		size_t last = i;
+		for (; i < buffer.count && (int64_t) i - (int64_t) last < tolerance; i++) {
+			if (abs(buffer.frames[i]) >= TEST_AMPLITUDE / 2) {
+				last = i;
+			}
+		}
+		int64_t const start_error = (int64_t) start - (int64_t) (expected_start[mark] + synth.ramp_len / 2);
+		int64_t const len_error = (int64_t) (last - start) - (int64_t) expected_len[mark];
+		if (llabs(start_error) > tolerance || llabs(len_error) > tolerance) {
+			test_log_err("Test: mark #%zu: start at %zu, length %zu, expected %llu, %llu\n",
+			             mark, start, last - start, (unsigned long long) expected_start[mark], (unsigned long long) expected_len[mark]);
+			free(buffer.frames);
+			return -1;
+		}
+		mark++;
+	}
+	free(buffer.frames);
+	if (2 != mark) {
+		test_log_err("Test: found %zu marks\n", mark);
+		return -1;
+	}
+
+	test_log_info("Test: rendering of keying schedule %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Header of WAV file
+static int test_synth_wav_header(void)
+{
+	uint8_t const expected[SYNTH_WAV_HEADER_SIZE] = {
+		'R', 'I', 'F', 'F', 0x24, 0x77, 0x01, 0x00, 'W', 'A', 'V', 'E',
+		'f', 'm', 't', ' ', 0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00,
+		0x80, 0xbb, 0x00, 0x00, 0x00, 0x77, 0x01, 0x00, 0x02, 0x00, 0x10, 0x00,
+		'd', 'a', 't', 'a', 0x00, 0x77, 0x01, 0x00,
+	};
+	uint8_t header[SYNTH_WAV_HEADER_SIZE] = { 0 };
+	synth_wav_header(header, 48000, 48000);
+
+	if (0 != memcmp(header, expected, sizeof (header))) {
+		test_log_err("Test: unexpected header of WAV file %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test: header of WAV file %s\n", "");
+	return 0;
+}
+
+
+
+
+static int buffer_write(void * arg, int16_t const * frames, size_t count)
+{
+	test_buffer_t * buffer = (test_buffer_t *) arg;
+	if (buffer->count + count > buffer->capacity) {
+		return -1;
+	}
+	memcpy(buffer->frames + buffer->count, frames, count * sizeof (int16_t));
+	buffer->count += count;
+	return 0;
+}
+
+
+
+
+static int max_delta(int16_t const * frames, size_t count)
+{
+	int result = 0;
+	for (size_t i = 1; i < count; i++) {
+		int const delta = abs(frames[i] - frames[i - 1]);
+		result = delta > result ? delta : result;
+	}
+	return result;
+}
+
@@ -0,0 +1,395 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for cwdaemon/src/trace.c.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "src/cwdaemon.h"
+#include "src/trace.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+#define TEST_RING_CAPACITY 64u
+#define TEST_THREADS_COUNT  3u
+#define TEST_THREAD_EVENTS 50u
+
+
+
+
+static int test_trace_open_invalid(void);
+static int test_trace_single_thread(void);
+static int test_trace_wrap_around(void);
+static int test_trace_threads(void);
+static int test_trace_reuse(void);
+
+static void * thread_fn(void * arg);
+static int read_ring(char const * path, unsigned int ring, trace_record_t * records, size_t size, size_t * count, trace_file_header_t * header);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_trace_open_invalid,
+	test_trace_single_thread,
+	test_trace_wrap_around,
+	test_trace_threads,
+	test_trace_reuse,
+	NULL
+};
+
+
+
+
+static char g_path[64];
+
+/// Keeps threads of test_trace_threads() alive until all of them have
+/// recorded their events, so that they can't reuse each other's rings.
+static pthread_barrier_t g_barrier;
+
+
+
+
+int main(void)
+{
+	snprintf(g_path, sizeof (g_path), "/tmp/cwdaemon_daemon_trace_%ld", (long) getpid());
+
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			unlink(g_path);
+			return -1;
+		}
+		i++;
+	}
+
+	unlink(g_path);
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Map trace file at @p path and read records from its given ring
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int read_ring(char const * path, unsigned int ring, trace_record_t * records, size_t size, size_t * count, trace_file_header_t * header)
+{
+	trace_map_t map = { 0 };
+	if (0 != trace_map_open(&map, path)) {
+		test_log_err("Failed to map trace file %s\n", path);
+		return -1;
+	}
+	*count = trace_map_read_ring(&map, ring, records, size);
+	*header = *map.header;
+	trace_map_close(&map);
+	return 0;
+}
+
+
+
+
+/// @brief Invalid geometry of trace file is rejected
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_trace_open_invalid(void)
+{
+	if (-1 != trace_open(g_path, 4, 100)) {
+		test_log_err("Ring capacity that is not a power of two has been accepted %s\n", "");
+		trace_close();
+		return -1;
+	}
+	if (-1 != trace_open(g_path, 0, 64)) {
+		test_log_err("Zero count of rings has been accepted %s\n", "");
+		trace_close();
+		return -1;
+	}
+
+	// Tracepoints must be no-op when tracing is disabled.
+	trace_event(TRACE_EVENT_KEY, 1, 0);
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Events recorded by one thread are read back in order
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_trace_single_thread(void)
+{
+	if (0 != trace_open(g_path, 2, TEST_RING_CAPACITY)) {
+		test_log_err("Failed to open trace file %s\n", g_path);
+		return -1;
+	}
+	for (uint32_t i = 0; i < 10; i++) {
+		trace_event(TRACE_EVENT_ENQUEUE, 'a' + i, i);
+	}
+	trace_event(TRACE_EVENT_KEY, 1, 0);
+	trace_close();
+
+	trace_record_t records[TEST_RING_CAPACITY] = { 0 };
+	size_t count = 0;
+	trace_file_header_t header = { 0 };
+	if (0 != read_ring(g_path, 0, records, TEST_RING_CAPACITY, &count, &header)) {
+		return -1;
+	}
+
+	if (11 != count || 1 != header.rings_used || 0 != header.dropped) {
+		test_log_err("Unexpected contents of trace: %zu records, %u rings used, %lu dropped\n",
+		             count, header.rings_used, (unsigned long) header.dropped);
+		return -1;
+	}
+	for (size_t i = 0; i < 10; i++) {
+		if (TRACE_EVENT_ENQUEUE != records[i].event || 'a' + i != records[i].arg0 || i != records[i].arg1 || i + 1 != records[i].seq) {
+			test_log_err("Unexpected record #%zu: event %u, arg0 %u, arg1 %u, seq %lu\n",
+			             i, records[i].event, records[i].arg0, records[i].arg1, (unsigned long) records[i].seq);
+			return -1;
+		}
+		if (records[i + 1].timestamp_ns < records[i].timestamp_ns) {
+			test_log_err("Time stamps of records #%zu and #%zu are not monotonic\n", i, i + 1);
+			return -1;
+		}
+	}
+	if (TRACE_EVENT_KEY != records[10].event || 1 != records[10].arg0) {
+		test_log_err("Unexpected last record: event %u, arg0 %u\n", records[10].event, records[10].arg0);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief When ring is full, newest records overwrite oldest records
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_trace_wrap_around(void)
+{
+	if (0 != trace_open(g_path, 1, TEST_RING_CAPACITY)) {
+		test_log_err("Failed to open trace file %s\n", g_path);
+		return -1;
+	}
+	uint32_t const total = 2 * TEST_RING_CAPACITY + 5;
+	for (uint32_t i = 0; i < total; i++) {
+		trace_event(TRACE_EVENT_KEY, i % 2, i);
+	}
+	trace_close();
+
+	trace_record_t records[TEST_RING_CAPACITY] = { 0 };
+	size_t count = 0;
+	trace_file_header_t header = { 0 };
+	if (0 != read_ring(g_path, 0, records, TEST_RING_CAPACITY, &count, &header)) {
+		return -1;
+	}
+
+	if (TEST_RING_CAPACITY != count) {
+		test_log_err("Unexpected count of records after wrap-around: %zu\n", count);
+		return -1;
+	}
+	for (size_t i = 0; i < count; i++) {
+		uint32_t const expected = total - TEST_RING_CAPACITY + (uint32_t) i;
+		if (expected != records[i].arg1 || expected + 1 != records[i].seq) {
+			test_log_err("Unexpected record #%zu after wrap-around: arg1 %u, seq %lu, expected %u\n",
+			             i, records[i].arg1, (unsigned long) records[i].seq, expected);
+			return -1;
+		}
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+static void * thread_fn(void * arg)
+{
+	uint32_t const id = (uint32_t) (uintptr_t) arg;
+	for (uint32_t i = 0; i < TEST_THREAD_EVENTS; i++) {
+		trace_event(TRACE_EVENT_TQ_LOW, id, i);
+	}
+	pthread_barrier_wait(&g_barrier);
+	return NULL;
+}
+
+
+
+
+/// @brief Each thread gets its own ring, threads that don't get a ring are counted as dropped
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_trace_threads(void)
+{
+	// One ring less than count of threads.
+	if (0 != trace_open(g_path, TEST_THREADS_COUNT - 1, TEST_RING_CAPACITY)) {
+		test_log_err("Failed to open trace file %s\n", g_path);
+		return -1;
+	}
+
+	pthread_barrier_init(&g_barrier, NULL, TEST_THREADS_COUNT);
+	pthread_t threads[TEST_THREADS_COUNT];
+	for (uint32_t t = 0; t < TEST_THREADS_COUNT; t++) {
+		pthread_create(&threads[t], NULL, thread_fn, (void *) (uintptr_t) t);
+	}
+	for (uint32_t t = 0; t < TEST_THREADS_COUNT; t++) {
+		pthread_join(threads[t], NULL);
+	}
+	pthread_barrier_destroy(&g_barrier);
+	trace_close();
+
+	bool seen[TEST_THREADS_COUNT] = { false };
+	for (unsigned int ring = 0; ring < TEST_THREADS_COUNT - 1; ring++) {
+		trace_record_t records[TEST_RING_CAPACITY] = { 0 };
+		size_t count = 0;
+		trace_file_header_t header = { 0 };
+		if (0 != read_ring(g_path, ring, records, TEST_RING_CAPACITY, &count, &header)) {
+			return -1;
+		}
+		if (TEST_THREADS_COUNT != header.rings_used || TEST_THREAD_EVENTS != header.dropped) {
+			test_log_err("Unexpected header: %u rings used, %lu dropped\n", header.rings_used, (unsigned long) header.dropped);
+			return -1;
+		}
+		if (TEST_THREAD_EVENTS != count) {
+			test_log_err("Unexpected count of records in ring %u: %zu\n", ring, count);
+			return -1;
+		}
+
+		// All records in a ring come from one thread, in order.
+		uint32_t const id = records[0].arg0;
+		if (id >= TEST_THREADS_COUNT || seen[id]) {
+			test_log_err("Unexpected owner of ring %u: %u\n", ring, id);
+			return -1;
+		}
+		seen[id] = true;
+		for (size_t i = 0; i < count; i++) {
+			if (id != records[i].arg0 || i != records[i].arg1) {
+				test_log_err("Unexpected record #%zu in ring %u: arg0 %u, arg1 %u\n", i, ring, records[i].arg0, records[i].arg1);
+				return -1;
+			}
+		}
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Ring of a thread that has exited is reused by next thread
+///
+/// Keying engine's thread is started again each time the engine is
+/// reopened. The threads must not use up the rings.
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_trace_reuse(void)
+{
+	if (0 != trace_open(g_path, 2, TEST_RING_CAPACITY)) {
+		test_log_err("Failed to open trace file %s\n", g_path);
+		return -1;
+	}
+
+	// Ring of main thread is never released.
+	trace_event(TRACE_EVENT_RECEIVE, 0, 0);
+
+	// More short-lived threads than there are rings, one after another.
+	pthread_barrier_init(&g_barrier, NULL, 1);
+	uint32_t const threads_count = 4;
+	for (uint32_t t = 0; t < threads_count; t++) {
+		pthread_t thread;
+		pthread_create(&thread, NULL, thread_fn, (void *) (uintptr_t) t);
+		pthread_join(thread, NULL);
+	}
+	pthread_barrier_destroy(&g_barrier);
+	trace_close();
+
+	trace_record_t records[TEST_RING_CAPACITY] = { 0 };
+	size_t count = 0;
+	trace_file_header_t header = { 0 };
+	if (0 != read_ring(g_path, 1, records, TEST_RING_CAPACITY, &count, &header)) {
+		return -1;
+	}
+	if (2 != header.rings_used || 0 != header.dropped) {
+		test_log_err("Unexpected header: %u rings used, %lu dropped\n", header.rings_used, (unsigned long) header.dropped);
+		return -1;
+	}
+	// The ring contains most recent records of the threads, in order.
+	if (TEST_RING_CAPACITY != count) {
+		test_log_err("Unexpected count of records in reused ring: %zu\n", count);
+		return -1;
+	}
+	uint32_t const total = threads_count * TEST_THREAD_EVENTS;
+	for (size_t i = 0; i < count; i++) {
+		uint32_t const n = total - TEST_RING_CAPACITY + (uint32_t) i;
+		if (n / TEST_THREAD_EVENTS != records[i].arg0 || n % TEST_THREAD_EVENTS != records[i].arg1) {
+			test_log_err("Unexpected record #%zu in reused ring: arg0 %u, arg1 %u\n", i, records[i].arg0, records[i].arg1);
+			return -1;
+		}
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
@@ -0,0 +1,373 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for cwdaemon/src/vclock.c.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/cwdaemon.h"
+#include "src/engine.h"
+#include "src/engine_native.h"
+#include "src/vclock.h"
+#include "tests/library/log.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+/// Upper limit of real time of a test that spans seconds of virtual time.
+#define TEST_REAL_LIMIT_NS  1000000000u
+
+#define TEST_PERIODS_COUNT  40
+#define TEST_EDGES_MAX     128
+
+
+
+
+static int test_vclock_sleep(void);
+static int test_vclock_periods(void);
+static int test_vclock_hold(void);
+static int test_vclock_engine_native(void);
+
+static void * periodic_thread_fn(void * arg);
+static void * hold_thread_fn(void * arg);
+static void keying_callback(void * arg, int keystate);
+static uint64_t real_now_ns(void);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_vclock_sleep,
+	test_vclock_periods,
+	test_vclock_hold,
+	test_vclock_engine_native,
+	NULL
+};
+
+
+
+
+/// Keying edges recorded by keying callback.
+static struct {
+	uint64_t timestamp_ns[TEST_EDGES_MAX];
+	int keystate[TEST_EDGES_MAX];
+	size_t count;
+} g_edges;
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+
+	char path[64] = { 0 };
+	snprintf(path, sizeof (path), "/tmp/cwdaemon_vclock_test_%ld", (long) getpid());
+	unlink(path);
+	setenv(VCLOCK_ENV_PATH, path, 1);
+	if (!vclock_enabled()) {
+		test_log_err("Failed to enable virtual clock with state file [%s]\n", path);
+		return -1;
+	}
+
+	int rv = 0;
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			rv = -1;
+			break;
+		}
+		i++;
+	}
+	if (0 == rv && 0 != vclock_stalls()) {
+		test_log_err("Virtual clock has stalled %u time(s)\n", vclock_stalls());
+		rv = -1;
+	}
+	unlink(path);
+
+	if (0 == rv) {
+		test_log_info("Test result: PASS %s\n", "");
+	}
+	return rv;
+}
+
+
+
+
+/// @brief Long sleep on virtual clock is exact and takes little real time
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_vclock_sleep(void)
+{
+	uint64_t const real_start = real_now_ns();
+	uint64_t const start = vclock_now_ns();
+	vclock_sleep_ns(10ull * 1000000000u);
+	uint64_t const end = vclock_now_ns();
+	uint64_t const real_elapsed = real_now_ns() - real_start;
+
+	if (end - start != 10ull * 1000000000u) {
+		test_log_err("Unexpected duration of virtual sleep: %" PRIu64 " ns\n", end - start);
+		return -1;
+	}
+	if (real_elapsed > TEST_REAL_LIMIT_NS) {
+		test_log_err("Virtual sleep has taken too much real time: %" PRIu64 " ns\n", real_elapsed);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+typedef struct {
+	uint64_t period_ns;
+	uint64_t wakeups_ns[TEST_PERIODS_COUNT]; ///< Times of wake-ups, relative to start of the thread.
+} periodic_t;
+
+
+
+
+/// @brief Two threads with different periods wake up exactly on time
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_vclock_periods(void)
+{
+	periodic_t periodic[2] = { { .period_ns = 3000000 }, { .period_ns = 5000000 } };
+	pthread_t threads[2];
+
+	vclock_wait_begin(0);
+	for (size_t i = 0; i < 2; i++) {
+		pthread_create(&threads[i], NULL, periodic_thread_fn, &periodic[i]);
+	}
+	for (size_t i = 0; i < 2; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	vclock_wait_end();
+
+	for (size_t i = 0; i < 2; i++) {
+		for (size_t k = 0; k < TEST_PERIODS_COUNT; k++) {
+			if (periodic[i].wakeups_ns[k] != (k + 1) * periodic[i].period_ns) {
+				test_log_err("Unexpected wake-up #%zu of thread #%zu: %" PRIu64 " ns\n", k, i, periodic[i].wakeups_ns[k]);
+				return -1;
+			}
+		}
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Held clock doesn't advance until it's released
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_vclock_hold(void)
+{
+	bool woken = false;
+	pthread_t thread;
+
+	vclock_hold();
+	vclock_wait_begin(0);
+	pthread_create(&thread, NULL, hold_thread_fn, &woken);
+
+	struct timespec const delay = { .tv_sec = 0, .tv_nsec = 50000000 };
+	nanosleep(&delay, NULL);
+	bool const woken_while_held = __atomic_load_n(&woken, __ATOMIC_ACQUIRE);
+
+	vclock_release();
+	pthread_join(thread, NULL);
+	vclock_wait_end();
+
+	if (woken_while_held) {
+		test_log_err("Thread has woken up while the clock was held %s\n", "");
+		return -1;
+	}
+	if (!__atomic_load_n(&woken, __ATOMIC_ACQUIRE)) {
+		test_log_err("Thread hasn't woken up after the clock was released %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Keying edges of native engine are exactly on time, faster than real time
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_vclock_engine_native(void)
+{
+	char const text[] = "paris paris";
+	int const wpm = 60;
+
+	/* Expected edges, from schedules of characters. */
+	engine_native_timing_t timing = { 0 };
+	engine_native_timing(&timing, wpm, 50, 0);
+	uint64_t expected_ns[TEST_EDGES_MAX] = { 0 };
+	int expected_keystate[TEST_EDGES_MAX] = { 0 };
+	size_t expected_count = 0;
+	uint64_t offset_ns = 0;
+	bool key = false;
+	for (size_t c = 0; c < sizeof (text) - 1; c++) {
+		engine_native_element_t elements[ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX] = { 0 };
+		size_t const n = engine_native_character_elements(&timing, text[c], elements, ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX);
+		for (size_t e = 0; e < n; e++) {
+			if (elements[e].key != key && expected_count < TEST_EDGES_MAX) {
+				key = elements[e].key;
+				expected_ns[expected_count] = offset_ns;
+				expected_keystate[expected_count] = key;
+				expected_count++;
+			}
+			offset_ns += (uint64_t) elements[e].duration_us * 1000u;
+		}
+	}
+
+	g_edges.count = 0;
+	if (!engine_native.open(CW_AUDIO_NULL)) {
+		test_log_err("Failed to open engine %s\n", "");
+		return -1;
+	}
+	engine_native.register_keying_callback(keying_callback, NULL);
+	engine_native.set_send_speed(wpm);
+	engine_native.set_weighting(50);
+	engine_native.set_gap(0);
+
+	uint64_t const real_start = real_now_ns();
+	for (size_t c = 0; c < sizeof (text) - 1; c++) {
+		engine_native.send_character(text[c]);
+	}
+	engine_native.wait_for_tone_queue();
+	uint64_t const real_elapsed = real_now_ns() - real_start;
+	engine_native.close();
+	engine_native.register_keying_callback(NULL, NULL);
+
+	if (g_edges.count != expected_count) {
+		test_log_err("Unexpected count of keying edges: %zu, expected %zu\n", g_edges.count, expected_count);
+		return -1;
+	}
+	for (size_t i = 0; i < g_edges.count; i++) {
+		uint64_t const edge_offset_ns = g_edges.timestamp_ns[i] - g_edges.timestamp_ns[0];
+		if (g_edges.keystate[i] != expected_keystate[i] || edge_offset_ns != expected_ns[i]) {
+			test_log_err("Unexpected keying edge #%zu: key %d at %" PRIu64 " ns, expected key %d at %" PRIu64 " ns\n",
+			             i, g_edges.keystate[i], edge_offset_ns, expected_keystate[i], expected_ns[i]);
+			return -1;
+		}
+	}
+	if (real_elapsed > TEST_REAL_LIMIT_NS) {
+		test_log_err("Keying on virtual clock has taken too much real time: %" PRIu64 " ns\n", real_elapsed);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+static void * periodic_thread_fn(void * arg)
+{
+	periodic_t * periodic = (periodic_t *) arg;
+	uint64_t const start = vclock_now_ns();
+	for (size_t k = 0; k < TEST_PERIODS_COUNT; k++) {
+		vclock_sleep_until_ns(start + (k + 1) * periodic->period_ns);
+		periodic->wakeups_ns[k] = vclock_now_ns() - start;
+	}
+	return NULL;
+}
+
+
+
+
+static void * hold_thread_fn(void * arg)
+{
+	vclock_sleep_ns(1000000);
+	__atomic_store_n((bool *) arg, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+
+
+
+static void keying_callback(__attribute__((unused)) void * arg, int keystate)
+{
+	if (g_edges.count < TEST_EDGES_MAX) {
+		g_edges.timestamp_ns[g_edges.count] = vclock_now_ns();
+		g_edges.keystate[g_edges.count] = keystate;
+		g_edges.count++;
+	}
+}
+
+
+
+
+static uint64_t real_now_ns(void)
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
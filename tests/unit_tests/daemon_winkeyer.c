@@ -0,0 +1,522 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for WinKeyer cwdevice (cwdaemon/src/winkeyer.c) and
+/// "winkeyer" keying engine (cwdaemon/src/engine_winkeyer.c). The keyer is
+/// emulated on a pseudo-terminal pair by tests/library/winkeyer_emulator.c.
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/cwdaemon.h"
+#include "src/engine.h"
+#include "src/winkeyer.h"
+#include "tests/library/log.h"
+#include "tests/library/winkeyer_emulator.h"
+
+
+
+
+/*
+  Global variables used by files compiled for this test. The variables are
+  normally defined in cwdaemon's main file. For the purposes of the files
+  linked in this test we need to define them here.
+*/
+FILE * cwdaemon_debug_f;
+char * cwdaemon_debug_f_path;
+bool g_forking;
+options_t g_current_options;
+
+
+
+
+/// Dot unit of the emulator, short enough to run the tests quickly.
+#define TEST_UNIT_US  2000
+
+/// Time for the emulator to process commands sent by host.
+#define TEST_SETTLE_MS  100
+
+
+
+
+static int test_winkeyer_characters(void);
+static int test_winkeyer_open(void);
+static int test_winkeyer_text(void);
+static int test_winkeyer_speed(void);
+static int test_winkeyer_abort(void);
+static int test_winkeyer_flow_control(void);
+static int test_winkeyer_ptt_and_key(void);
+
+static int open_winkeyer(winkeyer_emulator_t * emu, cwdevice * dev);
+static void close_winkeyer(winkeyer_emulator_t * emu, cwdevice * dev);
+static void tq_low_callback(void * arg);
+static void sleep_ms(unsigned int ms);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_winkeyer_characters,
+	test_winkeyer_open,
+	test_winkeyer_text,
+	test_winkeyer_speed,
+	test_winkeyer_abort,
+	test_winkeyer_flow_control,
+	test_winkeyer_ptt_and_key,
+	NULL
+};
+
+
+
+
+int main(void)
+{
+	cwdaemon_debug_f = stderr;
+
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in tests #%d\n", i);
+			return -1;
+		}
+		i++;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Characters are encoded as plain characters or as merged letters
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_winkeyer_characters(void)
+{
+	struct {
+		char character;
+		size_t count;
+		uint8_t bytes[WINKEYER_CHARACTER_BYTES_MAX];
+		unsigned int echoes;
+	} const data[] = {
+		{ 'a',    1, { 'A' },                    1 },
+		{ '7',    1, { '7' },                    1 },
+		{ ' ',    1, { ' ' },                    1 },
+		{ '?',    1, { '?' },                    1 },
+		{ '<',    3, { WINKEYER_CMD_MERGE, 'S', 'K' }, 2 },
+		{ '&',    3, { WINKEYER_CMD_MERGE, 'A', 'S' }, 2 },
+		{ '%',    0, { 0 },                      0 },
+		{ '\x01', 0, { 0 },                      0 },
+		{ '\xff', 0, { 0 },                      0 },
+	};
+
+	for (size_t i = 0; i < sizeof (data) / sizeof (data[0]); i++) {
+		uint8_t bytes[WINKEYER_CHARACTER_BYTES_MAX] = { 0 };
+		unsigned int echoes = 0;
+		size_t const count = winkeyer_character_bytes(data[i].character, bytes, &echoes);
+		if (count != data[i].count
+		    || 0 != memcmp(bytes, data[i].bytes, count)
+		    || (count && echoes != data[i].echoes)) {
+			test_log_err("Unexpected encoding of character #%zu: %zu bytes, %u echoes\n", i, count, echoes);
+			return -1;
+		}
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Opening of the device opens host mode of the keyer; the engine needs the device
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_winkeyer_open(void)
+{
+	if (engine_winkeyer.open(CW_AUDIO_NULL)) {
+		test_log_err("Engine was opened without WinKeyer cwdevice %s\n", "");
+		engine_winkeyer.close();
+		return -1;
+	}
+
+	winkeyer_emulator_t emu = { .unit_us = TEST_UNIT_US };
+	cwdevice dev;
+	if (0 != open_winkeyer(&emu, &dev)) {
+		return -1;
+	}
+	sleep_ms(TEST_SETTLE_MS);
+	winkeyer_emulator_state_t state;
+	winkeyer_emulator_get_state(&emu, &state);
+	if (!state.host_open
+	    || !(state.mode & WINKEYER_MODE_SERIAL_ECHO)
+	    || !(state.pin_config & WINKEYER_PINCFG_PTT)) {
+		test_log_err("Unexpected state of keyer after opening: host open = %d, mode = 0x%02x, pins = 0x%02x\n",
+		             state.host_open, state.mode, state.pin_config);
+		close_winkeyer(&emu, &dev);
+		return -1;
+	}
+
+	engine_winkeyer.close();
+	dev.free(&dev);
+	sleep_ms(TEST_SETTLE_MS);
+	winkeyer_emulator_get_state(&emu, &state);
+	free(dev.desc);
+	winkeyer_emulator_stop(&emu);
+	if (state.host_open || -1 != winkeyer_fd()) {
+		test_log_err("Host mode of keyer is still open after closing %s\n", "");
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Text is forwarded to the keyer, "tone queue low" is reported when the keyer is idle
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_winkeyer_text(void)
+{
+	winkeyer_emulator_t emu = { .unit_us = TEST_UNIT_US };
+	cwdevice dev;
+	if (0 != open_winkeyer(&emu, &dev)) {
+		return -1;
+	}
+	int tq_low_calls = 0;
+	engine_winkeyer.register_tone_queue_low_callback(tq_low_callback, &tq_low_calls, 1);
+	engine_winkeyer.set_send_speed(30);
+	engine_winkeyer.set_weighting(60);
+
+	char const * text = "cq de sp5<";
+	for (char const * c = text; *c; c++) {
+		if (!engine_winkeyer.send_character(*c)) {
+			test_log_err("Failed to enqueue character [%c]\n", *c);
+			close_winkeyer(&emu, &dev);
+			return -1;
+		}
+	}
+	if (engine_winkeyer.send_character('%')) {
+		test_log_err("Character not supported by the keyer was accepted %s\n", "");
+		close_winkeyer(&emu, &dev);
+		return -1;
+	}
+	engine_winkeyer.wait_for_tone_queue();
+
+	winkeyer_emulator_state_t state;
+	winkeyer_emulator_get_state(&emu, &state);
+	int const len = engine_winkeyer.get_tone_queue_length();
+	close_winkeyer(&emu, &dev);
+
+	if (0 != strcmp(state.keyed, "CQ DE SP5[SK]") || 30 != state.wpm || 60 != state.weighting) {
+		test_log_err("Unexpected state of keyer: keyed [%s], speed %d, weighting %d\n", state.keyed, state.wpm, state.weighting);
+		return -1;
+	}
+	if (0 != len || tq_low_calls < 1) {
+		test_log_err("Unexpected tone queue: length %d, %d calls of callback\n", len, tq_low_calls);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Change of speed in the middle of text applies to following characters
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_winkeyer_speed(void)
+{
+	winkeyer_emulator_t emu = { .unit_us = TEST_UNIT_US };
+	cwdevice dev;
+	if (0 != open_winkeyer(&emu, &dev)) {
+		return -1;
+	}
+	engine_winkeyer.set_send_speed(20);
+	for (int i = 0; i < 4; i++) {
+		engine_winkeyer.send_character('E');
+	}
+	engine_winkeyer.set_send_speed(40);
+	for (int i = 0; i < 4; i++) {
+		engine_winkeyer.send_character('T');
+	}
+	engine_winkeyer.wait_for_tone_queue();
+	sleep_ms(TEST_SETTLE_MS);
+
+	winkeyer_emulator_state_t state;
+	winkeyer_emulator_get_state(&emu, &state);
+	close_winkeyer(&emu, &dev);
+
+	// The keyer returns to non-buffered speed when its buffer becomes
+	// empty, so host must set the new speed also as non-buffered.
+	if (0 != strcmp(state.keyed, "EEEETTTT") || 1 != state.buffered_speeds || 40 != state.wpm) {
+		test_log_err("Unexpected state of keyer: keyed [%s], %u buffered speed changes, speed %d\n",
+		             state.keyed, state.buffered_speeds, state.wpm);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Abort clears keyer's buffer; host keeps only a few characters in the keyer
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_winkeyer_abort(void)
+{
+	winkeyer_emulator_t emu = { .unit_us = 20000 };
+	cwdevice dev;
+	if (0 != open_winkeyer(&emu, &dev)) {
+		return -1;
+	}
+	for (int i = 0; i < 100; i++) {
+		engine_winkeyer.send_character('A' + (i % 26));
+	}
+	sleep_ms(TEST_SETTLE_MS);
+
+	struct timespec start = { 0 };
+	struct timespec end = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	engine_winkeyer.flush_tone_queue();
+	engine_winkeyer.wait_for_tone_queue();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long const abort_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+
+	sleep_ms(TEST_SETTLE_MS);
+	winkeyer_emulator_state_t state;
+	winkeyer_emulator_get_state(&emu, &state);
+	int const len = engine_winkeyer.get_tone_queue_length();
+	close_winkeyer(&emu, &dev);
+
+	if (1 != state.clears || state.busy || 0 != len || state.keyed_len > 2) {
+		test_log_err("Unexpected state after abort: %u clears, busy %d, queue length %d, keyed [%s]\n",
+		             state.clears, state.busy, len, state.keyed);
+		return -1;
+	}
+	if (state.max_fill > WINKEYER_INFLIGHT_MAX || abort_ms > 500) {
+		test_log_err("Abort is not quick enough: max fill of buffer %zu, abort took %ld ms\n", state.max_fill, abort_ms);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Host stops sending when the keyer reports XOFF, and no character is lost
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_winkeyer_flow_control(void)
+{
+	winkeyer_emulator_t emu = { .unit_us = 500, .xoff_threshold = 3 };
+	cwdevice dev;
+	if (0 != open_winkeyer(&emu, &dev)) {
+		return -1;
+	}
+	char expected[64] = { 0 };
+	for (size_t i = 0; i < 60; i++) {
+		expected[i] = (char) ('A' + (i % 26));
+		engine_winkeyer.send_character(expected[i]);
+		if (0 == i % 10) {
+			sleep_ms(5); // Let the host see XOFF in the middle of text.
+		}
+	}
+	engine_winkeyer.wait_for_tone_queue();
+
+	winkeyer_emulator_state_t state;
+	winkeyer_emulator_get_state(&emu, &state);
+	close_winkeyer(&emu, &dev);
+
+	if (0 != strcmp(state.keyed, expected) || 0 != state.overflows || state.max_fill > WINKEYER_INFLIGHT_MAX) {
+		test_log_err("Unexpected state of keyer: keyed [%s], %zu overflows, max fill %zu\n", state.keyed, state.overflows, state.max_fill);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief PTT timing goes to the keyer; key and PTT of cwdevice are forwarded
+///
+/// @return 0 on success
+/// @return -1 on failure
+static int test_winkeyer_ptt_and_key(void)
+{
+	winkeyer_emulator_t emu = { .unit_us = TEST_UNIT_US };
+	cwdevice dev;
+	if (0 != open_winkeyer(&emu, &dev)) {
+		return -1;
+	}
+	winkeyer_emulator_state_t state;
+
+	engine_winkeyer.set_ptt_timing(150, 30);
+	sleep_ms(TEST_SETTLE_MS);
+	winkeyer_emulator_get_state(&emu, &state);
+	if (150 != state.ptt_lead_ms || 30 != state.ptt_tail_ms || !(state.pin_config & WINKEYER_PINCFG_PTT)) {
+		test_log_err("Unexpected PTT timing: lead %u ms, tail %u ms, pins 0x%02x\n", state.ptt_lead_ms, state.ptt_tail_ms, state.pin_config);
+		close_winkeyer(&emu, &dev);
+		return -1;
+	}
+	engine_winkeyer.set_ptt_timing(0, 0);
+	sleep_ms(TEST_SETTLE_MS);
+	winkeyer_emulator_get_state(&emu, &state);
+	if (state.pin_config & WINKEYER_PINCFG_PTT) {
+		test_log_err("PTT of keyer not disabled for zero PTT delay: pins 0x%02x\n", state.pin_config);
+		close_winkeyer(&emu, &dev);
+		return -1;
+	}
+
+	dev.ptt(&dev, 1);
+	dev.cw(&dev, 1);
+	sleep_ms(TEST_SETTLE_MS);
+	winkeyer_emulator_get_state(&emu, &state);
+	bool const on = state.ptt && state.key;
+	dev.reset_pins_state(&dev);
+	sleep_ms(TEST_SETTLE_MS);
+	winkeyer_emulator_get_state(&emu, &state);
+	if (!on || state.ptt || state.key) {
+		test_log_err("Unexpected state of lines: on = %d, PTT = %d, key = %d\n", on, state.ptt, state.key);
+		close_winkeyer(&emu, &dev);
+		return -1;
+	}
+
+	// Tone (e.g. of TUNE request) is keyed with "key immediate" command.
+	engine_winkeyer.queue_tone(300000, 800);
+	sleep_ms(TEST_SETTLE_MS);
+	winkeyer_emulator_get_state(&emu, &state);
+	bool const tone_on = state.key;
+	engine_winkeyer.wait_for_tone_queue();
+	sleep_ms(TEST_SETTLE_MS);
+	winkeyer_emulator_get_state(&emu, &state);
+	close_winkeyer(&emu, &dev);
+	if (!tone_on || state.key) {
+		test_log_err("Unexpected key during tone: %d, after tone: %d\n", tone_on, state.key);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Start emulator, open WinKeyer cwdevice on it and start the engine
+static int open_winkeyer(winkeyer_emulator_t * emu, cwdevice * dev)
+{
+	if (0 != winkeyer_emulator_start(emu)) {
+		return -1;
+	}
+
+	char desc[128] = { 0 };
+	snprintf(desc, sizeof (desc), "%s%s", WINKEYER_DEVICE_PREFIX, emu->slave_path);
+	memset(dev, 0, sizeof (cwdevice));
+	dev->init = winkeyer_init;
+	dev->free = winkeyer_free;
+	dev->reset_pins_state = winkeyer_reset_pins_state;
+	dev->cw = winkeyer_cw;
+	dev->ptt = winkeyer_ptt;
+	dev->desc = strdup(desc);
+
+	int const fd = winkeyer_probe_cwdevice(desc);
+	if (-1 == fd || 0 != dev->init(dev, fd)) {
+		test_log_err("Failed to open WinKeyer cwdevice [%s]\n", desc);
+		free(dev->desc);
+		winkeyer_emulator_stop(emu);
+		return -1;
+	}
+	if (!engine_winkeyer.open(CW_AUDIO_NULL)) {
+		test_log_err("Failed to open keying engine for WinKeyer [%s]\n", desc);
+		dev->free(dev);
+		free(dev->desc);
+		winkeyer_emulator_stop(emu);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+
+static void close_winkeyer(winkeyer_emulator_t * emu, cwdevice * dev)
+{
+	engine_winkeyer.register_tone_queue_low_callback(NULL, NULL, 0);
+	engine_winkeyer.close();
+	dev->free(dev);
+	free(dev->desc);
+	winkeyer_emulator_stop(emu);
+}
+
+
+
+
+static void tq_low_callback(void * arg)
+{
+	int * const calls = arg;
+	(*calls)++;
+}
+
+
+
+
+static void sleep_ms(unsigned int ms)
+{
+	struct timespec const ts = { .tv_sec = ms / 1000, .tv_nsec = (long) (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
@@ -0,0 +1,324 @@
+/*
+ * This file is a part of cwdaemon project.
+ *
+ * Copyright (C) 2002 - 2005 Joop Stakenborg <pg4i@amsat.org>
+ *		        and many authors, see the AUTHORS file.
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// Unit tests for waiting for edges in tests/library/cwdevice_observer.c
+/// and tests/library/cwdevice_observer_serial.c.
+///
+/// The observed tty is a pty with modem lines emulated by interposer of
+/// ioctl() (tools/modem_lines_preload.c) linked into the test program.
+
+
+
+
+#define _XOPEN_SOURCE 700 /* posix_openpt(), grantpt(), unlockpt(), ptsname(). */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tests/library/cwdevice_observer.h"
+#include "tests/library/cwdevice_observer_serial.h"
+#include "tests/library/log.h"
+#include "tools/modem_lines.h"
+
+
+
+
+#define EDGES_MAX 16
+
+
+
+
+/// Changes of pins reported by observer to change handlers.
+typedef struct {
+	struct timespec key_timestamps[EDGES_MAX];
+	bool key_states[EDGES_MAX];
+	size_t key_count;
+	size_t ptt_count;
+} sink_t;
+
+
+
+
+static int test_cwdevice_observer_edges(void);
+static int test_cwdevice_observer_fallback(void);
+
+static int on_key(void * arg, bool key_is_down, struct timespec const * timestamp);
+static int on_ptt(void * arg, bool ptt_is_on);
+static int fake_wait_edges(cwdevice_observer_t * observer, cwdevice_observer_edge_t * edges, size_t size);
+static int fake_poll_once(cwdevice_observer_t * observer, bool * key_is_down, bool * ptt_is_on);
+static void set_lines(int fd, int request, int lines);
+static int64_t elapsed_ms(struct timespec const * start);
+static void sleep_ms(unsigned int ms);
+
+
+
+
+static int (*g_tests[])(void) = {
+	test_cwdevice_observer_edges,
+	test_cwdevice_observer_fallback,
+	NULL
+};
+
+
+
+
+int main(void)
+{
+	// Private state file of modem lines, so that the test doesn't interfere
+	// with ptys used by other programs.
+	char path[] = "/tmp/cwdaemon_modem_lines_XXXXXX";
+	int const fd = mkstemp(path);
+	if (-1 == fd) {
+		test_log_err("Test: can't create state file: %s\n", strerror(errno));
+		return -1;
+	}
+	close(fd);
+	setenv(MODEM_LINES_ENV_PATH, path, 1);
+
+	int retv = 0;
+	int i = 0;
+	while (g_tests[i]) {
+		if (0 != g_tests[i]()) {
+			test_log_err("Test result: FAIL in test #%d\n", i);
+			retv = -1;
+			break;
+		}
+		i++;
+	}
+	unlink(path);
+
+	if (0 == retv) {
+		test_log_info("Test result: PASS %s\n", "");
+	}
+	return retv;
+}
+
+
+
+
+/// @brief Observer blocks until edges happen, and reports exact time stamps of the edges
+static int test_cwdevice_observer_edges(void)
+{
+	int const master = posix_openpt(O_RDWR | O_NOCTTY);
+	char const * slave_path = NULL;
+	if (-1 == master || 0 != grantpt(master) || 0 != unlockpt(master) || NULL == (slave_path = ptsname(master))) {
+		test_log_err("Test: can't create pseudo-terminal: %s\n", strerror(errno));
+		return -1;
+	}
+	unsigned int pty = 0;
+	sscanf(slave_path, "/dev/pts/%u", &pty);
+	modem_lines_t ml = { 0 };
+	modem_lines_slot_t * slot = NULL;
+	if (0 != modem_lines_open(&ml, NULL) || NULL == (slot = modem_lines_slot(&ml, pty, true))) {
+		test_log_err("Test: can't open state file: %s\n", strerror(errno));
+		close(master);
+		return -1;
+	}
+	modem_lines_reset(slot);
+
+	sink_t sink = { 0 };
+	cwdevice_observer_t observer = { 0 };
+	cwdevice_observer_tty_setup(&observer, NULL);
+	snprintf(observer.source_path, sizeof (observer.source_path), "%s", slave_path);
+	cwdevice_observer_set_key_change_handler(&observer, on_key, &sink);
+	cwdevice_observer_set_ptt_change_handler(&observer, on_ptt, &sink);
+	if (0 != cwdevice_observer_start_observing(&observer)) {
+		test_log_err("Test: can't start observing [%s]\n", slave_path);
+		modem_lines_close(&ml);
+		close(master);
+		return -1;
+	}
+	bool const edge_source = NULL != observer.edges_reference;
+
+	// Keying by "cwdaemon": a 20 ms mark with PTT, and a pulse shorter
+	// than anyone could poll for.
+	int const keyer = open(slave_path, O_RDWR | O_NOCTTY);
+	set_lines(keyer, TIOCMBIS, TIOCM_RTS);
+	set_lines(keyer, TIOCMBIS, TIOCM_DTR);
+	sleep_ms(20);
+	set_lines(keyer, TIOCMBIC, TIOCM_DTR);
+	sleep_ms(10);
+	set_lines(keyer, TIOCMBIS, TIOCM_DTR);
+	set_lines(keyer, TIOCMBIC, TIOCM_DTR);
+	set_lines(keyer, TIOCMBIC, TIOCM_RTS);
+	sleep_ms(50);
+
+	// The observer's thread is blocked in waiting; stop must not hang.
+	struct timespec start = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	cwdevice_observer_stop_observing(&observer);
+	int64_t const stop_ms = elapsed_ms(&start);
+
+	uint64_t cursor = 0;
+	modem_lines_record_t records[EDGES_MAX];
+	size_t const n = modem_lines_read(slot, &cursor, records, EDGES_MAX);
+	close(keyer);
+	modem_lines_close(&ml);
+	close(master);
+
+	if (!edge_source || stop_ms > 500) {
+		test_log_err("Test: edge source found: %d, stopping took %" PRId64 " ms\n", edge_source, stop_ms);
+		return -1;
+	}
+	if (4 != sink.key_count || 2 != sink.ptt_count || 6 != n) {
+		test_log_err("Test: unexpected count of edges: key %zu, ptt %zu, records %zu\n", sink.key_count, sink.ptt_count, n);
+		return -1;
+	}
+	// Edges of key are records 1, 2, 3 and 4 (0 and 5 are edges of PTT).
+	for (size_t i = 0; i < sink.key_count; i++) {
+		uint64_t const ns = (uint64_t) sink.key_timestamps[i].tv_sec * 1000000000u + (uint64_t) sink.key_timestamps[i].tv_nsec;
+		if (ns != records[i + 1].timestamp_ns || sink.key_states[i] != (0 == i % 2)) {
+			test_log_err("Test: unexpected edge #%zu of key: state %d, %" PRIu64 " ns vs %" PRIu64 " ns\n",
+			             i, sink.key_states[i], ns, records[i + 1].timestamp_ns);
+			return -1;
+		}
+	}
+	uint64_t const mark_ns = records[2].timestamp_ns - records[1].timestamp_ns;
+	if (mark_ns < 20000000u) {
+		test_log_err("Test: mark is too short: %" PRIu64 " ns\n", mark_ns);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+/// @brief Observer polls pins if it can't wait for edges
+static int test_cwdevice_observer_fallback(void)
+{
+	sink_t sink = { 0 };
+	cwdevice_observer_t observer = { 0 };
+	cwdevice_observer_configure_polling(&observer, 1000, fake_poll_once);
+	cwdevice_observer_configure_waiting(&observer, fake_wait_edges);
+	cwdevice_observer_set_key_change_handler(&observer, on_key, &sink);
+	observer.source_reference = 0; // Counter of polls in fake_poll_once().
+
+	if (0 != cwdevice_observer_start_observing(&observer)) {
+		test_log_err("Test: can't start observing %s\n", "");
+		return -1;
+	}
+	sleep_ms(100);
+	cwdevice_observer_stop_observing(&observer);
+
+	if (sink.key_count < 4) {
+		test_log_err("Test: unexpected count of polled edges: %zu\n", sink.key_count);
+		return -1;
+	}
+
+	test_log_info("Test result: PASS %s\n", "");
+	return 0;
+}
+
+
+
+
+static int on_key(void * arg, bool key_is_down, struct timespec const * timestamp)
+{
+	sink_t * const sink = arg;
+	if (sink->key_count < EDGES_MAX) {
+		sink->key_timestamps[sink->key_count] = *timestamp;
+		sink->key_states[sink->key_count] = key_is_down;
+		sink->key_count++;
+	}
+	return 0;
+}
+
+
+
+
+static int on_ptt(void * arg, bool ptt_is_on)
+{
+	sink_t * const sink = arg;
+	(void) ptt_is_on;
+	sink->ptt_count++;
+	return 0;
+}
+
+
+
+
+static int fake_wait_edges(cwdevice_observer_t * observer, cwdevice_observer_edge_t * edges, size_t size)
+{
+	(void) observer;
+	(void) edges;
+	(void) size;
+	return -1; // Waiting is not possible.
+}
+
+
+
+
+/// Key changes its state every 5 polls.
+static int fake_poll_once(cwdevice_observer_t * observer, bool * key_is_down, bool * ptt_is_on)
+{
+	observer->source_reference++;
+	*key_is_down = (observer->source_reference / 5) % 2;
+	*ptt_is_on = false;
+	return 0;
+}
+
+
+
+
+static void set_lines(int fd, int request, int lines)
+{
+	ioctl(fd, (unsigned long) request, &lines);
+}
+
+
+
+
+static int64_t elapsed_ms(struct timespec const * start)
+{
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+
+
+
+static void sleep_ms(unsigned int ms)
+{
+	struct timespec const ts = { .tv_sec = ms / 1000, .tv_nsec = (long) (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
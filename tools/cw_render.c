@@ -0,0 +1,211 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/**
+   Offline renderer of sidetone of "native" keying engine.
+
+   The program converts text into keying schedule with the same code that
+   is used by "native" keying engine of cwdaemon, renders the schedule
+   with sidetone synthesizer, and writes the sound to WAV file (mono,
+   16-bit). Rendering doesn't wait for real time and needs no sound
+   hardware, so timing of marks and shapes of their envelopes can be
+   inspected offline.
+
+   Usage: cw_render [-s wpm] [-T tone] [-v volume] [-w weighting] [-r rise time in us] <path to WAV file> <text>
+*/
+
+
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/cwdaemon.h"
+#include "src/engine.h"
+#include "src/engine_native.h"
+#include "src/synth.h"
+
+
+
+
+// Variables required by src/log.c.
+bool g_forking = false;
+FILE * cwdaemon_debug_f = NULL;
+char * cwdaemon_debug_f_path = NULL;
+options_t g_current_options = { .log_threshold = LOG_WARNING };
+
+
+
+
+// Function required by src/engine_native.c and src/sidetone.c.
+char const * engine_get_audio_system_label(__attribute__((unused)) int audio_system)
+{
+	return "WAV file";
+}
+
+
+
+
+static int write_frames(void * arg, int16_t const * frames, size_t count)
+{
+	FILE * file = (FILE *) arg;
+	/* WAV files are little-endian. */
+	for (size_t i = 0; i < count; i++) {
+		uint16_t const sample = (uint16_t) frames[i];
+		uint8_t const bytes[2] = { (uint8_t) (sample & 0xff), (uint8_t) (sample >> 8) };
+		if (2 != fwrite(bytes, 1, 2, file)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+
+
+static int get_int(char const * value, int min, int max, char const * label)
+{
+	char * end = NULL;
+	errno = 0;
+	long const lv = strtol(value, &end, 10);
+	if (0 != errno || end == value || '\0' != *end || lv < min || lv > max) {
+		fprintf(stderr, "[EE] Invalid %s: \"%s\", must be in range <%d - %d>\n", label, value, min, max);
+		exit(EXIT_FAILURE);
+	}
+	return (int) lv;
+}
+
+
+
+
+int main(int argc, char * argv[])
+{
+	int wpm = CWDAEMON_MORSE_SPEED_DEFAULT;
+	int tone = CWDAEMON_MORSE_TONE_DEFAULT;
+	int volume = CWDAEMON_MORSE_VOLUME_DEFAULT;
+	int weighting = CWDAEMON_MORSE_WEIGHTING_DEFAULT;
+	int rise_us = SYNTH_RISE_US_DEFAULT;
+
+	int opt = 0;
+	while (-1 != (opt = getopt(argc, argv, "s:T:v:w:r:"))) {
+		switch (opt) {
+		case 's':
+			wpm = get_int(optarg, CW_SPEED_MIN, CW_SPEED_MAX, "speed");
+			break;
+		case 'T':
+			tone = get_int(optarg, CW_FREQUENCY_MIN, CW_FREQUENCY_MAX, "tone");
+			break;
+		case 'v':
+			volume = get_int(optarg, CW_VOLUME_MIN, CW_VOLUME_MAX, "volume");
+			break;
+		case 'w':
+			weighting = get_int(optarg, CWDAEMON_MORSE_WEIGHTING_MIN, CWDAEMON_MORSE_WEIGHTING_MAX, "weighting");
+			break;
+		case 'r':
+			rise_us = get_int(optarg, 0, SYNTH_RISE_US_MAX, "rise time");
+			break;
+		default:
+			fprintf(stderr, "[EE] Usage: %s [-s wpm] [-T tone] [-v volume] [-w weighting] [-r rise time in us] <path to WAV file> <text>\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, "[EE] Pass path to WAV file and text. Call the program like this: %s /tmp/cq.wav \"cq de sp5xyz\"\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	char const * path = argv[optind];
+	char const * text = argv[optind + 1];
+
+	cwdaemon_debug_f = stderr;
+
+	engine_native_timing_t timing = { 0 };
+	/* Convert weighting to libcw's range in the same way as cwdaemon does. */
+	engine_native_timing(&timing, wpm, (int) (weighting * 0.6 + CWDAEMON_MORSE_WEIGHTING_MAX), 0);
+
+	size_t const capacity = (strlen(text) + 1) * ENGINE_NATIVE_CHARACTER_ELEMENTS_MAX;
+	engine_native_element_t * elements = calloc(capacity, sizeof (engine_native_element_t));
+	if (NULL == elements) {
+		fprintf(stderr, "[EE] Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	size_t count = 0;
+	for (char const * c = text; *c; c++) {
+		size_t const n = engine_native_character_elements(&timing, *c, elements + count, capacity - count);
+		if (0 == n) {
+			fprintf(stderr, "[WW] Character '%c' has no Morse representation, skipping it\n", *c);
+		}
+		count += n;
+	}
+
+	synth_t * synth = calloc(1, sizeof (synth_t));
+	if (NULL == synth || 0 != synth_init(synth, SYNTH_SAMPLE_RATE_DEFAULT, (unsigned int) rise_us)) {
+		fprintf(stderr, "[EE] Failed to initialize synthesizer\n");
+		exit(EXIT_FAILURE);
+	}
+	synth_set_frequency(synth, tone);
+	synth_set_volume(synth, volume);
+
+	FILE * file = fopen(path, "wb");
+	if (NULL == file) {
+		fprintf(stderr, "[EE] Can't open WAV file [%s]: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	uint8_t header[SYNTH_WAV_HEADER_SIZE] = { 0 };
+	fwrite(header, 1, sizeof (header), file); // Placeholder, size of data is not known yet.
+
+	struct timespec start = { 0 };
+	struct timespec stop = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int64_t const frames = synth_render_elements(synth, elements, count, write_frames, file);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	if (frames < 0) {
+		fprintf(stderr, "[EE] Failed to write WAV file [%s]\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	synth_wav_header(header, SYNTH_SAMPLE_RATE_DEFAULT, (uint32_t) frames);
+	if (0 != fseek(file, 0, SEEK_SET) || sizeof (header) != fwrite(header, 1, sizeof (header), file) || 0 != fclose(file)) {
+		fprintf(stderr, "[EE] Failed to write WAV file [%s]\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	double const audio_s = (double) frames / SYNTH_SAMPLE_RATE_DEFAULT;
+	double const render_s = (double) (stop.tv_sec - start.tv_sec) + (double) (stop.tv_nsec - start.tv_nsec) / 1e9;
+	printf("[II] %zu elements, %" PRId64 " frames (%.3f s of audio) rendered in %.3f ms (%.0fx real time)\n",
+	       count, frames, audio_s, render_s * 1000.0, render_s > 0 ? audio_s / render_s : 0.0);
+
+	free(synth);
+	free(elements);
+
+	exit(EXIT_SUCCESS);
+}
+
@@ -0,0 +1,410 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/// @file
+///
+/// State file with emulated modem-control lines of pseudo-terminals. See
+/// modem_lines.h for description of the emulation.
+///
+/// Writers of a slot serialize on a spinlock in the slot: critical
+/// sections are a few stores long, and the writers are processes that
+/// don't share any other synchronization primitive. Processes waiting for
+/// a change sleep on a futex in the shared mapping.
+
+
+
+
+#define _GNU_SOURCE /* syscall() */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "modem_lines.h"
+#include "src/vclock.h"
+
+
+
+
+static size_t modem_lines_file_size(void);
+static void modem_lines_lock(uint32_t * lock);
+static void modem_lines_unlock(uint32_t * lock);
+static unsigned int modem_lines_counters(modem_lines_side_t side, unsigned int mask);
+static unsigned int modem_lines_view(uint32_t const outputs[2], modem_lines_side_t side);
+
+
+
+
+static size_t modem_lines_file_size(void)
+{
+	return sizeof (modem_lines_file_header_t) + MODEM_LINES_SLOTS_COUNT * sizeof (modem_lines_slot_t);
+}
+
+
+
+
+int modem_lines_open(modem_lines_t * ml, char const * path)
+{
+	memset(ml, 0, sizeof (modem_lines_t));
+	if (NULL == path) {
+		path = getenv(MODEM_LINES_ENV_PATH);
+	}
+	if (NULL == path || '\0' == path[0]) {
+		path = MODEM_LINES_PATH_DEFAULT;
+	}
+
+	int const fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if (-1 == fd) {
+		return -1;
+	}
+	size_t const size = modem_lines_file_size();
+	struct stat st = { 0 };
+	if (0 != fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	if (0 == st.st_size) {
+		// New file. Let other users' processes use it too (e.g. file
+		// created by a program started with sudo), regardless of umask.
+		(void) fchmod(fd, 0666);
+	}
+	// Processes may race here; extending the file to the same size twice is harmless.
+	if ((size_t) st.st_size < size && 0 != ftruncate(fd, (off_t) size)) {
+		close(fd);
+		return -1;
+	}
+	void * const base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // The mapping stays valid after the file is closed.
+	if (MAP_FAILED == base) {
+		return -1;
+	}
+
+	modem_lines_file_header_t * const header = (modem_lines_file_header_t *) base;
+	if (0 == __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE)) {
+		// New file, filled with zeros. The stores are the same in all
+		// processes that may be initializing the file at the same time.
+		header->version = MODEM_LINES_VERSION;
+		header->slots_count = MODEM_LINES_SLOTS_COUNT;
+		header->trace_capacity = MODEM_LINES_TRACE_CAPACITY;
+		__atomic_store_n(&header->magic, MODEM_LINES_MAGIC, __ATOMIC_RELEASE);
+	}
+	if (MODEM_LINES_MAGIC != header->magic
+	    || MODEM_LINES_VERSION != header->version
+	    || MODEM_LINES_SLOTS_COUNT != header->slots_count
+	    || MODEM_LINES_TRACE_CAPACITY != header->trace_capacity) {
+
+		munmap(base, size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	ml->header = header;
+	ml->slots = (modem_lines_slot_t *) ((uint8_t *) base + sizeof (modem_lines_file_header_t));
+	ml->size = size;
+	return 0;
+}
+
+
+
+
+void modem_lines_close(modem_lines_t * ml)
+{
+	if (ml->header) {
+		munmap(ml->header, ml->size);
+	}
+	memset(ml, 0, sizeof (modem_lines_t));
+	return;
+}
+
+
+
+
+modem_lines_slot_t * modem_lines_slot(modem_lines_t * ml, unsigned int pty, bool create)
+{
+	uint32_t const id = pty + 1;
+	for (unsigned int i = 0; i < MODEM_LINES_SLOTS_COUNT; i++) {
+		if (id == __atomic_load_n(&ml->slots[i].pty, __ATOMIC_ACQUIRE)) {
+			return &ml->slots[i];
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+
+	// Look again under the lock: other process may have allocated a slot
+	// for the pty in the meantime.
+	modem_lines_slot_t * slot = NULL;
+	modem_lines_lock(&ml->header->lock);
+	for (unsigned int i = 0; i < MODEM_LINES_SLOTS_COUNT && NULL == slot; i++) {
+		if (id == ml->slots[i].pty) {
+			slot = &ml->slots[i];
+		}
+	}
+	for (unsigned int i = 0; i < MODEM_LINES_SLOTS_COUNT && NULL == slot; i++) {
+		if (0 == ml->slots[i].pty) {
+			slot = &ml->slots[i];
+			modem_lines_reset(slot);
+			__atomic_store_n(&slot->pty, id, __ATOMIC_RELEASE);
+		}
+	}
+	modem_lines_unlock(&ml->header->lock);
+
+	if (NULL == slot) {
+		errno = ENOSPC;
+	}
+	return slot;
+}
+
+
+
+
+void modem_lines_reset(modem_lines_slot_t * slot)
+{
+	modem_lines_lock(&slot->lock);
+	slot->outputs[MODEM_LINES_SIDE_SLAVE] = 0;
+	slot->outputs[MODEM_LINES_SIDE_MASTER] = 0;
+	slot->head = 0;
+	memset(slot->trace, 0, sizeof (slot->trace));
+	modem_lines_unlock(&slot->lock);
+	// Counters are not reset: a process waiting for a change must see a
+	// change of counters.
+	return;
+}
+
+
+
+
+unsigned int modem_lines_get(modem_lines_slot_t * slot, modem_lines_side_t side)
+{
+	uint32_t outputs[2];
+	outputs[MODEM_LINES_SIDE_SLAVE] = __atomic_load_n(&slot->outputs[MODEM_LINES_SIDE_SLAVE], __ATOMIC_ACQUIRE);
+	outputs[MODEM_LINES_SIDE_MASTER] = __atomic_load_n(&slot->outputs[MODEM_LINES_SIDE_MASTER], __ATOMIC_ACQUIRE);
+	return modem_lines_view(outputs, side);
+}
+
+
+
+
+void modem_lines_change(modem_lines_slot_t * slot, modem_lines_side_t side, unsigned int mask, unsigned int values)
+{
+	mask &= TIOCM_DTR | TIOCM_RTS;
+	values &= mask;
+
+	modem_lines_lock(&slot->lock);
+	uint32_t const old = slot->outputs[side];
+	uint32_t const new = (old & ~mask) | values;
+	if (new == old) {
+		modem_lines_unlock(&slot->lock);
+		return;
+	}
+	__atomic_store_n(&slot->outputs[side], new, __ATOMIC_RELEASE);
+
+	uint32_t const changed = old ^ new;
+	if (changed & TIOCM_DTR) {
+		__atomic_add_fetch(&slot->counts[2 * side], 1, __ATOMIC_RELEASE);
+	}
+	if (changed & TIOCM_RTS) {
+		__atomic_add_fetch(&slot->counts[2 * side + 1], 1, __ATOMIC_RELEASE);
+	}
+
+	uint64_t const now_ns = vclock_now_ns();
+	uint64_t const pos = slot->head;
+	modem_lines_record_t * const record = &slot->trace[pos & (MODEM_LINES_TRACE_CAPACITY - 1)];
+	__atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	record->timestamp_ns = now_ns;
+	record->lines = modem_lines_view(slot->outputs, MODEM_LINES_SIDE_SLAVE);
+	record->side = (uint32_t) side;
+	record->pid = (uint32_t) getpid();
+	__atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&slot->head, pos + 1, __ATOMIC_RELEASE);
+
+	__atomic_add_fetch(&slot->changes, 1, __ATOMIC_RELEASE);
+	modem_lines_unlock(&slot->lock);
+
+	syscall(SYS_futex, &slot->changes, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	return;
+}
+
+
+
+
+int modem_lines_wait(modem_lines_slot_t * slot, modem_lines_side_t side, unsigned int mask)
+{
+	unsigned int const counters = modem_lines_counters(side, mask);
+	if (0 == counters) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	uint32_t snapshot[4] = { 0 };
+	for (unsigned int i = 0; i < 4; i++) {
+		snapshot[i] = __atomic_load_n(&slot->counts[i], __ATOMIC_ACQUIRE);
+	}
+
+	while (true) {
+		// Read the futex word before the counters: a change made after
+		// the read makes futex wait return immediately.
+		uint32_t const changes = __atomic_load_n(&slot->changes, __ATOMIC_ACQUIRE);
+		for (unsigned int i = 0; i < 4; i++) {
+			if ((counters & (1u << i)) && snapshot[i] != __atomic_load_n(&slot->counts[i], __ATOMIC_ACQUIRE)) {
+				return 0;
+			}
+		}
+		if (0 != syscall(SYS_futex, &slot->changes, FUTEX_WAIT, changes, NULL, NULL, 0)
+		    && EAGAIN != errno) {
+			return -1; // EINTR, like TIOCMIWAIT interrupted by a signal.
+		}
+	}
+}
+
+
+
+
+int modem_lines_wait_record(modem_lines_slot_t * slot, uint64_t cursor)
+{
+	while (true) {
+		uint32_t const changes = __atomic_load_n(&slot->changes, __ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->head, __ATOMIC_ACQUIRE) > cursor) {
+			return 0;
+		}
+		if (0 != syscall(SYS_futex, &slot->changes, FUTEX_WAIT, changes, NULL, NULL, 0)
+		    && EAGAIN != errno) {
+			return -1;
+		}
+	}
+}
+
+
+
+
+size_t modem_lines_read(modem_lines_slot_t * slot, uint64_t * from, modem_lines_record_t * records, size_t size)
+{
+	uint64_t const head = __atomic_load_n(&slot->head, __ATOMIC_ACQUIRE);
+	uint64_t pos = *from;
+	if (pos > head) {
+		pos = head; // The ring has been reset.
+	}
+	if (head - pos > MODEM_LINES_TRACE_CAPACITY) {
+		pos = head - MODEM_LINES_TRACE_CAPACITY;
+	}
+
+	size_t n = 0;
+	for (; pos < head && n < size; pos++) {
+		modem_lines_record_t const * const record = &slot->trace[pos & (MODEM_LINES_TRACE_CAPACITY - 1)];
+
+		uint64_t const seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+		if (seq != pos + 1) {
+			continue; // Being written, or already overwritten.
+		}
+		modem_lines_record_t copy = *record;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq != __atomic_load_n(&record->seq, __ATOMIC_RELAXED)) {
+			continue; // Overwritten while we were copying it.
+		}
+		copy.seq = seq;
+		records[n++] = copy;
+	}
+
+	*from = pos;
+	return n;
+}
+
+
+
+
+static void modem_lines_lock(uint32_t * lock)
+{
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+		sched_yield();
+	}
+	return;
+}
+
+
+
+
+static void modem_lines_unlock(uint32_t * lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+	return;
+}
+
+
+
+
+/// @brief Get bits of counters of changes of output lines that are seen as
+/// lines in @p mask by @p side
+///
+/// DTR of a side is seen as DSR and CD by other side, RTS of a side is seen
+/// as CTS by other side.
+static unsigned int modem_lines_counters(modem_lines_side_t side, unsigned int mask)
+{
+	unsigned int const own = 2 * (unsigned int) side;
+	unsigned int const other = 2 * (unsigned int) !side;
+
+	unsigned int counters = 0;
+	if (mask & TIOCM_DTR) {
+		counters |= 1u << own;
+	}
+	if (mask & TIOCM_RTS) {
+		counters |= 1u << (own + 1);
+	}
+	if (mask & (TIOCM_DSR | TIOCM_CD)) {
+		counters |= 1u << other;
+	}
+	if (mask & TIOCM_CTS) {
+		counters |= 1u << (other + 1);
+	}
+	return counters;
+}
+
+
+
+
+static unsigned int modem_lines_view(uint32_t const outputs[2], modem_lines_side_t side)
+{
+	uint32_t const own = outputs[side];
+	uint32_t const other = outputs[!side];
+
+	unsigned int lines = own;
+	if (other & TIOCM_DTR) {
+		lines |= TIOCM_DSR | TIOCM_CD;
+	}
+	if (other & TIOCM_RTS) {
+		lines |= TIOCM_CTS;
+	}
+	return lines;
+}
@@ -0,0 +1,247 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef CWDAEMON_MODEM_LINES_H
+#define CWDAEMON_MODEM_LINES_H
+
+
+
+
+/// @file
+///
+/// Emulated modem-control lines of pseudo-terminals.
+///
+/// Linux ptys don't have modem-control lines: TIOCMGET, TIOCMBIS and
+/// similar ioctl()s fail on them, so tty cwdevice can't be tested without
+/// a real serial port. libcwdaemon_modem_lines.so (modem_lines_preload.c),
+/// loaded into cwdaemon and into test programs with LD_PRELOAD, serves the
+/// ioctl()s for ptys from a state file shared by all processes that use the
+/// ptys.
+///
+/// The pty is treated as a null-modem cable: DTR and RTS are outputs of
+/// each side, DTR of one side is seen as DSR and CD on the other side, and
+/// RTS of one side is seen as CTS on the other side. A process that opens
+/// the slave side (/dev/pts/N, e.g. cwdaemon and cwdevice observer) sees
+/// DTR and RTS set by any process that opened the slave side.
+///
+/// Each change of lines is recorded with CLOCK_MONOTONIC time stamp (or
+/// with time of virtual clock, see src/vclock.h) in a per-pty ring in the
+/// state file, and wakes up processes waiting in TIOCMIWAIT.
+///
+/// Layout of the state file:
+///
+/// <verbatim>
+///     modem_lines_file_header_t
+///     modem_lines_slot_t [MODEM_LINES_SLOTS_COUNT]
+/// </verbatim>
+
+
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+
+#define MODEM_LINES_MAGIC    0x4c4d5743u /**< "CWML" in a little-endian file. */
+#define MODEM_LINES_VERSION  1u
+
+#define MODEM_LINES_SLOTS_COUNT       16u /**< Count of ptys with emulated lines. */
+#define MODEM_LINES_TRACE_CAPACITY  4096u /**< Records in ring of a pty. Must be a power of two. */
+
+/// Name of environment variable with path to state file.
+#define MODEM_LINES_ENV_PATH      "CWDAEMON_MODEM_LINES"
+/// Path to state file used when the environment variable is not set.
+#define MODEM_LINES_PATH_DEFAULT  "/tmp/cwdaemon_modem_lines"
+
+
+
+
+/// Side of a pty.
+typedef enum {
+	MODEM_LINES_SIDE_SLAVE  = 0, /**< /dev/pts/N */
+	MODEM_LINES_SIDE_MASTER = 1, /**< /dev/ptmx */
+} modem_lines_side_t;
+
+
+
+
+/// A single change of lines, recorded in ring of a pty.
+typedef struct {
+	/// One-based position of the record in the ring. Zero when the
+	/// record is being written, or has never been written.
+	uint64_t seq;
+	uint64_t timestamp_ns; ///< CLOCK_MONOTONIC (or virtual clock) time stamp of the change.
+	uint32_t lines;        ///< TIOCM_* bits of all lines, as seen by slave side.
+	uint32_t side;         ///< modem_lines_side_t of side that made the change.
+	uint32_t pid;          ///< Process that made the change.
+	uint32_t reserved;
+} modem_lines_record_t;
+
+
+
+
+/// State of lines of a single pty.
+typedef struct {
+	uint32_t pty;        ///< Index of pty (N in /dev/pts/N) plus one. Zero for unused slot.
+	uint32_t lock;       ///< Spinlock guarding writes to the slot.
+
+	uint32_t outputs[2]; ///< TIOCM_DTR and TIOCM_RTS set by each side (modem_lines_side_t).
+
+	/// Futex word, incremented on every change. Processes waiting in
+	/// TIOCMIWAIT sleep on it.
+	uint32_t changes;
+
+	/// Count of changes of each output line: DTR and RTS of slave side,
+	/// DTR and RTS of master side.
+	uint32_t counts[4];
+
+	uint32_t reserved[7];
+	uint64_t head;       ///< Count of records written to the ring.
+	modem_lines_record_t trace[MODEM_LINES_TRACE_CAPACITY];
+} modem_lines_slot_t;
+
+
+
+
+/// Header at the beginning of the state file.
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots_count;
+	uint32_t trace_capacity;
+	uint32_t lock;       ///< Spinlock guarding allocation of slots.
+	uint32_t reserved[11];
+} modem_lines_file_header_t;
+
+
+
+
+/// Mapping of the state file in a process.
+typedef struct {
+	modem_lines_file_header_t * header;
+	modem_lines_slot_t * slots;
+	size_t size; ///< Size of mapped region.
+} modem_lines_t;
+
+
+
+
+/// @brief Map state file, create it if it doesn't exist
+///
+/// @param[out] ml Mapping of the file
+/// @param[in] path Path to the file. NULL selects value of
+/// MODEM_LINES_ENV_PATH environment variable or MODEM_LINES_PATH_DEFAULT.
+///
+/// @return 0 on success
+/// @return -1 on failure
+int modem_lines_open(modem_lines_t * ml, char const * path);
+
+
+
+
+void modem_lines_close(modem_lines_t * ml);
+
+
+
+
+/// @brief Get slot of given pty
+///
+/// @param ml Mapping of state file
+/// @param[in] pty Index of pty (N in /dev/pts/N)
+/// @param[in] create Whether to allocate the slot if the pty doesn't have one
+///
+/// @return slot of the pty
+/// @return NULL if the pty has no slot and @p create is false, or if all slots are used
+modem_lines_slot_t * modem_lines_slot(modem_lines_t * ml, unsigned int pty, bool create);
+
+
+
+
+/// @brief Clear lines and ring of a slot
+///
+/// Call this when the pty is created, so that state left by previous pty
+/// with the same index is not visible.
+void modem_lines_reset(modem_lines_slot_t * slot);
+
+
+
+
+/// @brief Get TIOCM_* bits of lines, as seen by given side
+unsigned int modem_lines_get(modem_lines_slot_t * slot, modem_lines_side_t side);
+
+
+
+
+/// @brief Change output lines (DTR, RTS) of given side
+///
+/// Other bits in @p mask are ignored, like by serial drivers. A change is
+/// recorded and waiters are woken up only if some line changes its state.
+///
+/// @param slot Slot of pty
+/// @param[in] side Side on which the lines are changed
+/// @param[in] mask TIOCM_* bits of lines to change
+/// @param[in] values New states of lines selected by @p mask
+void modem_lines_change(modem_lines_slot_t * slot, modem_lines_side_t side, unsigned int mask, unsigned int values);
+
+
+
+
+/// @brief Wait for change of any of given lines, as seen by given side
+///
+/// Unlike serial drivers, which only watch input lines in TIOCMIWAIT,
+/// this function also watches output lines, so that an observer on slave
+/// side can wait for DTR and RTS set by cwdaemon.
+///
+/// @return 0 when a line has changed
+/// @return -1 on errors, including interruption by signal (errno set to EINTR)
+int modem_lines_wait(modem_lines_slot_t * slot, modem_lines_side_t side, unsigned int mask);
+
+
+
+
+/// @brief Wait until ring of a pty has records at or after position @p cursor
+///
+/// @return 0 when the ring has such records
+/// @return -1 on errors, including interruption by signal (errno set to EINTR)
+int modem_lines_wait_record(modem_lines_slot_t * slot, uint64_t cursor);
+
+
+
+
+/// @brief Copy records from ring of a pty
+///
+/// Records are copied in order in which they were written, starting at
+/// position @p from (zero for oldest record still present in the ring).
+///
+/// @param slot Slot of pty
+/// @param[in,out] from Position of first record to copy, updated to position of next record
+/// @param[out] records Output buffer
+/// @param[in] size Count of records that fit into @p records
+///
+/// @return count of records copied to @p records
+size_t modem_lines_read(modem_lines_slot_t * slot, uint64_t * from, modem_lines_record_t * records, size_t size);
+
+
+
+
+#endif /* #ifndef CWDAEMON_MODEM_LINES_H */
@@ -0,0 +1,192 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/**
+   Interposer of ioctl() that emulates modem-control lines of
+   pseudo-terminals (see modem_lines.h).
+
+   Build result is libcwdaemon_modem_lines.so. Load it into cwdaemon and
+   into test programs observing cwdevice with LD_PRELOAD:
+
+   LD_PRELOAD=tools/libcwdaemon_modem_lines.so ./src/cwdaemon -n -d /dev/pts/3
+
+   TIOCMGET, TIOCMSET, TIOCMBIS, TIOCMBIC and TIOCMIWAIT called on a pty
+   (either side) are served from the state file. All other requests, and
+   all requests on other file descriptors, are passed to ioctl() of C
+   library.
+*/
+
+
+
+
+#define _GNU_SOURCE /* RTLD_NEXT */
+
+#include "config.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "modem_lines.h"
+
+
+
+
+/// Majors of slave sides of ptys (UNIX98_PTY_SLAVE_MAJOR and following majors).
+#define PTY_SLAVE_MAJOR_FIRST  136u
+#define PTY_SLAVE_MAJOR_LAST   143u
+/// Major and minor of /dev/ptmx.
+#define PTY_MASTER_MAJOR         5u
+#define PTY_MASTER_MINOR         2u
+
+
+
+
+typedef int (* ioctl_fn_t)(int fd, unsigned long request, ...);
+
+static ioctl_fn_t g_real_ioctl = NULL;
+static modem_lines_t g_modem_lines;
+static bool g_modem_lines_mapped = false;
+static pthread_once_t g_init_once = PTHREAD_ONCE_INIT;
+
+
+
+
+static void modem_lines_preload_init(void);
+static bool modem_lines_preload_pty(int fd, unsigned int * pty, modem_lines_side_t * side);
+
+
+
+
+static void modem_lines_preload_init(void)
+{
+	// ISO C doesn't allow casting object pointer to function pointer.
+	void * const symbol = dlsym(RTLD_NEXT, "ioctl");
+	memcpy(&g_real_ioctl, &symbol, sizeof (g_real_ioctl));
+	g_modem_lines_mapped = 0 == modem_lines_open(&g_modem_lines, NULL);
+	return;
+}
+
+
+
+
+/// @brief Get index and side of pty opened as @p fd
+///
+/// @return true if @p fd is a pty
+/// @return false otherwise
+static bool modem_lines_preload_pty(int fd, unsigned int * pty, modem_lines_side_t * side)
+{
+	struct stat st;
+	if (0 != fstat(fd, &st) || !S_ISCHR(st.st_mode)) {
+		return false;
+	}
+	unsigned int const maj = major(st.st_rdev);
+	unsigned int const min = minor(st.st_rdev);
+
+	if (maj >= PTY_SLAVE_MAJOR_FIRST && maj <= PTY_SLAVE_MAJOR_LAST) {
+		*pty = (maj - PTY_SLAVE_MAJOR_FIRST) * 256u + min;
+		*side = MODEM_LINES_SIDE_SLAVE;
+		return true;
+	}
+	if (PTY_MASTER_MAJOR == maj && PTY_MASTER_MINOR == min) {
+		unsigned int n = 0;
+		if (0 != g_real_ioctl(fd, TIOCGPTN, &n)) {
+			return false;
+		}
+		*pty = n;
+		*side = MODEM_LINES_SIDE_MASTER;
+		return true;
+	}
+	return false;
+}
+
+
+
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	va_start(ap, request);
+	void * const arg = va_arg(ap, void *);
+	va_end(ap);
+
+	pthread_once(&g_init_once, modem_lines_preload_init);
+	if (NULL == g_real_ioctl) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	switch (request) {
+	case TIOCMGET:
+	case TIOCMSET:
+	case TIOCMBIS:
+	case TIOCMBIC:
+	case TIOCMIWAIT:
+		break;
+	default:
+		return g_real_ioctl(fd, request, arg);
+	}
+
+	unsigned int pty = 0;
+	modem_lines_side_t side = MODEM_LINES_SIDE_SLAVE;
+	if (!g_modem_lines_mapped || !modem_lines_preload_pty(fd, &pty, &side)) {
+		return g_real_ioctl(fd, request, arg);
+	}
+	modem_lines_slot_t * const slot = modem_lines_slot(&g_modem_lines, pty, true);
+	if (NULL == slot) {
+		return -1;
+	}
+
+	if (TIOCMIWAIT == request) {
+		// Argument of TIOCMIWAIT is the mask itself, not a pointer.
+		return modem_lines_wait(slot, side, (unsigned int) (uintptr_t) arg);
+	}
+	if (NULL == arg) {
+		errno = EFAULT;
+		return -1;
+	}
+	int * const lines = arg;
+	switch (request) {
+	case TIOCMGET:
+		*lines = (int) modem_lines_get(slot, side);
+		break;
+	case TIOCMSET:
+		modem_lines_change(slot, side, TIOCM_DTR | TIOCM_RTS, (unsigned int) *lines);
+		break;
+	case TIOCMBIS:
+		modem_lines_change(slot, side, (unsigned int) *lines, (unsigned int) *lines);
+		break;
+	case TIOCMBIC:
+	default:
+		modem_lines_change(slot, side, (unsigned int) *lines, 0);
+		break;
+	}
+	return 0;
+}
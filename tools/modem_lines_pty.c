@@ -0,0 +1,170 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/**
+   Creator of pseudo-terminal with emulated modem-control lines (see
+   modem_lines.h), to be used as tty cwdevice of cwdaemon without a real
+   serial port.
+
+   The program creates a pty, clears lines of the pty in the state file,
+   prints path to slave side of the pty, and optionally creates a symbolic
+   link to the slave side (e.g. /dev/ttyCW0, so that the name can be
+   passed to "configure --with-tests-tty-cwdevice-name"). Then it prints
+   every change of lines of the pty, with time stamps, until it receives
+   SIGINT or SIGTERM. Data written to the pty by other processes is
+   discarded.
+
+   cwdaemon and test programs must be started with LD_PRELOAD pointing to
+   libcwdaemon_modem_lines.so, and with the same value of
+   CWDAEMON_MODEM_LINES environment variable (if it is set at all).
+
+   Usage: modem_lines_pty [path of symbolic link]
+*/
+
+
+
+
+#define _XOPEN_SOURCE 600 /* posix_openpt(), grantpt(), unlockpt(), ptsname(). */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "modem_lines.h"
+
+
+
+
+static volatile sig_atomic_t g_stop = 0;
+
+
+
+
+static void handle_signal(int sig)
+{
+	(void) sig;
+	g_stop = 1;
+}
+
+
+
+
+static void print_record(modem_lines_record_t const * r, uint64_t t0)
+{
+	printf("%14.6f ms  %s  DTR=%d RTS=%d CTS=%d DSR=%d CD=%d  pid=%" PRIu32 "\n",
+	       (double) (r->timestamp_ns - t0) / 1000000.0,
+	       MODEM_LINES_SIDE_MASTER == r->side ? "master" : "slave ",
+	       !!(r->lines & TIOCM_DTR), !!(r->lines & TIOCM_RTS), !!(r->lines & TIOCM_CTS),
+	       !!(r->lines & TIOCM_DSR), !!(r->lines & TIOCM_CD), r->pid);
+}
+
+
+
+
+int main(int argc, char * argv[])
+{
+	if (argc > 2) {
+		fprintf(stderr, "[EE] Call the program like this: %s [/dev/ttyCW0]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	char const * link_path = argc == 2 ? argv[1] : NULL;
+
+	int const master = posix_openpt(O_RDWR | O_NOCTTY);
+	char const * slave_path = NULL;
+	if (-1 == master || 0 != grantpt(master) || 0 != unlockpt(master) || NULL == (slave_path = ptsname(master))) {
+		fprintf(stderr, "[EE] Failed to create pseudo-terminal: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	unsigned int pty = 0;
+	if (1 != sscanf(slave_path, "/dev/pts/%u", &pty)) {
+		fprintf(stderr, "[EE] Unexpected path of pseudo-terminal [%s]\n", slave_path);
+		exit(EXIT_FAILURE);
+	}
+
+	modem_lines_t ml = { 0 };
+	modem_lines_slot_t * slot = NULL;
+	if (0 != modem_lines_open(&ml, NULL) || NULL == (slot = modem_lines_slot(&ml, pty, true))) {
+		fprintf(stderr, "[EE] Can't open state file of modem lines: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	modem_lines_reset(slot);
+
+	if (link_path) {
+		unlink(link_path);
+		if (0 != symlink(slave_path, link_path)) {
+			fprintf(stderr, "[EE] Can't create symbolic link [%s]: %s\n", link_path, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	struct sigaction sa = { 0 };
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("%s\n", slave_path);
+	fflush(stdout);
+
+	uint64_t t0 = 0;
+	uint64_t cursor = 0;
+	size_t count = 0;
+	while (!g_stop) {
+		struct pollfd pfd = { .fd = master, .events = POLLIN };
+		if (poll(&pfd, 1, 100) > 0 && (pfd.revents & POLLIN)) {
+			char discard[256];
+			if (read(master, discard, sizeof (discard)) < 0 && EINTR != errno) {
+				break;
+			}
+		}
+
+		modem_lines_record_t records[64];
+		size_t n = 0;
+		while (0 != (n = modem_lines_read(slot, &cursor, records, sizeof (records) / sizeof (records[0])))) {
+			for (size_t i = 0; i < n; i++) {
+				if (0 == count++) {
+					t0 = records[i].timestamp_ns;
+				}
+				print_record(&records[i], t0);
+			}
+		}
+		fflush(stdout);
+	}
+	fprintf(stderr, "[II] %zu change(s) of lines of [%s]\n", count, slave_path);
+
+	if (link_path) {
+		unlink(link_path);
+	}
+	modem_lines_close(&ml);
+	close(master);
+
+	exit(EXIT_SUCCESS);
+}
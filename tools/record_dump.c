@@ -0,0 +1,121 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/**
+   Decoder of file written by recording cwdevice of cwdaemon (cwdaemon
+   started with "-d record:<path>").
+
+   The program prints all edges present in the file in order in which they
+   were recorded, together with time elapsed since previous edge on the
+   same line (e.g. duration of a mark or a space on keying line).
+
+   Usage: record_dump <path to file>
+*/
+
+
+
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+#include "src/cwdaemon.h"
+#include "src/recorder.h"
+
+
+
+
+// Variables required by src/log.c.
+bool g_forking = false;
+FILE * cwdaemon_debug_f = NULL;
+char * cwdaemon_debug_f_path = NULL;
+options_t g_current_options = { .log_threshold = LOG_WARNING };
+
+
+
+
+static char const * line_label(uint32_t line)
+{
+	switch (line) {
+	case RECORDER_LINE_KEY:
+		return "KEY";
+	case RECORDER_LINE_PTT:
+		return "PTT";
+	case RECORDER_LINE_SSBWAY:
+		return "SSBWAY";
+	case RECORDER_LINE_BAND:
+		return "BAND";
+	case RECORDER_LINE_NONE:
+	default:
+		return "??";
+	}
+}
+
+
+
+
+int main(int argc, char * argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "[EE] Pass path to file. Call the program like this: %s /dev/shm/cwdaemon.rec\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	cwdaemon_debug_f = stderr;
+
+	recorder_map_t map = { 0 };
+	if (0 != recorder_map_open(&map, argv[1])) {
+		fprintf(stderr, "[EE] Can't open file [%s]\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t t0 = 0;
+	uint64_t previous_ts[RECORDER_LINE_BAND + 1] = { 0 };
+	size_t count = 0;
+	recorder_edge_t edges[256];
+	size_t n = 0;
+	while (0 != (n = recorder_map_read(&map, edges, sizeof (edges) / sizeof (edges[0])))) {
+		for (size_t i = 0; i < n; i++) {
+			recorder_edge_t const * e = &edges[i];
+			if (0 == count++) {
+				t0 = e->timestamp_ns;
+			}
+			printf("%14.6f ms  %-6s  value=%" PRIu32, (double) (e->timestamp_ns - t0) / 1000000.0, line_label(e->line), e->value);
+			if (e->line <= RECORDER_LINE_BAND && previous_ts[e->line]) {
+				printf("  (%" PRIu64 " us since previous edge)", (e->timestamp_ns - previous_ts[e->line]) / 1000);
+			}
+			printf("\n");
+			if (e->line <= RECORDER_LINE_BAND) {
+				previous_ts[e->line] = e->timestamp_ns;
+			}
+		}
+	}
+	printf("[II] %zu edge(s), %" PRIu64 " edge(s) lost\n", count, map.lost);
+
+	recorder_map_close(&map);
+
+	exit(EXIT_SUCCESS);
+}
+
@@ -0,0 +1,246 @@
+/*
+ * cwdaemon - morse sounding daemon for the parallel or serial port
+ * Copyright (C) 2012 - 2024 Kamil Ignacak <acerion@wp.pl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+
+
+/**
+   Decoder of trace file recorded by cwdaemon started with --tracefile
+   option.
+
+   The program merges records from all rings (threads) of the trace file,
+   prints them in chronological order, and then prints latencies of
+   requests: time from receiving a plain request to first keying edge, and
+   time from last keying edge to sending a reply, and latency of paddles:
+   time from press of a paddle to first keying edge and to end of I/O on
+   CW pin.
+
+   Usage: trace_dump <path to trace file>
+*/
+
+
+
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+#include "src/cwdaemon.h"
+#include "src/trace.h"
+
+
+
+
+// Variables required by src/log.c.
+bool g_forking = false;
+FILE * cwdaemon_debug_f = NULL;
+char * cwdaemon_debug_f_path = NULL;
+options_t g_current_options = { .log_threshold = LOG_WARNING };
+
+
+
+
+typedef struct {
+	trace_record_t record;
+	unsigned int ring;
+} entry_t;
+
+
+
+
+static int compare_entries(void const * a, void const * b)
+{
+	uint64_t const ta = ((entry_t const *) a)->record.timestamp_ns;
+	uint64_t const tb = ((entry_t const *) b)->record.timestamp_ns;
+	return (ta > tb) - (ta < tb);
+}
+
+
+
+
+static void print_entry(entry_t const * entry, uint64_t t0)
+{
+	trace_record_t const * r = &entry->record;
+	printf("%14.6f ms  thread %u  %-8s", (double) (r->timestamp_ns - t0) / 1000000.0, entry->ring, trace_event_label(r->event));
+
+	switch (r->event) {
+	case TRACE_EVENT_RECEIVE:
+	case TRACE_EVENT_REPLY:
+		printf("  bytes=%" PRIu32 "\n", r->arg0);
+		break;
+	case TRACE_EVENT_DISPATCH:
+		if (r->arg0) {
+			printf("  Escape request '%c'\n", (char) r->arg0);
+		} else {
+			printf("  plain request\n");
+		}
+		break;
+	case TRACE_EVENT_ENQUEUE:
+		printf("  char='%c'\n", (char) r->arg0);
+		break;
+	case TRACE_EVENT_KEY:
+		printf("  key=%" PRIu32 "\n", r->arg0);
+		break;
+	case TRACE_EVENT_PTT:
+		printf("  ptt=%" PRIu32 " flags=0x%02" PRIx32 "\n", r->arg0, r->arg1);
+		break;
+	case TRACE_EVENT_TQ_LOW:
+		printf("  tq_len=%" PRIu32 " flags=0x%02" PRIx32 "\n", r->arg0, r->arg1);
+		break;
+	case TRACE_EVENT_CW_IO:
+	case TRACE_EVENT_PTT_IO:
+		printf("  delay=%" PRIu32 " us io=%" PRIu32 " us\n", r->arg0, r->arg1);
+		break;
+	case TRACE_EVENT_PADDLE:
+		printf("  dot=%" PRIu32 " dash=%" PRIu32 "\n", r->arg0 & 0x01u, (r->arg0 >> 1) & 0x01u);
+		break;
+	case TRACE_EVENT_SUSPEND:
+		printf("  idle=%" PRIu32 " s\n", r->arg0);
+		break;
+	case TRACE_EVENT_RESUME:
+		printf("  open=%" PRIu32 " us\n", r->arg0);
+		break;
+	default:
+		printf("  arg0=%" PRIu32 " arg1=%" PRIu32 "\n", r->arg0, r->arg1);
+		break;
+	}
+}
+
+
+
+
+int main(int argc, char * argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "[EE] Pass path to trace file. Call the program like this: %s /dev/shm/cwdaemon.trace\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	cwdaemon_debug_f = stderr;
+
+	trace_map_t map = { 0 };
+	if (0 != trace_map_open(&map, argv[1])) {
+		fprintf(stderr, "[EE] Can't open trace file [%s]\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	unsigned int const rings = map.header->rings_used < map.header->rings_count ? map.header->rings_used : map.header->rings_count;
+	size_t const capacity = (size_t) map.header->rings_count * map.header->ring_capacity;
+	entry_t * entries = calloc(capacity, sizeof (entry_t));
+	trace_record_t * records = calloc(map.header->ring_capacity, sizeof (trace_record_t));
+	if (NULL == entries || NULL == records) {
+		fprintf(stderr, "[EE] Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	size_t count = 0;
+	for (unsigned int ring = 0; ring < rings; ring++) {
+		size_t const n = trace_map_read_ring(&map, ring, records, map.header->ring_capacity);
+		for (size_t i = 0; i < n; i++) {
+			entries[count].record = records[i];
+			entries[count].ring = ring;
+			count++;
+		}
+	}
+	printf("[II] %zu records from %u thread(s), %" PRIu64 " event(s) dropped\n", count, rings, map.header->dropped);
+	qsort(entries, count, sizeof (entry_t), compare_entries);
+
+	uint64_t const t0 = count ? entries[0].record.timestamp_ns : 0;
+	for (size_t i = 0; i < count; i++) {
+		print_entry(&entries[i], t0);
+	}
+
+	// Latencies of requests.
+	printf("\n");
+	uint64_t receive_ts = 0;    // Time stamp of most recent RECEIVE.
+	uint64_t pending_ts = 0;    // Time stamp of RECEIVE of plain request waiting for first key edge.
+	uint64_t last_key_ts = 0;
+	unsigned int request = 0;
+	uint64_t io_count = 0;
+	uint64_t io_total_us = 0;
+	uint32_t io_max_us = 0;
+	uint32_t io_delay_max_us = 0;
+	uint64_t paddle_ts = 0;     // Time stamp of press of paddle waiting for key edge.
+	uint64_t paddle_key_ts = 0; // Time stamp of the key edge waiting for end of I/O on CW pin.
+	uint32_t paddles = 0;
+	for (size_t i = 0; i < count; i++) {
+		trace_record_t const * r = &entries[i].record;
+		switch (r->event) {
+		case TRACE_EVENT_RECEIVE:
+			receive_ts = r->timestamp_ns;
+			break;
+		case TRACE_EVENT_DISPATCH:
+			if (0 == r->arg0 && 0 == pending_ts) {
+				pending_ts = receive_ts;
+			}
+			break;
+		case TRACE_EVENT_KEY:
+			if (r->arg0 && pending_ts) {
+				printf("[II] request #%u: receive -> first key edge: %" PRIu64 " us\n", request++, (r->timestamp_ns - pending_ts) / 1000);
+				pending_ts = 0;
+			}
+			if (r->arg0 && paddle_ts) {
+				printf("[II] paddle: press -> key edge: %" PRIu64 " us\n", (r->timestamp_ns - paddle_ts) / 1000);
+				paddle_key_ts = paddle_ts;
+				paddle_ts = 0;
+			}
+			last_key_ts = r->timestamp_ns;
+			break;
+		case TRACE_EVENT_REPLY:
+			if (last_key_ts) {
+				printf("[II] reply: last key edge -> reply: %" PRIu64 " us\n", (r->timestamp_ns - last_key_ts) / 1000);
+			}
+			break;
+		case TRACE_EVENT_PADDLE:
+			if (r->arg0 && 0 == paddles) {
+				paddle_ts = r->timestamp_ns; // First press after all paddles have been released.
+			}
+			paddles = r->arg0;
+			break;
+		case TRACE_EVENT_CW_IO:
+			if (paddle_key_ts) {
+				printf("[II] paddle: press -> end of I/O on CW pin: %" PRIu64 " us\n", (r->timestamp_ns - paddle_key_ts) / 1000);
+				paddle_key_ts = 0;
+			}
+			// fall through
+		case TRACE_EVENT_PTT_IO:
+			io_count++;
+			io_total_us += r->arg1;
+			io_max_us = r->arg1 > io_max_us ? r->arg1 : io_max_us;
+			io_delay_max_us = r->arg0 > io_delay_max_us ? r->arg0 : io_delay_max_us;
+			break;
+		default:
+			break;
+		}
+	}
+	if (io_count) {
+		printf("[II] pin I/O: %" PRIu64 " operations, time of I/O avg/max: %" PRIu64 "/%" PRIu32 " us, max queue delay: %" PRIu32 " us\n",
+		       io_count, io_total_us / io_count, io_max_us, io_delay_max_us);
+	}
+
+	free(records);
+	free(entries);
+	trace_map_close(&map);
+
+	exit(EXIT_SUCCESS);
+}
+